@@ -0,0 +1,238 @@
+/// IndiBinaryCodec.cpp
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+#include <map>
+#include <sys/time.h>
+#include "IndiBinaryCodec.hpp"
+#include "IndiElement.hpp"
+#include "TimeStamp.hpp"
+
+using std::string;
+using std::vector;
+using std::map;
+using pcf::TimeStamp;
+using pcf::IndiElement;
+using pcf::IndiProperty;
+using pcf::IndiMessage;
+using pcf::IndiBinaryCodec;
+
+////////////////////////////////////////////////////////////////////////////////
+/// Encodes the message, replacing the contents of 'vecOut'. The vector is
+/// not shrunk, so re-using the same one avoids allocations.
+
+void IndiBinaryCodec::encode( const IndiMessage &imSend,
+                              vector<unsigned char> &vecOut )
+{
+  const IndiProperty &ipSend = imSend.getProperty();
+
+  vecOut.clear();
+
+  putU8( vecOut, Magic );
+  putU8( vecOut, Version );
+  putU8( vecOut, imSend.getType() );
+  putU8( vecOut, ipSend.getType() );
+  putU8( vecOut, ipSend.getState() );
+  putU8( vecOut, ipSend.getPerm() );
+  putU8( vecOut, ipSend.getRule() );
+  putU8( vecOut, ipSend.getBLOBEnable() );
+  putU8( vecOut, ipSend.isRequested() ? 1 : 0 );
+
+  double xTimeout = ipSend.getTimeout();
+  putRaw( vecOut, &xTimeout, sizeof( xTimeout ) );
+
+  const timeval &tv = ipSend.getTimeStamp().getTimeVal();
+  int64_t lSecs = tv.tv_sec;
+  int32_t iMicros = tv.tv_usec;
+  putRaw( vecOut, &lSecs, sizeof( lSecs ) );
+  putRaw( vecOut, &iMicros, sizeof( iMicros ) );
+
+  putString( vecOut, ipSend.getDevice() );
+  putString( vecOut, ipSend.getName() );
+  putString( vecOut, ipSend.getLabel() );
+  putString( vecOut, ipSend.getGroup() );
+  putString( vecOut, ipSend.getMessage() );
+  putString( vecOut, ipSend.getVersion() );
+
+  const map<string, IndiElement> &mapElements = ipSend.getElements();
+  uint32_t uiNumElements = mapElements.size();
+  putRaw( vecOut, &uiNumElements, sizeof( uiNumElements ) );
+
+  map<string, IndiElement>::const_iterator itr = mapElements.begin();
+  for ( ; itr != mapElements.end(); ++itr )
+  {
+    const IndiElement &ieSend = itr->second;
+    putString( vecOut, ieSend.getName() );
+    putString( vecOut, ieSend.getLabel() );
+    putString( vecOut, ieSend.getFormat() );
+    putString( vecOut, ieSend.getMin() );
+    putString( vecOut, ieSend.getMax() );
+    putString( vecOut, ieSend.getStep() );
+    putString( vecOut, ieSend.getSize() );
+    putString( vecOut, ieSend.getValue() );
+    putU8( vecOut, ieSend.getLightState() );
+    putU8( vecOut, ieSend.getSwitchState() );
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Decodes a record. Returns false if the record is malformed, in which
+/// case 'imRecv' is not modified.
+
+bool IndiBinaryCodec::decode( const unsigned char *pData,
+                              const size_t &uiSize,
+                              IndiMessage &imRecv )
+{
+  const unsigned char *pEnd = pData + uiSize;
+
+  uint8_t pucHeader[9];
+  if ( getRaw( pData, pEnd, pucHeader, sizeof( pucHeader ) ) == false )
+    return false;
+  if ( pucHeader[0] != Magic || pucHeader[1] != Version )
+    return false;
+  if ( pucHeader[2] > IndiMessage::SetProperty || pucHeader[3] > IndiProperty::Text )
+    return false;
+  if ( pucHeader[4] > IndiProperty::Idle || pucHeader[5] > IndiProperty::WriteOnly ||
+       pucHeader[6] > IndiProperty::OneOfMany || pucHeader[7] > IndiProperty::Never ||
+       pucHeader[8] > 1 )
+    return false;
+
+  IndiProperty ipRecv( ( IndiProperty::Type )( pucHeader[3] ) );
+  ipRecv.setState( ( IndiProperty::PropertyStateType )( pucHeader[4] ) );
+  ipRecv.setPerm( ( IndiProperty::PropertyPermType )( pucHeader[5] ) );
+  ipRecv.setRule( ( IndiProperty::SwitchRuleType )( pucHeader[6] ) );
+  ipRecv.setBLOBEnable( ( IndiProperty::BLOBEnableType )( pucHeader[7] ) );
+  ipRecv.setRequested( pucHeader[8] != 0 );
+
+  double xTimeout = 0;
+  int64_t lSecs = 0;
+  int32_t iMicros = 0;
+  if ( getRaw( pData, pEnd, &xTimeout, sizeof( xTimeout ) ) == false ||
+       getRaw( pData, pEnd, &lSecs, sizeof( lSecs ) ) == false ||
+       getRaw( pData, pEnd, &iMicros, sizeof( iMicros ) ) == false )
+    return false;
+  if ( iMicros < 0 || iMicros >= 1000000 )
+    return false;
+  ipRecv.setTimeout( xTimeout );
+
+  string szValue;
+  if ( getString( pData, pEnd, szValue ) == false ) return false;
+  ipRecv.setDevice( szValue );
+  if ( getString( pData, pEnd, szValue ) == false ) return false;
+  ipRecv.setName( szValue );
+  if ( getString( pData, pEnd, szValue ) == false ) return false;
+  ipRecv.setLabel( szValue );
+  if ( getString( pData, pEnd, szValue ) == false ) return false;
+  ipRecv.setGroup( szValue );
+  if ( getString( pData, pEnd, szValue ) == false ) return false;
+  ipRecv.setMessage( szValue );
+  if ( getString( pData, pEnd, szValue ) == false ) return false;
+  ipRecv.setVersion( szValue );
+
+  uint32_t uiNumElements = 0;
+  if ( getRaw( pData, pEnd, &uiNumElements, sizeof( uiNumElements ) ) == false )
+    return false;
+
+  for ( uint32_t ii = 0; ii < uiNumElements; ii++ )
+  {
+    IndiElement ieRecv;
+    if ( getString( pData, pEnd, szValue ) == false ) return false;
+    ieRecv.setName( szValue );
+    if ( getString( pData, pEnd, szValue ) == false ) return false;
+    ieRecv.setLabel( szValue );
+    if ( getString( pData, pEnd, szValue ) == false ) return false;
+    ieRecv.setFormat( szValue );
+    if ( getString( pData, pEnd, szValue ) == false ) return false;
+    ieRecv.setMin( szValue );
+    if ( getString( pData, pEnd, szValue ) == false ) return false;
+    ieRecv.setMax( szValue );
+    if ( getString( pData, pEnd, szValue ) == false ) return false;
+    ieRecv.setStep( szValue );
+    if ( getString( pData, pEnd, szValue ) == false ) return false;
+    ieRecv.setSize( szValue );
+    if ( getString( pData, pEnd, szValue ) == false ) return false;
+    ieRecv.setValue( szValue );
+
+    uint8_t pucStates[2];
+    if ( getRaw( pData, pEnd, pucStates, sizeof( pucStates ) ) == false )
+      return false;
+    if ( pucStates[0] > IndiElement::Alert || pucStates[1] > IndiElement::On )
+      return false;
+    ieRecv.setLightState( ( IndiElement::LightStateType )( pucStates[0] ) );
+    ieRecv.setSwitchState( ( IndiElement::SwitchStateType )( pucStates[1] ) );
+
+    // 'add' throws on a repeated name.
+    if ( ipRecv.getElements().count( ieRecv.getName() ) > 0 )
+      return false;
+    ipRecv.add( ieRecv );
+  }
+
+  // Anything left over means the record is not what we think it is.
+  if ( pData != pEnd )
+    return false;
+
+  // This goes after the elements, since adding one sets the time stamp.
+  timeval tv;
+  tv.tv_sec = lSecs;
+  tv.tv_usec = iMicros;
+  ipRecv.setTimeStamp( TimeStamp( tv ) );
+
+  imRecv = IndiMessage( ( IndiMessage::Type )( pucHeader[2] ), ipRecv );
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void IndiBinaryCodec::putU8( vector<unsigned char> &vecOut, const uint8_t &uiValue )
+{
+  vecOut.push_back( uiValue );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void IndiBinaryCodec::putRaw( vector<unsigned char> &vecOut,
+                              const void *pValue, const size_t &uiSize )
+{
+  const unsigned char *pucValue = static_cast<const unsigned char *>( pValue );
+  vecOut.insert( vecOut.end(), pucValue, pucValue + uiSize );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void IndiBinaryCodec::putString( vector<unsigned char> &vecOut,
+                                 const string &szValue )
+{
+  uint32_t uiLen = szValue.size();
+  putRaw( vecOut, &uiLen, sizeof( uiLen ) );
+  putRaw( vecOut, szValue.data(), uiLen );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool IndiBinaryCodec::getRaw( const unsigned char *&pData, const unsigned char *pEnd,
+                              void *pValue, const size_t &uiSize )
+{
+  if ( ( size_t )( pEnd - pData ) < uiSize )
+    return false;
+  ::memcpy( pValue, pData, uiSize );
+  pData += uiSize;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool IndiBinaryCodec::getString( const unsigned char *&pData, const unsigned char *pEnd,
+                                 string &szValue )
+{
+  uint32_t uiLen = 0;
+  if ( getRaw( pData, pEnd, &uiLen, sizeof( uiLen ) ) == false )
+    return false;
+  if ( ( size_t )( pEnd - pData ) < uiLen )
+    return false;
+  szValue.assign( reinterpret_cast<const char *>( pData ), uiLen );
+  pData += uiLen;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
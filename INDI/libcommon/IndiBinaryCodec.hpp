@@ -0,0 +1,72 @@
+/// IndiBinaryCodec.hpp
+///
+/// Encodes and decodes an IndiMessage to and from a compact binary record.
+/// This is used on the local shared memory transport between a driver and
+/// xindidriver, so no XML needs to be generated or parsed by the driver.
+///
+/// The record layout is (host byte order, since the transport is local):
+///   u8  magic, u8 version, u8 message type, u8 property type,
+///   u8  state, u8 perm, u8 rule, u8 BLOB enable, u8 requested,
+///   f64 timeout, i64 timestamp secs, i32 timestamp usecs,
+///   str device, name, label, group, message, version,
+///   u32 number of elements, then for each element:
+///     str name, label, format, min, max, step, size, value,
+///     u8 light state, u8 switch state.
+/// A 'str' is a u32 length followed by the bytes (no terminator).
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INDI_BINARY_CODEC_HPP
+#define INDI_BINARY_CODEC_HPP
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "IndiMessage.hpp"
+#include "IndiProperty.hpp"
+
+namespace pcf
+{
+class IndiBinaryCodec
+{
+  public:
+    enum Constants
+    {
+      // The first byte of every record.
+      Magic = 0xB1,
+      // Bumped whenever the layout changes.
+      Version = 1,
+    };
+
+  // Construction/destruction.
+  private:
+    /// This class only has static methods.
+    IndiBinaryCodec();
+
+  public:
+    /// Encodes the message, replacing the contents of 'vecOut'.
+    static void encode( const pcf::IndiMessage &imSend,
+                        std::vector<unsigned char> &vecOut );
+    /// Decodes a record. Returns false if the record is malformed, in
+    /// which case 'imRecv' is not modified.
+    static bool decode( const unsigned char *pData,
+                        const size_t &uiSize,
+                        pcf::IndiMessage &imRecv );
+
+  // Helper functions.
+  private:
+    static void putU8( std::vector<unsigned char> &vecOut, const uint8_t &uiValue );
+    static void putRaw( std::vector<unsigned char> &vecOut,
+                        const void *pValue, const size_t &uiSize );
+    static void putString( std::vector<unsigned char> &vecOut,
+                           const std::string &szValue );
+    static bool getRaw( const unsigned char *&pData, const unsigned char *pEnd,
+                        void *pValue, const size_t &uiSize );
+    static bool getString( const unsigned char *&pData, const unsigned char *pEnd,
+                           std::string &szValue );
+
+}; // class IndiBinaryCodec
+} // namespace pcf
+
+#endif // INDI_BINARY_CODEC_HPP
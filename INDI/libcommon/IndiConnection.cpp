@@ -14,8 +14,11 @@
 #include <sys/stat.h>  // provides 'umask'
 #include <sys/time.h>  // provides 'setrlimit'
 #include <sys/resource.h>  // provides 'setrlimit'
+#include <poll.h>
+#include <fcntl.h>
 #include "IndiConnection.hpp"
 #include "TimeStamp.hpp"
+#include "IndiBinaryCodec.hpp"
 
 using std::exception;
 using std::runtime_error;
@@ -26,8 +29,11 @@ using std::endl;
 using pcf::TimeStamp;
 using pcf::IndiConnection;
 using pcf::IndiXmlParser;
+using pcf::IndiXmlStreamParser;
 using pcf::IndiMessage;
 using pcf::IndiProperty;
+using pcf::IndiShmRing;
+using pcf::IndiBinaryCodec;
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -83,6 +89,10 @@ const IndiConnection &IndiConnection::operator= ( const IndiConnection &idRhs )
 
 IndiConnection::~IndiConnection()
 {
+  if ( m_fdWake[0] >= 0 )
+    ::close( m_fdWake[0] );
+  if ( m_fdWake[1] >= 0 )
+    ::close( m_fdWake[1] );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -106,6 +116,24 @@ void IndiConnection::construct( const string &szName,
   m_fdInput = STDIN_FILENO;
   m_fdOutput = STDOUT_FILENO;
 
+  // This is written to by 'quitProcess' to wake up 'process'.
+  m_fdWake[0] = -1;
+  m_fdWake[1] = -1;
+  if ( ::pipe( m_fdWake ) == 0 )
+  {
+    ::fcntl( m_fdWake[0], F_SETFL, O_NONBLOCK );
+    ::fcntl( m_fdWake[1], F_SETFL, O_NONBLOCK );
+    ::fcntl( m_fdWake[0], F_SETFD, FD_CLOEXEC );
+    ::fcntl( m_fdWake[1], F_SETFD, FD_CLOEXEC );
+  }
+
+  // 'update' is called at least this often.
+  m_nUpdateMillis = 1000;
+
+  // No shared memory transport unless one is set.
+  m_pShmInput = NULL;
+  m_pShmOutput = NULL;
+
   // setup the signal handler.
   //::signal( SIGHUP, IndiConnection::handleSignal );
   //::signal( SIGINT, IndiConnection::handleSignal );
@@ -272,32 +300,28 @@ void IndiConnection::process()
       // this loop reading input.
       update();
 
-      // The length of the command received.
-      int nInputBufLen = 0;
-      ::memset( &m_vecInputBuf[0], 0, InputBufSize );
-
-      // Create and clear out the FD set.
-      fd_set fdsRead;
-      FD_ZERO( &fdsRead );
-      // Watch input to see when we get some input.
-      FD_SET( m_fdInput, &fdsRead );
-
-      // The argument to 'select' must be +1 greater than the largest fd.
-      int nHighestNumberedFd = m_fdInput;
+      // With a ring there is no XML to parse.
+      if ( m_pShmInput != NULL )
+      {
+        processRing();
+        continue;
+      }
 
-      // Set the timeout on the select call.
-      timeval tv;
-      tv.tv_sec = 1; //0;
-      tv.tv_usec = 0; //10000;
+      // Wait for input, or for 'quitProcess' to wake us up. Unless 'update'
+      // needs to be called regularly this blocks until something happens.
+      pollfd pfdWait[2];
+      pfdWait[0].fd = m_fdInput;
+      pfdWait[0].events = POLLIN;
+      pfdWait[0].revents = 0;
+      pfdWait[1].fd = m_fdWake[0];
+      pfdWait[1].events = POLLIN;
+      pfdWait[1].revents = 0;
 
-      // We need a timeout on the select to ensure that we loop around and
-      // call the 'update' function regularly.
-      int nRetval = ::select( nHighestNumberedFd + 1, &fdsRead, NULL, NULL, &tv );
-      //int nRetval = ::select( nHighestNumberedFd+1, &fdsRead, NULL, NULL, NULL );
+      int nRetval = ::poll( pfdWait, 2, m_nUpdateMillis );
 
       if ( nRetval == -1 )
       {
-        if ( m_oQuitProcess == false )
+        if ( errno != EINTR && m_oQuitProcess == false )
         {
           Thread::sleep( 1 );
         }
@@ -307,13 +331,14 @@ void IndiConnection::process()
         // Timed out - just loop back around.
       }
       // We must check the input file descriptor.
-      else if ( FD_ISSET( m_fdInput, &fdsRead ) != 0 )
+      else if ( pfdWait[0].revents != 0 )
       {
         // Receive a command
-        nInputBufLen = ::read( m_fdInput, &m_vecInputBuf[0], InputBufSize );
+        int nInputBufLen = ::read( m_fdInput, &m_vecInputBuf[0], InputBufSize );
         if ( nInputBufLen < 0 )
         {
-          m_oQuitProcess = true;
+          if ( errno != EINTR && errno != EAGAIN )
+            m_oQuitProcess = true;
         }
         else if ( nInputBufLen == 0 )
         {
@@ -324,23 +349,25 @@ void IndiConnection::process()
         {
           // A message for the error.
           std::string szErrorMsg;
-          // Now, is this a command which fits our requirements?
-          m_ixpIndi.parseXml( ( char * )( &m_vecInputBuf[0] ), nInputBufLen, szErrorMsg );
+          const char *pcInput = ( const char * )( &m_vecInputBuf[0] );
+          unsigned int uiParsed = 0;
 
-          while( m_ixpIndi.getState() == IndiXmlParser::CompleteState )
+          // The parser picks up where it left off, so each message is
+          // dispatched as soon as it is complete, and nothing is copied.
+          while ( uiParsed < ( unsigned int )( nInputBufLen ) )
           {
-            // Create the message from the XML.
-            IndiMessage imRecv = m_ixpIndi.createIndiMessage();
-            const IndiProperty &ipRecv = imRecv.getProperty();
-
-            // Dispatch!
-            dispatch( imRecv.getType(), ipRecv );
-
-            // Get ready for some new XML.
-            //m_ixpIndi.clear();
-
-            //Test whether there is more unparsed data.
-            m_ixpIndi.parseXml( "", szErrorMsg);
+            uiParsed += m_ixsIndi.parseXml( pcInput + uiParsed,
+                                            nInputBufLen - uiParsed,
+                                            szErrorMsg );
+
+            if ( m_ixsIndi.getState() == IndiXmlStreamParser::CompleteState )
+            {
+              // Create the message from the XML.
+              IndiMessage imRecv = m_ixsIndi.createIndiMessage();
+
+              // Dispatch!
+              dispatch( imRecv.getType(), imRecv.getProperty() );
+            }
           }
         }
       }
@@ -355,6 +382,74 @@ void IndiConnection::process()
 
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// \brief IndiConnection::processRing
+/// Waits for a record on the input ring, then decodes and dispatches it.
+/// The ring can not be woken by 'quitProcess', so this always times out
+/// after at most one second.
+
+void IndiConnection::processRing()
+{
+  int nMillis = ( m_nUpdateMillis < 0 || m_nUpdateMillis > 1000 ) ? ( 1000 ) : ( m_nUpdateMillis );
+  int nRetval = m_pShmInput->read( m_vecShmInput, nMillis );
+
+  if ( nRetval < 0 )
+  {
+    if ( m_oQuitProcess == false )
+    {
+      Thread::sleep( 1 );
+    }
+  }
+  else if ( nRetval > 0 )
+  {
+    IndiMessage imRecv;
+    if ( IndiBinaryCodec::decode( &m_vecShmInput[0], m_vecShmInput.size(), imRecv ) == true )
+    {
+      // Dispatch!
+      dispatch( imRecv.getType(), imRecv.getProperty() );
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \brief IndiConnection::sendIndiMessage
+/// Sends a message. If an output ring is set, the message is written to it
+/// in binary form, otherwise it is converted to XML and sent with 'sendXml'.
+/// A message the ring drops is reported on stderr.
+/// \param imSend The message to send.
+
+void IndiConnection::sendIndiMessage( const IndiMessage &imSend ) const
+{
+  if ( m_pShmOutput != NULL )
+  {
+    MutexLock::AutoLock autoOut( &m_mutOutput );
+    IndiBinaryCodec::encode( imSend, m_vecShmOutput );
+    if ( m_pShmOutput->write( &m_vecShmOutput[0], m_vecShmOutput.size() ) == false )
+    {
+      // A message that can never fit is always reported, but a stalled
+      // reader only once, not for every message dropped while it is stalled.
+      int nErr = errno;
+      if ( nErr == EMSGSIZE )
+      {
+        std::cerr << "Dropped " << imSend.getProperty().createUniqueKey() << ": "
+                  << m_vecShmOutput.size() << " bytes is more than the "
+                  << m_pShmOutput->getMaxRecordSize() << " that fit in "
+                  << m_pShmOutput->getName() << "." << std::endl;
+      }
+      else if ( nErr == ETIMEDOUT )
+      {
+        std::cerr << "Dropped " << imSend.getProperty().createUniqueKey() << ": "
+                  << m_pShmOutput->getName() << " is full, and its reader is not keeping up." << std::endl;
+      }
+    }
+  }
+  else
+  {
+    IndiXmlParser ixp( imSend, getProtocolVersion() );
+    sendXml( ixp.createXmlString() );
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// \brief IndiConnection::sendXml
 /// Sends an XML string out to a file descriptor. If there is an error,
@@ -411,6 +506,27 @@ void IndiConnection::setOutputFd( const int &iFd )
   m_fdOutput = iFd;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// \brief setInputRing
+/// Read binary messages from a shared memory ring instead of the input FD.
+/// \param pRing The ring to use, which is not owned by this. NULL for the FD.
+
+void IndiConnection::setInputRing( IndiShmRing *pRing )
+{
+  m_pShmInput = pRing;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \brief setOutputRing
+/// Write binary messages to a shared memory ring instead of the output FD.
+/// \param pRing The ring to use, which is not owned by this. NULL for the FD.
+
+void IndiConnection::setOutputRing( IndiShmRing *pRing )
+{
+  MutexLock::AutoLock autoOut( &m_mutOutput );
+  m_pShmOutput = pRing;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// \brief IndiConnection::setName
 /// Sets the name of this component.
@@ -458,7 +574,7 @@ string IndiConnection::getVersion() const
 
 void IndiConnection::setProtocolVersion( const string &ProtocolVersion )
 {
-  m_ixpIndi.setProtocolVersion( ProtocolVersion );
+  m_szProtocolVersion = ProtocolVersion;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -468,7 +584,7 @@ void IndiConnection::setProtocolVersion( const string &ProtocolVersion )
 
 string IndiConnection::getProtocolVersion() const
 {
-  return m_ixpIndi.getProtocolVersion();
+  return m_szProtocolVersion;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -478,6 +594,39 @@ string IndiConnection::getProtocolVersion() const
 void IndiConnection::quitProcess()
 {
   m_oQuitProcess = true;
+
+  // Don't let a sender wait on a reader which may already be gone.
+  if ( m_pShmOutput != NULL )
+    m_pShmOutput->interrupt();
+
+  // Wake up 'process' if it is waiting.
+  if ( m_fdWake[1] >= 0 )
+  {
+    char cWake = 0;
+    ssize_t nWritten = ::write( m_fdWake[1], &cWake, 1 );
+    static_cast<void>( nWritten );
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \brief IndiConnection::setUpdateInterval
+/// Sets the longest time 'process' waits for input before calling 'update'.
+/// \param nMillis The time in milliseconds. If negative, 'process' blocks
+/// until there is input or 'quitProcess' is called.
+
+void IndiConnection::setUpdateInterval( const int &nMillis )
+{
+  m_nUpdateMillis = nMillis;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \brief IndiConnection::getUpdateInterval
+/// Returns the longest time 'process' waits for input before calling 'update'.
+/// \return The time in milliseconds, negative if 'process' blocks.
+
+int IndiConnection::getUpdateInterval() const
+{
+  return m_nUpdateMillis;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
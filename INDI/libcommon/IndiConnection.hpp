@@ -17,8 +17,10 @@
 #include "TimeStamp.hpp"
 //#include "ConfigFile.hpp"
 #include "IndiXmlParser.hpp"
+#include "IndiXmlStreamParser.hpp"
 #include "IndiMessage.hpp"
 #include "IndiProperty.hpp"
+#include "IndiShmRing.hpp"
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -57,6 +59,8 @@ class IndiConnection : public pcf::Thread
     /// Listens on the file descriptor in a loop for incoming INDI messages.
     /// Exits when the 'Quit Process' flag becomes true.
     void process();
+    /// Reads one record from the input ring and dispatches it.
+    void processRing();
 
   // Standard client interface methods.
   public:
@@ -103,13 +107,23 @@ class IndiConnection : public pcf::Thread
     /// Sends an XML string out to a file descriptor. If there is an error,
     /// it will be logged.
     virtual void sendXml( const std::string &szXml ) const;
+    /// Sends a message. If an output ring is set, the message is written to
+    /// it in binary form, otherwise it is converted to XML and sent with
+    /// 'sendXml'.
+    void sendIndiMessage( const pcf::IndiMessage &imSend ) const;
 
     /// Which FD will be used for input?
     void setInputFd( const int &iFd );
+    /// Read binary messages from a shared memory ring instead of the input
+    /// FD. The ring is not owned by this object. NULL goes back to the FD.
+    void setInputRing( pcf::IndiShmRing *pRing );
     /// Set the name of this component.
     void setName( const std::string &szName );
     /// Which FD will be used for output?
     void setOutputFd( const int &iFd );
+    /// Write binary messages to a shared memory ring instead of XML to the
+    /// output FD. The ring is not owned by this object. NULL goes back to the FD.
+    void setOutputRing( pcf::IndiShmRing *pRing );
     /// Set the version of the INDI protocol.
     void setProtocolVersion( const std::string &szProtocolVersion );
     /// Sets the INDI protocol version.
@@ -119,6 +133,11 @@ class IndiConnection : public pcf::Thread
     virtual void update() = 0;
     /// This will cause the process to quit, the same as if a ctrl-c was sent.
     void quitProcess();
+    /// Sets the longest time 'process' waits for input before calling
+    /// 'update'. If negative, it waits until there is input. Default 1000.
+    void setUpdateInterval( const int &nMillis );
+    /// Returns the longest time 'process' waits for input before calling 'update'.
+    int getUpdateInterval() const;
 
     bool getQuitProcess() 
     {
@@ -149,14 +168,28 @@ class IndiConnection : public pcf::Thread
     //Changed from static to prevent app-wide INDI shutdown.
     bool m_oQuitProcess {false};
     
-    /// This is the object that conglomerates all the INDI XML
-    pcf::IndiXmlParser m_ixpIndi;
+    /// This parses the incoming INDI XML, one chunk at a time.
+    pcf::IndiXmlStreamParser m_ixsIndi;
+    /// This is the INDI protocol version.
+    std::string m_szProtocolVersion;
+    /// A pipe used to wake up 'process' when 'quitProcess' is called.
+    int m_fdWake[2];
+    /// The longest time to wait for input before calling 'update' [msec].
+    int m_nUpdateMillis;
     /// A mutex to protect output.
     mutable pcf::MutexLock m_mutOutput;
     /// The file descriptor to read from.
     int m_fdInput;
     /// The file descriptor to write to.
     int m_fdOutput;
+    /// The ring to read from, if any.
+    pcf::IndiShmRing *m_pShmInput;
+    /// The ring to write to, if any.
+    pcf::IndiShmRing *m_pShmOutput;
+    /// Holds a record read from the input ring, reused each time.
+    std::vector<unsigned char> m_vecShmInput;
+    /// Holds a record to write to the output ring, protected by 'm_mutOutput'.
+    mutable std::vector<unsigned char> m_vecShmOutput;
     /// If the processing of INDI messages is put in a separate thread,
     /// this is the thread id of it.
     pthread_t m_idProcessThread;
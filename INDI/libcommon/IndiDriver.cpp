@@ -320,9 +320,7 @@ void IndiDriver::sendDefProperty( const IndiProperty &ipSend ) const
 {
   if ( isResponseModeEnabled() == true )
   {
-    IndiXmlParser ixp( IndiMessage( IndiMessage::Define, ipSend ),
-                       getProtocolVersion() );
-    sendXml( ixp.createXmlString() );
+    sendIndiMessage( IndiMessage( IndiMessage::Define, ipSend ) );
   }
 }
 
@@ -336,9 +334,7 @@ void IndiDriver::sendDefProperties( const vector<IndiProperty> &vecIpSend ) cons
   {
     for ( unsigned int ii = 0; ii < vecIpSend.size(); ii++ )
     {
-      IndiXmlParser ixp( IndiMessage( IndiMessage::Define, vecIpSend[ii] ),
-                         getProtocolVersion() );
-      sendXml( ixp.createXmlString() );
+      sendIndiMessage( IndiMessage( IndiMessage::Define, vecIpSend[ii] ) );
     }
   }
 }
@@ -353,9 +349,7 @@ void IndiDriver::sendDelProperty( const pcf::IndiProperty &ipSend )
 {
   if ( isResponseModeEnabled() == true )
   {
-    IndiXmlParser ixp( IndiMessage( IndiMessage::Delete, ipSend ),
-                       getProtocolVersion() );
-    sendXml( ixp.createXmlString() );
+    sendIndiMessage( IndiMessage( IndiMessage::Delete, ipSend ) );
   }
 }
 
@@ -371,9 +365,7 @@ void IndiDriver::sendDelProperties( const vector<IndiProperty> &vecIpSend )
   {
     for ( unsigned int ii = 0; ii < vecIpSend.size(); ii++ )
     {
-      IndiXmlParser ixp( IndiMessage( IndiMessage::Delete, vecIpSend[ii] ),
-                         getProtocolVersion() );
-      sendXml( ixp.createXmlString() );
+      sendIndiMessage( IndiMessage( IndiMessage::Delete, vecIpSend[ii] ) );
     }
   }
 }
@@ -387,9 +379,7 @@ void IndiDriver::sendEnableBLOB( const IndiProperty &ipSend )
 {
   if ( isResponseModeEnabled() == true )
   {
-    IndiXmlParser ixp( IndiMessage( IndiMessage::EnableBLOB, ipSend ),
-                       getProtocolVersion() );
-    sendXml( ixp.createXmlString() );
+    sendIndiMessage( IndiMessage( IndiMessage::EnableBLOB, ipSend ) );
   }
 }
 
@@ -409,9 +399,7 @@ void IndiDriver::sendGetProperties( const IndiProperty &ipSend )
   // todo: Should this be disabled, or is this the one exception?
   //if ( isResponseModeEnabled() == true )
   {
-    IndiXmlParser ixp( IndiMessage( IndiMessage::GetProperties, ipSend ),
-                       getProtocolVersion() );
-    sendXml( ixp.createXmlString() );
+    sendIndiMessage( IndiMessage( IndiMessage::GetProperties, ipSend ) );
   }
 }
 
@@ -422,9 +410,7 @@ void IndiDriver::sendMessage( const IndiProperty &ipSend )
 {
   if ( isResponseModeEnabled() == true )
   {
-    IndiXmlParser ixp( IndiMessage( IndiMessage::Message, ipSend ),
-                       getProtocolVersion() );;
-    sendXml( ixp.createXmlString() );
+    sendIndiMessage( IndiMessage( IndiMessage::Message, ipSend ) );
   }
 }
 
@@ -440,9 +426,7 @@ void IndiDriver::sendSetProperty( const IndiProperty &ipSend ) const
    
   if ( isResponseModeEnabled() == true )
   {
-    IndiXmlParser ixp( IndiMessage( IndiMessage::SetProperty, _ipSend ),
-                       getProtocolVersion() );
-    sendXml( ixp.createXmlString() );
+    sendIndiMessage( IndiMessage( IndiMessage::SetProperty, _ipSend ) );
   }
 }
 
@@ -456,9 +440,7 @@ void IndiDriver::sendSetProperties( const vector<IndiProperty> &vecIpSend )
   {
     for ( unsigned int ii = 0; ii < vecIpSend.size(); ii++ )
     {
-      IndiXmlParser ixp( IndiMessage( IndiMessage::SetProperty, vecIpSend[ii] ),
-                         getProtocolVersion() );
-      sendXml( ixp.createXmlString() );
+      sendIndiMessage( IndiMessage( IndiMessage::SetProperty, vecIpSend[ii] ) );
     }
   }
 }
@@ -0,0 +1,439 @@
+/// IndiShmRing.cpp
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <new>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "IndiShmRing.hpp"
+
+using std::string;
+using std::vector;
+using pcf::IndiShmRing;
+
+namespace
+{
+// The data buffer starts on a cache line after the header.
+size_t dataOffset( const size_t &uiHeaderSize )
+{
+  return ( uiHeaderSize + 63 ) & ~( size_t )( 63 );
+}
+
+// The space a record takes in the buffer, with its length and padding.
+uint64_t recordSize( const uint32_t &uiSize )
+{
+  return sizeof( uint32_t ) + ( ( ( uint64_t )( uiSize ) + 3 ) & ~( uint64_t )( 3 ) );
+}
+
+// Milliseconds on the monotonic clock.
+int64_t nowMillis()
+{
+  timespec tsNow;
+  ::clock_gettime( CLOCK_MONOTONIC, &tsNow );
+  return ( int64_t )( tsNow.tv_sec ) * 1000 + tsNow.tv_nsec / 1000000;
+}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Standard constructor. The ring is not usable until 'create' or 'attach'.
+
+IndiShmRing::IndiShmRing()
+{
+  m_pHeader = NULL;
+  m_pData = NULL;
+  m_uiMapSize = 0;
+  m_oInterrupted = false;
+  m_oStalled = false;
+  m_ulStalledTail = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Copy constructor.
+
+IndiShmRing::IndiShmRing( const IndiShmRing &isrRhs )
+{
+  static_cast<void>(isrRhs);
+  // Empty because this is private.
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Assignment operator.
+
+const IndiShmRing &IndiShmRing::operator= ( const IndiShmRing &isrRhs )
+{
+  static_cast<void>(isrRhs);
+  // Empty because this is private.
+  return *this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Standard destructor. Detaches, but does not unlink.
+
+IndiShmRing::~IndiShmRing()
+{
+  detach();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Creates a new ring, removing any existing ring with the same name.
+/// The size is rounded up to a multiple of 4 bytes.
+/// \return 0 on success, -1 on error (errno is set).
+
+int IndiShmRing::create( const string &szName, const size_t &uiSize )
+{
+  detach();
+
+  // Anybody still attached to an old ring keeps their mapping, but will
+  // never see anything new on it.
+  ::shm_unlink( szName.c_str() );
+
+  int fd = ::shm_open( szName.c_str(), O_CREAT | O_EXCL | O_RDWR,
+                       S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP );
+  if ( fd < 0 )
+    return -1;
+
+  size_t uiDataSize = ( uiSize + 3 ) & ~( size_t )( 3 );
+  size_t uiMapSize = dataOffset( sizeof( Header ) ) + uiDataSize;
+
+  if ( ::ftruncate( fd, uiMapSize ) < 0 )
+  {
+    int nErr = errno;
+    ::close( fd );
+    ::shm_unlink( szName.c_str() );
+    errno = nErr;
+    return -1;
+  }
+
+  void *pMap = ::mmap( NULL, uiMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  ::close( fd );
+  if ( pMap == MAP_FAILED )
+  {
+    int nErr = errno;
+    ::shm_unlink( szName.c_str() );
+    errno = nErr;
+    return -1;
+  }
+
+  Header *pHeader = new ( pMap ) Header;
+  pHeader->m_uiVersion = LayoutVersion;
+  pHeader->m_ulDataSize = uiDataSize;
+  pHeader->m_aulHead.store( 0 );
+  pHeader->m_aulTail.store( 0 );
+  pHeader->m_aulDropped.store( 0 );
+  if ( ::sem_init( &pHeader->m_semData, 1, 0 ) < 0 )
+  {
+    int nErr = errno;
+    ::munmap( pMap, uiMapSize );
+    ::shm_unlink( szName.c_str() );
+    errno = nErr;
+    return -1;
+  }
+
+  // The magic number goes in last so an attach never sees a partial header.
+  std::atomic_thread_fence( std::memory_order_release );
+  pHeader->m_uiMagic = Magic;
+
+  m_szName = szName;
+  m_pHeader = pHeader;
+  m_pData = static_cast<unsigned char *>( pMap ) + dataOffset( sizeof( Header ) );
+  m_uiMapSize = uiMapSize;
+  m_oInterrupted = false;
+  m_oStalled = false;
+
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Attaches to an existing ring.
+/// \return 0 on success, -1 on error (errno is set).
+
+int IndiShmRing::attach( const string &szName )
+{
+  detach();
+
+  int fd = ::shm_open( szName.c_str(), O_RDWR, 0 );
+  if ( fd < 0 )
+    return -1;
+
+  struct stat stShm;
+  if ( ::fstat( fd, &stShm ) < 0 )
+  {
+    int nErr = errno;
+    ::close( fd );
+    errno = nErr;
+    return -1;
+  }
+
+  size_t uiMapSize = stShm.st_size;
+  if ( uiMapSize <= dataOffset( sizeof( Header ) ) )
+  {
+    ::close( fd );
+    errno = EINVAL;
+    return -1;
+  }
+
+  void *pMap = ::mmap( NULL, uiMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  ::close( fd );
+  if ( pMap == MAP_FAILED )
+    return -1;
+
+  Header *pHeader = static_cast<Header *>( pMap );
+  std::atomic_thread_fence( std::memory_order_acquire );
+  if ( pHeader->m_uiMagic != Magic || pHeader->m_uiVersion != LayoutVersion ||
+       dataOffset( sizeof( Header ) ) + pHeader->m_ulDataSize != uiMapSize )
+  {
+    ::munmap( pMap, uiMapSize );
+    errno = EINVAL;
+    return -1;
+  }
+
+  m_szName = szName;
+  m_pHeader = pHeader;
+  m_pData = static_cast<unsigned char *>( pMap ) + dataOffset( sizeof( Header ) );
+  m_uiMapSize = uiMapSize;
+  m_oInterrupted = false;
+  m_oStalled = false;
+
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unmaps the ring.
+
+void IndiShmRing::detach()
+{
+  if ( m_pHeader != NULL )
+    ::munmap( m_pHeader, m_uiMapSize );
+
+  m_pHeader = NULL;
+  m_pData = NULL;
+  m_uiMapSize = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Removes the named ring from the system, if it exists.
+
+int IndiShmRing::unlink( const string &szName )
+{
+  if ( ::shm_unlink( szName.c_str() ) < 0 && errno != ENOENT )
+    return -1;
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Does the named ring exist?
+
+bool IndiShmRing::exists( const string &szName )
+{
+  int fd = ::shm_open( szName.c_str(), O_RDONLY, 0 );
+  if ( fd < 0 )
+    return false;
+  ::close( fd );
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Is this attached to a ring?
+
+bool IndiShmRing::isAttached() const
+{
+  return ( m_pHeader != NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Returns the name of the ring.
+
+const string &IndiShmRing::getName() const
+{
+  return m_szName;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Returns the number of records dropped because the ring was full.
+
+uint64_t IndiShmRing::getNumDropped() const
+{
+  if ( m_pHeader == NULL )
+    return 0;
+  return m_pHeader->m_aulDropped.load( std::memory_order_relaxed );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Returns the largest record that can be written, which is a little less
+/// than half the data buffer. 0 if not attached.
+
+uint32_t IndiShmRing::getMaxRecordSize() const
+{
+  if ( m_pHeader == NULL )
+    return 0;
+  uint64_t ulMax = ( m_pHeader->m_ulDataSize / 2 - sizeof( uint32_t ) ) & ~( uint64_t )( 3 );
+  return ( ulMax > 0xfffffff0 ) ? ( 0xfffffff0 ) : ( ( uint32_t )( ulMax ) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Writes a record. Only one thread may write to a ring at a time.
+/// If the ring is full, this waits up to 'nTimeoutMillis' for the reader
+/// to make space, then gives up. Once a write has timed out, later writes
+/// don't wait until the reader has read something, so a stalled reader
+/// costs the writer one timeout rather than one per record.
+/// \return true if the record was written, false if it was dropped. errno
+/// is EMSGSIZE if the record can never fit, ETIMEDOUT if the wait timed
+/// out, EAGAIN if the ring is full and the reader is still stalled, or
+/// EINTR if 'interrupt' was called.
+
+bool IndiShmRing::write( const unsigned char *pData, const uint32_t &uiSize,
+                         const int &nTimeoutMillis )
+{
+  if ( m_pHeader == NULL )
+    return false;
+
+  const uint64_t ulDataSize = m_pHeader->m_ulDataSize;
+  const uint64_t ulNeed = recordSize( uiSize );
+
+  // A record has to leave room for a wrap, so it can't be more than half.
+  if ( ulNeed > ulDataSize / 2 )
+  {
+    m_pHeader->m_aulDropped.fetch_add( 1, std::memory_order_relaxed );
+    errno = EMSGSIZE;
+    return false;
+  }
+
+  uint64_t ulHead = m_pHeader->m_aulHead.load( std::memory_order_relaxed );
+  uint64_t ulOffset = ulHead % ulDataSize;
+  uint64_t ulSkip = ( ulDataSize - ulOffset < ulNeed ) ? ulDataSize - ulOffset : 0;
+
+  // Wait for the reader to catch up, if we have to.
+  int64_t llDeadline = -1;
+  uint64_t ulTail;
+  while ( ulDataSize - ( ulHead - ( ulTail = m_pHeader->m_aulTail.load( std::memory_order_acquire ) ) )
+          < ulSkip + ulNeed )
+  {
+    if ( m_oInterrupted.load( std::memory_order_relaxed ) == true )
+    {
+      m_pHeader->m_aulDropped.fetch_add( 1, std::memory_order_relaxed );
+      errno = EINTR;
+      return false;
+    }
+
+    if ( m_oStalled == true && ulTail == m_ulStalledTail )
+    {
+      m_pHeader->m_aulDropped.fetch_add( 1, std::memory_order_relaxed );
+      errno = EAGAIN;
+      return false;
+    }
+
+    if ( llDeadline < 0 )
+      llDeadline = nowMillis() + nTimeoutMillis;
+
+    if ( nowMillis() >= llDeadline )
+    {
+      m_pHeader->m_aulDropped.fetch_add( 1, std::memory_order_relaxed );
+      m_oStalled = true;
+      m_ulStalledTail = ulTail;
+      errno = ETIMEDOUT;
+      return false;
+    }
+    ::usleep( 1000 );
+  }
+
+  m_oStalled = false;
+
+  if ( ulSkip > 0 )
+  {
+    ::memcpy( m_pData + ulOffset, &WrapMarker, sizeof( uint32_t ) );
+    ulHead += ulSkip;
+    ulOffset = 0;
+  }
+
+  ::memcpy( m_pData + ulOffset, &uiSize, sizeof( uint32_t ) );
+  ::memcpy( m_pData + ulOffset + sizeof( uint32_t ), pData, uiSize );
+
+  m_pHeader->m_aulHead.store( ulHead + ulNeed, std::memory_order_release );
+  ::sem_post( &m_pHeader->m_semData );
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Makes a 'write' that is waiting for space give up now, and any later
+/// 'write' give up rather than wait, e.g. so a shutdown isn't held up by
+/// a reader that has gone away. Safe to call from any thread.
+
+void IndiShmRing::interrupt()
+{
+  m_oInterrupted.store( true, std::memory_order_relaxed );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Reads a record into 'vecData', waiting up to 'nTimeoutMillis' for one.
+/// Only one thread may read from a ring at a time. A signal interrupting
+/// the wait is treated as a timeout, so the caller can check its flags.
+/// A record whose length doesn't fit in what the writer has written is
+/// corrupt, so everything written so far is discarded (errno is EBADMSG).
+/// \return 1 if a record was read, 0 on timeout, -1 on error.
+
+int IndiShmRing::read( vector<unsigned char> &vecData, const int &nTimeoutMillis )
+{
+  if ( m_pHeader == NULL )
+    return -1;
+
+  timespec tsWait;
+  ::clock_gettime( CLOCK_REALTIME, &tsWait );
+  tsWait.tv_sec += nTimeoutMillis / 1000;
+  tsWait.tv_nsec += ( long )( nTimeoutMillis % 1000 ) * 1000000L;
+  if ( tsWait.tv_nsec >= 1000000000L )
+  {
+    tsWait.tv_sec += 1;
+    tsWait.tv_nsec -= 1000000000L;
+  }
+
+  if ( ::sem_timedwait( &m_pHeader->m_semData, &tsWait ) < 0 )
+  {
+    if ( errno == ETIMEDOUT || errno == EINTR )
+      return 0;
+    return -1;
+  }
+
+  const uint64_t ulDataSize = m_pHeader->m_ulDataSize;
+  uint64_t ulTail = m_pHeader->m_aulTail.load( std::memory_order_relaxed );
+  uint64_t ulHead = m_pHeader->m_aulHead.load( std::memory_order_acquire );
+  if ( ulHead == ulTail )
+    return -1;
+
+  uint64_t ulOffset = ulTail % ulDataSize;
+  uint64_t ulUsed = ulHead - ulTail;
+  uint32_t uiSize = 0;
+  ::memcpy( &uiSize, m_pData + ulOffset, sizeof( uint32_t ) );
+
+  if ( uiSize == WrapMarker && ulDataSize - ulOffset < ulUsed )
+  {
+    ulTail += ulDataSize - ulOffset;
+    ulUsed -= ulDataSize - ulOffset;
+    ulOffset = 0;
+    ::memcpy( &uiSize, m_pData, sizeof( uint32_t ) );
+  }
+
+  // The length comes from shared memory, so it is checked before it is used.
+  const uint64_t ulRecord = recordSize( uiSize );
+  if ( uiSize == WrapMarker || ulRecord > ulUsed || ulOffset + ulRecord > ulDataSize )
+  {
+    m_pHeader->m_aulTail.store( ulHead, std::memory_order_release );
+    errno = EBADMSG;
+    return -1;
+  }
+
+  const unsigned char *pRecord = m_pData + ulOffset + sizeof( uint32_t );
+  vecData.assign( pRecord, pRecord + uiSize );
+
+  ulTail += ulRecord;
+  m_pHeader->m_aulTail.store( ulTail, std::memory_order_release );
+
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
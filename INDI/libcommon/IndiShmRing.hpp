@@ -0,0 +1,130 @@
+/// IndiShmRing.hpp
+///
+/// A single-producer, single-consumer ring of variable length records in
+/// POSIX shared memory. This is the local transport between a driver and
+/// its xindidriver, replacing the named FIFOs. One ring carries one
+/// direction; a driver owns two (see 'IndiConnection::setInputRing' and
+/// 'IndiConnection::setOutputRing').
+///
+/// Each record is a u32 length followed by the data, padded to 4 bytes.
+/// A length of 'WrapMarker' means the rest of the buffer is unused and the
+/// reader should continue at the start. A process-shared semaphore counts
+/// the records available, so the reader sleeps in the kernel only when the
+/// ring is empty, and the writer makes no system call when the reader is busy.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INDI_SHM_RING_HPP
+#define INDI_SHM_RING_HPP
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+#include <semaphore.h>
+
+namespace pcf
+{
+class IndiShmRing
+{
+  public:
+    enum Constants
+    {
+      // The default size of the data buffer.
+      DefaultSize = 1048576,
+      // Identifies an initialized ring.
+      Magic = 0x494e4452,
+      // Bumped whenever the layout changes.
+      LayoutVersion = 1,
+    };
+
+  private:
+    // Marks the end of the used part of the buffer.
+    static const uint32_t WrapMarker = 0xffffffff;
+
+    // This lives at the start of the shared memory segment.
+    struct Header
+    {
+      uint32_t m_uiMagic;
+      uint32_t m_uiVersion;
+      uint64_t m_ulDataSize;
+      // The total number of bytes written, only changed by the writer.
+      std::atomic<uint64_t> m_aulHead;
+      // The total number of bytes read, only changed by the reader.
+      std::atomic<uint64_t> m_aulTail;
+      // The number of records that were dropped because the ring was full.
+      std::atomic<uint64_t> m_aulDropped;
+      // Posted once per record written.
+      sem_t m_semData;
+    };
+
+  // Construction/destruction.
+  public:
+    /// Standard constructor. The ring is not usable until 'create' or 'attach'.
+    IndiShmRing();
+    /// Standard destructor. Detaches, but does not unlink.
+    virtual ~IndiShmRing();
+
+  // Prevent these from being invoked.
+  private:
+    IndiShmRing( const IndiShmRing &isrRhs );
+    const IndiShmRing &operator= ( const IndiShmRing &isrRhs );
+
+  public:
+    /// Creates a new ring, removing any existing ring with the same name.
+    /// Returns 0 on success, -1 on error (errno is set).
+    int create( const std::string &szName, const size_t &uiSize = DefaultSize );
+    /// Attaches to an existing ring.
+    /// Returns 0 on success, -1 on error (errno is set).
+    int attach( const std::string &szName );
+    /// Unmaps the ring.
+    void detach();
+    /// Removes the named ring from the system, if it exists.
+    static int unlink( const std::string &szName );
+    /// Does the named ring exist?
+    static bool exists( const std::string &szName );
+
+    /// Is this attached to a ring?
+    bool isAttached() const;
+    /// Returns the name of the ring.
+    const std::string &getName() const;
+    /// Returns the number of records dropped because the ring was full.
+    uint64_t getNumDropped() const;
+    /// Returns the largest record that can be written, which is a little
+    /// less than half the data buffer. 0 if not attached.
+    uint32_t getMaxRecordSize() const;
+
+    /// Writes a record. If the ring is full, this waits up to 'nTimeoutMillis'
+    /// for the reader to make space. Returns false if the record was dropped,
+    /// with errno set to say why.
+    bool write( const unsigned char *pData, const uint32_t &uiSize,
+                const int &nTimeoutMillis = 1000 );
+    /// Makes a 'write' that is waiting for space give up now, and any later
+    /// 'write' give up rather than wait. Safe to call from any thread.
+    void interrupt();
+    /// Reads a record into 'vecData', waiting up to 'nTimeoutMillis' for one.
+    /// Returns 1 if a record was read, 0 on timeout, -1 on error.
+    int read( std::vector<unsigned char> &vecData, const int &nTimeoutMillis );
+
+  // Variables
+  private:
+    /// The shared memory name, starting with a '/'.
+    std::string m_szName;
+    /// The mapped header.
+    Header *m_pHeader;
+    /// The mapped data buffer, right after the header.
+    unsigned char *m_pData;
+    /// The total size of the mapping.
+    size_t m_uiMapSize;
+    /// Set by 'interrupt' to stop the writer waiting.
+    std::atomic<bool> m_oInterrupted;
+    /// Did the last write time out waiting for the reader?
+    bool m_oStalled;
+    /// The reader's position when the last write timed out.
+    uint64_t m_ulStalledTail;
+
+}; // class IndiShmRing
+} // namespace pcf
+
+#endif // INDI_SHM_RING_HPP
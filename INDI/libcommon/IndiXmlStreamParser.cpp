@@ -0,0 +1,684 @@
+/// IndiXmlStreamParser.cpp
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <iostream>
+#include "IndiElement.hpp"
+#include "TimeStamp.hpp"
+#include "IndiXmlStreamParser.hpp"
+
+using std::string;
+using pcf::TimeStamp;
+using pcf::IndiElement;
+using pcf::IndiProperty;
+using pcf::IndiMessage;
+using pcf::IndiXmlStreamParser;
+
+namespace
+{
+// The INDI root tags, and the message and property types they produce.
+struct TagType
+{
+  const char *m_pcTag;
+  IndiMessage::Type m_tMsgType;
+  IndiProperty::Type m_tPropType;
+};
+
+const TagType g_pttTags[] =
+{
+  { "defBLOBVector",   IndiMessage::Define,        IndiProperty::BLOB },
+  { "defLightVector",  IndiMessage::Define,        IndiProperty::Light },
+  { "defNumberVector", IndiMessage::Define,        IndiProperty::Number },
+  { "defSwitchVector", IndiMessage::Define,        IndiProperty::Switch },
+  { "defTextVector",   IndiMessage::Define,        IndiProperty::Text },
+  { "delProperty",     IndiMessage::Delete,        IndiProperty::Unknown },
+  { "enableBLOB",      IndiMessage::EnableBLOB,    IndiProperty::Unknown },
+  { "getProperties",   IndiMessage::GetProperties, IndiProperty::Unknown },
+  { "message",         IndiMessage::Message,       IndiProperty::Unknown },
+  { "newBLOBVector",   IndiMessage::NewProperty,   IndiProperty::BLOB },
+  { "newNumberVector", IndiMessage::NewProperty,   IndiProperty::Number },
+  { "newSwitchVector", IndiMessage::NewProperty,   IndiProperty::Switch },
+  { "newTextVector",   IndiMessage::NewProperty,   IndiProperty::Text },
+  { "setBLOBVector",   IndiMessage::SetProperty,   IndiProperty::BLOB },
+  { "setLightVector",  IndiMessage::SetProperty,   IndiProperty::Light },
+  { "setNumberVector", IndiMessage::SetProperty,   IndiProperty::Number },
+  { "setSwitchVector", IndiMessage::SetProperty,   IndiProperty::Switch },
+  { "setTextVector",   IndiMessage::SetProperty,   IndiProperty::Text },
+};
+
+// Can this character start a tag or attribute name?
+inline bool isTokenStart( const char &cChar )
+{
+  return ( ::isalpha( ( unsigned char )( cChar ) ) || cChar == '_' );
+}
+
+// Can this character be part of a tag or attribute name?
+inline bool isTokenChar( const char &cChar )
+{
+  return ( ::isalnum( ( unsigned char )( cChar ) ) || cChar == '_' ||
+           cChar == '-' || cChar == '.' || cChar == ':' );
+}
+
+inline bool isSpace( const char &cChar )
+{
+  return ( ::isspace( ( unsigned char )( cChar ) ) != 0 );
+}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Empties all the strings, keeping their storage.
+
+void IndiXmlStreamParser::ElementData::clear()
+{
+  m_szName.clear();
+  m_szLabel.clear();
+  m_szFormat.clear();
+  m_szMin.clear();
+  m_szMax.clear();
+  m_szStep.clear();
+  m_szSize.clear();
+  m_szValue.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor.
+
+IndiXmlStreamParser::IndiXmlStreamParser()
+{
+  m_uiLine = 1;
+  clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Copy constructor.
+
+IndiXmlStreamParser::IndiXmlStreamParser( const IndiXmlStreamParser &ixspRhs )
+{
+  static_cast<void>(ixspRhs);
+  // Empty because this is private.
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Assignment operator.
+
+const IndiXmlStreamParser &IndiXmlStreamParser::operator= ( const IndiXmlStreamParser &ixspRhs )
+{
+  static_cast<void>(ixspRhs);
+  // Empty because this is private.
+  return *this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Destructor.
+
+IndiXmlStreamParser::~IndiXmlStreamParser()
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Throw away any partial message and start fresh. The storage is kept.
+
+void IndiXmlStreamParser::clear()
+{
+  m_tScanState = LookForStart;
+  m_tAfterDecl = LookForStart;
+  m_nDepth = 0;
+  m_oComplete = false;
+  m_cQuote = '"';
+  m_uiNumElements = 0;
+  m_pszTag = NULL;
+  m_pszAttrValue = NULL;
+  m_pszContent = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Is there a complete message?
+
+IndiXmlStreamParser::State IndiXmlStreamParser::getState() const
+{
+  return ( m_oComplete == true ) ? ( CompleteState ) : ( IncompleteState );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Parse bytes until a message is complete, there is an error, or the
+/// bytes run out.
+/// \return The number of bytes used.
+
+unsigned int IndiXmlStreamParser::parseXml( const char *pcXml,
+                                            const unsigned int &uiNumBytes,
+                                            string &szErrorMsg )
+{
+  szErrorMsg.clear();
+  m_oComplete = false;
+
+  unsigned int ii = 0;
+  while ( ii < uiNumBytes )
+  {
+    const char cChar = pcXml[ii++];
+
+    if ( cChar == '\n' )
+      m_uiLine++;
+
+    switch ( m_tScanState )
+    {
+      case LookForStart:
+        if ( cChar == '<' )
+          m_tScanState = SawLt;
+        break;
+
+      case SawLt:
+        if ( cChar == '/' )
+        {
+          if ( m_nDepth == 0 )
+            setError( "Close tag with no open tag", cChar, szErrorMsg );
+          else
+            m_tScanState = LookForCloseTag;
+        }
+        else if ( cChar == '?' || cChar == '!' )
+        {
+          m_tAfterDecl = ( m_nDepth == 0 ) ? ( LookForStart ) : ( LookForContent );
+          m_tScanState = SkipDecl;
+        }
+        else if ( isTokenStart( cChar ) == true )
+        {
+          m_nDepth++;
+          beginElement();
+          m_pszTag->push_back( cChar );
+          m_tScanState = InTag;
+        }
+        else
+        {
+          setError( "Bogus tag char", cChar, szErrorMsg );
+        }
+        break;
+
+      case SkipDecl:
+        if ( cChar == '>' )
+          m_tScanState = m_tAfterDecl;
+        break;
+
+      case InTag:
+        if ( isTokenChar( cChar ) == true )
+          m_pszTag->push_back( cChar );
+        else if ( isSpace( cChar ) == true )
+          m_tScanState = LookForAttr;
+        else if ( cChar == '>' )
+          endStartTag();
+        else if ( cChar == '/' )
+          m_tScanState = SawSlashInTag;
+        else
+          setError( "Bogus tag char", cChar, szErrorMsg );
+        break;
+
+      case LookForAttr:
+        if ( isSpace( cChar ) == true )
+        {
+        }
+        else if ( cChar == '>' )
+        {
+          endStartTag();
+        }
+        else if ( cChar == '/' )
+        {
+          m_tScanState = SawSlashInTag;
+        }
+        else if ( isTokenStart( cChar ) == true )
+        {
+          m_szAttrName.clear();
+          m_szAttrName.push_back( cChar );
+          m_tScanState = InAttrName;
+        }
+        else
+        {
+          setError( "Bogus attribute name char", cChar, szErrorMsg );
+        }
+        break;
+
+      case InAttrName:
+        if ( isTokenChar( cChar ) == true )
+        {
+          m_szAttrName.push_back( cChar );
+        }
+        else if ( isSpace( cChar ) == true )
+        {
+          m_tScanState = LookForEq;
+        }
+        else if ( cChar == '=' )
+        {
+          selectAttribute();
+          m_tScanState = LookForQuote;
+        }
+        else
+        {
+          setError( "Bogus attribute name char", cChar, szErrorMsg );
+        }
+        break;
+
+      case LookForEq:
+        if ( cChar == '=' )
+        {
+          selectAttribute();
+          m_tScanState = LookForQuote;
+        }
+        else if ( isSpace( cChar ) == false )
+        {
+          setError( "Expected '=' after attribute name", cChar, szErrorMsg );
+        }
+        break;
+
+      case LookForQuote:
+        if ( cChar == '"' || cChar == '\'' )
+        {
+          m_cQuote = cChar;
+          m_tScanState = InAttrValue;
+        }
+        else if ( isSpace( cChar ) == false )
+        {
+          setError( "Expected a quote for the attribute value", cChar, szErrorMsg );
+        }
+        break;
+
+      case InAttrValue:
+        if ( cChar == m_cQuote )
+        {
+          m_tScanState = LookForAttr;
+        }
+        else if ( cChar == '&' )
+        {
+          m_szEntity.assign( 1, cChar );
+          m_tScanState = EntityInAttrValue;
+        }
+        else if ( m_pszAttrValue != NULL && ::iscntrl( ( unsigned char )( cChar ) ) == 0 )
+        {
+          // Control characters are dropped, the same as lilxml.
+          m_pszAttrValue->push_back( cChar );
+        }
+        break;
+
+      case EntityInAttrValue:
+        if ( cChar == m_cQuote )
+        {
+          // Not an entity after all.
+          appendEntity( m_pszAttrValue );
+          m_tScanState = LookForAttr;
+          break;
+        }
+        m_szEntity.push_back( cChar );
+        if ( cChar == ';' || m_szEntity.size() >= MaxEntitySize )
+        {
+          appendEntity( m_pszAttrValue );
+          m_tScanState = InAttrValue;
+        }
+        break;
+
+      case SawSlashInTag:
+        if ( cChar == '>' )
+        {
+          endStartTag();
+          if ( endElement() == true )
+            return ii;
+        }
+        else
+        {
+          setError( "Expected '>' after '/'", cChar, szErrorMsg );
+        }
+        break;
+
+      case LookForContent:
+        if ( cChar == '<' )
+        {
+          m_tScanState = SawLt;
+        }
+        else if ( cChar == '&' )
+        {
+          m_szEntity.assign( 1, cChar );
+          m_tScanState = EntityInContent;
+        }
+        else if ( isSpace( cChar ) == false )
+        {
+          if ( m_pszContent != NULL )
+            m_pszContent->push_back( cChar );
+          m_tScanState = InContent;
+        }
+        break;
+
+      case InContent:
+        if ( cChar == '<' )
+        {
+          // Chomp trailing whitespace, the same as lilxml.
+          if ( m_pszContent != NULL )
+          {
+            size_t uiLen = m_pszContent->size();
+            while ( uiLen > 0 && isSpace( ( *m_pszContent )[uiLen - 1] ) == true )
+              uiLen--;
+            m_pszContent->resize( uiLen );
+          }
+          m_tScanState = SawLt;
+        }
+        else if ( cChar == '&' )
+        {
+          m_szEntity.assign( 1, cChar );
+          m_tScanState = EntityInContent;
+        }
+        else if ( m_pszContent != NULL )
+        {
+          m_pszContent->push_back( cChar );
+        }
+        break;
+
+      case EntityInContent:
+        if ( cChar == '<' )
+        {
+          // Not an entity after all.
+          appendEntity( m_pszContent );
+          m_tScanState = SawLt;
+          break;
+        }
+        m_szEntity.push_back( cChar );
+        if ( cChar == ';' || m_szEntity.size() >= MaxEntitySize )
+        {
+          appendEntity( m_pszContent );
+          m_tScanState = InContent;
+        }
+        break;
+
+      case LookForCloseTag:
+        if ( isTokenStart( cChar ) == true )
+        {
+          m_szCloseTag.assign( 1, cChar );
+          m_tScanState = InCloseTag;
+        }
+        else if ( isSpace( cChar ) == false )
+        {
+          setError( "Bogus close tag char", cChar, szErrorMsg );
+        }
+        break;
+
+      case InCloseTag:
+        if ( isTokenChar( cChar ) == true )
+        {
+          m_szCloseTag.push_back( cChar );
+        }
+        else if ( cChar == '>' )
+        {
+          if ( ( m_nDepth == 1 && m_szCloseTag != m_szRootTag ) ||
+               ( m_nDepth == 2 && m_szCloseTag != m_szChildTag ) )
+          {
+            setError( "Close tag does not match", cChar, szErrorMsg );
+          }
+          else if ( endElement() == true )
+          {
+            return ii;
+          }
+        }
+        else if ( isSpace( cChar ) == false )
+        {
+          setError( "Bogus close tag char", cChar, szErrorMsg );
+        }
+        break;
+    }
+
+    // Stop at an error, so the caller sees each one.
+    if ( szErrorMsg.size() > 0 )
+      return ii;
+  }
+
+  return ii;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Called when '<' and the first character of a tag have been seen.
+/// A new root starts a new message.
+
+void IndiXmlStreamParser::beginElement()
+{
+  if ( m_nDepth == 1 )
+  {
+    m_szRootTag.clear();
+    m_szDevice.clear();
+    m_szGroup.clear();
+    m_szLabel.clear();
+    m_szMessage.clear();
+    m_szName.clear();
+    m_szPerm.clear();
+    m_szRule.clear();
+    m_szState.clear();
+    m_szTimeout.clear();
+    m_szTimeStamp.clear();
+    m_szVersion.clear();
+    m_szRootContent.clear();
+    m_uiNumElements = 0;
+    m_pszTag = &m_szRootTag;
+  }
+  else if ( m_nDepth == 2 )
+  {
+    if ( m_uiNumElements == m_vecElements.size() )
+      m_vecElements.push_back( ElementData() );
+    m_vecElements[m_uiNumElements].clear();
+    m_uiNumElements++;
+    m_szChildTag.clear();
+    m_pszTag = &m_szChildTag;
+  }
+  else
+  {
+    m_szIgnoredTag.clear();
+    m_pszTag = &m_szIgnoredTag;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Called at the '>' of a start tag. The content goes to the root or to the
+/// value of the current child element.
+
+void IndiXmlStreamParser::endStartTag()
+{
+  if ( m_nDepth == 1 )
+    m_pszContent = &m_szRootContent;
+  else if ( m_nDepth == 2 )
+    m_pszContent = &m_vecElements[m_uiNumElements - 1].m_szValue;
+  else
+    m_pszContent = NULL;
+
+  m_tScanState = LookForContent;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Called when an element is closed.
+/// \return true if it was the root, and the message is complete.
+
+bool IndiXmlStreamParser::endElement()
+{
+  m_nDepth--;
+
+  if ( m_nDepth == 0 )
+  {
+    m_pszContent = NULL;
+    m_oComplete = true;
+    m_tScanState = LookForStart;
+    return true;
+  }
+
+  if ( m_nDepth == 1 )
+    m_pszContent = &m_szRootContent;
+  else if ( m_nDepth == 2 )
+    m_pszContent = &m_vecElements[m_uiNumElements - 1].m_szValue;
+  else
+    m_pszContent = NULL;
+
+  m_tScanState = LookForContent;
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Points 'm_pszAttrValue' at the string for 'm_szAttrName'. Attributes
+/// INDI does not use are ignored.
+
+void IndiXmlStreamParser::selectAttribute()
+{
+  m_pszAttrValue = NULL;
+
+  if ( m_nDepth == 1 )
+  {
+    if ( m_szAttrName == "device" ) m_pszAttrValue = &m_szDevice;
+    else if ( m_szAttrName == "name" ) m_pszAttrValue = &m_szName;
+    else if ( m_szAttrName == "state" ) m_pszAttrValue = &m_szState;
+    else if ( m_szAttrName == "timestamp" ) m_pszAttrValue = &m_szTimeStamp;
+    else if ( m_szAttrName == "group" ) m_pszAttrValue = &m_szGroup;
+    else if ( m_szAttrName == "label" ) m_pszAttrValue = &m_szLabel;
+    else if ( m_szAttrName == "message" ) m_pszAttrValue = &m_szMessage;
+    else if ( m_szAttrName == "perm" ) m_pszAttrValue = &m_szPerm;
+    else if ( m_szAttrName == "rule" ) m_pszAttrValue = &m_szRule;
+    else if ( m_szAttrName == "timeout" ) m_pszAttrValue = &m_szTimeout;
+    else if ( m_szAttrName == "version" ) m_pszAttrValue = &m_szVersion;
+  }
+  else if ( m_nDepth == 2 )
+  {
+    ElementData &edCurr = m_vecElements[m_uiNumElements - 1];
+    if ( m_szAttrName == "name" ) m_pszAttrValue = &edCurr.m_szName;
+    else if ( m_szAttrName == "label" ) m_pszAttrValue = &edCurr.m_szLabel;
+    else if ( m_szAttrName == "format" ) m_pszAttrValue = &edCurr.m_szFormat;
+    else if ( m_szAttrName == "min" ) m_pszAttrValue = &edCurr.m_szMin;
+    else if ( m_szAttrName == "max" ) m_pszAttrValue = &edCurr.m_szMax;
+    else if ( m_szAttrName == "step" ) m_pszAttrValue = &edCurr.m_szStep;
+    else if ( m_szAttrName == "size" ) m_pszAttrValue = &edCurr.m_szSize;
+  }
+
+  // If the attribute is repeated, the last one wins.
+  if ( m_pszAttrValue != NULL )
+    m_pszAttrValue->clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Adds the decoded entity in 'm_szEntity' to 'pszTarget'. Entities which
+/// are not recognized are added as is, the same as lilxml.
+
+void IndiXmlStreamParser::appendEntity( string *pszTarget )
+{
+  if ( pszTarget == NULL )
+    return;
+
+  if ( m_szEntity == "&amp;" ) pszTarget->push_back( '&' );
+  else if ( m_szEntity == "&lt;" ) pszTarget->push_back( '<' );
+  else if ( m_szEntity == "&gt;" ) pszTarget->push_back( '>' );
+  else if ( m_szEntity == "&quot;" ) pszTarget->push_back( '"' );
+  else if ( m_szEntity == "&apos;" ) pszTarget->push_back( '\'' );
+  else pszTarget->append( m_szEntity );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Sets the error message and discards the partial message.
+
+void IndiXmlStreamParser::setError( const char *pcWhy,
+                                    const char &cChar,
+                                    string &szErrorMsg )
+{
+  char pcMsg[128];
+  ::snprintf( pcMsg, sizeof( pcMsg ), "Line %u: %s '%c'", m_uiLine, pcWhy, cChar );
+  szErrorMsg = pcMsg;
+
+  std::cerr << "Error processing XML: " << szErrorMsg << std::endl;
+
+  clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Get the IndiMessage for the message just completed. Only the attributes
+/// which were present are set, the same as 'IndiXmlParser'.
+
+IndiMessage IndiXmlStreamParser::createIndiMessage() const
+{
+  IndiMessage::Type tMsgType = IndiMessage::Unknown;
+  IndiProperty::Type tPropType = IndiProperty::Unknown;
+
+  for ( unsigned int ii = 0; ii < sizeof( g_pttTags ) / sizeof( g_pttTags[0] ); ii++ )
+  {
+    if ( m_szRootTag == g_pttTags[ii].m_pcTag )
+    {
+      tMsgType = g_pttTags[ii].m_tMsgType;
+      tPropType = g_pttTags[ii].m_tPropType;
+      break;
+    }
+  }
+
+  IndiProperty ipNew( tPropType );
+
+  if ( m_szDevice.size() > 0 )
+    ipNew.setDevice( m_szDevice );
+  if ( m_szGroup.size() > 0 )
+    ipNew.setGroup( m_szGroup );
+  if ( m_szLabel.size() > 0 )
+    ipNew.setLabel( m_szLabel );
+  if ( m_szMessage.size() > 0 )
+    ipNew.setMessage( m_szMessage );
+  if ( m_szName.size() > 0 )
+    ipNew.setName( m_szName );
+  if ( m_szPerm.size() > 0 )
+    ipNew.setPerm( IndiProperty::getPropertyPermType( m_szPerm ) );
+  if ( m_szRule.size() > 0 )
+    ipNew.setRule( IndiProperty::getSwitchRuleType( m_szRule ) );
+  if ( m_szState.size() > 0 )
+    ipNew.setState( IndiProperty::getPropertyStateType( m_szState ) );
+  if ( m_szTimeout.size() > 0 )
+    ipNew.setTimeout( ::strtod( m_szTimeout.c_str(), NULL ) );
+  if ( m_szTimeStamp.size() > 0 )
+  {
+    TimeStamp tsMod;
+    tsMod.fromFormattedIso8601Str( m_szTimeStamp );
+    ipNew.setTimeStamp( tsMod );
+  }
+  if ( m_szVersion.size() > 0 )
+    ipNew.setVersion( m_szVersion );
+
+  // A special case is a BLOB enable message - it has no elements,
+  // but has data in it.
+  if ( tMsgType == IndiMessage::EnableBLOB )
+  {
+    ipNew = IndiProperty::getBLOBEnableType( m_szRootContent );
+  }
+  else
+  {
+    for ( unsigned int ii = 0; ii < m_uiNumElements; ii++ )
+    {
+      const ElementData &edCurr = m_vecElements[ii];
+      IndiElement ieNew;
+
+      if ( edCurr.m_szFormat.size() > 0 )
+        ieNew.setFormat( edCurr.m_szFormat );
+      if ( edCurr.m_szLabel.size() > 0 )
+        ieNew.setLabel( edCurr.m_szLabel );
+      if ( edCurr.m_szMax.size() > 0 )
+        ieNew.setMax( edCurr.m_szMax );
+      if ( edCurr.m_szMin.size() > 0 )
+        ieNew.setMin( edCurr.m_szMin );
+      if ( edCurr.m_szName.size() > 0 )
+        ieNew.setName( edCurr.m_szName );
+      if ( edCurr.m_szSize.size() > 0 )
+        ieNew.setSize( edCurr.m_szSize );
+      if ( edCurr.m_szStep.size() > 0 )
+        ieNew.setStep( edCurr.m_szStep );
+
+      // The different types have different data...
+      switch ( tPropType )
+      {
+        case IndiProperty::Light:
+          ieNew.setLightState( IndiElement::getLightStateType( edCurr.m_szValue ) );
+          break;
+        case IndiProperty::Switch:
+          ieNew.setSwitchState( IndiElement::getSwitchStateType( edCurr.m_szValue ) );
+          break;
+        default:
+          ieNew.setValue( edCurr.m_szValue );
+      }
+
+      // Now add this element to the message.
+      ipNew.add( ieNew );
+    }
+  }
+
+  return IndiMessage( tMsgType, ipNew );
+}
+
+////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,187 @@
+/// IndiXmlStreamParser.hpp
+///
+/// An incremental parser for a stream of INDI XML messages. Unlike
+/// 'IndiXmlParser', it does not build a lilxml tree or keep left-over text
+/// between calls: it is a character level state machine which can stop and
+/// resume anywhere, so the caller can hand it each chunk as it is read and
+/// then re-use the read buffer. The attributes and element data of the
+/// message being parsed are collected in strings which are kept between
+/// messages, so once they have grown to fit, parsing does not allocate.
+///
+/// Typical use:
+///
+///   unsigned int uiOffset = 0;
+///   while ( uiOffset < uiNumBytes )
+///   {
+///     uiOffset += ixsp.parseXml( pcBuf + uiOffset, uiNumBytes - uiOffset, szErr );
+///     if ( ixsp.getState() == IndiXmlStreamParser::CompleteState )
+///       handle( ixsp.createIndiMessage() );
+///   }
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INDI_XML_STREAM_PARSER_HPP
+#define INDI_XML_STREAM_PARSER_HPP
+#pragma once
+
+#include <string>
+#include <vector>
+#include "IndiMessage.hpp"
+#include "IndiProperty.hpp"
+
+namespace pcf
+{
+class IndiXmlStreamParser
+{
+  public:
+    enum State
+    {
+      UnknownState = 0,
+      IncompleteState,
+      CompleteState
+    };
+
+  private:
+    enum Constants
+    {
+      // The longest entity we decode ("&quot;").
+      MaxEntitySize = 8,
+    };
+
+    // Where we are in the character stream.
+    enum ScanState
+    {
+      LookForStart = 0,   // Outside any element, skipping to a '<'.
+      SawLt,              // Saw a '<', deciding what it starts.
+      SkipDecl,           // In a '<?...>' or '<!...>', skipping to the '>'.
+      InTag,              // Reading the name of a start tag.
+      LookForAttr,        // In a start tag, looking for an attribute or the end.
+      InAttrName,         // Reading an attribute name.
+      LookForEq,          // After an attribute name, looking for the '='.
+      LookForQuote,       // After the '=', looking for the opening quote.
+      InAttrValue,        // Reading an attribute value.
+      EntityInAttrValue,  // Reading an entity in an attribute value.
+      SawSlashInTag,      // Saw a '/' in a start tag, the next must be '>'.
+      LookForContent,     // Skipping leading whitespace in the content.
+      InContent,          // Reading the content.
+      EntityInContent,    // Reading an entity in the content.
+      LookForCloseTag,    // Saw '</', looking for the name.
+      InCloseTag,         // Reading the name of a close tag.
+    };
+
+    // The data of one child element ('oneNumber', 'defSwitch', etc.).
+    struct ElementData
+    {
+      std::string m_szName;
+      std::string m_szLabel;
+      std::string m_szFormat;
+      std::string m_szMin;
+      std::string m_szMax;
+      std::string m_szStep;
+      std::string m_szSize;
+      std::string m_szValue;
+      /// Empties all the strings, keeping their storage.
+      void clear();
+    };
+
+  // Constructor/destructor.
+  public:
+    /// Constructor.
+    IndiXmlStreamParser();
+    /// Destructor.
+    virtual ~IndiXmlStreamParser();
+
+  // Prevent these from being invoked.
+  private:
+    IndiXmlStreamParser( const IndiXmlStreamParser &ixspRhs );
+    const IndiXmlStreamParser &operator= ( const IndiXmlStreamParser &ixspRhs );
+
+  // Methods.
+  public:
+    /// Throw away any partial message and start fresh.
+    void clear();
+    /// Get the IndiMessage for the message just completed.
+    pcf::IndiMessage createIndiMessage() const;
+    /// Is there a complete message? This is only true right after the
+    /// 'parseXml' call which completed it.
+    State getState() const;
+    /// Parse bytes until a message is complete, there is an error, or the
+    /// bytes run out. Returns the number of bytes used. If there is an
+    /// error, the partial message is discarded and 'szErrorMsg' says why.
+    unsigned int parseXml( const char *pcXml,
+                           const unsigned int &uiNumBytes,
+                           std::string &szErrorMsg );
+
+  // Helper functions.
+  private:
+    /// Called when the name of a start tag is complete.
+    void beginElement();
+    /// Called when the start tag is complete.
+    void endStartTag();
+    /// Called when an element is closed. Returns true if it was the root.
+    bool endElement();
+    /// Points 'm_pszAttrValue' at the string for 'm_szAttrName'.
+    void selectAttribute();
+    /// Adds the decoded entity in 'm_szEntity' to 'pszTarget'.
+    void appendEntity( std::string *pszTarget );
+    /// Sets the error message and discards the partial message.
+    void setError( const char *pcWhy, const char &cChar, std::string &szErrorMsg );
+
+  // Members.
+  private:
+    /// Where we are in the stream.
+    ScanState m_tScanState;
+    /// The state to go back to after skipping a declaration.
+    ScanState m_tAfterDecl;
+    /// How deep we are: 0 is outside, 1 is the root, 2 is a child element.
+    int m_nDepth;
+    /// Was a message completed by the last call to 'parseXml'?
+    bool m_oComplete;
+    /// The line number, for error messages.
+    unsigned int m_uiLine;
+    /// The quote character which opened the current attribute value.
+    char m_cQuote;
+
+    /// The tag of the root element ('setNumberVector', etc.).
+    std::string m_szRootTag;
+    /// The tag of the current child element.
+    std::string m_szChildTag;
+    /// The tag of an element nested deeper than INDI uses, which is ignored.
+    std::string m_szIgnoredTag;
+    /// The name in the close tag.
+    std::string m_szCloseTag;
+    /// The name of the current attribute.
+    std::string m_szAttrName;
+    /// The entity being read.
+    std::string m_szEntity;
+
+    /// The attributes of the root element.
+    std::string m_szDevice;
+    std::string m_szGroup;
+    std::string m_szLabel;
+    std::string m_szMessage;
+    std::string m_szName;
+    std::string m_szPerm;
+    std::string m_szRule;
+    std::string m_szState;
+    std::string m_szTimeout;
+    std::string m_szTimeStamp;
+    std::string m_szVersion;
+    /// The content of the root element (used by 'enableBLOB').
+    std::string m_szRootContent;
+
+    /// The child elements. This only grows, 'm_uiNumElements' are in use.
+    std::vector<ElementData> m_vecElements;
+    unsigned int m_uiNumElements;
+
+    /// Where the current tag name goes.
+    std::string *m_pszTag;
+    /// Where the current attribute value goes, NULL to ignore it.
+    std::string *m_pszAttrValue;
+    /// Where the current content goes, NULL to ignore it.
+    std::string *m_pszContent;
+
+}; // class IndiXmlStreamParser
+} // namespace pcf
+
+#endif // INDI_XML_STREAM_PARSER_HPP
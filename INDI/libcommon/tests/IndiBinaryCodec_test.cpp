@@ -0,0 +1,251 @@
+#include "../../../tests/catch2/catch.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "../IndiBinaryCodec.hpp"
+
+namespace IndiBinaryCodec_test
+{
+
+using pcf::IndiBinaryCodec;
+using pcf::IndiElement;
+using pcf::IndiMessage;
+using pcf::IndiProperty;
+
+//A property of the given type with every attribute and element field set.
+IndiProperty fullProperty( IndiProperty::Type tType )
+{
+   IndiProperty ip(tType);
+   ip.setDevice("camwfs");
+   ip.setName("exptime");
+   ip.setLabel("Exposure Time");
+   ip.setGroup("Camera \"main\"");
+   ip.setMessage("a message, with <xml> & such");
+   ip.setVersion("1.7");
+   ip.setState(IndiProperty::Busy);
+   ip.setPerm(IndiProperty::ReadWrite);
+   ip.setRule(IndiProperty::OneOfMany);
+   ip.setBLOBEnable(IndiProperty::Only);
+   ip.setRequested(true);
+   ip.setTimeout(2.5);
+
+   //Every light and switch state appears in an element.
+   for(int n = 0; n < 5; ++n)
+   {
+      IndiElement ie("elem" + std::to_string(n));
+      ie.setLabel("Element " + std::to_string(n));
+      ie.setFormat("%0.3f");
+      ie.setMin("-" + std::to_string(n));
+      ie.setMax(std::to_string(100*n));
+      ie.setStep("0.5");
+      ie.setSize(std::to_string(n*1024));
+      ie.setValue(std::string(n*7, 'x') + std::string(1, '\0') + "after a nul");
+      ie.setLightState(static_cast<IndiElement::LightStateType>(n % 5));
+      ie.setSwitchState(static_cast<IndiElement::SwitchStateType>(n % 3));
+      ip.add(ie);
+   }
+
+   //Set last, since adding an element sets the time stamp.
+   timeval tv;
+   tv.tv_sec = 1700000000;
+   tv.tv_usec = 123456;
+   ip.setTimeStamp(pcf::TimeStamp(tv));
+
+   return ip;
+}
+
+//Check everything the codec carries, including what IndiProperty::operator== skips.
+void requireSame( const IndiMessage & imA,
+                  const IndiMessage & imB
+                )
+{
+   REQUIRE(imA.getType() == imB.getType());
+
+   const IndiProperty & ipA = imA.getProperty();
+   const IndiProperty & ipB = imB.getProperty();
+
+   REQUIRE(ipA == ipB);
+   REQUIRE(ipA.getType() == ipB.getType());
+   REQUIRE(ipA.getBLOBEnable() == ipB.getBLOBEnable());
+   REQUIRE(ipA.isRequested() == ipB.isRequested());
+   REQUIRE(ipA.getTimeout() == ipB.getTimeout());
+   REQUIRE(ipA.getTimeStamp().getTimeVal().tv_sec == ipB.getTimeStamp().getTimeVal().tv_sec);
+   REQUIRE(ipA.getTimeStamp().getTimeVal().tv_usec == ipB.getTimeStamp().getTimeVal().tv_usec);
+
+   std::map<std::string, IndiElement>::const_iterator itA = ipA.getElements().begin();
+   std::map<std::string, IndiElement>::const_iterator itB = ipB.getElements().begin();
+   for(; itA != ipA.getElements().end(); ++itA, ++itB)
+   {
+      REQUIRE(itA->second.getValue() == itB->second.getValue());
+      REQUIRE(itA->second.getLightState() == itB->second.getLightState());
+      REQUIRE(itA->second.getSwitchState() == itB->second.getSwitchState());
+   }
+}
+
+SCENARIO( "Encoding and decoding INDI messages", "[libcommon::IndiBinaryCodec]" )
+{
+   GIVEN("every message type with every property type")
+   {
+      for(int mt = IndiMessage::Unknown; mt <= IndiMessage::SetProperty; ++mt)
+      {
+         for(int pt = IndiProperty::Unknown; pt <= IndiProperty::Text; ++pt)
+         {
+            IndiMessage imSend(static_cast<IndiMessage::Type>(mt), fullProperty(static_cast<IndiProperty::Type>(pt)));
+
+            std::vector<unsigned char> vecRec;
+            IndiBinaryCodec::encode(imSend, vecRec);
+
+            IndiMessage imRecv;
+            REQUIRE(IndiBinaryCodec::decode(vecRec.data(), vecRec.size(), imRecv) == true);
+            requireSame(imSend, imRecv);
+         }
+      }
+   }
+
+   GIVEN("a property with no elements and empty strings")
+   {
+      IndiProperty ip(IndiProperty::Number);
+      IndiMessage imSend(IndiMessage::Delete, ip);
+
+      std::vector<unsigned char> vecRec;
+      IndiBinaryCodec::encode(imSend, vecRec);
+
+      IndiMessage imRecv;
+      REQUIRE(IndiBinaryCodec::decode(vecRec.data(), vecRec.size(), imRecv) == true);
+      requireSame(imSend, imRecv);
+      REQUIRE(imRecv.getProperty().getElements().size() == 0);
+   }
+
+   GIVEN("an encoding buffer which is re-used")
+   {
+      std::vector<unsigned char> vecRec;
+      IndiBinaryCodec::encode(IndiMessage(IndiMessage::Define, fullProperty(IndiProperty::Text)), vecRec);
+
+      IndiMessage imSend(IndiMessage::SetProperty, IndiProperty(IndiProperty::Switch, "dev", "prop"));
+      IndiBinaryCodec::encode(imSend, vecRec);
+
+      IndiMessage imRecv;
+      REQUIRE(IndiBinaryCodec::decode(vecRec.data(), vecRec.size(), imRecv) == true);
+      requireSame(imSend, imRecv);
+   }
+}
+
+SCENARIO( "Rejecting malformed INDI records", "[libcommon::IndiBinaryCodec]" )
+{
+   IndiMessage imSend(IndiMessage::SetProperty, fullProperty(IndiProperty::Switch));
+
+   std::vector<unsigned char> vecRec;
+   IndiBinaryCodec::encode(imSend, vecRec);
+
+   //What's in imRecv before a failed decode must be left alone.
+   IndiMessage imSentinel(IndiMessage::Message, IndiProperty(IndiProperty::Text, "sentinel", "untouched"));
+
+   GIVEN("a record truncated at every length")
+   {
+      for(size_t n = 0; n < vecRec.size(); ++n)
+      {
+         IndiMessage imRecv = imSentinel;
+         REQUIRE(IndiBinaryCodec::decode(vecRec.data(), n, imRecv) == false);
+         REQUIRE(imRecv.getProperty().getDevice() == "sentinel");
+      }
+   }
+
+   GIVEN("a record with a byte left over")
+   {
+      vecRec.push_back(0);
+      IndiMessage imRecv = imSentinel;
+      REQUIRE(IndiBinaryCodec::decode(vecRec.data(), vecRec.size(), imRecv) == false);
+      REQUIRE(imRecv.getProperty().getDevice() == "sentinel");
+   }
+
+   GIVEN("records with bad header bytes")
+   {
+      //magic, version, message type, property type, state, perm, rule, BLOB enable, requested
+      const unsigned char pucBad[9] = {0xB2, 2, IndiMessage::SetProperty+1, IndiProperty::Text+1,
+                                        IndiProperty::Idle+1, IndiProperty::WriteOnly+1, IndiProperty::OneOfMany+1,
+                                        IndiProperty::Never+1, 2};
+
+      for(size_t n = 0; n < sizeof(pucBad); ++n)
+      {
+         std::vector<unsigned char> vecBad = vecRec;
+         vecBad[n] = pucBad[n];
+
+         IndiMessage imRecv = imSentinel;
+         REQUIRE(IndiBinaryCodec::decode(vecBad.data(), vecBad.size(), imRecv) == false);
+         REQUIRE(imRecv.getProperty().getDevice() == "sentinel");
+      }
+   }
+
+   GIVEN("a record with invalid microseconds")
+   {
+      //After the 9 header bytes, the f64 timeout, and the i64 seconds.
+      int32_t iMicros = 1000000;
+      memcpy(vecRec.data() + 9 + 8 + 8, &iMicros, sizeof(iMicros));
+
+      IndiMessage imRecv;
+      REQUIRE(IndiBinaryCodec::decode(vecRec.data(), vecRec.size(), imRecv) == false);
+   }
+
+   GIVEN("a record with a string longer than the record")
+   {
+      //The device string length is after the fixed fields.
+      uint32_t uiLen = 0xfffffff0;
+      memcpy(vecRec.data() + 9 + 8 + 8 + 4, &uiLen, sizeof(uiLen));
+
+      IndiMessage imRecv;
+      REQUIRE(IndiBinaryCodec::decode(vecRec.data(), vecRec.size(), imRecv) == false);
+   }
+
+   GIVEN("records with bad elements")
+   {
+      IndiProperty ip(IndiProperty::Light, "dev", "prop");
+      ip.add(IndiElement("a", IndiElement::Ok));
+      ip.add(IndiElement("b", IndiElement::Alert));
+
+      std::vector<unsigned char> vecOk;
+      IndiBinaryCodec::encode(IndiMessage(IndiMessage::Define, ip), vecOk);
+
+      IndiMessage imRecv;
+      REQUIRE(IndiBinaryCodec::decode(vecOk.data(), vecOk.size(), imRecv) == true);
+
+      WHEN("the element count is too large")
+      {
+         //The count follows the 6 strings, which are the device, the name, and 4 empty strings.
+         size_t uiCount = 9 + 8 + 8 + 4 + 6*4 + 3 + 4;
+         uint32_t uiTwo = 2;
+         REQUIRE(memcmp(vecOk.data() + uiCount, &uiTwo, sizeof(uiTwo)) == 0);
+         uint32_t uiNum = 3;
+         memcpy(vecOk.data() + uiCount, &uiNum, sizeof(uiNum));
+         REQUIRE(IndiBinaryCodec::decode(vecOk.data(), vecOk.size(), imRecv) == false);
+
+         uiNum = 0xffffffff;
+         memcpy(vecOk.data() + uiCount, &uiNum, sizeof(uiNum));
+         REQUIRE(IndiBinaryCodec::decode(vecOk.data(), vecOk.size(), imRecv) == false);
+      }
+
+      WHEN("an element name repeats")
+      {
+         //Find the second element's name: a length of 1 followed by 'b'.
+         const unsigned char pucName2[5] = {1, 0, 0, 0, 'b'};
+         std::vector<unsigned char>::iterator itName2 = std::search(vecOk.begin(), vecOk.end(), pucName2, pucName2 + 5);
+         REQUIRE(itName2 != vecOk.end());
+         size_t uiName2 = (itName2 - vecOk.begin()) + 4;
+         vecOk[uiName2] = 'a';
+         REQUIRE(IndiBinaryCodec::decode(vecOk.data(), vecOk.size(), imRecv) == false);
+      }
+
+      WHEN("an element state is out of range")
+      {
+         vecOk[vecOk.size()-2] = IndiElement::Alert+1;
+         REQUIRE(IndiBinaryCodec::decode(vecOk.data(), vecOk.size(), imRecv) == false);
+
+         vecOk[vecOk.size()-2] = IndiElement::Alert;
+         vecOk[vecOk.size()-1] = IndiElement::On+1;
+         REQUIRE(IndiBinaryCodec::decode(vecOk.data(), vecOk.size(), imRecv) == false);
+      }
+   }
+}
+
+} //namespace IndiBinaryCodec_test
@@ -0,0 +1,366 @@
+#include "../../../tests/catch2/catch.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../IndiShmRing.hpp"
+
+namespace IndiShmRing_test
+{
+
+using pcf::IndiShmRing;
+
+//A ring name which won't collide with another test run.
+std::string ringName( const std::string & suffix )
+{
+   return "/IndiShmRing_test_" + std::to_string(getpid()) + "_" + suffix;
+}
+
+//Fill a record with a pattern derived from its sequence number, which is stored in the first 4 bytes.
+void makeRecord( std::vector<unsigned char> & rec,
+                 uint32_t seq,
+                 size_t len
+               )
+{
+   rec.resize(len < sizeof(seq) ? sizeof(seq) : len);
+   memcpy(rec.data(), &seq, sizeof(seq));
+   for(size_t n = sizeof(seq); n < rec.size(); ++n) rec[n] = static_cast<unsigned char>(seq*31 + n);
+}
+
+SCENARIO( "Creating and attaching to a shared memory ring", "[libcommon::IndiShmRing]" )
+{
+   GIVEN("a new ring")
+   {
+      std::string name = ringName("attach");
+
+      IndiShmRing writer;
+      REQUIRE(writer.create(name, 1024) == 0);
+      REQUIRE(writer.isAttached());
+      REQUIRE(writer.getName() == name);
+      REQUIRE(IndiShmRing::exists(name));
+
+      WHEN("a second ring attaches")
+      {
+         IndiShmRing reader;
+         REQUIRE(reader.attach(name) == 0);
+
+         const unsigned char msg[] = "hello";
+         REQUIRE(writer.write(msg, sizeof(msg)) == true);
+
+         std::vector<unsigned char> rec;
+         REQUIRE(reader.read(rec, 1000) == 1);
+         REQUIRE(rec.size() == sizeof(msg));
+         REQUIRE(memcmp(rec.data(), msg, sizeof(msg)) == 0);
+      }
+
+      WHEN("the ring is empty")
+      {
+         std::vector<unsigned char> rec;
+         REQUIRE(writer.read(rec, 10) == 0);
+      }
+
+      WHEN("the ring is detached")
+      {
+         writer.detach();
+         REQUIRE(writer.isAttached() == false);
+
+         std::vector<unsigned char> rec;
+         const unsigned char msg[] = "x";
+         REQUIRE(writer.read(rec, 10) == -1);
+         REQUIRE(writer.write(msg, 1) == false);
+      }
+
+      REQUIRE(IndiShmRing::unlink(name) == 0);
+      REQUIRE(IndiShmRing::exists(name) == false);
+   }
+
+   GIVEN("rings which aren't there or aren't rings")
+   {
+      IndiShmRing ring;
+      REQUIRE(ring.attach(ringName("missing")) == -1);
+      REQUIRE(ring.isAttached() == false);
+
+      //A segment of the right size for a ring, but without the header.
+      std::string name = ringName("garbage");
+      int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+      REQUIRE(fd >= 0);
+      REQUIRE(ftruncate(fd, 65536) == 0);
+      close(fd);
+
+      errno = 0;
+      REQUIRE(ring.attach(name) == -1);
+      REQUIRE(errno == EINVAL);
+      REQUIRE(ring.isAttached() == false);
+
+      REQUIRE(IndiShmRing::unlink(name) == 0);
+   }
+}
+
+SCENARIO( "Writing and reading records through a shared memory ring", "[libcommon::IndiShmRing]" )
+{
+   GIVEN("a small ring which wraps many times")
+   {
+      std::string name = ringName("wrap");
+
+      IndiShmRing writer, reader;
+      REQUIRE(writer.create(name, 256) == 0);
+      REQUIRE(reader.attach(name) == 0);
+
+      //Lengths up to the largest a 256 byte ring accepts, most of which don't divide the ring evenly.
+      std::vector<unsigned char> sent, rec;
+      for(uint32_t seq = 0; seq < 2000; ++seq)
+      {
+         makeRecord(sent, seq, (seq*37) % 125);
+
+         REQUIRE(writer.write(sent.data(), sent.size(), 0) == true);
+         REQUIRE(reader.read(rec, 1000) == 1);
+         REQUIRE(rec == sent);
+      }
+
+      REQUIRE(writer.getNumDropped() == 0);
+      REQUIRE(IndiShmRing::unlink(name) == 0);
+   }
+
+   GIVEN("a small ring holding several records at once across the wrap")
+   {
+      std::string name = ringName("batch");
+
+      IndiShmRing writer, reader;
+      REQUIRE(writer.create(name, 256) == 0);
+      REQUIRE(reader.attach(name) == 0);
+
+      std::vector<unsigned char> sent, rec;
+      uint32_t seqW = 0, seqR = 0;
+      for(int pass = 0; pass < 200; ++pass)
+      {
+         //Three 36 byte records (40 with the length) always fit.
+         for(int n = 0; n < 3; ++n)
+         {
+            makeRecord(sent, seqW++, 36);
+            REQUIRE(writer.write(sent.data(), sent.size(), 0) == true);
+         }
+
+         for(int n = 0; n < 3; ++n)
+         {
+            makeRecord(sent, seqR++, 36);
+            REQUIRE(reader.read(rec, 1000) == 1);
+            REQUIRE(rec == sent);
+         }
+      }
+
+      REQUIRE(reader.read(rec, 0) == 0);
+      REQUIRE(writer.getNumDropped() == 0);
+      REQUIRE(IndiShmRing::unlink(name) == 0);
+   }
+}
+
+SCENARIO( "Dropping records when a shared memory ring is full", "[libcommon::IndiShmRing]" )
+{
+   GIVEN("a small ring")
+   {
+      std::string name = ringName("full");
+
+      IndiShmRing writer, reader;
+      REQUIRE(writer.create(name, 256) == 0);
+      REQUIRE(reader.attach(name) == 0);
+
+      std::vector<unsigned char> sent, rec;
+
+      WHEN("a record is more than half the ring")
+      {
+         REQUIRE(writer.getMaxRecordSize() == 124);
+
+         makeRecord(sent, 0, 125);
+         errno = 0;
+         REQUIRE(writer.write(sent.data(), sent.size(), 1000) == false);
+         REQUIRE(errno == EMSGSIZE);
+         REQUIRE(writer.getNumDropped() == 1);
+         REQUIRE(reader.getNumDropped() == 1);
+         REQUIRE(reader.read(rec, 0) == 0);
+      }
+
+      WHEN("the reader doesn't keep up")
+      {
+         //Each record takes 64 bytes, so 4 fill the ring.
+         uint32_t seq = 0;
+         for(; seq < 4; ++seq)
+         {
+            makeRecord(sent, seq, 60);
+            REQUIRE(writer.write(sent.data(), sent.size(), 0) == true);
+         }
+
+         makeRecord(sent, seq, 60);
+         errno = 0;
+         REQUIRE(writer.write(sent.data(), sent.size(), 0) == false);
+         REQUIRE(errno == ETIMEDOUT);
+         REQUIRE(writer.getNumDropped() == 1);
+
+         //Once it has timed out, the writer doesn't wait again until the reader reads.
+         errno = 0;
+         REQUIRE(writer.write(sent.data(), sent.size(), 10000) == false);
+         REQUIRE(errno == EAGAIN);
+         REQUIRE(writer.getNumDropped() == 2);
+
+         //The records already in the ring are intact, and reading one makes room.
+         makeRecord(sent, 0, 60);
+         REQUIRE(reader.read(rec, 1000) == 1);
+         REQUIRE(rec == sent);
+
+         makeRecord(sent, seq, 60);
+         REQUIRE(writer.write(sent.data(), sent.size(), 0) == true);
+
+         for(uint32_t n = 1; n <= seq; ++n)
+         {
+            makeRecord(sent, n, 60);
+            REQUIRE(reader.read(rec, 1000) == 1);
+            REQUIRE(rec == sent);
+         }
+         REQUIRE(reader.read(rec, 0) == 0);
+      }
+
+      WHEN("a writer waiting for space is interrupted")
+      {
+         for(uint32_t seq = 0; seq < 4; ++seq)
+         {
+            makeRecord(sent, seq, 60);
+            REQUIRE(writer.write(sent.data(), sent.size(), 0) == true);
+         }
+
+         std::thread it([&writer]()
+         {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            writer.interrupt();
+         });
+
+         auto t0 = std::chrono::steady_clock::now();
+         errno = 0;
+         bool written = writer.write(sent.data(), sent.size(), 10000);
+         int err = errno;
+         auto t1 = std::chrono::steady_clock::now();
+         it.join();
+
+         THEN("it gives up without waiting out the timeout")
+         {
+            REQUIRE(written == false);
+            REQUIRE(err == EINTR);
+            REQUIRE(t1 - t0 < std::chrono::seconds(5));
+            REQUIRE(writer.getNumDropped() == 1);
+         }
+      }
+
+      REQUIRE(IndiShmRing::unlink(name) == 0);
+   }
+}
+
+SCENARIO( "Reading a corrupt shared memory ring", "[libcommon::IndiShmRing]" )
+{
+   GIVEN("a ring holding a record whose length has been overwritten")
+   {
+      std::string name = ringName("corrupt");
+
+      IndiShmRing writer, reader;
+      REQUIRE(writer.create(name, 256) == 0);
+      REQUIRE(reader.attach(name) == 0);
+
+      std::vector<unsigned char> sent, rec;
+      makeRecord(sent, 0x5a5a5a5a, 40);
+      REQUIRE(writer.write(sent.data(), sent.size(), 0) == true);
+
+      //Map the segment ourselves, and find the record's length just before its data.
+      int fd = shm_open(name.c_str(), O_RDWR, 0);
+      REQUIRE(fd >= 0);
+      struct stat st;
+      REQUIRE(fstat(fd, &st) == 0);
+      unsigned char * map = static_cast<unsigned char *>(mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+      close(fd);
+      REQUIRE(map != MAP_FAILED);
+
+      unsigned char * data = std::search(map, map + st.st_size, sent.begin(), sent.end());
+      REQUIRE(data != map + st.st_size);
+
+      uint32_t badSize = 0x7fffffff;
+      memcpy(data - sizeof(uint32_t), &badSize, sizeof(uint32_t));
+
+      WHEN("it is read")
+      {
+         errno = 0;
+         int rv = reader.read(rec, 1000);
+         int err = errno;
+
+         THEN("the record is rejected rather than read past the ring, and the ring is usable again")
+         {
+            REQUIRE(rv == -1);
+            REQUIRE(err == EBADMSG);
+            REQUIRE(reader.read(rec, 0) == 0);
+
+            makeRecord(sent, 1, 40);
+            REQUIRE(writer.write(sent.data(), sent.size(), 0) == true);
+            REQUIRE(reader.read(rec, 1000) == 1);
+            REQUIRE(rec == sent);
+         }
+      }
+
+      munmap(map, st.st_size);
+      REQUIRE(IndiShmRing::unlink(name) == 0);
+   }
+}
+
+SCENARIO( "Streaming records between threads through a shared memory ring", "[libcommon::IndiShmRing]" )
+{
+   GIVEN("a writer thread and a reader thread")
+   {
+      std::string name = ringName("stream");
+
+      IndiShmRing writer, reader;
+      REQUIRE(writer.create(name, 65536) == 0);
+      REQUIRE(reader.attach(name) == 0);
+
+      const uint32_t numRecs = 20000;
+
+      //The writer waits as long as it needs to, so nothing should be dropped.
+      std::thread wt([&writer, numRecs]()
+      {
+         std::mt19937 gen(numRecs);
+         std::uniform_int_distribution<size_t> dist(0, 2000);
+         std::vector<unsigned char> sent;
+         for(uint32_t seq = 0; seq < numRecs; ++seq)
+         {
+            makeRecord(sent, seq, dist(gen));
+            if(!writer.write(sent.data(), sent.size(), 10000)) break;
+         }
+      });
+
+      std::mt19937 gen(numRecs);
+      std::uniform_int_distribution<size_t> dist(0, 2000);
+      std::vector<unsigned char> sent, rec;
+      uint32_t seq = 0;
+      for(; seq < numRecs; ++seq)
+      {
+         if(reader.read(rec, 10000) != 1) break;
+
+         makeRecord(sent, seq, dist(gen));
+         if(rec != sent) break;
+      }
+
+      wt.join();
+
+      REQUIRE(seq == numRecs);
+      REQUIRE(reader.getNumDropped() == 0);
+      REQUIRE(reader.read(rec, 0) == 0);
+
+      REQUIRE(IndiShmRing::unlink(name) == 0);
+   }
+}
+
+} //namespace IndiShmRing_test
@@ -0,0 +1,324 @@
+#include "../../../tests/catch2/catch.hpp"
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../IndiXmlParser.hpp"
+#include "../IndiXmlStreamParser.hpp"
+
+namespace IndiXmlStreamParser_test
+{
+
+using pcf::IndiElement;
+using pcf::IndiMessage;
+using pcf::IndiProperty;
+using pcf::IndiXmlParser;
+using pcf::IndiXmlStreamParser;
+
+//What a parser made of a stream: the messages in order, and the number of errors.
+struct parseResult
+{
+   std::vector<IndiMessage> m_msgs;
+   int m_errors {0};
+};
+
+//Feed the chunks to IndiXmlParser, the way IndiConnection used to: keep calling
+//until a call neither completes a message nor reports an error, since one call
+//stops at the end of the first message and holds the rest for the next.
+parseResult parseOld( const std::vector<std::string> & chunks )
+{
+   parseResult res;
+   IndiXmlParser ixp;
+   std::string err;
+
+   for(size_t n = 0; n < chunks.size(); ++n)
+   {
+      ixp.parseXml(chunks[n], err);
+      while(true)
+      {
+         if(err.size() > 0) ++res.m_errors;
+
+         if(ixp.getState() == IndiXmlParser::CompleteState) res.m_msgs.push_back(ixp.createIndiMessage());
+         else if(err.size() == 0) break;
+
+         ixp.parseXml(std::string(), err);
+      }
+   }
+
+   return res;
+}
+
+//Feed the chunks to IndiXmlStreamParser, the way IndiConnection does.
+parseResult parseStream( const std::vector<std::string> & chunks )
+{
+   parseResult res;
+   IndiXmlStreamParser ixsp;
+   std::string err;
+
+   for(size_t n = 0; n < chunks.size(); ++n)
+   {
+      unsigned int uiOffset = 0;
+      while(uiOffset < chunks[n].size())
+      {
+         uiOffset += ixsp.parseXml(chunks[n].data() + uiOffset, chunks[n].size() - uiOffset, err);
+         if(err.size() > 0) ++res.m_errors;
+         if(ixsp.getState() == IndiXmlStreamParser::CompleteState) res.m_msgs.push_back(ixsp.createIndiMessage());
+      }
+   }
+
+   return res;
+}
+
+//A time stamp either came from the XML, and must match, or defaulted to about now in both.
+bool sameTimeStamp( const pcf::TimeStamp & tsA,
+                    const pcf::TimeStamp & tsB
+                  )
+{
+   timeval tvA = tsA.getTimeVal();
+   timeval tvB = tsB.getTimeVal();
+
+   timeval tvNow = pcf::TimeStamp::now().getTimeVal();
+   if(tvNow.tv_sec - tvA.tv_sec < 3600 && tvNow.tv_sec - tvB.tv_sec < 3600) return true;
+
+   return (tvA.tv_sec == tvB.tv_sec && tvA.tv_usec == tvB.tv_usec);
+}
+
+void requireSame( const parseResult & resOld,
+                  const parseResult & resNew
+                )
+{
+   REQUIRE(resNew.m_errors == resOld.m_errors);
+   REQUIRE(resNew.m_msgs.size() == resOld.m_msgs.size());
+
+   for(size_t n = 0; n < resOld.m_msgs.size(); ++n)
+   {
+      const IndiMessage & imOld = resOld.m_msgs[n];
+      const IndiMessage & imNew = resNew.m_msgs[n];
+
+      REQUIRE(imNew.getType() == imOld.getType());
+      REQUIRE(imNew.getProperty() == imOld.getProperty());
+      REQUIRE(imNew.getProperty().getType() == imOld.getProperty().getType());
+      REQUIRE(imNew.getProperty().getBLOBEnable() == imOld.getProperty().getBLOBEnable());
+      REQUIRE(imNew.getProperty().getTimeout() == imOld.getProperty().getTimeout());
+      REQUIRE(sameTimeStamp(imNew.getProperty().getTimeStamp(), imOld.getProperty().getTimeStamp()));
+   }
+}
+
+//Split the stream into chunks of 1 to maxChunk bytes.
+std::vector<std::string> randomChunks( const std::string & xml,
+                                       std::mt19937 & gen,
+                                       size_t maxChunk
+                                     )
+{
+   std::uniform_int_distribution<size_t> dist(1, maxChunk);
+   std::vector<std::string> chunks;
+   size_t pos = 0;
+   while(pos < xml.size())
+   {
+      size_t len = dist(gen);
+      chunks.push_back(xml.substr(pos, len));
+      pos += len;
+   }
+   return chunks;
+}
+
+//Parse the stream whole, byte by byte, and in random chunks with both parsers,
+//and require that they agree. Returns what the parsers made of it.
+parseResult compareParsers( const std::string & xml )
+{
+   parseResult resOld = parseOld({xml});
+   requireSame(resOld, parseStream({xml}));
+
+   std::vector<std::string> bytes;
+   for(size_t n = 0; n < xml.size(); ++n) bytes.push_back(xml.substr(n, 1));
+   requireSame(resOld, parseOld(bytes));
+   requireSame(resOld, parseStream(bytes));
+
+   std::mt19937 gen(xml.size());
+   for(int trial = 0; trial < 20; ++trial)
+   {
+      std::vector<std::string> chunks = randomChunks(xml, gen, 1 + trial*7);
+      requireSame(resOld, parseOld(chunks));
+      requireSame(resOld, parseStream(chunks));
+   }
+
+   return resOld;
+}
+
+const char * g_defNumber =
+   "<defNumberVector device=\"camwfs\" name=\"exptime\" label=\"Exposure Time\" group=\"Camera\"\n"
+   "    state=\"Idle\" perm=\"rw\" timeout=\"2.5\" timestamp=\"2023-11-14T22:13:20.123456\" message=\"ready\">\n"
+   "  <defNumber name=\"current\" label=\"Current\" format=\"%0.3f\" min=\"0\" max=\"100\" step=\"0.001\">\n"
+   "     0.250\n"
+   "  </defNumber>\n"
+   "  <defNumber name=\"target\" format=\"%g\" min=\"-1e3\" max=\"1e3\" step=\"0\">1.5e-3</defNumber>\n"
+   "</defNumberVector>\n";
+
+const char * g_setSwitch =
+   "<setSwitchVector device='fwpupil' name = 'filterName' state = 'Busy' timestamp='2023-11-14T22:13:21.5'\n"
+   "     label='say \"hi\"' rule='OneOfMany'>\n"
+   "<oneSwitch name='open'>On</oneSwitch><oneSwitch name='dark'>\n"
+   "Off\n"
+   "</oneSwitch>\n"
+   "</setSwitchVector>";
+
+const char * g_defText =
+   "<defTextVector device=\"dev\" name=\"text\" label=\"a &lt;b&gt; &amp; &quot;c&quot; &apos;d&apos; &unknown;\" perm=\"ro\" state=\"Ok\">"
+   "<defText name=\"t1\" label=\"T1\">x &lt; y &amp;&amp; y &gt; z</defText>"
+   "<defText name=\"t2\">&quot;quoted&quot; &apos;single&apos; &nbsp; &#65;</defText>"
+   "<defText name=\"empty\"/>"
+   "<defText name=\"spaces\">   leading and trailing   </defText>"
+   "</defTextVector>";
+
+const char * g_defLight =
+   "<defLightVector device=\"dev\" name=\"lights\" state=\"Alert\">\n"
+   "  <defLight name=\"l1\">Idle</defLight>\n"
+   "  <defLight name=\"l2\">Ok</defLight>\n"
+   "  <defLight name=\"l3\">Busy</defLight>\n"
+   "  <defLight name=\"l4\">Alert</defLight>\n"
+   "</defLightVector>\n";
+
+const char * g_blobs =
+   "<defBLOBVector device=\"cam\" name=\"image\" perm=\"ro\" state=\"Idle\"><defBLOB name=\"frame\" label=\"Frame\"/></defBLOBVector>"
+   "<setBLOBVector device=\"cam\" name=\"image\" state=\"Ok\">\n"
+   "  <oneBLOB name=\"frame\" size=\"12\" format=\".fits\">\n"
+   "SGVsbG8gV29y\n"
+   "bGQh\n"
+   "  </oneBLOB>\n"
+   "</setBLOBVector>\n"
+   "<enableBLOB device=\"cam\" name=\"image\">Also</enableBLOB>\n"
+   "<enableBLOB device=\"cam\">  Never  </enableBLOB>\n";
+
+const char * g_commands =
+   "<getProperties version=\"1.7\"/>\n"
+   "<getProperties version='1.7' device='camwfs' name='exptime' />\n"
+   "<delProperty device=\"camwfs\"/>"
+   "<delProperty device=\"camwfs\" name=\"exptime\" timestamp=\"2023-11-14T22:13:22\"></delProperty>"
+   "<message device=\"camwfs\" message=\"first line\nsecond line\ttabbed\" timestamp=\"2023-11-14T22:13:23\"/>"
+   "<newNumberVector device=\"camwfs\" name=\"exptime\"><oneNumber name=\"target\">0.1</oneNumber></newNumberVector>"
+   "<newTextVector device=\"camwfs\" name=\"text\"><oneText name=\"t\">new &amp; improved</oneText></newTextVector>"
+   "<newSwitchVector device=\"camwfs\" name=\"sw\"><oneSwitch name=\"a\">On</oneSwitch><oneSwitch name=\"b\">Off</oneSwitch></newSwitchVector>";
+
+const char * g_declarations =
+   "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+   "<!-- a comment between messages -->\n"
+   "some stray text between messages\n"
+   "<getProperties version=\"1.7\" device=\"a\"/>"
+   "<defNumberVector device=\"a\" name=\"b\"><!-- a comment in the content --><defNumber name=\"n\">4</defNumber></defNumberVector>";
+
+SCENARIO( "The stream parser and the lilxml parser agree on well formed XML", "[libcommon::IndiXmlStreamParser]" )
+{
+   GIVEN("number vectors")
+   {
+      parseResult res = compareParsers(g_defNumber);
+      REQUIRE(res.m_errors == 0);
+      REQUIRE(res.m_msgs.size() == 1);
+      REQUIRE(res.m_msgs[0].getProperty()["current"].getValue() == "0.250");
+      REQUIRE(res.m_msgs[0].getProperty().getTimeout() == 2.5);
+   }
+
+   GIVEN("switch vectors with single quotes and spaces around the equals signs")
+   {
+      parseResult res = compareParsers(g_setSwitch);
+      REQUIRE(res.m_errors == 0);
+      REQUIRE(res.m_msgs.size() == 1);
+      REQUIRE(res.m_msgs[0].getProperty().getLabel() == "say \"hi\"");
+      REQUIRE(res.m_msgs[0].getProperty()["open"].getSwitchState() == IndiElement::On);
+      REQUIRE(res.m_msgs[0].getProperty()["dark"].getSwitchState() == IndiElement::Off);
+   }
+
+   GIVEN("text vectors with entities and self-closing elements")
+   {
+      parseResult res = compareParsers(g_defText);
+      REQUIRE(res.m_errors == 0);
+      REQUIRE(res.m_msgs.size() == 1);
+      REQUIRE(res.m_msgs[0].getProperty().getLabel() == "a <b> & \"c\" 'd' &unknown;");
+      REQUIRE(res.m_msgs[0].getProperty()["t1"].getValue() == "x < y && y > z");
+      REQUIRE(res.m_msgs[0].getProperty()["empty"].getValue() == "");
+      REQUIRE(res.m_msgs[0].getProperty()["spaces"].getValue() == "leading and trailing");
+   }
+
+   GIVEN("light vectors")
+   {
+      parseResult res = compareParsers(g_defLight);
+      REQUIRE(res.m_errors == 0);
+      REQUIRE(res.m_msgs.size() == 1);
+      REQUIRE(res.m_msgs[0].getProperty()["l4"].getLightState() == IndiElement::Alert);
+   }
+
+   GIVEN("BLOBs and BLOB enables")
+   {
+      parseResult res = compareParsers(g_blobs);
+      REQUIRE(res.m_errors == 0);
+      REQUIRE(res.m_msgs.size() == 4);
+      REQUIRE(res.m_msgs[2].getProperty().getBLOBEnable() == IndiProperty::Also);
+      REQUIRE(res.m_msgs[3].getProperty().getBLOBEnable() == IndiProperty::Never);
+   }
+
+   GIVEN("commands, messages, and new vectors")
+   {
+      parseResult res = compareParsers(g_commands);
+      REQUIRE(res.m_errors == 0);
+      REQUIRE(res.m_msgs.size() == 8);
+      REQUIRE(res.m_msgs[2].getType() == IndiMessage::Delete);
+      REQUIRE(res.m_msgs[4].getType() == IndiMessage::Message);
+   }
+
+   GIVEN("declarations, comments, and text outside the messages")
+   {
+      parseResult res = compareParsers(g_declarations);
+      REQUIRE(res.m_errors == 0);
+      REQUIRE(res.m_msgs.size() == 2);
+   }
+
+   GIVEN("all of them in one stream")
+   {
+      std::string xml = std::string(g_declarations) + g_defNumber + g_setSwitch + g_defText + g_defLight + g_blobs + g_commands;
+      parseResult res = compareParsers(xml);
+      REQUIRE(res.m_errors == 0);
+      REQUIRE(res.m_msgs.size() == 18);
+   }
+}
+
+SCENARIO( "The stream parser and the lilxml parser agree on malformed XML", "[libcommon::IndiXmlStreamParser]" )
+{
+   //Each bad message is followed by a good one, which both parsers must recover to read.
+   const std::vector<std::string> bad = {
+      "<defNumberVector device=\"a\" name=\"b\"><defNumber name=\"x\">1</defNumberX></defNumberVector>",
+      "<defNumberVector device=\"a\" name=\"b\"><defNumber name=\"x\">1</defNumber></defNumberVectorX>",
+      "<getProperties version=1.7/>",
+      "<getProperties version\"1.7\"/>",
+      "<getProperties \"version\"=\"1.7\"/>",
+      "<getProperties version=\"1.7\"/ >",
+      "<1getProperties/>",
+      "</getProperties>",
+      "<defTextVector device=\"a\" name=\"b\"><defText name=\"x\">1</defText =></defTextVector>",
+   };
+
+   const std::string good = "<defSwitchVector device=\"a\" name=\"b\"><defSwitch name=\"s\">On</defSwitch></defSwitchVector>";
+
+   for(size_t n = 0; n < bad.size(); ++n)
+   {
+      GIVEN("malformed XML: " + bad[n])
+      {
+         parseResult res = compareParsers(bad[n] + "\n" + good);
+         REQUIRE(res.m_errors > 0);
+         REQUIRE(res.m_msgs.size() == 1);
+         REQUIRE(res.m_msgs[0].getProperty().getType() == IndiProperty::Switch);
+      }
+   }
+
+   GIVEN("all of them in one stream, between good messages")
+   {
+      std::string xml = good;
+      for(size_t n = 0; n < bad.size(); ++n) xml += bad[n] + good;
+
+      parseResult res = compareParsers(xml);
+      REQUIRE(res.m_errors >= static_cast<int>(bad.size()));
+      REQUIRE(res.m_msgs.size() == bad.size() + 1);
+   }
+}
+
+} //namespace IndiXmlStreamParser_test
@@ -9,6 +9,11 @@
 #include <signal.h>
 #include <sys/stat.h>
 
+#include "../libcommon/IndiShmRing.hpp"
+#include "../libcommon/IndiBinaryCodec.hpp"
+#include "../libcommon/IndiXmlParser.hpp"
+#include "../libcommon/IndiXmlStreamParser.hpp"
+
 #ifndef XINDID_BUFFSIZE
 #define XINDID_BUFFSIZE (1024)
 #endif
@@ -17,6 +22,10 @@
 #define XINDID_FIFODIR "."
 #endif
 
+#ifndef XINDID_PROTOCOLVERSION
+#define XINDID_PROTOCOLVERSION "1.7"
+#endif
+
 #ifndef XINDID_COMPILEDNAME
 #define XINDID_COMPILEDNAME "xindidriver"
 #endif
@@ -302,6 +311,186 @@ void * xoverThread( void * vdf /**< [in] pointer to a driverFIFO struct */)
 }
 
 
+/// The details of one driver shared memory ring, this is passed to shmInThread or shmOutThread.
+/** The device controller creates the rings, named "/drivername.in" and "/drivername.out", instead of using the FIFOs.
+  * Messages on the rings are binary (see pcf::IndiBinaryCodec), and are translated to and from XML here.
+  */
+struct driverRing
+{
+   std::string ringName;    ///< the name of the shared memory ring
+   std::string lockName;    ///< the name of the FIFO to lock to ensure only one instance is running.  Empty for no lock.
+   pcf::IndiShmRing ring;   ///< the ring, attached by the thread.
+
+   /// Constructor to initialize the names.
+   driverRing( const std::string & rn, ///< [in] the ringName to set
+               const std::string & ln  ///< [in] the lockName to set
+             ) : ringName(rn), lockName(ln)
+   {
+   }
+};
+
+/// Lock the named FIFO, using the same scheme as xoverThread.
+/**
+  * \returns the locked file descriptor on success
+  * \returns -1 on error, which is reported.
+  */
+int lockFIFO( const std::string & fileName /**< [in] the FIFO to lock*/)
+{
+   int fd = open( fileName.c_str(), O_RDWR);
+
+   if(fd < 0)
+   {
+      std::cerr << " (" << XINDID_COMPILEDNAME << "): failed to open " << fileName << ".\n";
+      return -1;
+   }
+
+   struct flock fl;
+   fl.l_type = F_WRLCK; //get an exclusive lock
+   fl.l_whence = SEEK_SET;
+   fl.l_start = 0;
+   fl.l_len = 0;
+   fl.l_pid = getpid();
+
+   if(fcntl(fd, F_SETLK, &fl) < 0)
+   {
+      std::cerr << " (" << XINDID_COMPILEDNAME << "): failed to lock " << fileName << ".  Another process is already running.  Kill the zombies.\n";
+      close(fd);
+      return -1;
+   }
+
+   return fd;
+}
+
+/// Work function for the STDIN to shared memory thread.
+/** Parses the XML from indiserver and writes binary messages to the controller's input ring.
+  */
+void * shmInThread( void * vdr /**< [in] pointer to a driverRing struct */)
+{
+   driverRing * dr = static_cast<driverRing *>(vdr);
+
+   int lockfd = -1;
+   if(dr->lockName != "")
+   {
+      lockfd = lockFIFO(dr->lockName);
+      if(lockfd < 0) return nullptr;
+   }
+
+   if(dr->ring.attach(dr->ringName) < 0)
+   {
+      std::cerr << " (" << XINDID_COMPILEDNAME << "): failed to attach " << dr->ringName << ": " << std::strerror(errno) << "\n";
+      if(lockfd >= 0) close(lockfd);
+      return nullptr;
+   }
+
+   char rdbuff[XINDID_BUFFSIZE];
+   std::vector<unsigned char> record;
+   pcf::IndiXmlStreamParser parser;
+   std::string errMsg;
+
+   while(!timeToDie)
+   {
+      int rd = read(STDIN_FILENO, rdbuff, XINDID_BUFFSIZE);
+
+      if(timeToDie) break; //Woke up from a blocking read due to a signal
+
+      if(rd < 0)
+      {
+         if(errno == EINTR) continue;
+
+         std::cerr << " (" << XINDID_COMPILEDNAME << "): " << std::strerror( errno);
+         std::cerr << " in " << __FILE__ << " at " << __LINE__ << "\n";
+         break;
+      }
+
+      if(rd == 0) break; //indiserver has gone away
+
+      int parsed = 0;
+      while(parsed < rd)
+      {
+         parsed += parser.parseXml( rdbuff + parsed, rd - parsed, errMsg );
+
+         if( parser.getState() != pcf::IndiXmlStreamParser::CompleteState ) continue;
+
+         pcf::IndiBinaryCodec::encode( parser.createIndiMessage(), record );
+
+         if(!dr->ring.write( record.data(), record.size() ))
+         {
+            std::cerr << " (" << XINDID_COMPILEDNAME << "): message dropped on " << dr->ringName << ": " << std::strerror(errno) << "\n";
+         }
+      }
+   }
+
+   dr->ring.detach();
+   if(lockfd >= 0) close(lockfd);
+
+   return nullptr;
+}
+
+/// Work function for the shared memory to STDOUT thread.
+/** Reads binary messages from the controller's output ring and writes the XML to indiserver.
+  */
+void * shmOutThread( void * vdr /**< [in] pointer to a driverRing struct */)
+{
+   driverRing * dr = static_cast<driverRing *>(vdr);
+
+   if(dr->ring.attach(dr->ringName) < 0)
+   {
+      std::cerr << " (" << XINDID_COMPILEDNAME << "): failed to attach " << dr->ringName << ": " << std::strerror(errno) << "\n";
+      return nullptr;
+   }
+
+   std::vector<unsigned char> record;
+
+   while(!timeToDie)
+   {
+      int rv = dr->ring.read( record, 1000 );
+
+      if(timeToDie) break;
+
+      if(rv < 0)
+      {
+         std::cerr << " (" << XINDID_COMPILEDNAME << "): error reading " << dr->ringName;
+         std::cerr << " in " << __FILE__ << " at " << __LINE__ << "\n";
+         sleep(1);
+         continue;
+      }
+
+      if(rv == 0) continue; //timeout
+
+      pcf::IndiMessage msg;
+      if(!pcf::IndiBinaryCodec::decode( record.data(), record.size(), msg ))
+      {
+         std::cerr << " (" << XINDID_COMPILEDNAME << "): malformed record on " << dr->ringName << "\n";
+         continue;
+      }
+
+      pcf::IndiXmlParser ixp( msg, XINDID_PROTOCOLVERSION );
+      std::string xml = ixp.createXmlString();
+
+      //We write until we have written all of it.
+      size_t totwr = 0;
+      while(totwr != xml.size() && !timeToDie)
+      {
+         int wr = write(STDOUT_FILENO, xml.data() + totwr, xml.size() - totwr);
+
+         if( wr < 0 )
+         {
+            if(errno == EINTR) continue;
+
+            std::cerr << " (" << XINDID_COMPILEDNAME << "): " << std::strerror( errno);
+            std::cerr << " in " << __FILE__ << " at " << __LINE__ << "\n";
+            break;
+         }
+
+         totwr += wr;
+      }
+   }
+
+   dr->ring.detach();
+
+   return nullptr;
+}
+
 /// Work function for the restart FIFO thread 
 void * ctrlThread( void * vdf /**< [in] pointer to a driverFIFO struct */)
 {
@@ -481,12 +670,30 @@ int main( int argc, char **argv)
    
    sleep(2); //This gives indiserver time to startup so it can handle any thing that comes from the fifos.
 
+   //If the controller has created shared memory rings we use them instead of the FIFOs.
+   //The controller writes to the ctrl FIFO after it creates them, so we are always restarted in the right mode.
+   driverRing drIn ("/" + myName + ".in", stdinFifo);
+
+   driverRing drOut ("/" + myName + ".out", "");
+
+   bool useShm = pcf::IndiShmRing::exists(drIn.ringName) && pcf::IndiShmRing::exists(drOut.ringName);
+
    //Launch the read/write threads, one each for STDIN and STDOUT and for control.
    pthread_t stdIn_th = 0;
-   pthread_create( &stdIn_th, NULL, xoverThread, &dfIn );
-
    pthread_t stdOut_th = 0;
-   pthread_create( &stdOut_th, NULL, xoverThread, &dfOut );
+
+   if(useShm)
+   {
+      std::cerr << " (" << XINDID_COMPILEDNAME << "): using shared memory " << drIn.ringName << " & " << drOut.ringName << std::endl;
+
+      pthread_create( &stdIn_th, NULL, shmInThread, &drIn );
+      pthread_create( &stdOut_th, NULL, shmOutThread, &drOut );
+   }
+   else
+   {
+      pthread_create( &stdIn_th, NULL, xoverThread, &dfIn );
+      pthread_create( &stdOut_th, NULL, xoverThread, &dfOut );
+   }
 
    pthread_t ctrl_th = 0;
    pthread_create( &ctrl_th, NULL, ctrlThread, &dfCtrl );
@@ -58,6 +58,7 @@ EXTRA_LDFLAGS ?=
 EXTRA_LDLIBS ?=  -lmxlib \
   -ludev \
   -lpthread \
+  -lrt \
   -ltelnet \
   -lcfitsio \
   -lxrif \
@@ -164,6 +164,8 @@ protected:
    
    Scalar * m_dminputs {nullptr}; ///< Pre-allocated command vector, used only in commandDM
    
+   dev::actuatorMap<dev::alpaoActuators, realT, Scalar> m_actMap; ///< Converts the shape to the command vector, set up in initDM
+   
    asdkDM * m_dm {nullptr}; ///< ALPAO SDK handle for the DM.
    
 public:
@@ -362,6 +364,14 @@ int alpaoCtrl::initDM()
       return -1;
    }
    
+   if(m_actMap.setup(m_actuator_mapping, m_nbAct, m_dmWidth*m_dmHeight, m_volume_factor/m_max_stroke) < 0)
+   {
+      log<text_log>("DM initialization failed.  Actuator mapping does not match dm.width and dm.height.", logPrio::LOG_ERROR);
+      return -1;
+   }
+   
+   satMaskMapping(m_actuator_mapping, m_nbAct);
+   
    state(stateCodes::OPERATING);
    
    return 0;
@@ -405,55 +415,22 @@ int alpaoCtrl::commandDM(void * curr_src)
 
    //This is based on Kyle Van Gorkoms original sendCommand function.
    
-   /*This loop performs the following steps:
-     1) converts from float to double (ALPAO Scalar)
+   /*This performs the following steps:
+     1) maps from the 2D shape to the command vector, converting from float to double (ALPAO Scalar)
      2) convert to volume-normalized displacement (microns)
      3) convert to fractional stroke (-1 to +1) that the ALPAO SDK expects
-     4) calculate the mean
+     4) remove the mean
+     5) clip to fractional values between -1 and 1, recording saturation.
+        The ALPAO SDK doesn't seem to check for this, which
+        is scary and a little odd.
    */
-   Scalar mean = 0;
-   for (UInt idx = 0; idx < m_nbAct; ++idx)
-   {
-     m_dminputs[idx] = ((Scalar)  ((realT *) curr_src)[m_actuator_mapping[idx]]) * m_volume_factor/m_max_stroke;
-     mean += m_dminputs[idx];
-   }
-   mean /= m_nbAct;
-
-   /*This loop performas the following steps:
-      1) remove mean from each actuator input
-      2) clip to fractional values between -1 and 1.
-         The ALPAO SDK doesn't seem to check for this, which
-         is scary and a little odd.
-   */
-   for (UInt idx = 0 ; idx < m_nbAct ; ++idx)
-   {
-      m_dminputs[idx] -= mean;
-      if (m_dminputs[idx] > 1)
-      {
-         ++m_nsat;
-         m_dminputs[idx] = 1;
-      } else if (m_dminputs[idx] < -1)
-      {
-         ++m_nsat;
-         m_dminputs[idx] = - 1;
-      }
-   }
+   m_nsat += m_actMap.apply(m_dminputs, (realT *) curr_src);
     
    /* Finally, send the command to the DM */
    ret = asdkSend(m_dm, m_dminputs);
 
-   /* Now update the instantaneous sat map */
-   for (UInt idx = 0; idx < m_nbAct; ++idx)
-   {
-      if(m_dminputs[idx] >= 1 || m_dminputs[idx] <= -1)
-      {
-         m_instSatMap.data()[m_actuator_mapping[idx]] = 1;
-      }
-      else
-      {
-         m_instSatMap.data()[m_actuator_mapping[idx]] = 0;
-      }
-   }
+   /* Now record the saturation */
+   recordSat(m_actMap.satMask().data());
    
    return ret;
     
@@ -177,6 +177,8 @@ protected:
    
    double * m_dminputs {nullptr}; ///< Pre-allocated command vector, used only in commandDM
    
+   dev::actuatorMap<dev::bmcActuators, realT, double> m_actMap; ///< Converts the shape to the command vector, set up in initDM
+   
    DM m_dm = {}; ///< BMC SDK handle for the DM.
    
    bool m_dmopen {false}; ///< Track whether the DM connection has been opened
@@ -385,6 +387,14 @@ int bmcCtrl::initDM()
       return -1;
    }
    
+   if(m_actMap.setup(m_actuator_mapping, m_nbAct, m_dmWidth*m_dmHeight, m_volume_factor/m_act_gain) < 0)
+   {
+      log<text_log>("DM initialization failed.  Actuator mapping does not match dm.width and dm.height.", logPrio::LOG_ERROR);
+      return -1;
+   }
+   
+   satMaskMapping(m_actuator_mapping, m_nbAct);
+   
    state(stateCodes::OPERATING);
    
    return 0;
@@ -428,52 +438,13 @@ int bmcCtrl::commandDM(void * curr_src)
 {
    //This is based on Kyle Van Gorkoms original sendCommand function.
    
-   /*This loop performs the following steps:
-     1) converts from float to double
-     2) convert to volume-normalized displacement
-     3) convert to squared fractional voltage (0 to +1)
-     4) calculate the mean
+   /*In one pass over the actuators, this:
+     1) maps from the 2D shape to the command vector, converting from float to double
+     2) converts to volume-normalized displacement
+     3) clips to squared fractional voltage (0 to +1), recording saturation
+     4) takes the square root to approximate the voltage-displacement curve
    */
-
-
-   // want to rework the logic here so that we don't have to check
-   // if every actuator is addressable.
-   // Loop over addressable only?
-   //double mean = 0;
-   for (uint32_t idx = 0; idx < m_nbAct; ++idx)
-   {
-     int address = m_actuator_mapping[idx];
-     if(address == -1)
-     {
-        m_dminputs[idx] = 0.; // addressable but ignored actuators set to 0
-     } 
-     else 
-     {
-        m_dminputs[idx] = ((double)  ((realT *) curr_src)[address]) * m_volume_factor/m_act_gain;
-        //mean += m_dminputs[idx];
-     }
-   }
-   //mean /= m_nbAct;
-
-   /*This loop performas the following steps:
-      1) remove mean from each actuator input (and add midpoint bias)
-      2) clip to fractional values between 0 and 1.
-      3) take the square root to approximate the voltage-displacement curve
-   */
-   for (uint32_t idx = 0 ; idx < m_nbAct ; ++idx)
-   {
-      //m_dminputs[idx] -= mean - 0.5;
-      if (m_dminputs[idx] > 1)
-      {
-         ++m_nsat;
-         m_dminputs[idx] = 1;
-      } else if (m_dminputs[idx] < 0)
-      {
-         ++m_nsat;
-         m_dminputs[idx] = 0;
-      }
-      m_dminputs[idx] = sqrt(m_dminputs[idx]);
-   }
+   m_nsat += m_actMap.apply(m_dminputs, (realT *) curr_src);
 
    /* Finally, send the command to the DM */
    BMCRC ret = BMCSetArray(&m_dm, m_dminputs, NULL);
@@ -488,21 +459,8 @@ int bmcCtrl::commandDM(void * curr_src)
       return -1;
    }
 
-   /* Now update the instantaneous sat map */
-   for (uint32_t idx = 0; idx < m_nbAct; ++idx)
-   {
-      int address = m_actuator_mapping[idx];
-      if(address == -1) continue;
-     
-      if(m_dminputs[idx] >= 1 || m_dminputs[idx] <= 0)
-      {
-         m_instSatMap.data()[address] = 1;
-      }
-      else
-      {
-         m_instSatMap.data()[address] = 0;
-      }
-   }
+   /* Now record the saturation */
+   recordSat(m_actMap.satMask().data());
    
    return ret;
 }
@@ -71,6 +71,10 @@ protected:
 
    std::mutex m_modeBlockMutex;
 
+   sys::fileWatcher m_confWatcher; ///< Watches the loop conf directory for changes to the mode block files.
+   int m_blockWatch {-1}; ///< The id of the mode block watch.
+   uint64_t m_blockGeneration {0}; ///< The generation of the mode block index last read by getModeBlocks.
+
 
    float m_maxLim {0.0}; ///< The current max limit
    float m_maxLim_target {0.0}; ///< The target max limit
@@ -400,6 +404,12 @@ int cacaoInterface::appStartup()
       return log<text_log, -1>("Could not get loop name and/or number", logPrio::LOG_CRITICAL);
    }
    
+   m_blockWatch = m_confWatcher.addWatch(m_loopDir + "conf/", "param_blockoffset_", "", ".txt");
+   if(m_confWatcher.start() < 0)
+   {
+      return log<software_error, -1>({__FILE__, __LINE__, "could not start conf watcher"});
+   }
+
    if(getModeBlocks() < 0)
    {
       return log<text_log, -1>("Could not get mode blocks", logPrio::LOG_CRITICAL);
@@ -501,6 +511,7 @@ int cacaoInterface::appLogic()
 
 int cacaoInterface::appShutdown()
 {
+   m_confWatcher.stop();
    
    if(m_fmThread.joinable())
    {
@@ -575,8 +586,13 @@ int cacaoInterface::getLoopNameNumber()
 
 int cacaoInterface::getModeBlocks()
 {
+   uint64_t generation = m_blockGeneration;
+   if(!m_confWatcher.changed(m_blockWatch, generation))
+   {
+      return 0;
+   }
 
-   std::vector<std::string> blocks = mx::ioutils::getFileNames(m_loopDir + "conf/", "param_blockoffset_", "", ".txt");
+   std::vector<std::string> blocks = m_confWatcher.files(m_blockWatch);
 
    if(blocks.size() == 0)
    {
@@ -620,6 +636,9 @@ int cacaoInterface::getModeBlocks()
       }
    }
 
+   //Only now, so that a failed read is tried again
+   m_blockGeneration = generation;
+
    //now detect changes.
    bool changed = false;
    if(m_modeBlockStart.size() != Nb || m_modeBlockN.size() != Nb || m_modeBlockGains.size() != Nb || m_modeBlockMCs.size() != Nb || m_modeBlockLims.size() != Nb)
@@ -0,0 +1,16 @@
+/** \file camSimulator.cpp
+  * \brief The MagAO-X synthetic camera main program source file.
+  *
+  * \ingroup camSimulator_files
+  */
+
+#include "camSimulator.hpp"
+
+
+int main(int argc, char **argv)
+{
+   MagAOX::app::camSimulator xapp;
+
+   return xapp.main(argc, argv);
+
+}
@@ -0,0 +1,424 @@
+/** \file camSimulator.hpp
+  * \brief The MagAO-X synthetic camera header file
+  *
+  * \ingroup camSimulator_files
+  */
+
+#ifndef camSimulator_hpp
+#define camSimulator_hpp
+
+#include <atomic>
+#include <limits>
+
+#include "../../libMagAOX/libMagAOX.hpp" //Note this is included on command line to trigger pch
+#include "../../magaox_git_version.h"
+
+#include "syntheticFrames.hpp"
+
+/** \defgroup camSimulator Synthetic Camera
+  * \brief A camera which writes synthetic frames to a stream at a set rate, for testing and benchmarking.
+  *
+  * <a href="../handbook/operating/software/apps/camSimulator.html">Application Documentation</a>
+  *
+  * \ingroup apps
+  *
+  */
+
+/** \defgroup camSimulator_files Synthetic Camera Files
+  * \ingroup camSimulator
+  */
+
+namespace MagAOX
+{
+namespace app
+{
+
+/// A camera which writes synthetic frames to a stream at a set rate.
+/** The frames are made by syntheticFrames, with photon and read noise on one of several scenes, so that the image
+  * pipeline, e.g. the streamWriter, can be stressed reproducibly without a camera.  The frame rate can be changed
+  * with the fps property.  If the frames can not be made at the set rate they are counted as late, and the rate
+  * actually achieved is reported as fps.current.
+  *
+  * \ingroup camSimulator
+  */
+class camSimulator : public MagAOXApp<>, public dev::frameGrabber<camSimulator>
+{
+
+   //Give the test harness access.
+   friend class camSimulator_test;
+
+   friend class dev::frameGrabber<camSimulator>;
+
+   //The base frameGrabber type
+   typedef dev::frameGrabber<camSimulator> frameGrabberT;
+
+public:
+   /** \name app::dev Configurations
+     *@{
+     */
+
+   static constexpr bool c_frameGrabber_flippable = false; ///< app:dev config to tell framegrabber these images can not be flipped
+
+   ///@}
+
+protected:
+
+   /** \name Configurable Parameters
+     *@{
+     */
+
+   uint32_t m_simWidth {512}; ///< The width of the frames.  Default is 512.
+
+   uint32_t m_simHeight {512}; ///< The height of the frames.  Default is 512.
+
+   std::string m_simDataType {"uint16"}; ///< The data type of the frames, uint16, int16 or float.  Default is uint16.
+
+   std::string m_simPattern {"pupils"}; ///< The scene, flat, psf or pupils.  Default is pupils.
+
+   double m_simPeak {2000}; ///< The peak of the scene, in photons per pixel.  Default is 2000.
+
+   double m_simBackground {20}; ///< The background, in photons per pixel.  Default is 20.
+
+   double m_simReadNoise {3}; ///< The read noise, in ADU.  Default is 3.
+
+   double m_simBias {200}; ///< The bias, in ADU.  Default is 200.
+
+   unsigned m_simNFrames {16}; ///< The number of noisy frames in the bank.  Default is 16.
+
+   uint64_t m_simSeed {1}; ///< The random seed.  Default is 1.
+
+   float m_fps {100}; ///< The frame rate.  Default is 100.
+
+   ///@}
+
+   syntheticFrames m_synth; ///< The frame generator.
+
+   timespec m_nextFrame {0,0}; ///< The time of the next frame.
+
+   std::atomic<uint64_t> m_frames {0}; ///< The number of frames written.
+
+   std::atomic<uint64_t> m_lateFrames {0}; ///< The number of frames which could not be made at the set rate.
+
+   uint64_t m_lastFrames {0}; ///< The number of frames written at the last rate measurement.
+
+   timespec m_lastFramesTime {0,0}; ///< The time of the last rate measurement.
+
+   float m_fpsAchieved {0}; ///< The measured frame rate.
+
+public:
+   /// Default c'tor.
+   camSimulator();
+
+   /// D'tor, declared and defined for noexcept.
+   ~camSimulator() noexcept
+   {}
+
+   virtual void setupConfig();
+
+   /// Implementation of loadConfig logic, separated for testing.
+   /** This is called by loadConfig().
+     */
+   int loadConfigImpl( mx::app::appConfigurator & _config /**< [in] an application configuration from which to load values*/);
+
+   virtual void loadConfig();
+
+   /// Startup function
+   /**
+     *
+     */
+   virtual int appStartup();
+
+   /// Implementation of the FSM for camSimulator.
+   /**
+     * \returns 0 on no critical error
+     * \returns -1 on an error requiring shutdown
+     */
+   virtual int appLogic();
+
+   /// Shutdown the app.
+   /**
+     *
+     */
+   virtual int appShutdown();
+
+   /** \name framegrabber Interface
+     *
+     * @{
+     */
+
+   int configureAcquisition();
+   float fps();
+   int startAcquisition();
+   int acquireAndCheckValid();
+   int loadImageIntoStream(void * dest);
+   int reconfig();
+
+   ///@}
+
+   /** \name INDI
+     * @{
+     */
+protected:
+
+   pcf::IndiProperty m_indiP_fps;
+
+   pcf::IndiProperty m_indiP_late;
+
+public:
+   INDI_NEWCALLBACK_DECL(camSimulator, m_indiP_fps);
+
+   ///@}
+};
+
+inline
+camSimulator::camSimulator() : MagAOXApp(MAGAOX_CURRENT_SHA1, MAGAOX_REPO_MODIFIED)
+{
+   m_powerMgtEnabled = false;
+
+   return;
+}
+
+inline
+void camSimulator::setupConfig()
+{
+   frameGrabberT::setupConfig(config);
+
+   config.add("camsim.width", "", "camsim.width", argType::Required, "camsim", "width", false, "uint32_t", "The width of the frames.  Default is 512.");
+   config.add("camsim.height", "", "camsim.height", argType::Required, "camsim", "height", false, "uint32_t", "The height of the frames.  Default is 512.");
+   config.add("camsim.dataType", "", "camsim.dataType", argType::Required, "camsim", "dataType", false, "string", "The data type of the frames, uint16, int16 or float.  Default is uint16.");
+   config.add("camsim.pattern", "", "camsim.pattern", argType::Required, "camsim", "pattern", false, "string", "The scene: flat, psf (a star with faint companions), or pupils (the 4 pupils of a pyramid WFS).  Default is pupils.");
+   config.add("camsim.peak", "", "camsim.peak", argType::Required, "camsim", "peak", false, "double", "The peak of the scene, in photons per pixel.  Default is 2000.");
+   config.add("camsim.background", "", "camsim.background", argType::Required, "camsim", "background", false, "double", "The background, in photons per pixel.  Default is 20.");
+   config.add("camsim.readNoise", "", "camsim.readNoise", argType::Required, "camsim", "readNoise", false, "double", "The read noise, in ADU.  Default is 3.");
+   config.add("camsim.bias", "", "camsim.bias", argType::Required, "camsim", "bias", false, "double", "The bias, in ADU.  Default is 200.");
+   config.add("camsim.noiseFrames", "", "camsim.noiseFrames", argType::Required, "camsim", "noiseFrames", false, "unsigned", "The number of noisy frames made at startup, which are written in random order.  Default is 16.");
+   config.add("camsim.seed", "", "camsim.seed", argType::Required, "camsim", "seed", false, "uint64_t", "The random seed, so runs are reproducible.  Default is 1.");
+   config.add("camsim.fps", "", "camsim.fps", argType::Required, "camsim", "fps", false, "float", "The frame rate.  Default is 100.  Can be changed via INDI.");
+}
+
+inline
+int camSimulator::loadConfigImpl( mx::app::appConfigurator & _config )
+{
+   frameGrabberT::loadConfig(_config);
+
+   _config(m_simWidth, "camsim.width");
+   _config(m_simHeight, "camsim.height");
+   _config(m_simDataType, "camsim.dataType");
+   _config(m_simPattern, "camsim.pattern");
+   _config(m_simPeak, "camsim.peak");
+   _config(m_simBackground, "camsim.background");
+   _config(m_simReadNoise, "camsim.readNoise");
+   _config(m_simBias, "camsim.bias");
+   _config(m_simNFrames, "camsim.noiseFrames");
+   _config(m_simSeed, "camsim.seed");
+   _config(m_fps, "camsim.fps");
+
+   return 0;
+}
+
+inline
+void camSimulator::loadConfig()
+{
+   loadConfigImpl(config);
+}
+
+inline
+int camSimulator::appStartup()
+{
+   int pattern = syntheticFrames::pattern(m_simPattern);
+   if(pattern < 0)
+   {
+      return log<software_critical,-1>({__FILE__, __LINE__, "invalid pattern: " + m_simPattern});
+   }
+
+   uint8_t dataType = syntheticFrames::dataType(m_simDataType);
+   if(dataType == 0)
+   {
+      return log<software_critical,-1>({__FILE__, __LINE__, "invalid data type: " + m_simDataType});
+   }
+
+   if(m_fps <= 0)
+   {
+      return log<software_critical,-1>({__FILE__, __LINE__, "fps must be > 0"});
+   }
+
+   if(m_synth.setup(m_simWidth, m_simHeight, dataType, pattern, m_simPeak, m_simBackground, m_simReadNoise, m_simBias, m_simNFrames, m_simSeed) < 0)
+   {
+      return log<software_critical,-1>({__FILE__, __LINE__, "invalid frame size or number of noise frames"});
+   }
+
+   log<text_log>("made " + std::to_string(m_simNFrames) + " " + std::to_string(m_simWidth) + "x" + std::to_string(m_simHeight) + " " + m_simDataType + " " + m_simPattern + " frames");
+
+   createStandardIndiNumber<float>( m_indiP_fps, "fps", 0, std::numeric_limits<float>::max(), 0, "%0.2f");
+   m_indiP_fps["current"].set(0);
+   m_indiP_fps["target"].set(m_fps);
+   if( registerIndiPropertyNew( m_indiP_fps, INDI_NEWCALLBACK(m_indiP_fps)) < 0)
+   {
+      log<software_error>({__FILE__,__LINE__});
+      return -1;
+   }
+
+   REG_INDI_NEWPROP_NOCB(m_indiP_late, "late", pcf::IndiProperty::Number);
+   m_indiP_late.add(pcf::IndiElement("frames"));
+   m_indiP_late["frames"] = 0;
+
+   clock_gettime(CLOCK_REALTIME, &m_lastFramesTime);
+
+   if(frameGrabberT::appStartup() < 0)
+   {
+      return log<software_error,-1>({__FILE__, __LINE__});
+   }
+
+   state(stateCodes::OPERATING);
+
+   return 0;
+}
+
+inline
+int camSimulator::appLogic()
+{
+   if( frameGrabberT::appLogic() < 0)
+   {
+      return log<software_error,-1>({__FILE__,__LINE__});
+   }
+
+   //Measure the rate over the last loop
+   timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+
+   uint64_t frames = m_frames;
+   double dt = (ts.tv_sec - m_lastFramesTime.tv_sec) + (ts.tv_nsec - m_lastFramesTime.tv_nsec)/1e9;
+   if(dt > 0) m_fpsAchieved = (frames - m_lastFrames)/dt;
+
+   m_lastFrames = frames;
+   m_lastFramesTime = ts;
+
+   std::unique_lock<std::mutex> lock(m_indiMutex);
+
+   if(frameGrabberT::updateINDI() < 0)
+   {
+      log<software_error>({__FILE__, __LINE__});
+   }
+
+   updateIfChanged(m_indiP_fps, "current", m_fpsAchieved, INDI_IDLE);
+   updateIfChanged(m_indiP_fps, "target", m_fps, INDI_IDLE);
+
+   updateIfChanged(m_indiP_late, "frames", (uint64_t) m_lateFrames);
+
+   return 0;
+}
+
+inline
+int camSimulator::appShutdown()
+{
+   frameGrabberT::appShutdown();
+
+   return 0;
+}
+
+inline
+int camSimulator::configureAcquisition()
+{
+   frameGrabberT::m_width = m_synth.width();
+   frameGrabberT::m_height = m_synth.height();
+   frameGrabberT::m_dataType = m_synth.dataType();
+
+   return 0;
+}
+
+inline
+float camSimulator::fps()
+{
+   return m_fps;
+}
+
+inline
+int camSimulator::startAcquisition()
+{
+   clock_gettime(CLOCK_REALTIME, &m_nextFrame);
+
+   return 0;
+}
+
+inline
+int camSimulator::acquireAndCheckValid()
+{
+   long period = 1e9/m_fps;
+
+   m_nextFrame.tv_nsec += period;
+   while(m_nextFrame.tv_nsec >= 1000000000)
+   {
+      m_nextFrame.tv_nsec -= 1000000000;
+      ++m_nextFrame.tv_sec;
+   }
+
+   timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+
+   double behind = (ts.tv_sec - m_nextFrame.tv_sec) + (ts.tv_nsec - m_nextFrame.tv_nsec)/1e9;
+
+   if(behind < 0)
+   {
+      clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &m_nextFrame, nullptr);
+   }
+   else if(behind > period/1e9)
+   {
+      //More than a frame behind: count it, and restart the cadence rather than bursting to catch up.
+      ++m_lateFrames;
+      m_nextFrame = ts;
+   }
+
+   clock_gettime(CLOCK_REALTIME, &m_currImageTimestamp);
+
+   return 0;
+}
+
+inline
+int camSimulator::loadImageIntoStream(void * dest)
+{
+   memcpy(dest, m_synth.next(), m_synth.frameSize());
+   ++m_frames;
+
+   return 0;
+}
+
+inline
+int camSimulator::reconfig()
+{
+   return 0;
+}
+
+INDI_NEWCALLBACK_DEFN(camSimulator, m_indiP_fps)(const pcf::IndiProperty &ipRecv)
+{
+   if(ipRecv.getName() != m_indiP_fps.getName())
+   {
+      log<software_error>({__FILE__, __LINE__, "invalid indi property received"});
+      return -1;
+   }
+
+   float target;
+
+   if( indiTargetUpdate( m_indiP_fps, target, ipRecv, true) < 0)
+   {
+      log<software_error>({__FILE__,__LINE__});
+      return -1;
+   }
+
+   if(target <= 0)
+   {
+      log<text_log>("fps must be > 0", logPrio::LOG_ERROR);
+      return -1;
+   }
+
+   //Takes effect at the next frame.
+   m_fps = target;
+
+   log<text_log>("set fps to " + std::to_string(m_fps), logPrio::LOG_NOTICE);
+
+   return 0;
+}
+
+} //namespace app
+} //namespace MagAOX
+
+#endif //camSimulator_hpp
@@ -0,0 +1,316 @@
+/** \file syntheticFrames.hpp
+  * \brief Synthetic camera frames with photon and read noise.
+  *
+  * \ingroup camSimulator_files
+  */
+
+#ifndef syntheticFrames_hpp
+#define syntheticFrames_hpp
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <ImageStreamIO.h>
+
+namespace MagAOX
+{
+namespace app
+{
+
+/// Synthetic camera frames with photon and read noise, for exercising the image pipeline at high rates.
+/** The scene is one of the patterns: a flat field, a bright star with a few faint companions, or the 4 pupils of a
+  * pyramid wavefront sensor, on a background.  A bank of frames is made from the scene when setup, each with its own
+  * Poisson photon noise and Gaussian read noise on a bias, and next() returns a frame from the bank chosen at random.
+  * This makes each frame a memcpy, so rates are limited only by the memory bandwidth, while the frames compress about
+  * as well as real data: consecutive frames differ by noise only.
+  *
+  * \ingroup camSimulator
+  */
+class syntheticFrames
+{
+public:
+
+   /// The scene patterns.
+   enum patterns { patternFlat, patternPSF, patternPupils };
+
+protected:
+
+   uint32_t m_width {0};  ///< The width of the frames.
+   uint32_t m_height {0}; ///< The height of the frames.
+   uint8_t m_dataType {0}; ///< The ImageStreamIO type code of the frames.
+   size_t m_typeSize {0}; ///< The size of a pixel in bytes.
+
+   std::vector<double> m_scene; ///< The noiseless scene, in photons, including the background.
+
+   std::vector<char> m_bank; ///< The bank of noisy frames.
+   unsigned m_nFrames {0}; ///< The number of frames in the bank.
+
+   unsigned m_last {0}; ///< The bank index of the last frame returned.
+
+   uint64_t m_rng {1}; ///< The state of the xorshift generator used to choose frames.
+
+public:
+
+   /// Get the pattern code from its name, one of "flat", "psf", or "pupils".
+   /**
+     * \returns the pattern code
+     * \returns -1 if the name is not a pattern
+     */
+   static int pattern( const std::string & name /**< [in] the name of the pattern */)
+   {
+      if(name == "flat") return patternFlat;
+      if(name == "psf") return patternPSF;
+      if(name == "pupils") return patternPupils;
+      return -1;
+   }
+
+   /// Get the ImageStreamIO type code from its name, one of "uint16", "int16", or "float".
+   /**
+     * \returns the type code
+     * \returns 0 if the name is not a supported type
+     */
+   static uint8_t dataType( const std::string & name /**< [in] the name of the type */)
+   {
+      if(name == "uint16") return _DATATYPE_UINT16;
+      if(name == "int16") return _DATATYPE_INT16;
+      if(name == "float") return _DATATYPE_FLOAT;
+      return 0;
+   }
+
+   /// Make the scene and the bank of frames.
+   /**
+     * \returns 0 on success
+     * \returns -1 if the size, type, pattern or number of frames is not valid
+     */
+   int setup( uint32_t width,      ///< [in] the width of the frames
+              uint32_t height,     ///< [in] the height of the frames
+              uint8_t dataType,    ///< [in] the ImageStreamIO type code, uint16, int16 or float
+              int pattern,         ///< [in] the scene pattern
+              double peak,         ///< [in] the peak of the pattern, in photons per pixel
+              double background,   ///< [in] the background, in photons per pixel
+              double readNoise,    ///< [in] the read noise, in ADU
+              double bias,         ///< [in] the bias, in ADU
+              unsigned nFrames,    ///< [in] the number of frames in the bank, at least 2 so consecutive frames differ
+              uint64_t seed        ///< [in] the random seed, so that the frames are reproducible
+            )
+   {
+      if(width == 0 || height == 0 || nFrames < 2) return -1;
+
+      if(dataType != _DATATYPE_UINT16 && dataType != _DATATYPE_INT16 && dataType != _DATATYPE_FLOAT) return -1;
+
+      if(makeScene(width, height, pattern, peak, background) < 0) return -1;
+
+      m_width = width;
+      m_height = height;
+      m_dataType = dataType;
+      m_typeSize = ImageStreamIO_typesize(dataType);
+      m_nFrames = nFrames;
+
+      m_bank.resize(m_nFrames*frameSize());
+
+      std::mt19937_64 gen(seed);
+      std::normal_distribution<double> read(0, (readNoise > 0) ? readNoise : 1);
+
+      size_t npix = static_cast<size_t>(m_width)*m_height;
+
+      for(unsigned k = 0; k < m_nFrames; ++k)
+      {
+         std::vector<double> frame(npix);
+
+         for(size_t n = 0; n < npix; ++n)
+         {
+            frame[n] = bias;
+
+            if(m_scene[n] > 0)
+            {
+               std::poisson_distribution<int64_t> photons(m_scene[n]);
+               frame[n] += photons(gen);
+            }
+
+            if(readNoise > 0) frame[n] += read(gen);
+         }
+
+         char * dest = m_bank.data() + k*frameSize();
+
+         switch(m_dataType)
+         {
+            case _DATATYPE_UINT16:
+               convert(reinterpret_cast<uint16_t *>(dest), frame);
+               break;
+            case _DATATYPE_INT16:
+               convert(reinterpret_cast<int16_t *>(dest), frame);
+               break;
+            default:
+               convert(reinterpret_cast<float *>(dest), frame);
+         }
+      }
+
+      m_rng = (seed == 0) ? 1 : seed;
+      m_last = 0;
+
+      return 0;
+   }
+
+   /// Get the next frame, a frame of the bank chosen at random but never the last one returned.
+   const char * next()
+   {
+      //xorshift64
+      m_rng ^= m_rng << 13;
+      m_rng ^= m_rng >> 7;
+      m_rng ^= m_rng << 17;
+
+      unsigned k = (m_last + 1 + m_rng % (m_nFrames - 1)) % m_nFrames;
+      m_last = k;
+
+      return m_bank.data() + k*frameSize();
+   }
+
+   /// Get the size of a frame, in bytes.
+   size_t frameSize() const
+   {
+      return static_cast<size_t>(m_width)*m_height*m_typeSize;
+   }
+
+   /// Get the width of the frames.
+   uint32_t width() const
+   {
+      return m_width;
+   }
+
+   /// Get the height of the frames.
+   uint32_t height() const
+   {
+      return m_height;
+   }
+
+   /// Get the ImageStreamIO type code of the frames.
+   uint8_t dataType() const
+   {
+      return m_dataType;
+   }
+
+   /// Get the number of frames in the bank.
+   unsigned nFrames() const
+   {
+      return m_nFrames;
+   }
+
+   /// Get the noiseless scene, in photons.
+   const std::vector<double> & scene() const
+   {
+      return m_scene;
+   }
+
+   /// Get a frame of the bank.
+   const char * bankFrame( unsigned k /**< [in] the index of the frame */) const
+   {
+      return m_bank.data() + k*frameSize();
+   }
+
+protected:
+
+   /// Make the noiseless scene.
+   /**
+     * \returns 0 on success
+     * \returns -1 if the pattern is not valid
+     */
+   int makeScene( uint32_t width,
+                  uint32_t height,
+                  int pattern,
+                  double peak,
+                  double background
+                )
+   {
+      m_scene.assign(static_cast<size_t>(width)*height, background);
+
+      double xc = 0.5*(width-1);
+      double yc = 0.5*(height-1);
+
+      if(pattern == patternFlat)
+      {
+         for(size_t n = 0; n < m_scene.size(); ++n) m_scene[n] += peak;
+      }
+      else if(pattern == patternPSF)
+      {
+         //A bright star in the center, with fainter companions at fixed offsets.
+         const double sig = 2.0;
+         const double stars[4][3] = { {0, 0, 1}, {0.21, 0.13, 0.05}, {-0.17, 0.27, 0.02}, {0.31, -0.23, 0.01} };
+
+         for(int s = 0; s < 4; ++s)
+         {
+            double x0 = xc + stars[s][0]*width;
+            double y0 = yc + stars[s][1]*height;
+
+            for(uint32_t y = 0; y < height; ++y)
+            {
+               for(uint32_t x = 0; x < width; ++x)
+               {
+                  double r2 = (x-x0)*(x-x0) + (y-y0)*(y-y0);
+                  m_scene[y*width + x] += peak*stars[s][2]*exp(-0.5*r2/(sig*sig));
+               }
+            }
+         }
+      }
+      else if(pattern == patternPupils)
+      {
+         //Four pupils, one in each quadrant, each with a central obscuration and a gentle illumination ripple.
+         double rad = 0.2*std::min(width, height);
+
+         for(int q = 0; q < 4; ++q)
+         {
+            double x0 = xc + ((q % 2) ? 0.25 : -0.25)*width;
+            double y0 = yc + ((q / 2) ? 0.25 : -0.25)*height;
+
+            for(uint32_t y = 0; y < height; ++y)
+            {
+               for(uint32_t x = 0; x < width; ++x)
+               {
+                  double r = sqrt((x-x0)*(x-x0) + (y-y0)*(y-y0));
+                  if(r > rad || r < 0.25*rad) continue;
+
+                  m_scene[y*width + x] += peak*(0.9 + 0.1*cos(2*M_PI*(x+y)/rad));
+               }
+            }
+         }
+      }
+      else
+      {
+         m_scene.clear();
+         return -1;
+      }
+
+      return 0;
+   }
+
+   /// Convert a frame to the data type, rounding and clamping integer types.
+   template<typename T>
+   void convert( T * dest,
+                 const std::vector<double> & frame
+               )
+   {
+      for(size_t n = 0; n < frame.size(); ++n)
+      {
+         double v = frame[n];
+
+         if(std::numeric_limits<T>::is_integer)
+         {
+            v = std::round(v);
+            if(v < std::numeric_limits<T>::lowest()) v = std::numeric_limits<T>::lowest();
+            if(v > std::numeric_limits<T>::max()) v = std::numeric_limits<T>::max();
+         }
+
+         dest[n] = static_cast<T>(v);
+      }
+   }
+};
+
+} //namespace app
+} //namespace MagAOX
+
+#endif //syntheticFrames_hpp
@@ -0,0 +1,110 @@
+#include "../../../tests/catch2/catch.hpp"
+
+#include "../syntheticFrames.hpp"
+
+#include <cstring>
+#include <vector>
+
+namespace syntheticFrames_test
+{
+
+//The mean of a frame of type T.
+template<typename T>
+double frameMean( const char * frame,
+                  size_t npix
+                )
+{
+   const T * im = reinterpret_cast<const T *>(frame);
+
+   double sum = 0;
+   for(size_t n = 0; n < npix; ++n) sum += im[n];
+
+   return sum/npix;
+}
+
+SCENARIO( "Generating synthetic frames", "[camSimulator]" )
+{
+   using MagAOX::app::syntheticFrames;
+
+   GIVEN("pattern and type names")
+   {
+      REQUIRE(syntheticFrames::pattern("flat") == syntheticFrames::patternFlat);
+      REQUIRE(syntheticFrames::pattern("psf") == syntheticFrames::patternPSF);
+      REQUIRE(syntheticFrames::pattern("pupils") == syntheticFrames::patternPupils);
+      REQUIRE(syntheticFrames::pattern("stars") == -1);
+
+      REQUIRE(syntheticFrames::dataType("uint16") == _DATATYPE_UINT16);
+      REQUIRE(syntheticFrames::dataType("float") == _DATATYPE_FLOAT);
+      REQUIRE(syntheticFrames::dataType("double") == 0);
+   }
+
+   GIVEN("a flat uint16 field")
+   {
+      syntheticFrames sf;
+      REQUIRE(sf.setup(64, 32, _DATATYPE_UINT16, syntheticFrames::patternFlat, 1000, 50, 3, 200, 4, 1) == 0);
+
+      REQUIRE(sf.frameSize() == 64*32*2);
+      REQUIRE(sf.nFrames() == 4);
+
+      //The mean is the bias plus the photons, and the photon noise makes the frames differ.
+      REQUIRE(frameMean<uint16_t>(sf.bankFrame(0), 64*32) == Approx(1250).epsilon(0.01));
+      REQUIRE(memcmp(sf.bankFrame(0), sf.bankFrame(1), sf.frameSize()) != 0);
+
+      WHEN("frames are taken")
+      {
+         const char * last = sf.next();
+         for(int n = 0; n < 100; ++n)
+         {
+            const char * frame = sf.next();
+            REQUIRE(frame != last);
+            last = frame;
+         }
+      }
+
+      WHEN("it is made again with the same seed")
+      {
+         syntheticFrames sf2;
+         REQUIRE(sf2.setup(64, 32, _DATATYPE_UINT16, syntheticFrames::patternFlat, 1000, 50, 3, 200, 4, 1) == 0);
+         REQUIRE(memcmp(sf.bankFrame(2), sf2.bankFrame(2), sf.frameSize()) == 0);
+      }
+   }
+
+   GIVEN("a float star field")
+   {
+      syntheticFrames sf;
+      REQUIRE(sf.setup(33, 33, _DATATYPE_FLOAT, syntheticFrames::patternPSF, 10000, 0, 0, 0, 2, 3) == 0);
+
+      //The star is in the center
+      const std::vector<double> & scene = sf.scene();
+      size_t imax = 0;
+      for(size_t n = 0; n < scene.size(); ++n) if(scene[n] > scene[imax]) imax = n;
+      REQUIRE(imax == 16*33 + 16);
+      REQUIRE(scene[imax] == Approx(10000).epsilon(0.01));
+
+      //Without background or read noise the corners are empty
+      REQUIRE(reinterpret_cast<const float *>(sf.bankFrame(0))[0] == 0);
+   }
+
+   GIVEN("pupils which saturate an int16")
+   {
+      syntheticFrames sf;
+      REQUIRE(sf.setup(40, 40, _DATATYPE_INT16, syntheticFrames::patternPupils, 50000, 10, 0, 0, 2, 5) == 0);
+
+      const int16_t * im = reinterpret_cast<const int16_t *>(sf.bankFrame(0));
+
+      //The centers of the pupils are obscured, and the pupils are clamped
+      REQUIRE(im[10*40 + 10] < 100);
+      REQUIRE(im[10*40 + 16] == 32767);
+   }
+
+   GIVEN("invalid setups")
+   {
+      syntheticFrames sf;
+      REQUIRE(sf.setup(0, 32, _DATATYPE_UINT16, syntheticFrames::patternFlat, 1000, 50, 3, 200, 4, 1) == -1);
+      REQUIRE(sf.setup(64, 32, 0, syntheticFrames::patternFlat, 1000, 50, 3, 200, 4, 1) == -1);
+      REQUIRE(sf.setup(64, 32, _DATATYPE_UINT16, -1, 1000, 50, 3, 200, 4, 1) == -1);
+      REQUIRE(sf.setup(64, 32, _DATATYPE_UINT16, syntheticFrames::patternFlat, 1000, 50, 3, 200, 1, 1) == -1);
+   }
+}
+
+} //namespace syntheticFrames_test
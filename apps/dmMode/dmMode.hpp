@@ -16,6 +16,8 @@
 #include "../../libMagAOX/libMagAOX.hpp" //Note this is included on command line to trigger pch
 #include "../../magaox_git_version.h"
 
+#include "modalShape.hpp"
+
 /** \defgroup dmMode
   * \brief The DM mode command app, places modes on a DM channel
   * \todo update md doc
@@ -60,13 +62,15 @@ protected:
    
    std::string m_dmChannelName;
    
+   unsigned m_resyncInterval {100}; ///< The number of incremental shape updates between full recomputes (default 100).
+   
    ///@}
 
    mx::improc::eigenCube<realT> m_modes;
    
-   std::vector<realT> m_amps;
+   modalShape<realT> m_shape; ///< The shape, synthesized from the mode amplitudes.
    
-   mx::improc::eigenImage<realT> m_shape;
+   std::mutex m_shapeMutex; ///< Protects m_shape between the INDI callbacks and the publish thread.
    
    IMAGE m_imageStream; 
    uint32_t m_width {0}; ///< The width of the image
@@ -115,8 +119,36 @@ public:
    virtual int appShutdown();
 
 
+   /// Apply all requested amplitude changes to the shape and send it to the DM channel.
    int sendCommand();
    
+   /** \name Publish Thread 
+     * This thread sends the shape to the DM channel after amplitude changes, so a burst of changes is sent once.
+     *
+     * @{
+     */ 
+   int m_pubThreadPrio {0}; ///< Priority of the publish thread.
+
+   std::thread m_pubThread; ///< The publish thread.
+
+   bool m_pubThreadInit {true}; ///< Synchronizer to ensure the publish thread initializes before doing dangerous things.
+   
+   pid_t m_pubThreadID {0}; ///< Publish thread PID.
+
+   pcf::IndiProperty m_pubThreadProp; ///< The property to hold the publish thread details.
+
+   sem_t m_pubSemaphore; ///< Posted when amplitudes change.
+
+   bool m_pubSemaphoreInit {false}; ///< Set while m_pubSemaphore is initialized.  Cleared under m_shapeMutex when appShutdown destroys it.
+   
+   ///Thread starter, called by threadStart on thread construction.  Calls pubThreadExec.
+   static void pubThreadStart( dmMode * d /**< [in] a pointer to a dmMode instance (normally this) */);
+
+   /// Execute the publish thread main loop.
+   void pubThreadExec();
+
+   ///@}
+   
    //INDI:
 protected:
    //declare our properties
@@ -142,6 +174,7 @@ void dmMode::setupConfig()
    config.add("dm.modeCube", "", "dm.modeCube", argType::Required, "dm", "modeCube", false, "string", "Full path to the FITS file containing the modes for this DM.");
    config.add("dm.name", "", "dm.name", argType::Required, "dm", "name", false, "string", "The descriptive name of this dm. Default is the channel name.");
    config.add("dm.channelName", "", "dm.channelName", argType::Required, "dm", "channelName", false, "string", "The name of the DM channel to write to.");
+   config.add("dm.resyncInterval", "", "dm.resyncInterval", argType::Required, "dm", "resyncInterval", false, "unsigned", "The number of incremental shape updates between full recomputes of the shape from all modes (default 100).");
 }
 
 int dmMode::loadConfigImpl( mx::app::appConfigurator & _config )
@@ -153,6 +186,7 @@ int dmMode::loadConfigImpl( mx::app::appConfigurator & _config )
    m_dmName = m_dmChannelName;
    _config(m_dmName, "dm.name");
    
+   _config(m_resyncInterval, "dm.resyncInterval");
    
    return 0;
 }
@@ -171,8 +205,8 @@ int dmMode::appStartup()
       return log<text_log,-1>("Could not open mode cube file", logPrio::LOG_ERROR);
    }
    
-   m_amps.resize(m_modes.planes(), 0);
-   m_shape.resize(m_modes.rows(), m_modes.cols());
+   m_shape.setup(m_modes.data(), m_modes.rows()*m_modes.cols(), m_modes.planes());
+   m_shape.resyncInterval(m_resyncInterval);
    
    REG_INDI_NEWPROP_NOCB(m_indiP_dm, "dm", pcf::IndiProperty::Text);
    m_indiP_dm.add(pcf::IndiElement("name"));
@@ -183,9 +217,9 @@ int dmMode::appStartup()
    REG_INDI_NEWPROP(m_indiP_currAmps, "current_amps", pcf::IndiProperty::Number);
    REG_INDI_NEWPROP(m_indiP_tgtAmps, "target_amps", pcf::IndiProperty::Number);
    
-   m_elNames.resize(m_amps.size());
+   m_elNames.resize(m_shape.nModes());
    
-   for(size_t n=0; n < m_amps.size(); ++n)
+   for(size_t n=0; n < m_shape.nModes(); ++n)
    {
       //std::string el = std::to_string(n);
       m_elNames[n] = mx::ioutils::convertToString<size_t, 4, '0'>(n);
@@ -196,6 +230,22 @@ int dmMode::appStartup()
       m_indiP_tgtAmps.add( pcf::IndiElement(m_elNames[n]) );
    }
    
+   if(sem_init(&m_pubSemaphore, 0,0) < 0)
+   {
+      return log<software_critical,-1>({__FILE__, __LINE__, errno,0, "Initializing publish semaphore"});
+   }
+   
+   {//scope for mutex, since INDI callbacks check the flag
+      std::lock_guard<std::mutex> guard(m_shapeMutex);
+      m_pubSemaphoreInit = true;
+   }
+   
+   if(threadStart( m_pubThread, m_pubThreadInit, m_pubThreadID, m_pubThreadProp, m_pubThreadPrio, "", "publish", this, pubThreadStart)  < 0)
+   {
+      log<software_critical>({__FILE__, __LINE__});
+      return -1;
+   }
+   
    state(stateCodes::NOTCONNECTED);
    
    
@@ -256,7 +306,11 @@ int dmMode::appLogic()
          return log<text_log,-1>("Size mismatch between DM and modes (cols)", logPrio::LOG_CRITICAL);
       }
       
-      for(size_t n=0; n < m_amps.size(); ++n) m_amps[n] = 0;
+      {
+         std::lock_guard<std::mutex> guard(m_shapeMutex);
+         for(size_t n=0; n < m_shape.nModes(); ++n) m_shape.setAmp(n, 0);
+         m_shape.resync();
+      }
       sendCommand();
       
       state(stateCodes::READY);
@@ -268,6 +322,25 @@ int dmMode::appLogic()
 
 int dmMode::appShutdown()
 {
+   if(m_pubThread.joinable())
+   {
+      try
+      {
+         m_pubThread.join(); //this will throw if it was already joined
+      }
+      catch(...)
+      {
+      }
+   }
+   
+   //The publish thread is gone, so nothing waits on the semaphore.  INDI callbacks may still post it, under m_shapeMutex.
+   std::lock_guard<std::mutex> lock(m_shapeMutex);
+   if(m_pubSemaphoreInit)
+   {
+      sem_destroy(&m_pubSemaphore);
+      m_pubSemaphoreInit = false;
+   }
+   
    return 0;
 }
 
@@ -279,12 +352,9 @@ int dmMode::sendCommand()
       return 0;
    }
    
-   m_shape = m_amps[0]*m_modes.image(0);
+   std::unique_lock<std::mutex> lock(m_shapeMutex);
    
-   for(size_t n = 1; n<m_amps.size(); ++n)
-   {
-      m_shape += m_amps[n]*m_modes.image(n);
-   }
+   m_shape.update();
    
    if(m_imageStream.md[0].write)
    {
@@ -302,16 +372,21 @@ int dmMode::sendCommand()
    
    char* next_dest = (char *) m_imageStream.array.raw + curr_image*m_width*m_height*m_typeSize;
    
-   memcpy(next_dest, m_shape.data(), m_width*m_height*m_typeSize);
+   memcpy(next_dest, m_shape.shape(), m_width*m_height*m_typeSize);
       
    m_imageStream.md[0].cnt0++;
    
    m_imageStream.md->write=0;
    ImageStreamIO_sempost(&m_imageStream,-1);
    
-   for(size_t n = 0; n<m_amps.size(); ++n)
+   std::vector<realT> amps(m_shape.amps().data(), m_shape.amps().data() + m_shape.nModes());
+   
+   lock.unlock();
+   
+   std::lock_guard<std::mutex> guard(m_indiMutex);
+   for(size_t n = 0; n<amps.size(); ++n)
    {
-      m_indiP_currAmps[m_elNames[n]] = m_amps[n];
+      m_indiP_currAmps[m_elNames[n]] = amps[n];
    }
    m_indiP_currAmps.setState (pcf::IndiProperty::Ok);
    m_indiDriver->sendSetProperty (m_indiP_currAmps);
@@ -320,12 +395,60 @@ int dmMode::sendCommand()
    
 }
 
+inline
+void dmMode::pubThreadStart( dmMode * d)
+{
+   d->pubThreadExec();
+}
+
+inline
+void dmMode::pubThreadExec()
+{
+   m_pubThreadID = syscall(SYS_gettid);
+
+   //Wait for the thread starter to finish initializing this thread.
+   while( m_pubThreadInit == true && m_shutdown == 0)
+   {
+      sleep(1);
+   }
+   
+   while(m_shutdown == 0)
+   {
+      timespec ts;
+      
+      if(clock_gettime(CLOCK_REALTIME, &ts) < 0)
+      {
+         log<software_critical>({__FILE__,__LINE__,errno,0,"clock_gettime"}); 
+         return;
+      }
+      
+      ts.tv_sec += 1;
+      
+      if(sem_timedwait(&m_pubSemaphore, &ts) != 0)
+      {
+         //ETIMEDOUT and EINTR just mean we check m_shutdown and wait again.
+         if(errno != ETIMEDOUT && errno != EINTR)
+         {
+            log<software_error>({__FILE__, __LINE__,errno, "sem_timedwait"});
+         }
+         continue;
+      }
+      
+      //Changes made while we were waiting or sending are all picked up by this command.
+      while(sem_trywait(&m_pubSemaphore) == 0);
+      
+      if(state() == stateCodes::READY) sendCommand();
+   }
+}
+
 INDI_NEWCALLBACK_DEFN(dmMode, m_indiP_currAmps)(const pcf::IndiProperty &ipRecv)
 {
    if (ipRecv.getName() == m_indiP_currAmps.getName())
    {
       size_t found = 0;
-      for(size_t n=0; n < m_amps.size(); ++n)
+      
+      std::unique_lock<std::mutex> lock(m_shapeMutex);
+      for(size_t n=0; n < m_shape.nModes(); ++n)
       {
          if(ipRecv.find(m_elNames[n]))
          {
@@ -333,15 +456,18 @@ INDI_NEWCALLBACK_DEFN(dmMode, m_indiP_currAmps)(const pcf::IndiProperty &ipRecv)
             
             ///\todo add bounds checks here
             
-            m_amps[n] = amp;
+            m_shape.setAmp(n, amp);
             ++found;
          }
       }
       
-      if(found) 
+      //The publish thread sends all the changes made since it last ran at once.
+      //The lock keeps appShutdown from destroying the semaphore under us.
+      if(found && m_pubSemaphoreInit) 
       {
-         return sendCommand();
+         sem_post(&m_pubSemaphore);
       }
+      lock.unlock();
       
       return 0;
       
@@ -355,7 +481,9 @@ INDI_NEWCALLBACK_DEFN(dmMode, m_indiP_tgtAmps)(const pcf::IndiProperty &ipRecv)
    if (ipRecv.getName() == m_indiP_tgtAmps.getName())
    {
       size_t found = 0;
-      for(size_t n=0; n < m_amps.size(); ++n)
+      
+      std::unique_lock<std::mutex> lock(m_shapeMutex);
+      for(size_t n=0; n < m_shape.nModes(); ++n)
       {
          if(ipRecv.find(m_elNames[n]))
          {
@@ -363,15 +491,18 @@ INDI_NEWCALLBACK_DEFN(dmMode, m_indiP_tgtAmps)(const pcf::IndiProperty &ipRecv)
             
             ///\todo add bounds checks here
             
-            m_amps[n] = amp;
+            m_shape.setAmp(n, amp);
             ++found;
          }
       }
       
-      if(found) 
+      //The publish thread sends all the changes made since it last ran at once.
+      //The lock keeps appShutdown from destroying the semaphore under us.
+      if(found && m_pubSemaphoreInit) 
       {
-         return sendCommand();
+         sem_post(&m_pubSemaphore);
       }
+      lock.unlock();
       
       return 0;
       
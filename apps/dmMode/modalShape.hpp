@@ -0,0 +1,186 @@
+/** \file modalShape.hpp
+  * \brief Incremental synthesis of a DM shape from modal amplitudes.
+  *
+  * \ingroup dmMode_files
+  */
+
+#ifndef dmMode_modalShape_hpp
+#define dmMode_modalShape_hpp
+
+#include <vector>
+
+#include <Eigen/Dense>
+
+namespace MagAOX
+{
+namespace app
+{
+
+/// Synthesizes a DM shape as the sum of modes weighted by their amplitudes, updating it incrementally as amplitudes change.
+/** The modes are viewed as an (actuators x modes) matrix, one column per mode, which is the layout of an eigenCube
+  * with one mode per plane.  Amplitude changes are queued with setAmp() and applied together by update().  When only
+  * a few modes changed the shape is updated in place, with `shape += (new - old)*mode` for each, otherwise it is
+  * recomputed as a single matrix-vector product.  A full recompute is also forced periodically, which bounds the
+  * round-off that accumulates from the incremental updates.
+  *
+  * \tparam realT the floating point type of the modes and the shape
+  *
+  * \ingroup dmMode
+  */
+template<typename realT>
+class modalShape
+{
+public:
+   typedef Eigen::Matrix<realT, Eigen::Dynamic, 1> vectorT;
+   typedef Eigen::Map<const Eigen::Matrix<realT, Eigen::Dynamic, Eigen::Dynamic>> modeMatrixT;
+
+protected:
+   const realT * m_modes {nullptr}; ///< The modes, not owned.
+   size_t m_nPix {0}; ///< The number of actuators (pixels) in each mode.
+   size_t m_nModes {0}; ///< The number of modes.
+
+   vectorT m_amps; ///< The amplitudes which are in the shape.
+   vectorT m_targets; ///< The requested amplitudes.
+   std::vector<size_t> m_changed; ///< The modes whose requested amplitude differs from the applied one.
+   std::vector<bool> m_isChanged; ///< Flag for each mode which is in m_changed.
+
+   vectorT m_shape; ///< The shape.
+
+   unsigned m_resyncInterval {100}; ///< The number of incremental updates between full recomputes.
+   unsigned m_sinceResync {0}; ///< The number of incremental updates since the last full recompute.
+
+public:
+
+   /// Setup the modes, and zero all amplitudes and the shape.
+   /** The modes must remain valid until the next call to setup().
+     */
+   void setup( const realT * modes, ///< [in] the modes, contiguous, nPix values each
+               size_t nPix,         ///< [in] the number of actuators (pixels) in each mode
+               size_t nModes        ///< [in] the number of modes
+             )
+   {
+      m_modes = modes;
+      m_nPix = nPix;
+      m_nModes = nModes;
+
+      m_amps.setZero(nModes);
+      m_targets.setZero(nModes);
+      m_changed.clear();
+      m_isChanged.assign(nModes, false);
+
+      m_shape.setZero(nPix);
+      m_sinceResync = 0;
+   }
+
+   /// Set the number of incremental updates between full recomputes.
+   void resyncInterval( unsigned ri /**< [in] the new interval, 0 to always recompute*/)
+   {
+      m_resyncInterval = ri;
+   }
+
+   /// Get the number of incremental updates between full recomputes.
+   unsigned resyncInterval() const
+   {
+      return m_resyncInterval;
+   }
+
+   /// Get the number of modes
+   size_t nModes() const
+   {
+      return m_nModes;
+   }
+
+   /// Request a new amplitude for a mode.  It is applied by the next update().
+   void setAmp( size_t n, ///< [in] the mode
+                realT amp ///< [in] the new amplitude
+              )
+   {
+      m_targets[n] = amp;
+
+      if(!m_isChanged[n])
+      {
+         m_isChanged[n] = true;
+         m_changed.push_back(n);
+      }
+   }
+
+   /// Get the amplitude of a mode, including any requested change.
+   realT amp( size_t n /**< [in] the mode */) const
+   {
+      return m_targets[n];
+   }
+
+   /// Get the amplitudes which are in the shape.
+   const vectorT & amps() const
+   {
+      return m_amps;
+   }
+
+   /// Get whether there are changes which have not been applied.
+   bool pending() const
+   {
+      return m_changed.size() > 0;
+   }
+
+   /// Apply the requested amplitude changes to the shape.
+   /**
+     * \returns 0 if nothing changed
+     * \returns 1 if the shape was updated incrementally
+     * \returns 2 if the shape was recomputed
+     */
+   int update()
+   {
+      if(m_changed.size() == 0) return 0;
+
+      //The incremental update makes one pass over the shape per mode, so recompute when that's
+      //a good fraction of a full pass over all the modes.
+      if(m_sinceResync >= m_resyncInterval || 4*m_changed.size() >= m_nModes)
+      {
+         resync();
+         return 2;
+      }
+
+      modeMatrixT modes(m_modes, m_nPix, m_nModes);
+
+      for(size_t k = 0; k < m_changed.size(); ++k)
+      {
+         size_t n = m_changed[k];
+
+         realT delta = m_targets[n] - m_amps[n];
+         if(delta != 0) m_shape.noalias() += delta*modes.col(n);
+
+         m_amps[n] = m_targets[n];
+         m_isChanged[n] = false;
+      }
+      m_changed.clear();
+
+      ++m_sinceResync;
+
+      return 1;
+   }
+
+   /// Apply the requested amplitudes and recompute the shape as a matrix-vector product.
+   void resync()
+   {
+      for(size_t k = 0; k < m_changed.size(); ++k) m_isChanged[m_changed[k]] = false;
+      m_changed.clear();
+
+      m_amps = m_targets;
+
+      modeMatrixT modes(m_modes, m_nPix, m_nModes);
+      m_shape.noalias() = modes*m_amps;
+
+      m_sinceResync = 0;
+   }
+
+   /// Get the shape.
+   const realT * shape() const
+   {
+      return m_shape.data();
+   }
+};
+
+} //namespace app
+} //namespace MagAOX
+
+#endif //dmMode_modalShape_hpp
@@ -0,0 +1,130 @@
+/** \file modalShape_test.cpp
+  * \brief Catch2 tests for the modalShape in the dmMode app.
+  *
+  * History:
+  */
+#include "../../../tests/catch2/catch.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "../modalShape.hpp"
+
+using namespace MagAOX::app;
+
+namespace modalShape_test 
+{
+
+/// The shape summed directly from the modes, in double precision.
+std::vector<double> directShape( const std::vector<float> & modes,
+                                 const std::vector<double> & amps,
+                                 size_t nPix
+                               )
+{
+   std::vector<double> shape(nPix, 0);
+   for(size_t m = 0; m < amps.size(); ++m)
+   {
+      for(size_t p = 0; p < nPix; ++p) shape[p] += amps[m]*modes[m*nPix + p];
+   }
+   return shape;
+}
+
+double maxDiff( const float * shape,
+                const std::vector<double> & ref
+              )
+{
+   double md = 0;
+   for(size_t p = 0; p < ref.size(); ++p) md = std::max(md, std::fabs(shape[p] - ref[p]));
+   return md;
+}
+
+SCENARIO( "Synthesizing a shape from modal amplitudes", "[modalShape]" )
+{
+   GIVEN("200 random modes of 30x30 pixels")
+   {
+      size_t nPix = 900;
+      size_t nModes = 200;
+
+      srand48(1123);
+      std::vector<float> modes(nPix*nModes);
+      for(size_t n = 0; n < modes.size(); ++n) modes[n] = drand48() - 0.5;
+
+      modalShape<float> ms;
+      ms.setup(modes.data(), nPix, nModes);
+
+      std::vector<double> amps(nModes, 0);
+
+      WHEN("nothing was requested")
+      {
+         REQUIRE(ms.pending() == false);
+         REQUIRE(ms.update() == 0);
+         REQUIRE(maxDiff(ms.shape(), amps) == 0);
+      }
+      WHEN("a few amplitudes change at a time")
+      {
+         ms.resyncInterval(1000);
+
+         for(int u = 0; u < 500; ++u)
+         {
+            for(int k = 0; k < 3; ++k)
+            {
+               size_t n = lrand48() % nModes;
+               amps[n] = drand48() - 0.5;
+               ms.setAmp(n, amps[n]);
+            }
+
+            REQUIRE(ms.pending() == true);
+            REQUIRE(ms.update() == 1);
+            REQUIRE(ms.pending() == false);
+         }
+
+         for(size_t n = 0; n < nModes; ++n) REQUIRE(ms.amps()[n] == (float) amps[n]);
+
+         std::vector<double> ref = directShape(modes, amps, nPix);
+         REQUIRE(maxDiff(ms.shape(), ref) < 1e-4);
+
+         //The resync recomputes the same shape
+         ms.resync();
+         REQUIRE(maxDiff(ms.shape(), ref) < 1e-4);
+      }
+      WHEN("the same amplitude is set repeatedly before an update")
+      {
+         ms.setAmp(7, 1.0);
+         ms.setAmp(7, 2.0);
+         ms.setAmp(7, 0.5);
+         amps[7] = 0.5;
+
+         REQUIRE(ms.amp(7) == 0.5);
+         REQUIRE(ms.update() == 1);
+         REQUIRE(maxDiff(ms.shape(), directShape(modes, amps, nPix)) < 1e-5);
+      }
+      WHEN("many amplitudes change at once")
+      {
+         for(size_t n = 0; n < nModes; n += 2)
+         {
+            amps[n] = drand48() - 0.5;
+            ms.setAmp(n, amps[n]);
+         }
+
+         REQUIRE(ms.update() == 2);
+         REQUIRE(maxDiff(ms.shape(), directShape(modes, amps, nPix)) < 1e-4);
+      }
+      WHEN("the resync interval is reached")
+      {
+         ms.resyncInterval(5);
+
+         for(int u = 0; u < 12; ++u)
+         {
+            ms.setAmp(u, 1.0);
+            amps[u] = 1.0;
+
+            //Every 6th update is a full recompute
+            REQUIRE(ms.update() == ( (u % 6 == 5) ? 2 : 1) );
+         }
+         REQUIRE(maxDiff(ms.shape(), directShape(modes, amps, nPix)) < 1e-4);
+      }
+   }
+}
+
+} //namespace modalShape_test
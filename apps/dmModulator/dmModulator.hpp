@@ -128,6 +128,10 @@ protected:
 
    bool m_modThreadInit {true}; ///< Synchronizer to ensure f.g. thread initializes before doing dangerous things.
    
+   realT m_modSpinTime {0}; ///< The time, in microseconds, to busy-wait before each tick instead of sleeping (default 0).
+
+   dev::modulationEngine m_modEngine; ///< Schedules the ticks and publishes the shapes.
+
    ///Thread starter, called by modThreadStart on thread construction.  Calls modThreadExec.
    static void modThreadStart( dmModulator * d /**< [in] a pointer to a dmModulator instance (normally this) */);
 
@@ -143,6 +147,7 @@ protected:
    pcf::IndiProperty m_indiP_frequency;
    pcf::IndiProperty m_indiP_modulating;
    pcf::IndiProperty m_indiP_zero;
+   pcf::IndiProperty m_indiP_timing;
 
    std::vector<std::string> m_elNames;
 public:
@@ -164,6 +169,8 @@ void dmModulator::setupConfig()
    config.add("dm.name", "", "dm.name", argType::Required, "dm", "name", false, "string", "The descriptive name of this dm. Default is the channel name.");
    config.add("dm.channelName", "", "dm.channelName", argType::Required, "dm", "channelName", false, "string", "The name of the DM channel to write to.");
    config.add("dm.frequency", "", "dm.frequency", argType::Required, "dm", "frequency", false, "float", "The frequency to modulate by default after startup.");
+
+   config.add("modulator.spinTime", "", "modulator.spinTime", argType::Required, "modulator", "spinTime", false, "float", "The time, in microseconds, to busy-wait before each tick instead of sleeping.  Reduces the timing error at high frequencies, at the cost of a core (default 0).");
 }
 
 int dmModulator::loadConfigImpl( mx::app::appConfigurator & _config )
@@ -176,6 +183,8 @@ int dmModulator::loadConfigImpl( mx::app::appConfigurator & _config )
    
    _config(m_frequency, "dm.frequency");
    
+   _config(m_modSpinTime, "modulator.spinTime");
+   
    return 0;
 }
 
@@ -219,6 +228,14 @@ int dmModulator::appStartup()
       return -1;
    }
    
+   createROIndiNumber( m_indiP_timing, "timing", "Modulation Timing", "Modulation");
+   indi::addNumberElement<uint64_t>( m_indiP_timing, "ticks", 0, std::numeric_limits<uint64_t>::max(), 1, "%lu", "Ticks");
+   indi::addNumberElement<uint64_t>( m_indiP_timing, "missed", 0, std::numeric_limits<uint64_t>::max(), 1, "%lu", "Missed Deadlines");
+   indi::addNumberElement<double>( m_indiP_timing, "meanErr", 0, std::numeric_limits<double>::max(), 0, "%0.2f", "Mean Error [us]");
+   indi::addNumberElement<double>( m_indiP_timing, "rmsErr", 0, std::numeric_limits<double>::max(), 0, "%0.2f", "RMS Error [us]");
+   indi::addNumberElement<double>( m_indiP_timing, "maxErr", 0, std::numeric_limits<double>::max(), 0, "%0.2f", "Max Error [us]");
+   registerIndiPropertyReadOnly(m_indiP_timing);
+   
    if(threadStart( m_modThread, m_modThreadInit, m_modThreadPrio, "modulator", this, modThreadStart)  < 0)
    {
       log<software_critical>({__FILE__, __LINE__});
@@ -288,6 +305,16 @@ int dmModulator::appLogic()
       state(stateCodes::READY);
    }
    
+   if(state() == stateCodes::READY)
+   {
+      //The timing over the last loop
+      dev::modulationTiming mt = m_modEngine.timing(true);
+      
+      std::unique_lock<std::mutex> lock(m_indiMutex);
+      updateIfChanged(m_indiP_timing, std::vector<std::string>({"ticks", "missed"}), std::vector<uint64_t>({mt.ticks, mt.missed}));
+      updateIfChanged(m_indiP_timing, std::vector<std::string>({"meanErr", "rmsErr", "maxErr"}), std::vector<double>({mt.meanErr, mt.rmsErr, mt.maxErr}));
+   }
+   
    return 0;
 }
 
@@ -320,48 +347,21 @@ void dmModulator::modThreadExec()
       
       if(m_modulating)
       {
-         int64_t freqNsec = (1.0/m_frequency)*1e9;
-         int64_t dnsec;
-   
-         int idx = 0;
-         
-         timespec modstart;
-         timespec currtime;
-      
-         dnsec = freqNsec;
-         clock_gettime(CLOCK_REALTIME, &modstart);
-         while(m_modulating)
+         if(m_modEngine.setup(&m_imageStream, m_shapes.data(), m_shapes.planes(), m_width*m_height*m_typeSize) < 0)
          {
-            mx::nanoSleep(0.5*dnsec);
-            clock_gettime(CLOCK_REALTIME, &currtime);
+            log<software_error>({__FILE__, __LINE__, "error setting up modulation"});
+            m_modulating = false;
+            continue;
+         }
          
-            dnsec = (currtime.tv_sec - modstart.tv_sec)*1000000000 + (currtime.tv_nsec - modstart.tv_nsec);
-            
-            if(dnsec >= freqNsec)
+         m_modEngine.start(m_frequency, m_modSpinTime/1e6);
+         
+         while(m_modulating && m_shutdown == 0)
+         {
+            if(m_modEngine.tick() < 0)
             {
-               //Do the write
-               m_imageStream.md->write = 1;
-   
-               memcpy(m_imageStream.array.raw, m_shapes.image(idx).data(), m_width*m_height*m_typeSize);
-      
-               m_imageStream.md->atime = currtime;
-               m_imageStream.md->writetime = currtime;
-               
-               m_imageStream.md->cnt0++;
-   
-               m_imageStream.md->write=0;
-               ImageStreamIO_sempost(&m_imageStream,-1);
-   
-               ++idx;
-               if(idx >= m_shapes.planes()) idx=0;
-               
-               modstart.tv_nsec += freqNsec;
-               if(modstart.tv_nsec >= 1000000000)
-               {
-                  modstart.tv_nsec -= 1000000000;
-                  modstart.tv_sec += 1;
-               }
-               dnsec = freqNsec;
+               log<software_error>({__FILE__, __LINE__,errno, "clock_nanosleep"});
+               break;
             }
          }
       }
@@ -448,18 +448,7 @@ INDI_NEWCALLBACK_DEFN(dmModulator, m_indiP_zero)(const pcf::IndiProperty &ipRecv
    
    if( ipRecv["request"].getSwitchState() == pcf::IndiElement::On)
    {
-      m_imageStream.md->write = 1;
-   
-      memset(m_imageStream.array.raw, 0, m_width*m_height*m_typeSize);
-      timespec currtime;
-      clock_gettime(CLOCK_REALTIME, &currtime);
-      m_imageStream.md->atime = currtime;
-      m_imageStream.md->writetime = currtime;
-               
-      m_imageStream.md->cnt0++;
-   
-      m_imageStream.md->write=0;
-      ImageStreamIO_sempost(&m_imageStream,-1);      
+      dev::modulationEngine::zero(&m_imageStream, m_width*m_height*m_typeSize);
    }
    
    
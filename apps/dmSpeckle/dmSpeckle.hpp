@@ -155,6 +155,10 @@ protected:
 
    pcf::IndiProperty m_modThreadProp; ///< The property to hold the modulator thread details.
 
+   realT m_modSpinTime {0}; ///< The time, in microseconds, to busy-wait before each tick instead of sleeping (default 0).
+
+   dev::modulationEngine m_modEngine; ///< Schedules the ticks and publishes the shapes.
+
    ///Thread starter, called by modThreadStart on thread construction.  Calls modThreadExec.
    static void modThreadStart( dmSpeckle * d /**< [in] a pointer to a dmSpeckle instance (normally this) */);
 
@@ -194,8 +198,13 @@ public:
    
    int recordTelem( const telem_dmspeck * );
    
+   int recordTelem( const telem_dmmodtiming * );
+   
    int recordDmSpeck(bool force = false);
    
+   /// Record the modulation timing statistics since the last record, and reset them.
+   int recordModTiming();
+   
    ///@}
 };
 
@@ -223,6 +232,8 @@ void dmSpeckle::setupConfig()
 
    config.add("modulator.cpuset", "", "modulator.cpuset", argType::Required, "modulator", "cpuset", false, "string", "The cpuset to assign the modulator thread to.");
 
+   config.add("modulator.spinTime", "", "modulator.spinTime", argType::Required, "modulator", "spinTime", false, "float", "The time, in microseconds, to busy-wait before each tick instead of sleeping.  Reduces the timing error at high frequencies, at the cost of a core (default 0).");
+
 }
 
 int dmSpeckle::loadConfigImpl( mx::app::appConfigurator & _config )
@@ -244,6 +255,7 @@ int dmSpeckle::loadConfigImpl( mx::app::appConfigurator & _config )
    
    _config(m_modThreadPrio, "modulator.threadPrio");
    _config(m_modThreadCpuset, "modulator.cpuset");
+   _config(m_modSpinTime, "modulator.spinTime");
    
    dev::telemeter<dmSpeckle>::loadConfig(_config);
    return 0;
@@ -489,15 +501,13 @@ void dmSpeckle::modThreadExec()
       {
          generateSpeckles();
          
-         int64_t freqNsec = (1.0/m_frequency)*1e9;
-         int64_t dnsec;
-   
-         int idx = 0;
+         if(m_modEngine.setup(&m_imageStream, m_shapes.data(), m_shapes.planes(), m_width*m_height*m_typeSize) < 0)
+         {
+            log<software_error>({__FILE__, __LINE__, "error setting up modulation"});
+            m_modulating = false;
+            continue;
+         }
          
-         timespec modstart;
-         timespec currtime;
-      
-         bool triggered = false;
          sem_t * sem = nullptr;
          if(m_dmTriggerChannel == "") 
          {
@@ -519,8 +529,7 @@ void dmSpeckle::modThreadExec()
          //The official record:
          recordDmSpeck(true);
 
-         dnsec = freqNsec;
-         clock_gettime(CLOCK_REALTIME, &modstart);
+         m_modEngine.start(m_frequency, m_modSpinTime/1e6);
 
          while(m_modulating && !m_shutdown)
          {
@@ -538,12 +547,10 @@ void dmSpeckle::modThreadExec()
          
                if(sem_timedwait(sem, &ts) == 0)
                {
-                  triggered = true;
+                  m_modEngine.publish(false);
                }
                else
                {
-                  triggered = false;
-
                   //Check for why we timed out
                   if(errno == EINTR) break; //This indicates signal interrupted us, time to restart or shutdown, loop will exit normally if flags set.
             
@@ -558,59 +565,19 @@ void dmSpeckle::modThreadExec()
             }
             else
             {
-               mx::sys::nanoSleep(0.5*dnsec);
-               clock_gettime(CLOCK_REALTIME, &currtime);
-         
-               dnsec = (currtime.tv_sec - modstart.tv_sec)*1000000000 + (currtime.tv_nsec - modstart.tv_nsec);
-               triggered = false;
-            }
-
-            if(dnsec >= freqNsec || triggered)
-            {
-               //Do the write
-               
-               m_imageStream.md->write = 1;
-   
-               memcpy(m_imageStream.array.raw, m_shapes.image(idx).data(), m_width*m_height*m_typeSize);
-      
-               m_imageStream.md->atime = currtime;
-               m_imageStream.md->writetime = currtime;
-               
-               if(!m_trigger) m_imageStream.md->cnt0++;
-   
-               m_imageStream.md->write=0;
-               ImageStreamIO_sempost(&m_imageStream,-1);
-   
-               ++idx;
-               if(idx >= m_shapes.planes()) idx=0;
-               
-               if(!m_trigger)
+               if(m_modEngine.tick() < 0)
                {
-                  modstart.tv_nsec += freqNsec;
-                  if(modstart.tv_nsec >= 1000000000)
-                  {
-                     modstart.tv_nsec -= 1000000000;
-                     modstart.tv_sec += 1;
-                  }
-                  dnsec = freqNsec;
+                  log<software_error>({__FILE__, __LINE__,errno, "clock_nanosleep"});
+                  break;
                }
             }
          }
          recordDmSpeck(true);
+         recordModTiming();
          log<text_log>("stopped modulating", logPrio::LOG_NOTICE);
+         
          //Always zero when done
-         clock_gettime(CLOCK_REALTIME, &currtime);
-         m_imageStream.md->write = 1;
-   
-         memset(m_imageStream.array.raw, 0.0, m_width*m_height*m_typeSize);
-
-         m_imageStream.md->atime = currtime;
-         m_imageStream.md->writetime = currtime;
-               
-         if(!m_trigger) m_imageStream.md->cnt0++;
-   
-         m_imageStream.md->write=0;
-         ImageStreamIO_sempost(&m_imageStream,-1);
+         dev::modulationEngine::zero(&m_imageStream, m_width*m_height*m_typeSize, !m_trigger);
          log<text_log>("zeroed");
 
       }
@@ -819,18 +786,7 @@ INDI_NEWCALLBACK_DEFN(dmSpeckle, m_indiP_zero)(const pcf::IndiProperty &ipRecv)
    
    if( ipRecv["request"].getSwitchState() == pcf::IndiElement::On)
    {
-      m_imageStream.md->write = 1;
-   
-      memset(m_imageStream.array.raw, 0, m_width*m_height*m_typeSize);
-      timespec currtime;
-      clock_gettime(CLOCK_REALTIME, &currtime);
-      m_imageStream.md->atime = currtime;
-      m_imageStream.md->writetime = currtime;
-               
-      m_imageStream.md->cnt0++;
-   
-      m_imageStream.md->write=0;
-      ImageStreamIO_sempost(&m_imageStream,-1);      
+      dev::modulationEngine::zero(&m_imageStream, m_width*m_height*m_typeSize);
       log<text_log>("zeroed");
    }
    
@@ -841,7 +797,7 @@ INDI_NEWCALLBACK_DEFN(dmSpeckle, m_indiP_zero)(const pcf::IndiProperty &ipRecv)
 inline
 int dmSpeckle::checkRecordTimes()
 {
-   return telemeter<dmSpeckle>::checkRecordTimes(telem_dmspeck());
+   return telemeter<dmSpeckle>::checkRecordTimes(telem_dmspeck(), telem_dmmodtiming());
 }
    
 inline
@@ -850,6 +806,12 @@ int dmSpeckle::recordTelem( const telem_dmspeck * )
    return recordDmSpeck(true);
 }
  
+inline
+int dmSpeckle::recordTelem( const telem_dmmodtiming * )
+{
+   return recordModTiming();
+}
+ 
 inline
 int dmSpeckle::recordDmSpeck( bool force )
 {
@@ -885,6 +847,16 @@ int dmSpeckle::recordDmSpeck( bool force )
    return 0;
 } 
 
+inline
+int dmSpeckle::recordModTiming()
+{
+   dev::modulationTiming mt = m_modEngine.timing(true);
+   
+   telem<telem_dmmodtiming>({m_modEngine.preloaded(), mt.ticks, mt.missed, (float) mt.meanErr, (float) mt.rmsErr, (float) mt.maxErr});
+   
+   return 0;
+}
+
 } //namespace app
 } //namespace MagAOX
 
@@ -9,6 +9,7 @@
 
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <chrono>
 #include <thread>
 
@@ -20,7 +21,9 @@ using namespace mx::improc;
 #include "../../libMagAOX/libMagAOX.hpp" //Note this is included on command line to trigger pch
 #include "../../magaox_git_version.h"
 
-#include "predictive_controller.cuh"
+#include "predictive_controller.hpp"
+#include "shadow_learner.hpp"
+#include "pwfs_slopes.hpp"
 
 using namespace DDSPC;
 
@@ -107,13 +110,27 @@ protected:
 	uint8_t m_pwfsDataType{0}; ///< The ImageStreamIO type code.
 	size_t m_pwfsTypeSize {0}; ///< The size of the type, in bytes.  
 	
-	unsigned long long duration;
-	unsigned long long iterations;
+	/** \name Loop Timing
+	  * The time to extract the measurement vector and to run the controller, accumulated by processImage and reported
+	  * by appLogic.
+	  *
+	  * @{
+	  */
+	std::mutex m_timingMutex; ///< Protects the timing accumulators.
+	unsigned long long m_timingFrames {0}; ///< The number of frames timed since the last report.
+	double m_measTimeSum {0}; ///< The total measurement time since the last report, in microseconds.
+	double m_measTimeMax {0}; ///< The maximum measurement time since the last report, in microseconds.
+	double m_ctrlTimeSum {0}; ///< The total controller time since the last report, in microseconds.
+	double m_ctrlTimeMax {0}; ///< The maximum controller time since the last report, in microseconds.
+
+	pcf::IndiProperty m_indiP_timing; ///< The mean and maximum measurement and controller times per frame.
+	///@}
 
 	// The wavefront sensor variables
 	size_t m_illuminatedPixels;
 	size_t m_measurement_size;
 	eigenImage<realT> m_pupilMask;
+	pwfsSlopes<realT> m_slopes; ///< Extracts the measurement vector from the illuminated pixels of the pupil mask.
 	eigenImage<realT> m_interaction_matrix;
 	eigenImage<realT> m_measurementVector;
 	eigenImage<realT> m_refSlope;
@@ -145,6 +162,36 @@ protected:
 	int m_learning_counter;
 	float m_exploration_rms;
 
+	/** \name Learning Thread
+	  * With asynchronous learning the control path only queues the training samples, and this thread learns them in
+	  * a shadow controller which is swapped into the live one every m_swap_interval samples.
+	  *
+	  * @{
+	  */
+	bool m_async_learning {true};	///< Whether to learn in the learning thread instead of the control path.
+	int m_swap_interval {10};		///< The number of samples learned between controller swaps.
+	int m_learning_queue {64};		///< The maximum number of samples queued for learning.
+
+	int m_learnThreadPrio {0}; ///< Priority of the learning thread.
+
+	std::thread m_learnThread; ///< The learning thread.
+
+	bool m_learnThreadInit {true}; ///< Synchronizer to ensure the learning thread initializes before doing dangerous things.
+
+	pid_t m_learnThreadID {0}; ///< Learning thread PID.
+
+	pcf::IndiProperty m_learnThreadProp; ///< The property to hold the learning thread details.
+
+	std::shared_ptr<DDSPC::ShadowLearner> m_shadow; ///< The shadow learner, replaced in allocate so accessed atomically by other threads.
+
+	///Thread starter, called by threadStart on thread construction.  Calls learnThreadExec.
+	static void learnThreadStart( hoPredCtrl * p /**< [in] a pointer to a hoPredCtrl instance (normally this) */);
+
+	/// Execute the learning thread main loop.
+	void learnThreadExec();
+
+	///@}
+
 	bool m_is_closed_loop;
 
 	// Interaction for the DM
@@ -181,6 +228,8 @@ protected:
 	// The control parameters
 	pcf::IndiProperty m_indiP_lambda;
 	pcf::IndiProperty m_indiP_clipval;
+
+	pcf::IndiProperty m_indiP_learning; ///< The asynchronous learning status: backlog, dropped samples, and swap latency.
 	// pcf::IndiProperty m_indiP_gamma;
 	// pcf::IndiProperty m_indiP_inv_cov;
 
@@ -295,6 +344,10 @@ void hoPredCtrl::setupConfig()
 	config.add("parameters.exploration_steps", "", "parameters.exploration_steps", argType::Required, "parameters", "exploration_steps", false, "int", "The update clip value.");
 	config.add("parameters.exploration_rms", "", "parameters.exploration_rms", argType::Required, "parameters", "exploration_rms", false, "float", "The update clip value.");
 
+	config.add("parameters.async_learning", "", "parameters.async_learning", argType::Required, "parameters", "async_learning", false, "bool", "Learn in a background thread, and swap the controller in, instead of learning in the control path.  Default true.");
+	config.add("parameters.swap_interval", "", "parameters.swap_interval", argType::Required, "parameters", "swap_interval", false, "int", "With async_learning, the number of samples learned between controller swaps.  Default 10.");
+	config.add("parameters.learning_queue", "", "parameters.learning_queue", argType::Required, "parameters", "learning_queue", false, "int", "With async_learning, the maximum number of samples waiting to be learned.  Further samples are dropped.  Default 64.");
+
 	// Read in the learning parameters as a vector.
 	// config.add("parameters.exploration_steps", "", "parameters.exploration_steps",  argType::Required, "parameters", "exploration_steps", false, "vector<int>", "The number of steps for each training iteration.");
 	// config.add("parameters.exploration_rms", "", "parameters.exploration_rms",  argType::Required, "parameters", "exploration_rms", false, "vector<double>", "The rms for each training iteration.");
@@ -336,6 +389,10 @@ int hoPredCtrl::loadConfigImpl( mx::app::appConfigurator & _config )
 	_config(m_exploration_rms, "parameters.exploration_rms");
 	std::cout << "Nexplore:: "<< m_exploration_steps << " with " << m_exploration_rms << " rms." << std::endl;
 
+	_config(m_async_learning, "parameters.async_learning");
+	_config(m_swap_interval, "parameters.swap_interval");
+	_config(m_learning_queue, "parameters.learning_queue");
+
 	_config(m_dmChannel, "parameters.channel");
 	std::cout << "Open DM tweeter channel at " << m_dmChannel << std::endl;
    return 0;
@@ -393,6 +450,30 @@ int hoPredCtrl::appStartup()
 	// createStandardIndiNumber<int>( m_indiP_inv_cov, "lambda", 0, 1e8, 0.1, "%0.3f", "Inverse Covariance", "Learning control");
 	// registerIndiPropertyNew( m_indiP_inv_cov, INDI_NEWCALLBACK(m_indiP_inv_cov) );  
 
+	createROIndiNumber( m_indiP_learning, "learning", "Asynchronous Learning", "Learning control");
+	indi::addNumberElement<uint64_t>( m_indiP_learning, "backlog", 0, std::numeric_limits<uint64_t>::max(), 1, "%lu", "Queued Samples");
+	indi::addNumberElement<uint64_t>( m_indiP_learning, "learned", 0, std::numeric_limits<uint64_t>::max(), 1, "%lu", "Learned Samples");
+	indi::addNumberElement<uint64_t>( m_indiP_learning, "dropped", 0, std::numeric_limits<uint64_t>::max(), 1, "%lu", "Dropped Samples");
+	indi::addNumberElement<uint64_t>( m_indiP_learning, "swaps", 0, std::numeric_limits<uint64_t>::max(), 1, "%lu", "Controller Swaps");
+	indi::addNumberElement<double>( m_indiP_learning, "swap_latency", 0, std::numeric_limits<double>::max(), 0, "%0.1f", "Mean Swap Latency [us]");
+	indi::addNumberElement<double>( m_indiP_learning, "swap_latency_max", 0, std::numeric_limits<double>::max(), 0, "%0.1f", "Max Swap Latency [us]");
+	registerIndiPropertyReadOnly(m_indiP_learning);
+
+	createROIndiNumber( m_indiP_timing, "timing", "Loop Timing", "Loop Timing");
+	indi::addNumberElement<double>( m_indiP_timing, "measurement", 0, std::numeric_limits<double>::max(), 0, "%0.1f", "Mean Measurement Time [us]");
+	indi::addNumberElement<double>( m_indiP_timing, "measurement_max", 0, std::numeric_limits<double>::max(), 0, "%0.1f", "Max Measurement Time [us]");
+	indi::addNumberElement<double>( m_indiP_timing, "controller", 0, std::numeric_limits<double>::max(), 0, "%0.1f", "Mean Controller Time [us]");
+	indi::addNumberElement<double>( m_indiP_timing, "controller_max", 0, std::numeric_limits<double>::max(), 0, "%0.1f", "Max Controller Time [us]");
+	registerIndiPropertyReadOnly(m_indiP_timing);
+
+	if(m_async_learning){
+		if(threadStart( m_learnThread, m_learnThreadInit, m_learnThreadID, m_learnThreadProp, m_learnThreadPrio, "", "learning", this, learnThreadStart)  < 0)
+		{
+			log<software_critical>({__FILE__, __LINE__});
+			return -1;
+		}
+	}
+
 
 
 	state(stateCodes::OPERATING);
@@ -435,6 +516,34 @@ int hoPredCtrl::appLogic()
 	updateIfChanged(m_indiP_clipval, "current", m_clip_val);
 	// updateIfChanged(m_indiP_inv_cov, "current", m_inv_covariance);
 
+	std::shared_ptr<DDSPC::ShadowLearner> shadow = std::atomic_load(&m_shadow);
+	if(shadow){
+		// The swap latencies over the last loop
+		DDSPC::ShadowLearnerStats st = shadow->stats(true);
+
+		updateIfChanged(m_indiP_learning, std::vector<std::string>({"backlog", "learned", "dropped", "swaps"}), std::vector<uint64_t>({st.backlog, st.learned, st.dropped, st.swaps}));
+		updateIfChanged(m_indiP_learning, std::vector<std::string>({"swap_latency", "swap_latency_max"}), std::vector<double>({st.mean_swap_latency, st.max_swap_latency}));
+	}
+
+	// The frame times over the last loop
+	double measTime = 0, measTimeMax = 0, ctrlTime = 0, ctrlTimeMax = 0;
+	{
+		std::lock_guard<std::mutex> guard(m_timingMutex);
+		if(m_timingFrames > 0){
+			measTime = m_measTimeSum / m_timingFrames;
+			measTimeMax = m_measTimeMax;
+			ctrlTime = m_ctrlTimeSum / m_timingFrames;
+			ctrlTimeMax = m_ctrlTimeMax;
+		}
+
+		m_timingFrames = 0;
+		m_measTimeSum = 0;
+		m_measTimeMax = 0;
+		m_ctrlTimeSum = 0;
+		m_ctrlTimeMax = 0;
+	}
+	updateIfChanged(m_indiP_timing, std::vector<std::string>({"measurement", "measurement_max", "controller", "controller_max"}), std::vector<double>({measTime, measTimeMax, ctrlTime, ctrlTimeMax}));
+
 	if(m_is_closed_loop){
 		updateSwitchIfChanged(m_indiP_controlToggle, "toggle", pcf::IndiElement::On, INDI_OK);
 	}else{
@@ -455,11 +564,57 @@ int hoPredCtrl::appShutdown()
 	m_shaped_command.setZero();
 	send_dm_command();
 
+	if(m_learnThread.joinable())
+	{
+		try
+		{
+			m_learnThread.join(); //this will throw if it was already joined
+		}
+		catch(...)
+		{
+		}
+	}
+
 	delete controller;
 
 	return 0;
 }
 
+inline
+void hoPredCtrl::learnThreadStart( hoPredCtrl * p)
+{
+	p->learnThreadExec();
+}
+
+inline
+void hoPredCtrl::learnThreadExec()
+{
+	m_learnThreadID = syscall(SYS_gettid);
+
+	//Wait for the thread starter to finish initializing this thread.
+	while( m_learnThreadInit == true && m_shutdown == 0)
+	{
+		sleep(1);
+	}
+
+	while(m_shutdown == 0)
+	{
+		//Holding this keeps the learner alive if allocate replaces it.
+		std::shared_ptr<DDSPC::ShadowLearner> shadow = std::atomic_load(&m_shadow);
+
+		if(!shadow)
+		{
+			sleep(1);
+			continue;
+		}
+
+		if(shadow->work(0.1) < 0)
+		{
+			log<software_error>({__FILE__, __LINE__, errno, "sem_timedwait"});
+		}
+	}
+}
+
 inline
 int hoPredCtrl::allocate(const dev::shmimT & dummy)
 {
@@ -475,7 +630,9 @@ int hoPredCtrl::allocate(const dev::shmimT & dummy)
 	m_quadHeight = m_pwfsHeight / 2;
 	std::cout << "Height " << m_pwfsHeight << std::endl;
 
-	set_pupil_mask(m_pupilMaskFilename);
+	if(set_pupil_mask(m_pupilMaskFilename) < 0){
+		return log<software_error,-1>({__FILE__, __LINE__, "pupil mask does not fit in a quadrant of the WFS image"});
+	}
 
 	// Read in the pupil mask
 	mx::fits::fitsFile<realT> ff;
@@ -494,6 +651,10 @@ int hoPredCtrl::allocate(const dev::shmimT & dummy)
 	controller = new DDSPC::PredictiveController(m_numHist, m_numFut, m_numModes, m_measurement_size, m_gamma, m_lambda, m_inv_covariance);
 	controller->set_interaction_matrix(m_interaction_matrix.data());
 
+	if(m_async_learning){
+		std::atomic_store(&m_shadow, std::make_shared<DDSPC::ShadowLearner>(m_numHist, m_numFut, m_numModes, m_gamma, m_inv_covariance, m_learning_queue, m_swap_interval));
+	}
+
 	mx::fits::fitsFile<realT> ff2;
 	ff2.read(m_illuminated_actuators_mask, m_actuator_mask_filename);
 	std::cerr << "Read a " << m_illuminated_actuators_mask.rows() << " x " << m_illuminated_actuators_mask.cols() << " actuator mask.\n";
@@ -558,8 +719,6 @@ int hoPredCtrl::allocate(const dev::shmimT & dummy)
 		send_dm_command();
 	}
 
-	duration = 0;
-	iterations = 0;
 	m_is_closed_loop = false;
 
 	return 0;
@@ -571,31 +730,10 @@ int hoPredCtrl::processImage( void * curr_src, const dev::shmimT & dummy )
 	static_cast<void>(dummy); //be unused
 	auto start = std::chrono::steady_clock::now();
 
-	Eigen::Map<eigenImage<unsigned short>> pwfsIm( static_cast<unsigned short *>(curr_src), m_pwfsHeight, m_pwfsWidth);
-	realT mean_value = 0;
-	realT Ia = 0, Ib = 0, Ic = 0, Id = 0;
-
-	size_t ki = 0;
-	for(uint32_t col_i=0; col_i < m_quadWidth; ++col_i){
-		for(uint32_t row_i=0; row_i < m_quadHeight; ++row_i){
-			// Select the pixel from the correct quadrant and subtract dark			
-			Ic = (realT)pwfsIm(row_i, col_i) - m_darkImage(row_i, col_i);															
-			Id = (realT)pwfsIm(row_i + m_quadWidth, col_i) - m_darkImage(row_i + m_quadWidth, col_i);								
-			Ia = (realT)pwfsIm(row_i, col_i + m_quadHeight) - m_darkImage(row_i, col_i + m_quadHeight);								
-			Ib = (realT)pwfsIm(row_i + m_quadWidth, col_i + m_quadHeight) - m_darkImage(row_i + m_quadWidth, col_i + m_quadHeight);
-
-			// Calculate the norm
-			realT pwfsNorm = Ia + Ib + Ic + Id;
-
-			// Take all linear combinations of the measurements and concatenate in vector
-			if(m_pupilMask(row_i, col_i) > 0.5){
-				m_measurementVector(ki, 0) = (Ia - Ib + Ic - Id) / pwfsNorm;
-				m_measurementVector(ki + m_illuminatedPixels, 0) = (Ia + Ib - Ic - Id) / pwfsNorm;
-				m_measurementVector(ki + 2 * m_illuminatedPixels, 0) = (Ia - Ib - Ic + Id) / pwfsNorm;
-				++ki;
-			}
-		}
-	}
+	// Dark subtract and combine the quadrants of the illuminated pixels
+	m_slopes.extract(m_measurementVector.data(), static_cast<unsigned short *>(curr_src), m_darkImage.data());
+
+	auto measured = std::chrono::steady_clock::now();
 
 	// Okay reconstruction matrix is used correctly!
 	// The error is now in the slope measurement.
@@ -604,14 +742,20 @@ int hoPredCtrl::processImage( void * curr_src, const dev::shmimT & dummy )
 		controller->add_measurement(m_measurementVector.data());
 				 
 		// If -1 always learn, otherwise learn for N steps
-		if(m_learning_counter == -1){
-			controller->update_predictor();
-			controller->update_controller();
-		}else if(m_learning_counter > 0){
-			controller->update_predictor();
-			controller->update_controller();
-			m_learning_counter -= 1;
+		if(m_learning_counter == -1 || m_learning_counter > 0){
+			if(m_shadow){
+				// Learned in the learning thread
+				m_shadow->push(controller);
+			}else{
+				controller->update_predictor();
+				controller->update_controller();
+			}
+
+			if(m_learning_counter > 0) m_learning_counter -= 1;
 		}
+
+		// A newly learned controller is swapped in before the command, never during it
+		if(m_shadow) m_shadow->swap(controller);
 		
 		m_command = controller->get_command(m_clip_val);	
 		// This works!
@@ -622,18 +766,17 @@ int hoPredCtrl::processImage( void * curr_src, const dev::shmimT & dummy )
 
 	}
 	auto end = std::chrono::steady_clock::now();
-	duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-
-	//if(iterations == 0){
-	//		
-	//}else{
-	//	duration = 0.1 * duration + 0.9 * std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-	//}
-	iterations += 1;
-	
-	if(iterations % 400 == 0){
-		std::cout << "elapsed " << (double)duration / (double)iterations << " us." << std::endl;
-		std::cout << '\n';
+
+	double measTime = std::chrono::duration<double, std::micro>(measured - start).count();
+	double ctrlTime = std::chrono::duration<double, std::micro>(end - measured).count();
+
+	{
+		std::lock_guard<std::mutex> guard(m_timingMutex);
+		++m_timingFrames;
+		m_measTimeSum += measTime;
+		if(measTime > m_measTimeMax) m_measTimeMax = measTime;
+		m_ctrlTimeSum += ctrlTime;
+		if(ctrlTime > m_ctrlTimeMax) m_ctrlTimeMax = ctrlTime;
 	}
 
 	// std::chrono::milliseconds timespan(500); // or whatever
@@ -652,16 +795,13 @@ int hoPredCtrl::set_pupil_mask(std::string pupil_mask_filename){
 	ff.read(m_pupilMask, pupil_mask_filename);
 	std::cerr << "Read a " << m_pupilMask.rows() << " x " << m_pupilMask.cols() << " matrix.\n";
 
-	// Count the number of pixels that are used for the wavefront sensing
-	m_illuminatedPixels = 0;
-	realT * data = m_pupilMask.data();
-   
-	for(size_t nn=0; nn < m_pupilMask.rows() * m_pupilMask.cols(); ++nn){
-		if(data[nn] > 0.5)
-			++m_illuminatedPixels;
+	// List the pixels that are used for the wavefront sensing
+	if(m_slopes.setup(m_pupilMask.data(), m_pupilMask.rows(), m_pupilMask.cols(), m_pwfsWidth, m_pwfsHeight) < 0){
+		return -1;
 	}
-	
-	m_measurement_size = 3 * m_illuminatedPixels;
+
+	m_illuminatedPixels = m_slopes.illuminated();
+	m_measurement_size = m_slopes.size();
 
 	std::cout << "Number of illuminated pixels :: " << m_illuminatedPixels << std::endl;
 	std::cout << "Measurement vector size :: " << m_measurement_size << std::endl;
@@ -867,6 +1007,10 @@ INDI_NEWCALLBACK_DEFN(hoPredCtrl, m_indiP_lambda )(const pcf::IndiProperty &ipRe
 	if(!m_is_closed_loop){
 		m_lambda = target;
 		controller->set_new_regularization(m_lambda);
+
+		std::shared_ptr<DDSPC::ShadowLearner> shadow = std::atomic_load(&m_shadow);
+		if(shadow) shadow->set_new_regularization(m_lambda);
+
 		updateIfChanged(m_indiP_lambda, "target", m_lambda);
 	}else{
 		 log<text_log>("Lambda not changed. Loop is still running.", logPrio::LOG_NOTICE);
@@ -1066,6 +1210,9 @@ INDI_NEWCALLBACK_DEFN(hoPredCtrl, m_indiP_reset_modelRequest )(const pcf::IndiPr
 	{
 		std::lock_guard<std::mutex> guard(m_indiMutex);
 		controller->reset_controller();
+
+		std::shared_ptr<DDSPC::ShadowLearner> shadow = std::atomic_load(&m_shadow);
+		if(shadow) shadow->reset();
 		updateSwitchIfChanged(m_indiP_reset_modelRequest, "toggle", pcf::IndiElement::Off, INDI_IDLE);
 	}
    
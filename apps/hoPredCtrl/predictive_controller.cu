@@ -71,6 +71,7 @@ namespace DDSPC
 	void PredictiveController::create_exploration_buffer(float rms, int exploration_buffer_size){
 		std::cout << " Create buffer with size: " << exploration_buffer_size << std::endl;
 		m_exploration_index = 0;
+		m_exploration_buffer_size = exploration_buffer_size;
 
 		// First clean the current_buffer and only if it exists
 		if(m_exploration_buffer){
@@ -128,5 +129,16 @@ namespace DDSPC
 		// Copy into shmimstream
 		return m_command->cpu_data[0];
 	};
+
+	void PredictiveController::get_training_sample(float* phi, float* xf){
+		// The features and future measurements built by the last add_measurement, column-major by mode
+		cudaMemcpy(phi, controller->phi->gpu_data[0], controller->nfeatures * m_num_modes * sizeof(float), cudaMemcpyDeviceToHost);
+		cudaMemcpy(xf, controller->xf->gpu_data[0], m_num_future * m_num_modes * sizeof(float), cudaMemcpyDeviceToHost);
+	};
+
+	void PredictiveController::set_controller(const float* new_controller){
+		// One row of (nfeatures - nfuture) per mode
+		cudaMemcpy(controller->controller->gpu_data[0], new_controller, (controller->nfeatures - m_num_future) * m_num_modes * sizeof(float), cudaMemcpyHostToDevice);
+	};
 	
 }
\ No newline at end of file
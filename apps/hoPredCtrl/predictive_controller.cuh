@@ -63,6 +63,10 @@ class PredictiveController{
 		void set_interaction_matrix(float* interaction_matrix);
 		void add_measurement(float* new_wfs_measurement);
 		float* get_command(float clip_val);
+
+		// Training data for an external learner, and the controller it learns
+		void get_training_sample(float* phi, float* xf);
+		void set_controller(const float* new_controller);
 		
 };
 
@@ -0,0 +1,19 @@
+/** \file predictive_controller.hpp
+  * \brief Selects the backend of the data-driven predictive controller.
+  *
+  * The CUDA backend is used when building with CUDA (NEED_CUDA = yes, which defines HAVE_CUDA), otherwise the CPU
+  * backend.  Both provide DDSPC::PredictiveController with the same interface.
+  *
+  * \ingroup hoPredCtrl_files
+  */
+
+#ifndef RDDSC_HPP
+#define RDDSC_HPP
+
+#ifdef HAVE_CUDA
+#include "predictive_controller.cuh"
+#else
+#include "predictive_controller_cpu.hpp"
+#endif
+
+#endif
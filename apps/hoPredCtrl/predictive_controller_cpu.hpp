@@ -0,0 +1,260 @@
+/** \file predictive_controller_cpu.hpp
+  * \brief The CPU backend of the data-driven predictive controller.
+  *
+  * \ingroup hoPredCtrl_files
+  */
+
+#ifndef RDDSC_CPU_HPP
+#define RDDSC_CPU_HPP
+
+#include <random>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "predictor_learner.hpp"
+
+namespace DDSPC
+{
+
+/// The predictive controller, computed on the CPU with Eigen and OpenMP.
+/** This has the same interface and numerics as the CUDA backend in predictive_controller.cuh, which it replaces
+  * when the app is built without CUDA.  Each mode has its own recursive least squares predictor and controller,
+  * learned by a PredictorLearner, and modes are independent, so every step is a loop over the modes which OpenMP
+  * splits across the cores.  The data history of each mode is stored contiguously so that each thread works on its
+  * own cache lines.
+  */
+class PredictiveController{
+	public:
+		typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> matrixT;
+		typedef Eigen::Matrix<float, Eigen::Dynamic, 1> vectorT;
+
+	private:
+		int m_num_history;
+		int m_num_future;
+		int m_num_modes;
+		int m_num_measurements;
+		int m_num_features;	// num_future - 1 + 2*num_history
+		int m_num_past;		// The length of the controller, m_num_features - num_future
+
+		unsigned long long int m_buffer_mask;
+		unsigned long long int m_buffer_index;
+
+		unsigned long long int m_exploration_buffer_size;
+		unsigned long long int m_exploration_index;
+
+		matrixT m_interaction_matrix;	// Transposed, num_measurements x num_modes, so each mode's row is contiguous.
+		matrixT m_exploration_buffer;	// num_modes x exploration steps
+
+		matrixT m_measurement_buffer;	// History x num_modes, so each mode's history is contiguous.
+		matrixT m_command_buffer;		// History x num_modes
+
+		matrixT m_phi;	// num_features x num_modes
+		matrixT m_xf;	// num_future x num_modes
+		matrixT m_wp;	// m_num_past x num_modes
+
+		PredictorLearner m_learner;
+		matrixT m_controller;	// m_num_past x num_modes
+
+		vectorT m_command;
+
+	public:
+		vectorT m_measurement;	// The newest measurement in modal space.
+
+		PredictiveController(int num_history, int num_future, int num_modes, int num_measurements, float gamma, float lambda, float P0);
+
+		void reset_data_buffer();
+		void reset_controller();
+		void update_predictor();
+		void update_controller();
+
+		// This function should reset the buffers and set the current control command to zero.
+		void set_zero();
+
+		// Training signal
+		void get_next_exploration_signal(){}; // Included in get_command
+		void create_exploration_buffer(float rms, int exploration_buffer_size);
+
+		void set_new_regularization(float new_lambda);
+		void set_interaction_matrix(float* interaction_matrix);
+		void add_measurement(float* new_wfs_measurement);
+		float* get_command(float clip_val);
+
+		// Training data for an external learner, and the controller it learns
+		void get_training_sample(float* phi, float* xf);
+		void set_controller(const float* controller);
+};
+
+inline
+PredictiveController::PredictiveController(int num_history, int num_future, int num_modes, int num_measurements, float gamma, float lambda, float P0) :
+	m_learner(num_history, num_future, num_modes, gamma, P0){
+	m_num_history = num_history;
+	m_num_future = num_future;
+	m_num_modes = num_modes;
+	m_num_measurements = num_measurements;
+
+	// Use all future DM commands except the most recent because that one will only have an effect in later measurements
+	m_num_features = num_future - 1 + 2 * num_history;
+	m_num_past = m_num_features - num_future;
+
+	// Like the CUDA backend, lambda only takes effect with set_new_regularization.
+	static_cast<void>(lambda);
+
+	// The history is a power of two long so the index can be masked
+	m_buffer_mask = 1;
+	while(m_buffer_mask < (unsigned long long int) (num_history + num_future + 2)) m_buffer_mask <<= 1;
+	m_buffer_mask -= 1;
+
+	m_exploration_buffer_size = 0;
+	m_exploration_index = 0;
+
+	m_interaction_matrix.setConstant(num_measurements, num_modes, 1.0);
+
+	m_measurement_buffer.resize(m_buffer_mask + 1, num_modes);
+	m_command_buffer.resize(m_buffer_mask + 1, num_modes);
+	m_phi.resize(m_num_features, num_modes);
+	m_xf.resize(num_future, num_modes);
+	m_wp.resize(m_num_past, num_modes);
+	m_command.resize(num_modes);
+	m_measurement.setZero(num_modes);
+
+	m_controller.resize(m_num_past, num_modes);
+
+	reset_data_buffer();
+	reset_controller();
+}
+
+inline
+void PredictiveController::reset_data_buffer(){
+	m_buffer_index = 0;
+
+	m_measurement_buffer.setZero();
+	m_command_buffer.setZero();
+	m_command.setZero();
+	m_phi.setZero();
+	m_xf.setZero();
+	m_wp.setZero();
+}
+
+inline
+void PredictiveController::reset_controller(){
+	m_learner.reset();
+	m_controller.setZero();
+}
+
+inline
+void PredictiveController::set_zero(){
+	m_command.setZero();
+}
+
+inline
+void PredictiveController::create_exploration_buffer(float rms, int exploration_buffer_size){
+	m_exploration_index = 0;
+	m_exploration_buffer_size = exploration_buffer_size > 0 ? exploration_buffer_size : 0;
+
+	// A random binary signal of +/- rms
+	std::mt19937 generator{std::random_device{}()};
+	std::bernoulli_distribution distribution(0.5);
+
+	m_exploration_buffer.resize(m_num_modes, m_exploration_buffer_size);
+	for(unsigned long long int k = 0; k < m_exploration_buffer_size; ++k){
+		for(int i = 0; i < m_num_modes; ++i){
+			m_exploration_buffer(i, k) = distribution(generator) ? rms : -rms;
+		}
+	}
+}
+
+inline
+void PredictiveController::set_new_regularization(float new_lambda){
+	m_learner.set_new_regularization(new_lambda);
+}
+
+inline
+void PredictiveController::set_interaction_matrix(float* interaction_matrix){
+	// interaction_matrix is column-major, num_modes x num_measurements
+	m_interaction_matrix = Eigen::Map<matrixT>(interaction_matrix, m_num_modes, m_num_measurements).transpose();
+}
+
+inline
+void PredictiveController::add_measurement(float* new_wfs_measurement){
+	Eigen::Map<vectorT> wfs(new_wfs_measurement, m_num_measurements);
+
+	unsigned long long int idx = m_buffer_index;
+	unsigned long long int mask = m_buffer_mask;
+
+	#pragma omp parallel for schedule(static)
+	for(int m = 0; m < m_num_modes; ++m){
+		auto meas = m_measurement_buffer.col(m);
+		auto cmd = m_command_buffer.col(m);
+
+		m_measurement[m] = m_interaction_matrix.col(m).dot(wfs);
+		meas[idx & mask] = m_measurement[m];
+
+		// The features: the past and future commands, and the past measurements
+		auto phi = m_phi.col(m);
+		for(int i = 0; i < m_num_future - 1 + m_num_history; ++i) phi[i] = cmd[(idx - 1 - i) & mask];
+
+		int phi_offset = m_num_future - 1 + m_num_history;
+		for(int i = 0; i < m_num_history; ++i) phi[phi_offset + i] = meas[(idx - m_num_future - i) & mask];
+
+		// The future measurements
+		auto xf = m_xf.col(m);
+		for(int i = 0; i < m_num_future; ++i) xf[i] = meas[(idx - i) & mask];
+
+		// The past vector for the control command: N-1 past commands and N past measurements
+		auto wp = m_wp.col(m);
+		for(int i = 0; i < m_num_history - 1; ++i) wp[i] = cmd[(idx - 1 - i) & mask];
+		for(int i = 0; i < m_num_history; ++i) wp[m_num_history - 1 + i] = meas[(idx - i) & mask];
+	}
+}
+
+inline
+void PredictiveController::update_predictor(){
+	m_learner.update_predictor(m_phi.data(), m_xf.data());
+}
+
+inline
+void PredictiveController::update_controller(){
+	m_learner.update_controller(m_controller.data());
+}
+
+inline
+float* PredictiveController::get_command(float clip_val){
+	unsigned long long int slot = m_buffer_index & m_buffer_mask;
+
+	bool explore = m_exploration_index < m_exploration_buffer_size;
+	unsigned long long int expl = m_exploration_index;
+
+	#pragma omp parallel for schedule(static)
+	for(int m = 0; m < m_num_modes; ++m){
+		float delta = m_controller.col(m).dot(m_wp.col(m));
+		if(explore) delta += m_exploration_buffer(m, expl);
+
+		delta = delta < -clip_val ? -clip_val : delta;
+		delta = delta > clip_val ? clip_val : delta;
+
+		m_command_buffer(slot, m) = delta;
+		m_command[m] += delta;
+	}
+
+	if(explore) ++m_exploration_index;
+	++m_buffer_index;
+
+	return m_command.data();
+}
+
+inline
+void PredictiveController::get_training_sample(float* phi, float* xf){
+	// The features and future measurements built by the last add_measurement
+	Eigen::Map<matrixT>(phi, m_num_features, m_num_modes) = m_phi;
+	Eigen::Map<matrixT>(xf, m_num_future, m_num_modes) = m_xf;
+}
+
+inline
+void PredictiveController::set_controller(const float* controller){
+	m_controller = Eigen::Map<const matrixT>(controller, m_num_past, m_num_modes);
+}
+
+}
+
+#endif
@@ -0,0 +1,168 @@
+/** \file predictor_learner.hpp
+  * \brief The recursive least squares learning of the predictive controller, on the CPU.
+  *
+  * \ingroup hoPredCtrl_files
+  */
+
+#ifndef RDDSC_LEARNER_HPP
+#define RDDSC_LEARNER_HPP
+
+#include <Eigen/Dense>
+
+namespace DDSPC
+{
+
+/// Learns the per-mode predictors from training samples, and computes the controllers from them.
+/** A training sample is the features \f$ \phi \f$ (num_features x num_modes) and the future measurements \f$ x_f \f$
+  * (num_future x num_modes) of one step, column-major with one column per mode, as the controller builds them in
+  * add_measurement.  With them the RLS update of a mode's predictor is
+  * \f[ k = \frac{\phi^T P}{\phi^T P \phi + \gamma}, \quad A \leftarrow A + (x_f - A\phi) k, \quad P \leftarrow \frac{P - (\phi^T P)^T k}{\gamma} \f]
+  * and its controller is the last row of \f$ -(B^T B + \lambda I)^{-1} B^T A_s \f$, where \f$ B \f$ is the first
+  * num_future columns of A and \f$ A_s \f$ the rest.  As \f$ B^T B + \lambda I \f$ is symmetric only that row is
+  * solved for, with an LDLT factorization.  If it is singular, as before any regularization is set and the
+  * predictor has learned, the LDLT gives the pseudo-inverse solution, so the controller is zero rather than NaN.
+  *
+  * Modes are independent, so each step is a loop over the modes which OpenMP splits across the cores.  The predictor
+  * A and its inverse covariance P are stored contiguously by mode so that each thread works on its own cache lines.
+  */
+class PredictorLearner{
+	public:
+		typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> matrixT;
+		typedef Eigen::Matrix<float, Eigen::Dynamic, 1> vectorT;
+
+	private:
+		int m_num_future;
+		int m_num_modes;
+		int m_num_features;	// num_future - 1 + 2*num_history
+		int m_num_past;		// The length of a mode's controller, m_num_features - num_future
+
+		float m_gamma;
+		float m_lambda;		// The regularization used by update_controller, 0 until set_new_regularization is called
+		float m_P0;
+
+		matrixT m_A;	// num_future x (num_features * num_modes)
+		matrixT m_P;	// num_features x (num_features * num_modes)
+
+	public:
+		PredictorLearner(int num_history, int num_future, int num_modes, float gamma, float P0);
+
+		int num_features(){ return m_num_features;};
+		int num_past(){ return m_num_past;};
+
+		// Zero the predictors and reset their inverse covariances to P0
+		void reset();
+
+		void set_new_regularization(float new_lambda);
+
+		// Learn from one sample
+		void update_predictor(const float* phi, const float* xf);
+
+		// Compute the controllers, num_past x num_modes
+		void update_controller(float* controller);
+
+	private:
+		// The predictor of mode m
+		matrixT::ColsBlockXpr A(int m){ return m_A.middleCols(m*m_num_features, m_num_features);};
+
+		// The inverse covariance of mode m
+		matrixT::ColsBlockXpr P(int m){ return m_P.middleCols(m*m_num_features, m_num_features);};
+};
+
+inline
+PredictorLearner::PredictorLearner(int num_history, int num_future, int num_modes, float gamma, float P0){
+	m_num_future = num_future;
+	m_num_modes = num_modes;
+
+	// Use all future DM commands except the most recent because that one will only have an effect in later measurements
+	m_num_features = num_future - 1 + 2 * num_history;
+	m_num_past = m_num_features - num_future;
+
+	m_gamma = gamma;
+	m_lambda = 0;
+	m_P0 = P0;
+
+	m_A.resize(num_future, m_num_features * num_modes);
+	m_P.resize(m_num_features, m_num_features * num_modes);
+
+	reset();
+}
+
+inline
+void PredictorLearner::reset(){
+	m_A.setZero();
+
+	m_P.setZero();
+	for(int m = 0; m < m_num_modes; ++m) P(m).diagonal().setConstant(m_P0);
+}
+
+inline
+void PredictorLearner::set_new_regularization(float new_lambda){
+	m_lambda = new_lambda;
+}
+
+inline
+void PredictorLearner::update_predictor(const float* phi, const float* xf){
+	Eigen::Map<const matrixT> phis(phi, m_num_features, m_num_modes);
+	Eigen::Map<const matrixT> xfs(xf, m_num_future, m_num_modes);
+
+	float inv_gamma = 1.0f / m_gamma;
+
+	#pragma omp parallel
+	{
+		vectorT xtP(m_num_features);
+		vectorT err(m_num_future);
+
+		#pragma omp for schedule(static)
+		for(int m = 0; m < m_num_modes; ++m){
+			auto x = phis.col(m);
+			auto Am = A(m);
+			auto Pm = P(m);
+
+			// xtP holds (x^T P)^T, and becomes the gain k^T
+			xtP.noalias() = Pm.transpose() * x;
+			float cn = x.dot(xtP) + m_gamma;
+
+			// The a-priori error
+			err = xfs.col(m);
+			err.noalias() -= Am * x;
+
+			Am.noalias() += (err / cn) * xtP.transpose();
+			Pm.noalias() -= (xtP / cn) * xtP.transpose();
+			Pm *= inv_gamma;
+		}
+	}
+}
+
+inline
+void PredictorLearner::update_controller(float* controller){
+	Eigen::Map<matrixT> controllers(controller, m_num_past, m_num_modes);
+
+	#pragma omp parallel
+	{
+		matrixT H11(m_num_future, m_num_future);
+		vectorT z(m_num_future);
+		vectorT e = vectorT::Unit(m_num_future, m_num_future - 1);
+		Eigen::LDLT<matrixT> ldlt(m_num_future);
+
+		#pragma omp for schedule(static)
+		for(int m = 0; m < m_num_modes; ++m){
+			auto Am = A(m);
+			auto B = Am.leftCols(m_num_future);
+			auto As = Am.rightCols(m_num_past);
+
+			H11.noalias() = B.transpose() * B;
+			H11.diagonal().array() += m_lambda;
+
+			// The last row of invH11, which is its last column as H11 is symmetric
+			ldlt.compute(H11);
+			z = ldlt.solve(e);
+
+			// controller = -invH11[nfuture-1,:] * B^T As
+			controllers.col(m).noalias() = -(As.transpose() * (B * z));
+		}
+	}
+}
+
+}
+
+#endif
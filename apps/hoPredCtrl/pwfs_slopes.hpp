@@ -0,0 +1,159 @@
+/** \file pwfs_slopes.hpp
+  * \brief Extraction of the pyramid WFS measurement vector from the illuminated pixels.
+  *
+  * \ingroup hoPredCtrl_files
+  */
+
+#ifndef pwfs_slopes_hpp
+#define pwfs_slopes_hpp
+
+#include <cstdint>
+#include <vector>
+
+namespace MagAOX
+{
+namespace app
+{
+
+/// Converts a pyramid WFS image into the measurement vector of its illuminated pixels.
+/** The image has four quadrants, and the pupil mask is the size of one.  For each illuminated pixel of the mask, with
+  * dark-subtracted intensities \f$ I_c \f$ in the first quadrant, \f$ I_d \f$ one quadrant down the rows,
+  * \f$ I_a \f$ one quadrant along the columns, and \f$ I_b \f$ in the last quadrant, the measurement vector holds the
+  * three normalized combinations
+  * \f[ \frac{I_a - I_b + I_c - I_d}{N}, \quad \frac{I_a + I_b - I_c - I_d}{N}, \quad \frac{I_a - I_b - I_c + I_d}{N}, \quad N = I_a + I_b + I_c + I_d \f]
+  * as three contiguous blocks, with the pixels in mask (column-major) order.
+  *
+  * The illuminated pixels are listed in setup(), so extract() does no mask tests.  It is a gather pass, which
+  * dark-subtracts the four quadrants into contiguous arrays, then a branch-free pass computing the blocks, which
+  * vectorizes.  The gather is kept out of the arithmetic because there is no hardware gather in the baseline target.
+  *
+  * Images are column-major with the rows along the fast (ImageStreamIO size[0]) axis.
+  *
+  * \tparam realT the type of the measurement vector
+  */
+template<typename realT>
+class pwfsSlopes
+{
+protected:
+   std::vector<uint32_t> m_pixels; ///< The index in the image of each illuminated pixel, in the first quadrant.
+
+   size_t m_offD {0}; ///< The offset of the d quadrant from the first.
+   size_t m_offA {0}; ///< The offset of the a quadrant from the first.
+   size_t m_offB {0}; ///< The offset of the b quadrant from the first.
+
+   std::vector<realT> m_Ia; ///< Working memory for the dark-subtracted intensities in quadrant a.
+   std::vector<realT> m_Ib; ///< Working memory for the dark-subtracted intensities in quadrant b.
+   std::vector<realT> m_Ic; ///< Working memory for the dark-subtracted intensities in quadrant c.
+   std::vector<realT> m_Id; ///< Working memory for the dark-subtracted intensities in quadrant d.
+
+public:
+
+   /// Setup the illuminated pixel list.
+   /**
+     * \returns 0 on success
+     * \returns -1 if the mask is larger than a quadrant of the image
+     */
+   int setup( const realT * mask, ///< [in] the pupil mask, pixels above 0.5 are illuminated
+              size_t maskRows,    ///< [in] the number of rows in the mask
+              size_t maskCols,    ///< [in] the number of columns in the mask
+              size_t imageRows,   ///< [in] the number of rows in the image, the fast axis
+              size_t imageCols    ///< [in] the number of columns in the image
+            )
+   {
+      m_pixels.clear();
+
+      size_t quadRows = imageRows / 2;
+      size_t quadCols = imageCols / 2;
+
+      if(maskRows > quadRows || maskCols > quadCols) return -1;
+
+      m_offD = quadRows;
+      m_offA = quadCols * imageRows;
+      m_offB = m_offD + m_offA;
+
+      for(size_t col = 0; col < maskCols; ++col)
+      {
+         for(size_t row = 0; row < maskRows; ++row)
+         {
+            if(mask[col*maskRows + row] > 0.5) m_pixels.push_back(col*imageRows + row);
+         }
+      }
+
+      m_Ia.resize(m_pixels.size());
+      m_Ib.resize(m_pixels.size());
+      m_Ic.resize(m_pixels.size());
+      m_Id.resize(m_pixels.size());
+
+      return 0;
+   }
+
+   /// Get the number of illuminated pixels.
+   size_t illuminated() const
+   {
+      return m_pixels.size();
+   }
+
+   /// Get the size of the measurement vector, 3 times the number of illuminated pixels.
+   size_t size() const
+   {
+      return 3*m_pixels.size();
+   }
+
+   /// Get the index in the image of each illuminated pixel, in the first quadrant.
+   const std::vector<uint32_t> & pixels() const
+   {
+      return m_pixels;
+   }
+
+   /// Extract the measurement vector from an image.
+   /**
+     * \tparam pixT the pixel type of the image
+     */
+   template<typename pixT>
+   void extract( realT * meas,        ///< [out] the measurement vector, of length size()
+                 const pixT * image,  ///< [in] the WFS image
+                 const realT * dark   ///< [in] the dark, the same size as the image
+               )
+   {
+      size_t N = m_pixels.size();
+
+      const uint32_t * __restrict__ pix = m_pixels.data();
+      realT * __restrict__ Ia = m_Ia.data();
+      realT * __restrict__ Ib = m_Ib.data();
+      realT * __restrict__ Ic = m_Ic.data();
+      realT * __restrict__ Id = m_Id.data();
+
+      for(size_t k = 0; k < N; ++k)
+      {
+         size_t p = pix[k];
+         Ic[k] = static_cast<realT>(image[p]) - dark[p];
+         Id[k] = static_cast<realT>(image[p + m_offD]) - dark[p + m_offD];
+         Ia[k] = static_cast<realT>(image[p + m_offA]) - dark[p + m_offA];
+         Ib[k] = static_cast<realT>(image[p + m_offB]) - dark[p + m_offB];
+      }
+
+      realT * __restrict__ m0 = meas;
+      realT * __restrict__ m1 = meas + N;
+      realT * __restrict__ m2 = meas + 2*N;
+
+      #pragma omp simd
+      for(size_t k = 0; k < N; ++k)
+      {
+         realT apb = Ia[k] + Ib[k];
+         realT amb = Ia[k] - Ib[k];
+         realT cpd = Ic[k] + Id[k];
+         realT cmd = Ic[k] - Id[k];
+
+         realT norm = static_cast<realT>(1) / (apb + cpd);
+
+         m0[k] = (amb + cmd) * norm;
+         m1[k] = (apb - cpd) * norm;
+         m2[k] = (amb - cmd) * norm;
+      }
+   }
+};
+
+} //namespace app
+} //namespace MagAOX
+
+#endif //pwfs_slopes_hpp
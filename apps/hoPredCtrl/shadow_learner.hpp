@@ -0,0 +1,274 @@
+/** \file shadow_learner.hpp
+  * \brief Learning of the predictive controller in the background, off the control path.
+  *
+  * \ingroup hoPredCtrl_files
+  */
+
+#ifndef RDDSC_SHADOW_HPP
+#define RDDSC_SHADOW_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+#include <semaphore.h>
+#include <time.h>
+
+#include "predictive_controller.hpp"
+#include "predictor_learner.hpp"
+
+namespace DDSPC
+{
+
+/// Statistics of a ShadowLearner, with the swap latencies since they were last reset.
+struct ShadowLearnerStats{
+	unsigned long long int backlog {0};	// The number of queued samples not yet learned.
+	unsigned long long int learned {0};	// The number of samples learned.
+	unsigned long long int dropped {0};	// The number of samples dropped because the queue was full.
+	unsigned long long int swaps {0};	// The number of controllers swapped in.
+	double mean_swap_latency {0};		// The mean time from publishing a controller to swapping it in, in microseconds.
+	double max_swap_latency {0};		// The maximum time from publishing a controller to swapping it in, in microseconds.
+};
+
+/// Learns a shadow copy of the predictive controller from queued samples, and swaps it into the live controller.
+/** The control path only queues the training sample of each step with push(), and swaps in a new controller with
+  * swap() when one is ready, so a learning step costs it a copy instead of the RLS update.  A worker thread calls
+  * work(), which learns the queued samples with its own PredictorLearner, and publishes a new controller every
+  * swap_interval samples, and when it runs out of samples.
+  *
+  * The queue is single-producer single-consumer and lock-free.  When it is full push() drops the sample rather
+  * than wait.  A published controller is swapped in between steps, under a mutex which the control path only tries,
+  * so the live controller is never partly updated and the control path never waits on the worker.
+  *
+  * push() and swap() are called from the control thread, work() from the worker thread, and the rest from any
+  * thread.
+  */
+class ShadowLearner{
+	private:
+		int m_num_modes;
+		int m_phi_size;		// The size of the features of a sample
+		int m_xf_size;		// The size of the future measurements of a sample
+
+		PredictorLearner m_learner;
+
+		// The sample queue
+		unsigned long long int m_queue_length;
+		std::vector<float> m_queue_phi;
+		std::vector<float> m_queue_xf;
+		std::atomic<unsigned long long int> m_head {0};	// The number of samples pushed, written by the control thread.
+		std::atomic<unsigned long long int> m_tail {0};	// The number of samples consumed, written by the worker.
+		std::atomic<unsigned long long int> m_dropped {0};
+		std::atomic<unsigned long long int> m_learned {0};
+		sem_t m_semaphore;	// Posted for each pushed sample.
+
+		int m_swap_interval;
+		int m_since_publish {0};	// The number of samples learned since the last publication.
+
+		std::atomic<float> m_lambda {0};
+		std::atomic<bool> m_reset_request {false};
+
+		// Controller publication
+		std::vector<float> m_controller_work;	// Computed by the worker.
+		std::vector<float> m_controller_ready;	// The last published controller.
+		std::atomic<bool> m_ready {false};
+		std::mutex m_swap_mutex;	// Protects m_controller_ready, m_publish_time, and the swap statistics.
+		timespec m_publish_time {0,0};
+
+		unsigned long long int m_swaps {0};
+		unsigned long long int m_latency_count {0};
+		double m_latency_sum {0};
+		double m_latency_max {0};
+
+	public:
+		ShadowLearner(int num_history, int num_future, int num_modes, float gamma, float P0, int queue_length, int swap_interval);
+		~ShadowLearner();
+
+		void set_swap_interval(int swap_interval){ m_swap_interval = swap_interval > 0 ? swap_interval : 1;};
+
+		void set_new_regularization(float new_lambda){ m_lambda = new_lambda;};
+
+		// Reset the shadow predictor, discarding queued samples and any unswapped controller
+		void reset();
+
+		// Queue the training sample of the current step of a controller
+		bool push(PredictiveController* pc);
+
+		// Swap the last published controller into a controller, if there is a new one and the worker isn't publishing
+		bool swap(PredictiveController* pc);
+
+		// Wait up to timeout seconds for samples, and learn them
+		int work(double timeout);
+
+		ShadowLearnerStats stats(bool reset_latency = false);
+
+	private:
+		void publish();
+};
+
+inline
+ShadowLearner::ShadowLearner(int num_history, int num_future, int num_modes, float gamma, float P0, int queue_length, int swap_interval) :
+	m_learner(num_history, num_future, num_modes, gamma, P0){
+	m_num_modes = num_modes;
+	m_phi_size = m_learner.num_features() * num_modes;
+	m_xf_size = num_future * num_modes;
+
+	m_queue_length = queue_length > 0 ? queue_length : 1;
+	m_queue_phi.resize(m_queue_length * m_phi_size);
+	m_queue_xf.resize(m_queue_length * m_xf_size);
+
+	set_swap_interval(swap_interval);
+
+	m_controller_work.assign(m_learner.num_past() * num_modes, 0);
+	m_controller_ready.assign(m_learner.num_past() * num_modes, 0);
+
+	sem_init(&m_semaphore, 0, 0);
+}
+
+inline
+ShadowLearner::~ShadowLearner(){
+	sem_destroy(&m_semaphore);
+}
+
+inline
+void ShadowLearner::reset(){
+	std::lock_guard<std::mutex> lock(m_swap_mutex);
+	m_reset_request = true;
+	m_ready = false;
+
+	// Wake the worker to do it
+	sem_post(&m_semaphore);
+}
+
+inline
+bool ShadowLearner::push(PredictiveController* pc){
+	unsigned long long int head = m_head.load(std::memory_order_relaxed);
+	if(head - m_tail.load(std::memory_order_acquire) >= m_queue_length){
+		++m_dropped;
+		return false;
+	}
+
+	unsigned long long int slot = head % m_queue_length;
+	pc->get_training_sample(&m_queue_phi[slot * m_phi_size], &m_queue_xf[slot * m_xf_size]);
+
+	m_head.store(head + 1, std::memory_order_release);
+	sem_post(&m_semaphore);
+
+	return true;
+}
+
+inline
+bool ShadowLearner::swap(PredictiveController* pc){
+	if(!m_ready.load(std::memory_order_acquire)) return false;
+
+	std::unique_lock<std::mutex> lock(m_swap_mutex, std::try_to_lock);
+	if(!lock.owns_lock() || !m_ready) return false;
+
+	pc->set_controller(m_controller_ready.data());
+	m_ready = false;
+
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double latency = (now.tv_sec - m_publish_time.tv_sec) * 1e6 + (now.tv_nsec - m_publish_time.tv_nsec) / 1e3;
+
+	++m_swaps;
+	++m_latency_count;
+	m_latency_sum += latency;
+	if(latency > m_latency_max) m_latency_max = latency;
+
+	return true;
+}
+
+inline
+int ShadowLearner::work(double timeout){
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += (time_t) timeout;
+	ts.tv_nsec += (long) ((timeout - floor(timeout)) * 1e9);
+	if(ts.tv_nsec >= 1000000000){
+		ts.tv_nsec -= 1000000000;
+		ts.tv_sec += 1;
+	}
+
+	bool idle = false;
+	if(sem_timedwait(&m_semaphore, &ts) != 0){
+		if(errno != ETIMEDOUT && errno != EINTR) return -1;
+		idle = true;
+	}
+
+	// Everything pushed so far is picked up below.
+	while(sem_trywait(&m_semaphore) == 0);
+
+	if(m_reset_request){
+		m_learner.reset();
+		m_tail.store(m_head.load(std::memory_order_acquire), std::memory_order_release);
+		m_since_publish = 0;
+		m_reset_request = false;
+		return 0;
+	}
+
+	unsigned long long int head = m_head.load(std::memory_order_acquire);
+	unsigned long long int tail = m_tail.load(std::memory_order_relaxed);
+
+	while(tail < head && !m_reset_request){
+		unsigned long long int slot = tail % m_queue_length;
+		m_learner.update_predictor(&m_queue_phi[slot * m_phi_size], &m_queue_xf[slot * m_xf_size]);
+
+		++tail;
+		m_tail.store(tail, std::memory_order_release);
+		++m_learned;
+
+		if(++m_since_publish >= m_swap_interval) publish();
+	}
+
+	// Don't leave learned samples unpublished when the samples stop
+	if(idle && m_since_publish > 0) publish();
+
+	return 0;
+}
+
+inline
+void ShadowLearner::publish(){
+	m_learner.set_new_regularization(m_lambda);
+	m_learner.update_controller(m_controller_work.data());
+	m_since_publish = 0;
+
+	std::lock_guard<std::mutex> lock(m_swap_mutex);
+
+	// A reset was requested while this was learned
+	if(m_reset_request) return;
+
+	m_controller_ready.swap(m_controller_work);
+	clock_gettime(CLOCK_MONOTONIC, &m_publish_time);
+	m_ready = true;
+}
+
+inline
+ShadowLearnerStats ShadowLearner::stats(bool reset_latency){
+	ShadowLearnerStats st;
+
+	unsigned long long int tail = m_tail.load(std::memory_order_acquire);
+	st.backlog = m_head.load(std::memory_order_acquire) - tail;
+	st.learned = m_learned;
+	st.dropped = m_dropped;
+
+	std::lock_guard<std::mutex> lock(m_swap_mutex);
+	st.swaps = m_swaps;
+	if(m_latency_count > 0){
+		st.mean_swap_latency = m_latency_sum / m_latency_count;
+		st.max_swap_latency = m_latency_max;
+	}
+
+	if(reset_latency){
+		m_latency_count = 0;
+		m_latency_sum = 0;
+		m_latency_max = 0;
+	}
+
+	return st;
+}
+
+}
+
+#endif
@@ -0,0 +1,481 @@
+/** \file predictiveController_test.cpp
+  * \brief Catch2 tests for the predictive controller in the hoPredCtrl app.
+  *
+  * These use only the interface shared by the backends, so they test whichever backend predictive_controller.hpp
+  * selects.
+  *
+  * History:
+  */
+#include "../../../tests/catch2/catch.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "../predictive_controller.hpp"
+#include "../shadow_learner.hpp"
+
+namespace predictiveController_test
+{
+
+/// A direct implementation of the predictive controller for one mode, in double precision.
+/** This follows the CUDA kernels step by step, including the full inverse of H11.
+  */
+struct refMode
+{
+   int nh, nf, nfeat, npast;
+   double gamma, P0, lambda {0};
+
+   std::vector<double> meas, cmd; //indexed by step
+   std::vector<double> phi, xf, wp;
+   std::vector<std::vector<double>> A, P;
+   std::vector<double> ctrl;
+   double command {0};
+
+   refMode(int nhist, int nfut, double g, double p0) : nh{nhist}, nf{nfut}, gamma{g}, P0{p0}
+   {
+      nfeat = nf - 1 + 2*nh;
+      npast = nfeat - nf;
+      phi.assign(nfeat, 0);
+      xf.assign(nf, 0);
+      wp.assign(npast, 0);
+      A.assign(nf, std::vector<double>(nfeat, 0));
+      P.assign(nfeat, std::vector<double>(nfeat, 0));
+      for(int i = 0; i < nfeat; ++i) P[i][i] = P0;
+      ctrl.assign(npast, 0);
+   }
+
+   double getMeas(long t) { return t < 0 ? 0 : meas[t]; }
+   double getCmd(long t) { return t < 0 ? 0 : cmd[t]; }
+
+   void add(double y)
+   {
+      meas.push_back(y);
+      long t = meas.size() - 1;
+
+      for(int i = 0; i < nf - 1 + nh; ++i) phi[i] = getCmd(t - 1 - i);
+      for(int i = 0; i < nh; ++i) phi[nf - 1 + nh + i] = getMeas(t - nf - i);
+      for(int i = 0; i < nf; ++i) xf[i] = getMeas(t - i);
+      for(int i = 0; i < nh - 1; ++i) wp[i] = getCmd(t - 1 - i);
+      for(int i = 0; i < nh; ++i) wp[nh - 1 + i] = getMeas(t - i);
+   }
+
+   void updatePredictor()
+   {
+      std::vector<double> xtP(nfeat, 0), K(nfeat), err(nf);
+      for(int j = 0; j < nfeat; ++j) for(int i = 0; i < nfeat; ++i) xtP[j] += phi[i]*P[i][j];
+
+      double cn = gamma;
+      for(int i = 0; i < nfeat; ++i) cn += xtP[i]*phi[i];
+      for(int i = 0; i < nfeat; ++i) K[i] = xtP[i]/cn;
+
+      for(int r = 0; r < nf; ++r)
+      {
+         err[r] = xf[r];
+         for(int i = 0; i < nfeat; ++i) err[r] -= A[r][i]*phi[i];
+      }
+
+      for(int r = 0; r < nf; ++r) for(int i = 0; i < nfeat; ++i) A[r][i] += err[r]*K[i];
+      for(int i = 0; i < nfeat; ++i) for(int j = 0; j < nfeat; ++j) P[i][j] = (P[i][j] - xtP[i]*K[j])/gamma;
+   }
+
+   void updateController()
+   {
+      //H11 = B^T B + lambda I, H12 = B^T As
+      std::vector<std::vector<double>> H11(nf, std::vector<double>(2*nf, 0)), H12(nf, std::vector<double>(npast, 0));
+      for(int i = 0; i < nf; ++i)
+      {
+         for(int j = 0; j < nf; ++j) for(int r = 0; r < nf; ++r) H11[i][j] += A[r][i]*A[r][j];
+         H11[i][i] += lambda;
+         H11[i][nf + i] = 1;
+
+         for(int j = 0; j < npast; ++j) for(int r = 0; r < nf; ++r) H12[i][j] += A[r][i]*A[r][nf + j];
+      }
+
+      //Gauss-Jordan inverse, H11 is positive definite so no pivoting is needed
+      for(int c = 0; c < nf; ++c)
+      {
+         double p = H11[c][c];
+         for(int j = 0; j < 2*nf; ++j) H11[c][j] /= p;
+         for(int r = 0; r < nf; ++r)
+         {
+            if(r == c) continue;
+            double f = H11[r][c];
+            for(int j = 0; j < 2*nf; ++j) H11[r][j] -= f*H11[c][j];
+         }
+      }
+
+      for(int j = 0; j < npast; ++j)
+      {
+         ctrl[j] = 0;
+         for(int k = 0; k < nf; ++k) ctrl[j] -= H11[nf - 1][nf + k]*H12[k][j];
+      }
+   }
+
+   double getCommand( double clip,
+                      double explore
+                    )
+   {
+      double delta = explore;
+      for(int j = 0; j < npast; ++j) delta += ctrl[j]*wp[j];
+
+      if(delta < -clip) delta = -clip;
+      if(delta > clip) delta = clip;
+
+      cmd.push_back(delta);
+      command += delta;
+      return command;
+   }
+};
+
+/// Run a controller and the direct implementation on the same closed loop, and get the largest difference in the commands.
+/** The controller is learned in the control path, or by a ShadowLearner swapping in a controller after every sample.
+  */
+double compareWithDirect( double & maxCmd,   ///< [out] the largest command delta after the exploration
+                          bool useShadow     ///< [in] whether to learn with a ShadowLearner
+                        )
+{
+   int nhist = 3;
+   int nfut = 2;
+   int nmodes = 7;
+   int nmeas = 11;
+   float gamma = 0.995;
+   float P0 = 1;
+   float lambda = 0.01;
+   float clip = 0.5;
+   float rms = 0.1;
+   int nexplore = 100;
+
+   std::mt19937 gen(1234);
+   std::normal_distribution<float> norm(0, 1);
+
+   //Column-major modes x measurements
+   Eigen::MatrixXf im(nmodes, nmeas);
+   for(int k = 0; k < im.size(); ++k) im.data()[k] = norm(gen);
+
+   //The measurements of the commands, so each mode measures its own command
+   Eigen::MatrixXf resp = im.transpose() * (im * im.transpose()).inverse();
+
+   DDSPC::PredictiveController pc(nhist, nfut, nmodes, nmeas, gamma, lambda, P0);
+   pc.set_interaction_matrix(im.data());
+   pc.set_new_regularization(lambda);
+   pc.create_exploration_buffer(rms, nexplore);
+
+   DDSPC::ShadowLearner shadow(nhist, nfut, nmodes, gamma, P0, 4, 1);
+   shadow.set_new_regularization(lambda);
+
+   std::vector<refMode> ref(nmodes, refMode(nhist, nfut, gamma, P0));
+   for(auto & r : ref) r.lambda = lambda;
+
+   //The disturbance is a sinusoid in each measurement plus noise
+   Eigen::VectorXf wfs(nmeas);
+   Eigen::VectorXf cmdv = Eigen::VectorXf::Zero(nmodes);
+
+   double maxErr = 0;
+   maxCmd = 0;
+
+   for(int t = 0; t < 300; ++t)
+   {
+      for(int k = 0; k < nmeas; ++k) wfs[k] = 0.3*sin(0.7*t + k) + 0.05*norm(gen);
+      wfs += resp*cmdv;
+
+      pc.add_measurement(wfs.data());
+      if(useShadow)
+      {
+         shadow.push(&pc);
+         shadow.work(0);
+         if(t >= nexplore) shadow.swap(&pc);
+      }
+      else
+      {
+         pc.update_predictor();
+         if(t >= nexplore) pc.update_controller();
+      }
+      float * cmd = pc.get_command(clip);
+
+      Eigen::VectorXf y = im*wfs;
+      for(int m = 0; m < nmodes; ++m)
+      {
+         //The exploration signal is random, but its sign can be read from the command
+         double explore = 0;
+         if(t < nexplore) explore = (cmd[m] > cmdv[m]) ? rms : -rms;
+
+         ref[m].add(y[m]);
+         ref[m].updatePredictor();
+         if(t >= nexplore) ref[m].updateController();
+         double command = ref[m].getCommand(clip, explore);
+
+         if(!std::isfinite(cmd[m])) return std::numeric_limits<double>::infinity();
+         maxErr = std::max(maxErr, std::fabs(cmd[m] - command));
+         if(t >= nexplore) maxCmd = std::max(maxCmd, std::fabs(ref[m].cmd.back()));
+
+         cmdv[m] = cmd[m];
+      }
+   }
+
+   return maxErr;
+}
+
+SCENARIO( "The predictive controller matches a direct implementation", "[hoPredCtrl::predictiveController]" )
+{
+   GIVEN("7 modes, 11 measurements, 3 steps of history and 2 of future")
+   {
+      WHEN("exploring, then learning the controller on every step")
+      {
+         double maxCmd;
+         double maxErr = compareWithDirect(maxCmd, false);
+
+         THEN("the commands agree to within the float round off")
+         {
+            REQUIRE(maxErr < 1e-3);
+
+            //And the controller isn't trivially zero
+            REQUIRE(maxCmd > 0.01);
+         }
+      }
+      WHEN("learning with a shadow learner which swaps after every sample")
+      {
+         double maxCmd;
+         double maxErr = compareWithDirect(maxCmd, true);
+
+         THEN("the commands agree to within the float round off")
+         {
+            REQUIRE(maxErr < 1e-3);
+            REQUIRE(maxCmd > 0.01);
+         }
+      }
+   }
+}
+
+SCENARIO( "Exploring with a random binary signal", "[hoPredCtrl::predictiveController]" )
+{
+   GIVEN("3 modes and an untrained controller")
+   {
+      int nmodes = 3;
+      std::vector<float> im(nmodes, 1);
+      std::vector<float> wfs(1, 0);
+
+      DDSPC::PredictiveController pc(2, 2, nmodes, 1, 0.99, 0, 10);
+      pc.set_interaction_matrix(im.data());
+
+      WHEN("exploring for 5 steps")
+      {
+         pc.create_exploration_buffer(0.01, 5);
+
+         std::vector<float> prev(nmodes, 0);
+         for(int t = 0; t < 8; ++t)
+         {
+            pc.add_measurement(wfs.data());
+            float * cmd = pc.get_command(1.0);
+
+            for(int m = 0; m < nmodes; ++m)
+            {
+               if(t < 5) REQUIRE(std::fabs(std::fabs(cmd[m] - prev[m]) - 0.01) < 1e-6);
+               else REQUIRE(cmd[m] == prev[m]);
+               prev[m] = cmd[m];
+            }
+         }
+      }
+      WHEN("the exploration is larger than the clip")
+      {
+         pc.create_exploration_buffer(0.01, 5);
+
+         pc.add_measurement(wfs.data());
+         float * cmd = pc.get_command(0.004);
+
+         for(int m = 0; m < nmodes; ++m) REQUIRE(std::fabs(std::fabs(cmd[m]) - 0.004) < 1e-7);
+
+         THEN("set_zero zeros the command")
+         {
+            pc.set_zero();
+            pc.add_measurement(wfs.data());
+            cmd = pc.get_command(0.004);
+            for(int m = 0; m < nmodes; ++m) REQUIRE(std::fabs(std::fabs(cmd[m]) - 0.004) < 1e-7);
+         }
+      }
+   }
+}
+
+SCENARIO( "Learning to reject a predictable disturbance", "[hoPredCtrl::predictiveController]" )
+{
+   GIVEN("a single mode with a sinusoidal disturbance, measured after the DM")
+   {
+      DDSPC::PredictiveController pc(5, 2, 1, 1, 0.999, 0, 100);
+      float one = 1;
+      pc.set_interaction_matrix(&one);
+      pc.set_new_regularization(1e-3);
+      pc.create_exploration_buffer(0.05, 200);
+
+      WHEN("the loop runs with learning")
+      {
+         float command = 0;
+         double rmsDist = 0;
+         double rmsRes = 0;
+         int n = 0;
+
+         for(int t = 0; t < 1000; ++t)
+         {
+            float d = sin(2*3.14159265358979*t/13.);
+            float y = d + command;
+
+            pc.add_measurement(&y);
+            pc.update_predictor();
+            pc.update_controller();
+            command = pc.get_command(1.0)[0];
+
+            if(t >= 800)
+            {
+               rmsDist += d*d;
+               rmsRes += y*y;
+               ++n;
+            }
+         }
+
+         rmsDist = sqrt(rmsDist/n);
+         rmsRes = sqrt(rmsRes/n);
+
+         THEN("the residual is much smaller than the disturbance")
+         {
+            REQUIRE(rmsRes < 0.1*rmsDist);
+         }
+      }
+   }
+}
+
+SCENARIO( "Queueing samples for a shadow learner", "[hoPredCtrl::shadowLearner]" )
+{
+   GIVEN("3 modes and a shadow learner with a queue of 4 which swaps every 10 samples")
+   {
+      int nmodes = 3;
+      std::vector<float> im(nmodes, 1);
+      std::vector<float> wfs(1, 0.1);
+
+      DDSPC::PredictiveController pc(2, 2, nmodes, 1, 0.99, 0, 10);
+      pc.set_interaction_matrix(im.data());
+
+      DDSPC::ShadowLearner shadow(2, 2, nmodes, 0.99, 10, 4, 10);
+
+      WHEN("6 samples are pushed before the worker runs")
+      {
+         for(int n = 0; n < 6; ++n)
+         {
+            pc.add_measurement(wfs.data());
+            bool queued = shadow.push(&pc);
+            REQUIRE(queued == (n < 4));
+            pc.get_command(1.0);
+         }
+
+         DDSPC::ShadowLearnerStats st = shadow.stats();
+         REQUIRE(st.backlog == 4);
+         REQUIRE(st.dropped == 2);
+
+         THEN("the worker learns the queued samples, and publishes when it runs out")
+         {
+            REQUIRE(shadow.work(0) == 0);
+            st = shadow.stats();
+            REQUIRE(st.backlog == 0);
+            REQUIRE(st.learned == 4);
+
+            //Fewer than 10 samples, so nothing to swap yet
+            REQUIRE(shadow.swap(&pc) == false);
+
+            //Idle, so the 4 samples are published
+            REQUIRE(shadow.work(0) == 0);
+            REQUIRE(shadow.swap(&pc) == true);
+            REQUIRE(shadow.swap(&pc) == false);
+
+            st = shadow.stats(true);
+            REQUIRE(st.swaps == 1);
+            REQUIRE(st.mean_swap_latency >= 0);
+            REQUIRE(st.max_swap_latency >= st.mean_swap_latency);
+
+            st = shadow.stats();
+            REQUIRE(st.mean_swap_latency == 0);
+         }
+      }
+      WHEN("the shadow learner is reset with a controller published and samples queued")
+      {
+         shadow.set_swap_interval(1);
+         for(int n = 0; n < 3; ++n)
+         {
+            pc.add_measurement(wfs.data());
+            shadow.push(&pc);
+            pc.get_command(1.0);
+         }
+         shadow.work(0);
+
+         pc.add_measurement(wfs.data());
+         shadow.push(&pc);
+
+         shadow.reset();
+
+         THEN("the published controller and the queue are discarded")
+         {
+            REQUIRE(shadow.swap(&pc) == false);
+
+            shadow.work(0);
+            DDSPC::ShadowLearnerStats st = shadow.stats();
+            REQUIRE(st.backlog == 0);
+            REQUIRE(st.learned == 3);
+            REQUIRE(shadow.swap(&pc) == false);
+         }
+      }
+   }
+}
+
+SCENARIO( "Learning in a worker thread", "[hoPredCtrl::shadowLearner]" )
+{
+   GIVEN("a single mode loop with a shadow learner in a worker thread")
+   {
+      DDSPC::PredictiveController pc(5, 2, 1, 1, 0.999, 0, 100);
+      float one = 1;
+      pc.set_interaction_matrix(&one);
+      pc.set_new_regularization(1e-3);
+      pc.create_exploration_buffer(0.05, 200);
+
+      DDSPC::ShadowLearner shadow(5, 2, 1, 0.999, 100, 16, 5);
+      shadow.set_new_regularization(1e-3);
+
+      std::atomic<bool> stop {false};
+      std::thread worker([&shadow, &stop]() { while(!stop) shadow.work(0.01); });
+
+      WHEN("the loop runs for 1000 steps")
+      {
+         float command = 0;
+         int pushed = 0;
+         int swapped = 0;
+
+         for(int t = 0; t < 1000; ++t)
+         {
+            float y = sin(2*3.14159265358979*t/13.) + command;
+
+            pc.add_measurement(&y);
+            if(shadow.push(&pc)) ++pushed;
+            if(shadow.swap(&pc)) ++swapped;
+            command = pc.get_command(1.0)[0];
+
+            //Give the worker time, like a loop waiting for the next frame
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+         }
+
+         stop = true;
+         worker.join();
+
+         THEN("every pushed sample is learned or still queued, and controllers were swapped in")
+         {
+            DDSPC::ShadowLearnerStats st = shadow.stats();
+            REQUIRE(st.learned + st.backlog == (unsigned long long) pushed);
+            REQUIRE(st.dropped + pushed == 1000);
+            REQUIRE(st.swaps == (unsigned long long) swapped);
+            REQUIRE(swapped > 0);
+         }
+      }
+   }
+}
+
+} //namespace predictiveController_test
@@ -0,0 +1,131 @@
+/** \file pwfsSlopes_test.cpp
+  * \brief Catch2 tests for the pyramid WFS measurement extraction in the hoPredCtrl app.
+  *
+  * History:
+  */
+#include "../../../tests/catch2/catch.hpp"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "../pwfs_slopes.hpp"
+
+namespace pwfsSlopes_test
+{
+
+SCENARIO( "Extracting the PWFS measurement vector", "[hoPredCtrl::pwfsSlopes]" )
+{
+   GIVEN("a 120x120 image with a random 60x60 pupil mask and dark")
+   {
+      size_t W = 120, H = 120, qW = W/2, qH = H/2;
+
+      std::mt19937 gen(4321);
+      std::uniform_real_distribution<float> uni(0, 1);
+
+      std::vector<float> mask(qW*qH);
+      for(auto & m : mask) m = (uni(gen) > 0.3) ? 1 : 0;
+
+      std::vector<unsigned short> image(W*H);
+      for(auto & p : image) p = 1000 + 5000*uni(gen);
+
+      std::vector<float> dark(W*H);
+      for(auto & d : dark) d = 100*uni(gen);
+
+      MagAOX::app::pwfsSlopes<float> slopes;
+      REQUIRE(slopes.setup(mask.data(), qW, qH, W, H) == 0);
+
+      size_t nIllum = 0;
+      for(auto & m : mask) if(m > 0.5) ++nIllum;
+
+      REQUIRE(slopes.illuminated() == nIllum);
+      REQUIRE(slopes.size() == 3*nIllum);
+
+      WHEN("the measurement vector is extracted")
+      {
+         std::vector<float> meas(slopes.size());
+         slopes.extract(meas.data(), image.data(), dark.data());
+
+         THEN("it matches the per-pixel loop")
+         {
+            //The loop hoPredCtrl::processImage used before the pixel lists
+            auto pix = [&](size_t r, size_t c) { return (float) image[c*W + r] - dark[c*W + r]; };
+
+            std::vector<float> ref(3*nIllum);
+            size_t ki = 0;
+            for(size_t col_i = 0; col_i < qW; ++col_i)
+            {
+               for(size_t row_i = 0; row_i < qH; ++row_i)
+               {
+                  float Ic = pix(row_i, col_i);
+                  float Id = pix(row_i + qW, col_i);
+                  float Ia = pix(row_i, col_i + qH);
+                  float Ib = pix(row_i + qW, col_i + qH);
+                  float pwfsNorm = Ia + Ib + Ic + Id;
+
+                  if(mask[col_i*qH + row_i] > 0.5)
+                  {
+                     ref[ki] = (Ia - Ib + Ic - Id) / pwfsNorm;
+                     ref[ki + nIllum] = (Ia + Ib - Ic - Id) / pwfsNorm;
+                     ref[ki + 2*nIllum] = (Ia - Ib - Ic + Id) / pwfsNorm;
+                     ++ki;
+                  }
+               }
+            }
+
+            float maxErr = 0;
+            for(size_t k = 0; k < ref.size(); ++k) maxErr = std::max(maxErr, std::fabs(meas[k] - ref[k]));
+
+            REQUIRE(maxErr < 1e-6);
+         }
+      }
+   }
+
+   GIVEN("a non-square image with a single illuminated pixel")
+   {
+      size_t rows = 8, cols = 12;
+
+      std::vector<float> mask(4*6, 0);
+      mask[2*4 + 1] = 1; //row 1, column 2
+
+      //Quadrant c is 1, d is 2, a is 3, and b is 4
+      std::vector<unsigned short> image(rows*cols);
+      for(size_t c = 0; c < cols; ++c)
+      {
+         for(size_t r = 0; r < rows; ++r) image[c*rows + r] = 1 + (r >= rows/2) + 2*(c >= cols/2);
+      }
+      std::vector<float> dark(rows*cols, 0);
+
+      MagAOX::app::pwfsSlopes<float> slopes;
+      REQUIRE(slopes.setup(mask.data(), 4, 6, rows, cols) == 0);
+      REQUIRE(slopes.pixels().size() == 1);
+      REQUIRE(slopes.pixels()[0] == 2*rows + 1);
+
+      WHEN("the measurement vector is extracted")
+      {
+         std::vector<float> meas(3);
+         slopes.extract(meas.data(), image.data(), dark.data());
+
+         THEN("each quadrant is read from its own quarter of the image")
+         {
+            REQUIRE(meas[0] == Approx((3. - 4 + 1 - 2)/10));
+            REQUIRE(meas[1] == Approx((3. + 4 - 1 - 2)/10));
+            REQUIRE(meas[2] == Approx((3. - 4 - 1 + 2)/10));
+         }
+      }
+   }
+
+   GIVEN("a mask larger than a quadrant")
+   {
+      std::vector<float> mask(5*5, 1);
+      MagAOX::app::pwfsSlopes<float> slopes;
+
+      THEN("setup fails")
+      {
+         REQUIRE(slopes.setup(mask.data(), 5, 5, 8, 8) == -1);
+         REQUIRE(slopes.size() == 0);
+      }
+   }
+}
+
+} //namespace pwfsSlopes_test
@@ -0,0 +1,16 @@
+/** \file mockDMCtrl.cpp
+  * \brief The MagAO-X mock DM controller main program source file.
+  *
+  * \ingroup mockDMCtrl_files
+  */
+
+#include "mockDMCtrl.hpp"
+
+
+int main(int argc, char **argv)
+{
+   MagAOX::app::mockDMCtrl xapp;
+
+   return xapp.main(argc, argv);
+
+}
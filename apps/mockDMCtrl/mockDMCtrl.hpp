@@ -0,0 +1,542 @@
+/** \file mockDMCtrl.hpp
+  * \brief The MagAO-X mock DM controller header file
+  *
+  * \ingroup mockDMCtrl_files
+  */
+
+#ifndef mockDMCtrl_hpp
+#define mockDMCtrl_hpp
+
+
+#include "../../libMagAOX/libMagAOX.hpp" //Note this is included on command line to trigger pch
+#include "../../magaox_git_version.h"
+
+#include <random>
+
+#include "mockDMTrace.hpp"
+
+/** \defgroup mockDMCtrl
+  * \brief A DM controller with no hardware, for measuring the dev::dm command path.
+  *
+  * commandDM converts the shape with the same actuatorMap as bmcCtrl or alpaoCtrl, records saturation, and then
+  * busy-waits for a configurable time in place of the SDK call.  The timing of each command is written to a
+  * trace stream which utils/dmCommandBench reads.
+  *
+  * It is built on RTC but not installed, so it is run from apps/mockDMCtrl.
+  *
+  * <a href="..//apps_html/page_module_mockDMCtrl.html">Application Documentation</a>
+  *
+  * \ingroup apps
+  *
+  */
+
+/** \defgroup mockDMCtrl_files
+  * \ingroup mockDMCtrl
+  */
+
+namespace MagAOX
+{
+namespace app
+{
+
+/// The MagAO-X mock DM Controller
+/**
+  * \ingroup mockDMCtrl
+  */
+class mockDMCtrl : public MagAOXApp<true>, public dev::dm<mockDMCtrl,float>, public dev::shmimMonitor<mockDMCtrl>
+{
+
+   //Give the test harness access.
+   friend class mockDMCtrl_test;
+
+   friend class dev::dm<mockDMCtrl,float>;
+
+   friend class dev::shmimMonitor<mockDMCtrl>;
+
+   typedef float realT;  ///< This defines the datatype used to signal the DM using the ImageStreamIO library.
+
+protected:
+
+   /** \name Configurable Parameters
+     *@{
+     */
+
+   std::string m_family {"bmc"}; ///< The DM family whose conversion is used, bmc or alpao.
+
+   double m_callTime {0}; ///< The time to busy-wait in place of the SDK call, in microseconds.
+
+   double m_callJitter {0}; ///< The maximum random time added to each SDK call, in microseconds.
+
+   double m_scale {1}; ///< The factor converting the shape to the command, before clipping.
+
+   std::string m_traceName; ///< The name of the trace stream.  Default is shmimName with _trace appended.
+
+   uint32_t m_traceLength {65536}; ///< The number of entries in the trace stream's circular buffer.
+
+   ///@}
+
+   dev::actuatorMap<dev::bmcActuators, realT, double> m_bmcMap; ///< The conversion for the bmc family.
+
+   dev::actuatorMap<dev::alpaoActuators, realT, double> m_alpaoMap; ///< The conversion for the alpao family.
+
+   std::vector<double> m_dminputs; ///< The command vector, used only in commandDM
+
+   bool m_dmopen {false}; ///< Whether the mock DM is initialized
+
+   std::mt19937_64 m_gen; ///< Generates the SDK call jitter.
+
+   std::uniform_real_distribution<double> m_jitter; ///< The SDK call jitter distribution.
+
+   /** \name Command Accounting
+     * Written by commandDM only.
+     *@{
+     */
+
+   IMAGE m_traceStream; ///< The trace stream.
+   bool m_traceOpen {false}; ///< Whether the trace stream is created.
+
+   uint64_t m_lastCnt0 {0}; ///< The cnt0 of the last command sent.
+   bool m_firstCommand {true}; ///< True until the first command is sent.
+
+   std::atomic<uint64_t> m_commands {0}; ///< The number of commands sent.
+   std::atomic<uint64_t> m_dropped {0}; ///< The number of commands overwritten before they were sent.
+   std::atomic<uint64_t> m_repeated {0}; ///< The number of commands sent more than once.
+
+   ///@}
+
+public:
+   /// Default c'tor.
+   mockDMCtrl();
+
+   /// D'tor.
+   ~mockDMCtrl() noexcept;
+
+   /// Setup the configuration system.
+   virtual void setupConfig();
+
+   /// Implementation of loadConfig logic, separated for testing.
+   /** This is called by loadConfig().
+     */
+   int loadConfigImpl( mx::app::appConfigurator & _config /**< [in] an application configuration from which to load values*/);
+
+   /// Load the configuration
+   virtual void loadConfig();
+
+   /// Startup function
+   /** Sets up INDI, and starts the shmim thread.
+     *
+     */
+   virtual int appStartup();
+
+   /// Implementation of the FSM for mockDMCtrl.
+   /**
+     * \returns 0 on no critical error
+     * \returns -1 on an error requiring shutdown
+     */
+   virtual int appLogic();
+
+   /// Shutdown the app.
+   /**
+     *
+     */
+   virtual int appShutdown();
+
+   /// Cleanup after a power off.
+   /**
+     */
+   virtual int onPowerOff();
+
+   /// Maintenace while powered off.
+   /**
+     */
+   virtual int whilePowerOff();
+
+   /** \name DM Base Class Interface
+     *
+     *@{
+     */
+
+   /// Initialize the mock DM and prepare for operation.
+   /** Application is in state OPERATING upon successful conclusion.
+     *
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int initDM();
+
+   /// Zero all commands on the DM
+   /** This does not update the shared memory buffer.
+     *
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int zeroDM();
+
+   /// Send a command to the mock DM
+   /** This is called by the shmim monitoring thread in response to a semaphore trigger.
+     *
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int commandDM(void * curr_src);
+
+   /// Release the DM, making it safe to turn off power.
+   /** The application will be state READY at the conclusion of this.
+     *
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int releaseDM();
+
+   ///@}
+
+protected:
+
+   /// Busy-wait in place of the SDK call.
+   /**
+     * \returns the time spent, in microseconds
+     */
+   double sdkCall();
+
+   /// Write an entry to the trace stream.
+   void writeTrace( uint64_t cnt0,     ///< [in] the cnt0 of the command
+                    double latency,    ///< [in] the time from writetime to the start of commandDM, in microseconds
+                    double convert,    ///< [in] the time to convert and record saturation, in microseconds
+                    double sdk         ///< [in] the time in the SDK call, in microseconds
+                  );
+
+   /** \name INDI
+     *@{
+     */
+
+   pcf::IndiProperty m_indiP_commands; ///< The command counts.
+
+   ///@}
+};
+
+/// Get the difference of two times in microseconds.
+inline
+double mockDMElapsed( const timespec & t0,
+                      const timespec & t1
+                    )
+{
+   return (t1.tv_sec - t0.tv_sec)*1e6 + (t1.tv_nsec - t0.tv_nsec)/1e3;
+}
+
+mockDMCtrl::mockDMCtrl() : MagAOXApp(MAGAOX_CURRENT_SHA1, MAGAOX_REPO_MODIFIED)
+{
+   m_powerMgtEnabled = false;
+   return;
+}
+
+mockDMCtrl::~mockDMCtrl() noexcept
+{
+}
+
+void mockDMCtrl::setupConfig()
+{
+   config.add("dm.calibRelDir", "", "dm.calibRelDir", argType::Required, "dm", "calibRelDir", false, "string", "Used to find the default config directory.");
+
+   config.add("mock.family", "", "mock.family", argType::Required, "mock", "family", false, "string", "The DM family whose command conversion is used, bmc or alpao.  Default is bmc.");
+   config.add("mock.callTime", "", "mock.callTime", argType::Required, "mock", "callTime", false, "double", "The time to busy-wait in place of the SDK call, in microseconds.  Default is 0.");
+   config.add("mock.callJitter", "", "mock.callJitter", argType::Required, "mock", "callJitter", false, "double", "The maximum random time added to each SDK call, in microseconds.  Default is 0.");
+   config.add("mock.scale", "", "mock.scale", argType::Required, "mock", "scale", false, "double", "The factor converting the shape to the command, before clipping.  Default is 1.");
+   config.add("mock.trace", "", "mock.trace", argType::Required, "mock", "trace", false, "string", "The name of the trace stream.  Default is shmimName with _trace appended.");
+   config.add("mock.traceLength", "", "mock.traceLength", argType::Required, "mock", "traceLength", false, "int", "The number of entries in the trace stream's circular buffer.  Default is 65536.");
+
+   dev::dm<mockDMCtrl,float>::setupConfig(config);
+}
+
+int mockDMCtrl::loadConfigImpl( mx::app::appConfigurator & _config )
+{
+   m_calibRelDir = "dm/mock";
+   _config(m_calibRelDir, "dm.calibRelDir");
+
+   _config(m_family, "mock.family");
+   _config(m_callTime, "mock.callTime");
+   _config(m_callJitter, "mock.callJitter");
+   _config(m_scale, "mock.scale");
+   _config(m_traceLength, "mock.traceLength");
+
+   dev::dm<mockDMCtrl,float>::loadConfig(_config);
+
+   m_traceName = m_shmimName + "_trace";
+   _config(m_traceName, "mock.trace");
+
+   return 0;
+}
+
+void mockDMCtrl::loadConfig()
+{
+   loadConfigImpl(config);
+}
+
+int mockDMCtrl::appStartup()
+{
+   if(m_family != "bmc" && m_family != "alpao")
+   {
+      log<software_critical>({__FILE__,__LINE__, "mock.family must be bmc or alpao"});
+      return -1;
+   }
+
+   if(m_traceLength < 1)
+   {
+      log<software_critical>({__FILE__,__LINE__, "mock.traceLength must be positive"});
+      return -1;
+   }
+
+   createROIndiNumber( m_indiP_commands, "commands", "Commands", "Mock DM");
+   indi::addNumberElement<uint64_t>( m_indiP_commands, "sent", 0, std::numeric_limits<uint64_t>::max(), 1, "%lu", "Sent");
+   indi::addNumberElement<uint64_t>( m_indiP_commands, "dropped", 0, std::numeric_limits<uint64_t>::max(), 1, "%lu", "Dropped");
+   indi::addNumberElement<uint64_t>( m_indiP_commands, "repeated", 0, std::numeric_limits<uint64_t>::max(), 1, "%lu", "Repeated");
+   registerIndiPropertyReadOnly(m_indiP_commands);
+
+   dev::dm<mockDMCtrl,float>::appStartup();
+   shmimMonitor<mockDMCtrl>::appStartup();
+
+   return initDM();
+}
+
+int mockDMCtrl::appLogic()
+{
+   dev::dm<mockDMCtrl,float>::appLogic();
+   shmimMonitor<mockDMCtrl>::appLogic();
+
+   std::unique_lock<std::mutex> lock(m_indiMutex);
+
+   updateIfChanged(m_indiP_commands, std::vector<std::string>({"sent", "dropped", "repeated"}), std::vector<uint64_t>({m_commands, m_dropped, m_repeated}));
+
+   return 0;
+}
+
+int mockDMCtrl::appShutdown()
+{
+   if(m_dmopen) releaseDM();
+
+   dev::dm<mockDMCtrl,float>::appShutdown();
+   shmimMonitor<mockDMCtrl>::appShutdown();
+
+   if(m_traceOpen)
+   {
+      ImageStreamIO_destroyIm(&m_traceStream);
+      m_traceOpen = false;
+   }
+
+   return 0;
+}
+
+int mockDMCtrl::onPowerOff()
+{
+   return dm<mockDMCtrl,float>::onPowerOff();
+}
+
+int mockDMCtrl::whilePowerOff()
+{
+   return dm<mockDMCtrl,float>::whilePowerOff();
+}
+
+int mockDMCtrl::initDM()
+{
+   if(m_dmopen)
+   {
+      log<text_log>("DM is already initialized.  Release first.", logPrio::LOG_ERROR);
+      return -1;
+   }
+
+   uint32_t nbAct = m_dmWidth*m_dmHeight;
+
+   if(nbAct == 0)
+   {
+      log<text_log>("DM initialization failed.  dm.width and dm.height must be set.", logPrio::LOG_ERROR);
+      return -1;
+   }
+
+   //Every pixel is an actuator, in order.
+   std::vector<int> mapping(nbAct);
+   for(uint32_t n = 0; n < nbAct; ++n) mapping[n] = n;
+
+   int rv;
+   if(m_family == "alpao") rv = m_alpaoMap.setup(mapping.data(), nbAct, nbAct, m_scale);
+   else rv = m_bmcMap.setup(mapping.data(), nbAct, nbAct, m_scale);
+
+   if(rv < 0)
+   {
+      log<text_log>("DM initialization failed.  Error setting up the actuator map.", logPrio::LOG_ERROR);
+      return -1;
+   }
+
+   m_dminputs.assign(nbAct, 0);
+
+   if(!m_traceOpen)
+   {
+      uint32_t imsize[3] = {mockDMTraceFields, 1, m_traceLength};
+      if(ImageStreamIO_createIm_gpu(&m_traceStream, m_traceName.c_str(), 3, imsize, IMAGESTRUCT_DOUBLE, -1, 1, IMAGE_NB_SEMAPHORE, 0, CIRCULAR_BUFFER | ZAXIS_TEMPORAL) != 0)
+      {
+         log<text_log>("DM initialization failed.  Could not create the trace stream " + m_traceName, logPrio::LOG_ERROR);
+         return -1;
+      }
+      m_traceStream.md->cnt0 = 0;
+      m_traceStream.md->cnt1 = 0;
+      m_traceOpen = true;
+   }
+
+   m_jitter = std::uniform_real_distribution<double>(0, m_callJitter);
+
+   m_firstCommand = true;
+   m_dmopen = true;
+
+   log<text_log>("mock " + m_family + " DM with " + std::to_string(nbAct) + " actuators initialized", logPrio::LOG_NOTICE);
+
+   state(stateCodes::OPERATING);
+
+   return 0;
+}
+
+int mockDMCtrl::zeroDM()
+{
+   if(!m_dmopen)
+   {
+      log<text_log>("DM not initialized", logPrio::LOG_ERROR);
+      return -1;
+   }
+
+   for(size_t n = 0; n < m_dminputs.size(); ++n) m_dminputs[n] = 0;
+   sdkCall();
+
+   log<text_log>("DM zeroed");
+   return 0;
+}
+
+int mockDMCtrl::commandDM(void * curr_src)
+{
+   timespec t0, t1;
+   clock_gettime(CLOCK_REALTIME, &t0);
+
+   //The command being sent is the stream's latest
+   uint64_t cnt0 = m_imageStream.md->cnt0;
+   timespec writetime = m_imageStream.md->writetime;
+
+   if(m_firstCommand)
+   {
+      m_firstCommand = false;
+   }
+   else if(cnt0 == m_lastCnt0)
+   {
+      ++m_repeated;
+   }
+   else if(cnt0 > m_lastCnt0 + 1)
+   {
+      m_dropped += cnt0 - m_lastCnt0 - 1;
+   }
+   m_lastCnt0 = cnt0;
+
+   if(m_family == "alpao")
+   {
+      m_alpaoMap.apply(m_dminputs.data(), (realT *) curr_src);
+      recordSat(m_alpaoMap.satMask().data());
+   }
+   else
+   {
+      m_bmcMap.apply(m_dminputs.data(), (realT *) curr_src);
+      recordSat(m_bmcMap.satMask().data());
+   }
+
+   clock_gettime(CLOCK_REALTIME, &t1);
+
+   double sdk = sdkCall();
+
+   ++m_commands;
+
+   writeTrace(cnt0, mockDMElapsed(writetime, t0), mockDMElapsed(t0, t1), sdk);
+
+   return 0;
+}
+
+int mockDMCtrl::releaseDM()
+{
+   if(!m_dmopen)
+   {
+      log<text_log>("dm is not initialized", logPrio::LOG_ERROR);
+      return -1;
+   }
+
+   state(stateCodes::READY);
+
+   if(!shutdown())
+   {
+      pthread_kill(m_smThread.native_handle(), SIGUSR1);
+   }
+
+   if(zeroDM() < 0)
+   {
+      log<text_log>("DM release failed.  Error zeroing DM.", logPrio::LOG_ERROR);
+      return -1;
+   }
+
+   m_dmopen = false;
+
+   log<text_log>("mock DM released", logPrio::LOG_NOTICE);
+
+   return 0;
+}
+
+double mockDMCtrl::sdkCall()
+{
+   double wait = m_callTime;
+   if(m_callJitter > 0) wait += m_jitter(m_gen);
+
+   timespec t0, t1;
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+
+   if(wait <= 0) return 0;
+
+   //Busy-wait, as the SDKs do while the command is transferred
+   do
+   {
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+   } while(mockDMElapsed(t0, t1) < wait);
+
+   return mockDMElapsed(t0, t1);
+}
+
+void mockDMCtrl::writeTrace( uint64_t cnt0,
+                             double latency,
+                             double convert,
+                             double sdk
+                           )
+{
+   if(!m_traceOpen) return;
+
+   uint64_t n = m_traceStream.md->cnt0;
+   uint64_t slot = n % m_traceLength;
+
+   m_traceStream.md->write = 1;
+
+   double * entry = m_traceStream.array.D + slot*mockDMTraceFields;
+   entry[mockDMTraceCnt0] = cnt0;
+   entry[mockDMTraceLatency] = latency;
+   entry[mockDMTraceConvert] = convert;
+   entry[mockDMTraceSDK] = sdk;
+   entry[mockDMTraceCommands] = m_commands;
+   entry[mockDMTraceDropped] = m_dropped;
+   entry[mockDMTraceRepeated] = m_repeated;
+   entry[mockDMTraceSatThread] = m_satThreadNs/1e3;
+
+   clock_gettime(CLOCK_REALTIME, &m_traceStream.md->writetime);
+   m_traceStream.md->atime = m_traceStream.md->writetime;
+
+   m_traceStream.md->cnt1 = slot;
+   m_traceStream.md->cnt0 = n + 1;
+
+   m_traceStream.writetimearray[slot] = m_traceStream.md->writetime;
+   m_traceStream.atimearray[slot] = m_traceStream.md->atime;
+   m_traceStream.cntarray[slot] = n + 1;
+
+   m_traceStream.md->write = 0;
+   ImageStreamIO_sempost(&m_traceStream, -1);
+}
+
+} //namespace app
+} //namespace MagAOX
+
+#endif //mockDMCtrl_hpp
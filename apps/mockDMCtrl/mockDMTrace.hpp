@@ -0,0 +1,37 @@
+/** \file mockDMTrace.hpp
+  * \brief The layout of the mockDMCtrl trace stream, shared with utils/dmCommandBench.
+  *
+  * \ingroup mockDMCtrl_files
+  */
+
+#ifndef mockDMTrace_hpp
+#define mockDMTrace_hpp
+
+namespace MagAOX
+{
+namespace app
+{
+
+/// The fields of each entry in the mockDMCtrl trace stream.
+/** The trace stream is mockDMTraceFields x 1 doubles, with a circular buffer of `mock.traceLength` entries.  Entry `n` is
+  * written to slot `n % mock.traceLength`, and cnt0 is the number of entries written.
+  *
+  * \ingroup mockDMCtrl
+  */
+enum mockDMTrace
+{
+   mockDMTraceCnt0,      ///< The cnt0 of the command in the DM stream.
+   mockDMTraceLatency,   ///< The time from the command's writetime to the start of commandDM, in microseconds.
+   mockDMTraceConvert,   ///< The time to convert the shape and record saturation, in microseconds.
+   mockDMTraceSDK,       ///< The time spent in the emulated SDK call, in microseconds.
+   mockDMTraceCommands,  ///< The number of commands sent so far.
+   mockDMTraceDropped,   ///< The number of commands overwritten in the DM stream before they were sent, so far.
+   mockDMTraceRepeated,  ///< The number of times a command was sent again because the stream was posted without a new cnt0, so far.
+   mockDMTraceSatThread, ///< The total time the saturation thread has spent collecting and publishing, in microseconds.
+   mockDMTraceFields     ///< The number of fields.
+};
+
+} //namespace app
+} //namespace MagAOX
+
+#endif //mockDMTrace_hpp
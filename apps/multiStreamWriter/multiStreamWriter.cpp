@@ -0,0 +1,11 @@
+
+
+
+#include "multiStreamWriter.hpp"
+
+int main(int argc, char ** argv)
+{
+   MagAOX::app::multiStreamWriter msw;
+
+   return msw.main(argc, argv);
+}
@@ -0,0 +1,1481 @@
+/** \file multiStreamWriter.hpp
+  * \brief The MagAO-X Multiple Image Stream Writer
+  *
+  * \ingroup multiStreamWriter_files
+  */
+
+#ifndef multiStreamWriter_hpp
+#define multiStreamWriter_hpp
+
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include <ImageStruct.h>
+#include <ImageStreamIO.h>
+
+#include <xrif/xrif.h>
+
+#include <mx/sys/timeUtils.hpp>
+
+#include "../../libMagAOX/app/MagAOXApp.hpp"
+#include "../../libMagAOX/sys/ioGate.hpp"
+#include "../../libMagAOX/sys/workStealingPool.hpp"
+#include "../../libMagAOX/sys/writeScheduler.hpp"
+#include "../../libMagAOX/sys/xrifCatalog.hpp"
+#include "../../libMagAOX/sys/xrifChunkEncoder.hpp"
+
+#include "../../magaox_git_version.h"
+
+#include "../streamWriter/lz4AccelControl.hpp"
+
+
+
+#define NOT_WRITING (0)
+#define START_WRITING (1)
+#define WRITING (2)
+#define STOP_WRITING (3)
+
+namespace MagAOX
+{
+namespace app
+{
+
+/** \defgroup multiStreamWriter Multiple ImageStreamIO Stream Writing
+  * \brief Writes the contents of several ImageStreamIO image streams to disk from one process.
+  *
+  * \ingroup apps
+  *
+  */
+
+/** \defgroup multiStreamWriter_files Multiple ImageStreamIO Stream Writing
+  * \ingroup multiStreamWriter
+  */
+
+class multiStreamWriter;
+
+/// A stream written by multiStreamWriter.
+/** Each stream has its own framegrabber thread and circular buffers, as in streamWriter.  Chunks are queued as jobs,
+  * which are encoded by the shared pool as encoders of the stream are free.
+  *
+  * \ingroup multiStreamWriter
+  */
+struct writerStream
+{
+   /// A chunk of the circular buffer to write.
+   struct job
+   {
+      uint64_t m_start {0};       ///< The circular buffer position of the first frame.
+      uint64_t m_stop {0};        ///< The circular buffer position after the last frame.
+      uint64_t m_grabbed {0};     ///< The value of m_grabbed when the last frame was copied.
+      uint64_t m_startFrameNo {0}; ///< The frame number of the first frame, if m_first.
+      uint64_t m_stopFrameNo {0}; ///< The frame number of the last frame.
+      bool m_first {false};       ///< Whether this is the first chunk of a save.
+      bool m_last {false};        ///< Whether this is the last chunk of a save.
+   };
+
+   multiStreamWriter * m_parent {nullptr}; ///< The app.
+
+   size_t m_index {0}; ///< The index of the stream, which picks the pool worker its chunks are queued on.
+
+   /** \name Configuration
+     * @{
+     */
+   std::string m_name;              ///< The name of the stream's config section, used for INDI and thread names.
+   std::string m_shmimName;         ///< The name of the shared memory buffer.
+   int m_semaphoreNumber {7};       ///< The image structure semaphore index.
+   std::string m_rawimageDir;       ///< The path where files will be saved.
+   unsigned m_priority {0};         ///< The write priority.  Higher priority archives are written first in each batch.
+   size_t m_circBuffLength {1024};  ///< The length of the circular buffer, in frames.
+   size_t m_writeChunkLength {512}; ///< The number of frames to write at a time.
+   int m_fgThreadPrio {1};          ///< Priority of the framegrabber thread.
+   std::string m_fgCpuset;          ///< The cpuset for the framegrabber thread.  Ignored if empty.
+   ///@}
+
+   /** \name Framegrabber Thread
+     * @{
+     */
+   std::thread m_fgThread; ///< The framegrabber thread.
+
+   bool m_fgThreadInit {true}; ///< Synchronizer to ensure f.g. thread initializes before doing dangerous things.
+
+   pid_t m_fgThreadID {0}; ///< F.g. thread PID.
+
+   pcf::IndiProperty m_fgThreadProp; ///< The property to hold the f.g. thread details.
+
+   bool m_restart {false}; ///< Set by the SIGSEGV handler to restart the framegrabber.
+   ///@}
+
+   /** \name Circular Buffers
+     * @{
+     */
+   uint32_t m_width {0};   ///< The width of the image.
+   uint32_t m_height {0};  ///< The height of the image.
+   uint8_t m_dataType {0}; ///< The ImageStreamIO type code.
+   size_t m_typeSize {0};  ///< The size of the type, in bytes.
+
+   char * m_rawImageCircBuff {nullptr};  ///< The image circular buffer.
+   uint64_t * m_timingCircBuff {nullptr}; ///< The timing circular buffer, 5 values per frame.
+
+   std::atomic<int> m_writing {NOT_WRITING}; ///< Controls whether or not images are being written, and sequences start and stop of writing.
+
+   uint64_t m_currImage {0};      ///< The circular buffer position of the current image.
+   uint64_t m_currChunkStart {0}; ///< The circular buffer starting position of the current to-be-written chunk.
+   uint64_t m_nextChunkStart {0}; ///< The circular buffer starting position of the next to-be-written chunk.
+
+   std::atomic<uint64_t> m_grabbed {0}; ///< The number of frames the framegrabber has started copying into the circular buffer.
+   ///@}
+
+   /** \name Encoding
+     * Protected by m_mutex.
+     * @{
+     */
+   std::mutex m_mutex; ///< Protects the jobs, the encoders, and the adaptive compression state.
+
+   std::deque<job> m_jobs; ///< The chunks waiting for an encoder.
+
+   std::vector<std::unique_ptr<sys::xrifChunkEncoder>> m_encoders; ///< The encoders of this stream.
+
+   std::vector<sys::xrifChunkEncoder *> m_freeEncoders; ///< The encoders not in use.
+
+   size_t m_inFlight {0}; ///< The number of chunks being encoded or written.
+
+   int m_lz4accelCurr {1}; ///< The LZ4 acceleration of the next chunk.
+
+   lz4AccelControl m_accelControl; ///< Chooses the LZ4 acceleration with adaptive compression.
+
+   float m_ratio {0};      ///< The compression ratio of the last chunk.
+   float m_encodeRate {0}; ///< The encoding rate of the last chunk, in bytes/sec.
+   float m_load {0};       ///< The load of the last chunk.
+   float m_backlog {0};    ///< The backlog of the last chunk.
+
+   uint64_t m_written {0}; ///< The number of chunks written.
+   uint64_t m_overrun {0}; ///< The number of chunks overwritten in the circular buffer before they were encoded.
+   ///@}
+
+   /** \name INDI
+     * @{
+     */
+   pcf::IndiProperty m_indiP_xrifStats; ///< The compression performance of this stream.
+   ///@}
+};
+
+/** MagAO-X application to write several ImageStreamIO streams to disk from one process.
+  *
+  * Each stream, configured in its own section with a shmimName, has its own framegrabber thread copying frames into
+  * its circular buffer, as in streamWriter.  The chunks of all streams are encoded by a shared pool of encoder
+  * threads, which steal work from each other so that a busy stream can use the encoders of idle ones.  The encoded
+  * archives are written by a single write scheduler thread, which batches the archives finished at about the same
+  * time into one turn at the disk, highest priority first.  The scheduler's backlog is fed back to adaptive
+  * compression, so every stream compresses harder when the disk falls behind.
+  *
+  * The archives and catalogs are the same as those of streamWriter.  Previews and the xrifcompress telemetry are not
+  * supported in this mode.
+  *
+  * \ingroup multiStreamWriter
+  *
+  */
+class multiStreamWriter : public MagAOXApp<>
+{
+   friend struct writerStream;
+
+protected:
+
+   /** \name configurable parameters
+     *@{
+     */
+
+   std::string m_rawimageBase; ///< The path where each stream's directory is created, unless the stream sets savePath.
+
+   size_t m_circBuffLength {1024}; ///< The default length of the circular buffers, in frames.
+
+   size_t m_writeChunkLength {512}; ///< The default number of frames to write at a time.
+
+   unsigned m_semWait {500000000}; ///< The time in nsec to wait on the semaphores.  Max is 999999999. Default is 5e8 nsec.
+
+   int m_fgThreadPrio {1}; ///< The default priority of the framegrabber threads.
+
+   std::string m_fgCpuset; ///< The default cpuset for the framegrabber threads.  Ignored if empty.
+
+   int m_lz4accel {1}; ///< The LZ4 acceleration parameter.  With adaptive compression, the lowest acceleration used.
+
+   bool m_adaptive {false}; ///< If true, the LZ4 acceleration of each chunk is chosen from the load and backlog.  See lz4AccelControl.
+
+   int m_adaptiveMaxAccel {64}; ///< The highest LZ4 acceleration used with adaptive compression.
+
+   float m_adaptiveLoadHigh {0.7}; ///< The load above which adaptive compression raises the acceleration.
+
+   float m_adaptiveLoadLow {0.35}; ///< The load below which adaptive compression lowers the acceleration.
+
+   size_t m_subChunkLength {0}; ///< If > 0, each archive is written as sub-chunks of this many frames, with an index.  See sys::xrifArchive.
+
+   unsigned m_encoderThreads {2}; ///< The number of encoder threads in the pool.
+
+   int m_encoderThreadPrio {0}; ///< The priority of the encoder threads.
+
+   unsigned m_inFlight {2}; ///< The number of chunks of each stream which may be encoded or written at once.
+
+   int m_swThreadPrio {1}; ///< The priority of the write scheduler thread.
+
+   double m_batchWait {0}; ///< How long the write scheduler waits for more archives to join a batch, in sec.
+
+   double m_maxBatchMB {0}; ///< The maximum size of a batch, in MB, which limits how long the I/O gate is held.  0 is no limit.
+
+   double m_backlogMB {1024}; ///< The MB queued for writing at which the write backlog is 1.
+
+   unsigned m_ioGateSlots {0}; ///< The number of writers which may write to the disk at once.  If 0, the default, the I/O gate is not used.  See sys::ioGate.
+
+   unsigned m_ioGatePriority {0}; ///< The I/O gate priority of this writer.
+
+   double m_ioGateMaxWait {0.5}; ///< The maximum time to wait for an I/O gate slot, in sec, after which the batch is written anyway.
+
+   std::string m_ioGateDir; ///< The directory of the I/O gate slot files, shared by the writers.  Default is the raw images directory.
+
+   ///@}
+
+   std::vector<std::unique_ptr<writerStream>> m_streams; ///< The streams.
+
+   sys::workStealingPool m_pool; ///< The encoder threads, shared by the streams.
+
+   sys::writeScheduler m_scheduler; ///< Writes the archives of all streams.
+
+   sys::ioGate m_ioGate; ///< Limits the number of writers writing to the disk at once.
+
+   uint64_t m_lastSchedBytes {0}; ///< The bytes written at the last updateINDI.
+
+   double m_lastSchedTime {0}; ///< The time of the last updateINDI.
+
+public:
+
+   ///Default c'tor
+   multiStreamWriter();
+
+   ///Destructor
+   ~multiStreamWriter() noexcept;
+
+   /// Setup the configuration system (called by MagAOXApp::setup())
+   virtual void setupConfig();
+
+   /// Implementation of loadConfig logic, separated for testing.
+   /** This is called by loadConfig().
+     *
+     * \returns 0 on success
+     * \returns -1 on error, e.g. if no streams are configured
+     */
+   int loadConfigImpl( mx::app::appConfigurator & _config /**< [in] an application configuration from which to load values*/);
+
+   /// load the configuration system results (called by MagAOXApp::setup())
+   virtual void loadConfig();
+
+   /// Startup functions
+   /** Starts the pool, the write scheduler, and the framegrabber threads, and sets up the INDI vars.
+     *
+     */
+   virtual int appStartup();
+
+   /// Checks the threads, and updates INDI.
+   virtual int appLogic();
+
+   /// Stops the framegrabbers, then the pool and the scheduler after they finish the chunks queued.
+   virtual int appShutdown();
+
+protected:
+
+   /** \name SIGSEGV & SIGBUS signal handling
+     * These signals occur as a result of a ImageStreamIO source server resetting (e.g. changing frame sizes).
+     * When they occur a restart of every framegrabber's main loop is triggered, since the signal does not say which.
+     *
+     * @{
+     */
+   static multiStreamWriter * m_selfWriter; ///< Static pointer to this (set in constructor).  Used for getting out of the static SIGSEGV handler.
+
+   ///Sets the handler for SIGSEGV and SIGBUS
+   int setSigSegvHandler();
+
+   ///The handler called when SIGSEGV or SIGBUS is received.  Just a wrapper for handlerSigSegv.
+   static void _handlerSigSegv( int signum,
+                                siginfo_t *siginf,
+                                void *ucont
+                              );
+
+   ///Handles SIGSEGV and SIGBUS.  Sets m_restart to true for every stream.
+   void handlerSigSegv( int signum,
+                        siginfo_t *siginf,
+                        void *ucont
+                      );
+   ///@}
+
+   /// Set the priority of a thread not started with threadStart, such as the pool and scheduler threads.
+   int setThreadPrio( std::thread::native_handle_type th, ///< [in] the thread
+                      int prio,                           ///< [in] the real-time priority, 0 for normal
+                      const std::string & name            ///< [in] the name of the thread, for logging
+                    );
+
+   /** \name Framegrabber Threads
+     * Each monitors its ImageStreamIO buffer and copies its images to the stream's circular buffer.
+     *
+     * @{
+     */
+
+   /// Allocate the circular buffers and encoders of a stream, once no chunks are in flight.
+   /**
+     * \returns 0 on sucess.
+     * \returns -1 on error.
+     */
+   int allocate( writerStream & st /**< [in] the stream */);
+
+   /// Wait until the chunks of every stream have been encoded and written.
+   /** Returns early if the pool or the scheduler is not running, since then the chunks can not be finished.
+     */
+   void drain();
+
+   /// Wait for a stream's chunks to be encoded and written, dropping those not started, and free its buffers.
+   void release( writerStream & st /**< [in] the stream */);
+
+   ///Thread starter, called by threadStart on thread construction.  Calls fgThreadExec.
+   static void fgThreadStart( writerStream * st /**< [in] the stream */);
+
+   /// Execute the frame grabber main loop of a stream.
+   void fgThreadExec( writerStream & st /**< [in] the stream */);
+
+   ///@}
+
+   /** \name Encoding and Writing
+     *
+     * @{
+     */
+
+   /// Queue a chunk, and start it if an encoder is free.
+   void queueJob( writerStream & st,             ///< [in] the stream
+                  const writerStream::job & jb   ///< [in] the chunk
+                );
+
+   /// Hand queued chunks to the pool while encoders are free.  Call with the stream's m_mutex locked.
+   void dispatchJobs( writerStream & st /**< [in] the stream */);
+
+   /// Encode a chunk and submit it to the write scheduler.  Runs on a pool thread.
+   void encodeJob( writerStream & st,              ///< [in] the stream
+                   writerStream::job jb,           ///< [in] the chunk
+                   sys::xrifChunkEncoder * enc     ///< [in] the encoder, owned by the job until it is written
+                 );
+
+   /// Record a written chunk.  Runs on the write scheduler thread.
+   void writeDone( writerStream & st,                            ///< [in] the stream
+                   const writerStream::job & jb,                 ///< [in] the chunk
+                   sys::xrifChunkEncoder * enc,                  ///< [in] the encoder
+                   const sys::xrifCatalogEntry & catEntry,       ///< [in] the catalog entry of the archive
+                   const std::string & fname,                    ///< [in] the path of the archive
+                   double encodeTime,                            ///< [in] the time taken to encode the chunk, in sec
+                   const sys::writeScheduler::result & res       ///< [in] the result of the write
+                 );
+
+   /// Return an encoder to the stream and start the next chunk.
+   void finishJob( writerStream & st,             ///< [in] the stream
+                   const writerStream::job & jb,  ///< [in] the chunk
+                   sys::xrifChunkEncoder * enc    ///< [in] the encoder
+                 );
+
+   ///@}
+
+   //INDI:
+protected:
+   //declare our properties
+   pcf::IndiProperty m_indiP_writing; ///< One switch per stream.
+
+   pcf::IndiProperty m_indiP_scheduler; ///< The write scheduler statistics.
+
+   pcf::IndiProperty m_indiP_pool; ///< The encoder pool statistics.
+
+public:
+   INDI_NEWCALLBACK_DECL(multiStreamWriter, m_indiP_writing);
+
+   void updateINDI();
+};
+
+//Set self pointer to null so app starts up uninitialized.
+multiStreamWriter * multiStreamWriter::m_selfWriter = nullptr;
+
+inline
+multiStreamWriter::multiStreamWriter() : MagAOXApp(MAGAOX_CURRENT_SHA1, MAGAOX_REPO_MODIFIED)
+{
+   m_powerMgtEnabled = false;
+
+   m_selfWriter = this;
+
+   return;
+}
+
+inline
+multiStreamWriter::~multiStreamWriter() noexcept
+{
+   return;
+}
+
+inline
+void multiStreamWriter::setupConfig()
+{
+   config.add("writer.savePath", "", "writer.savePath", argType::Required, "writer", "savePath", false, "string", "The absolute path where each stream's directory is created. Will use MagAO-X default if not set.");
+
+   config.add("writer.circBuffLength", "", "writer.circBuffLength", argType::Required, "writer", "circBuffLength", false, "size_t", "The default length in frames of the circular buffers. Should be an integer multiple of and larger than writeChunkLength.");
+
+   config.add("writer.writeChunkLength", "", "writer.writeChunkLength", argType::Required, "writer", "writeChunkLength", false, "size_t", "The default length in frames of the chunks to write to disk. Should be smaller than circBuffLength.");
+
+   config.add("writer.threadPrio", "", "writer.threadPrio", argType::Required, "writer", "threadPrio", false, "int", "The real-time priority of the write scheduler thread.");
+
+   config.add("writer.lz4accel", "", "writer.lz4accel", argType::Required, "writer", "lz4accel", false, "int", "The LZ4 acceleration parameter.  Larger is faster, but lower compression.");
+
+   config.add("writer.adaptive", "", "writer.adaptive", argType::Required, "writer", "adaptive", false, "bool", "If true, choose the LZ4 acceleration of each chunk from the stream's load and the larger of its backlog and the disk's, starting from lz4accel.  Default is false.");
+
+   config.add("writer.adaptiveMaxAccel", "", "writer.adaptiveMaxAccel", argType::Required, "writer", "adaptiveMaxAccel", false, "int", "The highest LZ4 acceleration used with adaptive compression.  Default is 64.");
+
+   config.add("writer.adaptiveLoadHigh", "", "writer.adaptiveLoadHigh", argType::Required, "writer", "adaptiveLoadHigh", false, "float", "The load, time to encode and write a chunk over time to acquire it, above which the acceleration is raised.  Default is 0.7.");
+
+   config.add("writer.adaptiveLoadLow", "", "writer.adaptiveLoadLow", argType::Required, "writer", "adaptiveLoadLow", false, "float", "The load below which the acceleration is lowered.  Default is 0.35.");
+
+   config.add("writer.subChunkLength", "", "writer.subChunkLength", argType::Required, "writer", "subChunkLength", false, "size_t", "If > 0, write each archive as independently compressed sub-chunks of this many frames, with an index.  Default is 0, one block per archive.");
+
+   config.add("writer.encoderThreads", "", "writer.encoderThreads", argType::Required, "writer", "encoderThreads", false, "unsigned", "The number of encoder threads shared by the streams.  Default is 2.");
+
+   config.add("writer.encoderThreadPrio", "", "writer.encoderThreadPrio", argType::Required, "writer", "encoderThreadPrio", false, "int", "The real-time priority of the encoder threads.  Default is 0.");
+
+   config.add("writer.inFlight", "", "writer.inFlight", argType::Required, "writer", "inFlight", false, "unsigned", "The number of chunks of each stream which may be encoded or written at once.  Default is 2.");
+
+   config.add("writer.batchWait", "", "writer.batchWait", argType::Required, "writer", "batchWait", false, "double", "How long to wait for more archives to join a batch, in seconds.  Default is 0, write what is ready as soon as the disk is free.");
+
+   config.add("writer.maxBatchMB", "", "writer.maxBatchMB", argType::Required, "writer", "maxBatchMB", false, "double", "The maximum size of a batch, in MB, which limits how long the I/O gate is held.  Default is 0, no limit.");
+
+   config.add("writer.backlogMB", "", "writer.backlogMB", argType::Required, "writer", "backlogMB", false, "double", "The MB waiting to be written at which the disk backlog is 1, for adaptive compression.  Default is 1024.");
+
+   config.add("ioGate.slots", "", "ioGate.slots", argType::Required, "ioGate", "slots", false, "unsigned", "The number of stream writers which may write to the disk at once, which should be the same for all writers sharing the gate.  Default is 0, no gate.");
+
+   config.add("ioGate.priority", "", "ioGate.priority", argType::Required, "ioGate", "priority", false, "unsigned", "The priority of this writer.  A writer with priority p may use slots 0 to p, so the higher slots are reserved for the higher priorities.  Default is 0.");
+
+   config.add("ioGate.maxWait", "", "ioGate.maxWait", argType::Required, "ioGate", "maxWait", false, "double", "The maximum time to wait for a slot, in seconds, after which the batch is written anyway.  Default is 0.5.");
+
+   config.add("ioGate.dir", "", "ioGate.dir", argType::Required, "ioGate", "dir", false, "string", "The directory of the slot files, shared by the writers.  Default is the raw images directory.");
+
+   config.add("framegrabber.semWait", "", "framegrabber.semWait", argType::Required, "framegrabber", "semWait", false, "int", "The time in nsec to wait on the semaphores.  Max is 999999999. Default is 5e8 nsec.");
+
+   config.add("framegrabber.threadPrio", "", "framegrabber.threadPrio", argType::Required, "framegrabber", "threadPrio", false, "int", "The default real-time priority of the framegrabber threads.");
+
+   config.add("framegrabber.cpuset", "", "framegrabber.cpuset", argType::Required, "framegrabber", "cpuset", false, "string", "The default cpuset for the framegrabber threads.");
+}
+
+inline
+int multiStreamWriter::loadConfigImpl( mx::app::appConfigurator & _config )
+{
+   _config(m_circBuffLength, "writer.circBuffLength");
+   _config(m_writeChunkLength, "writer.writeChunkLength");
+   _config(m_swThreadPrio, "writer.threadPrio");
+   _config(m_lz4accel, "writer.lz4accel");
+   if(m_lz4accel < XRIF_LZ4_ACCEL_MIN) m_lz4accel = XRIF_LZ4_ACCEL_MIN;
+   if(m_lz4accel > XRIF_LZ4_ACCEL_MAX) m_lz4accel = XRIF_LZ4_ACCEL_MAX;
+   _config(m_adaptive, "writer.adaptive");
+   _config(m_adaptiveMaxAccel, "writer.adaptiveMaxAccel");
+   if(m_adaptiveMaxAccel > XRIF_LZ4_ACCEL_MAX) m_adaptiveMaxAccel = XRIF_LZ4_ACCEL_MAX;
+   _config(m_adaptiveLoadHigh, "writer.adaptiveLoadHigh");
+   _config(m_adaptiveLoadLow, "writer.adaptiveLoadLow");
+   _config(m_subChunkLength, "writer.subChunkLength");
+   _config(m_encoderThreads, "writer.encoderThreads");
+   if(m_encoderThreads < 1) m_encoderThreads = 1;
+   _config(m_encoderThreadPrio, "writer.encoderThreadPrio");
+   _config(m_inFlight, "writer.inFlight");
+   if(m_inFlight < 1) m_inFlight = 1;
+   _config(m_batchWait, "writer.batchWait");
+   _config(m_maxBatchMB, "writer.maxBatchMB");
+   _config(m_backlogMB, "writer.backlogMB");
+
+   _config(m_semWait, "framegrabber.semWait");
+   _config(m_fgThreadPrio, "framegrabber.threadPrio");
+   _config(m_fgCpuset, "framegrabber.cpuset");
+
+   m_rawimageBase = MagAOXPath + "/" + MAGAOX_rawimageRelPath;
+   _config(m_rawimageBase, "writer.savePath");
+
+   _config(m_ioGateSlots, "ioGate.slots");
+   _config(m_ioGatePriority, "ioGate.priority");
+   _config(m_ioGateMaxWait, "ioGate.maxWait");
+   m_ioGateDir = MagAOXPath + "/" + MAGAOX_rawimageRelPath;
+   _config(m_ioGateDir, "ioGate.dir");
+
+   // Parse the unused config sections to look for streams
+   std::vector<std::string> sections;
+
+   _config.unusedSections(sections);
+
+   for(size_t i=0;i<sections.size(); ++i)
+   {
+      std::string shmimName;
+      _config.configUnused(shmimName, mx::app::iniFile::makeKey(sections[i], "shmimName" ) );
+      if( shmimName == "" )
+      {
+         //not a stream
+         continue;
+      }
+
+      std::unique_ptr<writerStream> st(new writerStream);
+      st->m_parent = this;
+      st->m_index = m_streams.size();
+      st->m_name = sections[i];
+      st->m_shmimName = shmimName;
+
+      st->m_circBuffLength = m_circBuffLength;
+      st->m_writeChunkLength = m_writeChunkLength;
+      st->m_fgThreadPrio = m_fgThreadPrio;
+      st->m_fgCpuset = m_fgCpuset;
+      st->m_rawimageDir = m_rawimageBase + "/" + shmimName;
+
+      _config.configUnused(st->m_semaphoreNumber, mx::app::iniFile::makeKey(sections[i], "semaphoreNumber" ) );
+      _config.configUnused(st->m_rawimageDir, mx::app::iniFile::makeKey(sections[i], "savePath" ) );
+      _config.configUnused(st->m_priority, mx::app::iniFile::makeKey(sections[i], "priority" ) );
+      _config.configUnused(st->m_circBuffLength, mx::app::iniFile::makeKey(sections[i], "circBuffLength" ) );
+      _config.configUnused(st->m_writeChunkLength, mx::app::iniFile::makeKey(sections[i], "writeChunkLength" ) );
+      _config.configUnused(st->m_fgThreadPrio, mx::app::iniFile::makeKey(sections[i], "threadPrio" ) );
+      _config.configUnused(st->m_fgCpuset, mx::app::iniFile::makeKey(sections[i], "cpuset" ) );
+
+      if(st->m_writeChunkLength == 0 || st->m_circBuffLength % st->m_writeChunkLength != 0 || st->m_circBuffLength <= st->m_writeChunkLength)
+      {
+         log<text_log>("Write chunk length is not a divisor of, and smaller than, the circular buffer length for " + sections[i], logPrio::LOG_CRITICAL);
+         return -1;
+      }
+
+      st->m_accelControl.reset(m_lz4accel, m_adaptiveMaxAccel);
+      st->m_accelControl.m_loadHigh = m_adaptiveLoadHigh;
+      st->m_accelControl.m_loadLow = m_adaptiveLoadLow;
+      st->m_lz4accelCurr = m_lz4accel;
+
+      m_streams.push_back(std::move(st));
+   }
+
+   if(m_streams.size() == 0)
+   {
+      log<text_log>("No streams found in config.", logPrio::LOG_CRITICAL);
+      return -1;
+   }
+
+   return 0;
+}
+
+inline
+void multiStreamWriter::loadConfig()
+{
+   if( loadConfigImpl(config) < 0)
+   {
+      log<text_log>("Error during config", logPrio::LOG_CRITICAL);
+      m_shutdown = true;
+   }
+}
+
+inline
+int multiStreamWriter::appStartup()
+{
+   //Create save directories.
+   for(size_t n = 0; n < m_streams.size(); ++n)
+   {
+      errno = 0;
+      if( mkdir(m_streams[n]->m_rawimageDir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0 )
+      {
+         if( errno != EEXIST)
+         {
+            std::stringstream logss;
+            logss << "Failed to create image directory (" << m_streams[n]->m_rawimageDir << ").  Errno says: " << strerror(errno);
+            log<software_critical>({__FILE__, __LINE__, errno, 0, logss.str()});
+
+            return -1;
+         }
+      }
+   }
+
+   if(m_ioGateSlots > 0)
+   {
+      if(m_ioGate.open(m_ioGateDir, m_ioGateSlots, m_ioGatePriority) < 0)
+      {
+         log<software_critical>({__FILE__, __LINE__, errno, 0, "Failed to open the I/O gate in " + m_ioGateDir});
+         return -1;
+      }
+
+      m_scheduler.gate(&m_ioGate, m_ioGateMaxWait);
+   }
+
+   // set up the  INDI properties
+   std::vector<std::string> names;
+   for(size_t n = 0; n < m_streams.size(); ++n) names.push_back(m_streams[n]->m_name);
+
+   m_indiP_writing = pcf::IndiProperty(pcf::IndiProperty::Switch);
+   m_indiP_writing.setDevice(configName());
+   m_indiP_writing.setName("writing");
+   m_indiP_writing.setPerm(pcf::IndiProperty::ReadWrite);
+   m_indiP_writing.setState(pcf::IndiProperty::Idle);
+   m_indiP_writing.setRule(pcf::IndiProperty::AnyOfMany);
+   m_indiP_writing.setLabel("Writing");
+   for(size_t n = 0; n < names.size(); ++n)
+   {
+      m_indiP_writing.add(pcf::IndiElement(names[n], pcf::IndiElement::Off));
+   }
+   registerIndiPropertyNew(m_indiP_writing, INDI_NEWCALLBACK(m_indiP_writing));
+
+   for(size_t n = 0; n < m_streams.size(); ++n)
+   {
+      pcf::IndiProperty & prop = m_streams[n]->m_indiP_xrifStats;
+
+      registerIndiPropertyNew(prop, "xrif-" + m_streams[n]->m_name, pcf::IndiProperty::Number, pcf::IndiProperty::ReadOnly, pcf::IndiProperty::Idle, 0);
+      prop.setLabel("xrif compression performance of " + m_streams[n]->m_name);
+
+      indi::addNumberElement<float>(prop, "ratio", 0, 1.0, 0.0, "%0.2f", "Compression Ratio");
+      indi::addNumberElement<float>(prop, "encodeMBsec", 0, std::numeric_limits<float>::max(), 0.0, "%0.2f", "Total Encoding Rate [MB/sec]");
+      indi::addNumberElement<float>(prop, "encodeFPS", 0, std::numeric_limits<float>::max(), 0.0, "%0.2f", "Total Encoding Rate [f.p.s.]");
+      indi::addNumberElement<int>(prop, "lz4accel", 0, XRIF_LZ4_ACCEL_MAX, 1, "%d", "LZ4 Acceleration");
+      indi::addNumberElement<float>(prop, "load", 0, std::numeric_limits<float>::max(), 0.0, "%0.2f", "Load");
+      indi::addNumberElement<float>(prop, "backlog", 0, std::numeric_limits<float>::max(), 0.0, "%0.2f", "Backlog");
+      indi::addNumberElement<float>(prop, "overruns", 0, std::numeric_limits<float>::max(), 0.0, "%0.0f", "Chunks Overwritten Before Encoding");
+
+      //The stats change every chunk, so coalesce them.
+      indiPublishRate(prop);
+   }
+
+   REG_INDI_NEWPROP_NOCB(m_indiP_scheduler, "scheduler", pcf::IndiProperty::Number);
+   m_indiP_scheduler.setLabel("Write scheduler");
+   indi::addNumberElement<float>(m_indiP_scheduler, "queuedMB", 0, std::numeric_limits<float>::max(), 0.0, "%0.1f", "Waiting to be Written [MB]");
+   indi::addNumberElement<float>(m_indiP_scheduler, "backlog", 0, std::numeric_limits<float>::max(), 0.0, "%0.2f", "Backlog");
+   indi::addNumberElement<float>(m_indiP_scheduler, "writeMBsec", 0, std::numeric_limits<float>::max(), 0.0, "%0.1f", "Write Rate [MB/sec]");
+   indi::addNumberElement<float>(m_indiP_scheduler, "files", 0, std::numeric_limits<float>::max(), 0.0, "%0.0f", "Archives Written");
+   indi::addNumberElement<float>(m_indiP_scheduler, "batches", 0, std::numeric_limits<float>::max(), 0.0, "%0.0f", "Batches Written");
+   indi::addNumberElement<float>(m_indiP_scheduler, "errors", 0, std::numeric_limits<float>::max(), 0.0, "%0.0f", "Write Errors");
+   indi::addNumberElement<float>(m_indiP_scheduler, "ioWait", 0, std::numeric_limits<float>::max(), 0.0, "%0.1f", "Total I/O Gate Wait [sec]");
+   indi::addNumberElement<float>(m_indiP_scheduler, "gateTimeouts", 0, std::numeric_limits<float>::max(), 0.0, "%0.0f", "I/O Gate Timeouts");
+   indiPublishRate(m_indiP_scheduler);
+
+   REG_INDI_NEWPROP_NOCB(m_indiP_pool, "pool", pcf::IndiProperty::Number);
+   m_indiP_pool.setLabel("Encoder pool");
+   indi::addNumberElement<float>(m_indiP_pool, "threads", 0, std::numeric_limits<float>::max(), 0.0, "%0.0f", "Threads");
+   indi::addNumberElement<float>(m_indiP_pool, "queued", 0, std::numeric_limits<float>::max(), 0.0, "%0.0f", "Chunks Queued");
+   indi::addNumberElement<float>(m_indiP_pool, "active", 0, std::numeric_limits<float>::max(), 0.0, "%0.0f", "Chunks Encoding");
+   indi::addNumberElement<float>(m_indiP_pool, "encoded", 0, std::numeric_limits<float>::max(), 0.0, "%0.0f", "Chunks Encoded");
+   indi::addNumberElement<float>(m_indiP_pool, "stolen", 0, std::numeric_limits<float>::max(), 0.0, "%0.0f", "Chunks Stolen");
+   indiPublishRate(m_indiP_pool);
+
+   //Now set up the pool, the scheduler, and the framegrabber threads.
+   if(setSigSegvHandler() < 0) return log<software_error, -1>({__FILE__, __LINE__});
+
+   //Each stream queues its chunks on worker index % threads, and idle workers steal from there.
+   if(m_pool.start(m_encoderThreads) < 0)
+   {
+      return log<software_critical, -1>({__FILE__, __LINE__, "failed to start the encoder pool"});
+   }
+
+   for(size_t n = 0; n < m_pool.threads(); ++n)
+   {
+      setThreadPrio(m_pool.nativeHandle(n), m_encoderThreadPrio, "encoder " + std::to_string(n));
+   }
+
+   m_scheduler.batchWait(m_batchWait);
+   m_scheduler.maxBatchBytes(m_maxBatchMB*1048576);
+   m_scheduler.budget(m_backlogMB*1048576);
+   if(m_scheduler.start() < 0)
+   {
+      return log<software_critical, -1>({__FILE__, __LINE__, "failed to start the write scheduler"});
+   }
+
+   setThreadPrio(m_scheduler.nativeHandle(), m_swThreadPrio, "write scheduler");
+
+   for(size_t n = 0; n < m_streams.size(); ++n)
+   {
+      writerStream * st = m_streams[n].get();
+
+      if(threadStart( st->m_fgThread, st->m_fgThreadInit, st->m_fgThreadID, st->m_fgThreadProp, st->m_fgThreadPrio, st->m_fgCpuset, "framegrabber-" + st->m_name, st, fgThreadStart)  < 0)
+      {
+         return log<software_critical,-1>({__FILE__, __LINE__});
+      }
+   }
+
+   m_lastSchedTime = mx::sys::get_curr_time();
+
+   return 0;
+}
+
+inline
+int multiStreamWriter::appLogic()
+{
+   //first do a join check to see if other threads have exited.
+   //these will throw if the threads are really gone
+   for(size_t n = 0; n < m_streams.size(); ++n)
+   {
+      try
+      {
+         if(pthread_tryjoin_np(m_streams[n]->m_fgThread.native_handle(),0) == 0)
+         {
+            log<software_error>({__FILE__, __LINE__, "framegrabber thread for " + m_streams[n]->m_name + " has exited"});
+            return -1;
+         }
+      }
+      catch(...)
+      {
+         log<software_error>({__FILE__, __LINE__, "framegrabber thread for " + m_streams[n]->m_name + " has exited"});
+         return -1;
+      }
+   }
+
+   if(!m_scheduler.running())
+   {
+      log<software_error>({__FILE__, __LINE__, "write scheduler has stopped"});
+      return -1;
+   }
+
+   bool writing = false;
+   for(size_t n = 0; n < m_streams.size(); ++n)
+   {
+      if(m_streams[n]->m_writing != NOT_WRITING) writing = true;
+   }
+
+   if(writing) state(stateCodes::OPERATING);
+   else state(stateCodes::READY);
+
+   updateINDI();
+
+   return 0;
+}
+
+inline
+int multiStreamWriter::appShutdown()
+{
+   for(size_t n = 0; n < m_streams.size(); ++n)
+   {
+      try
+      {
+         if(m_streams[n]->m_fgThread.joinable())
+         {
+            m_streams[n]->m_fgThread.join();
+         }
+      }
+      catch(...){}
+   }
+
+   //The framegrabbers have queued their last chunks.  The pool can be idle while chunks still wait for an encoder held
+   //by an archive not yet written, so wait for every stream, not the pool.
+   drain();
+
+   m_pool.stop();
+   m_scheduler.stop();
+
+   for(size_t n = 0; n < m_streams.size(); ++n) release(*m_streams[n]);
+
+   return 0;
+}
+
+inline
+int multiStreamWriter::setSigSegvHandler()
+{
+   struct sigaction act;
+   sigset_t set;
+
+   act.sa_sigaction = &multiStreamWriter::_handlerSigSegv;
+   act.sa_flags = SA_SIGINFO;
+   sigemptyset(&set);
+   act.sa_mask = set;
+
+   errno = 0;
+   if( sigaction(SIGSEGV, &act, 0) < 0 )
+   {
+      std::string logss = "Setting handler for SIGSEGV failed. Errno says: ";
+      logss += strerror(errno);
+
+      log<software_error>({__FILE__, __LINE__, errno, 0, logss});
+
+      return -1;
+   }
+
+   errno = 0;
+   if( sigaction(SIGBUS, &act, 0) < 0 )
+   {
+      std::string logss = "Setting handler for SIGBUS failed. Errno says: ";
+      logss += strerror(errno);
+
+      log<software_error>({__FILE__, __LINE__, errno, 0,logss});
+
+      return -1;
+   }
+
+   log<text_log>("Installed SIGSEGV/SIGBUS signal handler.", logPrio::LOG_DEBUG);
+
+   return 0;
+}
+
+inline
+void multiStreamWriter::_handlerSigSegv( int signum,
+                                         siginfo_t *siginf,
+                                         void *ucont
+                                       )
+{
+   m_selfWriter->handlerSigSegv(signum, siginf, ucont);
+}
+
+inline
+void multiStreamWriter::handlerSigSegv( int signum,
+                                        siginfo_t *siginf,
+                                        void *ucont
+                                      )
+{
+   static_cast<void>(signum);
+   static_cast<void>(siginf);
+   static_cast<void>(ucont);
+
+   for(size_t n = 0; n < m_streams.size(); ++n) m_streams[n]->m_restart = true;
+
+   return;
+}
+
+inline
+int multiStreamWriter::setThreadPrio( std::thread::native_handle_type th,
+                                      int prio,
+                                      const std::string & name
+                                    )
+{
+   if(prio < 0) prio = 0;
+   if(prio > 99) prio = 99;
+
+   sched_param sp;
+   sp.sched_priority = prio;
+
+   int rv = 0;
+
+   {//scope for elPriv
+      elevatedPrivileges elPriv(this);
+
+      if(prio > 0) rv = pthread_setschedparam(th, MAGAOX_RT_SCHED_POLICY, &sp);
+      else rv = pthread_setschedparam(th, SCHED_OTHER, &sp);
+   }
+
+   if(rv != 0)
+   {
+      return log<software_error, -1>({__FILE__, __LINE__, rv, "Setting " + name + " thread scheduler priority to " + std::to_string(prio) + " failed."});
+   }
+
+   log<text_log>(name + " thread scheduler priority set to " + std::to_string(prio));
+
+   return 0;
+}
+
+inline
+int multiStreamWriter::allocate( writerStream & st )
+{
+   release(st);
+
+   errno = 0;
+   st.m_rawImageCircBuff = (char *) malloc( st.m_width*st.m_height*st.m_typeSize*st.m_circBuffLength );
+   if(st.m_rawImageCircBuff == NULL)
+   {
+      return log<software_critical,-1>({__FILE__,__LINE__, errno, 0, "buffer allocation failure for " + st.m_name});
+   }
+
+   errno = 0;
+   st.m_timingCircBuff = (uint64_t *) malloc( 5*sizeof(uint64_t)*st.m_circBuffLength );
+   if(st.m_timingCircBuff == NULL)
+   {
+      return log<software_critical,-1>({__FILE__,__LINE__, errno, 0, "buffer allocation failure for " + st.m_name});
+   }
+
+   std::lock_guard<std::mutex> lock(st.m_mutex);
+
+   for(size_t n = 0; n < m_inFlight; ++n)
+   {
+      std::unique_ptr<sys::xrifChunkEncoder> enc(new sys::xrifChunkEncoder);
+
+      std::string errMsg;
+      if(enc->allocate(errMsg, st.m_width, st.m_height, st.m_dataType, st.m_writeChunkLength) < 0)
+      {
+         return log<software_critical,-1>({__FILE__,__LINE__, 0, 0, "xrif allocation failure for " + st.m_name + ": " + errMsg});
+      }
+
+      st.m_freeEncoders.push_back(enc.get());
+      st.m_encoders.push_back(std::move(enc));
+   }
+
+   return 0;
+}
+
+inline
+void multiStreamWriter::drain()
+{
+   for(size_t n = 0; n < m_streams.size(); ++n)
+   {
+      writerStream & st = *m_streams[n];
+
+      while(m_pool.running() && m_scheduler.running())
+      {
+         {
+            std::lock_guard<std::mutex> lock(st.m_mutex);
+            if(st.m_jobs.empty() && st.m_inFlight == 0) break;
+         }
+
+         mx::sys::milliSleep(10);
+      }
+   }
+}
+
+inline
+void multiStreamWriter::release( writerStream & st )
+{
+   //Chunks not yet started are dropped, those being encoded or written are finished first, since they use the buffers.
+   while(1)
+   {
+      {
+         std::lock_guard<std::mutex> lock(st.m_mutex);
+
+         if(st.m_jobs.size() > 0)
+         {
+            log<text_log>(st.m_name + ": dropping " + std::to_string(st.m_jobs.size()) + " chunks on restart", logPrio::LOG_WARNING);
+            st.m_jobs.clear();
+         }
+
+         if(st.m_inFlight == 0) break;
+      }
+
+      mx::sys::milliSleep(10);
+   }
+
+   std::lock_guard<std::mutex> lock(st.m_mutex);
+
+   st.m_freeEncoders.clear();
+   st.m_encoders.clear();
+
+   if(st.m_rawImageCircBuff)
+   {
+      free(st.m_rawImageCircBuff);
+      st.m_rawImageCircBuff = nullptr;
+   }
+
+   if(st.m_timingCircBuff)
+   {
+      free(st.m_timingCircBuff);
+      st.m_timingCircBuff = nullptr;
+   }
+}
+
+inline
+void multiStreamWriter::fgThreadStart( writerStream * st )
+{
+   st->m_parent->fgThreadExec(*st);
+}
+
+inline
+void multiStreamWriter::fgThreadExec( writerStream & st )
+{
+   st.m_fgThreadID = syscall(SYS_gettid);
+
+   //Wait fpr the thread starter to finish initializing this thread.
+   while(st.m_fgThreadInit == true && m_shutdown == 0)
+   {
+       sleep(1);
+   }
+
+   IMAGE image;
+   bool opened = false;
+
+   while(m_shutdown == 0)
+   {
+      /* Initialize ImageStreamIO
+       */
+      opened = false;
+      st.m_restart = false; //Set this up front, since we're about to restart.
+
+      sem_t * sem {nullptr}; ///< The semaphore to monitor for new image data
+
+      while(!opened && !m_shutdown && !st.m_restart)
+      {
+         if( ImageStreamIO_openIm(&image, st.m_shmimName.c_str()) == 0)
+         {
+            if(image.md[0].sem <= st.m_semaphoreNumber)
+            {
+               ImageStreamIO_closeIm(&image);
+               mx::sys::sleep(1); //We just need to wait for the server process to finish startup.
+            }
+            else
+            {
+               opened = true;
+            }
+         }
+         else
+         {
+            mx::sys::sleep(1); //be patient
+         }
+      }
+
+      if(m_shutdown || !opened) return;
+
+      ImageStreamIO_semflush(&image, st.m_semaphoreNumber);
+
+      sem = image.semptr[st.m_semaphoreNumber];
+
+      st.m_dataType = image.md[0].datatype;
+      st.m_typeSize = ImageStreamIO_typesize(st.m_dataType);
+      st.m_width = image.md[0].size[0];
+      st.m_height = image.md[0].size[1];
+      size_t length = image.md[0].size[2];
+
+      //Now allocate the circBuffs and the encoders
+      if(allocate(st) < 0) return; //will cause shutdown!
+
+      uint8_t atype;
+      size_t snx, sny, snz;
+
+      uint64_t curr_image; //The current cnt1 index
+      st.m_currImage = 0;
+      st.m_currChunkStart = 0;
+      st.m_nextChunkStart = 0;
+
+      uint64_t last_cnt0 = ((uint64_t) -1);
+
+      writerStream::job jb;
+
+      //This is the main image grabbing loop.
+      while(!m_shutdown && !st.m_restart)
+      {
+         timespec ts;
+
+         if(clock_gettime(CLOCK_REALTIME, &ts) < 0)
+         {
+            log<software_critical>({__FILE__,__LINE__,errno,0,"clock_gettime"});
+            return;
+         }
+
+         mx::sys::timespecAddNsec(ts, m_semWait);
+
+         if(sem_timedwait(sem, &ts) == 0)
+         {
+            if(image.md[0].size[2] > 0) ///\todo change to naxis?
+            {
+               curr_image = image.md[0].cnt1;
+            }
+            else curr_image = 0;
+
+            atype = image.md[0].datatype;
+            snx = image.md[0].size[0];
+            sny = image.md[0].size[1];
+            snz = image.md[0].size[2];
+
+            if( atype!= st.m_dataType || snx != st.m_width || sny != st.m_height || snz != length )
+            {
+               break; //exit the nearest while loop and get the new image setup.
+            }
+
+            if(m_shutdown || st.m_restart) break; //Check for exit signals
+
+            if( image.cntarray[curr_image] == last_cnt0 )
+            {
+               log<text_log>(st.m_name + ": semaphore raised but cnt0 has not changed -- we're probably getting behind", logPrio::LOG_WARNING);
+               continue;
+            }
+            last_cnt0 = image.cntarray[curr_image];
+
+            //Counted before the copy, so the encoders can tell when their chunk starts to be overwritten.
+            ++st.m_grabbed;
+
+            char * curr_dest = st.m_rawImageCircBuff + st.m_currImage*st.m_width*st.m_height*st.m_typeSize;
+            char * curr_src = (char *) image.array.raw + curr_image*st.m_width*st.m_height*st.m_typeSize;
+
+            memcpy( curr_dest, curr_src , st.m_width*st.m_height*st.m_typeSize);
+
+            uint64_t * curr_timing = st.m_timingCircBuff + 5*st.m_currImage;
+            curr_timing[0] = image.cntarray[curr_image];
+            curr_timing[1] = image.atimearray[curr_image].tv_sec;
+            curr_timing[2] = image.atimearray[curr_image].tv_nsec;
+            curr_timing[3] = image.writetimearray[curr_image].tv_sec;
+            curr_timing[4] = image.writetimearray[curr_image].tv_nsec;
+
+            if(m_shutdown && st.m_writing == WRITING) st.m_writing = STOP_WRITING;
+            switch(st.m_writing)
+            {
+               case START_WRITING:
+                  st.m_currChunkStart = st.m_currImage;
+                  st.m_nextChunkStart = (st.m_currImage / st.m_writeChunkLength)*st.m_writeChunkLength;
+                  st.m_writing = WRITING;
+                  jb.m_first = true;
+                  jb.m_startFrameNo = image.cntarray[curr_image];
+                  // fall through
+               case WRITING:
+                  if( st.m_currImage - st.m_nextChunkStart == st.m_writeChunkLength-1 )
+                  {
+                     jb.m_start = st.m_currChunkStart;
+                     jb.m_stop = st.m_nextChunkStart + st.m_writeChunkLength;
+                     jb.m_stopFrameNo = image.cntarray[curr_image];
+                     jb.m_grabbed = st.m_grabbed;
+                     jb.m_last = false;
+
+                     //Now hand the chunk to the encoders
+                     queueJob(st, jb);
+                     jb.m_first = false;
+
+                     st.m_nextChunkStart = ( (st.m_currImage  + 1) / st.m_writeChunkLength)*st.m_writeChunkLength;
+                     if(st.m_nextChunkStart >= st.m_circBuffLength) st.m_nextChunkStart = 0;
+
+                     st.m_currChunkStart = st.m_nextChunkStart;
+                  }
+                  break;
+
+               case STOP_WRITING:
+                  jb.m_start = st.m_currChunkStart;
+                  jb.m_stop = st.m_currImage + 1;
+                  jb.m_stopFrameNo = image.cntarray[curr_image];
+                  jb.m_grabbed = st.m_grabbed;
+                  jb.m_last = true;
+
+                  //The last chunk is queued once, and the stream is free to start again.
+                  queueJob(st, jb);
+                  jb.m_first = false;
+                  st.m_writing = NOT_WRITING;
+                  break;
+
+               default:
+                  break;
+            }
+
+            ++st.m_currImage;
+            if(st.m_currImage >= st.m_circBuffLength) st.m_currImage = 0;
+
+         }
+         else
+         {
+            if(image.md[0].sem <= 0) break; //Indicates that the server has cleaned up.
+
+            //Check for why we timed out
+            if(errno == EINTR) break; //This will indicate time to shutdown, loop will exit normally flags set.
+
+            //ETIMEDOUT just means we should wait more.
+            //Otherwise, report an error.
+            if(errno != ETIMEDOUT)
+            {
+               log<software_error>({__FILE__, __LINE__,errno, "sem_timedwait"});
+               break;
+            }
+         }
+      }
+
+      //At shutdown the partial chunk is queued too, and all are written by appShutdown, which releases the buffers after.
+      if(m_shutdown && st.m_writing == WRITING && st.m_currImage > st.m_currChunkStart)
+      {
+         jb.m_start = st.m_currChunkStart;
+         jb.m_stop = st.m_currImage;
+         jb.m_stopFrameNo = st.m_timingCircBuff[5*(st.m_currImage-1)];
+         jb.m_grabbed = st.m_grabbed;
+         jb.m_last = true;
+         queueJob(st, jb);
+         st.m_writing = NOT_WRITING;
+      }
+
+      if(!m_shutdown) release(st);
+
+      if(opened)
+      {
+         ImageStreamIO_closeIm(&image);
+         opened = false;
+      }
+
+   } //outer loop, will exit if m_shutdown==true
+
+   if(opened) ImageStreamIO_closeIm(&image);
+}
+
+inline
+void multiStreamWriter::queueJob( writerStream & st,
+                                  const writerStream::job & jb
+                                )
+{
+   std::lock_guard<std::mutex> lock(st.m_mutex);
+
+   st.m_jobs.push_back(jb);
+
+   dispatchJobs(st);
+}
+
+inline
+void multiStreamWriter::dispatchJobs( writerStream & st )
+{
+   while(st.m_jobs.size() > 0 && st.m_freeEncoders.size() > 0)
+   {
+      writerStream::job jb = st.m_jobs.front();
+      sys::xrifChunkEncoder * enc = st.m_freeEncoders.back();
+
+      writerStream * stp = &st;
+
+      //Queued on the stream's own worker, from which idle workers steal it.
+      if(m_pool.submit([this, stp, jb, enc]{ encodeJob(*stp, jb, enc); }, st.m_index) < 0) return;
+
+      st.m_jobs.pop_front();
+      st.m_freeEncoders.pop_back();
+      ++st.m_inFlight;
+   }
+}
+
+inline
+void multiStreamWriter::encodeJob( writerStream & st,
+                                   writerStream::job jb,
+                                   sys::xrifChunkEncoder * enc
+                                 )
+{
+   if(jb.m_first)
+   {
+      log<saving_start>({1,jb.m_startFrameNo});
+      log<text_log>(st.m_name + ": saving started at frame " + std::to_string(jb.m_startFrameNo));
+   }
+
+   timespec te0, te1;
+   clock_gettime(CLOCK_REALTIME, &te0);
+
+   uint64_t nframes = jb.m_stop - jb.m_start;
+   size_t frameSize = st.m_width*st.m_height*st.m_typeSize;
+   const uint64_t * timing = st.m_timingCircBuff + jb.m_start*5;
+
+   int accel;
+   {
+      std::lock_guard<std::mutex> lock(st.m_mutex);
+      accel = st.m_lz4accelCurr;
+   }
+
+   std::string errMsg;
+   if(enc->encode(errMsg, st.m_rawImageCircBuff + jb.m_start*frameSize, timing, nframes, accel, m_subChunkLength) < 0)
+   {
+      //This is a big problem.  Report it as "ALERT" and go on.
+      log<software_alert>({__FILE__,__LINE__, 0, 0, st.m_name + ": " + errMsg + ". DATA LOST."});
+      finishJob(st, jb, enc);
+      return;
+   }
+
+   //The first frame of the chunk is overwritten by the circBuffLength-th frame after it.
+   std::atomic_thread_fence(std::memory_order_acquire);
+   if(st.m_grabbed.load(std::memory_order_relaxed) > jb.m_grabbed - nframes + st.m_circBuffLength)
+   {
+      std::lock_guard<std::mutex> lock(st.m_mutex);
+      ++st.m_overrun;
+      log<text_log>(st.m_name + ": chunk overwritten while encoding, frames may be lost or out of order.  Increase circBuffLength or encoderThreads.", logPrio::LOG_WARNING);
+   }
+
+   //Now break down the acq time of the first image in the buffer for use in file name
+   tm uttime;//The broken down time.
+   timespec fts;
+   fts.tv_sec = timing[1];
+   fts.tv_nsec = timing[2];
+
+   if(gmtime_r(&fts.tv_sec, &uttime) == 0)
+   {
+      //Yell at operator but keep going
+      log<software_alert>({__FILE__,__LINE__,errno,0,"gmtime_r error.  possible loss of timing information."});
+   }
+
+   char tstamp[sizeof("YYYYMMDDHHMMSSNNNNNNNNN")];
+   int rv = snprintf(tstamp, sizeof(tstamp), "%04i%02i%02i%02i%02i%02i%09i", uttime.tm_year+1900,
+                            uttime.tm_mon+1, uttime.tm_mday, uttime.tm_hour, uttime.tm_min, uttime.tm_sec, static_cast<int>(fts.tv_nsec));
+
+   if(rv != sizeof("YYYYMMDDHHMMSSNNNNNNNNN")-1)
+   {
+      //Something is very wrong.  Keep going to try to get it on disk.
+      log<software_alert>({__FILE__,__LINE__, errno, rv, "did not write enough chars to timestamp"});
+   }
+
+   std::string fname = st.m_rawimageDir + "/" + st.m_shmimName + "_" + tstamp + ".xrif";
+
+   //The catalog entry is made now, since the circular buffer may be overwritten before the archive is written.
+   sys::xrifCatalogEntry catEntry;
+   catEntry.m_file = st.m_shmimName + "_" + tstamp + ".xrif";
+   catEntry.m_stream = st.m_shmimName;
+   catEntry.m_width = st.m_width;
+   catEntry.m_height = st.m_height;
+   catEntry.m_typeCode = st.m_dataType;
+   catEntry.m_compressedSize = enc->compressedSize();
+   catEntry.m_rawSize = enc->rawSize();
+   catEntry.timing(timing, nframes);
+
+   clock_gettime(CLOCK_REALTIME, &te1);
+   double encodeTime = ( (double) te1.tv_sec + ((double) te1.tv_nsec)/1e9) - ( (double) te0.tv_sec + ((double) te0.tv_nsec)/1e9);
+
+   sys::writeScheduler::request req;
+   req.m_path = fname;
+   req.m_priority = st.m_priority;
+   req.m_bytes = enc->size();
+   req.m_write = [enc](FILE * fp){ return enc->write(fp); };
+
+   writerStream * stp = &st;
+   req.m_done = [this, stp, jb, enc, catEntry, fname, encodeTime](const sys::writeScheduler::result & res)
+   {
+      writeDone(*stp, jb, enc, catEntry, fname, encodeTime, res);
+   };
+
+   if(m_scheduler.submit(req) < 0)
+   {
+      log<software_alert>({__FILE__,__LINE__, 0, 0, "write scheduler not running, " + fname + " not written.  DATA LOST."});
+      finishJob(st, jb, enc);
+   }
+}
+
+inline
+void multiStreamWriter::writeDone( writerStream & st,
+                                   const writerStream::job & jb,
+                                   sys::xrifChunkEncoder * enc,
+                                   const sys::xrifCatalogEntry & catEntry,
+                                   const std::string & fname,
+                                   double encodeTime,
+                                   const sys::writeScheduler::result & res
+                                 )
+{
+   if(res.m_rv < 0)
+   {
+      log<software_alert>({__FILE__,__LINE__, res.m_errno, 0, "failure writing " + fname + ".  DATA LOSS LIKELY."});
+   }
+   else
+   {
+      //Failure here only costs a rebuild, so it's just an error.
+      std::string catDir = fname.substr(0, fname.rfind('/'));
+      if(sys::xrifCatalog::append(catDir, catEntry) < 0)
+      {
+         log<software_error>({__FILE__,__LINE__,errno, 0,"failed to add " + catEntry.m_file + " to the xrif catalog"});
+      }
+   }
+
+   uint64_t nframes = jb.m_stop - jb.m_start;
+
+   {
+      std::lock_guard<std::mutex> lock(st.m_mutex);
+
+      //The load is the time to encode and write over the time to acquire.  Time queued for the disk is left out, as
+      //compressing faster only makes more to write, but the disk's backlog counts with the stream's.
+      double span = ((double) catEntry.m_atimeLast.tv_sec - (double) catEntry.m_atimeFirst.tv_sec) +
+                    ((double) catEntry.m_atimeLast.tv_nsec - (double) catEntry.m_atimeFirst.tv_nsec)/1e9;
+      float load = 0;
+      if(nframes > 1 && span > 0) load = (encodeTime + res.m_writeTime) / (span*nframes/(nframes-1));
+
+      float backlog = 0;
+      if(st.m_circBuffLength > nframes) backlog = ((double) (st.m_grabbed - jb.m_grabbed))/(st.m_circBuffLength - nframes);
+      backlog = std::max<float>(backlog, m_scheduler.backlog());
+
+      st.m_ratio = enc->ratio();
+      st.m_encodeRate = enc->encodeRate();
+      st.m_load = load;
+      st.m_backlog = backlog;
+      ++st.m_written;
+
+      //Favor ratio while the writer keeps up, and throughput when it falls behind.
+      if(m_adaptive && load > 0)
+      {
+         st.m_lz4accelCurr = st.m_accelControl.update(load, backlog);
+      }
+   }
+
+   finishJob(st, jb, enc);
+}
+
+inline
+void multiStreamWriter::finishJob( writerStream & st,
+                                   const writerStream::job & jb,
+                                   sys::xrifChunkEncoder * enc
+                                 )
+{
+   if(jb.m_last)
+   {
+      log<saving_stop>({0,jb.m_stopFrameNo});
+      log<text_log>(st.m_name + ": saving stopped at frame " + std::to_string(jb.m_stopFrameNo));
+   }
+
+   std::lock_guard<std::mutex> lock(st.m_mutex);
+
+   st.m_freeEncoders.push_back(enc);
+   --st.m_inFlight;
+
+   dispatchJobs(st);
+}
+
+INDI_NEWCALLBACK_DEFN(multiStreamWriter, m_indiP_writing)(const pcf::IndiProperty &ipRecv)
+{
+   if(ipRecv.getName() != m_indiP_writing.getName())
+   {
+      log<software_error>({__FILE__,__LINE__, "wrong INDI property received."});
+      return -1;
+   }
+
+   for(size_t n = 0; n < m_streams.size(); ++n)
+   {
+      writerStream & st = *m_streams[n];
+
+      if(!ipRecv.find(st.m_name)) continue;
+
+      if( ipRecv[st.m_name].getSwitchState() == pcf::IndiElement::Off && (st.m_writing == WRITING || st.m_writing == START_WRITING))
+      {
+         st.m_writing = STOP_WRITING;
+      }
+
+      if( ipRecv[st.m_name].getSwitchState() == pcf::IndiElement::On && st.m_writing == NOT_WRITING)
+      {
+         st.m_writing = START_WRITING;
+      }
+   }
+
+   return 0;
+}
+
+inline
+void multiStreamWriter::updateINDI()
+{
+   for(size_t n = 0; n < m_streams.size(); ++n)
+   {
+      writerStream & st = *m_streams[n];
+
+      //Only update this if not changing
+      if(st.m_writing == NOT_WRITING || st.m_writing == WRITING)
+      {
+         indi::updateSwitchIfChanged(m_indiP_writing, st.m_name, (st.m_writing == WRITING) ? pcf::IndiElement::On : pcf::IndiElement::Off, m_indiDriver, INDI_OK);
+      }
+
+      float ratio, encodeRate, load, backlog;
+      int accel;
+      uint64_t overrun;
+      {
+         std::lock_guard<std::mutex> lock(st.m_mutex);
+         ratio = st.m_ratio;
+         encodeRate = st.m_encodeRate;
+         load = st.m_load;
+         backlog = st.m_backlog;
+         accel = st.m_lz4accelCurr;
+         overrun = st.m_overrun;
+      }
+
+      pcf::IndiProperty::PropertyStateType state = (st.m_writing == WRITING) ? INDI_BUSY : INDI_IDLE;
+      size_t frameSize = st.m_width*st.m_height*st.m_typeSize;
+
+      updateIfChanged(st.m_indiP_xrifStats, "ratio", ratio, state);
+      updateIfChanged(st.m_indiP_xrifStats, "encodeMBsec", encodeRate/1048576.0, state);
+      updateIfChanged(st.m_indiP_xrifStats, "encodeFPS", (frameSize > 0) ? encodeRate/frameSize : 0.0, state);
+      updateIfChanged(st.m_indiP_xrifStats, "lz4accel", accel, state);
+      updateIfChanged(st.m_indiP_xrifStats, "load", load, state);
+      updateIfChanged(st.m_indiP_xrifStats, "backlog", backlog, state);
+      updateIfChanged(st.m_indiP_xrifStats, "overruns", (float) overrun, state);
+   }
+
+   double t = mx::sys::get_curr_time();
+   uint64_t bytes = m_scheduler.bytes();
+   double rate = 0;
+   if(t > m_lastSchedTime) rate = (bytes - m_lastSchedBytes)/(t - m_lastSchedTime)/1048576.0;
+   m_lastSchedBytes = bytes;
+   m_lastSchedTime = t;
+
+   pcf::IndiProperty::PropertyStateType state = (m_scheduler.queued() > 0) ? INDI_BUSY : INDI_IDLE;
+   updateIfChanged(m_indiP_scheduler, "queuedMB", m_scheduler.queuedBytes()/1048576.0, state);
+   updateIfChanged(m_indiP_scheduler, "backlog", m_scheduler.backlog(), state);
+   updateIfChanged(m_indiP_scheduler, "writeMBsec", rate, state);
+   updateIfChanged(m_indiP_scheduler, "files", (float) m_scheduler.files(), state);
+   updateIfChanged(m_indiP_scheduler, "batches", (float) m_scheduler.batches(), state);
+   updateIfChanged(m_indiP_scheduler, "errors", (float) m_scheduler.errors(), state);
+   updateIfChanged(m_indiP_scheduler, "ioWait", m_scheduler.ioWait(), state);
+   updateIfChanged(m_indiP_scheduler, "gateTimeouts", (float) m_scheduler.gateTimeouts(), state);
+
+   state = (m_pool.active() > 0) ? INDI_BUSY : INDI_IDLE;
+   updateIfChanged(m_indiP_pool, "threads", (float) m_pool.threads(), state);
+   updateIfChanged(m_indiP_pool, "queued", (float) m_pool.queued(), state);
+   updateIfChanged(m_indiP_pool, "active", (float) m_pool.active(), state);
+   updateIfChanged(m_indiP_pool, "encoded", (float) m_pool.executed(), state);
+   updateIfChanged(m_indiP_pool, "stolen", (float) m_pool.stolen(), state);
+}
+
+} //namespace app
+} //namespace MagAOX
+
+#endif //multiStreamWriter_hpp
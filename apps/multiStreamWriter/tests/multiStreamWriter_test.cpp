@@ -0,0 +1,255 @@
+#include "../../../tests/catch2/catch.hpp"
+
+#include "../multiStreamWriter.hpp"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace MagAOX
+{
+namespace app
+{
+
+class multiStreamWriter_test : public multiStreamWriter
+{
+public:
+
+   //Load a config file the way setup() does.
+   int loadFile( const std::string & path )
+   {
+      setupConfig();
+      config.readConfig(path);
+      return loadConfigImpl(config);
+   }
+
+   size_t streams(){ return m_streams.size(); }
+
+   writerStream & stream( size_t n ){ return *m_streams[n]; }
+
+   unsigned encoderThreads(){ return m_encoderThreads; }
+
+   unsigned inFlight(){ return m_inFlight; }
+
+   std::string rawimageBase(){ return m_rawimageBase; }
+
+   sys::writeScheduler & scheduler(){ return m_scheduler; }
+
+   //Set a stream up as its framegrabber does after connecting, and fill its circular buffers.
+   int setupStream( size_t n,
+                    uint32_t width,
+                    uint32_t height
+                  )
+   {
+      writerStream & st = *m_streams[n];
+      st.m_width = width;
+      st.m_height = height;
+      st.m_dataType = XRIF_TYPECODE_UINT16;
+      st.m_typeSize = ImageStreamIO_typesize(st.m_dataType);
+
+      if(allocate(st) < 0) return -1;
+
+      for(size_t pp = 0; pp < st.m_circBuffLength; ++pp)
+      {
+         for(size_t k = 0; k < width*height; ++k) ((uint16_t *) st.m_rawImageCircBuff)[pp*width*height + k] = pp + k;
+
+         uint64_t * curr_timing = st.m_timingCircBuff + 5*pp;
+         curr_timing[0] = pp;
+         curr_timing[1] = pp + 1000;
+         curr_timing[2] = pp + 2000;
+         curr_timing[3] = pp + 1000;
+         curr_timing[4] = pp + 3000;
+      }
+
+      st.m_grabbed = st.m_circBuffLength;
+
+      return 0;
+   }
+
+   //Start the pool and the scheduler as appStartup does.
+   int startWriters( sys::ioGate * gate,
+                     double maxWait
+                   )
+   {
+      if(gate) m_scheduler.gate(gate, maxWait);
+      if(m_pool.start(m_encoderThreads) < 0) return -1;
+      return m_scheduler.start();
+   }
+
+   //Queue the chunks of the circular buffer of a stream as one save, as its framegrabber does.
+   void queueSave( size_t n )
+   {
+      writerStream & st = *m_streams[n];
+
+      for(size_t c = 0; c < st.m_circBuffLength/st.m_writeChunkLength; ++c)
+      {
+         writerStream::job jb;
+         jb.m_start = c*st.m_writeChunkLength;
+         jb.m_stop = jb.m_start + st.m_writeChunkLength;
+         jb.m_startFrameNo = jb.m_start;
+         jb.m_stopFrameNo = jb.m_stop - 1;
+         jb.m_grabbed = jb.m_stop;
+         jb.m_first = (c == 0);
+         jb.m_last = (c == st.m_circBuffLength/st.m_writeChunkLength - 1);
+         queueJob(st, jb);
+      }
+   }
+};
+
+}
+}
+
+using namespace MagAOX::app;
+
+SCENARIO( "multiStreamWriter Configuration", "[multiStreamWriter]" )
+{
+   GIVEN("a config file")
+   {
+      WHEN("two streams are configured, one with its own settings")
+      {
+         mx::app::writeConfigFile( "/tmp/multiStreamWriter_test.conf", {"writer",         "writer",           "writer",         "writer",   "camA",      "camB",      "camB",     "camB",           "camB",             "camB"},
+                                                                       {"circBuffLength", "writeChunkLength", "encoderThreads", "inFlight", "shmimName", "shmimName", "priority", "circBuffLength", "writeChunkLength", "savePath"},
+                                                                       {"64",             "16",               "3",              "4",        "camsci1",   "camwfs",    "2",        "1000",           "250",              "/tmp/camwfs"} );
+
+         multiStreamWriter_test msw;
+         REQUIRE(msw.loadFile("/tmp/multiStreamWriter_test.conf") == 0);
+
+         THEN("each stream is found, with the defaults or its own settings")
+         {
+            REQUIRE(msw.streams() == 2);
+            REQUIRE(msw.encoderThreads() == 3);
+            REQUIRE(msw.inFlight() == 4);
+
+            REQUIRE(msw.stream(0).m_name == "camA");
+            REQUIRE(msw.stream(0).m_shmimName == "camsci1");
+            REQUIRE(msw.stream(0).m_index == 0);
+            REQUIRE(msw.stream(0).m_priority == 0);
+            REQUIRE(msw.stream(0).m_circBuffLength == 64);
+            REQUIRE(msw.stream(0).m_writeChunkLength == 16);
+            REQUIRE(msw.stream(0).m_rawimageDir == msw.rawimageBase() + "/camsci1");
+
+            REQUIRE(msw.stream(1).m_name == "camB");
+            REQUIRE(msw.stream(1).m_shmimName == "camwfs");
+            REQUIRE(msw.stream(1).m_index == 1);
+            REQUIRE(msw.stream(1).m_priority == 2);
+            REQUIRE(msw.stream(1).m_circBuffLength == 1000);
+            REQUIRE(msw.stream(1).m_writeChunkLength == 250);
+            REQUIRE(msw.stream(1).m_rawimageDir == "/tmp/camwfs");
+         }
+      }
+
+      WHEN("a section has no shmimName")
+      {
+         mx::app::writeConfigFile( "/tmp/multiStreamWriter_test.conf", {"camA",      "notAStream"},
+                                                                       {"shmimName", "priority"},
+                                                                       {"camsci1",   "1"} );
+
+         multiStreamWriter_test msw;
+         REQUIRE(msw.loadFile("/tmp/multiStreamWriter_test.conf") == 0);
+
+         THEN("it is not a stream")
+         {
+            REQUIRE(msw.streams() == 1);
+            REQUIRE(msw.stream(0).m_shmimName == "camsci1");
+         }
+      }
+
+      WHEN("no streams are configured")
+      {
+         mx::app::writeConfigFile( "/tmp/multiStreamWriter_test.conf", {"writer"},
+                                                                       {"circBuffLength"},
+                                                                       {"64"} );
+
+         multiStreamWriter_test msw;
+         REQUIRE(msw.loadFile("/tmp/multiStreamWriter_test.conf") == -1);
+      }
+
+      WHEN("a stream's write chunk length does not divide its circular buffer")
+      {
+         mx::app::writeConfigFile( "/tmp/multiStreamWriter_test.conf", {"camA",      "camA",           "camA"},
+                                                                       {"shmimName", "circBuffLength", "writeChunkLength"},
+                                                                       {"camsci1",   "100",            "30"} );
+
+         multiStreamWriter_test msw;
+         REQUIRE(msw.loadFile("/tmp/multiStreamWriter_test.conf") == -1);
+      }
+
+      WHEN("a stream's write chunk length is the whole circular buffer")
+      {
+         mx::app::writeConfigFile( "/tmp/multiStreamWriter_test.conf", {"camA",      "camA",           "camA"},
+                                                                       {"shmimName", "circBuffLength", "writeChunkLength"},
+                                                                       {"camsci1",   "64",             "64"} );
+
+         multiStreamWriter_test msw;
+         REQUIRE(msw.loadFile("/tmp/multiStreamWriter_test.conf") == -1);
+      }
+   }
+}
+
+SCENARIO( "multiStreamWriter writing at shutdown", "[multiStreamWriter]" )
+{
+   GIVEN("two streams, one encoder each, and a slow disk")
+   {
+      char tmpl[] = "/tmp/multiStreamWriter_test_XXXXXX";
+      REQUIRE(mkdtemp(tmpl) != nullptr);
+      std::string dir = tmpl;
+
+      mx::app::writeConfigFile( "/tmp/multiStreamWriter_test.conf", {"writer",         "writer",           "writer",         "writer",   "camA",      "camA",     "camB",      "camB"},
+                                                                    {"circBuffLength", "writeChunkLength", "encoderThreads", "inFlight", "shmimName", "savePath", "shmimName", "savePath"},
+                                                                    {"8",              "2",                "2",              "1",        "camA",      dir,        "camB",      dir} );
+
+      multiStreamWriter_test msw;
+      REQUIRE(msw.loadFile("/tmp/multiStreamWriter_test.conf") == 0);
+      REQUIRE(msw.setupStream(0, 16, 16) == 0);
+      REQUIRE(msw.setupStream(1, 8, 8) == 0);
+
+      //Another writer holds the only gate slot, so each batch waits out maxWait.
+      MagAOX::sys::ioGate other, mine;
+      REQUIRE(other.open(dir, 1, 0) == 0);
+      REQUIRE(mine.open(dir, 1, 0) == 0);
+      REQUIRE(other.acquire(0.01) == 0);
+
+      REQUIRE(msw.startWriters(&mine, 0.05) == 0);
+
+      WHEN("chunks are queued faster than they are written, and the app shuts down")
+      {
+         //Each save is 4 chunks, and with one encoder per stream 3 wait on the stream, not the pool.
+         msw.queueSave(0);
+         msw.queueSave(1);
+
+         REQUIRE(msw.appShutdown() == 0);
+
+         THEN("every chunk is written and cataloged")
+         {
+            REQUIRE(msw.scheduler().files() == 8);
+            REQUIRE(msw.scheduler().errors() == 0);
+
+            MagAOX::sys::xrifCatalog cat;
+            REQUIRE(cat.load(dir) == 0);
+            REQUIRE(cat.entries().size() == 8);
+
+            uint64_t framesA = 0, framesB = 0;
+            for(size_t n = 0; n < cat.entries().size(); ++n)
+            {
+               struct stat st;
+               REQUIRE(stat(cat.path(n).c_str(), &st) == 0);
+
+               if(cat.entries()[n].m_stream == "camA") framesA += cat.entries()[n].m_frames;
+               if(cat.entries()[n].m_stream == "camB") framesB += cat.entries()[n].m_frames;
+            }
+
+            REQUIRE(framesA == 8);
+            REQUIRE(framesB == 8);
+
+            for(size_t n = 0; n < cat.entries().size(); ++n) unlink(cat.path(n).c_str());
+         }
+      }
+
+      msw.appShutdown();
+
+      other.close();
+      mine.close();
+      unlink(MagAOX::sys::ioGate::slotPath(dir, 0).c_str());
+      unlink(MagAOX::sys::xrifCatalog::catalogPath(dir).c_str());
+      rmdir(dir.c_str());
+   }
+}
@@ -0,0 +1,85 @@
+/** \file lz4AccelControl.hpp
+  * \brief Adaptive control of the LZ4 acceleration used by the streamWriter.
+  *
+  * \ingroup streamWriter_files
+  */
+
+#ifndef lz4AccelControl_hpp
+#define lz4AccelControl_hpp
+
+namespace MagAOX
+{
+namespace app
+{
+
+/// Chooses the LZ4 acceleration of each chunk from how hard the writer is working.
+/** The load is the time taken to encode and write a chunk over the time taken to acquire it, and the backlog is the
+  * fraction of the circular buffer's headroom which filled while the chunk was written.  If either is above its high
+  * threshold the acceleration is doubled at once, trading ratio for throughput quickly so the writer does not lose
+  * frames.  Only after m_calmChunks chunks in a row with the load below its low threshold, and the backlog below half
+  * of its threshold, is the acceleration halved, so it returns slowly to the best ratio at the minimum.  In between it
+  * is kept.
+  *
+  * \ingroup streamWriter
+  */
+struct lz4AccelControl
+{
+   int m_min {1};   ///< The lowest acceleration, used when the writer keeps up easily.
+   int m_max {64};  ///< The highest acceleration.
+
+   float m_loadHigh {0.7};    ///< The load above which the acceleration is raised.
+   float m_loadLow {0.35};    ///< The load below which the acceleration is lowered.
+   float m_backlogHigh {0.5}; ///< The backlog above which the acceleration is raised.
+
+   int m_calmChunks {4}; ///< The number of calm chunks in a row needed to lower the acceleration.
+
+   int m_accel {1}; ///< The current acceleration.
+
+   int m_calm {0}; ///< The number of calm chunks in a row so far.
+
+   /// Set the limits, and start at the minimum.
+   void reset( int min, ///< [in] the lowest acceleration
+               int max  ///< [in] the highest acceleration
+             )
+   {
+      m_min = min;
+      m_max = (max < min) ? min : max;
+      m_accel = m_min;
+      m_calm = 0;
+   }
+
+   /// Update the acceleration after a chunk.
+   /**
+     * \returns the acceleration for the next chunk
+     */
+   int update( float load,   ///< [in] the time to encode and write the chunk over the time to acquire it
+               float backlog ///< [in] the fraction of the circular buffer headroom used while writing the chunk
+             )
+   {
+      if(load > m_loadHigh || backlog > m_backlogHigh)
+      {
+         m_accel = (m_accel > m_max/2) ? m_max : 2*m_accel;
+         m_calm = 0;
+      }
+      else if(load < m_loadLow && backlog < 0.5*m_backlogHigh)
+      {
+         if(++m_calm >= m_calmChunks)
+         {
+            m_accel /= 2;
+            if(m_accel < m_min) m_accel = m_min;
+            m_calm = 0;
+         }
+      }
+      else
+      {
+         m_calm = 0;
+      }
+
+      return m_accel;
+   }
+};
+
+} //namespace app
+} //namespace MagAOX
+
+#endif //lz4AccelControl_hpp
@@ -10,6 +10,9 @@
 #define streamWriter_hpp
 
 
+#include <atomic>
+#include <mutex>
+
 #include <ImageStruct.h>
 #include <ImageStreamIO.h>
 
@@ -18,9 +21,16 @@
 #include <mx/sys/timeUtils.hpp>
 
 #include "../../libMagAOX/app/MagAOXApp.hpp"
+#include "../../libMagAOX/sys/ioGate.hpp"
+#include "../../libMagAOX/sys/xrifArchive.hpp"
+#include "../../libMagAOX/sys/xrifCatalog.hpp"
+#include "../../libMagAOX/sys/xrifChunkEncoder.hpp"
+#include "../../libMagAOX/sys/xrifPreview.hpp"
 
 #include "../../magaox_git_version.h"
 
+#include "lz4AccelControl.hpp"
+
 
 
 #define NOT_WRITING (0)
@@ -51,11 +61,13 @@ namespace app
   * \ingroup streamWriter
   * 
   */
-class streamWriter : public MagAOXApp<>
+class streamWriter : public MagAOXApp<>, public dev::telemeter<streamWriter>
 {
    //Give the test harness access.
    friend class streamWriter_test;
    
+   friend class dev::telemeter<streamWriter>;
+   
 protected:
 
    /** \name configurable parameters 
@@ -74,7 +86,31 @@ protected:
    
    unsigned m_semWait {500000000}; //The time in nsec to wait on the semaphore.  Max is 999999999. Default is 5e8 nsec.
    
-   int m_lz4accel {1};
+   int m_lz4accel {1}; ///< The LZ4 acceleration parameter.  With adaptive compression, the lowest acceleration used.
+   
+   bool m_adaptive {false}; ///< If true, the LZ4 acceleration of each chunk is chosen from the load and backlog of the writer.  See lz4AccelControl.
+   
+   int m_adaptiveMaxAccel {64}; ///< The highest LZ4 acceleration used with adaptive compression.  Default is 64.
+   
+   float m_adaptiveLoadHigh {0.7}; ///< The load above which adaptive compression raises the acceleration.  Default is 0.7.
+   
+   float m_adaptiveLoadLow {0.35}; ///< The load below which adaptive compression lowers the acceleration.  Default is 0.35.
+   
+   size_t m_subChunkLength {0}; ///< If > 0, each archive is written as sub-chunks of this many frames, with an index, so frames can be read without decoding the whole archive.  See sys::xrifArchive.
+   
+   unsigned m_ioGateSlots {0}; ///< The number of writers which may write to the disk at once.  If 0, the default, the I/O gate is not used.  See sys::ioGate.
+   
+   unsigned m_ioGatePriority {0}; ///< The I/O gate priority of this writer.  Slots above 0 are reserved for the higher priorities.
+   
+   double m_ioGateMaxWait {0.5}; ///< The maximum time to wait for an I/O gate slot, in sec, after which the archive is written anyway.  Shortened in proportion as the circular buffer fills.
+   
+   std::string m_ioGateDir; ///< The directory of the I/O gate slot files, shared by the writers.  Default is the raw images directory.
+   
+   bool m_preview {false}; ///< If true, a preview sidecar is written next to each archive.  See sys::xrifPreview.
+   
+   uint32_t m_previewBin {8}; ///< The binning of the preview thumbnail.  Default is 8.
+   
+   double m_previewSatLevel {0}; ///< The saturation level counted in the preview.  If 0, the default, the maximum of the data type.
    
    ///@}
    
@@ -102,17 +138,17 @@ protected:
    uint64_t m_currSaveStartFrameNo {0}; ///< The frame number of the image at which saving started (for logging)
    uint64_t m_currSaveStopFrameNo {0}; ///< The frame number of the image at which saving stopped (for logging)
    
-   ///The xrif compression handle for image data
-   xrif_t m_xrif {nullptr};
+   std::atomic<uint64_t> m_grabbed {0}; ///< The number of frames the framegrabber has started copying into the circular buffer.
+   uint64_t m_currSaveGrabbed {0}; ///< The value of m_grabbed when the last frame to be saved was copied.
    
-   ///Storage for the xrif image data file header
-   char * m_xrif_header {nullptr};
+   ///Encodes each chunk into an archive in memory, the same as multiStreamWriter's encoders.
+   sys::xrifChunkEncoder m_encoder;
    
-   ///The xrif compression handle for image data
-   xrif_t m_xrif_timing {nullptr};
+   int m_lz4accelCurr {1}; ///< The LZ4 acceleration of the chunk being written.
    
-   ///Storage for the xrif image data file header
-   char * m_xrif_timing_header {nullptr};
+   lz4AccelControl m_accelControl; ///< Chooses the LZ4 acceleration with adaptive compression.
+   
+   sys::ioGate m_ioGate; ///< Limits the number of writers writing to the disk at once.
    
    
 public:
@@ -154,14 +190,6 @@ protected:
    
    static streamWriter * m_selfWriter; ///< Static pointer to this (set in constructor).  Used for getting out of the static SIGSEGV handler.
 
-   /// Initialize the xrif system.
-   /** Allocates the handles and headers pointers.
-     *
-     * \returns 0 on success.
-     * \returns -1 on error.
-     */
-   int initialize_xrif();
-   
    ///Sets the handler for SIGSEGV and SIGBUS
    /** These are caused by ImageStreamIO server resets.
      */
@@ -205,7 +233,7 @@ protected:
      */ 
    int allocate_circbufs();
    
-   /// Worker function to configure and allocate the xrif handles.
+   /// Worker function to allocate the xrif encoder.
    /** This takes place in the fg thread after connecting to the stream.
      * 
      * \returns 0 on sucess.
@@ -257,6 +285,53 @@ protected:
    int doEncode();
    ///@}
    
+   /** \name Preview Thread 
+     * This thread computes the preview of each written chunk while it is still in the circular buffer, and writes it
+     * next to the archive.  It runs at low priority, and the writer never waits for it: if it is still busy when the
+     * next chunk is written that chunk gets no preview.
+     *
+     * @{
+     */ 
+   int m_pvThreadPrio {0}; ///< Priority of the preview thread, should normally be 0, below m_swThreadPrio.
+
+   std::string m_pvCpuset; ///< The cpuset for the preview thread.  Ignored if empty (the default).
+
+   sem_t m_pvSemaphore; ///< Semaphore used to hand chunks from the sw thread to the preview thread.
+   
+   std::thread m_pvThread; ///< A separate thread for the previews
+
+   bool m_pvThreadInit {true}; ///< Synchronizer to ensure preview thread initializes before doing dangerous things.
+   
+   pid_t m_pvThreadID {0}; ///< Preview thread pid.
+ 
+   pcf::IndiProperty m_pvThreadProp; ///< The property to hold the preview thread details.
+   
+   std::atomic<bool> m_pvBusy {false}; ///< True from when a chunk is handed to the preview thread until it is done with it.
+   
+   uint64_t m_pvStart {0}; ///< The circular buffer position of the first frame of the chunk to preview.
+   uint64_t m_pvStop {0}; ///< The circular buffer position after the last frame of the chunk to preview.
+   uint64_t m_pvGrabbed {0}; ///< The value of m_grabbed when the last frame of the chunk to preview was copied.
+   std::string m_pvFname; ///< The archive of the chunk to preview.
+   
+   std::atomic<uint64_t> m_pvSkipped {0}; ///< The number of chunks without a preview, because the preview thread was busy or too slow.
+   
+   sys::xrifPreview m_xrifPreview; ///< The preview, which keeps its buffers between chunks.
+   
+   ///Thread starter, called by pvThreadStart on thread construction.  Calls pvThreadExec.
+   static void pvThreadStart( streamWriter * s /**< [in] a pointer to an streamWriter instance (normally this) */);
+
+   /// Execute the preview main loop.
+   void pvThreadExec();
+   
+   /// Function called when the preview semaphore is raised to compute and write the preview.
+   /**
+     * \returns 0 on success, or if the preview was skipped.
+     * \returns -1 on error.
+     */
+   int doPreview();
+   
+   ///@}
+   
    //INDI:
 protected:
    //declare our properties
@@ -269,6 +344,40 @@ public:
 
    void updateINDI();
    
+   /** \name Telemeter Interface
+     * 
+     * @{
+     */ 
+protected:
+   /// The compression settings and performance of a written chunk, queued by the sw thread for the telemetry.
+   struct xrifCompressRecord
+   {
+      uint64_t m_frameNo {0};
+      int m_lz4accel {0};
+      float m_load {0};
+      float m_backlog {0};
+      float m_ratio {0};
+      float m_encodeRate {0};
+      float m_ioWait {0};
+   };
+   
+   std::mutex m_xrifTelemMutex; ///< Protects m_xrifTelem.
+   
+   std::vector<xrifCompressRecord> m_xrifTelem; ///< The records of chunks written since the last appLogic.
+   
+   xrifCompressRecord m_lastXrifTelem; ///< The last record, repeated when no chunks are written.
+   
+   bool m_haveXrifTelem {false}; ///< Whether any chunk has been recorded.
+   
+public:
+   int checkRecordTimes();
+   
+   int recordTelem( const telem_xrifcompress * );
+   
+   /// Record the chunks written since the last call.
+   int recordXrifCompress();
+   
+   ///@}
 };
 
 //Set self pointer to null so app starts up uninitialized.
@@ -287,15 +396,6 @@ streamWriter::streamWriter() : MagAOXApp(MAGAOX_CURRENT_SHA1, MAGAOX_REPO_MODIFI
 inline
 streamWriter::~streamWriter() noexcept
 {
-   if(m_xrif) xrif_delete(m_xrif);
-   
-   if(m_xrif_header) free(m_xrif_header);
-   
-   if(m_xrif_timing) xrif_delete(m_xrif_timing);
-   
-   if(m_xrif_timing_header) free(m_xrif_timing_header);
-
-   
    return;
 }
 
@@ -314,6 +414,34 @@ void streamWriter::setupConfig()
    
    config.add("writer.lz4accel", "", "writer.lz4accel", argType::Required, "writer", "lz4accel", false, "int", "The LZ4 acceleration parameter.  Larger is faster, but lower compression.");
    
+   config.add("writer.adaptive", "", "writer.adaptive", argType::Required, "writer", "adaptive", false, "bool", "If true, choose the LZ4 acceleration of each chunk from the writer's load and backlog, starting from lz4accel.  Default is false.");
+   
+   config.add("writer.adaptiveMaxAccel", "", "writer.adaptiveMaxAccel", argType::Required, "writer", "adaptiveMaxAccel", false, "int", "The highest LZ4 acceleration used with adaptive compression.  Default is 64.");
+   
+   config.add("writer.adaptiveLoadHigh", "", "writer.adaptiveLoadHigh", argType::Required, "writer", "adaptiveLoadHigh", false, "float", "The load, time to encode and write a chunk over time to acquire it, above which the acceleration is raised.  Default is 0.7.");
+   
+   config.add("writer.adaptiveLoadLow", "", "writer.adaptiveLoadLow", argType::Required, "writer", "adaptiveLoadLow", false, "float", "The load below which the acceleration is lowered.  Default is 0.35.");
+   
+   config.add("writer.subChunkLength", "", "writer.subChunkLength", argType::Required, "writer", "subChunkLength", false, "size_t", "If > 0, write each archive as independently compressed sub-chunks of this many frames, with an index, so a frame can be read by decoding only its sub-chunk.  Smaller is faster to access, but lower compression.  Default is 0, one block per archive.");
+   
+   config.add("ioGate.slots", "", "ioGate.slots", argType::Required, "ioGate", "slots", false, "unsigned", "The number of stream writers which may write to the disk at once, which should be the same for all writers sharing the gate.  Default is 0, no gate.");
+   
+   config.add("ioGate.priority", "", "ioGate.priority", argType::Required, "ioGate", "priority", false, "unsigned", "The priority of this writer.  A writer with priority p may use slots 0 to p, so the higher slots are reserved for the higher priorities.  Default is 0.");
+   
+   config.add("ioGate.maxWait", "", "ioGate.maxWait", argType::Required, "ioGate", "maxWait", false, "double", "The maximum time to wait for a slot, in seconds, after which the archive is written anyway.  The wait is shortened as the circular buffer fills.  Default is 0.5.");
+   
+   config.add("ioGate.dir", "", "ioGate.dir", argType::Required, "ioGate", "dir", false, "string", "The directory of the slot files, shared by the writers.  Default is the raw images directory.");
+   
+   config.add("preview.enable", "", "preview.enable", argType::Required, "preview", "enable", false, "bool", "If true, write a FITS preview next to each archive, with the mean image, a binned thumbnail, and per-frame flux, min, max and saturation.  Default is false.");
+   
+   config.add("preview.bin", "", "preview.bin", argType::Required, "preview", "bin", false, "int", "The binning of the preview thumbnail.  Default is 8.");
+   
+   config.add("preview.satLevel", "", "preview.satLevel", argType::Required, "preview", "satLevel", false, "double", "The saturation level counted in the preview.  Default is the maximum of the data type.");
+   
+   config.add("preview.threadPrio", "", "preview.threadPrio", argType::Required, "preview", "threadPrio", false, "int", "The real-time priority of the preview thread.  Default is 0.");
+   
+   config.add("preview.cpuset", "", "preview.cpuset", argType::Required, "preview", "cpuset", false, "string", "The cpuset for the preview thread.");
+   
    config.add("framegrabber.shmimName", "", "framegrabber.shmimName", argType::Required, "framegrabber", "shmimName", false, "int", "The name of the stream to monitor. From /tmp/shmimName.im.shm.");
    
    config.add("framegrabber.semaphoreNumber", "", "framegrabber.semaphoreNumber", argType::Required, "framegrabber", "semaphoreNumber", false, "int", "The semaphore to wait on. Default is 7.");
@@ -323,6 +451,8 @@ void streamWriter::setupConfig()
    config.add("framegrabber.threadPrio", "", "framegrabber.threadPrio", argType::Required, "framegrabber", "threadPrio", false, "int", "The real-time priority of the framegrabber thread.");
 
    config.add("framegrabber.cpuset", "", "framegrabber.cpuset", argType::Required, "framegrabber", "cpuset", false, "string", "The cpuset for the framegrabber thread.");
+   
+   dev::telemeter<streamWriter>::setupConfig(config);
 }
 
 
@@ -339,6 +469,24 @@ void streamWriter::loadConfig()
    config(m_lz4accel, "writer.lz4accel");
    if(m_lz4accel < XRIF_LZ4_ACCEL_MIN) m_lz4accel = XRIF_LZ4_ACCEL_MIN;
    if(m_lz4accel > XRIF_LZ4_ACCEL_MAX) m_lz4accel = XRIF_LZ4_ACCEL_MAX;
+   config(m_adaptive, "writer.adaptive");
+   config(m_adaptiveMaxAccel, "writer.adaptiveMaxAccel");
+   if(m_adaptiveMaxAccel > XRIF_LZ4_ACCEL_MAX) m_adaptiveMaxAccel = XRIF_LZ4_ACCEL_MAX;
+   config(m_adaptiveLoadHigh, "writer.adaptiveLoadHigh");
+   config(m_adaptiveLoadLow, "writer.adaptiveLoadLow");
+   
+   m_accelControl.reset(m_lz4accel, m_adaptiveMaxAccel);
+   m_accelControl.m_loadHigh = m_adaptiveLoadHigh;
+   m_accelControl.m_loadLow = m_adaptiveLoadLow;
+   m_lz4accelCurr = m_lz4accel;
+   config(m_subChunkLength, "writer.subChunkLength");
+   
+   config(m_preview, "preview.enable");
+   config(m_previewBin, "preview.bin");
+   if(m_previewBin < 1) m_previewBin = 1;
+   config(m_previewSatLevel, "preview.satLevel");
+   config(m_pvThreadPrio, "preview.threadPrio");
+   config(m_pvCpuset, "preview.cpuset");
    
    config(m_shmimName, "framegrabber.shmimName");
    config(m_semaphoreNumber, "framegrabber.semaphoreNumber");
@@ -352,6 +500,14 @@ void streamWriter::loadConfig()
    //Setup default log path
    m_rawimageDir = MagAOXPath + "/" + MAGAOX_rawimageRelPath + "/" + m_shmimName;
    config(m_rawimageDir, "writer.savePath");
+   
+   config(m_ioGateSlots, "ioGate.slots");
+   config(m_ioGatePriority, "ioGate.priority");
+   config(m_ioGateMaxWait, "ioGate.maxWait");
+   m_ioGateDir = MagAOXPath + "/" + MAGAOX_rawimageRelPath;
+   config(m_ioGateDir, "ioGate.dir");
+   
+   dev::telemeter<streamWriter>::loadConfig(config);
 }
 
 
@@ -374,6 +530,15 @@ int streamWriter::appStartup()
 
    }
    
+   if(m_ioGateSlots > 0)
+   {
+      if(m_ioGate.open(m_ioGateDir, m_ioGateSlots, m_ioGatePriority) < 0)
+      {
+         log<software_critical>({__FILE__, __LINE__, errno, 0, "Failed to open the I/O gate in " + m_ioGateDir});
+         return -1;
+      }
+   }
+   
    // set up the  INDI properties
    createStandardIndiToggleSw(m_indiP_writing, "writing");
    registerIndiPropertyNew(m_indiP_writing, INDI_NEWCALLBACK(m_indiP_writing));
@@ -401,24 +566,31 @@ int streamWriter::appStartup()
    
    indi::addNumberElement<float>(m_indiP_xrifStats, "encodeFPS", 0, std::numeric_limits<float>::max(), 0.0, "%0.2f", "Total Encoding Rate [f.p.s.]");
    
+   //The stats change every chunk, so coalesce them.  Starting and stopping still go out immediately as state changes.
+   indiPublishRate(m_indiP_xrifStats);
    
    //Now set up the framegrabber and writer threads.
    // - need SIGSEGV and SIGBUS handling for ImageStreamIO restarts
    // - initialize the semaphore 
    // - start the threads
    
+   if(dev::telemeter<streamWriter>::appStartup() < 0)
+   {
+      return log<software_error,-1>({__FILE__,__LINE__});
+   }
+   
    if(setSigSegvHandler() < 0) return log<software_error, -1>({__FILE__, __LINE__});
    
    if(sem_init(&m_swSemaphore, 0,0) < 0) return log<software_critical, -1>({__FILE__, __LINE__, errno,0, "Initializing S.W. semaphore"});
    
+   if(sem_init(&m_pvSemaphore, 0,0) < 0) return log<software_critical, -1>({__FILE__, __LINE__, errno,0, "Initializing preview semaphore"});
+   
    //Check if we have a safe writeChunkLengthh
    if( m_circBuffLength % m_writeChunkLength != 0)
    {
       return log<software_critical, -1>({__FILE__,__LINE__, "Write chunk length is not a divisor of circular buffer length."});
    }
    
-   if(initialize_xrif() < 0) log<software_critical,-1>({__FILE__, __LINE__});
-   
    if(threadStart( m_fgThread, m_fgThreadInit, m_fgThreadID, m_fgThreadProp, m_fgThreadPrio, m_fgCpuset, "framegrabber", this, fgThreadStart)  < 0)
    {
       return log<software_critical,-1>({__FILE__, __LINE__});
@@ -429,6 +601,14 @@ int streamWriter::appStartup()
       log<software_critical,-1>({__FILE__, __LINE__});
    }
    
+   if(m_preview)
+   {
+      if(threadStart( m_pvThread, m_pvThreadInit, m_pvThreadID, m_pvThreadProp, m_pvThreadPrio, m_pvCpuset, "preview", this, pvThreadStart) < 0)
+      {
+         log<software_critical,-1>({__FILE__, __LINE__});
+      }
+   }
+   
    return 0;
 
 }
@@ -466,6 +646,23 @@ int streamWriter::appLogic()
       return -1;
    }
    
+   if(m_preview)
+   {
+      try 
+      {
+         if(pthread_tryjoin_np(m_pvThread.native_handle(),0) == 0)
+         {
+            log<software_error>({__FILE__, __LINE__, "preview thread has exited"});
+            return -1;
+         }
+      }
+      catch(...)
+      {
+         log<software_error>({__FILE__, __LINE__, "preview thread has exited"});
+         return -1;
+      }
+   }
+   
    switch(m_writing)
    {
       case NOT_WRITING:
@@ -477,6 +674,16 @@ int streamWriter::appLogic()
    
    updateINDI();
    
+   if(recordXrifCompress() < 0)
+   {
+      log<software_error>({__FILE__, __LINE__});
+   }
+   
+   if(telemeter<streamWriter>::appLogic() < 0)
+   {
+      log<software_error>({__FILE__, __LINE__});
+   }
+   
    return 0;
 
 }
@@ -502,66 +709,22 @@ int streamWriter::appShutdown()
    }
    catch(...){}
    
-   if(m_xrif)
-   {
-      xrif_delete(m_xrif);
-      m_xrif=nullptr;
-   }
-   
-   if(m_xrif_timing)
-   {
-      xrif_delete(m_xrif_timing);
-      m_xrif_timing=nullptr;
-   }
-
-   
-   return 0;
-}
-inline
-int streamWriter::initialize_xrif()
-{
-   xrif_error_t rv = xrif_new(&m_xrif);
-   if( rv != XRIF_NOERROR )
-   {
-      return log<software_critical, -1>({__FILE__,__LINE__, 0, rv, "xrif handle allocation or initialization error."});
-   }
-  
-   rv = xrif_configure(m_xrif, XRIF_DIFFERENCE_PREVIOUS, XRIF_REORDER_BYTEPACK, XRIF_COMPRESS_LZ4);
-   if( rv != XRIF_NOERROR )
-   {
-      return log<software_critical, -1>({__FILE__,__LINE__, 0, rv, "xrif handle configuration error."});
-   }
- 
-   errno = 0;
-   m_xrif_header = (char *) malloc( XRIF_HEADER_SIZE * sizeof(char));
-   if(m_xrif_header == NULL)
+   try 
    {
-      return log<software_critical, -1>({__FILE__,__LINE__, errno, 0, "xrif header allocation failed."});
+      if(m_pvThread.joinable())
+      {
+         m_pvThread.join();
+      }
    }
+   catch(...){}
    
-   rv = xrif_new(&m_xrif_timing);
-   if( rv != XRIF_NOERROR )
-   {
-      return log<software_critical, -1>({__FILE__,__LINE__, 0, rv, "xrif handle allocation or initialization error."});
-   }
+   m_encoder.free();
 
-   //m_xrif_timing->reorder_method = XRIF_REORDER_NONE;
-   rv = xrif_configure(m_xrif_timing, XRIF_DIFFERENCE_NONE, XRIF_REORDER_NONE, XRIF_COMPRESS_NONE);
-   if( rv != XRIF_NOERROR )
-   {
-      return log<software_critical, -1>({__FILE__,__LINE__, 0, rv, "xrif handle configuration error."});
-   }
+   dev::telemeter<streamWriter>::appShutdown();
    
-   errno = 0;
-   m_xrif_timing_header = (char *) malloc( XRIF_HEADER_SIZE * sizeof(char));
-   if(m_xrif_timing_header == NULL)
-   {
-      return log<software_critical, -1>({__FILE__,__LINE__, errno, 0, "xrif header allocation failed."});
-   }
    
    return 0;
 }
-
 inline
 int streamWriter::setSigSegvHandler()
 {
@@ -657,55 +820,11 @@ int streamWriter::allocate_circbufs()
 
 inline
 int streamWriter::allocate_xrif()
-{   
-   //Set up the image data xrif handle
-   xrif_error_t rv = xrif_configure(m_xrif, XRIF_DIFFERENCE_PREVIOUS, XRIF_REORDER_BYTEPACK, XRIF_COMPRESS_LZ4);
-   if( rv != XRIF_NOERROR )
-   {
-      return log<software_critical,-1>({__FILE__,__LINE__, 0, rv, "xrif handle configuration error."});
-   }
-   
-   rv = xrif_set_size(m_xrif, m_width, m_height, 1, m_writeChunkLength, m_dataType);
-   if( rv != XRIF_NOERROR )
-   {
-      return log<software_critical,-1>({__FILE__,__LINE__, 0, rv, "xrif_set_size error."});
-   }
-   
-   rv = xrif_allocate_raw(m_xrif);
-   if( rv != XRIF_NOERROR )
-   {
-      return log<software_critical,-1>({__FILE__,__LINE__, 0, rv, "xrif_allocate_raw error."});
-   }
-   
-   rv = xrif_allocate_reordered(m_xrif);
-   if( rv != XRIF_NOERROR )
-   {
-      return log<software_critical,-1>({__FILE__,__LINE__, 0, rv, "xrif_allocate_reordered error."});
-   }
-   
-   //Set up the timing data xrif handle
-   rv = xrif_configure(m_xrif_timing, XRIF_DIFFERENCE_NONE, XRIF_REORDER_NONE, XRIF_COMPRESS_NONE);
-   if( rv != XRIF_NOERROR )
-   {
-      return log<software_critical,-1>({__FILE__,__LINE__, 0, rv, "xrif handle configuration error."});
-   }
-   
-   rv = xrif_set_size(m_xrif_timing, 5,1,1, m_writeChunkLength, XRIF_TYPECODE_UINT64);
-   if( rv != XRIF_NOERROR )
-   {
-      return log<software_critical,-1>({__FILE__,__LINE__, 0, rv, "xrif_set_size error."});
-   }
-   
-   rv = xrif_allocate_raw(m_xrif_timing);      
-   if( rv != XRIF_NOERROR )
-   {
-      return log<software_critical,-1>({__FILE__,__LINE__, 0, rv, "xrif_allocate_raw error."});
-   }
-   
-   rv = xrif_allocate_reordered(m_xrif_timing);
-   if( rv != XRIF_NOERROR )
+{
+   std::string errMsg;
+   if(m_encoder.allocate(errMsg, m_width, m_height, m_dataType, m_writeChunkLength) < 0)
    {
-      return log<software_critical,-1>({__FILE__,__LINE__, 0, rv, "xrif_allocate_reordered error."});
+      return log<software_critical,-1>({__FILE__,__LINE__, 0, 0, "xrif allocation error: " + errMsg});
    }
    
    return 0;
@@ -848,6 +967,9 @@ void streamWriter::fgThreadExec()
             }
             last_cnt0 = image.cntarray[curr_image];
             
+            //Counted before the copy, so the preview thread can tell when its chunk starts to be overwritten.
+            ++m_grabbed;
+            
             char * curr_dest = m_rawImageCircBuff + m_currImage*m_width*m_height*m_typeSize;
             char * curr_src = (char *) image.array.raw + curr_image*m_width*m_height*m_typeSize;
             
@@ -876,6 +998,7 @@ void streamWriter::fgThreadExec()
                      m_currSaveStart = m_currChunkStart;
                      m_currSaveStop = m_nextChunkStart + m_writeChunkLength;
                      m_currSaveStopFrameNo = image.cntarray[curr_image];
+                     m_currSaveGrabbed = m_grabbed;
                   
                      //Now tell the writer to get going
                      if(sem_post(&m_swSemaphore) < 0)
@@ -896,6 +1019,7 @@ void streamWriter::fgThreadExec()
                   m_currSaveStart = m_currChunkStart;
                   m_currSaveStop = m_currImage + 1;
                   m_currSaveStopFrameNo = image.cntarray[curr_image];
+                  m_currSaveGrabbed = m_grabbed;
                   
                   //Now tell the writer to get going
                   if(sem_post(&m_swSemaphore) < 0)
@@ -1073,68 +1197,27 @@ int streamWriter::doEncode()
    
    clock_gettime(CLOCK_REALTIME, &tw0);
    
-   //Configure xrif and copy image data -- this does no allocations
-   int rv = xrif_set_size(m_xrif, m_width, m_height, 1, (m_currSaveStop-m_currSaveStart), m_dataType);
-   if(rv != XRIF_NOERROR)
-   {
-      //This is a big problem.  Report it as "ALERT" and go on.
-      log<software_alert>({__FILE__,__LINE__, 0, rv, "xrif set size error. DATA POSSIBLY LOST"});
-   }
-   
-   rv = xrif_set_lz4_acceleration(m_xrif, m_lz4accel);
-   if(rv != XRIF_NOERROR)
-   {
-      //This may just be out of range, it's only an error.
-      log<software_error>({__FILE__,__LINE__, 0, rv, "xrif set LZ4 acceleration error."});
-   }
-   
-   memcpy(m_xrif->raw_buffer,  m_rawImageCircBuff + m_currSaveStart*m_width*m_height*m_typeSize, (m_currSaveStop-m_currSaveStart)*m_width*m_height*m_typeSize);
-   
-   //Configure xrif and copy timing data -- no allocations
-   rv = xrif_set_size(m_xrif_timing, 5, 1, 1, (m_currSaveStop-m_currSaveStart), XRIF_TYPECODE_UINT64);
-   if(rv != XRIF_NOERROR)
-   {
-      //This is a big problem.  Report it as "ALERT" and go on.
-      log<software_alert>({__FILE__,__LINE__, 0, rv, "xrif set size error. DATA POSSIBLY LOST."});
-   }
-   
-   rv = xrif_set_lz4_acceleration(m_xrif_timing, m_lz4accel);
-   if(rv != XRIF_NOERROR)
-   {
-      //This may just be out of range, it's only an error.
-      log<software_error>({__FILE__,__LINE__, 0, rv, "xrif set LZ4 acceleration error."});
-   }
-   
-   memcpy(m_xrif_timing->raw_buffer, m_timingCircBuff + m_currSaveStart*5, (m_currSaveStop-m_currSaveStart)*5*sizeof(uint64_t));
-   
+   uint64_t nframes = m_currSaveStop-m_currSaveStart;
    
-   rv = xrif_encode(m_xrif);
-   if(rv != XRIF_NOERROR)
+   //The whole archive, with the index of any sub-chunks, is encoded before the file is opened, so the disk is held
+   //only while it is copied.
+   std::string errMsg;
+   if(m_encoder.encode(errMsg, m_rawImageCircBuff + m_currSaveStart*m_width*m_height*m_typeSize, m_timingCircBuff + m_currSaveStart*5,
+                                    nframes, m_lz4accelCurr, m_subChunkLength) < 0)
    {
-      //This is a big problem.  Report it as "ALERT" and go on.
-      log<software_alert>({__FILE__,__LINE__, 0, rv, "xrif encode error. DATA POSSIBLY LOST."});
-   }
-   
-   rv = xrif_write_header( m_xrif_header, m_xrif);
-   if(rv != XRIF_NOERROR)
-   {
-      //This is a big problem.  Report it as "ALERT" and go on.
-      log<software_alert>({__FILE__,__LINE__, 0, rv, "xrif write header error. DATA POSSIBLY LOST."});
-   }
-   
-   rv = xrif_encode(m_xrif_timing);
-   if(rv != XRIF_NOERROR)
-   {
-      //This is a big problem.  Report it as "ALERT" and go on.
-      log<software_alert>({__FILE__,__LINE__, 0, rv, "xrif encode error. DATA POSSIBLY LOST."});
+      //This is a big problem.  Report it as "ALERT" and go on to the next chunk.
+      log<software_alert>({__FILE__,__LINE__, 0, 0, errMsg + ". DATA LOST."});
+      
+      if(m_writing == STOP_WRITING) 
+      {
+         m_writing = NOT_WRITING;
+         log<saving_stop>({0,m_currSaveStopFrameNo});
+      }
+      
+      return 0;
    }
    
-   rv = xrif_write_header( m_xrif_timing_header, m_xrif_timing);
-   if(rv != XRIF_NOERROR)
-   {
-      //This is a big problem.  Report it as "ALERT" and go on.
-      log<software_alert>({__FILE__,__LINE__, 0, rv, "xrif write header error. DATA POSSIBLY LOST"});
-   }
+   uint64_t compressedSize = m_encoder.compressedSize();
    
    //Now break down the acq time of the first image in the buffer for use in file name
    tm uttime;//The broken down time.   
@@ -1147,7 +1230,7 @@ int streamWriter::doEncode()
    }
    
    //Available size = m_fnameSz-m_fnameBase.size(), rather than assuming sizeof("YYYYMMDDHHMMSSNNNNNNNNN"), in case we screwed up somewhere.
-   rv = snprintf(m_fname + m_fnameBase.size(), m_fnameSz-m_fnameBase.size(), "%04i%02i%02i%02i%02i%02i%09i", uttime.tm_year+1900, 
+   int rv = snprintf(m_fname + m_fnameBase.size(), m_fnameSz-m_fnameBase.size(), "%04i%02i%02i%02i%02i%02i%09i", uttime.tm_year+1900, 
                             uttime.tm_mon+1, uttime.tm_mday, uttime.tm_hour, uttime.tm_min, uttime.tm_sec, static_cast<int>(fts->tv_nsec));
    
    if(rv != sizeof("YYYYMMDDHHMMSSNNNNNNNNN")-1) 
@@ -1159,8 +1242,6 @@ int streamWriter::doEncode()
    //Cover up the \0 inserted by snprintf
    (m_fname + m_fnameBase.size())[23] = '.';
    
-   clock_gettime(CLOCK_REALTIME, &tw1);
-   
    FILE * fp_xrif = fopen(m_fname, "wb");
    if(fp_xrif == NULL)
    {
@@ -1173,42 +1254,114 @@ int streamWriter::doEncode()
       return -1; //will trigger a shutdown
    }
    
-   size_t bw = fwrite(m_xrif_header, sizeof(uint8_t), XRIF_HEADER_SIZE, fp_xrif);
+   clock_gettime(CLOCK_REALTIME, &tw1);
    
-   if(bw != XRIF_HEADER_SIZE)
+   //Wait for a turn at the disk, so that the writers sharing it write archives in turn instead of interleaving them.
+   //The wait is cut short as the circular buffer fills, since then losing frames is worse than contending for the disk.
+   double gateWait = m_ioGateMaxWait;
+   if(m_circBuffLength > nframes) 
    {
-      log<software_alert>({__FILE__,__LINE__,errno, 0,"failure writing header to file.  DATA LOSS LIKELY. bytes = " + std::to_string(bw)}); 
-      //We go on . . .
+      double backlog = ((double) (m_grabbed - m_currSaveGrabbed))/(m_circBuffLength - nframes);
+      gateWait *= std::max(0.0, 1.0 - backlog);
    }
    
-   bw = fwrite(m_xrif->raw_buffer, sizeof(uint8_t), m_xrif->compressed_size, fp_xrif);
+   timespec tg;
+   if(m_ioGate.acquire(gateWait) < 0)
+   {
+      log<software_error>({__FILE__,__LINE__,errno,0,"I/O gate error, writing anyway"}); 
+   }
+   clock_gettime(CLOCK_REALTIME, &tg);
    
-   if(bw != m_xrif->compressed_size)
+   if(m_encoder.write(fp_xrif) < 0)
    {
-      log<software_alert>({__FILE__,__LINE__,errno,0,"failure writing data to file.  DATA LOSS LIKELY. bytes = " + std::to_string(bw)}); 
+      log<software_alert>({__FILE__,__LINE__,errno,0,"failure writing archive to file.  DATA LOSS LIKELY. bytes = " + std::to_string(m_encoder.size())}); 
+      //We go on . . .
    }
    
-   bw = fwrite(m_xrif_timing_header, sizeof(uint8_t), XRIF_HEADER_SIZE, fp_xrif);
+   //Closing flushes the last of the archive, so it is done before the gate is released.
+   fclose(fp_xrif);
+   
+   m_ioGate.release();
+   
+   //Add the archive to the directory's catalog.  Failure here only costs a rebuild, so it's just an error.
+   char * fnameSlash = strrchr(m_fname, '/');
+   std::string catDir = (fnameSlash == nullptr) ? std::string(".") : std::string(m_fname, fnameSlash - m_fname);
    
-   if(bw != XRIF_HEADER_SIZE)
+   sys::xrifCatalogEntry catEntry;
+   catEntry.m_file = (fnameSlash == nullptr) ? m_fname : fnameSlash + 1;
+   catEntry.m_stream = m_shmimName;
+   catEntry.m_width = m_width;
+   catEntry.m_height = m_height;
+   catEntry.m_typeCode = m_dataType;
+   catEntry.m_compressedSize = compressedSize;
+   catEntry.m_rawSize = nframes*m_width*m_height*m_typeSize;
+   catEntry.timing(m_timingCircBuff + m_currSaveStart*5, nframes);
+   
+   if(sys::xrifCatalog::append(catDir, catEntry) < 0)
    {
-      log<software_alert>({__FILE__,__LINE__,errno, 0,"failure writing timing header to file.  DATA LOSS LIKELY.  bytes = " + std::to_string(bw)}); 
+      log<software_error>({__FILE__,__LINE__,errno, 0,"failed to add " + catEntry.m_file + " to the xrif catalog"}); 
+   }
+   
+   //Hand the chunk to the preview thread, unless it is still busy with the last one.  The writer never waits for it.
+   if(m_preview)
+   {
+      if(m_pvBusy)
+      {
+         uint64_t skipped = ++m_pvSkipped;
+         log<text_log>("preview thread busy, no preview for " + catEntry.m_file + " (" + std::to_string(skipped) + " skipped)", logPrio::LOG_WARNING);
+      }
+      else
+      {
+         m_pvStart = m_currSaveStart;
+         m_pvStop = m_currSaveStop;
+         m_pvGrabbed = m_currSaveGrabbed;
+         m_pvFname = m_fname;
+         m_pvBusy = true;
+         
+         if(sem_post(&m_pvSemaphore) < 0)
+         {
+            log<software_error>({__FILE__, __LINE__, errno, 0, "Error posting to preview semaphore"});
+            m_pvBusy = false;
+         }
+      }
    }
    
-   bw = fwrite(m_xrif_timing->raw_buffer, sizeof(uint8_t), m_xrif_timing->compressed_size, fp_xrif);
+   clock_gettime(CLOCK_REALTIME, &tw2);
+   
+   //The load is the time to encode and write over the time to acquire, and the backlog the fraction of the circular
+   //buffer headroom the framegrabber used meanwhile.  Both are queued for the telemetry, with the acceleration used.
+   xrifCompressRecord rec;
+   uint64_t * firstTiming = m_timingCircBuff + m_currSaveStart*5;
+   rec.m_frameNo = firstTiming[0];
+   rec.m_lz4accel = m_lz4accelCurr;
+   
+   uint64_t * lastTiming = m_timingCircBuff + (m_currSaveStop-1)*5;
+   double span = ((double) lastTiming[1] - (double) firstTiming[1]) + ((double) lastTiming[2] - (double) firstTiming[2])/1e9;
+   
+   //Time waiting for the gate is left out of the load, as compressing faster only makes more to write.
+   rec.m_ioWait = ( (double) tg.tv_sec + ((double) tg.tv_nsec)/1e9) - ( (double) tw1.tv_sec + ((double) tw1.tv_nsec)/1e9);
    
-   if(bw != m_xrif_timing->compressed_size)
+   if(nframes > 1 && span > 0)
    {
-      log<software_alert>({__FILE__,__LINE__,errno,0,"failure writing timing data to file. DATA LOSS LIKELY. bytes = " + std::to_string(bw)}); 
+      double et = ( (double) tw2.tv_sec + ((double) tw2.tv_nsec)/1e9) - ( (double) tw0.tv_sec + ((double) tw0.tv_nsec)/1e9);
+      rec.m_load = (et - rec.m_ioWait) / (span*nframes/(nframes-1));
    }
    
-   fclose(fp_xrif);
+   if(m_circBuffLength > nframes) rec.m_backlog = ((double) (m_grabbed - m_currSaveGrabbed))/(m_circBuffLength - nframes);
    
-   clock_gettime(CLOCK_REALTIME, &tw2);
+   if(catEntry.m_rawSize > 0) rec.m_ratio = ((double) compressedSize)/catEntry.m_rawSize;
+   rec.m_encodeRate = m_encoder.encodeRate()/1048576.0;
    
-   double wt = ( (double) tw2.tv_sec + ((double) tw2.tv_nsec)/1e9) - ( (double) tw1.tv_sec + ((double) tw1.tv_nsec)/1e9);
+   //Favor ratio while the writer keeps up, and throughput when it falls behind.
+   if(m_adaptive && rec.m_load > 0)
+   {
+      m_lz4accelCurr = m_accelControl.update(rec.m_load, rec.m_backlog);
+   }
    
-   std::cerr << wt << "\n";
+   {
+      std::lock_guard<std::mutex> guard(m_xrifTelemMutex);
+      m_xrifTelem.push_back(rec);
+   }
    
    if(m_writing == STOP_WRITING) 
    {
@@ -1219,6 +1372,95 @@ int streamWriter::doEncode()
    return 0;
 }
 
+inline
+void streamWriter::pvThreadStart( streamWriter * s)
+{
+   s->pvThreadExec();
+}
+
+inline
+void streamWriter::pvThreadExec()
+{
+   m_pvThreadID = syscall(SYS_gettid);
+
+   //Wait fpr the thread starter to finish initializing this thread.
+   while(m_pvThreadInit == true && m_shutdown == 0)
+   {
+       sleep(1);
+   }
+   
+   while(!m_shutdown)
+   {
+      timespec ts;
+       
+      if(clock_gettime(CLOCK_REALTIME, &ts) < 0)
+      {
+         log<software_critical>({__FILE__,__LINE__,errno,0,"clock_gettime"}); 
+         return; //will trigger a shutdown
+      }
+       
+      mx::sys::timespecAddNsec(ts, m_semWait);
+      
+      if(sem_timedwait(&m_pvSemaphore, &ts) == 0)
+      {
+         int rv = doPreview();
+         m_pvBusy = false;
+         
+         if(rv < 0) return;
+      }
+      else
+      {
+         //Check for why we timed out
+         if(errno == EINTR) continue; //This will probably indicate time to shutdown, loop will exit normally if flags set.
+          
+         //ETIMEDOUT just means we should wait more.
+         //Otherwise, report an error.
+         if(errno != ETIMEDOUT)
+         {
+            log<software_error>({__FILE__, __LINE__,errno, "sem_timedwait"});
+            break;
+         }
+      }
+   }
+}
+
+inline
+int streamWriter::doPreview()
+{
+   uint64_t nframes = m_pvStop - m_pvStart;
+   
+   double satLevel = m_previewSatLevel;
+   if(satLevel <= 0) satLevel = sys::xrifPreview::defaultSatLevel(m_dataType);
+   
+   const char * pvFile = strrchr(m_pvFname.c_str(), '/');
+   pvFile = (pvFile == nullptr) ? m_pvFname.c_str() : pvFile + 1;
+   
+   if(m_xrifPreview.compute( m_rawImageCircBuff + m_pvStart*m_width*m_height*m_typeSize, m_timingCircBuff + m_pvStart*5, 
+                             m_width, m_height, m_dataType, nframes, m_previewBin, satLevel) < 0)
+   {
+      log<software_error>({__FILE__, __LINE__, "preview not supported for data type " + std::to_string(m_dataType)});
+      return 0;
+   }
+   
+   //The first frame of the chunk is overwritten by the circBuffLength-th frame after it.  If the framegrabber has
+   //started copying that frame, the preview may be of newer frames, so it is dropped.
+   std::atomic_thread_fence(std::memory_order_acquire);
+   if(m_grabbed.load(std::memory_order_relaxed) > m_pvGrabbed - nframes + m_circBuffLength)
+   {
+      uint64_t skipped = ++m_pvSkipped;
+      log<text_log>(std::string("preview too slow, chunk overwritten, no preview for ") + pvFile + " (" + std::to_string(skipped) + " skipped)", logPrio::LOG_WARNING);
+      return 0;
+   }
+   
+   std::string errMsg;
+   if(m_xrifPreview.write(errMsg, sys::xrifPreview::sidecarPath(m_pvFname), pvFile) < 0)
+   {
+      log<software_error>({__FILE__, __LINE__, "failed to write preview for " + std::string(pvFile) + ": " + errMsg});
+   }
+   
+   return 0;
+}
+
 INDI_NEWCALLBACK_DEFN(streamWriter, m_indiP_writing)(const pcf::IndiProperty &ipRecv)
 {
    if(ipRecv.getName() != m_indiP_writing.getName())
@@ -1247,41 +1489,80 @@ void streamWriter::updateINDI()
    //Only update this if not changing
    if(m_writing == NOT_WRITING || m_writing == WRITING)
    {
-      if(m_xrif && m_writing == WRITING)
+      if(m_encoder.allocated() && m_writing == WRITING)
       {
          indi::updateSwitchIfChanged(m_indiP_writing, "toggle", pcf::IndiElement::On, m_indiDriver, INDI_OK);
          
-         indi::updateIfChanged(m_indiP_xrifStats, "ratio", m_xrif->compression_ratio, m_indiDriver, INDI_BUSY);
+         updateIfChanged(m_indiP_xrifStats, "ratio", m_encoder.ratio(), INDI_BUSY);
          
-         indi::updateIfChanged(m_indiP_xrifStats, "encodeMBsec", m_xrif->encode_rate/1048576.0, m_indiDriver, INDI_BUSY);
-         indi::updateIfChanged(m_indiP_xrifStats, "encodeFPS", m_xrif->encode_rate/(m_width*m_height*m_typeSize), m_indiDriver, INDI_BUSY);
+         updateIfChanged(m_indiP_xrifStats, "encodeMBsec", m_encoder.encodeRate()/1048576.0, INDI_BUSY);
+         updateIfChanged(m_indiP_xrifStats, "encodeFPS", m_encoder.encodeRate()/(m_width*m_height*m_typeSize), INDI_BUSY);
          
-         indi::updateIfChanged(m_indiP_xrifStats, "differenceMBsec", m_xrif->difference_rate/1048576.0, m_indiDriver, INDI_BUSY);
-         indi::updateIfChanged(m_indiP_xrifStats, "differenceFPS", m_xrif->difference_rate/(m_width*m_height*m_typeSize), m_indiDriver, INDI_BUSY);
+         updateIfChanged(m_indiP_xrifStats, "differenceMBsec", m_encoder.differenceRate()/1048576.0, INDI_BUSY);
+         updateIfChanged(m_indiP_xrifStats, "differenceFPS", m_encoder.differenceRate()/(m_width*m_height*m_typeSize), INDI_BUSY);
          
-         indi::updateIfChanged(m_indiP_xrifStats, "reorderMBsec", m_xrif->reorder_rate/1048576.0, m_indiDriver, INDI_BUSY);
-         indi::updateIfChanged(m_indiP_xrifStats, "reorderFPS", m_xrif->reorder_rate/(m_width*m_height*m_typeSize), m_indiDriver, INDI_BUSY);
+         updateIfChanged(m_indiP_xrifStats, "reorderMBsec", m_encoder.reorderRate()/1048576.0, INDI_BUSY);
+         updateIfChanged(m_indiP_xrifStats, "reorderFPS", m_encoder.reorderRate()/(m_width*m_height*m_typeSize), INDI_BUSY);
 
-         indi::updateIfChanged(m_indiP_xrifStats, "compressMBsec", m_xrif->compress_rate/1048576.0, m_indiDriver, INDI_BUSY);
-         indi::updateIfChanged(m_indiP_xrifStats, "compressFPS", m_xrif->compress_rate/(m_width*m_height*m_typeSize), m_indiDriver, INDI_BUSY);
+         updateIfChanged(m_indiP_xrifStats, "compressMBsec", m_encoder.compressRate()/1048576.0, INDI_BUSY);
+         updateIfChanged(m_indiP_xrifStats, "compressFPS", m_encoder.compressRate()/(m_width*m_height*m_typeSize), INDI_BUSY);
       }
       else
       {
          indi::updateSwitchIfChanged(m_indiP_writing, "toggle", pcf::IndiElement::Off, m_indiDriver, INDI_OK);
          
-         indi::updateIfChanged(m_indiP_xrifStats, "ratio", 0.0, m_indiDriver, INDI_IDLE);
-         indi::updateIfChanged(m_indiP_xrifStats, "encodeMBsec", 0.0, m_indiDriver, INDI_IDLE);
-         indi::updateIfChanged(m_indiP_xrifStats, "encodeFPS", 0.0, m_indiDriver, INDI_IDLE);
-         indi::updateIfChanged(m_indiP_xrifStats, "differenceMBsec", 0.0, m_indiDriver, INDI_IDLE);
-         indi::updateIfChanged(m_indiP_xrifStats, "differenceFPS", 0.0, m_indiDriver, INDI_IDLE);
-         indi::updateIfChanged(m_indiP_xrifStats, "reorderMBsec", 0.0, m_indiDriver, INDI_IDLE);
-         indi::updateIfChanged(m_indiP_xrifStats, "reorderFPS", 0.0, m_indiDriver, INDI_IDLE);
-         indi::updateIfChanged(m_indiP_xrifStats, "compressMBsec", 0.0, m_indiDriver, INDI_IDLE);
-         indi::updateIfChanged(m_indiP_xrifStats, "compressFPS", 0.0, m_indiDriver, INDI_IDLE);
+         updateIfChanged(m_indiP_xrifStats, "ratio", 0.0, INDI_IDLE);
+         updateIfChanged(m_indiP_xrifStats, "encodeMBsec", 0.0, INDI_IDLE);
+         updateIfChanged(m_indiP_xrifStats, "encodeFPS", 0.0, INDI_IDLE);
+         updateIfChanged(m_indiP_xrifStats, "differenceMBsec", 0.0, INDI_IDLE);
+         updateIfChanged(m_indiP_xrifStats, "differenceFPS", 0.0, INDI_IDLE);
+         updateIfChanged(m_indiP_xrifStats, "reorderMBsec", 0.0, INDI_IDLE);
+         updateIfChanged(m_indiP_xrifStats, "reorderFPS", 0.0, INDI_IDLE);
+         updateIfChanged(m_indiP_xrifStats, "compressMBsec", 0.0, INDI_IDLE);
+         updateIfChanged(m_indiP_xrifStats, "compressFPS", 0.0, INDI_IDLE);
       }
    }
 }
 
+inline
+int streamWriter::checkRecordTimes()
+{
+   return telemeter<streamWriter>::checkRecordTimes(telem_xrifcompress());
+}
+
+inline
+int streamWriter::recordTelem( const telem_xrifcompress * )
+{
+   if(!m_haveXrifTelem) return 0;
+   
+   telem<telem_xrifcompress>({m_lastXrifTelem.m_frameNo, m_adaptive, m_lastXrifTelem.m_lz4accel, m_lastXrifTelem.m_load, m_lastXrifTelem.m_backlog, 
+                                  m_lastXrifTelem.m_ratio, m_lastXrifTelem.m_encodeRate, m_lastXrifTelem.m_ioWait});
+   
+   return 0;
+}
+
+inline
+int streamWriter::recordXrifCompress()
+{
+   std::vector<xrifCompressRecord> recs;
+   
+   {
+      std::lock_guard<std::mutex> guard(m_xrifTelemMutex);
+      recs.swap(m_xrifTelem);
+   }
+   
+   //Every chunk is recorded, so each archive's settings can be audited.
+   for(size_t n = 0; n < recs.size(); ++n)
+   {
+      m_lastXrifTelem = recs[n];
+      m_haveXrifTelem = true;
+      
+      recordTelem( (telem_xrifcompress *) nullptr);
+   }
+   
+   return 0;
+}
+
 }//namespace app
 } //namespace MagAOX
 #endif
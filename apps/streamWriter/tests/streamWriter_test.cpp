@@ -42,10 +42,15 @@ struct streamWriter_test
    {
       m_sw->m_writeChunkLength = writeChunkLength;
     
-      m_sw->initialize_xrif();
       return m_sw->allocate_xrif();
    }
    
+   //Sets m_subChunkLength, so archives are written as sub-chunks
+   void setup_subChunks( size_t subChunkLength )
+   {
+      m_sw->m_subChunkLength = subChunkLength;
+   }
+   
    //Allocates and populates the filename buffer
    int setup_fname()
    {
@@ -186,6 +191,64 @@ struct streamWriter_test
       return rv;
    }
    
+   //Read frames of an archive of sub-chunks back in, with random access, and compare the results.
+   int comp_subchunk_frames_uint16( size_t start, //the first frame written
+                                    size_t first, //the first frame to read, relative to start
+                                    size_t count  //the number of frames to read
+                                  )
+   {
+      std::cout << "Reading: " << m_sw->m_fname << "\n";
+
+      MagAOX::sys::xrifArchive archive;
+      std::string errMsg;
+      
+      if(archive.open(errMsg, m_sw->m_fname) < 0)
+      {
+         std::cerr << errMsg << "\n";
+         return -1;
+      }
+      
+      if(archive.subChunkLength() != m_sw->m_subChunkLength)
+      {
+         std::cerr << "sub-chunk length mismatch\n";
+         return -1;
+      }
+      
+      size_t frameSize = m_sw->m_width*m_sw->m_height*m_sw->m_typeSize;
+      
+      std::vector<char> image(count*frameSize);
+      std::vector<uint64_t> timing(5*count);
+      
+      if(archive.read(errMsg, image.data(), timing.data(), first, count) < 0)
+      {
+         std::cerr << errMsg << "\n";
+         return -1;
+      }
+      
+      int badpix = 0;
+      for(size_t n=0; n< count*frameSize; ++n)
+      {
+         if( m_sw->m_rawImageCircBuff[(start+first)*frameSize + n] != image[n] ) ++badpix;
+      }
+      
+      if(badpix > 0)
+      {
+         std::cerr << "Buffers don't match: " << badpix << " bad pixels.\n";
+         return -1;
+      }
+      
+      for(size_t n=0; n < 5*count; ++n)
+      {
+         if( m_sw->m_timingCircBuff[5*(start+first) + n] != timing[n] )
+         {
+            std::cerr << "Timing doesn't match.\n";
+            return -1;
+         }
+      }
+      
+      return 0;
+   }
+   
 };
 }
 }
@@ -274,5 +337,91 @@ SCENARIO( "streamWriter encoding data", "[streamWriter]" )
          
          REQUIRE(sw_test.comp_frames_uint16(5,8) == 0);
       }
+      
+      WHEN("writing a full chunk as sub-chunks, and reading frames from the middle")
+      {
+         int circBuffLength = 10;
+         int writeChunkLength = 5;
+         REQUIRE(sw_test.setup_circbufs(120, 120, XRIF_TYPECODE_UINT16, circBuffLength) == 0);
+         REQUIRE(sw_test.setup_xrif(writeChunkLength) == 0);
+         REQUIRE(sw_test.setup_fname() == 0);
+         sw_test.setup_subChunks(2);
+         
+         REQUIRE(sw_test.fill_circbuf_uint16() == 0);
+         
+         REQUIRE(sw_test.write_frames(5,10) == 0);
+         
+         REQUIRE(sw_test.comp_subchunk_frames_uint16(5,0,5) == 0);
+         REQUIRE(sw_test.comp_subchunk_frames_uint16(5,1,2) == 0);
+         REQUIRE(sw_test.comp_subchunk_frames_uint16(5,4,1) == 0);
+      }
+   }
+}
+
+SCENARIO( "streamWriter adaptive compression", "[streamWriter]" ) 
+{
+   GIVEN("an acceleration control from 1 to 16")
+   {
+      MagAOX::app::lz4AccelControl ac;
+      ac.reset(1,16);
+      
+      REQUIRE(ac.m_accel == 1);
+      
+      WHEN("the writer falls behind")
+      {
+         REQUIRE(ac.update(0.9, 0) == 2);
+         REQUIRE(ac.update(0.5, 0.6) == 4);
+         REQUIRE(ac.update(0.9, 0) == 8);
+         REQUIRE(ac.update(0.9, 0) == 16);
+         REQUIRE(ac.update(0.9, 0) == 16);
+      }
+      
+      WHEN("the writer keeps up")
+      {
+         REQUIRE(ac.update(0.9, 0) == 2);
+         REQUIRE(ac.update(0.9, 0) == 4);
+         
+         //In between thresholds is held
+         REQUIRE(ac.update(0.5, 0) == 4);
+         REQUIRE(ac.update(0.2, 0.3) == 4);
+         
+         //It comes down one step per 4 calm chunks in a row
+         REQUIRE(ac.update(0.2, 0) == 4);
+         REQUIRE(ac.update(0.2, 0) == 4);
+         REQUIRE(ac.update(0.2, 0) == 4);
+         REQUIRE(ac.update(0.2, 0) == 2);
+
+         REQUIRE(ac.update(0.2, 0) == 2);
+         REQUIRE(ac.update(0.2, 0) == 2);
+         REQUIRE(ac.update(0.2, 0) == 2);
+         REQUIRE(ac.update(0.2, 0) == 1);
+
+         for(int n = 0; n < 8; ++n) REQUIRE(ac.update(0.2, 0) == 1);
+      }
+
+      WHEN("the writer is calm, but not for long enough")
+      {
+         REQUIRE(ac.update(0.9, 0) == 2);
+
+         REQUIRE(ac.update(0.2, 0) == 2);
+         REQUIRE(ac.update(0.2, 0) == 2);
+         REQUIRE(ac.update(0.2, 0) == 2);
+
+         //A chunk in between thresholds starts the count again
+         REQUIRE(ac.update(0.5, 0) == 2);
+         REQUIRE(ac.update(0.2, 0) == 2);
+         REQUIRE(ac.update(0.2, 0) == 2);
+         REQUIRE(ac.update(0.2, 0) == 2);
+         REQUIRE(ac.update(0.2, 0) == 1);
+      }
+   }
+   
+   GIVEN("a maximum below the minimum")
+   {
+      MagAOX::app::lz4AccelControl ac;
+      ac.reset(4,2);
+      
+      REQUIRE(ac.update(0.9, 0) == 4);
+      for(int n = 0; n < 4; ++n) REQUIRE(ac.update(0.1, 0) == 4);
    }
 }
@@ -135,6 +135,11 @@ protected:
 
    std::mutex m_modeBlockMutex;
 
+   sys::fileWatcher m_calibWatcher; ///< Watches the calibration directory for changes to the mode block files.
+   int m_blockWatch {-1}; ///< The id of the mode block watch.
+   std::string m_blockWatchDir; ///< The directory of the mode block watch, which follows m_aoCalDir.
+   uint64_t m_blockGeneration {0}; ///< The generation of the mode block index last read by getModeBlocks.
+
 public:
    /// Default c'tor.
    userGainCtrl();
@@ -350,6 +355,11 @@ int userGainCtrl::appStartup()
    {
       return log<software_error,-1>({__FILE__, __LINE__});
    }
+
+   if(m_calibWatcher.start() < 0)
+   {
+      return log<software_error,-1>({__FILE__, __LINE__, "could not start calibration watcher"});
+   }
   
    state(stateCodes::OPERATING);
     
@@ -432,6 +442,8 @@ int userGainCtrl::appShutdown()
    mcShmimMonitorT::appShutdown();
    limitShmimMonitorT::appShutdown();
 
+   m_calibWatcher.stop();
+
    return 0;
 }
 
@@ -491,8 +503,23 @@ int userGainCtrl::getAOCalib()
 inline
 int userGainCtrl::getModeBlocks()
 {
+   //A new calibration can be in a new directory
+   if(m_blockWatch < 0 || m_blockWatchDir != m_aoCalDir)
+   {
+      if(m_blockWatch >= 0) m_calibWatcher.removeWatch(m_blockWatch);
 
-   std::vector<std::string> blocks = mx::ioutils::getFileNames(m_aoCalDir, "aol" + std::to_string(m_loopNumber) + "_block", "_NBmodes", ".txt");
+      m_blockWatch = m_calibWatcher.addWatch(m_aoCalDir, "aol" + std::to_string(m_loopNumber) + "_block", "_NBmodes", ".txt");
+      m_blockWatchDir = m_aoCalDir;
+      m_blockGeneration = 0;
+   }
+
+   uint64_t generation = m_blockGeneration;
+   if(!m_calibWatcher.changed(m_blockWatch, generation))
+   {
+      return 0;
+   }
+
+   std::vector<std::string> blocks = m_calibWatcher.files(m_blockWatch);
 
    if(blocks.size() == 0)
    {
@@ -533,6 +560,9 @@ int userGainCtrl::getModeBlocks()
       }
    }
 
+   //Only now, so that a failed read is tried again
+   m_blockGeneration = generation;
+
    //now detect changes.
    bool changed = false;
    if(m_modeBlockStart.size() != Nb || m_modeBlockN.size() != Nb || m_modeBlockGains.size() != Nb || m_modeBlockMCs.size() != Nb || m_modeBlockLims.size() != Nb)
@@ -66,6 +66,13 @@ pwrGUI::~pwrGUI() noexcept
 //    //m_parent->sendGetProperties( ipSend );
 // }
 
+void pwrGUI::subscribe()
+{
+   if(m_parent == nullptr) return;
+
+   m_parent->addSubscriberAllProperties(this);
+}
+
 void pwrGUI::pwrGUI::onDisconnect()
 {
    QLayoutItem *child;
@@ -39,6 +39,8 @@ public:
    
    virtual ~pwrGUI() noexcept;
    
+   /// Subscribes to all properties, since the power devices are discovered from their definitions.
+   virtual void subscribe();
       
    virtual void onDisconnect();
    
@@ -3,6 +3,7 @@
 
 #include <unordered_map>
 #include <set>
+#include <mutex>
 
 #include "../../INDI/libcommon/IndiClient.hpp"
 
@@ -22,6 +23,19 @@
   * Subscribers, instances of classes derived from multiIndiSubscriber, register
   * callbacks to be notified when a specific property is changed.
   * 
+  * The publisher only asks the server for the properties its subscribers have
+  * registered, with one exact `getProperties` per unique `device.name` key no matter
+  * how many subscribers share it.  indiserver then only forwards those properties to
+  * this client, so bandwidth and CPU scale with what is displayed rather than with
+  * the size of the system.  A broad `getProperties` is only sent if a subscriber
+  * asks for all properties with addSubscriberAllProperties.
+  * 
+  * Since the server answers a `getProperties` only once, the last def and set received
+  * for each key are cached.  A subscriber added to a key which was already requested
+  * gets the cached def and set replayed to it, just as if it had sent its own `getProperties`.
+  * 
+  * The handlers run on the client thread while subscriptions are made from the GUI thread,
+  * so the subscriber maps and the cache are protected by a mutex.
   */ 
 class multiIndiPublisher : public pcf::IndiClient, public multiIndiSubscriber
 {
@@ -30,6 +44,20 @@ protected:
    
    std::string m_hostAddress;
    std::string m_hostPort;
+
+   /// Protects the subscriber maps and the cache.  Recursive so a handler may subscribe.
+   std::recursive_mutex m_subMutex;
+
+   /// The last def received for each `device.name` key.
+   std::unordered_map<std::string, pcf::IndiProperty> m_lastDef;
+
+   /// The last set received for each `device.name` key, cleared when the property is re-defined.
+   std::unordered_map<std::string, pcf::IndiProperty> m_lastSet;
+
+   /// Replay the cached def and set for a key to one subscriber.
+   void replay( multiIndiSubscriber * sub, ///< [in] the subscriber to replay to
+                const std::string & key    ///< [in] the `device.name` key to replay
+              );
    
 public:
 
@@ -43,7 +71,8 @@ public:
    
 
    /// Subscribes the given instance of multiIndiSubscriber for notifications on the given property.
-   /**
+   /** The first subscriber to a key sends a getProperties, later ones get the cached def and set replayed.
+     *
      * \returns 0 on success.
      * \returns -1 on error.
      */ 
@@ -64,13 +93,36 @@ public:
    }
 
 
-   virtual void handleDefProperty( const pcf::IndiProperty &ipRecv );
+   /// Subscribes the given instance of multiIndiSubscriber for notifications on all properties.
+   /** The first such subscription sends a broad getProperties to the server, later ones
+     * get every cached def and set replayed.
+     *
+     * \returns 0 on success.
+     * \returns -1 on error.
+     */
+   virtual int addSubscriberAllProperties( multiIndiSubscriber * sub /**< [in] pointer to the subscriber */);
+
+   /// Remove all subscriptions for this subscriber, under the mutex.
+   virtual void unsubscribe( multiIndiSubscriber * sub /**< [in] the subscriber being un-subscribed*/);
+
+   /// Responds to DEF PROPERTY
+   /** Caches the def, then calls the handleDefProperty callback for any subscribers registered on the property, and
+     * for subscribers to all properties.
+     */
+   virtual void handleDefProperty( const pcf::IndiProperty &ipRecv /**< [in] the INDI property which was defined */);
    
    /// Responds to SET PROPERTY
    /** This is the implementation of the pcf::IndiClient interface function.
-     * Calls the handleSetProperty callback for any subscribers registered on the property.
+     * Caches the set, then calls the handleSetProperty callback for any subscribers registered on the property, and
+     * for subscribers to all properties.
      */ 
    virtual void handleSetProperty( const pcf::IndiProperty &ipRecv /**< [in] the INDI property which has changed */);
+
+   /// Responds to DEL PROPERTY
+   /** Drops the property, or all of the device's properties if no name is given, from the cache
+     * so it is not replayed to later subscribers.
+     */
+   virtual void handleDelProperty( const pcf::IndiProperty &ipRecv /**< [in] the INDI property which was deleted */);
    
    /// Implementation of the pcf::IndiClient interface, called by activate to actually beging the INDI event loop.
    /** 
@@ -78,10 +130,11 @@ public:
    void execute();
    
    /// Called once the parent is connected.
+   /** The subscriptions were already sent to the server as they were added, so this
+     * only notifies the subscribers.
+     */
    virtual void onConnect()
    {
-      pcf::IndiProperty ipSend;
-      sendGetProperties( ipSend );  
       multiIndiSubscriber::onConnect(); 
    }
 
@@ -97,51 +150,159 @@ multiIndiPublisher::multiIndiPublisher( const std::string & clientName,
                                         const int hostPort
                                       ) : pcf::IndiClient( clientName, MULTI_INDI_CLIENT_VERSION, MULTI_INDI_PROTO_VERSION, hostAddress, hostPort)
 {
-   pcf::IndiProperty ipSend;
-   sendGetProperties( ipSend );
+   //No getProperties here: the server is asked for each property as it is subscribed to.
 }
 
 
+inline
+void multiIndiPublisher::replay( multiIndiSubscriber * sub,
+                                 const std::string & key
+                               )
+{
+   auto dit = m_lastDef.find(key);
+   if(dit != m_lastDef.end()) sub->handleDefProperty(dit->second);
+
+   auto sit = m_lastSet.find(key);
+   if(sit != m_lastSet.end()) sub->handleSetProperty(sit->second);
+}
+
 inline
 int multiIndiPublisher::addSubscriberProperty( multiIndiSubscriber * sub,
                                                pcf::IndiProperty & ipSub
                                              )
 {
-   size_t already = subscribedProperties.count(ipSub.createUniqueKey());
+   std::lock_guard<std::recursive_mutex> lock(m_subMutex);
+
+   std::string key = ipSub.createUniqueKey();
+   size_t already = subscribedProperties.count(key);
 
    if(multiIndiSubscriber::addSubscriberProperty(sub, ipSub) != 0)
    {
       return -1;
    }
 
-   if(already == 0)
+   //Only the first subscriber to a property causes a request to the server.
+   //Both device and name are required, otherwise the server would send more than was asked for.
+   if(already == 0 && ipSub.getDevice() != "" && ipSub.getName() != "")
    {
       sendGetProperties(ipSub);
    }
+   else if(allPropSubscribers.count(sub) == 0)
+   {
+      //The server won't answer again, so give the new subscriber what the others already have.
+      replay(sub, key);
+   }
+
+   return 0;
+}
+
+inline
+int multiIndiPublisher::addSubscriberAllProperties( multiIndiSubscriber * sub )
+{
+   std::lock_guard<std::recursive_mutex> lock(m_subMutex);
+
+   size_t already = allPropSubscribers.size();
+
+   if(multiIndiSubscriber::addSubscriberAllProperties(sub) != 0)
+   {
+      return -1;
+   }
+
+   if(already == 0)
+   {
+      pcf::IndiProperty ipSend;
+      sendGetProperties(ipSend);
+   }
+   else
+   {
+      for(auto it = m_lastDef.begin(); it != m_lastDef.end(); ++it)
+      {
+         replay(sub, it->first);
+      }
+   }
 
    return 0;
 }
 
+inline
+void multiIndiPublisher::unsubscribe( multiIndiSubscriber * sub )
+{
+   std::lock_guard<std::recursive_mutex> lock(m_subMutex);
+
+   multiIndiSubscriber::unsubscribe(sub);
+}
+
 inline
 void multiIndiPublisher::handleDefProperty( const pcf::IndiProperty &ipRecv )
 {   
-   for(subSetIteratorT it = subscribers.begin(); it != subscribers.end(); ++it)
+   std::lock_guard<std::recursive_mutex> lock(m_subMutex);
+
+   std::string key = ipRecv.createUniqueKey();
+   m_lastDef[key] = ipRecv;
+   m_lastSet.erase(key);
+
+   std::pair< propMapIteratorT, propMapIteratorT> range = subscribedProperties.equal_range(key);
+
+   for(propMapIteratorT it = range.first; it != range.second; ++it)
+   {
+      //Subscribers to all properties are called below.
+      if(allPropSubscribers.count(it->second) > 0) continue;
+
+      it->second->handleDefProperty(ipRecv);
+   }
+
+   for(subSetIteratorT it = allPropSubscribers.begin(); it != allPropSubscribers.end(); ++it)
    {
       (*it)->handleDefProperty(ipRecv);
-   }      
+   }
 }
 
 inline
 void multiIndiPublisher::handleSetProperty( const pcf::IndiProperty &ipRecv )
 {
-   std::pair< propMapIteratorT, propMapIteratorT> range = subscribedProperties.equal_range(ipRecv.createUniqueKey());
+   std::lock_guard<std::recursive_mutex> lock(m_subMutex);
+
+   std::string key = ipRecv.createUniqueKey();
+   m_lastSet[key] = ipRecv;
 
-   if(range.first == subscribedProperties.end()) return;
+   std::pair< propMapIteratorT, propMapIteratorT> range = subscribedProperties.equal_range(key);
 
    for(propMapIteratorT it = range.first; it != range.second; ++it)
    {
+      if(allPropSubscribers.count(it->second) > 0) continue;
+
       it->second->handleSetProperty(ipRecv);
    }
+
+   for(subSetIteratorT it = allPropSubscribers.begin(); it != allPropSubscribers.end(); ++it)
+   {
+      (*it)->handleSetProperty(ipRecv);
+   }
+}
+
+inline
+void multiIndiPublisher::handleDelProperty( const pcf::IndiProperty &ipRecv )
+{
+   std::lock_guard<std::recursive_mutex> lock(m_subMutex);
+
+   if(ipRecv.getName() != "")
+   {
+      m_lastDef.erase(ipRecv.createUniqueKey());
+      m_lastSet.erase(ipRecv.createUniqueKey());
+      return;
+   }
+
+   std::string prefix = ipRecv.getDevice() + ".";
+   for(auto it = m_lastDef.begin(); it != m_lastDef.end(); )
+   {
+      if(it->first.compare(0, prefix.size(), prefix) == 0) it = m_lastDef.erase(it);
+      else ++it;
+   }
+   for(auto it = m_lastSet.begin(); it != m_lastSet.end(); )
+   {
+      if(it->first.compare(0, prefix.size(), prefix) == 0) it = m_lastSet.erase(it);
+      else ++it;
+   }
 }
 
 inline
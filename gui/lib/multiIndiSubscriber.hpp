@@ -39,6 +39,9 @@ protected:
 
    subSetT subscribers;
 
+   /// Child subscribers which want every property, e.g. to discover devices.
+   subSetT allPropSubscribers;
+
    bool m_disconnect {false};
 
 public:
@@ -73,6 +76,16 @@ public:
                                       const std::string & propName
                                     );
    
+   /// Subscribes the given instance of multiIndiSubscriber for notifications on all properties of all devices.
+   /** This is expensive, since the server then sends everything to the client.  It is only
+     * meant for subscribers which have to discover devices, and should be avoided when
+     * the device and property names are known.
+     *
+     * \returns 0 on success.
+     * \returns -1 on error.
+     */
+   virtual int addSubscriberAllProperties( multiIndiSubscriber * sub /**< [in] pointer to the subscriber */);
+
    /// Remove all subscriptions for this subscriber.
    /** This is mainly called by the multiIndiSubscriber destructor.
      */
@@ -167,6 +180,17 @@ int multiIndiSubscriber::addSubscriberProperty( multiIndiSubscriber * sub,
    return addSubscriberProperty(sub, ipSub);
 }
 
+inline
+int multiIndiSubscriber::addSubscriberAllProperties( multiIndiSubscriber * sub )
+{
+   allPropSubscribers.insert(sub);
+
+   subscribers.insert(sub);
+   sub->m_parent = this;
+
+   return 0;
+}
+
 inline
 void multiIndiSubscriber::unsubscribe( multiIndiSubscriber * sub )
 {
@@ -182,6 +206,7 @@ void multiIndiSubscriber::unsubscribe( multiIndiSubscriber * sub )
       else  ++it;
    }
 
+   allPropSubscribers.erase(sub);
    subscribers.erase(sub);
    sub->m_parent = nullptr;
 }
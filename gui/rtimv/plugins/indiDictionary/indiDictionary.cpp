@@ -111,6 +111,31 @@ int indiDictionary::attachDictionary( dictionaryT * dict,
    
    config.configUnused(m_checkTimeout, mx::app::iniFile::makeKey("indi", "checkTimeout"));
 
+   std::string props;
+   config.configUnused(props, mx::app::iniFile::makeKey("indi", "properties"));
+
+   size_t st = 0;
+   while(st < props.size())
+   {
+      size_t en = props.find(',', st);
+      if(en == std::string::npos) en = props.size();
+
+      std::string key = props.substr(st, en-st);
+      key.erase(0, key.find_first_not_of(" \t"));
+      key.erase(key.find_last_not_of(" \t")+1);
+
+      if(key.find('.') == std::string::npos || key.find('.') == 0 || key.back() == '.')
+      {
+         if(key != "") std::cerr << "INDI Dictionary: ignoring invalid property " << key << ", must be device.name\n";
+      }
+      else
+      {
+         m_properties.push_back(key);
+      }
+
+      st = en + 1;
+   }
+
    if(m_ipAddress == "" || m_port <= 0)
    {
       std::cerr << "INDI Dictionary: no connection specified. INDI disabled.\n";
@@ -147,8 +172,24 @@ void indiDictionary::checkConnection()
 
       m_client->activate();
    
-      pcf::IndiProperty ipSend;
-      m_client->sendGetProperties( ipSend );
+      if(m_properties.size() == 0)
+      {
+         pcf::IndiProperty ipSend;
+         m_client->sendGetProperties( ipSend );
+      }
+      else
+      {
+         //Exact requests, so the server only sends these properties.
+         for(size_t n = 0; n < m_properties.size(); ++n)
+         {
+            size_t dot = m_properties[n].find('.');
+
+            pcf::IndiProperty ipSend;
+            ipSend.setDevice(m_properties[n].substr(0, dot));
+            ipSend.setName(m_properties[n].substr(dot+1));
+            m_client->sendGetProperties( ipSend );
+         }
+      }
       
       return;
    }
@@ -8,6 +8,7 @@
 #include <QTimer>
 
 #include <iostream>
+#include <vector>
 
 #include <IndiClient.hpp>
 
@@ -15,8 +16,9 @@
 class rtimvIndiClient;
 
 /// rtimv dictionary using the INDI protocol
-/**
-  * \todo indiDictionary should only subscribe to specified properties 
+/** If `indi.properties` is set to a comma separated list of `device.name` keys, only those
+  * properties are requested from the server, which then sends nothing else.  Otherwise all
+  * properties of all devices are requested.
   */ 
 class indiDictionary : public QObject, public rtimvDictionaryInterface
 {
@@ -28,6 +30,8 @@ protected:
    std::string m_ipAddress {""}; ///< The IP address of the INDI server
    int m_port {0};               ///< The port of the INDI server
    int m_checkTimeout {1000};    ///< The timeout for checking the INDI connection, in msec
+   
+   std::vector<std::string> m_properties; ///< The `device.name` keys to request.  If empty, all properties are requested.
       
    dictionaryT * m_dict {nullptr};
       
@@ -172,6 +172,18 @@ void camera::subscribe()
    
    m_parent->addSubscriberProperty((multiIndiSubscriber *) this, m_camName, "fsm");
 
+   //The optional controls are only created once their property is defined, so we need the defs for each of them.
+   m_parent->addSubscriberProperty((multiIndiSubscriber *) this, m_camName, "temp_ccd");
+   m_parent->addSubscriberProperty((multiIndiSubscriber *) this, m_camName, "temp_control");
+   m_parent->addSubscriberProperty((multiIndiSubscriber *) this, m_camName, "shutter");
+   m_parent->addSubscriberProperty((multiIndiSubscriber *) this, m_camName, "roi_set");
+   m_parent->addSubscriberProperty((multiIndiSubscriber *) this, m_camName, "mode");
+   m_parent->addSubscriberProperty((multiIndiSubscriber *) this, m_camName, "readout_speed");
+   m_parent->addSubscriberProperty((multiIndiSubscriber *) this, m_camName, "vshift_speed");
+   m_parent->addSubscriberProperty((multiIndiSubscriber *) this, m_camName, "exptime");
+   m_parent->addSubscriberProperty((multiIndiSubscriber *) this, m_camName, "fps");
+   m_parent->addSubscriberProperty((multiIndiSubscriber *) this, m_camName, "emgain");
+
    m_parent->addSubscriber(ui_fsmState);
 
    if(ui_tempCCD) m_parent->addSubscriber(ui_tempCCD);
@@ -203,7 +215,7 @@ void camera::onConnect()
    if(ui_roiStatus) ui_roiStatus->onConnect();
    if(ui_modes) ui_modes->onConnect();
    if(ui_readoutSpd) ui_readoutSpd->onConnect();
-   if(ui_vshiftSpd) ui_readoutSpd->onConnect();
+   if(ui_vshiftSpd) ui_vshiftSpd->onConnect();
 
    if(ui_expTime) ui_expTime->onConnect();
    if(ui_fps) ui_fps->onConnect();
@@ -228,7 +240,7 @@ void camera::onDisconnect()
    if(ui_roiStatus) ui_roiStatus->onDisconnect();
    if(ui_modes) ui_modes->onDisconnect();
    if(ui_readoutSpd) ui_readoutSpd->onDisconnect();
-   if(ui_vshiftSpd) ui_readoutSpd->onDisconnect();
+   if(ui_vshiftSpd) ui_vshiftSpd->onDisconnect();
 
    if(ui_expTime) ui_expTime->onDisconnect();
    if(ui_fps) ui_fps->onDisconnect();
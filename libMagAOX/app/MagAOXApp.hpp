@@ -44,6 +44,7 @@
 #include "indiDriver.hpp"
 #include "indiMacros.hpp"
 #include "indiUtils.hpp"
+#include "indiPublishScheduler.hpp"
 
 //#include "../../INDI/libcommon/System.hpp"
 using namespace mx::app;
@@ -528,6 +529,12 @@ public:
    ///Mutex for locking INDI communications.
    std::mutex m_indiMutex;
    
+   ///Scheduler for rate-limited and coalesced SetProperty messages.
+   /** Pass a pointer to this in place of m_indiDriver to the indi:: update functions to have
+     * the updates scheduled.  Properties which are not registered with indiPublishRate are sent immediately.
+     */
+   indi::publishScheduler<indiDriver<MagAOXApp>> m_indiPublish;
+
 protected:
    ///Structure to hold the call-back details for handling INDI communications.
    struct indiCallBack
@@ -575,6 +582,36 @@ protected:
      */
    std::string m_driverCtrlName;
 
+   ///Flag controlling whether the INDI driver uses shared memory rings instead of the in and out FIFOs.  Config with indi.shm=true.
+   /** The rings carry binary messages, which xindidriver translates to and from XML for indiserver.
+     */
+   bool m_indiShm {false};
+
+   ///The size of each INDI shared memory ring [MB].  Config with indi.shmSize=X.
+   /** A message larger than half the ring, such as a large BLOB, can not be sent and is dropped.
+     */
+   double m_indiShmSize {1};
+
+   ///The default maximum publish rate for rate-limited INDI properties [Hz].  If \<= 0 rate limiting is disabled.  Config with indi.publishRate=X.
+   double m_indiPublishRate {MAGAOX_default_indiPublishRate};
+
+   bool m_indiPublishThreadInit {true}; ///< Synchronizer for thread startup, to allow priority setting to finish.
+
+   pid_t m_indiPublishThreadID {0}; ///< The ID of the INDI publish thread.
+
+   pcf::IndiProperty m_indiPublishThreadProp; ///< The property to hold the INDI publish thread details.
+
+   std::thread m_indiPublishThread; ///< The thread which flushes rate-limited INDI properties.
+
+   ///Thread starter, called by threadStart on thread construction.  Calls indiPublishThreadExec.
+   static void indiPublishThreadStart( MagAOXApp * app /**< [in] a pointer to a MagAOXApp instance (normally this) */);
+
+   /// Execute the INDI publish thread, which sends rate-limited properties when they are due.
+   void indiPublishThreadExec();
+
+   ///indi Property to report the INDI publishing statistics.
+   pcf::IndiProperty m_indiP_publish;
+
 public:
 
    /// Create a standard R/W INDI Text property with target and current elements.
@@ -743,6 +780,19 @@ public:
                                 int (*)( void *, const pcf::IndiProperty &) ///< [in] the callback for processing the property change
                               );
 
+   /// Set the maximum publish rate and priority of one of this app's INDI properties.
+   /** Updates made with updateIfChanged (or the indi:: functions given a pointer to m_indiPublish) will then be
+     * coalesced and sent no faster than the maximum rate.  For normal priority, changes in the property state
+     * are still sent immediately.  Normally called in appStartup.
+     *
+     * \returns 0 on success.
+     * \returns -1 on error.
+     */
+   int indiPublishRate( pcf::IndiProperty & prop,                                       ///< [in] the property to rate-limit.  Must be a member of the app.
+                        double maxRate = 0,                                             ///< [in] [optional] the maximum rate [Hz].  If \<= 0 the configured indi.publishRate is used.
+                        indi::publishPriority priority = indi::publishPriority::normal ///< [in] [optional] the priority class of this property
+                      );
+
 protected:
    /// Create the INDI FIFOs
    /** Changes permissions to max available and creates the
@@ -1045,6 +1095,18 @@ public:
      */
    std::string driverCtrlName();
 
+   ///Get the flag controlling whether the INDI driver uses shared memory rings
+   /**
+     * \returns the current value of m_indiShm
+     */
+   bool indiShm();
+
+   ///Get the size of each INDI shared memory ring
+   /**
+     * \returns the current value of m_indiShmSize [MB]
+     */
+   double indiShmSize();
+
    ///@} --Member Accessors
 };
 
@@ -1189,6 +1251,12 @@ void MagAOXApp<_useINDI>::setDefaults( int argc,
 
    createStandardIndiRequestSw( m_indiP_clearFSMAlert, "fsm_clear_alert", "Clear FSM Alert", "FSM");                                                     
    registerIndiPropertyNew(m_indiP_clearFSMAlert, st_newCallBack_clearFSMAlert);
+
+   createROIndiNumber( m_indiP_publish, "indi_publish", "INDI Publishing", "INDI");
+   indi::addNumberElement<uint64_t>( m_indiP_publish, "sent", 0, std::numeric_limits<uint64_t>::max(), 1, "%lu", "Messages Sent");
+   indi::addNumberElement<uint64_t>( m_indiP_publish, "suppressed", 0, std::numeric_limits<uint64_t>::max(), 1, "%lu", "Updates Coalesced");
+   indi::addNumberElement<uint64_t>( m_indiP_publish, "pending", 0, std::numeric_limits<uint64_t>::max(), 1, "%lu", "Properties Pending");
+   registerIndiPropertyReadOnly(m_indiP_publish);
    
    return;
 
@@ -1202,6 +1270,11 @@ void MagAOXApp<_useINDI>::setupBasicConfig() //virtual
 
    config.add("ignore_git", "", "ignore-git", argType::True, "", "", false, "bool", "set to true to ignore git status");
    
+   //INDI stuff
+   config.add("indi.publishRate", "", "indi.publishRate", argType::Required, "indi", "publishRate", false, "double", "The default maximum rate [Hz] at which rate-limited INDI properties are sent.  <= 0 disables rate limiting.");
+   config.add("indi.shm", "", "indi.shm", argType::Required, "indi", "shm", false, "bool", "If true, use shared memory rings instead of FIFOs to communicate with xindidriver.  Default is false.");
+   config.add("indi.shmSize", "", "indi.shmSize", argType::Required, "indi", "shmSize", false, "double", "The size of each INDI shared memory ring [MB].  Messages larger than half this are dropped.  Default is 1.");
+   
    //Logger Stuff
    m_log.setupConfig(config);
 
@@ -1241,6 +1314,13 @@ void MagAOXApp<_useINDI>::loadBasicConfig() //virtual
    //--------- Loop Pause Time --------//
    config(m_loopPause, "loopPause");
 
+   //--------- INDI Publishing --------//
+   config(m_indiPublishRate, "indi.publishRate");
+   m_indiPublish.defaultRate(m_indiPublishRate);
+
+   config(m_indiShm, "indi.shm");
+   config(m_indiShmSize, "indi.shmSize");
+
    //--------Power Management --------//
    if( m_powerMgtEnabled)
    {
@@ -1504,9 +1584,27 @@ int MagAOXApp<_useINDI>::execute() //virtual
 
    state(stateCodes::SHUTDOWN);
 
+   //Stop the INDI publish thread
+   if(m_indiPublishThread.joinable())
+   {
+      m_indiPublish.wake();
+      try
+      {
+         m_indiPublishThread.join(); //this will throw if it was already joined
+      }
+      catch(...)
+      {
+      }
+   }
+
    //Stop INDI communications
    if(m_indiDriver != nullptr)
    {
+      m_indiPublish.flush(true);
+      m_indiPublish.driver(nullptr);
+      
+      log<text_log>("INDI publishing: " + std::to_string(m_indiPublish.totalSent()) + " messages sent, " + std::to_string(m_indiPublish.totalSuppressed()) + " updates coalesced.");
+      
       pcf::IndiProperty ipSend;
       ipSend.setDevice(m_configName);
       m_indiDriver->sendDelProperty(ipSend);
@@ -2509,6 +2607,61 @@ int MagAOXApp<_useINDI>::registerIndiPropertySet( pcf::IndiProperty & prop,
    return 0;
 }
 
+template<bool _useINDI>
+int MagAOXApp<_useINDI>::indiPublishRate( pcf::IndiProperty & prop,
+                                          double maxRate,
+                                          indi::publishPriority priority
+                                        )
+{
+   if(!m_useINDI) return 0;
+
+   return m_indiPublish.setRate(prop, maxRate, priority);
+}
+
+template<bool _useINDI>
+void MagAOXApp<_useINDI>::indiPublishThreadStart( MagAOXApp * app )
+{
+   app->indiPublishThreadExec();
+}
+
+template<bool _useINDI>
+void MagAOXApp<_useINDI>::indiPublishThreadExec()
+{
+   //Get the thread PID immediately so the caller can return.
+   m_indiPublishThreadID = syscall(SYS_gettid);
+   
+   //Wait for the thread starter to finish initializing this thread.
+   while(m_indiPublishThreadInit == true && m_shutdown == 0)
+   {
+      sleep(1);
+   }
+   
+   double lastStats = 0;
+   
+   while(m_shutdown == 0)
+   {
+      double next;
+      
+      {//scope for mutex
+         std::lock_guard<std::mutex> guard(m_indiMutex);
+      
+         next = m_indiPublish.flush();
+      
+         double tnow = m_indiPublish.now();
+         if(tnow - lastStats >= 1.0)
+         {
+            indi::updateIfChanged(m_indiP_publish, std::vector<std::string>({"sent", "suppressed", "pending"}), 
+                                     std::vector<uint64_t>({m_indiPublish.totalSent(), m_indiPublish.totalSuppressed(), m_indiPublish.pending()}), &m_indiPublish);
+            lastStats = tnow;
+         }
+      }
+      
+      //Wait until the next property is due, but check in at least every 1/4 second.
+      if(next < 0 || next > 0.25) next = 0.25;
+      m_indiPublish.wait(next);
+   }
+}
+
 template<bool _useINDI>
 int MagAOXApp<_useINDI>::createINDIFIFOS()
 {
@@ -2620,6 +2773,19 @@ int MagAOXApp<_useINDI>::startINDI()
       return -1;
    }
 
+   //======= Setup the publish scheduler
+   m_indiPublish.driver(m_indiDriver);
+   m_indiPublish.setRate(m_indiP_publish, 1.0, indi::publishPriority::low);
+   
+   if(m_indiPublishRate > 0)
+   {
+      if(threadStart( m_indiPublishThread, m_indiPublishThreadInit, m_indiPublishThreadID, m_indiPublishThreadProp, 0, "", "indipublish", this, indiPublishThreadStart) < 0)
+      {
+         log<software_critical>({__FILE__, __LINE__, 0, 0, "INDI publish thread failed to start."});
+         return -1;
+      }
+   }
+   
    //======= Now we start talkin'
    m_indiDriver->activate();
    log<indidriver_start>();
@@ -2770,7 +2936,7 @@ void MagAOXApp<_useINDI>::updateIfChanged( pcf::IndiProperty & p,
 
    if(!m_indiDriver) return;
 
-   indi::updateIfChanged( p, el, newVal, m_indiDriver, ipState);
+   indi::updateIfChanged( p, el, newVal, &m_indiPublish, ipState);
 }
 
 template<bool _useINDI>
@@ -2794,7 +2960,7 @@ void MagAOXApp<_useINDI>::updateSwitchIfChanged( pcf::IndiProperty & p,
 
    if(!m_indiDriver) return;
 
-   indi::updateSwitchIfChanged( p, el, newVal, m_indiDriver, ipState);
+   indi::updateSwitchIfChanged( p, el, newVal, &m_indiPublish, ipState);
 }
 
 template<bool _useINDI>
@@ -2814,7 +2980,7 @@ void MagAOXApp<_useINDI>::updateIfChanged( pcf::IndiProperty & p,
    {
       descriptors[index] += std::to_string(index);
    }
-   indi::updateIfChanged(p, descriptors, newVals, m_indiDriver);
+   indi::updateIfChanged(p, descriptors, newVals, &m_indiPublish);
 }
 
 template<bool _useINDI>
@@ -2828,7 +2994,7 @@ void MagAOXApp<_useINDI>::updateIfChanged( pcf::IndiProperty & p,
 
    if(!m_indiDriver) return;
 
-   indi::updateIfChanged(p, els, newVals, m_indiDriver);
+   indi::updateIfChanged(p, els, newVals, &m_indiPublish);
 }
 
 
@@ -3118,6 +3284,18 @@ std::string MagAOXApp<_useINDI>::driverCtrlName()
    return m_driverCtrlName;
 }
 
+template<bool _useINDI>
+bool MagAOXApp<_useINDI>::indiShm()
+{
+   return m_indiShm;
+}
+
+template<bool _useINDI>
+double MagAOXApp<_useINDI>::indiShmSize()
+{
+   return m_indiShmSize;
+}
+
 extern template class MagAOXApp<true>;
 extern template class MagAOXApp<false>;
 
@@ -17,6 +17,11 @@
 #include <mx/ioutils/fits/fitsFile.hpp>
 
 #include "../../ImageStreamIO/ImageStruct.hpp"
+#include "../../sys/fileWatcher.hpp"
+
+#include "dmActuatorMap.hpp"
+#include "dmChannelCombiner.hpp"
+#include "dmSatAccumulator.hpp"
 
 namespace MagAOX
 {
@@ -92,6 +97,11 @@ protected:
    uint32_t m_dmWidth {0}; ///< The width of the images in the stream
    uint32_t m_dmHeight {0}; ///< The height of the images in the stream
    
+   bool m_combine {false}; ///< If true, the dmXXdispNN channels are summed in this process instead of by an external dmcomb.
+   int m_combThreadPrio {0}; ///< Priority of the channel combination thread.
+   std::string m_combCpuset; ///< The cpuset for the channel combination thread.  Ignored if empty (the default).
+   int m_combResum {1000}; ///< Number of updates after which the channel sum is recomputed from scratch, to bound round-off drift.
+   
    static constexpr uint8_t m_dmDataType = ImageStreamTypeCode<realT>(); ///< The ImageStreamIO type code.
    
    ///@}
@@ -99,7 +109,9 @@ protected:
    
    std::string m_calibRelDir; ///< The directory relative to the calibPath.  Set this before calling dm<derivedT,realT>::loadConfig().
    
-   int m_channels; ///< The number of dmcomb channels found as part of allocation.
+   int m_channels {0}; ///< The number of dmcomb channels found as part of allocation.
+   
+   std::mutex m_channelsMutex; ///< Protects m_channels, which the combination thread reads while allocate may be finding channels.
    
    std::map<std::string, std::string> m_flatCommands; ///< Map of flat file name to full path 
    std::string m_flatCurrent;  ///< The name of the current flat command
@@ -120,6 +132,16 @@ protected:
    IMAGE m_testImageStream; ///< The ImageStreamIO shared memory buffer for the test.
    bool m_testSet {false}; ///< Flag indicating whether the test command has been set.
    
+   std::map<std::string, mx::improc::eigenImage<realT>> m_preloaded; ///< Flat and test commands read by the watcher thread, by full path.
+   std::mutex m_preloadMutex; ///< Mutex protecting m_preloaded.
+   
+   //Declared after m_preloaded so the watcher thread is stopped before m_preloaded is destroyed.
+   sys::fileWatcher m_calibWatcher; ///< Watches the flat and test directories, so they are not rescanned each loop.
+   int m_flatWatch {-1}; ///< The id of the flat directory watch.
+   uint64_t m_flatGeneration {0}; ///< The generation of the flat directory index last seen by checkFlats.
+   int m_testWatch {-1}; ///< The id of the test directory watch.
+   uint64_t m_testGeneration {0}; ///< The generation of the test directory index last seen by checkTests.
+   
 public:
 
    /// Setup the configuration system
@@ -217,10 +239,21 @@ public:
    int allocate( const dev::shmimT & sp);
    
    /// Called by shmimMonitor when a new DM command is available.  This is just a pass-through to derivedT::commandDM(char*).
+   /** When combining channels in-process the dmXXdisp stream is written by this class, so
+     * this does nothing.
+     */
    int processImage( void * curr_src,
                      const dev::shmimT & sp
                    );
    
+   /// Send a command to the DM and record its saturation.
+   /** If the derived class did not call recordSat() from commandDM, m_instSatMap is recorded.
+     *
+     * \returns 0 on success
+     * \returns \<0 on error, which is logged.
+     */
+   int commandDMAndSat( void * curr_src /**< [in] the command, m_dmWidth x m_dmHeight of realT */);
+   
    /// Calls derived()->releaseDM() and then 0s all channels and the sat map.
    /** This is called by the relevant INDI callback
      *
@@ -229,8 +262,25 @@ public:
      */
    int releaseDM();
 
+   /// Read a changed flat or test file into m_preloaded, or drop a removed one.
+   /** Called by the calibration watcher thread.
+     */
+   void preloadCommand( const std::string & path, ///< [in] the full path to the file
+                        bool removed              ///< [in] whether the file was removed
+                      );
+   
+   /// Read a flat or test command, from m_preloaded if it is there.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int readCommand( mx::improc::eigenImage<realT> & command, ///< [out] the command
+                    const std::string & path                 ///< [in] the full path to the file
+                  );
+   
    /// Check the flats directory and update the list of flats if anything changes
-   /** This is called once per appLogic and whilePowerOff loops.
+   /** This is called once per appLogic and whilePowerOff loops.  The directory is indexed by m_calibWatcher, so this
+     * only checks for a change to the index.
      *
      * \returns 0 on success
      * \returns -1 on error
@@ -264,7 +314,8 @@ public:
    int zeroFlat();
 
    /// Check the tests directory and update the list of tests if anything changes
-   /** This is called once per appLogic and whilePowerOff loops.
+   /** This is called once per appLogic and whilePowerOff loops.  The directory is indexed by m_calibWatcher, so this
+     * only checks for a change to the index.
      *
      * \returns 0 on success
      * \returns -1 on error
@@ -303,13 +354,42 @@ public:
    
 protected:
    
-   mx::improc::eigenImage<uint8_t> m_instSatMap; ///< The instantaneous saturation map, 0/1, set by the commandDM() function of the derived class.
-   mx::improc::eigenImage<uint16_t> m_accumSatMap; ///< The accumulated saturation map, which acccumulates for m_satAvgInt then is publised as a 0/1 image. 
+   mx::improc::eigenImage<uint8_t> m_instSatMap; ///< The instantaneous saturation map, 0/1, set by the commandDM() function of the derived class unless it calls recordSat().
+   mx::improc::eigenImage<uint16_t> m_accumSatMap; ///< The saturation counts over the last m_satAvgInt, unpacked by the saturation thread and publised as a 0/1 image. 
    mx::improc::eigenImage<float> m_satPercMap; ///< Map of the percentage of time each actator was saturated during the avg. interval.
    
    IMAGE m_satImageStream; ///< The ImageStreamIO shared memory buffer for the sat map.
    IMAGE m_satPercImageStream; ///< The ImageStreamIO shared memory buffer for the sat percentage map.
    
+   satAccumulator m_satAccum; ///< Counts the saturation of each actuator, written by commandDMAndSat and read by the saturation thread.
+   
+   std::vector<int> m_satBitPixel; ///< The pixel for each bit of the masks passed to recordSat(), -1 if none.  If empty the masks are in pixel order.
+   
+   std::vector<uint16_t> m_satCounts; ///< Working memory for the saturation thread, the count for each bit.
+   
+   std::mutex m_satMutex; ///< Keeps satAlloc() and the saturation thread from running at the same time.  Not used by the command path.
+   
+   bool m_satRecorded {false}; ///< Set by recordSat(), so commandDMAndSat knows whether to record m_instSatMap.
+   
+   /// Size the saturation accounting for the current mask mapping.
+   /** Called by allocate() and satMaskMapping().  Must not be called while DM commands are being sent.
+     */
+   void satAlloc();
+   
+   /// Set the mapping from the bits of the masks passed to recordSat() to the pixels of the DM shape.
+   /** Normally called from the derived class's initDM with the mapping given to its actuatorMap.
+     */
+   void satMaskMapping( const int * bitPixel, ///< [in] the pixel for each bit, -1 if none
+                        uint32_t nbits        ///< [in] the number of bits
+                      );
+   
+   /// Record the saturation of a command as a bit-packed mask.
+   /** Call from the derived class's commandDM, instead of setting m_instSatMap.  The mask is in the order
+     * set by satMaskMapping(), or in pixel order if that was not called.  This does not lock or wake
+     * any thread.
+     */
+   void recordSat( const uint64_t * mask /**< [in] the mask, bit `n%64` of word `n/64` for bit `n` */);
+   
    /// Clear the saturation maps and zero the shared membory.
    /**
      * \returns 0 on success
@@ -318,11 +398,11 @@ protected:
    int clearSat();
 
    /** \name Saturation Thread
-     * This thread processes the saturation maps
+     * This thread wakes every m_satAvgInt milliseconds to collect the saturation counts and publish the maps.
      * @{
      */
    
-   sem_t m_satSemaphore; ///< Semaphore used to tell the saturation thread to run.
+   sem_t m_satSemaphore; ///< Semaphore the saturation thread sleeps on between publications, posting it wakes the thread early.
    
    bool m_satThreadInit {true}; ///< Synchronizer for thread startup, to allow priority setting to finish.
    
@@ -332,6 +412,9 @@ protected:
    
    std::thread m_satThread; ///< A separate thread for the actual saturation processing
 
+   std::atomic<uint64_t> m_satThreadNs {0}; ///< The total time the saturation thread has spent collecting and publishing, in nanoseconds.
+   std::atomic<uint64_t> m_satThreadPasses {0}; ///< The number of times the saturation thread has collected and published.
+
    ///Thread starter, called by MagAOXApp::threadStart on thread construction.  Calls satThreadExec.
    static void satThreadStart( dm * d /**< [in] a pointer to a dm instance (normally this) */);
 
@@ -341,6 +424,73 @@ protected:
    
    ///@}
    
+   /** \name Channel Combination
+     * With `dm.combine=true` this replaces the external dmcomb process.  A waiter thread per
+     * dmXXdispNN channel wakes the combination thread, which adds only the channels whose cnt0
+     * changed to a running sum, calls commandDM directly, and then publishes the sum to the
+     * dmXXdisp stream for observers.
+     * @{
+     */
+   
+   std::vector<IMAGE> m_combImages; ///< The channel streams.
+   channelCombiner<realT> m_combiner; ///< Keeps the running sum of the channels.
+   std::vector<uint64_t> m_combCnt0; ///< The current cnt0 of each channel, passed to the combiner.
+   std::vector<const realT *> m_combData; ///< The current data of each channel, passed to the combiner.
+   
+   IMAGE m_combDispStream; ///< The dmXXdisp stream, where the sum is published.
+   
+   sem_t m_combSemaphore; ///< Posted by the channel waiters when a channel is updated.
+   
+   std::atomic<bool> m_combRestart {false}; ///< Set by allocate to make the combination thread re-open the channels.
+   
+   std::atomic<bool> m_combWaitersRun {false}; ///< Keeps the channel waiter threads running.
+   
+   std::vector<std::thread> m_combWaiters; ///< The channel waiter threads.
+   
+   bool m_combThreadInit {true}; ///< Synchronizer for thread startup, to allow priority setting to finish.
+   
+   pid_t m_combThreadID {0}; ///< The ID of the combination thread.
+   
+   pcf::IndiProperty m_combThreadProp; ///< The property to hold the combination thread details.
+   
+   std::thread m_combThread; ///< The channel combination thread.
+   
+   ///Thread starter, called by MagAOXApp::threadStart on thread construction.  Calls combThreadExec.
+   static void combThreadStart( dm * d /**< [in] a pointer to a dm instance (normally this) */);
+   
+   /// Execute channel combination
+   void combThreadExec();
+   
+   /// Wait on the semaphore of one channel, and wake up the combination thread when it is posted.
+   void combWaiterExec( size_t ch,     ///< [in] the channel number
+                        int semIndex   ///< [in] the semaphore index to wait on
+                      );
+   
+   /// Get the number of channels, under the mutex since allocate may be changing it.
+   int combChannels();
+   
+   /// Open the channel and dmXXdisp streams, and start the channel waiters.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, which is logged.
+     */
+   int combOpen();
+   
+   /// Stop the channel waiters and close the streams.
+   void combClose();
+   
+   /// Update the running sum from the channels which have changed.
+   /**
+     * \returns true if any channel changed
+     * \returns false otherwise
+     */
+   bool combUpdate( bool full /**< [in] if true, all channels are re-read and the sum is recomputed from scratch */);
+   
+   /// Write the running sum to the dmXXdisp stream.
+   void combPublish();
+   
+   ///@}
+   
 protected:
    
     /** \name INDI 
@@ -557,6 +707,11 @@ void dm<derivedT,realT>::setupConfig(mx::app::appConfigurator & config)
    
    config.add("dm.width", "", "dm.width", argType::Required, "dm", "width", false, "string", "The width of the DM in actuators.");
    config.add("dm.height", "", "dm.height", argType::Required, "dm", "height", false, "string", "The height of the DM in actuators.");
+   
+   config.add("dm.combine", "", "dm.combine", argType::Required, "dm", "combine", false, "bool", "If true, the dmXXdispNN channels are summed in this process and sent directly to the DM, and the sum is written to shmimName.  An external dmcomb must not be run.  Default is false.");
+   config.add("dm.combThreadPrio", "", "dm.combThreadPrio", argType::Required, "dm", "combThreadPrio", false, "int", "The real-time priority of the channel combination thread.  Default is the dm.threadPrio.");
+   config.add("dm.combCpuset", "", "dm.combCpuset", argType::Required, "dm", "combCpuset", false, "string", "The cpuset for the channel combination thread.  Default is the dm.cpuset.");
+   config.add("dm.combResum", "", "dm.combResum", argType::Required, "dm", "combResum", false, "int", "The number of channel updates after which the channel sum is recomputed from scratch.  Default is 1000.");
 }
 
 template<class derivedT, typename realT>
@@ -623,6 +778,13 @@ void dm<derivedT,realT>::loadConfig(mx::app::appConfigurator & config)
 
    config(m_dmWidth, "dm.width");
    config(m_dmHeight, "dm.height");
+   
+   config(m_combine, "dm.combine");
+   m_combThreadPrio = derived().m_smThreadPrio;
+   config(m_combThreadPrio, "dm.combThreadPrio");
+   m_combCpuset = derived().m_smCpuset;
+   config(m_combCpuset, "dm.combCpuset");
+   config(m_combResum, "dm.combResum");
 }
    
 
@@ -635,6 +797,22 @@ int dm<derivedT,realT>::appStartup()
       return -1;
    }
    
+   //-----------------
+   //Watch the flat and test directories
+   m_flatWatch = m_calibWatcher.addWatch(m_flatPath, "", "", ".fits", [this](const std::string & path, bool removed)
+                                                                      {
+                                                                         preloadCommand(path, removed);
+                                                                      });
+   m_testWatch = m_calibWatcher.addWatch(m_testPath, "", "", ".fits", [this](const std::string & path, bool removed)
+                                                                      {
+                                                                         preloadCommand(path, removed);
+                                                                      });
+   if(m_calibWatcher.start() < 0)
+   {
+      derivedT::template log<software_error>({__FILE__,__LINE__, "could not start calibration watcher"});
+      return -1;
+   }
+   
    //-----------------
    //Get the flats
    checkFlats();
@@ -754,6 +932,17 @@ int dm<derivedT,realT>::appStartup()
       return -1;
    }
    
+   if(m_combine)
+   {
+      if(sem_init(&m_combSemaphore, 0,0) < 0) return derivedT::template log<software_critical, -1>({__FILE__, __LINE__, errno,0, "Initializing comb semaphore"});
+      
+      if(derived().threadStart( m_combThread, m_combThreadInit, m_combThreadID, m_combThreadProp, m_combThreadPrio, m_combCpuset, "combination", this, combThreadStart) < 0)
+      {
+         derivedT::template log<software_error, -1>({__FILE__, __LINE__});
+         return -1;
+      }
+   }
+   
    return 0;
 
 }
@@ -769,6 +958,16 @@ int dm<derivedT,realT>::appLogic()
       return -1;
    }
    
+   if(m_combine)
+   {
+      if(pthread_tryjoin_np(m_combThread.native_handle(),0) == 0)
+      {
+         derivedT::template log<software_error>({__FILE__, __LINE__, "combination thread has exited"});
+      
+         return -1;
+      }
+   }
+   
    checkFlats();
    checkTests();
    
@@ -780,6 +979,8 @@ int dm<derivedT,realT>::appLogic()
 template<class derivedT, typename realT>
 int dm<derivedT,realT>::appShutdown()
 {
+   m_calibWatcher.stop();
+   
    if(m_satThread.joinable())
    {
       pthread_kill(m_satThread.native_handle(), SIGUSR1);
@@ -792,6 +993,18 @@ int dm<derivedT,realT>::appShutdown()
       }
    }
    
+   if(m_combThread.joinable())
+   {
+      pthread_kill(m_combThread.native_handle(), SIGUSR1);
+      try
+      {
+         m_combThread.join(); //this will throw if it was already joined
+      }
+      catch(...)
+      {
+      }
+   }
+   
    return 0;
 }
 
@@ -821,6 +1034,8 @@ int dm<derivedT,realT>::findDMChannels()
       return -1;
    }
    
+   std::lock_guard<std::mutex> lock(m_channelsMutex);
+   
    m_channels = -1;
    for(size_t n =0; n < dmlist.size(); ++n)
    {  
@@ -882,6 +1097,8 @@ int dm<derivedT,realT>::allocate( const dev::shmimT & sp)
    m_satPercMap.resize(m_dmWidth,m_dmHeight);
    m_satPercMap.setZero();
    
+   satAlloc();
+   
    if(findDMChannels() < 0) 
    {
       derivedT::template log<software_critical>({__FILE__,__LINE__, "error finding DM channels"});
@@ -889,6 +1106,9 @@ int dm<derivedT,realT>::allocate( const dev::shmimT & sp)
       return -1;
    }
    
+   //The channels may have been re-created, so the combination thread has to re-open them.
+   m_combRestart = true;
+   
    return 0;
 }
 
@@ -899,6 +1119,17 @@ int dm<derivedT,realT>::processImage( void * curr_src,
 {
    static_cast<void>(sp); //be unused
    
+   //We wrote this ourselves, after already sending it to the DM.
+   if(m_combine) return 0;
+   
+   return commandDMAndSat(curr_src);
+}
+
+template<class derivedT, typename realT>
+int dm<derivedT,realT>::commandDMAndSat( void * curr_src )
+{
+   m_satRecorded = false;
+   
    int rv = derived().commandDM( curr_src );
    
    if(rv < 0)
@@ -906,16 +1137,50 @@ int dm<derivedT,realT>::processImage( void * curr_src,
       derivedT::template log<software_critical>({__FILE__, __LINE__, errno, rv, "Error from commandDM"});
       return rv;
    }
-   //Tell the sat thread to get going
-   if(sem_post(&m_satSemaphore) < 0)
+   
+   //The saturation thread collects at its own cadence, so there is nothing to wake.
+   if(!m_satRecorded && m_satBitPixel.size() == 0 && (size_t) m_instSatMap.size() == m_satAccum.bits())
    {
-      derivedT::template log<software_critical>({__FILE__, __LINE__, errno, 0, "Error posting to semaphore"});
-      return -1;
+      m_satAccum.record(m_instSatMap.data());
    }
    
    return rv;
 }
 
+template<class derivedT, typename realT>
+void dm<derivedT,realT>::satAlloc()
+{
+   std::lock_guard<std::mutex> guard(m_satMutex);
+   
+   size_t nbits = m_dmWidth*m_dmHeight;
+   if(m_satBitPixel.size() > 0) nbits = m_satBitPixel.size();
+   
+   m_satAccum.resize(nbits);
+   m_satCounts.assign(nbits, 0);
+}
+
+template<class derivedT, typename realT>
+void dm<derivedT,realT>::satMaskMapping( const int * bitPixel,
+                                         uint32_t nbits
+                                       )
+{
+   m_satBitPixel.assign(bitPixel, bitPixel + nbits);
+   
+   for(size_t n = 0; n < m_satBitPixel.size(); ++n)
+   {
+      if(m_satBitPixel[n] >= (int) (m_dmWidth*m_dmHeight)) m_satBitPixel[n] = -1;
+   }
+   
+   satAlloc();
+}
+
+template<class derivedT, typename realT>
+void dm<derivedT,realT>::recordSat( const uint64_t * mask )
+{
+   m_satAccum.record(mask);
+   m_satRecorded = true;
+}
+
 template<class derivedT, typename realT>
 int dm<derivedT,realT>::releaseDM()
 {
@@ -935,10 +1200,67 @@ int dm<derivedT,realT>::releaseDM()
    return 0;
 
 }
+template<class derivedT, typename realT>
+void dm<derivedT,realT>::preloadCommand( const std::string & path,
+                                         bool removed
+                                       )
+{
+   if(removed)
+   {
+      std::lock_guard<std::mutex> lock(m_preloadMutex);
+      m_preloaded.erase(path);
+      return;
+   }
+   
+   mx::improc::eigenImage<realT> command;
+   mx::fits::fitsFile<realT> ff;
+   if(ff.read(command, path) < 0)
+   {
+      //Possibly not finished, readCommand will try again when it is needed.
+      std::lock_guard<std::mutex> lock(m_preloadMutex);
+      m_preloaded.erase(path);
+      return;
+   }
+   
+   std::lock_guard<std::mutex> lock(m_preloadMutex);
+   m_preloaded[path].swap(command);
+}
+
+template<class derivedT, typename realT>
+int dm<derivedT,realT>::readCommand( mx::improc::eigenImage<realT> & command,
+                                     const std::string & path
+                                   )
+{
+   {
+      std::lock_guard<std::mutex> lock(m_preloadMutex);
+      auto it = m_preloaded.find(path);
+      if(it != m_preloaded.end())
+      {
+         command = it->second;
+         return 0;
+      }
+   }
+   
+   mx::fits::fitsFile<realT> ff;
+   if(ff.read(command, path) < 0) return -1;
+   
+   return 0;
+}
+
 template<class derivedT, typename realT>
 int dm<derivedT,realT>::checkFlats()
 {
-   std::vector<std::string> tfs = mx::ioutils::getFileNames(m_flatPath, "", "", ".fits");
+   std::vector<std::string> tfs;
+   
+   if(m_flatWatch < 0)
+   {
+      tfs = mx::ioutils::getFileNames(m_flatPath, "", "", ".fits");
+   }
+   else
+   {
+      if(!m_calibWatcher.changed(m_flatWatch, m_flatGeneration)) return 0;
+      tfs = m_calibWatcher.files(m_flatWatch);
+   }
    
    for(auto it = m_flatCommands.begin(); it != m_flatCommands.end(); ++it)
    {
@@ -1045,8 +1367,7 @@ int dm<derivedT,realT>::loadFlat(const std::string & intarget)
    
    m_flatLoaded = false;
    //load into memory.
-   mx::fits::fitsFile<realT> ff;
-   if(ff.read(m_flatCommand, targetPath) < 0)
+   if(readCommand(m_flatCommand, targetPath) < 0)
    {
       derivedT::template log<text_log>("flat file " + targetPath + " not found", logPrio::LOG_ERROR);
       return -1;
@@ -1221,7 +1542,17 @@ int dm<derivedT,realT>::zeroFlat()
 template<class derivedT, typename realT>
 int dm<derivedT,realT>::checkTests()
 {
-   std::vector<std::string> tfs = mx::ioutils::getFileNames(m_testPath, "", "", ".fits");
+   std::vector<std::string> tfs;
+   
+   if(m_testWatch < 0)
+   {
+      tfs = mx::ioutils::getFileNames(m_testPath, "", "", ".fits");
+   }
+   else
+   {
+      if(!m_calibWatcher.changed(m_testWatch, m_testGeneration)) return 0;
+      tfs = m_calibWatcher.files(m_testWatch);
+   }
    
    for(auto it = m_testCommands.begin(); it != m_testCommands.end(); ++it)
    {
@@ -1328,8 +1659,7 @@ int dm<derivedT,realT>::loadTest(const std::string & intarget)
    
    m_testLoaded = false;
    //load into memory.
-   mx::fits::fitsFile<realT> ff;
-   if(ff.read(m_testCommand, targetPath) < 0)
+   if(readCommand(m_testCommand, targetPath) < 0)
    {
       derivedT::template log<text_log>("test file " + targetPath + " not found", logPrio::LOG_ERROR);
       return -1;
@@ -1678,101 +2008,121 @@ void dm<derivedT,realT>::satThreadExec()
    //This is the working memory for making the 1/0 mask out of m_accumSatMap
    mx::improc::eigenImage<uint8_t> satmap(m_dmWidth, m_dmHeight);
    
-   int naccum = 0;
-   double t_accumst = mx::sys::get_curr_time();
+   //The deadline of the next collection
+   timespec ts;
+   if(clock_gettime(CLOCK_REALTIME, &ts) < 0)
+   {
+      derivedT::template log<software_critical>({__FILE__,__LINE__,errno,0,"clock_gettime"}); 
+      return;
+   }
    
-   //This is the main image grabbing loop.      
+   //This is the main saturation loop.      
    while(!derived().shutdown())
    {
-      //Get timespec for sem_timedwait
-      timespec ts;
-      if(clock_gettime(CLOCK_REALTIME, &ts) < 0)
-      {
-         derivedT::template log<software_critical>({__FILE__,__LINE__,errno,0,"clock_gettime"}); 
-         return;
-      }
-      ts.tv_sec += 1;
+      int avgInt = (m_satAvgInt > 0) ? m_satAvgInt : 1;
+      ts.tv_nsec += ((long) avgInt % 1000)*1000000;
+      ts.tv_sec += avgInt/1000 + ts.tv_nsec/1000000000;
+      ts.tv_nsec %= 1000000000;
       
-      //Wait on semaphore
-      if(sem_timedwait(&m_satSemaphore, &ts) == 0)
+      //Sleep until the deadline, unless posted or signaled
+      if(sem_timedwait(&m_satSemaphore, &ts) != 0)
       {
-         //not a timeout -->accumulate
-         for(int rr=0; rr < m_instSatMap.rows(); ++rr)
-         {
-            for(int cc=0; cc< m_instSatMap.cols(); ++cc)
-            {
-               m_accumSatMap(rr,cc) += m_instSatMap(rr,cc);
-            }
-         }
-         ++naccum;
-
-         // If less than avg int --> go back and wait again
-         if(mx::sys::get_curr_time(ts) - t_accumst < m_satAvgInt/1000.0) continue;
-         
-         // If greater than avg int --> calc stats, write to streams.
-         for(int rr=0; rr < m_instSatMap.rows(); ++rr)
+         //Check for why we timed out
+         if(errno == EINTR) break; //This indicates signal interrupted us, time to restart or shutdown, loop will exit normally if flags set.
+            
+         //ETIMEDOUT is the normal wake up.
+         //Otherwise, report an error.
+         if(errno != ETIMEDOUT)
          {
-            for(int cc=0; cc< m_instSatMap.cols(); ++cc)
-            {
-               m_satPercMap(rr,cc) = m_accumSatMap(rr,cc)/naccum;           
-               satmap(rr,cc) = (m_accumSatMap(rr,cc) > 0); //it's  1/0 map
-            }
+            derivedT::template log<software_error>({__FILE__, __LINE__,errno, "sem_timedwait"});
+            break;
          }
+      }
+      else
+      {
+         //Posted early, start the next interval from now.
+         clock_gettime(CLOCK_REALTIME, &ts);
+      }
       
-         m_satImageStream.md->write=1;
-         m_satPercImageStream.md->write=1;
-         
-         memcpy( m_satImageStream.array.raw, satmap.data() , m_dmWidth*m_dmHeight*sizeof(uint8_t));
-         memcpy( m_satPercImageStream.array.raw, m_satPercMap.data() , m_dmWidth*m_dmHeight*sizeof(float));
-         
-         //Set the time of last write
-         clock_gettime(CLOCK_REALTIME, &m_satImageStream.md->writetime);
-         m_satPercImageStream.md->writetime = m_satImageStream.md->writetime;
-
-         //Set the image acquisition timestamp
-         m_satImageStream.md->atime = m_satImageStream.md->writetime;
-         m_satPercImageStream.md->atime = m_satPercImageStream.md->writetime;
-         
-         //Update cnt1
-         m_satImageStream.md->cnt1 = 0;
-         m_satPercImageStream.md->cnt1 = 0;
-          
-         //Update cnt0
-         m_satImageStream.md->cnt0++;
-         m_satPercImageStream.md->cnt0++;
-         
-         m_satImageStream.writetimearray[0] = m_satImageStream.md->writetime;
-         m_satImageStream.atimearray[0] = m_satImageStream.md->atime;
-         m_satImageStream.cntarray[0] = m_satImageStream.md->cnt0;
+      timespec pass0;
+      clock_gettime(CLOCK_MONOTONIC, &pass0);
+      
+      uint32_t naccum;
+      
+      {//mutex scope
+         std::lock_guard<std::mutex> guard(m_satMutex);
          
-         m_satPercImageStream.writetimearray[0] = m_satPercImageStream.md->writetime;
-         m_satPercImageStream.atimearray[0] = m_satPercImageStream.md->atime;
-         m_satPercImageStream.cntarray[0] = m_satPercImageStream.md->cnt0;
+         if(m_satCounts.size() != m_satAccum.bits()) continue;
          
-         //And post
-         m_satImageStream.md->write=0;
-         ImageStreamIO_sempost(&m_satImageStream,-1);
+         naccum = m_satAccum.collect(m_satCounts.data());
          
-         m_satPercImageStream.md->write=0;
-         ImageStreamIO_sempost(&m_satPercImageStream,-1);
+         if(naccum == 0) continue;
          
-         m_accumSatMap.setZero();
-         naccum = 0;
-         t_accumst = mx::sys::get_curr_time(ts);
+         if(m_satBitPixel.size() == 0)
+         {
+            memcpy(m_accumSatMap.data(), m_satCounts.data(), m_dmWidth*m_dmHeight*sizeof(uint16_t));
+         }
+         else
+         {
+            m_accumSatMap.setZero();
+            for(size_t n = 0; n < m_satBitPixel.size(); ++n)
+            {
+               if(m_satBitPixel[n] < 0) continue;
+               m_accumSatMap.data()[m_satBitPixel[n]] = m_satCounts[n];
+            }
+         }
       }
-      else
+      
+      for(int rr=0; rr < m_accumSatMap.rows(); ++rr)
       {
-         //Check for why we timed out
-         if(errno == EINTR) break; //This indicates signal interrupted us, time to restart or shutdown, loop will exit normally if flags set.
-            
-         //ETIMEDOUT just means we should wait more.
-         //Otherwise, report an error.
-         if(errno != ETIMEDOUT)
+         for(int cc=0; cc< m_accumSatMap.cols(); ++cc)
          {
-            derivedT::template log<software_error>({__FILE__, __LINE__,errno, "sem_timedwait"});
-            break;
+            m_satPercMap(rr,cc) = m_accumSatMap(rr,cc)/((float) naccum);
+            satmap(rr,cc) = (m_accumSatMap(rr,cc) > 0); //it's  1/0 map
          }
       }
+   
+      m_satImageStream.md->write=1;
+      m_satPercImageStream.md->write=1;
+      
+      memcpy( m_satImageStream.array.raw, satmap.data() , m_dmWidth*m_dmHeight*sizeof(uint8_t));
+      memcpy( m_satPercImageStream.array.raw, m_satPercMap.data() , m_dmWidth*m_dmHeight*sizeof(float));
+      
+      //Set the time of last write
+      clock_gettime(CLOCK_REALTIME, &m_satImageStream.md->writetime);
+      m_satPercImageStream.md->writetime = m_satImageStream.md->writetime;
+
+      //Set the image acquisition timestamp
+      m_satImageStream.md->atime = m_satImageStream.md->writetime;
+      m_satPercImageStream.md->atime = m_satPercImageStream.md->writetime;
+      
+      //Update cnt1
+      m_satImageStream.md->cnt1 = 0;
+      m_satPercImageStream.md->cnt1 = 0;
+       
+      //Update cnt0
+      m_satImageStream.md->cnt0++;
+      m_satPercImageStream.md->cnt0++;
+      
+      m_satImageStream.writetimearray[0] = m_satImageStream.md->writetime;
+      m_satImageStream.atimearray[0] = m_satImageStream.md->atime;
+      m_satImageStream.cntarray[0] = m_satImageStream.md->cnt0;
+      
+      m_satPercImageStream.writetimearray[0] = m_satPercImageStream.md->writetime;
+      m_satPercImageStream.atimearray[0] = m_satPercImageStream.md->atime;
+      m_satPercImageStream.cntarray[0] = m_satPercImageStream.md->cnt0;
+      
+      //And post
+      m_satImageStream.md->write=0;
+      ImageStreamIO_sempost(&m_satImageStream,-1);
+      
+      m_satPercImageStream.md->write=0;
+      ImageStreamIO_sempost(&m_satPercImageStream,-1);
+      
+      timespec pass1;
+      clock_gettime(CLOCK_MONOTONIC, &pass1);
+      m_satThreadNs += (pass1.tv_sec - pass0.tv_sec)*1000000000 + (pass1.tv_nsec - pass0.tv_nsec);
+      ++m_satThreadPasses;
    }
 
    if(opened)
@@ -1783,6 +2133,237 @@ void dm<derivedT,realT>::satThreadExec()
    }
 }
 
+template<class derivedT, typename realT>
+void dm<derivedT,realT>::combThreadStart(dm *d)
+{
+   d->combThreadExec();
+}
+
+template<class derivedT, typename realT>
+void dm<derivedT,realT>::combThreadExec()
+{
+   //Get the thread PID immediately so the caller can return.
+   m_combThreadID = syscall(SYS_gettid);
+   
+   //Wait for the thread starter to finish initializing this thread.
+   while(m_combThreadInit == true && derived().shutdown() == 0)
+   {
+      sleep(1);
+   }
+   
+   while(!derived().shutdown())
+   {
+      //Wait for allocation and for the DM to be ready.
+      while((combChannels() <= 0 || derived().state() != stateCodes::OPERATING) && !derived().shutdown())
+      {
+         sleep(1);
+      }
+      if(derived().shutdown()) break;
+      
+      m_combRestart = false;
+      
+      if(combOpen() < 0)
+      {
+         sleep(1);
+         continue;
+      }
+      
+      //Send whatever is currently on the channels.
+      combUpdate(true);
+      if(commandDMAndSat(m_combiner.sum()) == 0) combPublish();
+      
+      int nupdates = 0;
+      
+      while(!derived().shutdown() && !m_combRestart && derived().state() == stateCodes::OPERATING)
+      {
+         timespec ts;
+         if(clock_gettime(CLOCK_REALTIME, &ts) < 0)
+         {
+            derivedT::template log<software_critical>({__FILE__,__LINE__,errno,0,"clock_gettime"}); 
+            combClose();
+            return;
+         }
+         ts.tv_sec += 1;
+         
+         if(sem_timedwait(&m_combSemaphore, &ts) == 0)
+         {
+            //Several channels may have been posted, they are all picked up by combUpdate.
+            while(sem_trywait(&m_combSemaphore) == 0);
+            
+            bool full = false;
+            if(++nupdates >= m_combResum)
+            {
+               full = true;
+               nupdates = 0;
+            }
+            
+            if(!combUpdate(full)) continue;
+            
+            if(commandDMAndSat(m_combiner.sum()) < 0) continue; //error is logged
+            
+            combPublish();
+         }
+         else
+         {
+            //EINTR is a signal, the loop checks the flags.  ETIMEDOUT just means we should wait more.
+            if(errno != EINTR && errno != ETIMEDOUT)
+            {
+               derivedT::template log<software_error>({__FILE__, __LINE__,errno, "sem_timedwait"});
+               break;
+            }
+         }
+      }
+      
+      combClose();
+   }
+}
+
+template<class derivedT, typename realT>
+void dm<derivedT,realT>::combWaiterExec( size_t ch,
+                                          int semIndex
+                                        )
+{
+   sem_t * sem = m_combImages[ch].semptr[semIndex];
+   
+   while(m_combWaitersRun)
+   {
+      timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += 1;
+      
+      if(sem_timedwait(sem, &ts) == 0)
+      {
+         sem_post(&m_combSemaphore);
+      }
+   }
+}
+
+template<class derivedT, typename realT>
+int dm<derivedT,realT>::combChannels()
+{
+   std::lock_guard<std::mutex> lock(m_channelsMutex);
+   
+   return m_channels;
+}
+
+template<class derivedT, typename realT>
+int dm<derivedT,realT>::combOpen()
+{
+   int nch = combChannels();
+   if(nch <= 0) return -1;
+   
+   m_combImages.resize(nch);
+   
+   for(int n=0; n < nch; ++n)
+   {
+      char nstr[16];
+      snprintf(nstr,sizeof(nstr), "%02d", n);
+      std::string shmimN = derived().m_shmimName + nstr;
+      
+      if( ImageStreamIO_openIm(&m_combImages[n], shmimN.c_str()) != 0)
+      {
+         for(int m=0; m < n; ++m) ImageStreamIO_closeIm(&m_combImages[m]);
+         derivedT::template log<text_log>("could not connect to channel " + shmimN, logPrio::LOG_WARNING);
+         return -1;
+      }
+      
+      if( m_combImages[n].md->size[0] != m_dmWidth || m_combImages[n].md->size[1] != m_dmHeight || m_combImages[n].md->datatype != m_dmDataType)
+      {
+         for(int m=0; m <= n; ++m) ImageStreamIO_closeIm(&m_combImages[m]);
+         derivedT::template log<text_log>("size or type mismatch between " + shmimN + " and configured DM", logPrio::LOG_ERROR);
+         return -1;
+      }
+   }
+   
+   if( ImageStreamIO_openIm(&m_combDispStream, derived().m_shmimName.c_str()) != 0)
+   {
+      for(int m=0; m < nch; ++m) ImageStreamIO_closeIm(&m_combImages[m]);
+      derivedT::template log<text_log>("could not connect to " + derived().m_shmimName, logPrio::LOG_WARNING);
+      return -1;
+   }
+   
+   m_combiner.resize(nch, m_dmWidth*m_dmHeight);
+   
+   m_combCnt0.resize(nch);
+   m_combData.resize(nch);
+   
+   m_combWaitersRun = true;
+   m_combWaiters.clear();
+   for(int n=0; n < nch; ++n)
+   {
+      int semIndex = ImageStreamIO_getsemwaitindex(&m_combImages[n], derived().m_semaphoreNumber);
+      if(semIndex < 0)
+      {
+         derivedT::template log<text_log>("no semaphore available on channel " + std::to_string(n), logPrio::LOG_ERROR);
+         combClose();
+         return -1;
+      }
+      ImageStreamIO_semflush(&m_combImages[n], semIndex);
+      
+      m_combWaiters.push_back(std::thread(&dm<derivedT,realT>::combWaiterExec, this, (size_t) n, semIndex));
+   }
+   
+   derivedT::template log<text_log>("combining " + std::to_string(nch) + " channels into " + derived().m_shmimName);
+   
+   return 0;
+}
+
+template<class derivedT, typename realT>
+void dm<derivedT,realT>::combClose()
+{
+   m_combWaitersRun = false;
+   for(size_t n=0; n < m_combWaiters.size(); ++n)
+   {
+      if(m_combWaiters[n].joinable()) m_combWaiters[n].join();
+   }
+   m_combWaiters.clear();
+   
+   for(size_t n=0; n < m_combImages.size(); ++n)
+   {
+      ImageStreamIO_closeIm(&m_combImages[n]);
+   }
+   m_combImages.clear();
+   
+   ImageStreamIO_closeIm(&m_combDispStream);
+}
+
+template<class derivedT, typename realT>
+bool dm<derivedT,realT>::combUpdate( bool full )
+{
+   for(size_t n=0; n < m_combImages.size(); ++n)
+   {
+      m_combCnt0[n] = m_combImages[n].md->cnt0;
+      
+      //Channels with a circular buffer, such as those played by a modulationEngine, are read from the cnt1 slot.
+      uint64_t slot = 0;
+      if(m_combImages[n].md->naxis == 3 && m_combImages[n].md->cnt1 < m_combImages[n].md->size[2]) slot = m_combImages[n].md->cnt1;
+      
+      m_combData[n] = (const realT *) (((char *) m_combImages[n].array.raw) + slot*m_dmWidth*m_dmHeight*sizeof(realT));
+   }
+   
+   return m_combiner.update(m_combCnt0.data(), m_combData.data(), full);
+}
+
+template<class derivedT, typename realT>
+void dm<derivedT,realT>::combPublish()
+{
+   m_combDispStream.md->write=1;
+   
+   memcpy( m_combDispStream.array.raw, m_combiner.sum(), m_dmWidth*m_dmHeight*sizeof(realT));
+   
+   //Set the time of last write
+   clock_gettime(CLOCK_REALTIME, &m_combDispStream.md->writetime);
+
+   //Set the image acquisition timestamp
+   m_combDispStream.md->atime = m_combDispStream.md->writetime;
+   
+   m_combDispStream.md->cnt1 = 0;
+   m_combDispStream.md->cnt0++;
+   m_combDispStream.md->write=0;
+   
+   ImageStreamIO_sempost(&m_combDispStream,-1);
+}
+
 template<class derivedT, typename realT>
 int dm<derivedT,realT>::updateINDI()
 {
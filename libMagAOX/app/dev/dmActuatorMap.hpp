@@ -0,0 +1,221 @@
+/** \file dmActuatorMap.hpp
+  * \brief Actuator mapping and conversion kernels for the DM controllers.
+  *
+  * \ingroup app_files
+  */
+
+#ifndef dmActuatorMap_hpp
+#define dmActuatorMap_hpp
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace MagAOX
+{
+namespace app
+{
+namespace dev
+{
+
+/// Conversion traits for the BMC DMs.
+/** The command is the square root of the volume-normalized displacement, clipped to [0,1], which
+  * approximates the quadratic voltage-displacement response.
+  */
+struct bmcActuators
+{
+   static constexpr bool removeMean = false; ///< The mean is not removed.
+   static constexpr bool sqrtResponse = true; ///< The square root is applied after clipping.
+
+   static constexpr double lower() { return 0; } ///< The minimum command
+   static constexpr double upper() { return 1; } ///< The maximum command
+};
+
+/// Conversion traits for the ALPAO DMs.
+/** The command is the fractional stroke with the mean removed, clipped to [-1,1].
+  */
+struct alpaoActuators
+{
+   static constexpr bool removeMean = true; ///< The mean is removed.
+   static constexpr bool sqrtResponse = false; ///< The command is linear in displacement.
+
+   static constexpr double lower() { return -1; } ///< The minimum command
+   static constexpr double upper() { return 1; } ///< The maximum command
+};
+
+/// Converts a 2D DM shape into the command vector of a DM, and records which actuators saturated.
+/** The mapping from the command vector to the 2D shape is precomputed in setup(), with actuators which are addressable but ignored
+  * given a weight of 0.  The conversion is then a gather and scale pass over the command vector, a branch-free vectorized pass
+  * doing the mean removal, clipping, square root, and saturation flags, and finally packing the flags into a mask with one bit per actuator.
+  * The behavior for each DM family is set at compile time by `familyT`, see bmcActuators and alpaoActuators.
+  *
+  * An actuator is saturated if its command was clipped.
+  *
+  * \tparam familyT the conversion traits of the DM family
+  * \tparam inputT the data type of the shape, normally the realT of dev::dm
+  * \tparam outputT the data type of the command vector expected by the SDK
+  */
+template<class familyT, typename inputT, typename outputT>
+class actuatorMap
+{
+   static_assert( sizeof(outputT) >= sizeof(double), "actuatorMap: the command type must be at least double precision, for exact mask packing");
+
+protected:
+   uint32_t m_nbAct {0}; ///< The number of actuators in the command vector
+
+   std::vector<uint32_t> m_src; ///< The index in the shape of each actuator in the command vector, 0 if it is ignored.
+   std::vector<outputT> m_weight; ///< The scale factor for each actuator, 0 if it is ignored.
+   std::vector<outputT> m_active; ///< 1 for each actuator which is used, 0 if it is ignored.
+
+   std::vector<outputT> m_bitWeight; ///< The weight of each actuator's bit in its half of the mask, 2^(idx%32).
+   std::vector<outputT> m_satFlags; ///< Working memory for the weighted saturation flags, padded to a multiple of 64.
+   std::vector<uint64_t> m_satMask; ///< The saturation mask from the last call to apply(), one bit per actuator.
+
+public:
+
+   /// Setup the mapping.
+   /**
+     * \returns 0 on success
+     * \returns -1 if an address is outside the shape
+     */
+   int setup( const int * mapping, ///< [in] the index in the shape of each actuator in the command vector, -1 if it is ignored.
+              uint32_t nbAct,      ///< [in] the number of actuators in the command vector
+              size_t shapeSize,    ///< [in] the number of pixels in the shape
+              outputT scale        ///< [in] the factor which converts the shape to the command, before clipping.
+            )
+   {
+      m_nbAct = nbAct;
+
+      m_src.assign(nbAct, 0);
+      m_weight.assign(nbAct, 0);
+      m_active.assign(nbAct, 0);
+      m_satMask.assign( (nbAct + 63)/64, 0);
+      m_satFlags.assign( 64*m_satMask.size(), 0);
+      m_bitWeight.resize( m_satFlags.size());
+      for(size_t idx = 0; idx < m_bitWeight.size(); ++idx) m_bitWeight[idx] = static_cast<uint32_t>(1) << (idx % 32);
+
+      for(uint32_t idx = 0; idx < nbAct; ++idx)
+      {
+         if(mapping[idx] < 0) continue;
+
+         if(static_cast<size_t>(mapping[idx]) >= shapeSize) return -1;
+
+         m_src[idx] = mapping[idx];
+         m_weight[idx] = scale;
+         m_active[idx] = 1;
+      }
+
+      return 0;
+   }
+
+   /// Get the number of actuators in the command vector
+   uint32_t nbAct() const
+   {
+      return m_nbAct;
+   }
+
+   /// Get the index in the shape of each actuator in the command vector.
+   /** Ignored actuators are 0, check active().
+     */
+   const std::vector<uint32_t> & src() const
+   {
+      return m_src;
+   }
+
+   /// Get the 1/0 flag for each actuator which is used.
+   const std::vector<outputT> & active() const
+   {
+      return m_active;
+   }
+
+   /// Get the saturation mask from the last call to apply(), bit `idx%64` of word `idx/64` for actuator `idx`.
+   const std::vector<uint64_t> & satMask() const
+   {
+      return m_satMask;
+   }
+
+   /// Convert a shape to the command vector.
+   /**
+     * \returns the number of saturated actuators.
+     */
+   uint32_t apply( outputT * cmd,        ///< [out] the command vector, nbAct long
+                   const inputT * shape  ///< [in] the shape
+                 )
+   {
+      const uint32_t * src = m_src.data();
+      const outputT * weight = m_weight.data();
+      const outputT * active = m_active.data();
+
+      const outputT lower = familyT::lower();
+      const outputT upper = familyT::upper();
+
+      //The gather is kept apart from the arithmetic, so the latter vectorizes without hardware gather instructions.
+      outputT mean = 0;
+      #pragma omp simd reduction(+:mean)
+      for(uint32_t idx = 0; idx < m_nbAct; ++idx)
+      {
+         cmd[idx] = static_cast<outputT>(shape[src[idx]]) * weight[idx];
+         if(familyT::removeMean) mean += cmd[idx];
+      }
+      if(familyT::removeMean) mean /= m_nbAct;
+
+      //Each flag is 0 or the weight of its bit in a 32 bit half of the mask, so the mask is packed with vectorized sums,
+      //which are exact.  The flags are the same width as the commands, which lets this vectorize with plain SSE2.
+      const outputT * bitWeight = m_bitWeight.data();
+      outputT * flags = m_satFlags.data();
+
+      #pragma omp simd
+      for(uint32_t idx = 0; idx < m_nbAct; ++idx)
+      {
+         outputT val = cmd[idx];
+         if(familyT::removeMean) val = (val - mean)*active[idx];
+
+         outputT clip = (val < lower) ? lower : val;
+         clip = (clip > upper) ? upper : clip;
+
+         outputT sat = (clip != val) ? 1 : 0;
+         flags[idx] = sat*bitWeight[idx];
+
+         if(familyT::sqrtResponse) clip = std::sqrt(clip);
+
+         cmd[idx] = clip;
+      }
+
+      uint32_t nsat = 0;
+      for(size_t w = 0; w < m_satMask.size(); ++w)
+      {
+         outputT lo = 0;
+         outputT hi = 0;
+         #pragma omp simd reduction(+:lo,hi)
+         for(uint32_t b = 0; b < 32; ++b)
+         {
+            lo += flags[64*w + b];
+            hi += flags[64*w + 32 + b];
+         }
+         m_satMask[w] = static_cast<uint64_t>(lo) | (static_cast<uint64_t>(hi) << 32);
+         nsat += __builtin_popcountll(m_satMask[w]);
+      }
+
+      return nsat;
+   }
+
+   /// Copy the saturation mask from the last call to apply() into a 1/0 map with the geometry of the shape.
+   /** Ignored actuators are not touched.
+     */
+   template<typename satT>
+   void satMap( satT * map /**< [out] the saturation map */ ) const
+   {
+      for(uint32_t idx = 0; idx < m_nbAct; ++idx)
+      {
+         if(m_active[idx] == 0) continue;
+
+         map[m_src[idx]] = (m_satFlags[idx] != 0);
+      }
+   }
+};
+
+} //namespace dev
+} //namespace app
+} //namespace MagAOX
+
+#endif //dmActuatorMap_hpp
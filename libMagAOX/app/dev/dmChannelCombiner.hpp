@@ -0,0 +1,140 @@
+/** \file dmChannelCombiner.hpp
+  * \brief Incremental sum of DM channels.
+  *
+  * \ingroup app_files
+  */
+
+#ifndef dmChannelCombiner_hpp
+#define dmChannelCombiner_hpp
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace MagAOX
+{
+namespace app
+{
+namespace dev
+{
+
+/// Keeps the sum of a set of DM channels, adding only the channels which changed.
+/** The last copy of each channel is kept, so that an update to one channel is applied to the sum
+  * as (new - last) in a single pass over the actuators.
+  * Since this accumulates round-off, update can also be asked to recompute the sum from scratch.
+  *
+  * Channels are identified as changed by their cnt0, so several wake-ups for the same write
+  * result in one changed update, and hence one command and one publish by the caller.
+  *
+  * This is not thread safe, and is meant to be owned by the combination thread.
+  */
+template<typename realT>
+class channelCombiner
+{
+protected:
+   size_t m_npix {0}; ///< The number of actuators in each channel.
+
+   std::vector<uint64_t> m_cnt0; ///< The cnt0 of each channel when it was last added to the sum.
+
+   std::vector<std::vector<realT>> m_last; ///< The last copy of each channel.
+
+   std::vector<realT> m_scratch; ///< Working memory for the latest channel data.
+
+   std::vector<realT> m_sum; ///< The running sum.
+
+public:
+
+   /// Set the number of channels and actuators.
+   /** The sum and the channel copies are zeroed.
+     */
+   void resize( size_t nch, ///< [in] the number of channels
+                size_t npix ///< [in] the number of actuators in each channel
+              )
+   {
+      m_npix = npix;
+      m_cnt0.assign(nch, 0);
+      m_last.resize(nch);
+      for(size_t n = 0; n < nch; ++n) m_last[n].assign(npix, 0);
+      m_scratch.assign(npix, 0);
+      m_sum.assign(npix, 0);
+   }
+
+   /// Get the number of channels
+   size_t channels() const
+   {
+      return m_last.size();
+   }
+
+   /// Get the number of actuators
+   size_t pixels() const
+   {
+      return m_npix;
+   }
+
+   /// Update the sum from the channels which have changed.
+   /** Channel n is read only if cnt0[n] differs from the cnt0 it had when last read, or if full is true.
+     *
+     * \returns true if the sum changed, and so should be sent and published
+     * \returns false otherwise
+     */
+   bool update( const uint64_t * cnt0,     ///< [in] the current cnt0 of each channel
+                const realT * const * data, ///< [in] the current data of each channel
+                bool full                  ///< [in] if true, all channels are re-read and the sum is recomputed from scratch
+              )
+   {
+      bool changed = full;
+
+      for(size_t n = 0; n < m_last.size(); ++n)
+      {
+         if(!full && cnt0[n] == m_cnt0[n]) continue;
+
+         m_cnt0[n] = cnt0[n];
+
+         //Take one copy, so the sum and m_last agree even if the channel is being written.
+         memcpy(m_scratch.data(), data[n], m_npix*sizeof(realT));
+
+         if(!full)
+         {
+            realT * sum = m_sum.data();
+            const realT * scr = m_scratch.data();
+            const realT * last = m_last[n].data();
+            for(size_t i = 0; i < m_npix; ++i) sum[i] += scr[i] - last[i];
+         }
+
+         m_last[n].swap(m_scratch);
+
+         changed = true;
+      }
+
+      if(full)
+      {
+         for(size_t i = 0; i < m_npix; ++i) m_sum[i] = 0;
+
+         for(size_t n = 0; n < m_last.size(); ++n)
+         {
+            const realT * last = m_last[n].data();
+            for(size_t i = 0; i < m_npix; ++i) m_sum[i] += last[i];
+         }
+      }
+
+      return changed;
+   }
+
+   /// Get the current sum
+   const realT * sum() const
+   {
+      return m_sum.data();
+   }
+
+   /// Get the current sum, e.g. to pass to a DM command.
+   realT * sum()
+   {
+      return m_sum.data();
+   }
+};
+
+} //namespace dev
+} //namespace app
+} //namespace MagAOX
+
+#endif //dmChannelCombiner_hpp
@@ -0,0 +1,339 @@
+/** \file dmModulationEngine.hpp
+  * \brief Deadline-scheduled playback of a sequence of DM shapes into a DM channel.
+  *
+  * \ingroup app_files
+  */
+
+#ifndef dmModulationEngine_hpp
+#define dmModulationEngine_hpp
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+
+#include <time.h>
+
+#include <ImageStruct.h>
+#include <ImageStreamIO.h>
+
+namespace MagAOX
+{
+namespace app
+{
+namespace dev
+{
+
+/// Timing statistics of a modulationEngine, over the ticks since they were last reset.
+/** The error of a tick is how late the shape was published relative to its deadline.
+  */
+struct modulationTiming
+{
+   uint64_t ticks {0}; ///< The number of timed ticks.
+   uint64_t missed {0}; ///< The number of deadlines which were skipped because a tick ran more than a period late.
+   double meanErr {0}; ///< The mean error, in microseconds.
+   double rmsErr {0}; ///< The RMS error, in microseconds.
+   double maxErr {0}; ///< The maximum error, in microseconds.
+};
+
+/// Publishes a sequence of shapes to a DM channel, one per tick, on a fixed schedule.
+/** Ticks are scheduled on absolute deadlines on CLOCK_MONOTONIC, which advance by exactly one period, so the
+  * modulation does not drift with scheduling latency or wall-clock adjustments.  The thread sleeps with
+  * `clock_nanosleep(TIMER_ABSTIME)` until the deadline, or optionally until a spin time before it and then
+  * busy-waits the rest, which removes most of the wake-up latency at the cost of a core.
+  *
+  * How much work a tick does depends on the depth of the channel's circular buffer:
+  * - if it has at least as many slots as there are shapes, all shapes are preloaded by setup() and a tick
+  *   only sets `cnt1` to the slot of the next shape, updates the counters and timing arrays, and posts.
+  * - if it has 2 or more slots, the next shape is copied into the slot after the published one once the tick
+  *   is published, so the copy is off the time-critical path.
+  * - otherwise the shape is copied into the single slot at the tick, as a single-buffered stream requires.
+  *
+  * Consumers of the channel must read the slot given by `cnt1` to see the shapes in the first two cases.
+  *
+  * One thread calls setup(), start(), tick(), and publish().  timing() may be called from any thread.
+  */
+class modulationEngine
+{
+protected:
+   IMAGE * m_stream {nullptr}; ///< The DM channel.
+   const char * m_shapes {nullptr}; ///< The shapes, contiguous, not owned.
+   uint32_t m_nShapes {0}; ///< The number of shapes.
+   size_t m_frameSize {0}; ///< The size of one shape, in bytes.
+   uint32_t m_slots {1}; ///< The number of slots in the channel's circular buffer.
+
+   uint32_t m_shape {0}; ///< The next shape to publish.
+   uint32_t m_nextSlot {0}; ///< The slot the next shape is staged in.
+
+   int64_t m_period {0}; ///< The tick period, in nanoseconds.
+   int64_t m_spin {0}; ///< The busy-wait before each deadline, in nanoseconds.
+   timespec m_deadline {0,0}; ///< The deadline of the next tick, on CLOCK_MONOTONIC.
+
+   std::mutex m_timingMutex; ///< Protects the timing accumulators.
+   uint64_t m_ticks {0}; ///< The number of timed ticks since the last reset.
+   uint64_t m_missed {0}; ///< The number of missed deadlines since the last reset.
+   double m_errSum {0}; ///< The sum of the errors, in nanoseconds.
+   double m_errSqSum {0}; ///< The sum of the squared errors, in nanoseconds squared.
+   int64_t m_errMax {0}; ///< The maximum error, in nanoseconds.
+
+public:
+
+   /// Setup the channel and the shapes to publish, and preload the shapes if the channel has the slots.
+   /** The shapes must remain valid until the next call to setup().
+     *
+     * \returns 0 on success
+     * \returns -1 if there are no shapes or no channel
+     */
+   int setup( IMAGE * stream,       ///< [in] the opened DM channel
+              const void * shapes,  ///< [in] the shapes, contiguous, each of frameSize bytes
+              uint32_t nShapes,     ///< [in] the number of shapes
+              size_t frameSize      ///< [in] the size of one shape in bytes, which must match the channel
+            )
+   {
+      if(stream == nullptr || shapes == nullptr || nShapes == 0) return -1;
+
+      m_stream = stream;
+      m_shapes = static_cast<const char *>(shapes);
+      m_nShapes = nShapes;
+      m_frameSize = frameSize;
+
+      m_slots = 1;
+      if(m_stream->md->naxis == 3 && m_stream->md->size[2] > 1) m_slots = m_stream->md->size[2];
+
+      m_shape = 0;
+
+      if(m_slots >= m_nShapes)
+      {
+         m_stream->md->write = 1;
+         for(uint32_t n = 0; n < m_nShapes; ++n) memcpy(slot(n), shape(n), m_frameSize);
+         m_stream->md->write = 0;
+      }
+      else if(m_slots > 1)
+      {
+         stage(0);
+      }
+
+      return 0;
+   }
+
+   /// Get whether all the shapes are preloaded in the channel.
+   bool preloaded() const
+   {
+      return m_slots >= m_nShapes && m_nShapes > 0;
+   }
+
+   /// Get the number of slots in the channel's circular buffer.
+   uint32_t slots() const
+   {
+      return m_slots;
+   }
+
+   /// Start the schedule, with the first deadline one period from now.
+   /** This also resets the timing statistics.
+     */
+   void start( double frequency, ///< [in] the tick frequency, in Hz
+               double spinTime   ///< [in] the time to busy-wait before each deadline, in seconds.  0 to sleep the whole time.
+             )
+   {
+      m_period = static_cast<int64_t>(1e9/frequency);
+      if(m_period < 1) m_period = 1;
+
+      m_spin = static_cast<int64_t>(spinTime*1e9);
+      if(m_spin < 0) m_spin = 0;
+
+      clock_gettime(CLOCK_MONOTONIC, &m_deadline);
+      advance(m_deadline, m_period);
+
+      timing(true);
+   }
+
+   /// Wait for the next deadline and publish the next shape.
+   /**
+     * \returns 0 on success
+     * \returns -1 on an error from clock_nanosleep, with errno set
+     */
+   int tick()
+   {
+      timespec wake = m_deadline;
+      advance(wake, -m_spin);
+
+      int rv;
+      while( (rv = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, nullptr)) == EINTR);
+      if(rv != 0)
+      {
+         errno = rv;
+         return -1;
+      }
+
+      timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      while(diff(now, m_deadline) < 0) clock_gettime(CLOCK_MONOTONIC, &now);
+
+      publish();
+
+      int64_t err = diff(now, m_deadline);
+
+      advance(m_deadline, m_period);
+
+      //If we're already past the next deadline, skip ahead to the next one on the same phase.
+      uint64_t missed = 0;
+      int64_t behind = diff(now, m_deadline);
+      if(behind >= 0)
+      {
+         missed = behind/m_period + 1;
+         advance(m_deadline, missed*m_period);
+      }
+
+      std::lock_guard<std::mutex> lock(m_timingMutex);
+      ++m_ticks;
+      m_missed += missed;
+      m_errSum += err;
+      m_errSqSum += static_cast<double>(err)*err;
+      if(err > m_errMax) m_errMax = err;
+
+      return 0;
+   }
+
+   /// Publish the next shape now, without regard to the schedule.
+   /** This is used directly when ticks come from an external trigger.
+     */
+   void publish( bool incrementCnt0 = true /**< [in] [optional] whether `cnt0` is incremented */)
+   {
+      uint32_t pubSlot = 0;
+      if(m_slots >= m_nShapes) pubSlot = m_shape;
+      else if(m_slots > 1) pubSlot = m_nextSlot;
+
+      m_stream->md->write = 1;
+
+      if(m_slots == 1) memcpy(slot(0), shape(m_shape), m_frameSize);
+
+      post(m_stream, pubSlot, incrementCnt0);
+
+      ++m_shape;
+      if(m_shape >= m_nShapes) m_shape = 0;
+
+      if(m_slots > 1 && m_slots < m_nShapes) stage( pubSlot + 1 < m_slots ? pubSlot + 1 : 0);
+   }
+
+   /// Publish a zero shape to a DM channel.
+   /** In a channel with a circular buffer the zeros are written to the slot after the current one.  This overwrites
+     * preloaded shapes, so setup() must be called again before the next start().
+     */
+   static void zero( IMAGE * stream,           ///< [in] the opened DM channel
+                     size_t frameSize,         ///< [in] the size of one shape in bytes
+                     bool incrementCnt0 = true ///< [in] [optional] whether `cnt0` is incremented
+                   )
+   {
+      uint32_t zSlot = 0;
+      if(stream->md->naxis == 3 && stream->md->size[2] > 1) zSlot = (stream->md->cnt1 + 1 < stream->md->size[2]) ? stream->md->cnt1 + 1 : 0;
+
+      stream->md->write = 1;
+
+      memset(static_cast<char *>(stream->array.raw) + zSlot*frameSize, 0, frameSize);
+
+      post(stream, zSlot, incrementCnt0);
+   }
+
+   /// Get the timing statistics since the last reset.
+   modulationTiming timing( bool reset = false /**< [in] [optional] if true the statistics are reset */)
+   {
+      std::lock_guard<std::mutex> lock(m_timingMutex);
+
+      modulationTiming mt;
+      mt.ticks = m_ticks;
+      mt.missed = m_missed;
+      if(m_ticks > 0)
+      {
+         mt.meanErr = m_errSum/m_ticks/1e3;
+         mt.rmsErr = sqrt(m_errSqSum/m_ticks)/1e3;
+         mt.maxErr = m_errMax/1e3;
+      }
+
+      if(reset)
+      {
+         m_ticks = 0;
+         m_missed = 0;
+         m_errSum = 0;
+         m_errSqSum = 0;
+         m_errMax = 0;
+      }
+
+      return mt;
+   }
+
+protected:
+
+   /// Get a pointer to a slot of the channel.
+   char * slot( uint32_t n )
+   {
+      return static_cast<char *>(m_stream->array.raw) + n*m_frameSize;
+   }
+
+   /// Get a pointer to a shape.
+   const char * shape( uint32_t n )
+   {
+      return m_shapes + n*m_frameSize;
+   }
+
+   /// Copy the next shape into a slot, to be published by the next tick.
+   void stage( uint32_t n )
+   {
+      memcpy(slot(n), shape(m_shape), m_frameSize);
+      m_nextSlot = n;
+   }
+
+   /// Make a slot current, update the counters and timing arrays, and post.  write must already be set.
+   static void post( IMAGE * stream,
+                     uint32_t n,
+                     bool incrementCnt0
+                   )
+   {
+      timespec currtime;
+      clock_gettime(CLOCK_REALTIME, &currtime);
+
+      stream->md->atime = currtime;
+      stream->md->writetime = currtime;
+
+      stream->md->cnt1 = n;
+      if(incrementCnt0) stream->md->cnt0++;
+
+      //These are only allocated for circular buffers
+      if(stream->writetimearray) stream->writetimearray[n] = currtime;
+      if(stream->atimearray) stream->atimearray[n] = currtime;
+      if(stream->cntarray) stream->cntarray[n] = stream->md->cnt0;
+
+      stream->md->write = 0;
+      ImageStreamIO_sempost(stream,-1);
+   }
+
+   /// Add nanoseconds to a timespec.
+   static void advance( timespec & ts,
+                        int64_t nsec
+                      )
+   {
+      int64_t ns = ts.tv_nsec + nsec;
+      ts.tv_sec += ns / 1000000000;
+      ns %= 1000000000;
+      if(ns < 0)
+      {
+         ns += 1000000000;
+         ts.tv_sec -= 1;
+      }
+      ts.tv_nsec = ns;
+   }
+
+   /// Get a - b in nanoseconds.
+   static int64_t diff( const timespec & a,
+                        const timespec & b
+                      )
+   {
+      return (static_cast<int64_t>(a.tv_sec) - b.tv_sec)*1000000000 + (a.tv_nsec - b.tv_nsec);
+   }
+};
+
+} //namespace dev
+} //namespace app
+} //namespace MagAOX
+
+#endif //dmModulationEngine_hpp
@@ -0,0 +1,226 @@
+/** \file dmSatAccumulator.hpp
+  * \brief Lock-free accumulation of DM actuator saturation masks.
+  *
+  * \ingroup app_files
+  */
+
+#ifndef dmSatAccumulator_hpp
+#define dmSatAccumulator_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace MagAOX
+{
+namespace app
+{
+namespace dev
+{
+
+/// Counts how many times each actuator was saturated, from one bit-packed mask per DM command.
+/** The counts are kept as bit-sliced (vertical) counters: plane p holds bit p of the count of every
+  * actuator, 64 actuators per word.  Adding a mask is a ripple-carry through the planes with word-wide
+  * AND and XOR, which stops as soon as no carries remain, so a command with few saturated actuators
+  * costs little more than scanning its mask.  Counts which reach the maximum stay there.
+  *
+  * There are two sets of counters.  The writer (the thread calling the DM's commandDM) adds to the active
+  * set, and the reader (the saturation thread) swaps sets with collect() and unpacks the inactive one.
+  * A busy flag per set, checked after the writer marks it and after the reader swaps, guarantees the
+  * reader never unpacks a set the writer is still adding to, without either side taking a lock.
+  * There must be one writer and one reader.
+  */
+class satAccumulator
+{
+public:
+   static constexpr int planes = 16; ///< The number of bits in each count.
+
+protected:
+   size_t m_bits {0}; ///< The number of actuators.
+   size_t m_words {0}; ///< The number of 64-bit words in a mask.
+
+   std::vector<uint64_t> m_planes[2]; ///< The counters, plane-major, for each set.
+   uint32_t m_naccum[2] {0,0}; ///< The number of masks added to each set.
+
+   std::atomic<int> m_active {0}; ///< The set the writer adds to.
+   std::atomic<bool> m_busy[2]; ///< True while the writer is adding to a set.
+
+   std::vector<uint64_t> m_carry; ///< Writer working memory for the carries.
+   std::vector<uint64_t> m_packed; ///< Writer working memory for packing byte maps.
+
+public:
+
+   satAccumulator()
+   {
+      m_busy[0] = false;
+      m_busy[1] = false;
+   }
+
+   /// Set the number of actuators, and zero all counts.
+   /** This must not be called while the writer or the reader are active.
+     */
+   void resize( size_t bits /**< [in] the number of actuators */)
+   {
+      m_bits = bits;
+      m_words = (bits + 63)/64;
+
+      m_planes[0].assign(planes*m_words, 0);
+      m_planes[1].assign(planes*m_words, 0);
+      m_naccum[0] = 0;
+      m_naccum[1] = 0;
+
+      m_carry.assign(m_words, 0);
+      m_packed.assign(m_words, 0);
+
+      m_active = 0;
+   }
+
+   /// Get the number of actuators.
+   size_t bits() const
+   {
+      return m_bits;
+   }
+
+   /// Get the number of 64-bit words in a mask.
+   size_t words() const
+   {
+      return m_words;
+   }
+
+   /// Add a saturation mask to the counts.  Called by the writer.
+   /** Bits beyond the number of actuators must be 0.
+     */
+   void record( const uint64_t * mask /**< [in] the mask, bit `n%64` of word `n/64` for actuator `n` */)
+   {
+      if(m_words == 0) return;
+
+      int set;
+      while(1)
+      {
+         set = m_active.load();
+         m_busy[set] = true;
+         if(m_active.load() == set) break;
+         m_busy[set] = false;
+      }
+
+      uint64_t * carry = m_carry.data();
+      const size_t nw = m_words;
+
+      uint64_t any = 0;
+      #pragma omp simd reduction(|:any)
+      for(size_t w = 0; w < nw; ++w)
+      {
+         carry[w] = mask[w];
+         any |= mask[w];
+      }
+
+      for(int p = 0; p < planes && any; ++p)
+      {
+         uint64_t * plane = m_planes[set].data() + p*nw;
+
+         any = 0;
+         #pragma omp simd reduction(|:any)
+         for(size_t w = 0; w < nw; ++w)
+         {
+            uint64_t c = plane[w] & carry[w];
+            plane[w] ^= carry[w];
+            carry[w] = c;
+            any |= c;
+         }
+      }
+
+      //These counts wrapped to 0, so set them to the maximum.
+      if(any)
+      {
+         for(int p = 0; p < planes; ++p)
+         {
+            uint64_t * plane = m_planes[set].data() + p*nw;
+            for(size_t w = 0; w < nw; ++w) plane[w] |= carry[w];
+         }
+      }
+
+      ++m_naccum[set];
+
+      m_busy[set] = false;
+   }
+
+   /// Pack a 0/1 byte map into a mask, and add it to the counts.  Called by the writer.
+   void record( const uint8_t * flags /**< [in] the map, one 0/1 byte for each actuator */)
+   {
+      if(m_words == 0) return;
+
+      uint64_t * packed = m_packed.data();
+
+      //The multiply moves byte k of 8 to bit 56+k.
+      size_t n = 0;
+      for(; n + 8 <= m_bits; n += 8)
+      {
+         uint64_t bytes;
+         memcpy(&bytes, flags + n, sizeof(bytes));
+
+         uint64_t bits = ((bytes * 0x0102040810204080ULL) >> 56);
+
+         if(n % 64 == 0) packed[n/64] = bits;
+         else packed[n/64] |= bits << (n % 64);
+      }
+
+      for(; n < m_bits; ++n)
+      {
+         if(n % 64 == 0) packed[n/64] = 0;
+         packed[n/64] |= static_cast<uint64_t>(flags[n] != 0) << (n % 64);
+      }
+
+      record(packed);
+   }
+
+   /// Swap the sets of counters and unpack the counts added since the last call.  Called by the reader.
+   /** The unpacked set is zeroed.
+     *
+     * \returns the number of masks which were added.
+     */
+   uint32_t collect( uint16_t * counts /**< [out] the count for each actuator */)
+   {
+      if(m_words == 0) return 0;
+
+      int set = m_active.load();
+      m_active = 1 - set;
+
+      while(m_busy[set]) std::this_thread::yield();
+
+      const size_t nw = m_words;
+      uint64_t * cntrs = m_planes[set].data();
+
+      for(size_t w = 0; w < nw; ++w)
+      {
+         size_t nb = (m_bits - 64*w < 64) ? m_bits - 64*w : 64;
+
+         uint64_t any = 0;
+         for(int p = 0; p < planes; ++p) any |= cntrs[p*nw + w];
+
+         for(size_t b = 0; b < nb; ++b)
+         {
+            uint16_t c = 0;
+            if( (any >> b) & 1)
+            {
+               for(int p = 0; p < planes; ++p) c |= ((cntrs[p*nw + w] >> b) & 1) << p;
+            }
+            counts[64*w + b] = c;
+         }
+      }
+
+      memset(cntrs, 0, planes*nw*sizeof(uint64_t));
+
+      uint32_t naccum = m_naccum[set];
+      m_naccum[set] = 0;
+
+      return naccum;
+   }
+};
+
+} //namespace dev
+} //namespace app
+} //namespace MagAOX
+
+#endif //dmSatAccumulator_hpp
@@ -0,0 +1,148 @@
+//#define CATCH_CONFIG_MAIN
+#include "../../../../tests/catch2/catch.hpp"
+
+#include <cstdlib>
+
+#include "../dmActuatorMap.hpp"
+
+namespace dmActuatorMap_tests
+{
+
+//Make a reversed mapping into a w x w shape, with every 7th actuator ignored.
+std::vector<int> makeMapping( uint32_t nbAct,
+                              uint32_t w
+                            )
+{
+   std::vector<int> mapping(nbAct);
+   for(uint32_t idx = 0; idx < nbAct; ++idx)
+   {
+      if(idx % 7 == 3) mapping[idx] = -1;
+      else mapping[idx] = (w*w - 1 - idx) % (w*w);
+   }
+   return mapping;
+}
+
+//Fill a shape with values which will saturate some actuators on both ends.
+std::vector<float> makeShape( uint32_t w )
+{
+   std::vector<float> shape(w*w);
+   srand48(12345);
+   for(size_t n = 0; n < shape.size(); ++n) shape[n] = 3*drand48() - 1.5;
+   return shape;
+}
+
+SCENARIO( "Converting a shape to a BMC command", "[dmActuatorMap]" )
+{
+   GIVEN("a 50x50 shape and a mapping with ignored actuators")
+   {
+      uint32_t w = 50;
+      uint32_t nbAct = 2048;
+      std::vector<int> mapping = makeMapping(nbAct, w);
+      std::vector<float> shape = makeShape(w);
+
+      double scale = 0.7;
+
+      MagAOX::app::dev::actuatorMap<MagAOX::app::dev::bmcActuators, float, double> am;
+      REQUIRE(am.setup(mapping.data(), nbAct, w*w, scale) == 0);
+
+      WHEN("the command is compared to the scalar calculation")
+      {
+         std::vector<double> cmd(nbAct, -10);
+         uint32_t nsat = am.apply(cmd.data(), shape.data());
+
+         std::vector<uint8_t> satmap(w*w, 2);
+         am.satMap(satmap.data());
+
+         uint32_t nsatRef = 0;
+         bool match = true;
+         bool satMatch = true;
+         for(uint32_t idx = 0; idx < nbAct; ++idx)
+         {
+            double ref = 0;
+            bool sat = false;
+            if(mapping[idx] != -1)
+            {
+               ref = shape[mapping[idx]] * scale;
+               if(ref > 1) { ref = 1; sat = true; }
+               else if(ref < 0) { ref = 0; sat = true; }
+               ref = sqrt(ref);
+
+               if(satmap[mapping[idx]] != sat) satMatch = false;
+            }
+            if(sat) ++nsatRef;
+
+            if(fabs(cmd[idx] - ref) > 1e-12) match = false;
+         }
+
+         REQUIRE(match == true);
+         REQUIRE(satMatch == true);
+         REQUIRE(nsat == nsatRef);
+         REQUIRE(nsat > 0);
+      }
+   }
+   GIVEN("a mapping outside the shape")
+   {
+      std::vector<int> mapping = {0, 1, 2, 9};
+
+      MagAOX::app::dev::actuatorMap<MagAOX::app::dev::bmcActuators, float, double> am;
+
+      WHEN("setting up")
+      {
+         REQUIRE(am.setup(mapping.data(), mapping.size(), 9, 1.0) == -1);
+      }
+   }
+}
+
+SCENARIO( "Converting a shape to an ALPAO command", "[dmActuatorMap]" )
+{
+   GIVEN("an 11x11 shape and a 97 actuator mapping")
+   {
+      uint32_t w = 11;
+      uint32_t nbAct = 97;
+      std::vector<int> mapping(nbAct);
+      for(uint32_t idx = 0; idx < nbAct; ++idx) mapping[idx] = (idx*5) % (w*w);
+      std::vector<float> shape = makeShape(w);
+
+      double scale = 0.9;
+
+      MagAOX::app::dev::actuatorMap<MagAOX::app::dev::alpaoActuators, float, double> am;
+      REQUIRE(am.setup(mapping.data(), nbAct, w*w, scale) == 0);
+
+      WHEN("the command is compared to the scalar calculation")
+      {
+         std::vector<double> cmd(nbAct, -10);
+         uint32_t nsat = am.apply(cmd.data(), shape.data());
+
+         std::vector<double> ref(nbAct);
+         double mean = 0;
+         for(uint32_t idx = 0; idx < nbAct; ++idx)
+         {
+            ref[idx] = shape[mapping[idx]] * scale;
+            mean += ref[idx];
+         }
+         mean /= nbAct;
+
+         uint32_t nsatRef = 0;
+         bool match = true;
+         bool maskMatch = true;
+         for(uint32_t idx = 0; idx < nbAct; ++idx)
+         {
+            bool sat = false;
+            ref[idx] -= mean;
+            if(ref[idx] > 1) { ref[idx] = 1; sat = true; }
+            else if(ref[idx] < -1) { ref[idx] = -1; sat = true; }
+            if(sat) ++nsatRef;
+
+            if(fabs(cmd[idx] - ref[idx]) > 1e-12) match = false;
+            if( ((am.satMask()[idx/64] >> (idx%64)) & 1) != sat) maskMatch = false;
+         }
+
+         REQUIRE(match == true);
+         REQUIRE(maskMatch == true);
+         REQUIRE(nsat == nsatRef);
+         REQUIRE(nsat > 0);
+      }
+   }
+}
+
+} //namespace dmActuatorMap_tests
@@ -0,0 +1,106 @@
+//#define CATCH_CONFIG_MAIN
+#include "../../../../tests/catch2/catch.hpp"
+
+#include <cstdlib>
+
+#include "../dmChannelCombiner.hpp"
+
+namespace dmChannelCombiner_tests
+{
+
+SCENARIO( "Combining DM channels", "[dmChannelCombiner]" )
+{
+   GIVEN("4 channels of 100 actuators")
+   {
+      size_t nch = 4;
+      size_t npix = 100;
+
+      MagAOX::app::dev::channelCombiner<float> comb;
+      comb.resize(nch, npix);
+
+      REQUIRE(comb.channels() == nch);
+      REQUIRE(comb.pixels() == npix);
+
+      //Small integers, so the sums are exact.
+      srand48(1618);
+      std::vector<std::vector<float>> chans(nch, std::vector<float>(npix));
+      for(size_t n = 0; n < nch; ++n)
+      {
+         for(size_t i = 0; i < npix; ++i) chans[n][i] = (int) (drand48()*200) - 100;
+      }
+
+      std::vector<uint64_t> cnt0(nch, 1);
+      std::vector<const float *> data(nch);
+      for(size_t n = 0; n < nch; ++n) data[n] = chans[n].data();
+
+      auto expected = [&]()
+      {
+         std::vector<float> sum(npix, 0);
+         for(size_t n = 0; n < nch; ++n)
+         {
+            for(size_t i = 0; i < npix; ++i) sum[i] += chans[n][i];
+         }
+         return sum;
+      };
+
+      auto current = [&]()
+      {
+         return std::vector<float>(comb.sum(), comb.sum() + npix);
+      };
+
+      WHEN("all channels are read")
+      {
+         REQUIRE(comb.update(cnt0.data(), data.data(), true));
+         REQUIRE(current() == expected());
+
+         THEN("nothing changes until a cnt0 does")
+         {
+            REQUIRE(!comb.update(cnt0.data(), data.data(), false));
+            REQUIRE(current() == expected());
+         }
+      }
+      WHEN("one channel is written once, and several wake-ups follow")
+      {
+         comb.update(cnt0.data(), data.data(), true);
+
+         for(size_t i = 0; i < npix; ++i) chans[2][i] = (int) (drand48()*200) - 100;
+         ++cnt0[2];
+
+         //The combination thread publishes once per update which returns true.
+         int npublish = 0;
+         for(int w = 0; w < 3; ++w)
+         {
+            if(comb.update(cnt0.data(), data.data(), false)) ++npublish;
+         }
+
+         REQUIRE(npublish == 1);
+         REQUIRE(current() == expected());
+      }
+      WHEN("several channels are written before one update")
+      {
+         comb.update(cnt0.data(), data.data(), true);
+
+         for(size_t n = 0; n < nch; n += 2)
+         {
+            for(size_t i = 0; i < npix; ++i) chans[n][i] = (int) (drand48()*200) - 100;
+            ++cnt0[n];
+         }
+
+         REQUIRE(comb.update(cnt0.data(), data.data(), false));
+         REQUIRE(!comb.update(cnt0.data(), data.data(), false));
+         REQUIRE(current() == expected());
+      }
+      WHEN("the combiner is resized")
+      {
+         comb.resize(nch+1, npix);
+
+         THEN("the sum is zeroed")
+         {
+            REQUIRE(comb.channels() == nch+1);
+            for(size_t i = 0; i < npix; ++i) REQUIRE(comb.sum()[i] == 0);
+         }
+      }
+   }
+}
+
+} //namespace dmChannelCombiner_tests
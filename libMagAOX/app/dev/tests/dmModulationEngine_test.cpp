@@ -0,0 +1,200 @@
+//#define CATCH_CONFIG_MAIN
+#include "../../../../tests/catch2/catch.hpp"
+
+#include <cstring>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../dmModulationEngine.hpp"
+
+namespace dmModulationEngine_tests
+{
+
+/// A DM channel in local memory, without semaphores.
+struct testChannel
+{
+   IMAGE m_image;
+   IMAGE_METADATA m_md;
+   std::vector<float> m_data;
+   std::vector<timespec> m_wtimes;
+   std::vector<timespec> m_atimes;
+   std::vector<uint64_t> m_cnts;
+
+   testChannel( uint32_t width,
+                uint32_t height,
+                uint32_t slots,
+                bool circBuff
+              )
+   {
+      memset(&m_image, 0, sizeof(m_image));
+      memset(&m_md, 0, sizeof(m_md));
+
+      m_md.size[0] = width;
+      m_md.size[1] = height;
+      m_md.size[2] = slots;
+      m_md.naxis = (slots > 1) ? 3 : 2;
+
+      m_data.assign(width*height*slots, -1);
+      m_image.md = &m_md;
+      m_image.array.raw = m_data.data();
+
+      if(circBuff)
+      {
+         m_wtimes.assign(slots, {0,0});
+         m_atimes.assign(slots, {0,0});
+         m_cnts.assign(slots, 0);
+         m_image.writetimearray = m_wtimes.data();
+         m_image.atimearray = m_atimes.data();
+         m_image.cntarray = m_cnts.data();
+      }
+   }
+
+   /// Get the first pixel of the current slot
+   float current()
+   {
+      return m_data[m_md.cnt1*m_md.size[0]*m_md.size[1]];
+   }
+};
+
+SCENARIO( "Publishing shapes to a DM channel", "[dmModulationEngine]" )
+{
+   GIVEN("4 shapes of 3x3, each filled with its index")
+   {
+      uint32_t w = 3;
+      uint32_t h = 3;
+      uint32_t nShapes = 4;
+      std::vector<float> shapes(w*h*nShapes);
+      for(size_t n = 0; n < shapes.size(); ++n) shapes[n] = n/(w*h);
+
+      WHEN("the channel has a slot for every shape")
+      {
+         testChannel ch(w, h, 8, true);
+         MagAOX::app::dev::modulationEngine me;
+
+         REQUIRE(me.setup(&ch.m_image, shapes.data(), nShapes, w*h*sizeof(float)) == 0);
+         REQUIRE(me.preloaded() == true);
+
+         for(uint32_t n = 0; n < nShapes; ++n) REQUIRE(ch.m_data[n*w*h] == n);
+         REQUIRE(ch.m_data[nShapes*w*h] == -1);
+
+         for(uint64_t n = 0; n < 9; ++n)
+         {
+            me.publish();
+            REQUIRE(ch.m_md.cnt1 == n % nShapes);
+            REQUIRE(ch.m_md.cnt0 == n+1);
+            REQUIRE(ch.current() == n % nShapes);
+            REQUIRE(ch.m_cnts[ch.m_md.cnt1] == n+1);
+            REQUIRE(ch.m_wtimes[ch.m_md.cnt1].tv_sec == ch.m_md.writetime.tv_sec);
+            REQUIRE(ch.m_wtimes[ch.m_md.cnt1].tv_nsec == ch.m_md.writetime.tv_nsec);
+         }
+      }
+      WHEN("the channel has fewer slots than shapes")
+      {
+         testChannel ch(w, h, 3, true);
+         MagAOX::app::dev::modulationEngine me;
+
+         REQUIRE(me.setup(&ch.m_image, shapes.data(), nShapes, w*h*sizeof(float)) == 0);
+         REQUIRE(me.preloaded() == false);
+
+         for(uint64_t n = 0; n < 9; ++n)
+         {
+            me.publish();
+            REQUIRE(ch.m_md.cnt1 == n % 3);
+            REQUIRE(ch.current() == n % nShapes);
+
+            //The next shape is already in the next slot
+            REQUIRE(ch.m_data[ ((n+1) % 3)*w*h ] == (n+1) % nShapes);
+         }
+      }
+      WHEN("the channel has a single slot and no timing arrays")
+      {
+         testChannel ch(w, h, 1, false);
+         MagAOX::app::dev::modulationEngine me;
+
+         REQUIRE(me.setup(&ch.m_image, shapes.data(), nShapes, w*h*sizeof(float)) == 0);
+         REQUIRE(me.slots() == 1);
+
+         for(uint64_t n = 0; n < 9; ++n)
+         {
+            me.publish(false);
+            REQUIRE(ch.m_md.cnt1 == 0);
+            REQUIRE(ch.m_md.cnt0 == 0);
+            REQUIRE(ch.current() == n % nShapes);
+            for(size_t p = 0; p < w*h; ++p) REQUIRE(ch.m_data[p] == n % nShapes);
+         }
+      }
+      WHEN("a preloaded channel is zeroed")
+      {
+         testChannel ch(w, h, 8, true);
+         MagAOX::app::dev::modulationEngine me;
+
+         REQUIRE(me.setup(&ch.m_image, shapes.data(), nShapes, w*h*sizeof(float)) == 0);
+
+         me.publish();
+         me.publish();
+         MagAOX::app::dev::modulationEngine::zero(&ch.m_image, w*h*sizeof(float));
+
+         REQUIRE(ch.m_md.cnt1 == 2);
+         REQUIRE(ch.m_md.cnt0 == 3);
+         for(size_t p = 0; p < w*h; ++p) REQUIRE(ch.m_data[2*w*h + p] == 0);
+
+         //The published shapes are untouched
+         REQUIRE(ch.m_data[w*h] == 1);
+      }
+   }
+}
+
+SCENARIO( "Scheduling ticks on deadlines", "[dmModulationEngine]" )
+{
+   GIVEN("2 shapes and a single slot channel")
+   {
+      std::vector<float> shapes({0,1});
+      testChannel ch(1, 1, 1, false);
+      MagAOX::app::dev::modulationEngine me;
+      REQUIRE(me.setup(&ch.m_image, shapes.data(), 2, sizeof(float)) == 0);
+
+      WHEN("ticking at 2 kHz with a busy-wait")
+      {
+         me.start(2000, 50e-6);
+
+         timespec ts0, ts1;
+         clock_gettime(CLOCK_MONOTONIC, &ts0);
+         for(int n = 0; n < 200; ++n) REQUIRE(me.tick() == 0);
+         clock_gettime(CLOCK_MONOTONIC, &ts1);
+
+         double dt = (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec)/1e9;
+
+         MagAOX::app::dev::modulationTiming mt = me.timing(true);
+
+         REQUIRE(mt.ticks == 200);
+         REQUIRE(mt.meanErr >= 0);
+         REQUIRE(mt.maxErr >= mt.meanErr);
+         REQUIRE(mt.rmsErr >= mt.meanErr);
+         REQUIRE(ch.m_md.cnt0 == 200);
+
+         //No drift: the 200th deadline is 100 ms after start, unless deadlines were missed on a busy machine
+         if(mt.missed == 0) REQUIRE(dt < 0.101 + 1e-6*mt.maxErr);
+         REQUIRE(dt >= 0.0995);
+
+         mt = me.timing();
+         REQUIRE(mt.ticks == 0);
+      }
+      WHEN("a tick is more than a period late")
+      {
+         me.start(1000, 0);
+         REQUIRE(me.tick() == 0);
+
+         usleep(10500);
+
+         REQUIRE(me.tick() == 0);
+
+         MagAOX::app::dev::modulationTiming mt = me.timing();
+         REQUIRE(mt.ticks == 2);
+         REQUIRE(mt.missed >= 9);
+         REQUIRE(mt.maxErr >= 9000);
+      }
+   }
+}
+
+} //namespace dmModulationEngine_tests
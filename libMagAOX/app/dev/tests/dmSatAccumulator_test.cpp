@@ -0,0 +1,120 @@
+//#define CATCH_CONFIG_MAIN
+#include "../../../../tests/catch2/catch.hpp"
+
+#include <cstdlib>
+#include <thread>
+
+#include "../dmSatAccumulator.hpp"
+
+namespace dmSatAccumulator_tests
+{
+
+SCENARIO( "Counting saturation masks", "[dmSatAccumulator]" )
+{
+   GIVEN("an accumulator for 2500 actuators")
+   {
+      size_t nbits = 2500;
+      MagAOX::app::dev::satAccumulator sa;
+      sa.resize(nbits);
+
+      REQUIRE(sa.words() == 40);
+
+      WHEN("random masks and byte maps are recorded")
+      {
+         srand48(2718);
+
+         std::vector<uint16_t> ref(nbits, 0);
+         std::vector<uint64_t> mask(sa.words());
+         std::vector<uint8_t> flags(nbits);
+
+         for(int n = 0; n < 500; ++n)
+         {
+            for(size_t b = 0; b < nbits; ++b)
+            {
+               flags[b] = (drand48() < 0.1);
+               ref[b] += flags[b];
+            }
+
+            if(n % 2)
+            {
+               sa.record(flags.data());
+            }
+            else
+            {
+               for(size_t w = 0; w < mask.size(); ++w) mask[w] = 0;
+               for(size_t b = 0; b < nbits; ++b) mask[b/64] |= static_cast<uint64_t>(flags[b]) << (b%64);
+               sa.record(mask.data());
+            }
+         }
+
+         std::vector<uint16_t> counts(nbits, 1);
+         uint32_t naccum = sa.collect(counts.data());
+
+         REQUIRE(naccum == 500);
+         REQUIRE(counts == ref);
+
+         //The collected set was zeroed, and nothing was added to the other
+         naccum = sa.collect(counts.data());
+         REQUIRE(naccum == 0);
+         naccum = sa.collect(counts.data());
+         REQUIRE(naccum == 0);
+         for(size_t b = 0; b < nbits; ++b) ref[b] = 0;
+         REQUIRE(counts == ref);
+      }
+      WHEN("a count passes the maximum")
+      {
+         std::vector<uint64_t> mask(sa.words(), 0);
+         mask[0] = 5;
+         for(int n = 0; n < 70000; ++n) sa.record(mask.data());
+         mask[0] = 1;
+         sa.record(mask.data());
+
+         std::vector<uint16_t> counts(nbits, 0);
+         sa.collect(counts.data());
+
+         REQUIRE(counts[0] == 65535);
+         REQUIRE(counts[1] == 0);
+         REQUIRE(counts[2] == 65535);
+         REQUIRE(counts[3] == 0);
+      }
+   }
+}
+
+SCENARIO( "Counting saturation masks with a concurrent reader", "[dmSatAccumulator]" )
+{
+   GIVEN("a writer thread and a reader collecting while it writes")
+   {
+      size_t nbits = 97;
+      MagAOX::app::dev::satAccumulator sa;
+      sa.resize(nbits);
+
+      WHEN("every mask saturates every actuator")
+      {
+         std::vector<uint64_t> mask(sa.words(), 0);
+         for(size_t b = 0; b < nbits; ++b) mask[b/64] |= static_cast<uint64_t>(1) << (b%64);
+
+         int nrec = 200000;
+         std::thread writer([&](){ for(int n = 0; n < nrec; ++n) sa.record(mask.data()); });
+
+         std::vector<uint16_t> counts(nbits);
+         uint64_t total = 0;
+         bool consistent = true;
+         while(total < (uint64_t) nrec)
+         {
+            uint32_t naccum = sa.collect(counts.data());
+            total += naccum;
+
+            //A partially added mask would show up as unequal counts
+            uint16_t expect = (naccum > 65535) ? 65535 : naccum;
+            for(size_t b = 0; b < nbits; ++b) if(counts[b] != expect) consistent = false;
+         }
+
+         writer.join();
+
+         REQUIRE(total == (uint64_t) nrec);
+         REQUIRE(consistent == true);
+      }
+   }
+}
+
+} //namespace dmSatAccumulator_tests
@@ -16,6 +16,8 @@
 
 #include "../../INDI/libcommon/IndiClient.hpp"
 
+#include "../../INDI/libcommon/IndiShmRing.hpp"
+
 #include "MagAOXApp.hpp"
 
 namespace MagAOX
@@ -70,6 +72,12 @@ protected:
    ///The port of the server for the INDI Client connection
    int m_serverPort {7624};
 
+   ///The shared memory ring for input from xindidriver, used if the parent's indiShm() is true.
+   pcf::IndiShmRing m_shmIn;
+
+   ///The shared memory ring for output to xindidriver, used if the parent's indiShm() is true.
+   pcf::IndiShmRing m_shmOut;
+
 private:
 
    /// Flag to hold the status of this connection.
@@ -79,7 +87,8 @@ public:
 
    /// Public c'tor
    /** Call pcf::IndiDriver c'tor, and then opens the FIFOs specified
-     * by parent.  If this fails, then m_good is set to false.
+     * by parent, or creates the shared memory rings if parent->indiShm() is true.
+     * If this fails, then m_good is set to false.
      * test this with good().
      */
    indiDriver( parentT * parent,
@@ -131,8 +140,45 @@ indiDriver<parentT>::indiDriver ( parentT * parent,
 {
    m_parent = parent;
 
+   //Our update() does nothing, so there is no need to wake up until there is input.
+   setUpdateInterval(-1);
+
    int fd;
 
+   //The rings are named after the driver, and xindidriver uses them if they exist.
+   std::string shmInName = "/" + szName + ".in";
+   std::string shmOutName = "/" + szName + ".out";
+
+   if(parent->indiShm())
+   {
+      size_t shmSize = parent->indiShmSize()*1048576;
+      if(shmSize < 4096) shmSize = 4096; //Leave room for at least ordinary property messages.
+
+      errno = 0;
+      if(m_shmIn.create(shmInName, shmSize) < 0)
+      {
+         parentT::template log<logger::software_error>({__FILE__, __LINE__, errno, "Error creating input INDI shared memory."});
+         m_good = false;
+         return;
+      }
+      setInputRing(&m_shmIn);
+
+      errno = 0;
+      if(m_shmOut.create(shmOutName, shmSize) < 0)
+      {
+         parentT::template log<logger::software_error>({__FILE__, __LINE__, errno, "Error creating output INDI shared memory."});
+         m_good = false;
+         return;
+      }
+      setOutputRing(&m_shmOut);
+   }
+   else
+   {
+      //Remove rings left over from a previous run so xindidriver uses the FIFOs.
+      pcf::IndiShmRing::unlink(shmInName);
+      pcf::IndiShmRing::unlink(shmOutName);
+   }
+
    errno = 0;
    fd = open( parent->driverInName().c_str(), O_RDWR);
    if(fd < 0)
@@ -181,6 +227,15 @@ indiDriver<parentT>::~indiDriver()
 {
    if(m_outGoing) delete m_outGoing;
 
+   if(m_shmIn.isAttached())
+   {
+      pcf::IndiShmRing::unlink(m_shmIn.getName());
+   }
+
+   if(m_shmOut.isAttached())
+   {
+      pcf::IndiShmRing::unlink(m_shmOut.getName());
+   }
 }
 template<class parentT>
 void indiDriver<parentT>::handleDefProperty( const pcf::IndiProperty &ipRecv )
@@ -0,0 +1,484 @@
+/** \file indiPublishScheduler.hpp
+  * \brief MagAO-X rate-limited, coalescing INDI publisher
+  * \author Jared R. Males (jaredmales@gmail.com)
+  *
+  * History:
+  * - 2026-10-18 created
+  *
+  * \ingroup app_files
+  */
+
+#ifndef app_indiPublishScheduler_hpp
+#define app_indiPublishScheduler_hpp
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+#include "../../INDI/libcommon/IndiProperty.hpp"
+
+namespace MagAOX
+{
+namespace app
+{
+namespace indi
+{
+
+/// Priority classes for the INDI publish scheduler
+/**
+  * \ingroup indi
+  */
+enum class publishPriority
+{
+   immediate, ///< Every update is sent as soon as it is made.  This is the behavior of properties not registered with the scheduler.
+   normal,    ///< Value updates are coalesced and sent at no more than the maximum rate, but property state changes are sent immediately.
+   low        ///< Value updates and state changes are both coalesced and sent at no more than the maximum rate.
+};
+
+/// A rate-limited, coalescing scheduler for INDI SetProperty messages.
+/** Properties are registered with a maximum publish rate and a priority class.  When an update
+  * to a registered property is requested via sendSetProperty, the property is marked dirty rather than
+  * being sent, unless it is immediate priority or (for normal priority) its INDI state has changed.
+  * Dirty properties are sent by flush() once their minimum interval has elapsed since the last send.  Each
+  * coalesced update copies the property, while the caller still holds whatever lock protects it, and the flush
+  * sends the latest copy.  So any number of updates made in the interval are coalesced into a single message,
+  * and the flushing thread never reads the property while the application is changing it.
+  *
+  * Properties which are not registered are always sent immediately.
+  *
+  * This class implements `sendSetProperty`, so it can be passed in place of the INDI driver to the
+  * functions in indiUtils.hpp, e.g. indi::updateIfChanged.
+  *
+  * Registered properties must outlive the scheduler, since they are tracked by address.
+  *
+  * \tparam indiDriverT is the INDI driver type, which must provide `sendSetProperty(const pcf::IndiProperty &)`.
+  *
+  * \ingroup indi
+  */
+template<class indiDriverT>
+class publishScheduler
+{
+
+protected:
+
+   /// The scheduling details for each registered property
+   struct entry
+   {
+      double m_minInterval {0}; ///< The minimum time between sends [sec].  0 means use the scheduler default.
+      publishPriority m_priority {publishPriority::normal}; ///< The priority class of this property.
+      double m_lastSent {0}; ///< The time of the last send [sec].
+      pcf::IndiProperty::PropertyStateType m_lastState {pcf::IndiProperty::UnknownPropertyState}; ///< The INDI state at the last send.
+      bool m_dirty {false}; ///< Flag indicating that the property has unsent updates.
+      uint64_t m_sent {0}; ///< Count of messages actually sent for this property.
+      uint64_t m_suppressed {0}; ///< Count of updates which were coalesced, i.e. not sent on their own.
+      pcf::IndiProperty m_pending; ///< A copy of the property at its last coalesced update, which flush() sends.
+   };
+
+   indiDriverT * m_driver {nullptr}; ///< The INDI driver used to actually send the property.
+
+   double m_defaultInterval {0.1}; ///< The minimum interval used for properties registered without their own rate [sec].
+
+   bool m_enabled {true}; ///< If false, every update is sent immediately.
+
+   std::unordered_map<const pcf::IndiProperty *, entry> m_entries; ///< The registered properties, keyed by address.
+
+   uint64_t m_totalSent {0}; ///< Total messages sent for all properties, including unregistered ones.  Protected by m_mutex.
+
+   uint64_t m_totalSuppressed {0}; ///< Total updates coalesced for all properties.  Protected by m_mutex.
+
+   std::mutex m_mutex; ///< Mutex protecting the entries and counters.
+
+   std::condition_variable m_cv; ///< Used to wake a flushing thread when a property becomes dirty.
+
+   bool m_newDirty {false}; ///< Flag indicating that a property has become dirty since the last flush, protected by m_mutex.
+
+public:
+
+   /// Get the current time for scheduling purposes
+   /** Uses the monotonic clock, so this is not affected by time changes.
+     *
+     * \returns the current time in seconds.
+     */
+   static double now()
+   {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+   }
+
+   /// Set the INDI driver
+   void driver( indiDriverT * drv /**< [in] the new driver pointer, can be nullptr */);
+
+   /// Get the INDI driver
+   /**
+     * \returns the current value of m_driver
+     */
+   indiDriverT * driver();
+
+   /// Set the default maximum publish rate
+   /** A rate \<= 0 disables the scheduler, so that all updates are sent immediately.
+     */
+   void defaultRate( double rate /**< [in] the new default rate [Hz] */);
+
+   /// Get the default maximum publish rate
+   /**
+     * \returns the default rate in Hz, or 0 if the scheduler is disabled.
+     */
+   double defaultRate();
+
+   /// Register a property with the scheduler
+   /** Can be called again to change the rate or priority of an already registered property.
+     *
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int setRate( const pcf::IndiProperty & prop,                     ///< [in] the property to schedule.  Must outlive the scheduler.
+                double maxRate = 0,                                 ///< [in] [optional] the maximum publish rate [Hz]. If \<= 0 the default rate is used.
+                publishPriority priority = publishPriority::normal ///< [in] [optional] the priority class
+              );
+
+   /// Send a SetProperty, or mark it dirty for a later flush, according to its schedule
+   /** This is the interface used by the indiUtils update functions.
+     *
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int sendSetProperty( const pcf::IndiProperty & prop /**< [in] the property to send */);
+
+   /// Send a SetProperty, or mark it dirty for a later flush, according to its schedule
+   /** This version uses the supplied time.
+     *
+     * \overload
+     *
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int sendSetProperty( const pcf::IndiProperty & prop, ///< [in] the property to send
+                        double tnow                     ///< [in] the current time [sec]
+                      );
+
+   /// Send all dirty properties whose minimum interval has elapsed
+   /**
+     * \returns the time [sec] until the next dirty property is due, or a negative number if none are dirty.
+     */
+   double flush( bool force = false /**< [in] [optional] if true all dirty properties are sent regardless of their schedule */);
+
+   /// Send all dirty properties whose minimum interval has elapsed, using the supplied time
+   /**
+     * \overload
+     *
+     * \returns the time [sec] until the next dirty property is due, or a negative number if none are dirty.
+     */
+   double flush( double tnow,       ///< [in] the current time [sec]
+                 bool force = false ///< [in] [optional] if true all dirty properties are sent regardless of their schedule
+               );
+
+   /// Wait until a dirty property may be due, or until the timeout expires
+   /** Returns early if a property has been marked dirty since the last flush, or if wake() is called.
+     */
+   void wait( double timeout /**< [in] the maximum time to wait [sec] */ );
+
+   /// Wake any thread which is in wait().
+   void wake();
+
+   /// Get the number of updates to a property which were coalesced
+   /**
+     * \returns the suppressed count for the property, or 0 if it is not registered.
+     */
+   uint64_t suppressed( const pcf::IndiProperty & prop /**< [in] the property to query */);
+
+   /// Get the number of messages sent for a property
+   /**
+     * \returns the sent count for the property, or 0 if it is not registered.
+     */
+   uint64_t sent( const pcf::IndiProperty & prop /**< [in] the property to query */);
+
+   /// Get the total number of coalesced updates
+   /**
+     * \returns m_totalSuppressed
+     */
+   uint64_t totalSuppressed();
+
+   /// Get the total number of messages sent
+   /**
+     * \returns m_totalSent
+     */
+   uint64_t totalSent();
+
+   /// Get the number of properties currently dirty
+   /**
+     * \returns the number of registered properties with unsent updates.
+     */
+   size_t pending();
+
+protected:
+
+   /// Get the minimum interval for an entry, applying the default
+   /**
+     * \returns the minimum interval [sec]
+     */
+   double interval( const entry & ent );
+
+   /// Actually send the property.  Must be called with m_mutex locked.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int send( const pcf::IndiProperty & prop, ///< [in] the property to send
+             entry * ent,                    ///< [in/out] the entry for this property, nullptr if not registered
+             double tnow                     ///< [in] the current time [sec]
+           );
+};
+
+template<class indiDriverT>
+void publishScheduler<indiDriverT>::driver( indiDriverT * drv )
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+   m_driver = drv;
+}
+
+template<class indiDriverT>
+indiDriverT * publishScheduler<indiDriverT>::driver()
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+   return m_driver;
+}
+
+template<class indiDriverT>
+void publishScheduler<indiDriverT>::defaultRate( double rate )
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+
+   if(rate <= 0)
+   {
+      m_enabled = false;
+      return;
+   }
+
+   m_enabled = true;
+   m_defaultInterval = 1.0/rate;
+}
+
+template<class indiDriverT>
+double publishScheduler<indiDriverT>::defaultRate()
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+
+   if(!m_enabled) return 0;
+
+   return 1.0/m_defaultInterval;
+}
+
+template<class indiDriverT>
+int publishScheduler<indiDriverT>::setRate( const pcf::IndiProperty & prop,
+                                            double maxRate,
+                                            publishPriority priority
+                                          )
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+
+   entry & ent = m_entries[&prop];
+
+   if(maxRate > 0) ent.m_minInterval = 1.0/maxRate;
+   else ent.m_minInterval = 0;
+
+   ent.m_priority = priority;
+
+   return 0;
+}
+
+template<class indiDriverT>
+int publishScheduler<indiDriverT>::sendSetProperty( const pcf::IndiProperty & prop )
+{
+   return sendSetProperty(prop, now());
+}
+
+template<class indiDriverT>
+int publishScheduler<indiDriverT>::sendSetProperty( const pcf::IndiProperty & prop,
+                                                    double tnow
+                                                  )
+{
+   std::unique_lock<std::mutex> lock(m_mutex);
+
+   if(!m_driver) return 0;
+
+   auto it = m_entries.find(&prop);
+
+   //Unregistered properties are always sent immediately.
+   if(it == m_entries.end()) return send(prop, nullptr, tnow);
+
+   entry & ent = it->second;
+
+   if(!m_enabled || ent.m_priority == publishPriority::immediate) return send(prop, &ent, tnow);
+
+   if(ent.m_priority == publishPriority::normal && prop.getState() != ent.m_lastState) return send(prop, &ent, tnow);
+
+   //Otherwise we coalesce, and let the flusher send it when it's due.  The copy is made now, since the caller holds
+   //the property's lock and the flusher does not.
+   ent.m_pending = prop;
+   ++ent.m_suppressed;
+   ++m_totalSuppressed;
+
+   if(!ent.m_dirty)
+   {
+      ent.m_dirty = true;
+      m_newDirty = true;
+      lock.unlock();
+      m_cv.notify_all();
+   }
+
+   return 0;
+}
+
+template<class indiDriverT>
+double publishScheduler<indiDriverT>::flush( bool force )
+{
+   return flush(now(), force);
+}
+
+template<class indiDriverT>
+double publishScheduler<indiDriverT>::flush( double tnow,
+                                             bool force
+                                           )
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+
+   m_newDirty = false;
+
+   double next = -1;
+
+   for(auto it = m_entries.begin(); it != m_entries.end(); ++it)
+   {
+      entry & ent = it->second;
+
+      if(!ent.m_dirty) continue;
+
+      double due = ent.m_lastSent + interval(ent);
+
+      if(force || due <= tnow || !m_enabled)
+      {
+         //A flushed send does not count as a suppressed update, it is the coalesced message.
+         --ent.m_suppressed;
+         --m_totalSuppressed;
+         send(ent.m_pending, &ent, tnow);
+         continue;
+      }
+
+      if(next < 0 || due - tnow < next) next = due - tnow;
+   }
+
+   return next;
+}
+
+template<class indiDriverT>
+void publishScheduler<indiDriverT>::wait( double timeout )
+{
+   std::unique_lock<std::mutex> lock(m_mutex);
+
+   m_cv.wait_for(lock, std::chrono::duration<double>(timeout), [this]{return m_newDirty;});
+}
+
+template<class indiDriverT>
+void publishScheduler<indiDriverT>::wake()
+{
+   {
+      std::lock_guard<std::mutex> guard(m_mutex);
+      m_newDirty = true;
+   }
+
+   m_cv.notify_all();
+}
+
+template<class indiDriverT>
+uint64_t publishScheduler<indiDriverT>::suppressed( const pcf::IndiProperty & prop )
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+
+   auto it = m_entries.find(&prop);
+   if(it == m_entries.end()) return 0;
+
+   return it->second.m_suppressed;
+}
+
+template<class indiDriverT>
+uint64_t publishScheduler<indiDriverT>::sent( const pcf::IndiProperty & prop )
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+
+   auto it = m_entries.find(&prop);
+   if(it == m_entries.end()) return 0;
+
+   return it->second.m_sent;
+}
+
+template<class indiDriverT>
+uint64_t publishScheduler<indiDriverT>::totalSuppressed()
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+   return m_totalSuppressed;
+}
+
+template<class indiDriverT>
+uint64_t publishScheduler<indiDriverT>::totalSent()
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+   return m_totalSent;
+}
+
+template<class indiDriverT>
+size_t publishScheduler<indiDriverT>::pending()
+{
+   std::lock_guard<std::mutex> guard(m_mutex);
+
+   size_t n = 0;
+   for(auto it = m_entries.begin(); it != m_entries.end(); ++it)
+   {
+      if(it->second.m_dirty) ++n;
+   }
+
+   return n;
+}
+
+template<class indiDriverT>
+double publishScheduler<indiDriverT>::interval( const entry & ent )
+{
+   if(ent.m_minInterval > 0) return ent.m_minInterval;
+
+   return m_defaultInterval;
+}
+
+template<class indiDriverT>
+int publishScheduler<indiDriverT>::send( const pcf::IndiProperty & prop,
+                                         entry * ent,
+                                         double tnow
+                                       )
+{
+   if(ent)
+   {
+      ent->m_dirty = false;
+      ent->m_lastSent = tnow;
+      ent->m_lastState = prop.getState();
+      ++ent->m_sent;
+   }
+
+   ++m_totalSent;
+
+   if(!m_driver) return 0;
+
+   try
+   {
+      m_driver->sendSetProperty(prop);
+   }
+   catch(...)
+   {
+      return -1;
+   }
+
+   return 0;
+}
+
+} //namespace indi
+} //namespace app
+} //namespace MagAOX
+
+#endif //app_indiPublishScheduler_hpp
@@ -0,0 +1,181 @@
+//#define CATCH_CONFIG_MAIN
+#include "../../../tests/catch2/catch.hpp"
+
+#include "../indiPublishScheduler.hpp"
+
+namespace indiPublishScheduler_tests
+{
+
+//Stands in for the INDI driver, just records what is sent.
+struct mockDriver
+{
+   std::vector<std::string> m_sentNames;
+   std::vector<double> m_sentValues;
+
+   void sendSetProperty( const pcf::IndiProperty & ipSend )
+   {
+      m_sentNames.push_back(ipSend.getName());
+      m_sentValues.push_back(ipSend["current"].get<double>());
+   }
+};
+
+typedef MagAOX::app::indi::publishScheduler<mockDriver> schedulerT;
+
+pcf::IndiProperty makeProp( const std::string & name )
+{
+   pcf::IndiProperty prop(pcf::IndiProperty::Number);
+   prop.setDevice("test");
+   prop.setName(name);
+   prop.setState(pcf::IndiProperty::Ok);
+   prop.add(pcf::IndiElement("current", 0));
+   return prop;
+}
+
+SCENARIO( "Scheduling INDI SetProperty messages", "[indiPublishScheduler]" )
+{
+   GIVEN("a scheduler with a default rate of 10 Hz")
+   {
+      mockDriver drv;
+      schedulerT sched;
+      sched.driver(&drv);
+      sched.defaultRate(10);
+
+      pcf::IndiProperty pos = makeProp("pos");
+
+      WHEN("a property is not registered")
+      {
+         pos["current"] = 1.0;
+         sched.sendSetProperty(pos, 100.0);
+         pos["current"] = 2.0;
+         sched.sendSetProperty(pos, 100.01);
+
+         REQUIRE( drv.m_sentNames.size() == 2 );
+         REQUIRE( sched.totalSent() == 2 );
+         REQUIRE( sched.totalSuppressed() == 0 );
+      }
+
+      WHEN("a burst of updates is made to a normal priority property")
+      {
+         sched.setRate(pos);
+
+         for(int n=1; n <= 5; ++n)
+         {
+            pos["current"] = n;
+            sched.sendSetProperty(pos, 100.0 + 0.001*n);
+         }
+
+         //The first update is a state change from never having been sent
+         REQUIRE( drv.m_sentNames.size() == 1 );
+         REQUIRE( drv.m_sentValues[0] == 1.0 );
+         REQUIRE( sched.pending() == 1 );
+
+         //Not due yet
+         REQUIRE( sched.flush(100.005) > 0 );
+         REQUIRE( drv.m_sentNames.size() == 1 );
+
+         //Now it is due, and only the latest value goes out
+         REQUIRE( sched.flush(100.2) < 0 );
+         REQUIRE( drv.m_sentNames.size() == 2 );
+         REQUIRE( drv.m_sentValues[1] == 5.0 );
+         REQUIRE( sched.pending() == 0 );
+         REQUIRE( sched.sent(pos) == 2 );
+         REQUIRE( sched.suppressed(pos) == 3 );
+      }
+
+      WHEN("a property is changed after its last update, before the flush")
+      {
+         sched.setRate(pos);
+
+         pos["current"] = 1.0;
+         sched.sendSetProperty(pos, 100.0);
+         pos["current"] = 2.0;
+         sched.sendSetProperty(pos, 100.001);
+
+         //The app is still changing it, without asking for an update
+         pos["current"] = 3.0;
+
+         REQUIRE( sched.flush(100.2) < 0 );
+
+         THEN("the flush sends the property as it was at the last update")
+         {
+            REQUIRE( drv.m_sentNames.size() == 2 );
+            REQUIRE( drv.m_sentValues[1] == 2.0 );
+         }
+      }
+
+      WHEN("the state of a normal priority property changes")
+      {
+         sched.setRate(pos, 1.0);
+
+         pos["current"] = 1.0;
+         sched.sendSetProperty(pos, 100.0);
+         sched.flush(101.0);
+         REQUIRE( drv.m_sentNames.size() == 1 );
+
+         pos["current"] = 2.0;
+         pos.setState(pcf::IndiProperty::Busy);
+         sched.sendSetProperty(pos, 101.1);
+
+         REQUIRE( drv.m_sentNames.size() == 2 );
+         REQUIRE( drv.m_sentValues[1] == 2.0 );
+         REQUIRE( sched.pending() == 0 );
+      }
+
+      WHEN("the state of a low priority property changes")
+      {
+         sched.setRate(pos, 1.0, MagAOX::app::indi::publishPriority::low);
+
+         pos["current"] = 1.0;
+         pos.setState(pcf::IndiProperty::Busy);
+         sched.sendSetProperty(pos, 100.0);
+
+         REQUIRE( drv.m_sentNames.size() == 0 );
+         REQUIRE( sched.flush(100.5) < 0 );
+         REQUIRE( drv.m_sentNames.size() == 1 );
+      }
+
+      WHEN("a property is immediate priority")
+      {
+         sched.setRate(pos, 1.0, MagAOX::app::indi::publishPriority::immediate);
+
+         sched.sendSetProperty(pos, 100.0);
+         sched.sendSetProperty(pos, 100.001);
+
+         REQUIRE( drv.m_sentNames.size() == 2 );
+      }
+
+      WHEN("a flush is forced")
+      {
+         sched.setRate(pos, 1.0, MagAOX::app::indi::publishPriority::low);
+         pcf::IndiProperty temp = makeProp("temp");
+         sched.setRate(temp, 0.1, MagAOX::app::indi::publishPriority::low);
+
+         sched.sendSetProperty(pos, 100.0);
+         sched.sendSetProperty(temp, 100.0);
+         sched.flush(100.0);
+         REQUIRE( drv.m_sentNames.size() == 2 );
+
+         sched.sendSetProperty(pos, 100.1);
+         sched.sendSetProperty(temp, 100.1);
+         REQUIRE( sched.pending() == 2 );
+
+         sched.flush(100.1, true);
+         REQUIRE( drv.m_sentNames.size() == 4 );
+         REQUIRE( sched.pending() == 0 );
+      }
+
+      WHEN("rate limiting is disabled")
+      {
+         sched.setRate(pos);
+         sched.defaultRate(0);
+
+         sched.sendSetProperty(pos, 100.0);
+         sched.sendSetProperty(pos, 100.001);
+
+         REQUIRE( drv.m_sentNames.size() == 2 );
+         REQUIRE( sched.defaultRate() == 0 );
+      }
+   }
+}
+
+} //namespace indiPublishScheduler_tests
@@ -49,6 +49,16 @@
    #define MAGAOX_default_loopPause (1000000000)
 #endif
 
+#ifndef MAGAOX_default_indiPublishRate
+   /// The default maximum INDI publish rate
+   /** Defines the default maximum rate at which rate-limited INDI properties are sent.  Default is 10 Hz.
+     * A value \<= 0 disables rate limiting.
+     *
+     * Units: Hz.
+     */
+   #define MAGAOX_default_indiPublishRate (10.0)
+#endif
+
 ///@}
 
 #endif //common_defaults_hpp
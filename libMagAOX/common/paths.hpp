@@ -92,6 +92,20 @@
    #define MAGAOX_rawimageRelPath "rawimages"
 #endif
 
+#ifndef MAGAOX_xrifCatalogName
+   /// The name of the xrif archive catalog file.
+   /** This is the catalog of the archives in a raw image directory, kept in that directory.
+     */
+   #define MAGAOX_xrifCatalogName "xrif.catalog"
+#endif
+
+#ifndef MAGAOX_ioGateName
+   /// The base name of the I/O gate slot files.
+   /** These are the lock files, one per slot, shared by the stream writers of a raw images directory.  See sys::ioGate.
+     */
+   #define MAGAOX_ioGateName ".iogate"
+#endif
+
 ///@}
 
 #endif //common_paths_hpp
@@ -22,9 +22,15 @@
 #include "app/dev/dssShutter.hpp"
 #include "app/dev/shmimMonitor.hpp"
 #include "app/dev/dm.hpp"
+#include "app/dev/dmModulationEngine.hpp"
 #include "app/dev/telemeter.hpp"
 
+#include "sys/fileWatcher.hpp"
+#include "sys/ioGate.hpp"
 #include "sys/runCommand.hpp"
+#include "sys/xrifArchive.hpp"
+#include "sys/xrifCatalog.hpp"
+#include "sys/xrifPreview.hpp"
 
 #include "common/config.hpp"
 #include "common/defaults.hpp"
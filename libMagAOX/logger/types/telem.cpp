@@ -24,6 +24,7 @@ timespec telem_cooler::lastRecord = {0,0};
 timespec telem_coreloads::lastRecord = {0,0};
 timespec telem_coretemps::lastRecord = {0,0};
 timespec telem_dmspeck::lastRecord = {0,0};
+timespec telem_dmmodtiming::lastRecord = {0,0};
 timespec telem_drivetemps::lastRecord = {0,0};
 timespec telem_fxngen::lastRecord = {0,0};
 timespec telem_observer::lastRecord = {0,0};
@@ -38,6 +39,7 @@ timespec telem_telsee::lastRecord = {0,0};
 timespec telem_telvane::lastRecord = {0,0};
 timespec telem_temps::lastRecord = {0,0};
 timespec telem_usage::lastRecord = {0,0};
+timespec telem_xrifcompress::lastRecord = {0,0};
 timespec telem_zaber::lastRecord = {0,0};
 
 } //namespace logger
@@ -0,0 +1,150 @@
+/** \file telem_dmmodtiming.hpp
+  * \brief The MagAO-X logger telem_dmmodtiming log type.
+  *
+  * \ingroup logger_types_files
+  *
+  */
+#ifndef logger_types_telem_dmmodtiming_hpp
+#define logger_types_telem_dmmodtiming_hpp
+
+#include "generated/telem_dmmodtiming_generated.h"
+#include "flatbuffer_log.hpp"
+
+namespace MagAOX
+{
+namespace logger
+{
+
+
+/// Log entry recording the tick timing of a DM modulation.
+/** \ingroup logger_types
+  */
+struct telem_dmmodtiming : public flatbuffer_log
+{
+   ///The event code
+   static const flatlogs::eventCodeT eventCode = eventCodes::TELEM_DMMODTIMING;
+
+   ///The default level
+   static const flatlogs::logPrioT defaultLevel = flatlogs::logPrio::LOG_TELEM;
+
+   static timespec lastRecord; ///< The timestamp of the last time this log was recorded.  Used by the telemetry system.
+
+   ///The type of the input message
+   struct messageT : public fbMessage
+   {
+      ///Construct from components
+      messageT( const bool & preloaded,  ///< [in] whether or not the shapes are preloaded in the channel
+                const uint64_t & ticks,  ///< [in] the number of timed ticks in the interval
+                const uint64_t & missed, ///< [in] the number of deadlines missed in the interval
+                const float & meanErr,   ///< [in] the mean timing error in the interval, in microseconds
+                const float & rmsErr,    ///< [in] the RMS timing error in the interval, in microseconds
+                const float & maxErr     ///< [in] the maximum timing error in the interval, in microseconds
+              )
+      {
+         auto fp = CreateTelem_dmmodtiming_fb(builder, preloaded, ticks, missed, meanErr, rmsErr, maxErr);
+         builder.Finish(fp);
+      }
+
+   };
+
+
+   ///Get the message formatte for human consumption.
+   static std::string msgString( void * msgBuffer,  /**< [in] Buffer containing the flatbuffer serialized message.*/
+                                 flatlogs::msgLenT len  /**< [in] [unused] length of msgBuffer.*/
+                               )
+   {
+      static_cast<void>(len);
+      char num[128];
+
+      auto fbs = GetTelem_dmmodtiming_fb(msgBuffer);
+
+      std::string msg = "[modtiming] ";
+
+      if(fbs->preloaded()) msg += "preloaded ";
+
+      msg += "ticks: ";
+      msg += std::to_string(fbs->ticks());
+
+      msg += " missed: ";
+      msg += std::to_string(fbs->missed());
+
+      msg += " err (us) mean: ";
+      snprintf(num, sizeof(num), "%0.2f",fbs->meanErr());
+      msg += num;
+
+      msg += " rms: ";
+      snprintf(num, sizeof(num), "%0.2f",fbs->rmsErr());
+      msg += num;
+
+      msg += " max: ";
+      snprintf(num, sizeof(num), "%0.2f",fbs->maxErr());
+      msg += num;
+
+      return msg;
+
+   }
+
+   static bool preloaded( void * msgBuffer )
+   {
+      auto fbs = GetTelem_dmmodtiming_fb(msgBuffer);
+      return fbs->preloaded();
+   }
+
+   static uint64_t ticks( void * msgBuffer )
+   {
+      auto fbs = GetTelem_dmmodtiming_fb(msgBuffer);
+      return fbs->ticks();
+   }
+
+   static uint64_t missed( void * msgBuffer )
+   {
+      auto fbs = GetTelem_dmmodtiming_fb(msgBuffer);
+      return fbs->missed();
+   }
+
+   static float meanErr( void * msgBuffer )
+   {
+      auto fbs = GetTelem_dmmodtiming_fb(msgBuffer);
+      return fbs->meanErr();
+   }
+
+   static float rmsErr( void * msgBuffer )
+   {
+      auto fbs = GetTelem_dmmodtiming_fb(msgBuffer);
+      return fbs->rmsErr();
+   }
+
+   static float maxErr( void * msgBuffer )
+   {
+      auto fbs = GetTelem_dmmodtiming_fb(msgBuffer);
+      return fbs->maxErr();
+   }
+
+   /// Get pointer to the accessor for a member by name
+   /**
+     * \returns the function pointer cast to void*
+     * \returns -1 for an unknown member
+     */
+   static void * getAccessor( const std::string & member /**< [in] the name of the member */ )
+   {
+      if(member == "preloaded") return (void *) &preloaded;
+      if(member == "ticks") return (void *) &ticks;
+      if(member == "missed") return (void *) &missed;
+      if(member == "meanErr") return (void *) &meanErr;
+      if(member == "rmsErr") return (void *) &rmsErr;
+      if(member == "maxErr") return (void *) &maxErr;
+      else
+      {
+         std::cerr << "No string member " << member << " in telem_dmmodtiming\n";
+         return 0;
+      }
+   }
+
+}; //telem_dmmodtiming
+
+
+
+} //namespace logger
+} //namespace MagAOX
+
+#endif //logger_types_telem_dmmodtiming_hpp
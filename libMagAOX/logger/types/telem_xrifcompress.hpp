@@ -0,0 +1,175 @@
+/** \file telem_xrifcompress.hpp
+  * \brief The MagAO-X logger telem_xrifcompress log type.
+  *
+  * \ingroup logger_types_files
+  *
+  */
+#ifndef logger_types_telem_xrifcompress_hpp
+#define logger_types_telem_xrifcompress_hpp
+
+#include "generated/telem_xrifcompress_generated.h"
+#include "flatbuffer_log.hpp"
+
+namespace MagAOX
+{
+namespace logger
+{
+
+
+/// Log entry recording the xrif compression settings and performance of a chunk written by the streamWriter.
+/** \ingroup logger_types
+  */
+struct telem_xrifcompress : public flatbuffer_log
+{
+   ///The event code
+   static const flatlogs::eventCodeT eventCode = eventCodes::TELEM_XRIFCOMPRESS;
+
+   ///The default level
+   static const flatlogs::logPrioT defaultLevel = flatlogs::logPrio::LOG_TELEM;
+
+   static timespec lastRecord; ///< The timestamp of the last time this log was recorded.  Used by the telemetry system.
+
+   ///The type of the input message
+   struct messageT : public fbMessage
+   {
+      ///Construct from components
+      messageT( const uint64_t & frameNo,  ///< [in] the frame number of the first frame of the chunk
+                const bool & adaptive,     ///< [in] whether or not the acceleration is adaptive
+                const int & lz4accel,      ///< [in] the LZ4 acceleration the chunk was compressed with
+                const float & load,        ///< [in] the time to encode and write the chunk over the time to acquire it
+                const float & backlog,     ///< [in] the fraction of the circular buffer headroom used while writing the chunk
+                const float & ratio,       ///< [in] the compression ratio of the chunk
+                const float & encodeRate,  ///< [in] the encoding rate of the chunk, in MB/sec
+                const float & ioWait       ///< [in] the time spent waiting for the I/O gate, in sec
+              )
+      {
+         auto fp = CreateTelem_xrifcompress_fb(builder, frameNo, adaptive, lz4accel, load, backlog, ratio, encodeRate, ioWait);
+         builder.Finish(fp);
+      }
+
+   };
+
+
+   ///Get the message formatte for human consumption.
+   static std::string msgString( void * msgBuffer,  /**< [in] Buffer containing the flatbuffer serialized message.*/
+                                 flatlogs::msgLenT len  /**< [in] [unused] length of msgBuffer.*/
+                               )
+   {
+      static_cast<void>(len);
+      char num[128];
+
+      auto fbs = GetTelem_xrifcompress_fb(msgBuffer);
+
+      std::string msg = "[xrif] ";
+
+      msg += "frame: ";
+      msg += std::to_string(fbs->frameNo());
+
+      if(fbs->adaptive()) msg += " adaptive";
+
+      msg += " lz4accel: ";
+      msg += std::to_string(fbs->lz4accel());
+
+      msg += " load: ";
+      snprintf(num, sizeof(num), "%0.2f",fbs->load());
+      msg += num;
+
+      msg += " backlog: ";
+      snprintf(num, sizeof(num), "%0.2f",fbs->backlog());
+      msg += num;
+
+      msg += " ratio: ";
+      snprintf(num, sizeof(num), "%0.3f",fbs->ratio());
+      msg += num;
+
+      msg += " encode: ";
+      snprintf(num, sizeof(num), "%0.1f",fbs->encodeRate());
+      msg += num;
+      msg += " MB/s";
+
+      msg += " ioWait: ";
+      snprintf(num, sizeof(num), "%0.3f",fbs->ioWait());
+      msg += num;
+
+      return msg;
+
+   }
+
+   static uint64_t frameNo( void * msgBuffer )
+   {
+      auto fbs = GetTelem_xrifcompress_fb(msgBuffer);
+      return fbs->frameNo();
+   }
+
+   static bool adaptive( void * msgBuffer )
+   {
+      auto fbs = GetTelem_xrifcompress_fb(msgBuffer);
+      return fbs->adaptive();
+   }
+
+   static int lz4accel( void * msgBuffer )
+   {
+      auto fbs = GetTelem_xrifcompress_fb(msgBuffer);
+      return fbs->lz4accel();
+   }
+
+   static float load( void * msgBuffer )
+   {
+      auto fbs = GetTelem_xrifcompress_fb(msgBuffer);
+      return fbs->load();
+   }
+
+   static float backlog( void * msgBuffer )
+   {
+      auto fbs = GetTelem_xrifcompress_fb(msgBuffer);
+      return fbs->backlog();
+   }
+
+   static float ratio( void * msgBuffer )
+   {
+      auto fbs = GetTelem_xrifcompress_fb(msgBuffer);
+      return fbs->ratio();
+   }
+
+   static float encodeRate( void * msgBuffer )
+   {
+      auto fbs = GetTelem_xrifcompress_fb(msgBuffer);
+      return fbs->encodeRate();
+   }
+
+   static float ioWait( void * msgBuffer )
+   {
+      auto fbs = GetTelem_xrifcompress_fb(msgBuffer);
+      return fbs->ioWait();
+   }
+
+   /// Get pointer to the accessor for a member by name
+   /**
+     * \returns the function pointer cast to void*
+     * \returns -1 for an unknown member
+     */
+   static void * getAccessor( const std::string & member /**< [in] the name of the member */ )
+   {
+      if(member == "frameNo") return (void *) &frameNo;
+      if(member == "adaptive") return (void *) &adaptive;
+      if(member == "lz4accel") return (void *) &lz4accel;
+      if(member == "load") return (void *) &load;
+      if(member == "backlog") return (void *) &backlog;
+      if(member == "ratio") return (void *) &ratio;
+      if(member == "encodeRate") return (void *) &encodeRate;
+      if(member == "ioWait") return (void *) &ioWait;
+      else
+      {
+         std::cerr << "No string member " << member << " in telem_xrifcompress\n";
+         return 0;
+      }
+   }
+
+}; //telem_xrifcompress
+
+
+
+} //namespace logger
+} //namespace MagAOX
+
+#endif //logger_types_telem_xrifcompress_hpp
@@ -0,0 +1,516 @@
+/** \file fileWatcher.cpp
+  * \brief Watch directories for changes with inotify, and keep an index of their files.
+  *
+  * \ingroup sys_files
+  */
+
+#include "fileWatcher.hpp"
+
+#include <cerrno>
+#include <ctime>
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace MagAOX
+{
+namespace sys
+{
+
+namespace
+{
+
+/// The events which change the index of a directory.
+constexpr uint32_t watchMask = IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+                                 IN_MOVE_SELF | IN_ONLYDIR;
+
+/// Get the modification time of a regular file, following links.
+/**
+  * \returns 0 if the path is a regular file
+  * \returns -1 otherwise
+  */
+int regularFileTime( int64_t & mtime,          ///< [out] the modification time, in ns
+                     const std::string & path ///< [in] the path of the file
+                   )
+{
+   struct stat st;
+   if(stat(path.c_str(), &st) != 0) return -1;
+   if(!S_ISREG(st.st_mode)) return -1;
+
+   mtime = static_cast<int64_t>(st.st_mtim.tv_sec)*1000000000 + st.st_mtim.tv_nsec;
+
+   return 0;
+}
+
+/// Get the monotonic clock in ms.
+int64_t monotonicMs()
+{
+   timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return static_cast<int64_t>(ts.tv_sec)*1000 + ts.tv_nsec/1000000;
+}
+
+}
+
+fileWatcher::fileWatcher()
+{
+   m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+fileWatcher::~fileWatcher()
+{
+   stop();
+
+   if(m_fd >= 0) close(m_fd);
+   if(m_wakeFd >= 0) close(m_wakeFd);
+}
+
+void fileWatcher::rescanInterval( int ms )
+{
+   m_rescanInterval = ms;
+}
+
+int fileWatcher::rescanInterval()
+{
+   return m_rescanInterval;
+}
+
+int fileWatcher::addWatch( const std::string & dir,
+                           const std::string & prefix,
+                           const std::string & substr,
+                           const std::string & ext,
+                           const callbackT & callback
+                         )
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+
+   size_t id = 0;
+   while(id < m_watches.size() && m_watches[id].m_active) ++id;
+   if(id == m_watches.size()) m_watches.emplace_back();
+
+   watch & w = m_watches[id];
+   w = watch();
+
+   w.m_dir = dir;
+   while(w.m_dir.size() > 1 && w.m_dir.back() == '/') w.m_dir.pop_back();
+   w.m_prefix = prefix;
+   w.m_substr = substr;
+   w.m_ext = ext;
+   w.m_callback = callback;
+   w.m_active = true;
+
+   inotifyWatch(w);
+   rescan(w, m_pending);
+
+   if(m_pending.size() > 0 && m_wakeFd >= 0)
+   {
+      uint64_t one = 1;
+      if(write(m_wakeFd, &one, sizeof(one)) < 0) {} //the thread still runs them on its next pass
+   }
+
+   return id;
+}
+
+void fileWatcher::removeWatch( int id )
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+
+   if(id < 0 || id >= static_cast<int>(m_watches.size()) || !m_watches[id].m_active) return;
+
+   watch & w = m_watches[id];
+
+   //The same directory can be watched more than once, with the same descriptor
+   if(w.m_wd >= 0 && m_fd >= 0)
+   {
+      bool shared = false;
+      for(size_t n = 0; n < m_watches.size(); ++n)
+      {
+         if(static_cast<int>(n) != id && m_watches[n].m_active && m_watches[n].m_wd == w.m_wd) shared = true;
+      }
+
+      if(!shared) inotify_rm_watch(m_fd, w.m_wd);
+   }
+
+   w = watch();
+}
+
+std::string fileWatcher::dir( int id )
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+
+   if(id < 0 || id >= static_cast<int>(m_watches.size()) || !m_watches[id].m_active) return "";
+
+   return m_watches[id].m_dir;
+}
+
+bool fileWatcher::changed( int id,
+                           uint64_t & generation
+                         )
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+
+   if(id < 0 || id >= static_cast<int>(m_watches.size()) || !m_watches[id].m_active) return false;
+
+   if(m_watches[id].m_generation == generation) return false;
+
+   generation = m_watches[id].m_generation;
+   return true;
+}
+
+std::vector<std::string> fileWatcher::files( int id )
+{
+   std::vector<std::string> fs;
+
+   std::lock_guard<std::mutex> lock(m_mutex);
+
+   if(id < 0 || id >= static_cast<int>(m_watches.size()) || !m_watches[id].m_active) return fs;
+
+   fs.reserve(m_watches[id].m_files.size());
+   for(auto it = m_watches[id].m_files.begin(); it != m_watches[id].m_files.end(); ++it)
+   {
+      fs.push_back(it->first);
+   }
+
+   return fs;
+}
+
+int fileWatcher::start()
+{
+   if(m_running) return 0;
+
+   if(m_wakeFd < 0) return -1;
+
+   m_running = true;
+
+   try
+   {
+      m_thread = std::thread(&fileWatcher::threadExec, this);
+   }
+   catch(...)
+   {
+      m_running = false;
+      return -1;
+   }
+
+   return 0;
+}
+
+void fileWatcher::stop()
+{
+   if(!m_thread.joinable()) return;
+
+   m_running = false;
+
+   uint64_t one = 1;
+   if(write(m_wakeFd, &one, sizeof(one)) < 0) {} //the thread still sees m_running within a rescan interval
+
+   try
+   {
+      m_thread.join();
+   }
+   catch(...)
+   {
+   }
+}
+
+bool fileWatcher::running()
+{
+   return m_running;
+}
+
+bool fileWatcher::matches( const watch & w,
+                           const std::string & name
+                         )
+{
+   if(name == "." || name == "..") return false;
+
+   if(w.m_prefix != "" && name.compare(0, w.m_prefix.size(), w.m_prefix) != 0) return false;
+
+   if(w.m_ext != "")
+   {
+      if(name.size() < w.m_ext.size()) return false;
+      if(name.compare(name.size() - w.m_ext.size(), w.m_ext.size(), w.m_ext) != 0) return false;
+   }
+
+   if(w.m_substr != "" && name.find(w.m_substr) == std::string::npos) return false;
+
+   return true;
+}
+
+void fileWatcher::inotifyWatch( watch & w )
+{
+   if(w.m_wd >= 0 || m_fd < 0) return;
+
+   w.m_wd = inotify_add_watch(m_fd, w.m_dir.c_str(), watchMask);
+}
+
+void fileWatcher::rescan( watch & w,
+                          std::vector<pendingCallback> & pending
+                        )
+{
+   std::map<std::string, int64_t> found;
+
+   DIR * d = opendir(w.m_dir.c_str());
+   if(d != nullptr)
+   {
+      dirent * de;
+      while( (de = readdir(d)) != nullptr)
+      {
+         std::string name = de->d_name;
+         if(!matches(w, name)) continue;
+
+         std::string path = w.m_dir + "/" + name;
+         int64_t mtime;
+         if(regularFileTime(mtime, path) < 0) continue;
+
+         found.insert(std::make_pair(path, mtime));
+      }
+      closedir(d);
+   }
+
+   bool changed = false;
+
+   for(auto it = w.m_files.begin(); it != w.m_files.end(); ++it)
+   {
+      if(found.count(it->first) == 0)
+      {
+         if(w.m_callback) pending.push_back({w.m_callback, it->first, true});
+         changed = true;
+      }
+   }
+
+   for(auto it = found.begin(); it != found.end(); ++it)
+   {
+      auto old = w.m_files.find(it->first);
+      if(old == w.m_files.end() || old->second != it->second)
+      {
+         if(w.m_callback) pending.push_back({w.m_callback, it->first, false});
+         changed = true;
+      }
+   }
+
+   if(changed)
+   {
+      w.m_files.swap(found);
+      ++w.m_generation;
+   }
+}
+
+void fileWatcher::update( watch & w,
+                          const std::string & name,
+                          bool removed,
+                          std::vector<pendingCallback> & pending
+                        )
+{
+   if(!matches(w, name)) return;
+
+   std::string path = w.m_dir + "/" + name;
+
+   int64_t mtime = 0;
+   if(!removed && regularFileTime(mtime, path) < 0)
+   {
+      //It went away again, or is not a regular file.
+      removed = true;
+   }
+
+   if(removed)
+   {
+      if(w.m_files.erase(path) == 0) return;
+   }
+   else
+   {
+      w.m_files[path] = mtime;
+   }
+
+   if(w.m_callback) pending.push_back({w.m_callback, path, removed});
+   ++w.m_generation;
+}
+
+void fileWatcher::clear( watch & w,
+                         std::vector<pendingCallback> & pending
+                       )
+{
+   w.m_wd = -1;
+
+   if(w.m_files.size() == 0) return;
+
+   if(w.m_callback)
+   {
+      for(auto it = w.m_files.begin(); it != w.m_files.end(); ++it)
+      {
+         pending.push_back({w.m_callback, it->first, true});
+      }
+   }
+
+   w.m_files.clear();
+   ++w.m_generation;
+}
+
+void fileWatcher::callCallbacks( std::vector<pendingCallback> & pending )
+{
+   for(size_t n = 0; n < pending.size(); ++n)
+   {
+      pending[n].m_callback(pending[n].m_path, pending[n].m_removed);
+   }
+
+   pending.clear();
+}
+
+void fileWatcher::handleEvents()
+{
+   alignas(inotify_event) char buf[16384];
+
+   std::vector<pendingCallback> pending;
+
+   while(true)
+   {
+      ssize_t len = read(m_fd, buf, sizeof(buf));
+      if(len <= 0) break;
+
+      std::unique_lock<std::mutex> lock(m_mutex);
+
+      for(char * ptr = buf; ptr < buf + len; )
+      {
+         const inotify_event * ev = reinterpret_cast<const inotify_event *>(ptr);
+         ptr += sizeof(inotify_event) + ev->len;
+
+         if(ev->mask & IN_Q_OVERFLOW)
+         {
+            //Events were lost, so only a rescan can tell what changed.
+            for(size_t n = 0; n < m_watches.size(); ++n)
+            {
+               if(m_watches[n].m_active) rescan(m_watches[n], pending);
+            }
+            continue;
+         }
+
+         for(size_t n = 0; n < m_watches.size(); ++n)
+         {
+            watch & w = m_watches[n];
+            if(!w.m_active || w.m_wd != ev->wd) continue;
+
+            if(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+            {
+               //The directory is gone, so the rescans take over until it comes back.
+               if(!(ev->mask & IN_IGNORED) && m_fd >= 0) inotify_rm_watch(m_fd, w.m_wd);
+               clear(w, pending);
+               continue;
+            }
+
+            if(ev->len == 0) continue;
+
+            std::string name = ev->name;
+
+            if(ev->mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+               update(w, name, true, pending);
+            }
+            else if(ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+            {
+               update(w, name, false, pending);
+            }
+            else if(ev->mask & IN_CREATE)
+            {
+               //A new file is only complete when closed, but a new link is complete now.
+               struct stat st;
+               if(lstat((w.m_dir + "/" + name).c_str(), &st) == 0 && S_ISLNK(st.st_mode))
+               {
+                  update(w, name, false, pending);
+               }
+            }
+         }
+      }
+
+      lock.unlock();
+
+      callCallbacks(pending);
+   }
+}
+
+void fileWatcher::rescanAll( bool unwatchedOnly )
+{
+   std::vector<pendingCallback> pending;
+
+   std::unique_lock<std::mutex> lock(m_mutex);
+
+   for(size_t n = 0; n < m_watches.size(); ++n)
+   {
+      watch & w = m_watches[n];
+      if(!w.m_active) continue;
+      if(unwatchedOnly && w.m_wd >= 0) continue;
+
+      //Watch first, so that nothing is missed between the scan and the watch.
+      inotifyWatch(w);
+      rescan(w, pending);
+   }
+
+   lock.unlock();
+
+   callCallbacks(pending);
+}
+
+void fileWatcher::threadExec()
+{
+   int64_t lastRescan = monotonicMs();
+
+   while(m_running)
+   {
+      std::vector<pendingCallback> pending;
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         pending.swap(m_pending);
+      }
+      callCallbacks(pending);
+
+      pollfd fds[2];
+      nfds_t nfds = 0;
+
+      fds[nfds].fd = m_wakeFd;
+      fds[nfds].events = POLLIN;
+      ++nfds;
+
+      if(m_fd >= 0)
+      {
+         fds[nfds].fd = m_fd;
+         fds[nfds].events = POLLIN;
+         ++nfds;
+      }
+
+      int interval = m_rescanInterval;
+      if(interval < 1) interval = 1;
+
+      int rv = poll(fds, nfds, interval);
+
+      if(rv < 0 && errno != EINTR) break;
+
+      if(!m_running) break;
+
+      if(rv > 0)
+      {
+         if(fds[0].revents & POLLIN)
+         {
+            uint64_t val;
+            if(read(m_wakeFd, &val, sizeof(val)) < 0) {} //it is only a wakeup
+         }
+
+         if(nfds > 1 && (fds[1].revents & POLLIN)) handleEvents();
+      }
+
+      int64_t now = monotonicMs();
+      if(now - lastRescan >= interval)
+      {
+         rescanAll(true);
+         lastRescan = now;
+      }
+   }
+
+   m_running = false;
+}
+
+} //namespace sys
+} //namespace MagAOX
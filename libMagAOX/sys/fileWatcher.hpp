@@ -0,0 +1,204 @@
+/** \file fileWatcher.hpp
+  * \brief Watch directories for changes with inotify, and keep an index of their files.
+  *
+  * \ingroup sys_files
+  */
+
+#ifndef sys_fileWatcher_hpp
+#define sys_fileWatcher_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace MagAOX
+{
+namespace sys
+{
+
+/// Watches directories with inotify, and keeps an in-memory index of the files in each.
+/** Each watch is a directory and a filter, which selects the regular files (or links to them) whose names start with
+  * a prefix, contain a substring, and end with an extension, just as mx::ioutils::getFileNames does.  The index of a
+  * watch is kept up to date by a background thread, so an app checks for changes with changed(), and gets the files
+  * with files(), without touching the filesystem.
+  *
+  * A watch can have a callback, which the background thread calls with the path of each file that is added to, changed
+  * in, or removed from the index.  This is used to preload files, so that the app does not read them when they are
+  * needed.  Callbacks are called without any lock held, and may call changed() and files().
+  *
+  * If a directory can not be watched, because it does not exist yet or inotify is not available, the background thread
+  * rescans it, and retries the watch, every rescan interval.  If the inotify queue overflows all directories are
+  * rescanned.
+  *
+  * \ingroup sys
+  */
+class fileWatcher
+{
+public:
+
+   /// The callback type, called with the path of a file and whether it was removed.
+   typedef std::function<void(const std::string & path, bool removed)> callbackT;
+
+protected:
+
+   /// A watched directory and its index.
+   struct watch
+   {
+      std::string m_dir;     ///< The directory, without a trailing /.
+      std::string m_prefix;  ///< Files must start with this.
+      std::string m_substr;  ///< Files must contain this.
+      std::string m_ext;     ///< Files must end with this.
+
+      callbackT m_callback;  ///< Called for each change to the index, may be empty.
+
+      int m_wd {-1};         ///< The inotify watch descriptor, -1 if the directory is not watched.
+      bool m_active {false}; ///< Whether this slot is in use.
+
+      std::map<std::string, int64_t> m_files; ///< The index, full path to modification time in ns.
+
+      uint64_t m_generation {1}; ///< Incremented on each change to the index.
+   };
+
+   /// A callback to be called once the lock is released.
+   struct pendingCallback
+   {
+      callbackT m_callback; ///< The callback.
+      std::string m_path;   ///< The path of the file.
+      bool m_removed;       ///< Whether the file was removed.
+   };
+
+   std::vector<watch> m_watches; ///< The watches, indexed by the id returned by addWatch.
+
+   std::mutex m_mutex; ///< Protects m_watches.
+
+   int m_fd {-1}; ///< The inotify file descriptor.
+
+   int m_wakeFd {-1}; ///< An eventfd used to wake the thread, to stop or to call m_pending.
+
+   std::vector<pendingCallback> m_pending; ///< Callbacks queued by addWatch for the thread to call.  Protected by m_mutex.
+
+   std::thread m_thread; ///< The background thread.
+
+   std::atomic<bool> m_running {false}; ///< Whether the thread is running.
+
+   int m_rescanInterval {1000}; ///< The interval at which unwatched directories are rescanned, in ms.
+
+public:
+
+   /// Default c'tor.  Opens the inotify instance, but does not start the thread.
+   fileWatcher();
+
+   /// D'tor.  Stops the thread and closes the inotify instance.
+   ~fileWatcher();
+
+   /// Set the rescan interval for directories which can not be watched.
+   void rescanInterval( int ms /**< [in] the new interval, in ms */);
+
+   /// Get the rescan interval.
+   /**
+     * \returns the current value of m_rescanInterval
+     */
+   int rescanInterval();
+
+   /// Add a watch, and build its index.
+   /** The index is built before this returns.  The callback is called for each file found by the background thread,
+     * once it is started.  The directory need not exist.
+     *
+     * \returns the id of the watch, for use in the other member functions
+     */
+   int addWatch( const std::string & dir,           ///< [in] the directory to watch
+                 const std::string & prefix,        ///< [in] files must start with this, ignored if empty
+                 const std::string & substr,        ///< [in] files must contain this, ignored if empty
+                 const std::string & ext,           ///< [in] files must end with this, ignored if empty
+                 const callbackT & callback = nullptr ///< [in] [optional] called for each change to the index
+               );
+
+   /// Remove a watch.  Its id may then be reused by addWatch.
+   void removeWatch( int id /**< [in] the id of the watch */);
+
+   /// Get the directory of a watch.
+   /**
+     * \returns the directory, or an empty string if the id is not a watch
+     */
+   std::string dir( int id /**< [in] the id of the watch */);
+
+   /// Check whether the index of a watch has changed since the generation passed in.
+   /** Start with a generation of 0 to always see the first index as a change.
+     *
+     * \returns true if the index has changed, in which case generation is updated
+     * \returns false otherwise, including if the id is not a watch
+     */
+   bool changed( int id,              ///< [in] the id of the watch
+                 uint64_t & generation ///< [in/out] the generation of the index last seen by the caller
+               );
+
+   /// Get the files in the index of a watch, sorted by path.
+   /**
+     * \returns the full paths of the files
+     */
+   std::vector<std::string> files( int id /**< [in] the id of the watch */);
+
+   /// Start the background thread.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int start();
+
+   /// Stop the background thread, and wait for it to exit.
+   void stop();
+
+   /// Check whether the background thread is running.
+   bool running();
+
+protected:
+
+   /// Check whether a file name matches the filter of a watch.
+   bool matches( const watch & w,           ///< [in] the watch
+                 const std::string & name   ///< [in] the file name, without the directory
+               );
+
+   /// Try to add the inotify watch for a watch, if it does not have one.  Must be called with m_mutex locked.
+   void inotifyWatch( watch & w /**< [in/out] the watch */);
+
+   /// Rescan the directory of a watch, and update its index.  Must be called with m_mutex locked.
+   /** The changes are appended to the list of pending callbacks.
+     */
+   void rescan( watch & w,                             ///< [in/out] the watch
+                std::vector<pendingCallback> & pending ///< [out] the callbacks to call
+              );
+
+   /// Update the index of a watch for one file.  Must be called with m_mutex locked.
+   void update( watch & w,                             ///< [in/out] the watch
+                const std::string & name,              ///< [in] the file name
+                bool removed,                          ///< [in] whether the file was removed
+                std::vector<pendingCallback> & pending ///< [out] the callbacks to call
+              );
+
+   /// Remove all files from the index of a watch, after its directory went away.  Must be called with m_mutex locked.
+   void clear( watch & w,                             ///< [in/out] the watch
+               std::vector<pendingCallback> & pending ///< [out] the callbacks to call
+             );
+
+   /// Call the pending callbacks.  Must be called with m_mutex unlocked.
+   void callCallbacks( std::vector<pendingCallback> & pending /**< [in] the callbacks to call */);
+
+   /// Read and handle the pending inotify events.
+   void handleEvents();
+
+   /// Rescan all directories, or only those which are not watched.
+   void rescanAll( bool unwatchedOnly /**< [in] if true only rescan the directories which are not watched */);
+
+   /// The background thread.
+   void threadExec();
+};
+
+} //namespace sys
+} //namespace MagAOX
+
+#endif //sys_fileWatcher_hpp
@@ -0,0 +1,124 @@
+/** \file ioGate.cpp
+  * \brief A gate limiting the number of processes writing to a disk at once.
+  *
+  * \ingroup sys_files
+  */
+
+#include "ioGate.hpp"
+
+#include "../common/paths.hpp"
+
+#include <cerrno>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+namespace MagAOX
+{
+namespace sys
+{
+
+ioGate::~ioGate()
+{
+   close();
+}
+
+int ioGate::open( const std::string & dir,
+                  unsigned slots,
+                  unsigned priority
+                )
+{
+   close();
+
+   if(slots == 0)
+   {
+      errno = EINVAL;
+      return -1;
+   }
+
+   unsigned nfds = (priority < slots) ? priority + 1 : slots;
+
+   for(unsigned n = 0; n < nfds; ++n)
+   {
+      int fd = ::open(slotPath(dir, n).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+      if(fd < 0)
+      {
+         int e = errno;
+         close();
+         errno = e;
+         return -1;
+      }
+
+      m_fds.push_back(fd);
+   }
+
+   return 0;
+}
+
+void ioGate::close()
+{
+   release();
+
+   for(size_t n = 0; n < m_fds.size(); ++n) ::close(m_fds[n]);
+
+   m_fds.clear();
+}
+
+bool ioGate::isOpen() const
+{
+   return (m_fds.size() > 0);
+}
+
+int ioGate::acquire( double maxWait )
+{
+   if(m_fds.size() == 0 || m_held >= 0) return 0;
+
+   timespec ts0, ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts0);
+
+   //Poll the slots, highest first so the shared slot 0 is left to the lower priorities when possible.
+   while(1)
+   {
+      for(int n = m_fds.size() - 1; n >= 0; --n)
+      {
+         if(flock(m_fds[n], LOCK_EX | LOCK_NB) == 0)
+         {
+            m_held = n;
+            return 0;
+         }
+
+         if(errno != EWOULDBLOCK && errno != EINTR) return -1;
+      }
+
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      if( (ts.tv_sec - ts0.tv_sec) + (ts.tv_nsec - ts0.tv_nsec)/1e9 >= maxWait) return 1;
+
+      timespec sl = {0, 1000000};
+      nanosleep(&sl, nullptr);
+   }
+}
+
+void ioGate::release()
+{
+   if(m_held < 0) return;
+
+   flock(m_fds[m_held], LOCK_UN);
+   m_held = -1;
+}
+
+int ioGate::held() const
+{
+   return m_held;
+}
+
+std::string ioGate::slotPath( const std::string & dir,
+                              unsigned slot
+                            )
+{
+   return dir + "/" + MAGAOX_ioGateName + "." + std::to_string(slot);
+}
+
+} //namespace sys
+} //namespace MagAOX
@@ -0,0 +1,84 @@
+/** \file ioGate.hpp
+  * \brief A gate limiting the number of processes writing to a disk at once.
+  *
+  * \ingroup sys_files
+  */
+
+#ifndef sys_ioGate_hpp
+#define sys_ioGate_hpp
+
+#include <string>
+#include <vector>
+
+namespace MagAOX
+{
+namespace sys
+{
+
+/// A gate limiting the number of processes writing to a disk at once, with slots reserved for higher priorities.
+/** The gate is a set of slot files in a directory shared by the writers, e.g. the raw images directory, named
+  * MAGAOX_ioGateName.0, MAGAOX_ioGateName.1, and so on.  A writer holds a slot by holding an exclusive flock on its
+  * file, so slots are shared between processes, and are freed by the kernel if a writer dies holding one.
+  *
+  * A writer with priority p may take any of slots 0 through p, so slot 0 is open to all writers and the higher slots
+  * are reserved for the higher priorities.  With 2 slots, for instance, the priority 1 streams can always write while
+  * a priority 0 stream does.
+  *
+  * A writer never waits indefinitely.  If no slot frees up within the maximum wait acquire() returns without one and
+  * the writer goes ahead, since it is better to contend for the disk than to lose frames.
+  *
+  * \ingroup sys
+  */
+class ioGate
+{
+protected:
+
+   std::vector<int> m_fds; ///< The file descriptors of the slot files which this writer may take.
+
+   int m_held {-1}; ///< The index of the slot held, or -1 if none.
+
+public:
+
+   /// Destructor, releases the slot and closes the slot files.
+   ~ioGate();
+
+   /// Open the slot files, creating them if needed.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with errno set
+     */
+   int open( const std::string & dir, ///< [in] the directory of the slot files
+             unsigned slots,          ///< [in] the number of slots, which should be the same for all writers
+             unsigned priority        ///< [in] the priority of this writer, from 0
+           );
+
+   /// Close the slot files, releasing the slot if held.
+   void close();
+
+   /// Check if the slot files are open.
+   bool isOpen() const;
+
+   /// Take a slot, waiting up to maxWait seconds for one to be free.
+   /**
+     * \returns 0 if a slot was taken, or the gate is not open
+     * \returns 1 if no slot was free within maxWait
+     * \returns -1 on error, with errno set
+     */
+   int acquire( double maxWait /**< [in] the maximum time to wait, in seconds */);
+
+   /// Release the slot, if held.
+   void release();
+
+   /// Get the slot held, or -1 if none.
+   int held() const;
+
+   /// Get the path of a slot file.
+   static std::string slotPath( const std::string & dir, ///< [in] the directory of the slot files
+                                unsigned slot            ///< [in] the slot
+                              );
+};
+
+} //namespace sys
+} //namespace MagAOX
+
+#endif //sys_ioGate_hpp
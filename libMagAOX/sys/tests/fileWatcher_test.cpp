@@ -0,0 +1,195 @@
+#include "../../../tests/catch2/catch.hpp"
+
+#include "../fileWatcher.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fileWatcher_test
+{
+
+//Write a file, which closes it.
+void touch( const std::string & path )
+{
+   std::ofstream fout(path);
+   fout << "1\n";
+}
+
+//Wait up to 5 seconds for a watch to change.
+bool waitChanged( MagAOX::sys::fileWatcher & fw,
+                  int id,
+                  uint64_t & generation
+                )
+{
+   for(int n = 0; n < 500; ++n)
+   {
+      if(fw.changed(id, generation)) return true;
+      usleep(10000);
+   }
+
+   return false;
+}
+
+SCENARIO( "Watching a directory for changes", "[libMagAOX::sys]" )
+{
+   GIVEN("a directory with some files")
+   {
+      char tmpl[] = "/tmp/fileWatcher_test_XXXXXX";
+      REQUIRE(mkdtemp(tmpl) != nullptr);
+      std::string dir = tmpl;
+
+      touch(dir + "/flat_a.fits");
+      touch(dir + "/flat_b.fits");
+      touch(dir + "/flat_c.txt");
+      touch(dir + "/other.fits");
+
+      MagAOX::sys::fileWatcher fw;
+      fw.rescanInterval(20);
+
+      std::mutex cbMutex;
+      std::set<std::string> loaded;
+      int removed = 0;
+
+      int id = fw.addWatch(dir + "/", "flat_", "", ".fits", [&](const std::string & path, bool rm)
+                                                            {
+                                                               std::lock_guard<std::mutex> lock(cbMutex);
+                                                               if(rm) ++removed;
+                                                               else loaded.insert(path);
+                                                            });
+      REQUIRE(id >= 0);
+      REQUIRE(fw.dir(id) == dir);
+
+      WHEN("the watch is added")
+      {
+         uint64_t gen = 0;
+         REQUIRE(fw.changed(id, gen) == true);
+         REQUIRE(fw.changed(id, gen) == false);
+
+         std::vector<std::string> fs = fw.files(id);
+         REQUIRE(fs.size() == 2);
+         REQUIRE(fs[0] == dir + "/flat_a.fits");
+         REQUIRE(fs[1] == dir + "/flat_b.fits");
+
+         //The callbacks wait for the thread
+         REQUIRE(fw.start() == 0);
+         for(int n = 0; n < 500; ++n)
+         {
+            {
+               std::lock_guard<std::mutex> lock(cbMutex);
+               if(loaded.size() == 2) break;
+            }
+            usleep(10000);
+         }
+
+         std::lock_guard<std::mutex> lock(cbMutex);
+         REQUIRE(loaded.size() == 2);
+         REQUIRE(removed == 0);
+      }
+
+      WHEN("files are added and removed")
+      {
+         uint64_t gen = 0;
+         REQUIRE(fw.changed(id, gen) == true);
+         REQUIRE(fw.start() == 0);
+
+         touch(dir + "/flat_d.fits");
+         REQUIRE(waitChanged(fw, id, gen));
+         REQUIRE(fw.files(id).size() == 3);
+
+         unlink((dir + "/flat_a.fits").c_str());
+         REQUIRE(waitChanged(fw, id, gen));
+         REQUIRE(fw.files(id).size() == 2);
+         REQUIRE(fw.files(id)[0] == dir + "/flat_b.fits");
+
+         rename((dir + "/flat_b.fits").c_str(), (dir + "/flat_e.fits").c_str());
+         REQUIRE(waitChanged(fw, id, gen));
+         while(fw.files(id).size() != 2 || fw.files(id)[1] != dir + "/flat_e.fits")
+         {
+            REQUIRE(waitChanged(fw, id, gen));
+         }
+
+         //Files outside the filter don't change the index
+         touch(dir + "/flat_f.txt");
+         touch(dir + "/other2.fits");
+         usleep(100000);
+         REQUIRE(fw.changed(id, gen) == false);
+
+         std::lock_guard<std::mutex> lock(cbMutex);
+         REQUIRE(removed >= 2);
+         REQUIRE(loaded.count(dir + "/flat_d.fits") == 1);
+         REQUIRE(loaded.count(dir + "/flat_e.fits") == 1);
+      }
+
+      WHEN("the watch is removed")
+      {
+         fw.removeWatch(id);
+         REQUIRE(fw.dir(id) == "");
+         REQUIRE(fw.files(id).size() == 0);
+
+         uint64_t gen = 0;
+         REQUIRE(fw.changed(id, gen) == false);
+
+         //The id is reused
+         REQUIRE(fw.addWatch(dir, "", "", ".txt") == id);
+         REQUIRE(fw.files(id).size() == 1);
+      }
+
+      fw.stop();
+      REQUIRE(fw.running() == false);
+
+      std::string cmd = "rm -rf " + dir;
+      REQUIRE(system(cmd.c_str()) == 0);
+   }
+
+   GIVEN("a directory which does not exist yet")
+   {
+      char tmpl[] = "/tmp/fileWatcher_test_XXXXXX";
+      REQUIRE(mkdtemp(tmpl) != nullptr);
+      std::string dir = std::string(tmpl) + "/later";
+
+      MagAOX::sys::fileWatcher fw;
+      fw.rescanInterval(20);
+
+      int id = fw.addWatch(dir, "", "", ".fits");
+      uint64_t gen = 0;
+      REQUIRE(fw.changed(id, gen) == true);
+      REQUIRE(fw.files(id).size() == 0);
+
+      REQUIRE(fw.start() == 0);
+
+      WHEN("it is created, removed, and created again")
+      {
+         REQUIRE(mkdir(dir.c_str(), 0755) == 0);
+         touch(dir + "/a.fits");
+         REQUIRE(waitChanged(fw, id, gen));
+         while(fw.files(id).size() != 1) REQUIRE(waitChanged(fw, id, gen));
+
+         //Once watched, changes are seen
+         touch(dir + "/b.fits");
+         while(fw.files(id).size() != 2) REQUIRE(waitChanged(fw, id, gen));
+
+         std::string cmd = "rm -rf " + dir;
+         REQUIRE(system(cmd.c_str()) == 0);
+         while(fw.files(id).size() != 0) REQUIRE(waitChanged(fw, id, gen));
+
+         REQUIRE(mkdir(dir.c_str(), 0755) == 0);
+         touch(dir + "/c.fits");
+         while(fw.files(id).size() != 1) REQUIRE(waitChanged(fw, id, gen));
+         REQUIRE(fw.files(id)[0] == dir + "/c.fits");
+      }
+
+      fw.stop();
+
+      std::string cmd = "rm -rf " + std::string(tmpl);
+      REQUIRE(system(cmd.c_str()) == 0);
+   }
+}
+
+} //namespace fileWatcher_test
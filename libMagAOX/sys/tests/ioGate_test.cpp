@@ -0,0 +1,85 @@
+#include "../../../tests/catch2/catch.hpp"
+
+#include "../ioGate.hpp"
+
+#include <cstdlib>
+#include <string>
+
+#include <unistd.h>
+
+namespace ioGate_test
+{
+
+SCENARIO( "Limiting writers with an I/O gate", "[libMagAOX::sys]" )
+{
+   GIVEN("a gate with 2 slots")
+   {
+      char tmpl[] = "/tmp/ioGate_test_XXXXXX";
+      REQUIRE(mkdtemp(tmpl) != nullptr);
+      std::string dir = tmpl;
+
+      //flock locks belong to the open file, so gates in one process contend like gates in separate processes.
+      MagAOX::sys::ioGate low1, low2, high;
+      REQUIRE(low1.open(dir, 2, 0) == 0);
+      REQUIRE(low2.open(dir, 2, 0) == 0);
+      REQUIRE(high.open(dir, 2, 5) == 0);
+
+      REQUIRE(access(MagAOX::sys::ioGate::slotPath(dir, 0).c_str(), F_OK) == 0);
+      REQUIRE(access(MagAOX::sys::ioGate::slotPath(dir, 1).c_str(), F_OK) == 0);
+
+      WHEN("a low priority writer holds the shared slot")
+      {
+         REQUIRE(low1.acquire(0.1) == 0);
+         REQUIRE(low1.held() == 0);
+
+         //The second low priority writer times out, but the high priority writer has its reserved slot.
+         REQUIRE(low2.acquire(0.01) == 1);
+         REQUIRE(low2.held() == -1);
+
+         REQUIRE(high.acquire(0.01) == 0);
+         REQUIRE(high.held() == 1);
+
+         low1.release();
+         REQUIRE(low1.held() == -1);
+         REQUIRE(low2.acquire(0.01) == 0);
+         REQUIRE(low2.held() == 0);
+      }
+
+      WHEN("a high priority writer takes a slot first")
+      {
+         //It takes its reserved slot, leaving the shared slot free.
+         REQUIRE(high.acquire(0.01) == 0);
+         REQUIRE(high.held() == 1);
+         REQUIRE(low1.acquire(0.01) == 0);
+      }
+
+      WHEN("a writer closes its gate while holding a slot")
+      {
+         REQUIRE(low1.acquire(0.01) == 0);
+         low1.close();
+         REQUIRE(low1.isOpen() == false);
+         REQUIRE(low2.acquire(0.01) == 0);
+      }
+
+      low1.close();
+      low2.close();
+      high.close();
+      unlink(MagAOX::sys::ioGate::slotPath(dir, 0).c_str());
+      unlink(MagAOX::sys::ioGate::slotPath(dir, 1).c_str());
+      rmdir(dir.c_str());
+   }
+
+   GIVEN("a gate which is not open")
+   {
+      MagAOX::sys::ioGate gate;
+      REQUIRE(gate.isOpen() == false);
+      REQUIRE(gate.acquire(0.01) == 0);
+      REQUIRE(gate.held() == -1);
+
+      REQUIRE(gate.open("/tmp/ioGate_test_does_not_exist", 2, 0) == -1);
+      REQUIRE(gate.open("/tmp", 0, 0) == -1);
+      REQUIRE(gate.isOpen() == false);
+   }
+}
+
+} //namespace ioGate_test
@@ -0,0 +1,151 @@
+#include "../../../tests/catch2/catch.hpp"
+
+#include "../workStealingPool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace workStealingPool_test
+{
+
+SCENARIO( "Running tasks on a work stealing pool", "[libMagAOX::sys]" )
+{
+   GIVEN("a pool of 4 workers")
+   {
+      MagAOX::sys::workStealingPool pool;
+      REQUIRE(pool.start(4) == 0);
+      REQUIRE(pool.running());
+      REQUIRE(pool.threads() == 4);
+      REQUIRE(pool.start(4) == -1);
+
+      WHEN("many tasks are submitted to the workers in turn")
+      {
+         std::atomic<int> sum {0};
+         for(int n = 1; n <= 1000; ++n)
+         {
+            REQUIRE(pool.submit([&sum, n]{ sum += n; }) == 0);
+         }
+         pool.wait();
+
+         REQUIRE(sum == 500500);
+         REQUIRE(pool.executed() == 1000);
+         REQUIRE(pool.queued() == 0);
+         REQUIRE(pool.active() == 0);
+      }
+
+      WHEN("all tasks are submitted to one worker")
+      {
+         //The tasks are slow enough that the idle workers must steal them.
+         std::atomic<int> count {0};
+
+         for(int n = 0; n < 40; ++n)
+         {
+            REQUIRE(pool.submit([&count]{ std::this_thread::sleep_for(std::chrono::milliseconds(5)); ++count; }, 0) == 0);
+         }
+         pool.wait();
+
+         REQUIRE(count == 40);
+         REQUIRE(pool.stolen() > 0);
+      }
+
+      WHEN("the pool is stopped with tasks queued")
+      {
+         std::atomic<int> count {0};
+         for(int n = 0; n < 20; ++n)
+         {
+            pool.submit([&count]{ std::this_thread::sleep_for(std::chrono::milliseconds(1)); ++count; });
+         }
+         pool.stop();
+
+         THEN("the queued tasks are run first, and no more are accepted")
+         {
+            REQUIRE(count == 20);
+            REQUIRE(!pool.running());
+            REQUIRE(pool.submit([]{}) == -1);
+         }
+      }
+
+      WHEN("tasks and other threads submit while the pool is stopped")
+      {
+         std::atomic<int> accepted {0};
+         std::atomic<int> count {0};
+         std::atomic<bool> done {false};
+
+         //Each task resubmits itself, as a writer returning an encoder dispatches the next chunk.
+         std::function<void()> task = [&]
+         {
+            ++count;
+            if(pool.submit(task) == 0) ++accepted;
+         };
+
+         for(int n = 0; n < 4; ++n)
+         {
+            if(pool.submit(task, n) == 0) ++accepted;
+         }
+
+         std::thread other([&]
+         {
+            while(!done)
+            {
+               if(pool.submit([&count]{ ++count; }) == 0) ++accepted;
+            }
+         });
+
+         std::this_thread::sleep_for(std::chrono::milliseconds(10));
+         pool.stop();
+         done = true;
+         other.join();
+
+         THEN("every accepted task is run, and the rest are rejected")
+         {
+            REQUIRE(count == accepted);
+            REQUIRE(pool.submit([]{}) == -1);
+         }
+      }
+
+      WHEN("a task throws")
+      {
+         std::atomic<int> count {0};
+         pool.submit([]{ throw 1; }, 2);
+         pool.submit([&count]{ ++count; }, 2);
+         pool.wait();
+
+         REQUIRE(count == 1);
+      }
+
+      pool.stop();
+   }
+
+   GIVEN("a pool of 1 worker")
+   {
+      MagAOX::sys::workStealingPool pool;
+      REQUIRE(pool.start(1) == 0);
+
+      WHEN("an urgent task is submitted while the worker is busy")
+      {
+         std::atomic<bool> go {false};
+         std::vector<int> order;
+
+         pool.submit([&go]{ while(!go) std::this_thread::sleep_for(std::chrono::milliseconds(1)); });
+         while(pool.active() < 1) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+         for(int n = 0; n < 3; ++n) pool.submit([&order, n]{ order.push_back(n); });
+         pool.submit([&order]{ order.push_back(-1); }, -1, true);
+
+         go = true;
+         pool.wait();
+
+         THEN("it runs before the tasks already queued")
+         {
+            REQUIRE(order == std::vector<int>({-1, 0, 1, 2}));
+         }
+      }
+
+      pool.stop();
+   }
+}
+
+} //namespace workStealingPool_test
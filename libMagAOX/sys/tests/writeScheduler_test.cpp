@@ -0,0 +1,217 @@
+#include "../../../tests/catch2/catch.hpp"
+
+#include "../writeScheduler.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace writeScheduler_test
+{
+
+/// Make a request which writes nbytes of the character c.
+MagAOX::sys::writeScheduler::request makeRequest( const std::string & path,
+                                                  unsigned priority,
+                                                  size_t nbytes,
+                                                  char c
+                                                )
+{
+   MagAOX::sys::writeScheduler::request req;
+   req.m_path = path;
+   req.m_priority = priority;
+   req.m_bytes = nbytes;
+   req.m_write = [nbytes, c](FILE * fp)
+   {
+      std::string buf(nbytes, c);
+      if(fwrite(buf.data(), 1, buf.size(), fp) != buf.size()) return -1;
+      return 0;
+   };
+   return req;
+}
+
+off_t fileSize( const std::string & path )
+{
+   struct stat st;
+   if(stat(path.c_str(), &st) != 0) return -1;
+   return st.st_size;
+}
+
+SCENARIO( "Batching writes from several producers", "[libMagAOX::sys]" )
+{
+   GIVEN("a scheduler writing to a temporary directory")
+   {
+      char tmpl[] = "/tmp/writeScheduler_test_XXXXXX";
+      REQUIRE(mkdtemp(tmpl) != nullptr);
+      std::string dir = tmpl;
+
+      MagAOX::sys::writeScheduler ws;
+      ws.budget(1000);
+      REQUIRE(ws.submit(makeRequest(dir + "/early", 0, 1, 'a')) == -1);
+      REQUIRE(ws.start() == 0);
+      REQUIRE(ws.running());
+      REQUIRE(ws.start() == -1);
+
+      std::vector<std::string> paths;
+
+      WHEN("requests are submitted while the writer is busy")
+      {
+         std::atomic<bool> go {false};
+         std::mutex doneMutex;
+         std::vector<std::string> done;
+         std::vector<size_t> batchSizes;
+         std::vector<int> rvs;
+
+         auto onDone = [&](const std::string & name)
+         {
+            return [&, name](const MagAOX::sys::writeScheduler::result & res)
+            {
+               std::lock_guard<std::mutex> lock(doneMutex);
+               rvs.push_back(res.m_rv);
+               done.push_back(name);
+               batchSizes.push_back(res.m_batchSize);
+            };
+         };
+
+         //The first request blocks the writer until the others are queued.
+         auto blocker = makeRequest(dir + "/blocker", 0, 10, 'b');
+         blocker.m_write = [&go](FILE * fp)
+         {
+            while(!go) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return (fputs("b", fp) < 0) ? -1 : 0;
+         };
+         blocker.m_done = onDone("blocker");
+         paths.push_back(dir + "/blocker");
+         REQUIRE(ws.submit(blocker) == 0);
+
+         while(ws.queued() > 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+         const char * names[] = {"low0", "high0", "low1", "high1"};
+         unsigned prios[] = {0, 1, 0, 1};
+         for(int n = 0; n < 4; ++n)
+         {
+            auto req = makeRequest(dir + "/" + names[n], prios[n], 100, 'x');
+            req.m_done = onDone(names[n]);
+            paths.push_back(req.m_path);
+            REQUIRE(ws.submit(req) == 0);
+         }
+
+         REQUIRE(ws.queued() == 4);
+         REQUIRE(ws.queuedBytes() == 410);
+         REQUIRE(ws.backlog() == Approx(0.41));
+
+         go = true;
+         ws.stop();
+
+         THEN("they are written in one batch, highest priority first and in order of submission")
+         {
+            REQUIRE(done == std::vector<std::string>({"blocker", "high0", "high1", "low0", "low1"}));
+            REQUIRE(batchSizes == std::vector<size_t>({1, 4, 4, 4, 4}));
+            REQUIRE(rvs == std::vector<int>({0, 0, 0, 0, 0}));
+            REQUIRE(ws.batches() == 2);
+            REQUIRE(ws.files() == 5);
+            REQUIRE(ws.bytes() == 410);
+            REQUIRE(ws.queuedBytes() == 0);
+            REQUIRE(fileSize(dir + "/high1") == 100);
+            REQUIRE(fileSize(dir + "/blocker") == 1);
+         }
+      }
+
+      WHEN("the batch size is limited")
+      {
+         std::atomic<bool> go {false};
+         auto blocker = makeRequest(dir + "/blocker", 0, 1, 'b');
+         blocker.m_write = [&go](FILE * fp)
+         {
+            while(!go) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return (fputs("b", fp) < 0) ? -1 : 0;
+         };
+         paths.push_back(dir + "/blocker");
+         ws.submit(blocker);
+         while(ws.queued() > 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+         ws.maxBatchBytes(250);
+         for(int n = 0; n < 4; ++n)
+         {
+            paths.push_back(dir + "/f" + std::to_string(n));
+            ws.submit(makeRequest(paths.back(), 0, 100, 'x'));
+         }
+
+         go = true;
+         ws.stop();
+
+         THEN("the requests are split into batches of at most that many bytes")
+         {
+            REQUIRE(ws.files() == 5);
+            REQUIRE(ws.batches() == 3);
+         }
+      }
+
+      WHEN("a file can not be opened")
+      {
+         std::atomic<int> rv {0};
+         std::atomic<int> err {0};
+         auto req = makeRequest(dir + "/nodir/file", 0, 10, 'x');
+         req.m_done = [&](const MagAOX::sys::writeScheduler::result & res)
+         {
+            rv = res.m_rv;
+            err = res.m_errno;
+         };
+         ws.submit(req);
+
+         paths.push_back(dir + "/after");
+         ws.submit(makeRequest(paths.back(), 0, 10, 'x'));
+         ws.stop();
+
+         THEN("the error is reported and the next file is written")
+         {
+            REQUIRE(rv == -1);
+            REQUIRE(err == ENOENT);
+            REQUIRE(ws.errors() == 1);
+            REQUIRE(ws.files() == 1);
+            REQUIRE(fileSize(dir + "/after") == 10);
+         }
+      }
+
+      WHEN("an ioGate is held by another writer")
+      {
+         MagAOX::sys::ioGate other, mine;
+         REQUIRE(other.open(dir, 1, 0) == 0);
+         REQUIRE(mine.open(dir, 1, 0) == 0);
+         REQUIRE(other.acquire(0.01) == 0);
+
+         ws.stop();
+         ws.gate(&mine, 0.02);
+         ws.start();
+
+         paths.push_back(dir + "/gated");
+         ws.submit(makeRequest(paths.back(), 0, 10, 'x'));
+         ws.stop();
+
+         THEN("the batch is written after the maximum wait")
+         {
+            REQUIRE(ws.gateTimeouts() == 1);
+            REQUIRE(ws.ioWait() >= 0.02);
+            REQUIRE(fileSize(dir + "/gated") == 10);
+            REQUIRE(mine.held() == -1);
+         }
+
+         other.close();
+         mine.close();
+         unlink(MagAOX::sys::ioGate::slotPath(dir, 0).c_str());
+      }
+
+      ws.stop();
+      for(size_t n = 0; n < paths.size(); ++n) unlink(paths[n].c_str());
+      rmdir(dir.c_str());
+   }
+}
+
+} //namespace writeScheduler_test
@@ -0,0 +1,234 @@
+#include "../../../tests/catch2/catch.hpp"
+
+#include "../xrifCatalog.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace xrifCatalog_test
+{
+
+//Make an entry with frames consecutive frames, 1 ms apart, starting at cnt0 and atime sec.
+MagAOX::sys::xrifCatalogEntry makeEntry( const std::string & file,
+                                         uint64_t cnt0,
+                                         uint64_t frames,
+                                         time_t sec
+                                       )
+{
+   std::vector<uint64_t> timing(5*frames);
+   for(uint64_t n = 0; n < frames; ++n)
+   {
+      timing[5*n] = cnt0 + n;
+      timing[5*n+1] = sec;
+      timing[5*n+2] = n*1000000;
+      timing[5*n+3] = sec;
+      timing[5*n+4] = n*1000000 + 500;
+   }
+
+   MagAOX::sys::xrifCatalogEntry e;
+   e.m_file = file;
+   e.m_stream = file.substr(0, file.rfind('_'));
+   e.m_width = 64;
+   e.m_height = 32;
+   e.m_typeCode = 4;
+   e.m_compressedSize = 1000;
+   e.m_rawSize = 64*32*2*frames;
+   e.timing(timing.data(), frames);
+
+   return e;
+}
+
+//Create an empty file.
+void touch( const std::string & path )
+{
+   std::ofstream fout(path);
+}
+
+SCENARIO( "Making xrif catalog entries", "[libMagAOX::sys]" )
+{
+   GIVEN("the timing data of an archive")
+   {
+      WHEN("the frames are consecutive")
+      {
+         MagAOX::sys::xrifCatalogEntry e = makeEntry("camwfs_20210101000000000000000.xrif", 100, 10, 1609459200);
+
+         REQUIRE(e.m_frames == 10);
+         REQUIRE(e.m_cnt0First == 100);
+         REQUIRE(e.m_cnt0Last == 109);
+         REQUIRE(e.m_atimeFirst.tv_sec == 1609459200);
+         REQUIRE(e.m_atimeFirst.tv_nsec == 0);
+         REQUIRE(e.m_atimeLast.tv_nsec == 9000000);
+         REQUIRE(e.dropped() == 0);
+         REQUIRE(e.ratio() == Approx(1000.0/40960));
+      }
+
+      WHEN("frames are missing")
+      {
+         uint64_t timing[] = { 5, 10, 0, 10, 0,
+                               9, 10, 1, 10, 1,
+                               7, 10, 2, 10, 2};
+
+         MagAOX::sys::xrifCatalogEntry e;
+         e.timing(timing, 3);
+
+         REQUIRE(e.m_cnt0First == 5);
+         REQUIRE(e.m_cnt0Last == 9);
+         REQUIRE(e.dropped() == 2);
+      }
+   }
+
+   GIVEN("an entry")
+   {
+      MagAOX::sys::xrifCatalogEntry e = makeEntry("camwfs_20210101000000000000000.xrif", 100, 10, 1609459200);
+
+      WHEN("it is formatted and parsed")
+      {
+         MagAOX::sys::xrifCatalogEntry e2;
+         REQUIRE(e2.parse(e.line()) == 0);
+
+         REQUIRE(e2.m_file == e.m_file);
+         REQUIRE(e2.m_stream == "camwfs");
+         REQUIRE(e2.m_width == 64);
+         REQUIRE(e2.m_height == 32);
+         REQUIRE(e2.m_typeCode == 4);
+         REQUIRE(e2.m_frames == 10);
+         REQUIRE(e2.m_cnt0First == 100);
+         REQUIRE(e2.m_cnt0Last == 109);
+         REQUIRE(e2.m_atimeLast.tv_sec == e.m_atimeLast.tv_sec);
+         REQUIRE(e2.m_atimeLast.tv_nsec == e.m_atimeLast.tv_nsec);
+         REQUIRE(e2.m_compressedSize == 1000);
+         REQUIRE(e2.m_rawSize == e.m_rawSize);
+      }
+
+      WHEN("a comment or a short line is parsed")
+      {
+         MagAOX::sys::xrifCatalogEntry e2;
+         REQUIRE(e2.parse("# file stream") == -1);
+         REQUIRE(e2.parse("camwfs_1.xrif camwfs 64") == -1);
+         REQUIRE(e2.parse("") == -1);
+      }
+   }
+}
+
+SCENARIO( "Maintaining an xrif catalog", "[libMagAOX::sys]" )
+{
+   GIVEN("a directory with archives appended to its catalog")
+   {
+      char tmpl[] = "/tmp/xrifCatalog_test_XXXXXX";
+      REQUIRE(mkdtemp(tmpl) != nullptr);
+      std::string dir = tmpl;
+
+      std::vector<MagAOX::sys::xrifCatalogEntry> es;
+      es.push_back(makeEntry("camwfs_20210101000002000000000.xrif", 200, 100, 1609459202));
+      es.push_back(makeEntry("camwfs_20210101000000000000000.xrif", 0, 100, 1609459200));
+      es.push_back(makeEntry("camwfs_20210101000001000000000.xrif", 100, 100, 1609459201));
+      es.push_back(makeEntry("camsci1_20210101000001500000000.xrif", 0, 50, 1609459201));
+
+      for(size_t n = 0; n < es.size(); ++n)
+      {
+         touch(dir + "/" + es[n].m_file);
+         REQUIRE(MagAOX::sys::xrifCatalog::append(dir, es[n]) == 0);
+      }
+
+      WHEN("the catalog is loaded")
+      {
+         MagAOX::sys::xrifCatalog cat;
+         REQUIRE(cat.load(dir + "/") == 0);
+         REQUIRE(cat.dir() == dir);
+         REQUIRE(cat.entries().size() == 4);
+
+         //Sorted by stream then time
+         REQUIRE(cat.entries()[0].m_stream == "camsci1");
+         REQUIRE(cat.entries()[1].m_cnt0First == 0);
+         REQUIRE(cat.entries()[2].m_cnt0First == 100);
+         REQUIRE(cat.entries()[3].m_cnt0First == 200);
+         REQUIRE(cat.path(3) == dir + "/camwfs_20210101000002000000000.xrif");
+      }
+
+      WHEN("archives are selected")
+      {
+         MagAOX::sys::xrifCatalog cat;
+         REQUIRE(cat.load(dir) == 0);
+
+         REQUIRE(cat.select("").size() == 4);
+         REQUIRE(cat.select("camwfs").size() == 3);
+
+         std::vector<size_t> idx = cat.select("camwfs", 150, 250);
+         REQUIRE(idx.size() == 2);
+         REQUIRE(cat.entries()[idx[0]].m_cnt0First == 100);
+         REQUIRE(cat.entries()[idx[1]].m_cnt0First == 200);
+
+         //The last frame of an archive is at 99 ms
+         idx = cat.select("camwfs", 0, std::numeric_limits<uint64_t>::max(), {1609459200, 99000000}, {1609459201, 0});
+         REQUIRE(idx.size() == 2);
+
+         idx = cat.select("camwfs", 0, std::numeric_limits<uint64_t>::max(), {1609459200, 99000001}, {1609459200, 999999999});
+         REQUIRE(idx.size() == 0);
+
+         idx = cat.select("", 0, 10);
+         REQUIRE(idx.size() == 2);
+      }
+
+      WHEN("an archive is appended twice, and one is removed")
+      {
+         MagAOX::sys::xrifCatalogEntry e = es[0];
+         e.m_frames = 99;
+         REQUIRE(MagAOX::sys::xrifCatalog::append(dir, e) == 0);
+
+         unlink((dir + "/" + es[1].m_file).c_str());
+
+         MagAOX::sys::xrifCatalog cat;
+         REQUIRE(cat.load(dir) == 0);
+         REQUIRE(cat.entries().size() == 3);
+         REQUIRE(cat.entries()[2].m_frames == 99);
+
+         //And saving drops them from the file
+         REQUIRE(cat.save() == 0);
+
+         std::ifstream fin(MagAOX::sys::xrifCatalog::catalogPath(dir));
+         std::string line;
+         int nlines = 0;
+         while(std::getline(fin, line)) if(line[0] != '#') ++nlines;
+         REQUIRE(nlines == 3);
+      }
+
+      std::string cmd = "rm -rf " + dir;
+      REQUIRE(system(cmd.c_str()) == 0);
+   }
+
+   GIVEN("a directory without a catalog")
+   {
+      MagAOX::sys::xrifCatalog cat;
+      REQUIRE(cat.load("/tmp/xrifCatalog_test_does_not_exist") == -1);
+      REQUIRE(cat.entries().size() == 0);
+   }
+}
+
+SCENARIO( "Parsing times for xrif catalog selection", "[libMagAOX::sys]" )
+{
+   GIVEN("ISO 8601 and compact times")
+   {
+      timespec ts;
+
+      REQUIRE(MagAOX::sys::xrifCatalog::parseTime(ts, "2021-01-01T00:00:01") == 0);
+      REQUIRE(ts.tv_sec == 1609459201);
+      REQUIRE(ts.tv_nsec == 0);
+
+      REQUIRE(MagAOX::sys::xrifCatalog::parseTime(ts, "2021-01-01T00:00:01.25") == 0);
+      REQUIRE(ts.tv_sec == 1609459201);
+      REQUIRE(ts.tv_nsec == 250000000);
+
+      REQUIRE(MagAOX::sys::xrifCatalog::parseTime(ts, "20210101000002") == 0);
+      REQUIRE(ts.tv_sec == 1609459202);
+
+      REQUIRE(MagAOX::sys::xrifCatalog::parseTime(ts, "2021-13-01T00:00:00") == -1);
+      REQUIRE(MagAOX::sys::xrifCatalog::parseTime(ts, "2021-01-01T00:00:00Z") == -1);
+      REQUIRE(MagAOX::sys::xrifCatalog::parseTime(ts, "yesterday") == -1);
+   }
+}
+
+} //namespace xrifCatalog_test
@@ -0,0 +1,85 @@
+#include "../../../tests/catch2/catch.hpp"
+
+#include "../xrifPreview.hpp"
+
+#include <cmath>
+#include <vector>
+
+#include <xrif/xrif.h>
+
+namespace xrifPreview_test
+{
+
+SCENARIO( "Computing xrif archive previews", "[libMagAOX::sys]" )
+{
+   GIVEN("sidecar paths")
+   {
+      REQUIRE(MagAOX::sys::xrifPreview::sidecarPath("/data/camwfs_20210101000000000000000.xrif") == "/data/camwfs_20210101000000000000000.preview.fits");
+      REQUIRE(MagAOX::sys::xrifPreview::sidecarPath("camwfs") == "camwfs.preview.fits");
+   }
+
+   GIVEN("saturation levels")
+   {
+      REQUIRE(MagAOX::sys::xrifPreview::defaultSatLevel(XRIF_TYPECODE_UINT16) == 65535);
+      REQUIRE(MagAOX::sys::xrifPreview::defaultSatLevel(XRIF_TYPECODE_INT16) == 32767);
+      REQUIRE(std::isinf(MagAOX::sys::xrifPreview::defaultSatLevel(XRIF_TYPECODE_FLOAT)));
+   }
+
+   GIVEN("3 frames of a 5x3 uint16 stream")
+   {
+      uint32_t width = 5;
+      uint32_t height = 3;
+      uint64_t frames = 3;
+
+      //Frame p has pixel n = p + n, with the last pixel of the last frame saturated.
+      std::vector<uint16_t> image(width*height*frames);
+      std::vector<uint64_t> timing(5*frames);
+      for(uint64_t p = 0; p < frames; ++p)
+      {
+         for(size_t n = 0; n < width*height; ++n) image[p*width*height + n] = p + n;
+
+         timing[5*p] = 100 + p;
+         timing[5*p+1] = 1609459200;
+         timing[5*p+2] = p*500000000;
+      }
+      image.back() = 65535;
+
+      MagAOX::sys::xrifPreview pv;
+
+      WHEN("the preview is computed with 2x2 binning")
+      {
+         REQUIRE(pv.compute(reinterpret_cast<char *>(image.data()), timing.data(), width, height, XRIF_TYPECODE_UINT16, frames, 2, 65535) == 0);
+
+         REQUIRE(pv.frames() == 3);
+         REQUIRE(pv.mean().size() == 15);
+         REQUIRE(pv.mean()[0] == Approx(1));
+         REQUIRE(pv.mean()[13] == Approx(14));
+
+         //The thumbnail has partial blocks on the right and bottom edges
+         REQUIRE(pv.thumbWidth() == 3);
+         REQUIRE(pv.thumbHeight() == 2);
+         REQUIRE(pv.thumb()[0] == Approx((1+2+6+7)/4.0));
+         REQUIRE(pv.thumb()[2] == Approx((5+10)/2.0));
+         REQUIRE(pv.thumb()[3] == Approx((11+12)/2.0));
+
+         REQUIRE(pv.cnt0()[2] == 102);
+         REQUIRE(pv.atime()[1] == Approx(1609459200.5));
+
+         REQUIRE(pv.flux()[0] == Approx(105));
+         REQUIRE(pv.flux()[1] == Approx(120));
+         REQUIRE(pv.min()[1] == 1);
+         REQUIRE(pv.max()[1] == 15);
+         REQUIRE(pv.max()[2] == 65535);
+         REQUIRE(pv.nsat()[1] == 0);
+         REQUIRE(pv.nsat()[2] == 1);
+      }
+
+      WHEN("the type is not supported")
+      {
+         REQUIRE(pv.compute(reinterpret_cast<char *>(image.data()), timing.data(), width, height, -1, frames, 2, 65535) == -1);
+         REQUIRE(pv.frames() == 0);
+      }
+   }
+}
+
+} //namespace xrifPreview_test
@@ -0,0 +1,221 @@
+/** \file workStealingPool.cpp
+  * \brief A pool of worker threads which steal tasks from each other.
+  *
+  * \ingroup sys_files
+  */
+
+#include "workStealingPool.hpp"
+
+namespace MagAOX
+{
+namespace sys
+{
+
+workStealingPool::~workStealingPool()
+{
+   stop();
+}
+
+int workStealingPool::start( size_t nThreads )
+{
+   std::lock_guard<std::mutex> poolLock(m_poolMutex);
+
+   if(m_running || m_workers.size() > 0) return -1;
+
+   if(nThreads < 1) nThreads = 1;
+
+   for(size_t n = 0; n < nThreads; ++n) m_workers.emplace_back(new worker);
+
+   m_running = true;
+
+   for(size_t n = 0; n < nThreads; ++n)
+   {
+      try
+      {
+         m_workers[n]->m_thread = std::thread(&workStealingPool::workerExec, this, n);
+      }
+      catch(...)
+      {
+         {
+            std::lock_guard<std::mutex> lock(m_waitMutex);
+            m_running = false;
+         }
+         m_wakeCv.notify_all();
+         for(size_t k = 0; k < n; ++k) m_workers[k]->m_thread.join();
+         m_workers.clear();
+         return -1;
+      }
+   }
+
+   return 0;
+}
+
+void workStealingPool::stop()
+{
+   //No lock is held while joining, since the tasks being finished may submit, and are then rejected.
+   {
+      std::lock_guard<std::mutex> poolLock(m_poolMutex);
+      std::lock_guard<std::mutex> lock(m_waitMutex);
+      m_running = false;
+   }
+   m_wakeCv.notify_all();
+
+   for(size_t n = 0; n < m_workers.size(); ++n)
+   {
+      if(m_workers[n]->m_thread.joinable()) m_workers[n]->m_thread.join();
+   }
+
+   std::lock_guard<std::mutex> poolLock(m_poolMutex);
+   m_workers.clear();
+}
+
+bool workStealingPool::running()
+{
+   return m_running;
+}
+
+size_t workStealingPool::threads()
+{
+   std::lock_guard<std::mutex> poolLock(m_poolMutex);
+   return m_workers.size();
+}
+
+std::thread::native_handle_type workStealingPool::nativeHandle( size_t n )
+{
+   std::lock_guard<std::mutex> poolLock(m_poolMutex);
+   return m_workers[n]->m_thread.native_handle();
+}
+
+int workStealingPool::submit( const taskT & task,
+                              int hint,
+                              bool urgent
+                            )
+{
+   //Held until the task is queued, so stop() can not clear the workers meanwhile.
+   std::lock_guard<std::mutex> poolLock(m_poolMutex);
+
+   if(!m_running) return -1;
+
+   size_t n;
+   if(hint < 0) n = (m_next++) % m_workers.size();
+   else n = hint % m_workers.size();
+
+   {
+      std::lock_guard<std::mutex> lock(m_workers[n]->m_mutex);
+      if(urgent) m_workers[n]->m_tasks.push_front(task);
+      else m_workers[n]->m_tasks.push_back(task);
+   }
+
+   //Counted after the task is queued, so a worker which sees the count can find the task.
+   {
+      std::lock_guard<std::mutex> lock(m_waitMutex);
+      ++m_queued;
+   }
+
+   //Wake the owner if it is idle, or any other to steal the task.
+   m_wakeCv.notify_one();
+
+   return 0;
+}
+
+void workStealingPool::wait()
+{
+   std::unique_lock<std::mutex> lock(m_waitMutex);
+   m_idleCv.wait(lock, [this]{ return m_queued == 0 && m_active == 0; });
+}
+
+size_t workStealingPool::queued()
+{
+   return m_queued;
+}
+
+size_t workStealingPool::active()
+{
+   return m_active;
+}
+
+uint64_t workStealingPool::executed()
+{
+   return m_executed;
+}
+
+uint64_t workStealingPool::stolen()
+{
+   return m_stolen;
+}
+
+bool workStealingPool::take( size_t n,
+                             taskT & task
+                           )
+{
+   size_t nw = m_workers.size();
+
+   for(size_t k = 0; k < nw; ++k)
+   {
+      size_t v = (n + k) % nw;
+
+      std::lock_guard<std::mutex> lock(m_workers[v]->m_mutex);
+
+      if(m_workers[v]->m_tasks.size() == 0) continue;
+
+      if(k == 0)
+      {
+         task = std::move(m_workers[v]->m_tasks.front());
+         m_workers[v]->m_tasks.pop_front();
+      }
+      else
+      {
+         task = std::move(m_workers[v]->m_tasks.back());
+         m_workers[v]->m_tasks.pop_back();
+         ++m_stolen;
+      }
+
+      //Active before no longer queued, so wait() never sees neither.
+      ++m_active;
+      --m_queued;
+
+      return true;
+   }
+
+   return false;
+}
+
+void workStealingPool::workerExec( size_t n )
+{
+   while(1)
+   {
+      taskT task;
+
+      if(take(n, task))
+      {
+         try
+         {
+            task();
+         }
+         catch(...)
+         {
+            //A task must not take down the worker.
+         }
+
+         ++m_executed;
+
+         {
+            std::lock_guard<std::mutex> lock(m_waitMutex);
+            --m_active;
+         }
+         m_idleCv.notify_all();
+
+         continue;
+      }
+
+      std::unique_lock<std::mutex> lock(m_waitMutex);
+
+      //Queued tasks are run before stopping.
+      if(!m_running && m_queued == 0) return;
+
+      m_wakeCv.wait(lock, [this]{ return m_queued > 0 || !m_running; });
+   }
+}
+
+} //namespace sys
+} //namespace MagAOX
@@ -0,0 +1,144 @@
+/** \file workStealingPool.hpp
+  * \brief A pool of worker threads which steal tasks from each other.
+  *
+  * \ingroup sys_files
+  */
+
+#ifndef sys_workStealingPool_hpp
+#define sys_workStealingPool_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MagAOX
+{
+namespace sys
+{
+
+/// A pool of worker threads, each with its own task queue, which steal tasks from each other when idle.
+/** A task is submitted to the queue of one worker, normally chosen by the submitter so that related tasks, such as the
+  * chunks of one stream, go to the same worker and find its caches warm.  A worker runs the tasks at the front of its
+  * own queue, and when it is empty takes the task at the back of another worker's queue.  So the load is shared out
+  * whenever it is uneven, without a single queue that every submitter and worker contends for.
+  *
+  * Urgent tasks are put at the front of the queue, and so run before the tasks already queued on that worker, and are
+  * the last to be stolen.
+  *
+  * Each queue has its own mutex.  Idle workers sleep on a condition variable, so an idle pool costs nothing.
+  *
+  * \ingroup sys
+  */
+class workStealingPool
+{
+public:
+
+   /// The task type.
+   typedef std::function<void()> taskT;
+
+protected:
+
+   /// A worker thread and its queue.
+   struct worker
+   {
+      std::deque<taskT> m_tasks; ///< The queue.  Protected by m_mutex.
+      std::mutex m_mutex;        ///< Protects m_tasks.
+      std::thread m_thread;      ///< The thread.
+   };
+
+   std::vector<std::unique_ptr<worker>> m_workers; ///< The workers.
+
+   std::mutex m_poolMutex; ///< Protects m_workers and m_running against a submit while the pool is started or stopped.
+
+   std::mutex m_waitMutex;          ///< Used with m_wakeCv and m_idleCv.
+   std::condition_variable m_wakeCv; ///< Signaled when a task is submitted, or the pool is stopped.
+   std::condition_variable m_idleCv; ///< Signaled when a task finishes.
+
+   std::atomic<size_t> m_queued {0}; ///< The number of tasks in the queues.
+   std::atomic<size_t> m_active {0}; ///< The number of tasks being run.
+
+   std::atomic<uint64_t> m_executed {0}; ///< The number of tasks run.
+   std::atomic<uint64_t> m_stolen {0};   ///< The number of tasks run by a worker other than the one they were submitted to.
+
+   std::atomic<size_t> m_next {0}; ///< The next worker for tasks submitted without a worker.
+
+   std::atomic<bool> m_running {false}; ///< Whether the workers are running.
+
+public:
+
+   /// D'tor.  Stops the workers, after they run the tasks already queued.
+   ~workStealingPool();
+
+   /// Start the workers.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, if already running or the threads could not be started
+     */
+   int start( size_t nThreads /**< [in] the number of workers, at least 1 */);
+
+   /// Stop the workers, after they run the tasks already queued, and wait for them to exit.
+   /** Tasks submitted after this is called, including by the tasks being run, are rejected.  So a task which submits
+     * more work, e.g. when a resource it holds is freed, must not count on it being run after stop().
+     */
+   void stop();
+
+   /// Check whether the workers are running.
+   bool running();
+
+   /// Get the number of workers.
+   size_t threads();
+
+   /// Get the native handle of a worker thread, e.g. to set its scheduling priority.
+   std::thread::native_handle_type nativeHandle( size_t n /**< [in] the worker */);
+
+   /// Submit a task.
+   /** This may be called from any thread, including the workers, and concurrently with stop().
+     *
+     * \returns 0 on success
+     * \returns -1 if the pool is not running
+     */
+   int submit( const taskT & task,  ///< [in] the task
+               int hint = -1,       ///< [in] [optional] the worker to queue the task on, modulo the number of workers.  If < 0 the workers are used in turn.
+               bool urgent = false  ///< [in] [optional] if true the task is put at the front of the queue
+             );
+
+   /// Wait until no tasks are queued or running.
+   void wait();
+
+   /// Get the number of tasks queued, but not yet running.
+   size_t queued();
+
+   /// Get the number of tasks running.
+   size_t active();
+
+   /// Get the number of tasks run.
+   uint64_t executed();
+
+   /// Get the number of tasks run by a worker other than the one they were submitted to.
+   uint64_t stolen();
+
+protected:
+
+   /// Take a task, from the front of the worker's own queue, or else from the back of another's.
+   /**
+     * \returns true if a task was taken, in which case it is counted as active
+     * \returns false if all queues are empty
+     */
+   bool take( size_t n,     ///< [in] the worker
+              taskT & task  ///< [out] the task
+            );
+
+   /// The worker thread.
+   void workerExec( size_t n /**< [in] the worker */);
+};
+
+} //namespace sys
+} //namespace MagAOX
+
+#endif //sys_workStealingPool_hpp
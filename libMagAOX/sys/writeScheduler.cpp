@@ -0,0 +1,300 @@
+/** \file writeScheduler.cpp
+  * \brief A single writer thread which batches file writes from many producers.
+  *
+  * \ingroup sys_files
+  */
+
+#include "writeScheduler.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <ctime>
+
+namespace MagAOX
+{
+namespace sys
+{
+
+namespace
+{
+
+double monotonic()
+{
+   timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+}
+
+writeScheduler::~writeScheduler()
+{
+   stop();
+}
+
+void writeScheduler::gate( ioGate * g,
+                           double maxWait
+                         )
+{
+   m_gate = g;
+   m_gateMaxWait = maxWait;
+}
+
+void writeScheduler::batchWait( double bw )
+{
+   m_batchWait = bw;
+}
+
+void writeScheduler::maxBatch( size_t mb )
+{
+   m_maxBatch = (mb < 1) ? 1 : mb;
+}
+
+void writeScheduler::maxBatchBytes( uint64_t mbb )
+{
+   m_maxBatchBytes = mbb;
+}
+
+void writeScheduler::budget( uint64_t b )
+{
+   m_budget = b;
+}
+
+int writeScheduler::start()
+{
+   if(m_running) return -1;
+
+   m_running = true;
+
+   try
+   {
+      m_thread = std::thread(&writeScheduler::threadExec, this);
+   }
+   catch(...)
+   {
+      m_running = false;
+      return -1;
+   }
+
+   return 0;
+}
+
+void writeScheduler::stop()
+{
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_running = false;
+   }
+   m_cv.notify_all();
+
+   if(m_thread.joinable()) m_thread.join();
+}
+
+bool writeScheduler::running()
+{
+   return m_running;
+}
+
+std::thread::native_handle_type writeScheduler::nativeHandle()
+{
+   return m_thread.native_handle();
+}
+
+int writeScheduler::submit( const request & req )
+{
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+
+      if(!m_running) return -1;
+
+      entry e;
+      e.m_req = req;
+      e.m_seq = m_seq++;
+      e.m_submitted = monotonic();
+      m_queue.push_back(std::move(e));
+
+      m_queuedBytes += req.m_bytes;
+   }
+
+   m_cv.notify_one();
+
+   return 0;
+}
+
+size_t writeScheduler::queued()
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   return m_queue.size();
+}
+
+uint64_t writeScheduler::queuedBytes()
+{
+   return m_queuedBytes;
+}
+
+double writeScheduler::backlog()
+{
+   if(m_budget == 0) return 0;
+   return ((double) m_queuedBytes) / m_budget;
+}
+
+uint64_t writeScheduler::files()
+{
+   return m_files;
+}
+
+uint64_t writeScheduler::errors()
+{
+   return m_errors;
+}
+
+uint64_t writeScheduler::batches()
+{
+   return m_batches;
+}
+
+uint64_t writeScheduler::bytes()
+{
+   return m_bytes;
+}
+
+uint64_t writeScheduler::gateTimeouts()
+{
+   return m_gateTimeouts;
+}
+
+double writeScheduler::ioWait()
+{
+   return m_ioWaitUs/1e6;
+}
+
+double writeScheduler::writeTime()
+{
+   return m_writeUs/1e6;
+}
+
+bool writeScheduler::batchFull()
+{
+   if(m_queue.size() >= m_maxBatch) return true;
+
+   if(m_maxBatchBytes > 0 && m_queuedBytes >= m_maxBatchBytes) return true;
+
+   return false;
+}
+
+void writeScheduler::writeBatch( std::vector<entry> & batch )
+{
+   double t0 = monotonic();
+
+   int grv = 0;
+   if(m_gate) grv = m_gate->acquire(m_gateMaxWait);
+
+   //On timeout or error the batch is written anyway, since it is better to contend for the disk than to lose frames.
+   if(grv != 0) ++m_gateTimeouts;
+
+   double t1 = monotonic();
+
+   std::vector<result> results(batch.size());
+
+   for(size_t n = 0; n < batch.size(); ++n)
+   {
+      result & res = results[n];
+      res.m_queueTime = t0 - batch[n].m_submitted;
+      res.m_ioWait = t1 - t0;
+      res.m_batchSize = batch.size();
+
+      double tw0 = monotonic();
+
+      FILE * fp = fopen(batch[n].m_req.m_path.c_str(), "wb");
+      if(fp == nullptr)
+      {
+         res.m_rv = -1;
+         res.m_errno = errno;
+      }
+      else
+      {
+         errno = 0;
+         if(batch[n].m_req.m_write(fp) < 0)
+         {
+            res.m_rv = -1;
+            res.m_errno = errno;
+         }
+
+         if(fclose(fp) != 0 && res.m_rv == 0)
+         {
+            res.m_rv = -1;
+            res.m_errno = errno;
+         }
+      }
+
+      res.m_writeTime = monotonic() - tw0;
+
+      if(res.m_rv == 0)
+      {
+         ++m_files;
+         m_bytes += batch[n].m_req.m_bytes;
+      }
+      else ++m_errors;
+
+      m_writeUs += res.m_writeTime*1e6;
+   }
+
+   if(m_gate) m_gate->release();
+
+   ++m_batches;
+   m_ioWaitUs += (t1-t0)*1e6;
+
+   for(size_t n = 0; n < batch.size(); ++n)
+   {
+      m_queuedBytes -= batch[n].m_req.m_bytes;
+
+      if(batch[n].m_req.m_done) batch[n].m_req.m_done(results[n]);
+   }
+}
+
+void writeScheduler::threadExec()
+{
+   while(1)
+   {
+      std::vector<entry> batch;
+
+      {
+         std::unique_lock<std::mutex> lock(m_mutex);
+
+         m_cv.wait(lock, [this]{ return m_queue.size() > 0 || !m_running; });
+
+         //Queued requests are written before stopping.
+         if(m_queue.size() == 0) return;
+
+         if(m_batchWait > 0 && m_running)
+         {
+            m_cv.wait_for(lock, std::chrono::duration<double>(m_batchWait), [this]{ return batchFull() || !m_running; });
+         }
+
+         std::sort(m_queue.begin(), m_queue.end(), [](const entry & a, const entry & b)
+         {
+            if(a.m_req.m_priority != b.m_req.m_priority) return a.m_req.m_priority > b.m_req.m_priority;
+            return a.m_seq < b.m_seq;
+         });
+
+         uint64_t bytes = 0;
+         size_t n = 0;
+         while(n < m_queue.size() && n < m_maxBatch)
+         {
+            if(n > 0 && m_maxBatchBytes > 0 && bytes + m_queue[n].m_req.m_bytes > m_maxBatchBytes) break;
+
+            bytes += m_queue[n].m_req.m_bytes;
+            ++n;
+         }
+
+         batch.assign(std::make_move_iterator(m_queue.begin()), std::make_move_iterator(m_queue.begin() + n));
+         m_queue.erase(m_queue.begin(), m_queue.begin() + n);
+      }
+
+      writeBatch(batch);
+   }
+}
+
+} //namespace sys
+} //namespace MagAOX
@@ -0,0 +1,201 @@
+/** \file writeScheduler.hpp
+  * \brief A single writer thread which batches file writes from many producers.
+  *
+  * \ingroup sys_files
+  */
+
+#ifndef sys_writeScheduler_hpp
+#define sys_writeScheduler_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ioGate.hpp"
+
+namespace MagAOX
+{
+namespace sys
+{
+
+/// A single writer thread which batches file writes from many producers.
+/** Producers, such as the encoders of several streams, submit requests to write a file.  The contents are ready when
+  * the request is submitted, and are written by a callback given the open file, so that writing costs only the copy to
+  * the file.  The writer thread takes all the requests pending, highest priority first and in order of submission
+  * within a priority, and writes them as one batch: the ioGate is acquired once, each file is opened, written and
+  * closed, and the gate is released.  So the processes sharing a disk take turns a batch at a time rather than a file
+  * at a time, and the gate is held only while data is copied.
+  *
+  * The number of bytes queued, as a fraction of a budget, is the backlog of the disk.  Producers use it for
+  * backpressure, e.g. to compress harder as the disk falls behind.
+  *
+  * Each request has a completion callback, which is called by the writer thread after the batch is written and the gate
+  * released.  It should be quick, since the next batch waits for it.
+  *
+  * Configure the scheduler before calling start().
+  *
+  * \ingroup sys
+  */
+class writeScheduler
+{
+public:
+
+   /// The result of a request, passed to its completion callback.
+   struct result
+   {
+      int m_rv {0};           ///< 0 on success, -1 on error.
+      int m_errno {0};        ///< The errno of the error, if m_rv is -1.
+      double m_queueTime {0}; ///< The time from submission to the start of the batch, in seconds.
+      double m_ioWait {0};    ///< The time the batch waited for the ioGate, in seconds.
+      double m_writeTime {0}; ///< The time from opening to closing the file, in seconds.
+      size_t m_batchSize {0}; ///< The number of requests in the batch.
+   };
+
+   /// A request to write a file.
+   struct request
+   {
+      std::string m_path;      ///< The path of the file, which is created or truncated.
+      unsigned m_priority {0}; ///< The priority.  Higher priorities are written first.
+      uint64_t m_bytes {0};    ///< The size of the file, for the backlog.
+
+      std::function<int(FILE *)> m_write;         ///< Writes the contents to the open file.  Returns 0 on success, -1 on error with errno set.
+      std::function<void(const result &)> m_done; ///< [optional] Called when the file is closed, or could not be written.
+   };
+
+protected:
+
+   /// A queued request.
+   struct entry
+   {
+      request m_req;         ///< The request.
+      uint64_t m_seq {0};    ///< The order of submission.
+      double m_submitted {0}; ///< The monotonic time of submission, in seconds.
+   };
+
+   std::vector<entry> m_queue; ///< The requests pending.  Protected by m_mutex.
+   uint64_t m_seq {0};         ///< The next sequence number.  Protected by m_mutex.
+   std::mutex m_mutex;         ///< Protects m_queue and m_seq.
+   std::condition_variable m_cv; ///< Signaled when a request is submitted, or the scheduler is stopped.
+
+   std::atomic<uint64_t> m_queuedBytes {0}; ///< The bytes submitted and not yet written.
+
+   ioGate * m_gate {nullptr}; ///< The ioGate, or nullptr for none.
+   double m_gateMaxWait {0.5}; ///< The maximum time to wait for the ioGate, in seconds.
+
+   double m_batchWait {0};        ///< How long to wait for more requests to join a batch, in seconds.
+   size_t m_maxBatch {16};        ///< The maximum number of requests in a batch.
+   uint64_t m_maxBatchBytes {0};  ///< The maximum bytes in a batch, or 0 for no limit.  A batch always has at least one request.
+   uint64_t m_budget {1073741824}; ///< The bytes queued at which the backlog is 1.
+
+   std::thread m_thread; ///< The writer thread.
+
+   std::atomic<bool> m_running {false}; ///< Whether the writer thread is running.
+
+   std::atomic<uint64_t> m_files {0};      ///< The number of files written.
+   std::atomic<uint64_t> m_errors {0};     ///< The number of files which could not be written.
+   std::atomic<uint64_t> m_batches {0};    ///< The number of batches written.
+   std::atomic<uint64_t> m_bytes {0};      ///< The number of bytes written.
+   std::atomic<uint64_t> m_gateTimeouts {0}; ///< The number of batches written without the ioGate, after waiting m_gateMaxWait.
+   std::atomic<uint64_t> m_ioWaitUs {0};   ///< The total time waited for the ioGate, in microseconds.
+   std::atomic<uint64_t> m_writeUs {0};    ///< The total time spent writing, in microseconds.
+
+public:
+
+   /// D'tor.  Stops the writer thread, after it writes the requests already queued.
+   ~writeScheduler();
+
+   /// Set the ioGate, which is acquired for each batch.
+   void gate( ioGate * g,     ///< [in] the ioGate, or nullptr for none.  Must outlive the scheduler, or the next call to gate.
+              double maxWait  ///< [in] the maximum time to wait for it, in seconds
+            );
+
+   /// Set how long to wait for more requests to join a batch.
+   /** The default, 0, writes what is pending as soon as the writer is free.  A short wait collects the chunks which
+     * several streams finish at about the same time into one batch.
+     */
+   void batchWait( double bw /**< [in] the wait, in seconds */);
+
+   /// Set the maximum number of requests in a batch.
+   void maxBatch( size_t mb /**< [in] the maximum, at least 1 */);
+
+   /// Set the maximum bytes in a batch, which limits how long the ioGate is held.
+   void maxBatchBytes( uint64_t mbb /**< [in] the maximum, or 0 for no limit */);
+
+   /// Set the bytes queued at which the backlog is 1.
+   void budget( uint64_t b /**< [in] the budget, in bytes */);
+
+   /// Start the writer thread.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, if already running or the thread could not be started
+     */
+   int start();
+
+   /// Stop the writer thread, after it writes the requests already queued.
+   void stop();
+
+   /// Check whether the writer thread is running.
+   bool running();
+
+   /// Get the native handle of the writer thread, e.g. to set its scheduling priority.
+   std::thread::native_handle_type nativeHandle();
+
+   /// Submit a request.
+   /**
+     * \returns 0 on success
+     * \returns -1 if the scheduler is not running
+     */
+   int submit( const request & req /**< [in] the request*/);
+
+   /// Get the number of requests pending.
+   size_t queued();
+
+   /// Get the bytes submitted and not yet written.
+   uint64_t queuedBytes();
+
+   /// Get the backlog, the bytes queued as a fraction of the budget.
+   double backlog();
+
+   /// Get the number of files written.
+   uint64_t files();
+
+   /// Get the number of files which could not be written.
+   uint64_t errors();
+
+   /// Get the number of batches written.
+   uint64_t batches();
+
+   /// Get the number of bytes written.
+   uint64_t bytes();
+
+   /// Get the number of batches written without the ioGate, after waiting the maximum time for it.
+   uint64_t gateTimeouts();
+
+   /// Get the total time waited for the ioGate, in seconds.
+   double ioWait();
+
+   /// Get the total time spent writing, in seconds.
+   double writeTime();
+
+protected:
+
+   /// Check if the pending requests make a full batch.  Call with m_mutex locked.
+   bool batchFull();
+
+   /// Write a batch.
+   void writeBatch( std::vector<entry> & batch /**< [in] the batch*/);
+
+   /// The writer thread.
+   void threadExec();
+};
+
+} //namespace sys
+} //namespace MagAOX
+
+#endif //sys_writeScheduler_hpp
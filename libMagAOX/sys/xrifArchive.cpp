@@ -0,0 +1,442 @@
+/** \file xrifArchive.cpp
+  * \brief Random access reading of xrif archives, including archives of sub-chunks.
+  *
+  * \ingroup sys_files
+  */
+
+#include "xrifArchive.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+namespace MagAOX
+{
+namespace sys
+{
+
+namespace
+{
+
+/// The size of the end of the index: the number of sub-chunks, the sub-chunk length, and the magic string.
+constexpr long indexTrailerSize = 2*sizeof(uint64_t) + 8;
+
+/// The size of each sub-chunk in the index.
+constexpr long indexBlockSize = 2*sizeof(uint64_t);
+
+}
+
+xrifArchive::~xrifArchive()
+{
+   close();
+}
+
+int xrifArchive::open( std::string & errMsg,
+                       const std::string & path
+                     )
+{
+   close();
+
+   m_path = path;
+
+   m_fp = fopen(path.c_str(), "rb");
+   if(m_fp == nullptr)
+   {
+      errMsg = "error opening " + path + ": " + strerror(errno);
+      return -1;
+   }
+
+   if(xrif_new(&m_xrif) != XRIF_NOERROR || xrif_new(&m_xrif_timing) != XRIF_NOERROR)
+   {
+      errMsg = "error allocating xrif handles";
+      close();
+      return -1;
+   }
+
+   char header[XRIF_HEADER_SIZE];
+   uint32_t header_size;
+
+   if(fread(header, 1, XRIF_HEADER_SIZE, m_fp) != XRIF_HEADER_SIZE)
+   {
+      errMsg = "error reading header of " + path;
+      close();
+      return -1;
+   }
+
+   if(xrif_read_header(m_xrif, &header_size, header) != XRIF_NOERROR)
+   {
+      errMsg = "invalid header in " + path;
+      close();
+      return -1;
+   }
+
+   m_width = m_xrif->width;
+   m_height = m_xrif->height;
+   m_depth = m_xrif->depth;
+   m_typeCode = m_xrif->type_code;
+   m_frameSize = static_cast<size_t>(m_xrif->width)*m_xrif->height*m_xrif->depth*xrif_typesize(m_xrif->type_code);
+
+   if(readIndex(errMsg) < 0)
+   {
+      close();
+      return -1;
+   }
+
+   //A plain archive is one sub-chunk
+   if(m_blocks.size() == 0)
+   {
+      block b;
+      b.m_offset = 0;
+      b.m_frames = m_xrif->frames;
+      m_blocks.push_back(b);
+
+      m_compressedSize = m_xrif->compressed_size;
+   }
+
+   m_frames = 0;
+   for(size_t n = 0; n < m_blocks.size(); ++n) m_frames += m_blocks[n].m_frames;
+
+   return 0;
+}
+
+void xrifArchive::close()
+{
+   if(m_fp) fclose(m_fp);
+   m_fp = nullptr;
+
+   if(m_xrif) xrif_delete(m_xrif);
+   m_xrif = nullptr;
+
+   if(m_xrif_timing) xrif_delete(m_xrif_timing);
+   m_xrif_timing = nullptr;
+
+   m_width = 0;
+   m_height = 0;
+   m_depth = 0;
+   m_typeCode = 0;
+   m_frameSize = 0;
+   m_frames = 0;
+   m_subChunkLength = 0;
+   m_compressedSize = 0;
+   m_blocks.clear();
+   m_decoded = -1;
+   m_imageDecoded = false;
+}
+
+const std::string & xrifArchive::path() const
+{
+   return m_path;
+}
+
+uint32_t xrifArchive::width() const
+{
+   return m_width;
+}
+
+uint32_t xrifArchive::height() const
+{
+   return m_height;
+}
+
+uint32_t xrifArchive::depth() const
+{
+   return m_depth;
+}
+
+int xrifArchive::typeCode() const
+{
+   return m_typeCode;
+}
+
+uint64_t xrifArchive::frames() const
+{
+   return m_frames;
+}
+
+uint64_t xrifArchive::subChunkLength() const
+{
+   return m_subChunkLength;
+}
+
+uint64_t xrifArchive::compressedSize() const
+{
+   return m_compressedSize;
+}
+
+const std::vector<xrifArchive::block> & xrifArchive::blocks() const
+{
+   return m_blocks;
+}
+
+int xrifArchive::read( std::string & errMsg,
+                       char * image,
+                       uint64_t * timing,
+                       uint64_t first,
+                       uint64_t count
+                     )
+{
+   if(m_fp == nullptr)
+   {
+      errMsg = "archive not open";
+      return -1;
+   }
+
+   if(first + count > m_frames || first + count < first)
+   {
+      errMsg = "frames out of range in " + m_path;
+      return -1;
+   }
+
+   uint64_t bfirst = 0;
+   for(size_t b = 0; b < m_blocks.size() && count > 0; ++b)
+   {
+      uint64_t blast = bfirst + m_blocks[b].m_frames;
+
+      uint64_t o0 = (first > bfirst) ? first : bfirst;
+      uint64_t o1 = (first + count < blast) ? first + count : blast;
+
+      if(o0 < o1)
+      {
+         if(decode(errMsg, b, image != nullptr) < 0) return -1;
+
+         if(image)
+         {
+            memcpy(image + (o0-first)*m_frameSize, m_xrif->raw_buffer + (o0-bfirst)*m_frameSize, (o1-o0)*m_frameSize);
+         }
+
+         if(timing)
+         {
+            memcpy(timing + (o0-first)*5, reinterpret_cast<uint64_t *>(m_xrif_timing->raw_buffer) + (o0-bfirst)*5,
+                                                                                        (o1-o0)*5*sizeof(uint64_t));
+         }
+      }
+
+      bfirst = blast;
+   }
+
+   return 0;
+}
+
+int xrifArchive::writeIndex( FILE * fp,
+                             const std::vector<block> & blocks,
+                             uint64_t subChunkLength
+                           )
+{
+   std::vector<uint64_t> index;
+   index.reserve(2*blocks.size() + 2);
+
+   for(size_t n = 0; n < blocks.size(); ++n)
+   {
+      index.push_back(blocks[n].m_offset);
+      index.push_back(blocks[n].m_frames);
+   }
+
+   index.push_back(blocks.size());
+   index.push_back(subChunkLength);
+
+   if(fwrite(index.data(), sizeof(uint64_t), index.size(), fp) != index.size()) return -1;
+
+   if(fwrite(XRIF_ARCHIVE_INDEX_MAGIC, 1, 8, fp) != 8) return -1;
+
+   return 0;
+}
+
+int xrifArchive::readIndex( std::string & errMsg )
+{
+   if(fseek(m_fp, 0, SEEK_END) != 0)
+   {
+      errMsg = "error seeking in " + m_path;
+      return -1;
+   }
+
+   long fsize = ftell(m_fp);
+
+   //Too small for an index is a plain archive
+   if(fsize < indexTrailerSize + XRIF_HEADER_SIZE) return 0;
+
+   char trailer[indexTrailerSize];
+
+   if(fseek(m_fp, -indexTrailerSize, SEEK_END) != 0 || fread(trailer, 1, indexTrailerSize, m_fp) != indexTrailerSize)
+   {
+      errMsg = "error reading end of " + m_path;
+      return -1;
+   }
+
+   if(memcmp(trailer + 2*sizeof(uint64_t), XRIF_ARCHIVE_INDEX_MAGIC, 8) != 0) return 0;
+
+   uint64_t nblocks, subChunkLength;
+   memcpy(&nblocks, trailer, sizeof(uint64_t));
+   memcpy(&subChunkLength, trailer + sizeof(uint64_t), sizeof(uint64_t));
+
+   if(nblocks == 0 || nblocks > static_cast<uint64_t>((fsize - indexTrailerSize)/indexBlockSize))
+   {
+      errMsg = "invalid sub-chunk index in " + m_path;
+      return -1;
+   }
+
+   long indexStart = fsize - indexTrailerSize - nblocks*indexBlockSize;
+
+   std::vector<uint64_t> index(2*nblocks);
+   if(fseek(m_fp, indexStart, SEEK_SET) != 0 || fread(index.data(), sizeof(uint64_t), index.size(), m_fp) != index.size())
+   {
+      errMsg = "error reading sub-chunk index of " + m_path;
+      return -1;
+   }
+
+   m_blocks.resize(nblocks);
+   for(size_t n = 0; n < nblocks; ++n)
+   {
+      m_blocks[n].m_offset = index[2*n];
+      m_blocks[n].m_frames = index[2*n+1];
+
+      if(m_blocks[n].m_offset + XRIF_HEADER_SIZE > static_cast<uint64_t>(indexStart) || (n > 0 && m_blocks[n].m_offset <= m_blocks[n-1].m_offset))
+      {
+         errMsg = "invalid sub-chunk index in " + m_path;
+         m_blocks.clear();
+         return -1;
+      }
+   }
+
+   //The headers give the compressed size, and check the index
+   xrif_t xrif;
+   if(xrif_new(&xrif) != XRIF_NOERROR)
+   {
+      errMsg = "error allocating xrif handle";
+      m_blocks.clear();
+      return -1;
+   }
+
+   int rv = 0;
+   for(size_t n = 0; n < nblocks; ++n)
+   {
+      char header[XRIF_HEADER_SIZE];
+      uint32_t header_size;
+
+      if(fseek(m_fp, m_blocks[n].m_offset, SEEK_SET) != 0 || fread(header, 1, XRIF_HEADER_SIZE, m_fp) != XRIF_HEADER_SIZE ||
+                                                                xrif_read_header(xrif, &header_size, header) != XRIF_NOERROR)
+      {
+         errMsg = "error reading header of sub-chunk " + std::to_string(n) + " of " + m_path;
+         rv = -1;
+         break;
+      }
+
+      if(xrif->frames != m_blocks[n].m_frames || xrif->width != m_width || xrif->height != m_height || xrif->depth != m_depth || xrif->type_code != m_typeCode)
+      {
+         errMsg = "sub-chunk " + std::to_string(n) + " does not match the index in " + m_path;
+         rv = -1;
+         break;
+      }
+
+      m_compressedSize += xrif->compressed_size;
+   }
+
+   xrif_delete(xrif);
+
+   if(rv < 0)
+   {
+      m_blocks.clear();
+      m_compressedSize = 0;
+      return -1;
+   }
+
+   m_subChunkLength = subChunkLength;
+
+   return 0;
+}
+
+int xrifArchive::decode( std::string & errMsg,
+                         size_t b,
+                         bool image
+                       )
+{
+   if(m_decoded == static_cast<long>(b) && (m_imageDecoded || !image)) return 0;
+
+   m_decoded = -1;
+
+   char header[XRIF_HEADER_SIZE];
+   uint32_t header_size;
+
+   if(fseek(m_fp, m_blocks[b].m_offset, SEEK_SET) != 0 || fread(header, 1, XRIF_HEADER_SIZE, m_fp) != XRIF_HEADER_SIZE)
+   {
+      errMsg = "error reading header of " + m_path;
+      return -1;
+   }
+
+   if(xrif_read_header(m_xrif, &header_size, header) != XRIF_NOERROR)
+   {
+      errMsg = "invalid header in " + m_path;
+      return -1;
+   }
+
+   if(image)
+   {
+      if(xrif_allocate_raw(m_xrif) != XRIF_NOERROR || xrif_allocate_reordered(m_xrif) != XRIF_NOERROR)
+      {
+         errMsg = "error allocating buffers for " + m_path;
+         return -1;
+      }
+
+      if(fread(m_xrif->raw_buffer, 1, m_xrif->compressed_size, m_fp) != m_xrif->compressed_size)
+      {
+         errMsg = "error reading data from " + m_path;
+         return -1;
+      }
+   }
+   else
+   {
+      if(fseek(m_fp, m_xrif->compressed_size, SEEK_CUR) != 0)
+      {
+         errMsg = "error seeking in " + m_path;
+         return -1;
+      }
+   }
+
+   if(fread(header, 1, XRIF_HEADER_SIZE, m_fp) != XRIF_HEADER_SIZE)
+   {
+      errMsg = "error reading timing header of " + m_path;
+      return -1;
+   }
+
+   if(xrif_read_header(m_xrif_timing, &header_size, header) != XRIF_NOERROR)
+   {
+      errMsg = "invalid timing header in " + m_path;
+      return -1;
+   }
+
+   if(m_xrif_timing->width != 5 || m_xrif_timing->frames != m_blocks[b].m_frames)
+   {
+      errMsg = "unexpected timing data size in " + m_path;
+      return -1;
+   }
+
+   if(xrif_allocate_raw(m_xrif_timing) != XRIF_NOERROR || xrif_allocate_reordered(m_xrif_timing) != XRIF_NOERROR)
+   {
+      errMsg = "error allocating timing buffers for " + m_path;
+      return -1;
+   }
+
+   if(fread(m_xrif_timing->raw_buffer, 1, m_xrif_timing->compressed_size, m_fp) != m_xrif_timing->compressed_size)
+   {
+      errMsg = "error reading timing data from " + m_path;
+      return -1;
+   }
+
+   if(image && xrif_decode(m_xrif) != XRIF_NOERROR)
+   {
+      errMsg = "error decoding image data from " + m_path;
+      return -1;
+   }
+
+   if(xrif_decode(m_xrif_timing) != XRIF_NOERROR)
+   {
+      errMsg = "error decoding timing data from " + m_path;
+      return -1;
+   }
+
+   m_decoded = b;
+   m_imageDecoded = image;
+
+   return 0;
+}
+
+} //namespace sys
+} //namespace MagAOX
@@ -0,0 +1,166 @@
+/** \file xrifArchive.hpp
+  * \brief Random access reading of xrif archives, including archives of sub-chunks.
+  *
+  * \ingroup sys_files
+  */
+
+#ifndef sys_xrifArchive_hpp
+#define sys_xrifArchive_hpp
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <xrif/xrif.h>
+
+/// The magic string at the end of an archive of sub-chunks.
+#define XRIF_ARCHIVE_INDEX_MAGIC "XRIFSUBK"
+
+namespace MagAOX
+{
+namespace sys
+{
+
+/// Reads frames from an xrif archive, decoding only the parts of the archive which hold them.
+/** A plain archive is an image data header and data, followed by a timing data header and data, for all the frames
+  * in the archive.  Reading any frame decodes all of them.
+  *
+  * An archive of sub-chunks is a series of plain archives of at most subChunkLength frames each, followed by an index.
+  * Each sub-chunk is compressed on its own, so its first frame is a keyframe, and reading a frame decodes only its
+  * sub-chunk.  The index is the offset in the file and the number of frames of each sub-chunk, as pairs of uint64_t,
+  * followed by the number of sub-chunks and subChunkLength as uint64_t, and then the 8 characters
+  * XRIF_ARCHIVE_INDEX_MAGIC, which end the file.
+  *
+  * The last decoded sub-chunk is kept, so reading consecutive frames decodes each sub-chunk once.
+  *
+  * \ingroup sys
+  */
+class xrifArchive
+{
+public:
+
+   /// A sub-chunk of an archive.
+   struct block
+   {
+      uint64_t m_offset {0}; ///< The offset of the sub-chunk's image data header in the file.
+      uint64_t m_frames {0}; ///< The number of frames in the sub-chunk.
+   };
+
+protected:
+
+   std::string m_path; ///< The path of the archive.
+
+   FILE * m_fp {nullptr}; ///< The open archive.
+
+   xrif_t m_xrif {nullptr};        ///< The image data handle.
+   xrif_t m_xrif_timing {nullptr}; ///< The timing data handle.
+
+   uint32_t m_width {0};    ///< The width of the images.
+   uint32_t m_height {0};   ///< The height of the images.
+   uint32_t m_depth {0};    ///< The depth of the images.
+   int m_typeCode {0};      ///< The xrif type code of the images.
+   size_t m_frameSize {0};  ///< The size of one frame, in bytes.
+
+   uint64_t m_frames {0};          ///< The number of frames in the archive.
+   uint64_t m_subChunkLength {0};  ///< The sub-chunk length, 0 for a plain archive.
+   uint64_t m_compressedSize {0};  ///< The total size of the compressed image data.
+
+   std::vector<block> m_blocks; ///< The sub-chunks, one for a plain archive.
+
+   long m_decoded {-1};         ///< The sub-chunk which is decoded in the handles, -1 if none.
+   bool m_imageDecoded {false}; ///< Whether the image data of m_decoded is decoded, or only its timing data.
+
+public:
+
+   /// D'tor, closes the archive.
+   ~xrifArchive();
+
+   /// Open an archive, and read its index.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with the message in errMsg
+     */
+   int open( std::string & errMsg,    ///< [out] the error message, if any
+             const std::string & path ///< [in] the path of the archive
+           );
+
+   /// Close the archive, and free the decoding buffers.
+   void close();
+
+   /// Get the path of the archive.
+   const std::string & path() const;
+
+   /// Get the width of the images.
+   uint32_t width() const;
+
+   /// Get the height of the images.
+   uint32_t height() const;
+
+   /// Get the depth of the images.
+   uint32_t depth() const;
+
+   /// Get the xrif type code of the images.
+   int typeCode() const;
+
+   /// Get the number of frames in the archive.
+   uint64_t frames() const;
+
+   /// Get the sub-chunk length, which is 0 for a plain archive.
+   uint64_t subChunkLength() const;
+
+   /// Get the total size of the compressed image data, in bytes.
+   uint64_t compressedSize() const;
+
+   /// Get the sub-chunks.
+   const std::vector<block> & blocks() const;
+
+   /// Read a range of frames.
+   /** Only the sub-chunks holding the frames are decoded.  The image buffer must hold count frames, and the timing
+     * buffer 5*count values: cnt0, atime sec, atime nsec, writetime sec, and writetime nsec of each frame.  If image is
+     * nullptr only the timing data is decoded.
+     *
+     * \returns 0 on success
+     * \returns -1 on error, with the message in errMsg
+     */
+   int read( std::string & errMsg, ///< [out] the error message, if any
+             char * image,         ///< [out] the image data, or nullptr
+             uint64_t * timing,    ///< [out] the timing data, or nullptr
+             uint64_t first,       ///< [in] the first frame
+             uint64_t count        ///< [in] the number of frames
+           );
+
+   /// Write the index of an archive of sub-chunks, after the last sub-chunk.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with errno set
+     */
+   static int writeIndex( FILE * fp,                         ///< [in] the archive, positioned after the last sub-chunk
+                          const std::vector<block> & blocks, ///< [in] the sub-chunks
+                          uint64_t subChunkLength            ///< [in] the sub-chunk length
+                        );
+
+protected:
+
+   /// Read the index of an archive of sub-chunks, if there is one.
+   /**
+     * \returns 0 on success, whether or not there is an index
+     * \returns -1 on error, with the message in errMsg
+     */
+   int readIndex( std::string & errMsg /**< [out] the error message, if any */);
+
+   /// Decode a sub-chunk into the handles.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with the message in errMsg
+     */
+   int decode( std::string & errMsg, ///< [out] the error message, if any
+               size_t b,             ///< [in] the sub-chunk
+               bool image            ///< [in] whether to decode the image data, or only the timing data
+             );
+};
+
+} //namespace sys
+} //namespace MagAOX
+
+#endif //sys_xrifArchive_hpp
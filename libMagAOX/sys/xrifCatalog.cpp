@@ -0,0 +1,459 @@
+/** \file xrifCatalog.cpp
+  * \brief A catalog of the xrif archives in a raw image directory.
+  *
+  * \ingroup sys_files
+  */
+
+#include "xrifCatalog.hpp"
+#include "xrifArchive.hpp"
+
+#include "../common/paths.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace MagAOX
+{
+namespace sys
+{
+
+namespace
+{
+
+/// The header line of the catalog file.
+const char * catalogHeader = "# file stream width height type frames cnt0First cnt0Last atimeFirst atimeLast compressedSize rawSize\n";
+
+/// Compare two times.
+bool tsLess( const timespec & a,
+             const timespec & b
+           )
+{
+   return (a.tv_sec < b.tv_sec) || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+/// Format a time as sec.nsec
+std::string tsString( const timespec & ts )
+{
+   char str[64];
+   snprintf(str, sizeof(str), "%lld.%09ld", static_cast<long long>(ts.tv_sec), static_cast<long>(ts.tv_nsec));
+   return str;
+}
+
+/// Parse a time formatted by tsString
+int tsParse( timespec & ts,
+             const std::string & str
+           )
+{
+   long long sec;
+   long nsec;
+   if(sscanf(str.c_str(), "%lld.%ld", &sec, &nsec) != 2) return -1;
+
+   ts.tv_sec = sec;
+   ts.tv_nsec = nsec;
+
+   return 0;
+}
+
+/// Get the name of the stream from the name of an archive, which is the stream name followed by _ and the timestamp.
+std::string streamName( const std::string & file )
+{
+   size_t p = file.rfind('_');
+   if(p == std::string::npos) return file;
+   return file.substr(0, p);
+}
+
+}
+
+void xrifCatalogEntry::timing( const uint64_t * timing,
+                               uint64_t frames
+                             )
+{
+   m_frames = frames;
+
+   if(frames == 0) return;
+
+   m_cnt0First = timing[0];
+   m_cnt0Last = timing[0];
+   m_atimeFirst = {static_cast<time_t>(timing[1]), static_cast<long>(timing[2])};
+   m_atimeLast = m_atimeFirst;
+
+   for(uint64_t n = 1; n < frames; ++n)
+   {
+      const uint64_t * t = timing + 5*n;
+
+      if(t[0] < m_cnt0First) m_cnt0First = t[0];
+      if(t[0] > m_cnt0Last) m_cnt0Last = t[0];
+
+      timespec atime = {static_cast<time_t>(t[1]), static_cast<long>(t[2])};
+      if(tsLess(atime, m_atimeFirst)) m_atimeFirst = atime;
+      if(tsLess(m_atimeLast, atime)) m_atimeLast = atime;
+   }
+}
+
+uint64_t xrifCatalogEntry::dropped() const
+{
+   if(m_frames == 0) return 0;
+
+   uint64_t span = m_cnt0Last - m_cnt0First + 1;
+   if(span <= m_frames) return 0;
+
+   return span - m_frames;
+}
+
+double xrifCatalogEntry::ratio() const
+{
+   if(m_rawSize == 0) return 0;
+
+   return static_cast<double>(m_compressedSize)/m_rawSize;
+}
+
+std::string xrifCatalogEntry::line() const
+{
+   std::ostringstream oss;
+
+   oss << m_file << ' ' << m_stream << ' ' << m_width << ' ' << m_height << ' ' << m_typeCode << ' ' << m_frames << ' ';
+   oss << m_cnt0First << ' ' << m_cnt0Last << ' ' << tsString(m_atimeFirst) << ' ' << tsString(m_atimeLast) << ' ';
+   oss << m_compressedSize << ' ' << m_rawSize;
+
+   return oss.str();
+}
+
+int xrifCatalogEntry::parse( const std::string & line )
+{
+   if(line.size() == 0 || line[0] == '#') return -1;
+
+   std::istringstream iss(line);
+
+   std::string atimeFirst, atimeLast;
+
+   iss >> m_file >> m_stream >> m_width >> m_height >> m_typeCode >> m_frames >> m_cnt0First >> m_cnt0Last;
+   iss >> atimeFirst >> atimeLast >> m_compressedSize >> m_rawSize;
+
+   if(iss.fail()) return -1;
+
+   if(tsParse(m_atimeFirst, atimeFirst) < 0) return -1;
+   if(tsParse(m_atimeLast, atimeLast) < 0) return -1;
+
+   return 0;
+}
+
+std::string xrifCatalog::catalogPath( const std::string & dir )
+{
+   if(dir.size() > 0 && dir.back() == '/') return dir + MAGAOX_xrifCatalogName;
+
+   return dir + "/" + MAGAOX_xrifCatalogName;
+}
+
+int xrifCatalog::append( const std::string & dir,
+                         const xrifCatalogEntry & entry
+                       )
+{
+   int fd = open(catalogPath(dir).c_str(), O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+   if(fd < 0) return -1;
+
+   std::string out;
+
+   struct stat st;
+   if(fstat(fd, &st) == 0 && st.st_size == 0) out = catalogHeader;
+
+   out += entry.line() + "\n";
+
+   ssize_t nw = write(fd, out.data(), out.size());
+
+   int en = errno;
+   close(fd);
+
+   if(nw != static_cast<ssize_t>(out.size()))
+   {
+      errno = (nw < 0) ? en : EIO;
+      return -1;
+   }
+
+   return 0;
+}
+
+int xrifCatalog::scan( xrifCatalogEntry & entry,
+                       std::string & errMsg,
+                       const std::string & path
+                     )
+{
+   entry = xrifCatalogEntry();
+
+   size_t p = path.rfind('/');
+   entry.m_file = (p == std::string::npos) ? path : path.substr(p+1);
+   entry.m_stream = streamName(entry.m_file.substr(0, entry.m_file.rfind('.')));
+
+   xrifArchive archive;
+   if(archive.open(errMsg, path) < 0) return -1;
+
+   entry.m_width = archive.width();
+   entry.m_height = archive.height();
+   entry.m_typeCode = archive.typeCode();
+   entry.m_compressedSize = archive.compressedSize();
+   entry.m_rawSize = archive.frames()*archive.width()*archive.height()*xrif_typesize(archive.typeCode());
+
+   //Only the timing data is decoded
+   std::vector<uint64_t> timing(5*archive.frames());
+   if(archive.read(errMsg, nullptr, timing.data(), 0, archive.frames()) < 0) return -1;
+
+   entry.timing(timing.data(), archive.frames());
+
+   return 0;
+}
+
+int xrifCatalog::parseTime( timespec & ts,
+                            const std::string & str
+                          )
+{
+   tm bt;
+   memset(&bt, 0, sizeof(bt));
+
+   double sec = 0;
+   int nc = 0;
+
+   if(sscanf(str.c_str(), "%4d-%2d-%2dT%2d:%2d:%lf%n", &bt.tm_year, &bt.tm_mon, &bt.tm_mday, &bt.tm_hour, &bt.tm_min, &sec, &nc) == 6)
+   {
+      if(static_cast<size_t>(nc) != str.size()) return -1;
+   }
+   else if(sscanf(str.c_str(), "%4d%2d%2d%2d%2d%2lf%n", &bt.tm_year, &bt.tm_mon, &bt.tm_mday, &bt.tm_hour, &bt.tm_min, &sec, &nc) == 6)
+   {
+      if(static_cast<size_t>(nc) != str.size()) return -1;
+   }
+   else
+   {
+      return -1;
+   }
+
+   if(bt.tm_mon < 1 || bt.tm_mon > 12 || bt.tm_mday < 1 || bt.tm_mday > 31 || sec < 0 || sec >= 61) return -1;
+
+   bt.tm_year -= 1900;
+   bt.tm_mon -= 1;
+   bt.tm_sec = static_cast<int>(sec);
+
+   ts.tv_sec = timegm(&bt);
+   ts.tv_nsec = static_cast<long>((sec - bt.tm_sec)*1e9 + 0.5);
+   if(ts.tv_nsec > 999999999) ts.tv_nsec = 999999999;
+
+   return 0;
+}
+
+int xrifCatalog::load( const std::string & dir )
+{
+   m_dir = dir;
+   if(m_dir.size() > 1 && m_dir.back() == '/') m_dir.erase(m_dir.size()-1);
+
+   m_entries.clear();
+   m_added = 0;
+
+   std::ifstream fin(catalogPath(m_dir));
+   if(!fin.good()) return -1;
+
+   std::string line;
+   while(std::getline(fin, line))
+   {
+      xrifCatalogEntry entry;
+      if(entry.parse(line) < 0) continue;
+
+      if(access(filePath(entry.m_file).c_str(), F_OK) != 0) continue;
+
+      m_entries.push_back(entry);
+   }
+
+   sort();
+
+   return 0;
+}
+
+int xrifCatalog::rebuild( std::vector<std::string> & errMsgs,
+                          const std::string & dir,
+                          bool update
+                        )
+{
+   errMsgs.clear();
+   m_added = 0;
+
+   if(!update || load(dir) < 0)
+   {
+      m_dir = dir;
+      if(m_dir.size() > 1 && m_dir.back() == '/') m_dir.erase(m_dir.size()-1);
+      m_entries.clear();
+   }
+
+   std::set<std::string> known;
+   for(size_t n = 0; n < m_entries.size(); ++n) known.insert(m_entries[n].m_file);
+
+   DIR * d = opendir(m_dir.c_str());
+   if(d == nullptr)
+   {
+      errMsgs.push_back("error opening " + m_dir + ": " + strerror(errno));
+      return 1;
+   }
+
+   std::vector<std::string> files;
+
+   dirent * de;
+   while((de = readdir(d)) != nullptr)
+   {
+      std::string name = de->d_name;
+      if(name.size() < 6 || name.compare(name.size()-5, 5, ".xrif") != 0) continue;
+      if(known.count(name) > 0) continue;
+
+      files.push_back(name);
+   }
+
+   closedir(d);
+
+   std::sort(files.begin(), files.end());
+
+   int nerr = 0;
+   for(size_t n = 0; n < files.size(); ++n)
+   {
+      xrifCatalogEntry entry;
+      std::string errMsg;
+
+      if(scan(entry, errMsg, filePath(files[n])) < 0)
+      {
+         errMsgs.push_back(errMsg);
+         ++nerr;
+         continue;
+      }
+
+      m_entries.push_back(entry);
+      ++m_added;
+   }
+
+   sort();
+
+   return nerr;
+}
+
+int xrifCatalog::save()
+{
+   std::string fname = catalogPath(m_dir);
+   std::string tmpName = fname + ".tmp." + std::to_string(getpid());
+
+   FILE * fp = fopen(tmpName.c_str(), "w");
+   if(fp == nullptr) return -1;
+
+   fputs(catalogHeader, fp);
+
+   for(size_t n = 0; n < m_entries.size(); ++n)
+   {
+      fputs(m_entries[n].line().c_str(), fp);
+      fputc('\n', fp);
+   }
+
+   if(ferror(fp))
+   {
+      int en = errno;
+      fclose(fp);
+      unlink(tmpName.c_str());
+      errno = en;
+      return -1;
+   }
+
+   if(fclose(fp) != 0)
+   {
+      int en = errno;
+      unlink(tmpName.c_str());
+      errno = en;
+      return -1;
+   }
+
+   if(rename(tmpName.c_str(), fname.c_str()) != 0)
+   {
+      int en = errno;
+      unlink(tmpName.c_str());
+      errno = en;
+      return -1;
+   }
+
+   return 0;
+}
+
+const std::string & xrifCatalog::dir() const
+{
+   return m_dir;
+}
+
+const std::vector<xrifCatalogEntry> & xrifCatalog::entries() const
+{
+   return m_entries;
+}
+
+size_t xrifCatalog::added() const
+{
+   return m_added;
+}
+
+std::vector<size_t> xrifCatalog::select( const std::string & stream,
+                                         uint64_t cnt0First,
+                                         uint64_t cnt0Last,
+                                         const timespec & start,
+                                         const timespec & end
+                                       ) const
+{
+   std::vector<size_t> idx;
+
+   for(size_t n = 0; n < m_entries.size(); ++n)
+   {
+      const xrifCatalogEntry & e = m_entries[n];
+
+      if(stream != "" && e.m_stream != stream) continue;
+      if(e.m_frames == 0) continue;
+
+      if(e.m_cnt0Last < cnt0First || e.m_cnt0First > cnt0Last) continue;
+      if(tsLess(e.m_atimeLast, start) || tsLess(end, e.m_atimeFirst)) continue;
+
+      idx.push_back(n);
+   }
+
+   return idx;
+}
+
+std::string xrifCatalog::path( size_t n ) const
+{
+   return filePath(m_entries[n].m_file);
+}
+
+std::string xrifCatalog::filePath( const std::string & file ) const
+{
+   if(m_dir == "/") return m_dir + file;
+
+   return m_dir + "/" + file;
+}
+
+void xrifCatalog::sort()
+{
+   //Keep the last of each file
+   std::set<std::string> seen;
+   std::vector<xrifCatalogEntry> entries;
+
+   for(size_t n = m_entries.size(); n > 0; --n)
+   {
+      if(seen.insert(m_entries[n-1].m_file).second) entries.push_back(m_entries[n-1]);
+   }
+
+   std::sort(entries.begin(), entries.end(), [](const xrifCatalogEntry & a, const xrifCatalogEntry & b)
+                                             {
+                                                if(a.m_stream != b.m_stream) return a.m_stream < b.m_stream;
+                                                if(tsLess(a.m_atimeFirst, b.m_atimeFirst)) return true;
+                                                if(tsLess(b.m_atimeFirst, a.m_atimeFirst)) return false;
+                                                return a.m_file < b.m_file;
+                                             });
+
+   m_entries.swap(entries);
+}
+
+} //namespace sys
+} //namespace MagAOX
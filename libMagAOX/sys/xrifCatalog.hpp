@@ -0,0 +1,189 @@
+/** \file xrifCatalog.hpp
+  * \brief A catalog of the xrif archives in a raw image directory.
+  *
+  * \ingroup sys_files
+  */
+
+#ifndef sys_xrifCatalog_hpp
+#define sys_xrifCatalog_hpp
+
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace MagAOX
+{
+namespace sys
+{
+
+/// The catalog entry of one xrif archive.
+/** The frame numbers and acquisition times are the ranges over the frames in the archive.
+  *
+  * \ingroup sys
+  */
+struct xrifCatalogEntry
+{
+   std::string m_file;   ///< The archive file name, without the directory.
+   std::string m_stream; ///< The name of the stream which was written.
+
+   uint32_t m_width {0};  ///< The width of the images.
+   uint32_t m_height {0}; ///< The height of the images.
+   int m_typeCode {0};    ///< The xrif type code of the images.
+
+   uint64_t m_frames {0};    ///< The number of frames in the archive.
+   uint64_t m_cnt0First {0}; ///< The lowest frame number.
+   uint64_t m_cnt0Last {0};  ///< The highest frame number.
+
+   timespec m_atimeFirst {0,0}; ///< The earliest acquisition time.
+   timespec m_atimeLast {0,0};  ///< The latest acquisition time.
+
+   uint64_t m_compressedSize {0}; ///< The size of the compressed image data, in bytes.
+   uint64_t m_rawSize {0};        ///< The size of the uncompressed image data, in bytes.
+
+   /// Set the frame number and acquisition time ranges from the timing data of the archive.
+   /** The timing data has 5 values per frame: cnt0, atime sec, atime nsec, writetime sec, and writetime nsec.
+     */
+   void timing( const uint64_t * timing, ///< [in] the timing data
+                uint64_t frames          ///< [in] the number of frames
+              );
+
+   /// Get the number of frames missing from the archive, judged by the range of frame numbers.
+   uint64_t dropped() const;
+
+   /// Get the compression ratio of the image data, compressed over uncompressed size.
+   double ratio() const;
+
+   /// Format the entry as a line of the catalog file, without the newline.
+   std::string line() const;
+
+   /// Parse a line of the catalog file.
+   /**
+     * \returns 0 on success
+     * \returns -1 if the line is not an entry, e.g. a comment
+     */
+   int parse( const std::string & line /**< [in] the line */);
+};
+
+/// A catalog of the xrif archives in a raw image directory.
+/** The catalog maps each archive to its stream, frame number range, and acquisition time range, with file level
+  * statistics, so that utilities can find the archives holding a set of frames without opening every archive.
+  *
+  * The catalog is a text file named MAGAOX_xrifCatalogName in the directory, with one line per archive.  The
+  * streamWriter appends a line as it closes each archive, with append(), and the catalog can be rebuilt from the
+  * archives with rebuild().  When an archive appears more than once the last line wins, and entries for archives which
+  * no longer exist are dropped on load.
+  *
+  * \ingroup sys
+  */
+class xrifCatalog
+{
+protected:
+
+   std::string m_dir; ///< The directory, without a trailing /.
+
+   std::vector<xrifCatalogEntry> m_entries; ///< The entries, sorted by stream and then acquisition time.
+
+   size_t m_added {0}; ///< The number of archives added by the last rebuild().
+
+public:
+
+   /// Get the path of the catalog file of a directory.
+   static std::string catalogPath( const std::string & dir /**< [in] the directory */);
+
+   /// Append an entry to the catalog file of a directory, creating it if needed.
+   /** The entry is written with a single write to a file opened for appending, so several writers can share a
+     * directory.
+     *
+     * \returns 0 on success
+     * \returns -1 on error, with errno set
+     */
+   static int append( const std::string & dir,        ///< [in] the directory
+                      const xrifCatalogEntry & entry  ///< [in] the entry
+                    );
+
+   /// Read the headers and timing data of an archive to make its entry.
+   /** The image data is skipped, only the timing data is decoded.  Archives of sub-chunks are supported, see
+     * xrifArchive.
+     *
+     * \returns 0 on success
+     * \returns -1 on error, with the message in errMsg
+     */
+   static int scan( xrifCatalogEntry & entry, ///< [out] the entry
+                    std::string & errMsg,     ///< [out] the error message, if any
+                    const std::string & path  ///< [in] the path of the archive
+                  );
+
+   /// Parse a UT time, as YYYY-MM-DDTHH:MM:SS with optional fractional seconds, or as YYYYMMDDHHMMSS.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   static int parseTime( timespec & ts,             ///< [out] the time
+                         const std::string & str    ///< [in] the string
+                       );
+
+   /// Load the catalog of a directory.
+   /**
+     * \returns 0 on success
+     * \returns -1 if there is no catalog file
+     */
+   int load( const std::string & dir /**< [in] the directory */);
+
+   /// Rebuild the catalog of a directory from its archives.
+   /** With update, only the archives which are not in the existing catalog are scanned.  The catalog file is not
+     * written, see save().
+     *
+     * \returns the number of archives which could not be scanned, with their errors in errMsgs
+     */
+   int rebuild( std::vector<std::string> & errMsgs, ///< [out] the errors, one per archive
+                const std::string & dir,            ///< [in] the directory
+                bool update = false                 ///< [in] [optional] if true, keep the existing entries
+              );
+
+   /// Write the catalog file, replacing the existing one.
+   /** The file is written to a temporary file which is then renamed, so readers never see a partial catalog.
+     *
+     * \returns 0 on success
+     * \returns -1 on error, with errno set
+     */
+   int save();
+
+   /// Get the directory of the catalog.
+   const std::string & dir() const;
+
+   /// Get the entries.
+   const std::vector<xrifCatalogEntry> & entries() const;
+
+   /// Get the number of archives added by the last rebuild(), which are not in the catalog file until save().
+   size_t added() const;
+
+   /// Select the archives which hold frames in a range of frame numbers and acquisition times.
+   /** An archive is selected if its ranges overlap all of the ranges given.
+     *
+     * \returns the indices of the selected entries, in catalog order
+     */
+   std::vector<size_t> select( const std::string & stream,                                          ///< [in] the stream, or empty for all streams
+                               uint64_t cnt0First = 0,                                              ///< [in] [optional] the lowest frame number
+                               uint64_t cnt0Last = std::numeric_limits<uint64_t>::max(),            ///< [in] [optional] the highest frame number
+                               const timespec & start = {0,0},                                      ///< [in] [optional] the earliest acquisition time
+                               const timespec & end = {std::numeric_limits<time_t>::max(), 0}       ///< [in] [optional] the latest acquisition time
+                             ) const;
+
+   /// Get the full path of the archive of an entry.
+   std::string path( size_t n /**< [in] the index of the entry */) const;
+
+protected:
+
+   /// Get the full path of a file in the directory.
+   std::string filePath( const std::string & file /**< [in] the file name */) const;
+
+   /// Sort the entries, and remove duplicates keeping the last.
+   void sort();
+};
+
+} //namespace sys
+} //namespace MagAOX
+
+#endif //sys_xrifCatalog_hpp
@@ -0,0 +1,297 @@
+/** \file xrifChunkEncoder.cpp
+  * \brief Encodes a chunk of frames into an xrif archive in memory.
+  *
+  * \ingroup sys_files
+  */
+
+#include "xrifChunkEncoder.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+namespace MagAOX
+{
+namespace sys
+{
+
+namespace
+{
+
+double monotonic()
+{
+   timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/// Append a header and data to the archive.
+void append( std::vector<char> & archive,
+             const char * header,
+             const char * data,
+             size_t size
+           )
+{
+   archive.insert(archive.end(), header, header + XRIF_HEADER_SIZE);
+   archive.insert(archive.end(), data, data + size);
+}
+
+}
+
+xrifChunkEncoder::~xrifChunkEncoder()
+{
+   free();
+}
+
+int xrifChunkEncoder::allocate( std::string & errMsg,
+                                uint32_t width,
+                                uint32_t height,
+                                int typeCode,
+                                uint64_t maxFrames
+                              )
+{
+   free();
+
+   if(xrif_new(&m_xrif) != XRIF_NOERROR || xrif_new(&m_xrif_timing) != XRIF_NOERROR)
+   {
+      errMsg = "error allocating xrif handles";
+      free();
+      return -1;
+   }
+
+   if( xrif_configure(m_xrif, XRIF_DIFFERENCE_PREVIOUS, XRIF_REORDER_BYTEPACK, XRIF_COMPRESS_LZ4) != XRIF_NOERROR ||
+       xrif_set_size(m_xrif, width, height, 1, maxFrames, typeCode) != XRIF_NOERROR ||
+       xrif_allocate_raw(m_xrif) != XRIF_NOERROR ||
+       xrif_allocate_reordered(m_xrif) != XRIF_NOERROR )
+   {
+      errMsg = "error configuring the xrif image handle";
+      free();
+      return -1;
+   }
+
+   if( xrif_configure(m_xrif_timing, XRIF_DIFFERENCE_NONE, XRIF_REORDER_NONE, XRIF_COMPRESS_NONE) != XRIF_NOERROR ||
+       xrif_set_size(m_xrif_timing, 5, 1, 1, maxFrames, XRIF_TYPECODE_UINT64) != XRIF_NOERROR ||
+       xrif_allocate_raw(m_xrif_timing) != XRIF_NOERROR ||
+       xrif_allocate_reordered(m_xrif_timing) != XRIF_NOERROR )
+   {
+      errMsg = "error configuring the xrif timing handle";
+      free();
+      return -1;
+   }
+
+   m_width = width;
+   m_height = height;
+   m_typeCode = typeCode;
+   m_frameSize = static_cast<size_t>(width)*height*xrif_typesize(typeCode);
+   m_maxFrames = maxFrames;
+
+   //Room for the whole chunk uncompressed, so encoding normally does not allocate.
+   m_archive.reserve(maxFrames*(m_frameSize + 5*sizeof(uint64_t)) + 4*XRIF_HEADER_SIZE);
+
+   return 0;
+}
+
+void xrifChunkEncoder::free()
+{
+   if(m_xrif) xrif_delete(m_xrif);
+   m_xrif = nullptr;
+
+   if(m_xrif_timing) xrif_delete(m_xrif_timing);
+   m_xrif_timing = nullptr;
+
+   m_archive.clear();
+   m_blocks.clear();
+
+   m_maxFrames = 0;
+   m_frames = 0;
+   m_compressedSize = 0;
+   m_encodeTime = 0;
+}
+
+bool xrifChunkEncoder::allocated() const
+{
+   return (m_xrif != nullptr);
+}
+
+int xrifChunkEncoder::encode( std::string & errMsg,
+                              const char * images,
+                              const uint64_t * timing,
+                              uint64_t frames,
+                              int lz4accel,
+                              uint64_t subChunkLength
+                            )
+{
+   if(!allocated())
+   {
+      errMsg = "xrif encoder not allocated";
+      return -1;
+   }
+
+   if(frames == 0 || frames > m_maxFrames)
+   {
+      errMsg = "invalid number of frames: " + std::to_string(frames);
+      return -1;
+   }
+
+   double t0 = monotonic();
+
+   m_archive.clear();
+   m_blocks.clear();
+   m_frames = frames;
+   m_compressedSize = 0;
+
+   uint64_t blockLength = frames;
+   if(subChunkLength > 0 && subChunkLength < frames) blockLength = subChunkLength;
+
+   for(uint64_t b0 = 0; b0 < frames; b0 += blockLength)
+   {
+      xrifArchive::block blk;
+      blk.m_offset = m_archive.size();
+      blk.m_frames = std::min(blockLength, frames - b0);
+
+      if(encodeBlock(errMsg, images + b0*m_frameSize, timing + b0*5, blk.m_frames, lz4accel) < 0) return -1;
+
+      m_blocks.push_back(blk);
+   }
+
+   //Without sub-chunks the archive is a plain archive, with no index.
+   if(subChunkLength == 0) m_blocks.clear();
+   m_subChunkLength = subChunkLength;
+
+   m_encodeTime = monotonic() - t0;
+
+   return 0;
+}
+
+int xrifChunkEncoder::write( FILE * fp ) const
+{
+   if(fwrite(m_archive.data(), 1, m_archive.size(), fp) != m_archive.size()) return -1;
+
+   if(m_blocks.size() > 0)
+   {
+      if(xrifArchive::writeIndex(fp, m_blocks, m_subChunkLength) < 0) return -1;
+   }
+
+   return 0;
+}
+
+uint64_t xrifChunkEncoder::size() const
+{
+   uint64_t sz = m_archive.size();
+
+   //The index: the blocks, then the number of blocks, the sub-chunk length, and the magic.
+   if(m_blocks.size() > 0) sz += m_blocks.size()*2*sizeof(uint64_t) + 2*sizeof(uint64_t) + 8;
+
+   return sz;
+}
+
+uint64_t xrifChunkEncoder::frames() const
+{
+   return m_frames;
+}
+
+uint64_t xrifChunkEncoder::compressedSize() const
+{
+   return m_compressedSize;
+}
+
+uint64_t xrifChunkEncoder::rawSize() const
+{
+   return m_frames*m_frameSize;
+}
+
+double xrifChunkEncoder::ratio() const
+{
+   if(rawSize() == 0) return 0;
+   return ((double) m_compressedSize)/rawSize();
+}
+
+double xrifChunkEncoder::encodeRate() const
+{
+   if(m_encodeTime <= 0) return 0;
+   return rawSize()/m_encodeTime;
+}
+
+double xrifChunkEncoder::differenceRate() const
+{
+   if(!m_xrif) return 0;
+   return m_xrif->difference_rate;
+}
+
+double xrifChunkEncoder::reorderRate() const
+{
+   if(!m_xrif) return 0;
+   return m_xrif->reorder_rate;
+}
+
+double xrifChunkEncoder::compressRate() const
+{
+   if(!m_xrif) return 0;
+   return m_xrif->compress_rate;
+}
+
+int xrifChunkEncoder::encodeBlock( std::string & errMsg,
+                                   const char * images,
+                                   const uint64_t * timing,
+                                   uint64_t frames,
+                                   int lz4accel
+                                 )
+{
+   char header[XRIF_HEADER_SIZE];
+
+   //Configure xrif and copy image data -- this does no allocations
+   if(xrif_set_size(m_xrif, m_width, m_height, 1, frames, m_typeCode) != XRIF_NOERROR)
+   {
+      errMsg = "xrif set size error";
+      return -1;
+   }
+
+   //This may just be out of range, in which case the last acceleration is used.
+   xrif_set_lz4_acceleration(m_xrif, lz4accel);
+
+   memcpy(m_xrif->raw_buffer, images, frames*m_frameSize);
+
+   if(xrif_encode(m_xrif) != XRIF_NOERROR)
+   {
+      errMsg = "xrif encode error";
+      return -1;
+   }
+
+   if(xrif_write_header(header, m_xrif) != XRIF_NOERROR)
+   {
+      errMsg = "xrif write header error";
+      return -1;
+   }
+
+   append(m_archive, header, m_xrif->raw_buffer, m_xrif->compressed_size);
+   m_compressedSize += m_xrif->compressed_size;
+
+   //Configure xrif and copy timing data -- no allocations
+   if(xrif_set_size(m_xrif_timing, 5, 1, 1, frames, XRIF_TYPECODE_UINT64) != XRIF_NOERROR)
+   {
+      errMsg = "xrif set size error for timing";
+      return -1;
+   }
+
+   memcpy(m_xrif_timing->raw_buffer, timing, frames*5*sizeof(uint64_t));
+
+   if(xrif_encode(m_xrif_timing) != XRIF_NOERROR)
+   {
+      errMsg = "xrif encode error for timing";
+      return -1;
+   }
+
+   if(xrif_write_header(header, m_xrif_timing) != XRIF_NOERROR)
+   {
+      errMsg = "xrif write header error for timing";
+      return -1;
+   }
+
+   append(m_archive, header, m_xrif_timing->raw_buffer, m_xrif_timing->compressed_size);
+
+   return 0;
+}
+
+} //namespace sys
+} //namespace MagAOX
@@ -0,0 +1,145 @@
+/** \file xrifChunkEncoder.hpp
+  * \brief Encodes a chunk of frames into an xrif archive in memory.
+  *
+  * \ingroup sys_files
+  */
+
+#ifndef sys_xrifChunkEncoder_hpp
+#define sys_xrifChunkEncoder_hpp
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <xrif/xrif.h>
+
+#include "xrifArchive.hpp"
+
+namespace MagAOX
+{
+namespace sys
+{
+
+/// Encodes a chunk of frames into an xrif archive in memory, to be written later.
+/** The whole archive, including the index of an archive of sub-chunks, is encoded before the file is opened, so that
+  * writing it is a single copy.  This lets the encoding be done by any thread, and the writing be scheduled separately,
+  * e.g. by a writeScheduler, without holding a disk while compressing.
+  *
+  * Each encoder owns its own xrif handles and buffers, so several encoders can work at once on different chunks.
+  * Both streamWriter and multiStreamWriter encode with it, so their archives are the same.  See xrifArchive for the format.
+  *
+  * \ingroup sys
+  */
+class xrifChunkEncoder
+{
+protected:
+
+   xrif_t m_xrif {nullptr};        ///< The image data handle.
+   xrif_t m_xrif_timing {nullptr}; ///< The timing data handle.
+
+   uint32_t m_width {0};      ///< The width of the images.
+   uint32_t m_height {0};     ///< The height of the images.
+   int m_typeCode {0};        ///< The xrif type code of the images.
+   size_t m_frameSize {0};    ///< The size of one image, in bytes.
+   uint64_t m_maxFrames {0};  ///< The maximum number of frames in a chunk.
+
+   std::vector<char> m_archive;            ///< The encoded archive, without the index.
+   std::vector<xrifArchive::block> m_blocks; ///< The sub-chunks, if the last chunk was encoded as sub-chunks.
+   uint64_t m_subChunkLength {0};          ///< The sub-chunk length of the last chunk, for the index.
+
+   uint64_t m_frames {0};         ///< The number of frames in the last chunk.
+   uint64_t m_compressedSize {0}; ///< The size of the compressed image data of the last chunk.
+   double m_encodeTime {0};       ///< The time taken to encode the last chunk, in seconds.
+
+public:
+
+   /// D'tor.  Frees the xrif handles.
+   ~xrifChunkEncoder();
+
+   /// Allocate the xrif handles and buffers for chunks of up to maxFrames frames.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with the message in errMsg
+     */
+   int allocate( std::string & errMsg, ///< [out] the error message, if any
+                 uint32_t width,       ///< [in] the width of the images
+                 uint32_t height,      ///< [in] the height of the images
+                 int typeCode,         ///< [in] the xrif type code of the images
+                 uint64_t maxFrames    ///< [in] the maximum number of frames in a chunk
+               );
+
+   /// Free the xrif handles and buffers.
+   void free();
+
+   /// Check if the encoder is allocated.
+   bool allocated() const;
+
+   /// Encode a chunk.
+   /** If subChunkLength is more than 0 the chunk is encoded as an archive of sub-chunks, each compressed on its own,
+     * followed by the index.
+     *
+     * \returns 0 on success
+     * \returns -1 on error, with the message in errMsg
+     */
+   int encode( std::string & errMsg,     ///< [out] the error message, if any
+               const char * images,      ///< [in] the images, frames*width*height pixels
+               const uint64_t * timing,  ///< [in] the timing data, 5 values per frame
+               uint64_t frames,          ///< [in] the number of frames, at most maxFrames
+               int lz4accel,             ///< [in] the LZ4 acceleration
+               uint64_t subChunkLength   ///< [in] the sub-chunk length, or 0 to encode the chunk as one block
+             );
+
+   /// Write the encoded archive to an open file.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with errno set
+     */
+   int write( FILE * fp /**< [in] the open file */) const;
+
+   /// Get the size of the archive which write() writes, in bytes.
+   uint64_t size() const;
+
+   /// Get the number of frames in the last chunk.
+   uint64_t frames() const;
+
+   /// Get the size of the compressed image data of the last chunk, in bytes.
+   uint64_t compressedSize() const;
+
+   /// Get the size of the raw image data of the last chunk, in bytes.
+   uint64_t rawSize() const;
+
+   /// Get the compression ratio of the image data of the last chunk.
+   double ratio() const;
+
+   /// Get the rate at which the last chunk was encoded, in raw bytes per second.
+   double encodeRate() const;
+
+   /// Get the rate of the differencing step of the last image block encoded, in bytes per second.
+   double differenceRate() const;
+
+   /// Get the rate of the reordering step of the last image block encoded, in bytes per second.
+   double reorderRate() const;
+
+   /// Get the rate of the compression step of the last image block encoded, in bytes per second.
+   double compressRate() const;
+
+protected:
+
+   /// Encode one block, and append it to the archive.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with the message in errMsg
+     */
+   int encodeBlock( std::string & errMsg,    ///< [out] the error message, if any
+                    const char * images,     ///< [in] the first image of the block
+                    const uint64_t * timing, ///< [in] the timing data of the first frame of the block
+                    uint64_t frames,         ///< [in] the number of frames in the block
+                    int lz4accel             ///< [in] the LZ4 acceleration
+                  );
+};
+
+} //namespace sys
+} //namespace MagAOX
+
+#endif //sys_xrifChunkEncoder_hpp
@@ -0,0 +1,322 @@
+/** \file xrifPreview.cpp
+  * \brief Preview images and statistics of a chunk of frames, written as a sidecar to an xrif archive.
+  *
+  * \ingroup sys_files
+  */
+
+#include "xrifPreview.hpp"
+
+#include <cstdio>
+#include <limits>
+
+#include <xrif/xrif.h>
+#include <fitsio.h>
+
+namespace MagAOX
+{
+namespace sys
+{
+
+std::string xrifPreview::sidecarPath( const std::string & archivePath )
+{
+   std::string ext = ".xrif";
+
+   if(archivePath.size() >= ext.size() && archivePath.compare(archivePath.size()-ext.size(), ext.size(), ext) == 0)
+   {
+      return archivePath.substr(0, archivePath.size()-ext.size()) + ".preview.fits";
+   }
+
+   return archivePath + ".preview.fits";
+}
+
+double xrifPreview::defaultSatLevel( int typeCode )
+{
+   switch(typeCode)
+   {
+      case XRIF_TYPECODE_UINT8:
+         return std::numeric_limits<uint8_t>::max();
+      case XRIF_TYPECODE_INT8:
+         return std::numeric_limits<int8_t>::max();
+      case XRIF_TYPECODE_UINT16:
+         return std::numeric_limits<uint16_t>::max();
+      case XRIF_TYPECODE_INT16:
+         return std::numeric_limits<int16_t>::max();
+      case XRIF_TYPECODE_UINT32:
+         return std::numeric_limits<uint32_t>::max();
+      case XRIF_TYPECODE_INT32:
+         return std::numeric_limits<int32_t>::max();
+      case XRIF_TYPECODE_UINT64:
+         return static_cast<double>(std::numeric_limits<uint64_t>::max());
+      case XRIF_TYPECODE_INT64:
+         return static_cast<double>(std::numeric_limits<int64_t>::max());
+      default:
+         return std::numeric_limits<double>::infinity();
+   }
+}
+
+int xrifPreview::compute( const char * image,
+                          const uint64_t * timing,
+                          uint32_t width,
+                          uint32_t height,
+                          int typeCode,
+                          uint64_t frames,
+                          uint32_t bin,
+                          double satLevel
+                        )
+{
+   if(frames == 0 || width == 0 || height == 0) return -1;
+
+   m_width = width;
+   m_height = height;
+   m_typeCode = typeCode;
+   m_bin = (bin < 1) ? 1 : bin;
+   m_satLevel = satLevel;
+
+   m_mean.assign(static_cast<size_t>(width)*height, 0);
+
+   m_cnt0.resize(frames);
+   m_atime.resize(frames);
+   m_flux.resize(frames);
+   m_min.resize(frames);
+   m_max.resize(frames);
+   m_nsat.resize(frames);
+
+   switch(typeCode)
+   {
+      case XRIF_TYPECODE_UINT8:
+         accumulate(reinterpret_cast<const uint8_t *>(image), frames);
+         break;
+      case XRIF_TYPECODE_INT8:
+         accumulate(reinterpret_cast<const int8_t *>(image), frames);
+         break;
+      case XRIF_TYPECODE_UINT16:
+         accumulate(reinterpret_cast<const uint16_t *>(image), frames);
+         break;
+      case XRIF_TYPECODE_INT16:
+         accumulate(reinterpret_cast<const int16_t *>(image), frames);
+         break;
+      case XRIF_TYPECODE_UINT32:
+         accumulate(reinterpret_cast<const uint32_t *>(image), frames);
+         break;
+      case XRIF_TYPECODE_INT32:
+         accumulate(reinterpret_cast<const int32_t *>(image), frames);
+         break;
+      case XRIF_TYPECODE_UINT64:
+         accumulate(reinterpret_cast<const uint64_t *>(image), frames);
+         break;
+      case XRIF_TYPECODE_INT64:
+         accumulate(reinterpret_cast<const int64_t *>(image), frames);
+         break;
+      case XRIF_TYPECODE_FLOAT:
+         accumulate(reinterpret_cast<const float *>(image), frames);
+         break;
+      case XRIF_TYPECODE_DOUBLE:
+         accumulate(reinterpret_cast<const double *>(image), frames);
+         break;
+      default:
+         m_cnt0.clear();
+         m_mean.clear();
+         return -1;
+   }
+
+   for(uint64_t p = 0; p < frames; ++p)
+   {
+      m_cnt0[p] = timing[5*p];
+      m_atime[p] = timing[5*p+1] + timing[5*p+2]/1e9;
+   }
+
+   //The thumbnail covers the whole image, with partial blocks at the edges averaged over the pixels they have.
+   m_thumbWidth = (m_width + m_bin - 1)/m_bin;
+   m_thumbHeight = (m_height + m_bin - 1)/m_bin;
+
+   m_thumb.assign(static_cast<size_t>(m_thumbWidth)*m_thumbHeight, 0);
+   std::vector<uint32_t> npix(m_thumb.size(), 0);
+
+   for(uint32_t y = 0; y < m_height; ++y)
+   {
+      for(uint32_t x = 0; x < m_width; ++x)
+      {
+         size_t t = (y/m_bin)*m_thumbWidth + x/m_bin;
+         m_thumb[t] += m_mean[y*m_width + x];
+         ++npix[t];
+      }
+   }
+
+   for(size_t t = 0; t < m_thumb.size(); ++t) m_thumb[t] /= npix[t];
+
+   return 0;
+}
+
+template<typename T>
+void xrifPreview::accumulate( const T * image,
+                              uint64_t frames
+                            )
+{
+   size_t npix = static_cast<size_t>(m_width)*m_height;
+
+   std::vector<double> sum(npix, 0);
+
+   for(uint64_t p = 0; p < frames; ++p)
+   {
+      const T * im = image + p*npix;
+
+      double flux = 0;
+      double mn = im[0];
+      double mx = im[0];
+      int32_t nsat = 0;
+
+      for(size_t n = 0; n < npix; ++n)
+      {
+         double v = im[n];
+
+         sum[n] += v;
+         flux += v;
+         if(v < mn) mn = v;
+         if(v > mx) mx = v;
+         if(v >= m_satLevel) ++nsat;
+      }
+
+      m_flux[p] = flux;
+      m_min[p] = mn;
+      m_max[p] = mx;
+      m_nsat[p] = nsat;
+   }
+
+   for(size_t n = 0; n < npix; ++n) m_mean[n] = sum[n]/frames;
+}
+
+int xrifPreview::write( std::string & errMsg,
+                        const std::string & path,
+                        const std::string & archive
+                      ) const
+{
+   if(m_cnt0.size() == 0)
+   {
+      errMsg = "no preview to write";
+      return -1;
+   }
+
+   //Written to a temporary file which is then renamed, so readers never see a partial sidecar.
+   std::string tmpPath = path + ".tmp";
+
+   int status = 0;
+   fitsfile * fptr = nullptr;
+
+   std::string createName = "!" + tmpPath;
+   fits_create_file(&fptr, createName.c_str(), &status);
+
+   long naxes[2] = {m_width, m_height};
+   fits_create_img(fptr, FLOAT_IMG, 2, naxes, &status);
+   fits_write_img(fptr, TFLOAT, 1, m_mean.size(), const_cast<float *>(m_mean.data()), &status);
+
+   long long nframes = m_cnt0.size();
+   int bin = m_bin;
+   double satLevel = m_satLevel;
+   fits_write_key(fptr, TSTRING, "XRIFFILE", const_cast<char *>(archive.c_str()), "the archive", &status);
+   fits_write_key(fptr, TLONGLONG, "NFRAMES", &nframes, "number of frames in the mean", &status);
+   fits_write_key(fptr, TDOUBLE, "SATLEVEL", &satLevel, "saturation level", &status);
+
+   naxes[0] = m_thumbWidth;
+   naxes[1] = m_thumbHeight;
+   fits_create_img(fptr, FLOAT_IMG, 2, naxes, &status);
+   fits_write_img(fptr, TFLOAT, 1, m_thumb.size(), const_cast<float *>(m_thumb.data()), &status);
+   fits_write_key(fptr, TSTRING, "EXTNAME", const_cast<char *>("THUMB"), "binned mean image", &status);
+   fits_write_key(fptr, TINT, "BIN", &bin, "binning", &status);
+
+   const char * ttype[] = {"FRAMENO", "ACQTIME", "FLUX", "MIN", "MAX", "NSAT"};
+   const char * tform[] = {"1K", "1D", "1D", "1D", "1D", "1J"};
+   const char * tunit[] = {"", "s", "", "", "", ""};
+
+   fits_create_tbl(fptr, BINARY_TBL, nframes, 6, const_cast<char **>(ttype), const_cast<char **>(tform),
+                                                                      const_cast<char **>(tunit), "FRAMESTATS", &status);
+
+   fits_write_col(fptr, TLONGLONG, 1, 1, 1, nframes, const_cast<int64_t *>(m_cnt0.data()), &status);
+   fits_write_col(fptr, TDOUBLE, 2, 1, 1, nframes, const_cast<double *>(m_atime.data()), &status);
+   fits_write_col(fptr, TDOUBLE, 3, 1, 1, nframes, const_cast<double *>(m_flux.data()), &status);
+   fits_write_col(fptr, TDOUBLE, 4, 1, 1, nframes, const_cast<double *>(m_min.data()), &status);
+   fits_write_col(fptr, TDOUBLE, 5, 1, 1, nframes, const_cast<double *>(m_max.data()), &status);
+   fits_write_col(fptr, TINT, 6, 1, 1, nframes, const_cast<int32_t *>(m_nsat.data()), &status);
+
+   if(fptr)
+   {
+      int cstatus = 0;
+      fits_close_file(fptr, &cstatus);
+      if(status == 0) status = cstatus;
+   }
+
+   if(status != 0)
+   {
+      char err[FLEN_STATUS];
+      fits_get_errstatus(status, err);
+      errMsg = err;
+      remove(tmpPath.c_str());
+      return -1;
+   }
+
+   if(rename(tmpPath.c_str(), path.c_str()) < 0)
+   {
+      errMsg = "error renaming " + tmpPath;
+      remove(tmpPath.c_str());
+      return -1;
+   }
+
+   return 0;
+}
+
+uint64_t xrifPreview::frames() const
+{
+   return m_cnt0.size();
+}
+
+const std::vector<float> & xrifPreview::mean() const
+{
+   return m_mean;
+}
+
+const std::vector<float> & xrifPreview::thumb() const
+{
+   return m_thumb;
+}
+
+uint32_t xrifPreview::thumbWidth() const
+{
+   return m_thumbWidth;
+}
+
+uint32_t xrifPreview::thumbHeight() const
+{
+   return m_thumbHeight;
+}
+
+const std::vector<int64_t> & xrifPreview::cnt0() const
+{
+   return m_cnt0;
+}
+
+const std::vector<double> & xrifPreview::atime() const
+{
+   return m_atime;
+}
+
+const std::vector<double> & xrifPreview::flux() const
+{
+   return m_flux;
+}
+
+const std::vector<double> & xrifPreview::min() const
+{
+   return m_min;
+}
+
+const std::vector<double> & xrifPreview::max() const
+{
+   return m_max;
+}
+
+const std::vector<int32_t> & xrifPreview::nsat() const
+{
+   return m_nsat;
+}
+
+} //namespace sys
+} //namespace MagAOX
@@ -0,0 +1,132 @@
+/** \file xrifPreview.hpp
+  * \brief Preview images and statistics of a chunk of frames, written as a sidecar to an xrif archive.
+  *
+  * \ingroup sys_files
+  */
+
+#ifndef sys_xrifPreview_hpp
+#define sys_xrifPreview_hpp
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace MagAOX
+{
+namespace sys
+{
+
+/// Preview images and statistics of a chunk of frames, for triage without decoding the archive.
+/** The preview is the mean image, a thumbnail of the mean binned by bin x bin pixels, and for each frame its frame
+  * number, acquisition time, total flux, minimum, maximum, and the number of pixels at or above the saturation level.
+  *
+  * It is written as a FITS sidecar next to the archive, see sidecarPath(): the mean image in the primary HDU, the
+  * thumbnail in an image extension named THUMB, and the per-frame statistics in a binary table extension named
+  * FRAMESTATS.  A sidecar is a few kB plus 40 bytes per frame.
+  *
+  * \ingroup sys
+  */
+class xrifPreview
+{
+protected:
+
+   uint32_t m_width {0};  ///< The width of the images.
+   uint32_t m_height {0}; ///< The height of the images.
+   int m_typeCode {0};    ///< The xrif type code of the images.
+   uint32_t m_bin {1};    ///< The binning of the thumbnail.
+   double m_satLevel {0}; ///< The saturation level.
+
+   std::vector<float> m_mean;  ///< The mean image.
+   std::vector<float> m_thumb; ///< The binned thumbnail of the mean image.
+
+   uint32_t m_thumbWidth {0};  ///< The width of the thumbnail.
+   uint32_t m_thumbHeight {0}; ///< The height of the thumbnail.
+
+   std::vector<int64_t> m_cnt0;  ///< The frame number of each frame.
+   std::vector<double> m_atime;  ///< The acquisition time of each frame, in seconds since the epoch.
+   std::vector<double> m_flux;   ///< The total flux of each frame.
+   std::vector<double> m_min;    ///< The minimum of each frame.
+   std::vector<double> m_max;    ///< The maximum of each frame.
+   std::vector<int32_t> m_nsat;  ///< The number of saturated pixels in each frame.
+
+public:
+
+   /// Get the sidecar path of an archive, which replaces the .xrif extension with .preview.fits.
+   static std::string sidecarPath( const std::string & archivePath /**< [in] the path of the archive */);
+
+   /// Get the default saturation level of a type, the maximum of integer types and infinity otherwise.
+   static double defaultSatLevel( int typeCode /**< [in] the xrif type code */);
+
+   /// Compute the preview of a chunk of frames.
+   /** The frames are contiguous, each width x height pixels with x fastest, and the timing data has 5 values per frame:
+     * cnt0, atime sec, atime nsec, writetime sec, and writetime nsec.
+     *
+     * \returns 0 on success
+     * \returns -1 if the type is not supported, or there are no frames
+     */
+   int compute( const char * image,       ///< [in] the image data
+                const uint64_t * timing,  ///< [in] the timing data
+                uint32_t width,           ///< [in] the width of the images
+                uint32_t height,          ///< [in] the height of the images
+                int typeCode,             ///< [in] the xrif type code of the images
+                uint64_t frames,          ///< [in] the number of frames
+                uint32_t bin,             ///< [in] the binning of the thumbnail, 1 or more
+                double satLevel           ///< [in] the saturation level
+              );
+
+   /// Write the preview as a FITS file, replacing it if it exists.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with the cfitsio message in errMsg
+     */
+   int write( std::string & errMsg,           ///< [out] the error message, if any
+              const std::string & path,       ///< [in] the path of the FITS file
+              const std::string & archive     ///< [in] the archive file name, written as the XRIFFILE keyword
+            ) const;
+
+   /// Get the number of frames.
+   uint64_t frames() const;
+
+   /// Get the mean image.
+   const std::vector<float> & mean() const;
+
+   /// Get the thumbnail.
+   const std::vector<float> & thumb() const;
+
+   /// Get the width of the thumbnail.
+   uint32_t thumbWidth() const;
+
+   /// Get the height of the thumbnail.
+   uint32_t thumbHeight() const;
+
+   /// Get the frame numbers.
+   const std::vector<int64_t> & cnt0() const;
+
+   /// Get the acquisition times, in seconds since the epoch.
+   const std::vector<double> & atime() const;
+
+   /// Get the total flux of each frame.
+   const std::vector<double> & flux() const;
+
+   /// Get the minimum of each frame.
+   const std::vector<double> & min() const;
+
+   /// Get the maximum of each frame.
+   const std::vector<double> & max() const;
+
+   /// Get the number of saturated pixels in each frame.
+   const std::vector<int32_t> & nsat() const;
+
+protected:
+
+   /// Accumulate the mean image and the per-frame statistics for a type.
+   template<typename T>
+   void accumulate( const T * image,     ///< [in] the image data
+                    uint64_t frames      ///< [in] the number of frames
+                  );
+};
+
+} //namespace sys
+} //namespace MagAOX
+
+#endif //sys_xrifPreview_hpp
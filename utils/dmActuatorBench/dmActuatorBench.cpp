@@ -0,0 +1,17 @@
+/** \file dmActuatorBench.cpp
+  * \brief A benchmark of the DM actuator mapping and conversion kernels.
+  *
+  * \ingroup dmActuatorBench_files
+  */
+
+#include "dmActuatorBench.hpp"
+
+
+
+int main(int argc, char **argv)
+{
+   dmActuatorBench dab;
+
+   return dab.main(argc, argv);
+
+}
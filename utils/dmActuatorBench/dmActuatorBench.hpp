@@ -0,0 +1,362 @@
+/** \file dmActuatorBench.hpp
+  * \brief A benchmark of the DM actuator mapping and conversion kernels.
+  *
+  * \ingroup dmActuatorBench_files
+  */
+
+#ifndef dmActuatorBench_hpp
+#define dmActuatorBench_hpp
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <time.h>
+
+#include <mx/app/application.hpp>
+
+#include "../../libMagAOX/app/dev/dmActuatorMap.hpp"
+#include "../../libMagAOX/app/dev/dmSatAccumulator.hpp"
+
+/** \defgroup dmActuatorBench dmActuatorBench: DM Actuator Kernel Benchmark
+  * \brief Measure the per-command cost of converting a DM shape to the SDK command vector and accounting for saturation.
+  *
+  * <a href="../handbook/utils/dmActuatorBench.html">Utility Documentation</a>
+  *
+  * \ingroup utils
+  *
+  */
+
+/** \defgroup dmActuatorBench_files dmActuatorBench Files
+  * \ingroup dmActuatorBench
+  */
+
+/// Get the monotonic clock as seconds.
+/**
+  * \ingroup dmActuatorBench
+  */
+inline double dmActuatorBenchTime()
+{
+   timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((double) ts.tv_sec) + ((double) ts.tv_nsec)/1e9;
+}
+
+/// A DM geometry to benchmark.
+/**
+  * \ingroup dmActuatorBench
+  */
+struct dmActuatorBenchGeom
+{
+   std::string m_name;
+   uint32_t m_width {0}; ///< The width (and height) of the shape.
+   uint32_t m_nbAct {0}; ///< The length of the command vector.
+   uint32_t m_nUsed {0}; ///< The number of actuators which are used, the rest are ignored.
+   std::vector<int> m_mapping; ///< The mapping, -1 for ignored actuators.
+
+   /// Make a mapping of the m_nUsed pixels closest to the center, in a shuffled order as the SDKs have it.
+   void makeMapping()
+   {
+      std::vector<std::pair<double,int>> pix;
+      double c = 0.5*(m_width-1);
+      for(uint32_t rr = 0; rr < m_width; ++rr)
+      {
+         for(uint32_t cc = 0; cc < m_width; ++cc)
+         {
+            pix.push_back( { (rr-c)*(rr-c) + (cc-c)*(cc-c), (int) (rr*m_width + cc) } );
+         }
+      }
+      std::stable_sort(pix.begin(), pix.end());
+
+      m_mapping.assign(m_nbAct, -1);
+      for(uint32_t n = 0; n < m_nUsed; ++n) m_mapping[n] = pix[n].second;
+
+      srand48(m_nbAct);
+      for(uint32_t n = m_nbAct-1; n > 0; --n) std::swap(m_mapping[n], m_mapping[lrand48() % (n+1)]);
+   }
+};
+
+/** The scalar loops used by bmcCtrl::commandDM before the kernels, for comparison.
+  * \ingroup dmActuatorBench
+  */
+inline
+size_t dmActuatorBenchScalarBMC( double * dminputs,
+                                 uint8_t * satmap,
+                                 const float * shape,
+                                 const int * mapping,
+                                 uint32_t nbAct,
+                                 double scale
+                               )
+{
+   size_t nsat = 0;
+   for(uint32_t idx = 0; idx < nbAct; ++idx)
+   {
+      int address = mapping[idx];
+      if(address == -1) dminputs[idx] = 0.;
+      else dminputs[idx] = ((double) shape[address]) * scale;
+   }
+
+   for(uint32_t idx = 0 ; idx < nbAct ; ++idx)
+   {
+      if(dminputs[idx] > 1)
+      {
+         ++nsat;
+         dminputs[idx] = 1;
+      }
+      else if(dminputs[idx] < 0)
+      {
+         ++nsat;
+         dminputs[idx] = 0;
+      }
+      dminputs[idx] = sqrt(dminputs[idx]);
+   }
+
+   for(uint32_t idx = 0; idx < nbAct; ++idx)
+   {
+      int address = mapping[idx];
+      if(address == -1) continue;
+
+      if(dminputs[idx] >= 1 || dminputs[idx] <= 0) satmap[address] = 1;
+      else satmap[address] = 0;
+   }
+
+   return nsat;
+}
+
+/** The scalar loops used by alpaoCtrl::commandDM before the kernels, for comparison.
+  * \ingroup dmActuatorBench
+  */
+inline
+size_t dmActuatorBenchScalarALPAO( double * dminputs,
+                                   uint8_t * satmap,
+                                   const float * shape,
+                                   const int * mapping,
+                                   uint32_t nbAct,
+                                   double scale
+                                 )
+{
+   size_t nsat = 0;
+   double mean = 0;
+   for(uint32_t idx = 0; idx < nbAct; ++idx)
+   {
+      dminputs[idx] = ((double) shape[mapping[idx]]) * scale;
+      mean += dminputs[idx];
+   }
+   mean /= nbAct;
+
+   for(uint32_t idx = 0 ; idx < nbAct ; ++idx)
+   {
+      dminputs[idx] -= mean;
+      if(dminputs[idx] > 1)
+      {
+         ++nsat;
+         dminputs[idx] = 1;
+      }
+      else if(dminputs[idx] < -1)
+      {
+         ++nsat;
+         dminputs[idx] = - 1;
+      }
+   }
+
+   for(uint32_t idx = 0; idx < nbAct; ++idx)
+   {
+      if(dminputs[idx] >= 1 || dminputs[idx] <= -1) satmap[mapping[idx]] = 1;
+      else satmap[mapping[idx]] = 0;
+   }
+
+   return nsat;
+}
+
+/// The DM actuator kernel benchmark application.
+/**
+  * \ingroup dmActuatorBench
+  */
+class dmActuatorBench : public mx::app::application
+{
+protected:
+
+   int m_commands {100000};
+   std::string m_family {"all"};
+   int m_nShapes {16};
+
+   size_t m_sink {0}; ///< Keeps the results live.
+
+public:
+   virtual void setupConfig();
+
+   virtual void loadConfig();
+
+   virtual int execute();
+
+protected:
+
+   /// Benchmark one geometry with the fused kernel and the scalar loops.
+   template<class familyT>
+   void bench( dmActuatorBenchGeom & geom );
+
+   /// Print the latency statistics.
+   void report( const std::string & name,
+                std::vector<double> & lat
+              );
+};
+
+inline
+void dmActuatorBench::setupConfig()
+{
+   config.add("commands","N", "commands" , argType::Required, "", "commands", false,  "int", "Number of commands to time for each geometry.  Default 100000.");
+   config.add("family","f", "family" , argType::Required, "", "family", false,  "string", "The DM family to benchmark, bmc, alpao, or all.  Default all.");
+   config.add("shapes","s", "shapes" , argType::Required, "", "shapes", false,  "int", "Number of different random shapes to cycle through.  Default 16.");
+}
+
+inline
+void dmActuatorBench::loadConfig()
+{
+   config(m_commands, "commands");
+   config(m_family, "family");
+   config(m_nShapes, "shapes");
+}
+
+inline
+int dmActuatorBench::execute()
+{
+   if(m_commands < 1 || m_nShapes < 1)
+   {
+      std::cerr << "dmActuatorBench: commands and shapes must be positive\n";
+      return -1;
+   }
+
+   if(m_family != "all" && m_family != "bmc" && m_family != "alpao")
+   {
+      std::cerr << "dmActuatorBench: unknown family " << m_family << "\n";
+      return -1;
+   }
+
+   if(m_family == "all" || m_family == "bmc")
+   {
+      //The BMC 2K: 2040 actuators in a 50x50 shape, and the SDK command vector is 2048 long.
+      dmActuatorBenchGeom geom;
+      geom.m_name = "BMC 2K";
+      geom.m_width = 50;
+      geom.m_nbAct = 2048;
+      geom.m_nUsed = 2040;
+      geom.makeMapping();
+
+      bench<MagAOX::app::dev::bmcActuators>(geom);
+   }
+
+   if(m_family == "all" || m_family == "alpao")
+   {
+      //The ALPAO DM97: 97 actuators in an 11x11 shape.
+      dmActuatorBenchGeom geom;
+      geom.m_name = "ALPAO 97";
+      geom.m_width = 11;
+      geom.m_nbAct = 97;
+      geom.m_nUsed = 97;
+      geom.makeMapping();
+
+      bench<MagAOX::app::dev::alpaoActuators>(geom);
+   }
+
+   //So the compiler can't discard the work.
+   if(m_sink == 0) std::cerr << "\n";
+
+   return 0;
+}
+
+template<class familyT>
+void dmActuatorBench::bench( dmActuatorBenchGeom & geom )
+{
+   uint32_t npix = geom.m_width*geom.m_width;
+
+   //Shapes which saturate a few percent of the actuators
+   std::vector<std::vector<float>> shapes(m_nShapes, std::vector<float>(npix));
+   srand48(npix);
+   for(size_t n = 0; n < shapes.size(); ++n)
+   {
+      for(size_t p = 0; p < npix; ++p) shapes[n][p] = 0.5 + 0.3*(drand48() - 0.5)*(1 + (lrand48() % 20 == 0)*3);
+   }
+
+   double scale = 1.0;
+
+   std::vector<double> dminputs(geom.m_nbAct, 0);
+   std::vector<uint8_t> satmap(npix, 0);
+   std::vector<uint16_t> accummap(npix, 0);
+
+   MagAOX::app::dev::actuatorMap<familyT, float, double> am;
+   if(am.setup(geom.m_mapping.data(), geom.m_nbAct, npix, scale) < 0)
+   {
+      std::cerr << "dmActuatorBench: bad mapping for " << geom.m_name << "\n";
+      return;
+   }
+
+   MagAOX::app::dev::satAccumulator sa;
+   sa.resize(geom.m_nbAct);
+
+   std::vector<double> lat(m_commands);
+
+   //Warm up the caches
+   for(int n = 0; n < 1000; ++n)
+   {
+      m_sink += am.apply(dminputs.data(), shapes[n % m_nShapes].data());
+      sa.record(am.satMask().data());
+   }
+
+   for(int n = 0; n < m_commands; ++n)
+   {
+      double t0 = dmActuatorBenchTime();
+      m_sink += am.apply(dminputs.data(), shapes[n % m_nShapes].data());
+      sa.record(am.satMask().data());
+      lat[n] = dmActuatorBenchTime() - t0;
+
+      //Collect as the saturation thread would at 10 Hz with a 2 kHz loop, this is not on the command path.
+      if(n % 200 == 0) m_sink += sa.collect(accummap.data());
+   }
+
+   printf("%s: %u actuators (%u used) in a %ux%u shape, %d commands\n", geom.m_name.c_str(), geom.m_nbAct, geom.m_nUsed,
+                                                                       geom.m_width, geom.m_width, m_commands);
+   report("fused", lat);
+
+   for(int n = 0; n < m_commands; ++n)
+   {
+      double t0 = dmActuatorBenchTime();
+      if(familyT::sqrtResponse)
+      {
+         m_sink += dmActuatorBenchScalarBMC(dminputs.data(), satmap.data(), shapes[n % m_nShapes].data(), geom.m_mapping.data(), geom.m_nbAct, scale);
+      }
+      else
+      {
+         m_sink += dmActuatorBenchScalarALPAO(dminputs.data(), satmap.data(), shapes[n % m_nShapes].data(), geom.m_mapping.data(), geom.m_nbAct, scale);
+      }
+
+      //The old saturation thread was woken to accumulate the whole map after every command.
+      for(size_t p = 0; p < npix; ++p) accummap[p] += satmap[p];
+      lat[n] = dmActuatorBenchTime() - t0;
+   }
+
+   report("scalar", lat);
+   printf("\n");
+}
+
+inline
+void dmActuatorBench::report( const std::string & name,
+                              std::vector<double> & lat
+                            )
+{
+   std::sort(lat.begin(), lat.end());
+
+   double mean = 0;
+   for(size_t n=0; n < lat.size(); ++n) mean += lat[n];
+   mean /= lat.size();
+
+   auto pct = [&lat](double p) { return 1e6*lat[ std::min(lat.size()-1, (size_t) (p*lat.size())) ]; };
+
+   printf("   %-8s latency (us):  mean %0.3f  p50 %0.3f  p99 %0.3f  p99.9 %0.3f  max %0.3f\n", name.c_str(),
+                                 1e6*mean, pct(0.5), pct(0.99), pct(0.999), 1e6*lat.back());
+}
+
+#endif //dmActuatorBench_hpp
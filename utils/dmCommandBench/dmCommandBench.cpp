@@ -0,0 +1,17 @@
+/** \file dmCommandBench.cpp
+  * \brief A benchmark of the DM command path, driving mockDMCtrl through its shared memory stream.
+  *
+  * \ingroup dmCommandBench_files
+  */
+
+#include "dmCommandBench.hpp"
+
+
+
+int main(int argc, char **argv)
+{
+   dmCommandBench dcb;
+
+   return dcb.main(argc, argv);
+
+}
@@ -0,0 +1,441 @@
+/** \file dmCommandBench.hpp
+  * \brief A benchmark of the DM command path, driving mockDMCtrl through its shared memory stream.
+  *
+  * \ingroup dmCommandBench_files
+  */
+
+#ifndef dmCommandBench_hpp
+#define dmCommandBench_hpp
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include <time.h>
+#include <signal.h>
+
+#include <mx/app/application.hpp>
+
+#include <ImageStruct.h>
+#include <ImageStreamIO.h>
+
+#include "../../libMagAOX/ImageStreamIO/ImageStruct.hpp"
+#include "../../apps/mockDMCtrl/mockDMTrace.hpp"
+
+/** \defgroup dmCommandBench dmCommandBench: DM Command Path Benchmark
+  * \brief Push commands into the stream of a mockDMCtrl at a series of rates, and report the command latency, jitter,
+  * dropped commands, and saturation thread cost.
+  *
+  * mockDMCtrl must be running on the same stream, with `dm.combine=false`.  Since it uses the dev::dm and
+  * dev::shmimMonitor command path of the real DM controllers this is the regression check for changes to them.
+  *
+  * <a href="../handbook/utils/dmCommandBench.html">Utility Documentation</a>
+  *
+  * \ingroup utils
+  *
+  */
+
+/** \defgroup dmCommandBench_files dmCommandBench Files
+  * \ingroup dmCommandBench
+  */
+
+bool g_timeToDie = false;
+
+/// Signal handler to stop at the end of the current rate
+void sigTermHandler( int signum,
+                     siginfo_t *siginf,
+                     void *ucont
+                   )
+{
+   //Suppress those warnings . . .
+   static_cast<void>(signum);
+   static_cast<void>(siginf);
+   static_cast<void>(ucont);
+
+   std::cerr << "\n"; //clear out the ^C char
+
+   g_timeToDie = true;
+}
+
+/// Get the difference of two times in microseconds.
+/**
+  * \ingroup dmCommandBench
+  */
+inline double dmCommandBenchElapsed( const timespec & t0,
+                                     const timespec & t1
+                                   )
+{
+   return (t1.tv_sec - t0.tv_sec)*1e6 + (t1.tv_nsec - t0.tv_nsec)/1e3;
+}
+
+/// The results of one rate.
+/**
+  * \ingroup dmCommandBench
+  */
+struct dmCommandBenchResult
+{
+   double m_rate {0}; ///< The requested rate, in Hz.
+   double m_achieved {0}; ///< The achieved posting rate, in Hz.
+   uint64_t m_posted {0}; ///< The number of commands posted.
+   uint64_t m_sent {0}; ///< The number of commands the mock DM sent.
+   uint64_t m_dropped {0}; ///< The number of commands overwritten before the mock DM sent them.
+   uint64_t m_repeated {0}; ///< The number of commands the mock DM sent more than once.
+   uint64_t m_traced {0}; ///< The number of trace entries the latency statistics are from.
+
+   std::vector<double> m_latency; ///< The stream post to commandDM latencies, in microseconds, sorted.
+   double m_latMean {0}; ///< The mean latency, in microseconds.
+   double m_latRms {0}; ///< The RMS deviation of the latency from its mean, the jitter, in microseconds.
+
+   double m_convert {0}; ///< The mean time to convert a command and record saturation, in microseconds.
+   double m_sdk {0}; ///< The mean time in the emulated SDK call, in microseconds.
+
+   double m_satThread {0}; ///< The saturation thread time, as a percentage of the run.
+
+   double m_postLateMax {0}; ///< The maximum lateness of a post relative to its deadline, in microseconds.
+};
+
+/// Compute the statistics of a run from the trace entries.
+/** The entries are the rows of the trace stream written during the run, oldest first, and `before` is the entry written
+  * just before the run, or nullptr if there was none.
+  *
+  * \ingroup dmCommandBench
+  */
+inline
+void dmCommandBenchStats( dmCommandBenchResult & res,                  ///< [in/out] the result, with m_posted set
+                          const std::vector<const double *> & entries, ///< [in] the trace entries of the run
+                          const double * before,                      ///< [in] the entry before the run, or nullptr
+                          uint64_t firstCnt0,                         ///< [in] the cnt0 of the first command posted
+                          double elapsed                              ///< [in] the duration of the run, in seconds
+                        )
+{
+   using namespace MagAOX::app;
+
+   res.m_latency.clear();
+   res.m_convert = 0;
+   res.m_sdk = 0;
+
+   if(entries.size() == 0) return;
+
+   const double * last = entries.back();
+
+   double commands0 = 0, dropped0 = 0, repeated0 = 0, sat0 = 0;
+   if(before)
+   {
+      commands0 = before[mockDMTraceCommands];
+      dropped0 = before[mockDMTraceDropped];
+      repeated0 = before[mockDMTraceRepeated];
+      sat0 = before[mockDMTraceSatThread];
+   }
+
+   res.m_sent = last[mockDMTraceCommands] - commands0;
+   res.m_dropped = last[mockDMTraceDropped] - dropped0;
+   res.m_repeated = last[mockDMTraceRepeated] - repeated0;
+
+   if(elapsed > 0) res.m_satThread = 100*(last[mockDMTraceSatThread] - sat0)/(elapsed*1e6);
+
+   //Only the commands posted by this run, the first may be a leftover
+   for(size_t n = 0; n < entries.size(); ++n)
+   {
+      if(entries[n][mockDMTraceCnt0] < firstCnt0) continue;
+
+      res.m_latency.push_back(entries[n][mockDMTraceLatency]);
+      res.m_convert += entries[n][mockDMTraceConvert];
+      res.m_sdk += entries[n][mockDMTraceSDK];
+   }
+
+   res.m_traced = res.m_latency.size();
+   if(res.m_traced == 0) return;
+
+   res.m_convert /= res.m_traced;
+   res.m_sdk /= res.m_traced;
+
+   res.m_latMean = 0;
+   for(size_t n = 0; n < res.m_latency.size(); ++n) res.m_latMean += res.m_latency[n];
+   res.m_latMean /= res.m_latency.size();
+
+   res.m_latRms = 0;
+   for(size_t n = 0; n < res.m_latency.size(); ++n) res.m_latRms += pow(res.m_latency[n] - res.m_latMean, 2);
+   res.m_latRms = sqrt(res.m_latRms/res.m_latency.size());
+
+   std::sort(res.m_latency.begin(), res.m_latency.end());
+}
+
+/// The DM command path benchmark application.
+/**
+  * \ingroup dmCommandBench
+  */
+class dmCommandBench : public mx::app::application
+{
+protected:
+
+   std::string m_shmimName {"dm00disp"};
+   std::string m_traceName;
+   std::vector<double> m_rates {500, 1000, 2000, 4000};
+   double m_duration {5};
+   double m_satFrac {0.01};
+   int m_nShapes {16};
+
+   IMAGE m_imageStream; ///< The DM stream.
+   IMAGE m_traceStream; ///< The mockDMCtrl trace stream.
+
+   std::vector<std::vector<float>> m_shapes; ///< The shapes to cycle through.
+
+public:
+   virtual void setupConfig();
+
+   virtual void loadConfig();
+
+   virtual int execute();
+
+protected:
+
+   /// Make the shapes, with a fraction of the actuators driven past the limits of either family.
+   void makeShapes( size_t nPix );
+
+   /// Post commands at one rate.
+   int run( dmCommandBenchResult & res );
+
+   /// Post the next shape to the DM stream.
+   void post( uint64_t n );
+
+   /// Print the results of a rate.
+   void report( dmCommandBenchResult & res );
+};
+
+inline
+void dmCommandBench::setupConfig()
+{
+   config.add("shmimName","s", "shmimName" , argType::Required, "", "shmimName", false,  "string", "The DM stream the mockDMCtrl is monitoring.  Default dm00disp.");
+   config.add("trace","t", "trace" , argType::Required, "", "trace", false,  "string", "The mockDMCtrl trace stream.  Default is shmimName with _trace appended.");
+   config.add("rates","r", "rates" , argType::Required, "", "rates", false,  "vector<double>", "The command rates to run, in Hz.  Default 500,1000,2000,4000.");
+   config.add("duration","d", "duration" , argType::Required, "", "duration", false,  "double", "The duration of each rate, in seconds.  Default 5.");
+   config.add("satFrac","", "satFrac" , argType::Required, "", "satFrac", false,  "double", "The fraction of actuators commanded past the limits.  Default 0.01.");
+   config.add("shapes","N", "shapes" , argType::Required, "", "shapes", false,  "int", "The number of different shapes to cycle through.  Default 16.");
+}
+
+inline
+void dmCommandBench::loadConfig()
+{
+   config(m_shmimName, "shmimName");
+   m_traceName = m_shmimName + "_trace";
+   config(m_traceName, "trace");
+   config(m_rates, "rates");
+   config(m_duration, "duration");
+   config(m_satFrac, "satFrac");
+   config(m_nShapes, "shapes");
+}
+
+inline
+int dmCommandBench::execute()
+{
+   if(m_duration <= 0 || m_nShapes < 1)
+   {
+      std::cerr << "dmCommandBench: duration and shapes must be positive\n";
+      return -1;
+   }
+
+   struct sigaction act;
+   sigset_t set;
+
+   act.sa_sigaction = sigTermHandler;
+   act.sa_flags = SA_SIGINFO;
+   sigemptyset(&set);
+   act.sa_mask = set;
+
+   errno = 0;
+   if( sigaction(SIGTERM, &act, 0) < 0 || sigaction(SIGQUIT, &act, 0) < 0 || sigaction(SIGINT, &act, 0) < 0)
+   {
+      std::cerr << "dmCommandBench: error setting signal handlers\n";
+      return -1;
+   }
+
+   if(ImageStreamIO_openIm(&m_imageStream, m_shmimName.c_str()) != 0)
+   {
+      std::cerr << "dmCommandBench: could not open " << m_shmimName << "\n";
+      return -1;
+   }
+
+   if(m_imageStream.md->datatype != IMAGESTRUCT_FLOAT)
+   {
+      std::cerr << "dmCommandBench: " << m_shmimName << " is not float\n";
+      ImageStreamIO_closeIm(&m_imageStream);
+      return -1;
+   }
+
+   if(ImageStreamIO_openIm(&m_traceStream, m_traceName.c_str()) != 0)
+   {
+      std::cerr << "dmCommandBench: could not open " << m_traceName << ", is mockDMCtrl running?\n";
+      ImageStreamIO_closeIm(&m_imageStream);
+      return -1;
+   }
+
+   if(m_traceStream.md->datatype != IMAGESTRUCT_DOUBLE || m_traceStream.md->size[0] != MagAOX::app::mockDMTraceFields)
+   {
+      std::cerr << "dmCommandBench: " << m_traceName << " is not a mockDMCtrl trace\n";
+      ImageStreamIO_closeIm(&m_imageStream);
+      ImageStreamIO_closeIm(&m_traceStream);
+      return -1;
+   }
+
+   makeShapes(m_imageStream.md->size[0]*m_imageStream.md->size[1]);
+
+   printf("%s: %u x %u, trace %s\n\n", m_shmimName.c_str(), m_imageStream.md->size[0], m_imageStream.md->size[1], m_traceName.c_str());
+
+   for(size_t n = 0; n < m_rates.size() && !g_timeToDie; ++n)
+   {
+      if(m_rates[n] <= 0)
+      {
+         std::cerr << "dmCommandBench: rates must be positive\n";
+         break;
+      }
+
+      dmCommandBenchResult res;
+      res.m_rate = m_rates[n];
+
+      if(run(res) < 0) break;
+
+      report(res);
+   }
+
+   ImageStreamIO_closeIm(&m_imageStream);
+   ImageStreamIO_closeIm(&m_traceStream);
+
+   return 0;
+}
+
+inline
+void dmCommandBench::makeShapes( size_t nPix )
+{
+   srand48(nPix);
+
+   m_shapes.resize(m_nShapes);
+   for(int n = 0; n < m_nShapes; ++n)
+   {
+      m_shapes[n].resize(nPix);
+      for(size_t k = 0; k < nPix; ++k)
+      {
+         //Inside the limits of both the bmc [0,1] and alpao [-1,1] families
+         m_shapes[n][k] = 0.1 + 0.8*drand48();
+
+         if(drand48() < m_satFrac) m_shapes[n][k] = (drand48() < 0.5) ? -2 : 2;
+      }
+   }
+}
+
+inline
+void dmCommandBench::post( uint64_t n )
+{
+   const std::vector<float> & shape = m_shapes[n % m_shapes.size()];
+
+   uint64_t depth = m_imageStream.md->size[2];
+   if(m_imageStream.md->naxis < 3 || depth < 1) depth = 1;
+
+   uint64_t cnt1 = (m_imageStream.md->cnt1 + 1) % depth;
+
+   m_imageStream.md->write = 1;
+
+   memcpy(m_imageStream.array.F + cnt1*shape.size(), shape.data(), shape.size()*sizeof(float));
+
+   clock_gettime(CLOCK_REALTIME, &m_imageStream.md->writetime);
+   m_imageStream.md->atime = m_imageStream.md->writetime;
+
+   m_imageStream.md->cnt1 = cnt1;
+   m_imageStream.md->cnt0++;
+
+   if(m_imageStream.writetimearray) m_imageStream.writetimearray[cnt1] = m_imageStream.md->writetime;
+   if(m_imageStream.atimearray) m_imageStream.atimearray[cnt1] = m_imageStream.md->atime;
+   if(m_imageStream.cntarray) m_imageStream.cntarray[cnt1] = m_imageStream.md->cnt0;
+
+   m_imageStream.md->write = 0;
+   ImageStreamIO_sempost(&m_imageStream, -1);
+}
+
+inline
+int dmCommandBench::run( dmCommandBenchResult & res )
+{
+   using namespace MagAOX::app;
+
+   uint64_t traceLength = m_traceStream.md->size[2];
+   uint64_t trace0 = m_traceStream.md->cnt0;
+   uint64_t firstCnt0 = m_imageStream.md->cnt0 + 1;
+
+   //The entry before the run, for the running totals
+   std::vector<double> before;
+   if(trace0 > 0)
+   {
+      const double * e = m_traceStream.array.D + ((trace0-1) % traceLength)*mockDMTraceFields;
+      before.assign(e, e + mockDMTraceFields);
+   }
+
+   long period = 1e9/res.m_rate;
+   uint64_t nPost = res.m_rate*m_duration;
+
+   timespec start, deadline, now;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   deadline = start;
+
+   uint64_t n;
+   for(n = 0; n < nPost && !g_timeToDie; ++n)
+   {
+      deadline.tv_nsec += period;
+      deadline.tv_sec += deadline.tv_nsec / 1000000000;
+      deadline.tv_nsec %= 1000000000;
+
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      double late = dmCommandBenchElapsed(deadline, now);
+      if(late > res.m_postLateMax) res.m_postLateMax = late;
+
+      post(n);
+   }
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   res.m_posted = n;
+   double elapsed = dmCommandBenchElapsed(start, now)/1e6;
+   if(elapsed > 0) res.m_achieved = n/elapsed;
+
+   //Give the mock DM time to finish
+   timespec settle = {0, 200000000};
+   nanosleep(&settle, nullptr);
+
+   uint64_t trace1 = m_traceStream.md->cnt0;
+
+   if(trace1 - trace0 > traceLength)
+   {
+      std::cerr << "dmCommandBench: the trace wrapped, latencies are from the last " << traceLength << " commands\n";
+      trace0 = trace1 - traceLength;
+   }
+
+   std::vector<const double *> entries;
+   for(uint64_t t = trace0; t < trace1; ++t) entries.push_back(m_traceStream.array.D + (t % traceLength)*mockDMTraceFields);
+
+   dmCommandBenchStats(res, entries, before.size() ? before.data() : nullptr, firstCnt0, elapsed);
+
+   return 0;
+}
+
+inline
+void dmCommandBench::report( dmCommandBenchResult & res )
+{
+   printf("%0.0f Hz (achieved %0.1f Hz, max post lateness %0.1f us)\n", res.m_rate, res.m_achieved, res.m_postLateMax);
+   printf("   posted %lu  sent %lu  dropped %lu  repeated %lu\n", res.m_posted, res.m_sent, res.m_dropped, res.m_repeated);
+
+   if(res.m_traced > 0)
+   {
+      auto pct = [&res](double p) { return res.m_latency[ std::min(res.m_latency.size()-1, (size_t) (p*res.m_latency.size())) ]; };
+
+      printf("   post->commandDM latency (us):  mean %0.2f  p50 %0.2f  p99 %0.2f  max %0.2f  jitter(rms) %0.2f\n",
+                              res.m_latMean, pct(0.5), pct(0.99), res.m_latency.back(), res.m_latRms);
+   }
+   printf("   convert+sat %0.2f us  sdk %0.2f us per command\n", res.m_convert, res.m_sdk);
+   printf("   saturation thread %0.3f%% of a core\n\n", res.m_satThread);
+}
+
+#endif //dmCommandBench_hpp
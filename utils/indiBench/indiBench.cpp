@@ -0,0 +1,25 @@
+/** \file indiBench.cpp
+  * \brief A load generator and latency benchmark for the INDI server and libcommon.
+  *
+  * \ingroup indiBench_files
+  */
+
+#include "indiBench.hpp"
+
+
+
+int main(int argc, char **argv)
+{
+   //When started by the indiserver through one of our symlinks, be a driver.
+   std::string self = basename(argv[0]);
+   if(self.compare(0, strlen(INDIBENCH_DRIVER_PREFIX), INDIBENCH_DRIVER_PREFIX) == 0)
+   {
+      indiBenchDriver drv(self);
+      return drv.run();
+   }
+
+   indiBench ib;
+
+   return ib.main(argc, argv);
+
+}
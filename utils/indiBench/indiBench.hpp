@@ -0,0 +1,1082 @@
+/** \file indiBench.hpp
+  * \brief A load generator and latency benchmark for the INDI server and libcommon.
+  *
+  * \ingroup indiBench_files
+  */
+
+#ifndef indiBench_hpp
+#define indiBench_hpp
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <libgen.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <mx/app/application.hpp>
+
+#include "../../INDI/libcommon/IndiDriver.hpp"
+#include "../../INDI/libcommon/IndiClient.hpp"
+#include "../../INDI/libcommon/IndiShmRing.hpp"
+
+#include "../../libMagAOX/common/paths.hpp"
+
+/** \defgroup indiBench indiBench: INDI Load and Latency Benchmark
+  * \brief Measure INDI throughput and latency with synthetic drivers and clients.
+  *
+  * <a href="../handbook/utils/indiBench.html">Utility Documentation</a>
+  *
+  * \ingroup utils
+  *
+  */
+
+/** \defgroup indiBench_files indiBench Files
+  * \ingroup indiBench
+  */
+
+/// Prefix of the executable name which selects driver mode.
+/** indiserver starts each driver by exec-ing its path with no arguments, so the
+  * benchmark makes symlinks to itself with this prefix, and the driver settings
+  * are passed in the environment (which indiserver inherits and passes on).
+  *
+  * With the `fifo` and `shm` transports the symlinks point to xindidriver instead,
+  * and the benchmark starts the drivers itself, with argv[0] set to the driver name.
+  *
+  * \ingroup indiBench
+  */
+#define INDIBENCH_DRIVER_PREFIX "indiBenchDrv"
+
+/// Get the realtime clock as seconds.
+/** The realtime clock is used because the send time crosses process boundaries.
+  *
+  * \ingroup indiBench
+  */
+inline double indiBenchTime()
+{
+   timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return ((double) ts.tv_sec) + ((double) ts.tv_nsec)/1e9;
+}
+
+/// Get an environment variable as a number, with a default.
+/**
+  * \ingroup indiBench
+  */
+template<typename T>
+T indiBenchEnv( const char * name,
+                const T & def
+              )
+{
+   const char * v = getenv(name);
+   if(v == nullptr || v[0] == '\0') return def;
+   return (T) strtod(v, nullptr);
+}
+
+/// A synthetic INDI driver which sends property updates at a fixed rate.
+/** Each driver owns `props` number properties of `elements` elements, and optionally
+  * one BLOB property.  The send time is put in the property message attribute so the
+  * client can compute set-to-receive latency independently of the property type (BLOB
+  * values are base64 text by the time a client sees them).
+  *
+  * The driver also publishes a `bench_stats` property once per second, reporting the
+  * number of updates sent and the number of bytes waiting in its output pipe to
+  * the server, which is the driver-side queue depth.
+  *
+  * The transport to the server is set by `INDIBENCH_TRANSPORT`:
+  * - `pipe`: stdin/stdout of a driver started by indiserver (the default).
+  * - `fifo`: the FIFOs in `INDIBENCH_FIFODIR` to xindidriver, as a MagAOXApp does by default.
+  * - `shm`: the shared memory rings to xindidriver, as a MagAOXApp does with indi.shm=true.
+  *
+  * For `fifo` and `shm` the driver connects the same way indiDriver does: it makes the FIFOs,
+  * creates (or removes) the rings, and writes to the control FIFO so xindidriver restarts
+  * in the right mode.  The queue depth is not measured on the rings.
+  *
+  * \ingroup indiBench
+  */
+class indiBenchDriver : public pcf::IndiDriver
+{
+protected:
+   int m_props {4};          ///< Number of number properties.
+   int m_elements {4};       ///< Elements per number property.
+   double m_rate {100};      ///< Updates per second, per number property.
+   int m_blobSize {0};       ///< Size of the BLOB in bytes.  0 disables the BLOB property.
+   double m_blobRate {0};    ///< BLOB updates per second.
+
+   std::vector<pcf::IndiProperty> m_numbers;
+   pcf::IndiProperty m_blob;
+   pcf::IndiProperty m_stats;
+
+   std::thread m_sendThread;
+   std::atomic<bool> m_shutdown {false};
+
+   uint64_t m_sent {0};
+   int m_queue {0};
+   int m_queueMax {0};
+
+   std::string m_transport {"pipe"}; ///< The transport to the server: pipe, fifo, or shm.
+   std::string m_fifoDir;            ///< The directory of the xindidriver FIFOs.
+
+   pcf::IndiShmRing m_shmIn;  ///< The input ring, for the shm transport.
+   pcf::IndiShmRing m_shmOut; ///< The output ring, for the shm transport.
+
+   int m_outFd {STDOUT_FILENO}; ///< The output file descriptor, whose queue depth is measured.
+
+public:
+   /// Constructor, reads the settings from the environment.
+   explicit indiBenchDriver( const std::string & name );
+
+   /// Destructor, stops the send thread.
+   ~indiBenchDriver() noexcept(true);
+
+   /// Sends the definitions of all properties.
+   virtual void handleGetProperties( const pcf::IndiProperty & ipRecv );
+
+   /// Starts the send thread and runs the INDI loop until the server goes away, or until SIGTERM for xindidriver transports.
+   int run();
+
+protected:
+   /// Connect to xindidriver through the FIFOs, and the rings if the transport is shm.
+   int connectXindi();
+
+   /// The send loop, which paces updates against absolute deadlines.
+   void sendLoop();
+
+   /// Record the bytes waiting in the output pipe.
+   void checkQueue();
+};
+
+inline
+indiBenchDriver::indiBenchDriver( const std::string & name ) : pcf::IndiDriver(name, "indiBench", "1.7")
+{
+   m_props = indiBenchEnv<int>("INDIBENCH_PROPS", m_props);
+   m_elements = indiBenchEnv<int>("INDIBENCH_ELEMENTS", m_elements);
+   m_rate = indiBenchEnv<double>("INDIBENCH_RATE", m_rate);
+   m_blobSize = indiBenchEnv<int>("INDIBENCH_BLOBSIZE", m_blobSize);
+   m_blobRate = indiBenchEnv<double>("INDIBENCH_BLOBRATE", m_blobRate);
+
+   const char * tr = getenv("INDIBENCH_TRANSPORT");
+   if(tr != nullptr && tr[0] != '\0') m_transport = tr;
+
+   const char * fd = getenv("INDIBENCH_FIFODIR");
+   if(fd != nullptr && fd[0] != '\0') m_fifoDir = fd;
+
+   m_numbers.resize(m_props);
+   for(int n=0; n < m_props; ++n)
+   {
+      m_numbers[n] = pcf::IndiProperty(pcf::IndiProperty::Number, name, "bench_n" + std::to_string(n));
+      m_numbers[n].setPerm(pcf::IndiProperty::ReadOnly);
+      m_numbers[n].setState(pcf::IndiProperty::Ok);
+      for(int e=0; e < m_elements; ++e)
+      {
+         m_numbers[n].add(pcf::IndiElement("e" + std::to_string(e), 0.0));
+      }
+   }
+
+   if(m_blobSize > 0)
+   {
+      m_blob = pcf::IndiProperty(pcf::IndiProperty::BLOB, name, "bench_blob");
+      m_blob.setPerm(pcf::IndiProperty::ReadOnly);
+      m_blob.setState(pcf::IndiProperty::Ok);
+      m_blob.add(pcf::IndiElement("data", std::string(m_blobSize, 'x')));
+   }
+
+   m_stats = pcf::IndiProperty(pcf::IndiProperty::Number, name, "bench_stats");
+   m_stats.setPerm(pcf::IndiProperty::ReadOnly);
+   m_stats.setState(pcf::IndiProperty::Ok);
+   m_stats.add(pcf::IndiElement("sent", 0));
+   m_stats.add(pcf::IndiElement("queue", 0));
+   m_stats.add(pcf::IndiElement("queueMax", 0));
+}
+
+inline
+indiBenchDriver::~indiBenchDriver() noexcept(true)
+{
+   m_shutdown = true;
+   if(m_sendThread.joinable()) m_sendThread.join();
+}
+
+inline
+void indiBenchDriver::handleGetProperties( const pcf::IndiProperty & ipRecv )
+{
+   static_cast<void>(ipRecv);
+
+   for(size_t n=0; n < m_numbers.size(); ++n) sendDefProperty(m_numbers[n]);
+   if(m_blobSize > 0) sendDefProperty(m_blob);
+   sendDefProperty(m_stats);
+}
+
+inline
+int indiBenchDriver::run()
+{
+   if(m_transport == "pipe")
+   {
+      m_sendThread = std::thread(&indiBenchDriver::sendLoop, this);
+
+      //Returns when stdin closes, i.e. when the server exits.
+      processIndiRequests(false);
+
+      m_shutdown = true;
+      m_sendThread.join();
+
+      return 0;
+   }
+
+   //xindidriver never closes the FIFOs or rings, so the benchmark stops us with SIGTERM.
+   //This is blocked before any threads start, so only sigwait sees it.
+   sigset_t set;
+   sigemptyset(&set);
+   sigaddset(&set, SIGTERM);
+   sigaddset(&set, SIGINT);
+   pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+   if(connectXindi() < 0) return -1;
+
+   m_sendThread = std::thread(&indiBenchDriver::sendLoop, this);
+   processIndiRequests(true);
+
+   int sig = 0;
+   sigwait(&set, &sig);
+
+   m_shutdown = true;
+   m_sendThread.join();
+   quitProcess();
+
+   if(m_shmIn.isAttached()) pcf::IndiShmRing::unlink(m_shmIn.getName());
+   if(m_shmOut.isAttached()) pcf::IndiShmRing::unlink(m_shmOut.getName());
+
+   return 0;
+}
+
+inline
+int indiBenchDriver::connectXindi()
+{
+   std::string name = getName();
+
+   std::string inName = m_fifoDir + "/" + name + ".in";
+   std::string outName = m_fifoDir + "/" + name + ".out";
+   std::string ctrlName = m_fifoDir + "/" + name + ".ctrl";
+
+   const std::string * fifos[] = {&inName, &outName, &ctrlName};
+   for(size_t n=0; n < 3; ++n)
+   {
+      if(mkfifo(fifos[n]->c_str(), S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) != 0 && errno != EEXIST)
+      {
+         std::cerr << name << ": could not make FIFO " << *fifos[n] << ": " << strerror(errno) << "\n";
+         return -1;
+      }
+   }
+
+   //The rings are named after the driver, and xindidriver uses them if they exist.
+   std::string shmInName = "/" + name + ".in";
+   std::string shmOutName = "/" + name + ".out";
+
+   if(m_transport == "shm")
+   {
+      if(m_shmIn.create(shmInName) < 0 || m_shmOut.create(shmOutName) < 0)
+      {
+         std::cerr << name << ": could not create INDI shared memory: " << strerror(errno) << "\n";
+         return -1;
+      }
+      setInputRing(&m_shmIn);
+      setOutputRing(&m_shmOut);
+   }
+   else
+   {
+      pcf::IndiShmRing::unlink(shmInName);
+      pcf::IndiShmRing::unlink(shmOutName);
+   }
+
+   int fd = open(inName.c_str(), O_RDWR);
+   if(fd < 0)
+   {
+      std::cerr << name << ": could not open " << inName << ": " << strerror(errno) << "\n";
+      return -1;
+   }
+   setInputFd(fd);
+
+   m_outFd = open(outName.c_str(), O_RDWR);
+   if(m_outFd < 0)
+   {
+      std::cerr << name << ": could not open " << outName << ": " << strerror(errno) << "\n";
+      return -1;
+   }
+   setOutputFd(m_outFd);
+
+   //Restart xindidriver, if it's already running, so it picks up the rings or the FIFOs.
+   fd = open(ctrlName.c_str(), O_RDWR);
+   if(fd < 0)
+   {
+      std::cerr << name << ": could not open " << ctrlName << ": " << strerror(errno) << "\n";
+      return -1;
+   }
+   char c = 0;
+   if(write(fd, &c, 1) < 0)
+   {
+      std::cerr << name << ": could not write to " << ctrlName << ": " << strerror(errno) << "\n";
+   }
+   close(fd);
+
+   return 0;
+}
+
+inline
+void indiBenchDriver::checkQueue()
+{
+   if(m_transport == "shm") return;
+
+   int nq = 0;
+   if(ioctl(m_outFd, FIONREAD, &nq) == 0)
+   {
+      m_queue = nq;
+      if(nq > m_queueMax) m_queueMax = nq;
+   }
+}
+
+inline
+void indiBenchDriver::sendLoop()
+{
+   //Nothing is sent until the server has asked for our properties.
+   while(!isResponseModeEnabled() && !m_shutdown) usleep(10000);
+
+   double now = indiBenchTime();
+
+   double numPeriod = (m_rate > 0 && m_props > 0) ? 1.0/(m_rate*m_props) : 0;
+   double blobPeriod = (m_blobRate > 0 && m_blobSize > 0) ? 1.0/m_blobRate : 0;
+
+   double nextNum = now;
+   double nextBlob = now;
+   double nextStats = now + 1.0;
+
+   int next = 0;
+   double value = 0;
+
+   char tstr[32];
+
+   while(!m_shutdown)
+   {
+      now = indiBenchTime();
+
+      if(numPeriod > 0 && now >= nextNum)
+      {
+         value += 1;
+         for(int e=0; e < m_elements; ++e) m_numbers[next]["e" + std::to_string(e)] = value;
+
+         snprintf(tstr, sizeof(tstr), "%0.6f", indiBenchTime());
+         m_numbers[next].setMessage(tstr);
+         sendSetProperty(m_numbers[next]);
+         ++m_sent;
+
+         next = (next + 1) % m_props;
+         nextNum += numPeriod;
+
+         //Don't try to catch up after a stall, just drop the missed slots.
+         if(nextNum < now - 1.0) nextNum = now;
+      }
+
+      if(blobPeriod > 0 && now >= nextBlob)
+      {
+         snprintf(tstr, sizeof(tstr), "%0.6f", indiBenchTime());
+         m_blob.setMessage(tstr);
+         sendSetProperty(m_blob);
+         ++m_sent;
+
+         nextBlob += blobPeriod;
+         if(nextBlob < now - 1.0) nextBlob = now;
+      }
+
+      checkQueue();
+
+      if(now >= nextStats)
+      {
+         m_stats["sent"] = m_sent;
+         m_stats["queue"] = m_queue;
+         m_stats["queueMax"] = m_queueMax;
+         sendSetProperty(m_stats);
+         m_queueMax = 0;
+         nextStats += 1.0;
+      }
+
+      //Sleep until the next deadline.
+      double wake = nextStats;
+      if(numPeriod > 0 && nextNum < wake) wake = nextNum;
+      if(blobPeriod > 0 && nextBlob < wake) wake = nextBlob;
+
+      double dt = wake - indiBenchTime();
+      if(dt > 0)
+      {
+         timespec ts;
+         ts.tv_sec = (time_t) dt;
+         ts.tv_nsec = (long) ((dt - ts.tv_sec)*1e9);
+         ::nanosleep(&ts, nullptr);
+      }
+   }
+}
+
+/// A synthetic INDI client which records the latency of every update it receives.
+/**
+  * \ingroup indiBench
+  */
+class indiBenchClient : public pcf::IndiClient
+{
+protected:
+   std::mutex m_mutex;
+
+   bool m_recording {false};
+
+   std::vector<double> m_latencies; ///< Set-to-receive latencies, in seconds, while recording.
+
+   uint64_t m_received {0};  ///< Number of bench updates received while recording.
+   uint64_t m_blobs {0};     ///< Number of BLOB updates received while recording.
+   uint64_t m_blobBytes {0}; ///< Number of BLOB bytes received while recording.
+
+   /// The latest driver statistics, by device: sent, queue, queueMax.
+   std::map<std::string, std::vector<double>> m_driverStats;
+
+public:
+   /// Constructor, which connects to the server.
+   indiBenchClient( const std::string & name,
+                    const std::string & host,
+                    const int port
+                  ) : pcf::IndiClient(name, "indiBench", "1.7", host, port)
+   {
+   }
+
+   /// Runs the INDI loop in the client thread.
+   virtual void execute()
+   {
+      processIndiRequests(false);
+   }
+
+   /// Asks for all properties, including BLOBs.
+   void subscribe( const std::vector<std::string> & devices );
+
+   /// Records latency for updates, and keeps the latest driver statistics.
+   virtual void handleSetProperty( const pcf::IndiProperty & ipRecv );
+
+   /// Start or stop recording, clearing the results on start.
+   void record( bool rec );
+
+   /// Append the recorded latencies to `lat`, and add the counts.
+   void results( std::vector<double> & lat,
+                 uint64_t & received,
+                 uint64_t & blobs,
+                 uint64_t & blobBytes
+               );
+
+   /// Get the latest driver statistics.
+   std::map<std::string, std::vector<double>> driverStats();
+};
+
+inline
+void indiBenchClient::subscribe( const std::vector<std::string> & devices )
+{
+   sendGetProperties(pcf::IndiProperty());
+
+   for(size_t n=0; n < devices.size(); ++n)
+   {
+      pcf::IndiProperty ipBlob(pcf::IndiProperty::BLOB, devices[n], "bench_blob");
+      ipBlob.setBLOBEnable(pcf::IndiProperty::Also);
+      sendEnableBLOB(ipBlob);
+   }
+}
+
+inline
+void indiBenchClient::handleSetProperty( const pcf::IndiProperty & ipRecv )
+{
+   double now = indiBenchTime();
+
+   if(ipRecv.getName() == "bench_stats")
+   {
+      std::vector<double> st(3, 0);
+      if(ipRecv.find("sent")) st[0] = ipRecv["sent"].get<double>();
+      if(ipRecv.find("queue")) st[1] = ipRecv["queue"].get<double>();
+      if(ipRecv.find("queueMax")) st[2] = ipRecv["queueMax"].get<double>();
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_driverStats[ipRecv.getDevice()] = st;
+      return;
+   }
+
+   if(ipRecv.getName().compare(0, 6, "bench_") != 0) return;
+   if(ipRecv.getMessage() == "") return;
+
+   double sent = strtod(ipRecv.getMessage().c_str(), nullptr);
+
+   std::lock_guard<std::mutex> lock(m_mutex);
+
+   if(!m_recording) return;
+
+   m_latencies.push_back(now - sent);
+   ++m_received;
+
+   if(ipRecv.getType() == pcf::IndiProperty::BLOB && ipRecv.find("data"))
+   {
+      ++m_blobs;
+      m_blobBytes += ipRecv["data"].getValue().size();
+   }
+}
+
+inline
+void indiBenchClient::record( bool rec )
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+
+   if(rec)
+   {
+      m_latencies.clear();
+      m_received = 0;
+      m_blobs = 0;
+      m_blobBytes = 0;
+   }
+
+   m_recording = rec;
+}
+
+inline
+void indiBenchClient::results( std::vector<double> & lat,
+                               uint64_t & received,
+                               uint64_t & blobs,
+                               uint64_t & blobBytes
+                             )
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+
+   lat.insert(lat.end(), m_latencies.begin(), m_latencies.end());
+   received += m_received;
+   blobs += m_blobs;
+   blobBytes += m_blobBytes;
+}
+
+inline
+std::map<std::string, std::vector<double>> indiBenchClient::driverStats()
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   return m_driverStats;
+}
+
+/// The results of one benchmark run, for comparing transports.
+/**
+  * \ingroup indiBench
+  */
+struct indiBenchSummary
+{
+   std::string m_transport; ///< The transport used for the run.
+   double m_rate {0};       ///< Messages per second received.
+   double m_expected {0};   ///< Messages per second expected.
+   double m_mean {0};       ///< Mean latency, in ms.
+   double m_p50 {0};        ///< Median latency, in ms.
+   double m_p99 {0};        ///< 99th percentile latency, in ms.
+   double m_max {0};        ///< Maximum latency, in ms.
+};
+
+/// The INDI benchmark application.
+/** Starts an indiserver with `drivers` synthetic drivers, connects `clients` synthetic
+  * clients to it, and after a warm-up records for `duration` seconds.  Then reports the
+  * message rate, the set-to-receive latency percentiles, and the driver output queue
+  * depths.
+  *
+  * The drivers can talk to the server directly (`pipe`, the baseline), or the way a
+  * MagAOXApp does through xindidriver, over FIFOs (`fifo`) or shared memory rings (`shm`).
+  * Given more than one transport, each is run in turn and the results are compared.
+  *
+  * \ingroup indiBench
+  */
+class indiBench : public mx::app::application
+{
+protected:
+
+   int m_drivers {4};
+   int m_clients {2};
+   int m_props {4};
+   int m_elements {4};
+   double m_rate {100};
+   int m_blobSize {0};
+   double m_blobRate {0};
+
+   double m_warmup {2};
+   double m_duration {10};
+
+   int m_port {7700};
+   std::string m_indiserver {"indiserver"};
+   int m_maxQueue {0};
+
+   std::vector<std::string> m_transports {"pipe"};
+   std::string m_fifoDir {MAGAOX_path "/" MAGAOX_driverFIFORelPath};
+   std::string m_xindidriver {MAGAOX_path "/bin/xindidriver"};
+
+   std::string m_transport;
+   std::string m_tmpDir;
+   std::vector<std::string> m_driverNames;
+   std::vector<pid_t> m_driverPids;
+   pid_t m_serverPid {0};
+
+public:
+   virtual void setupConfig();
+
+   virtual void loadConfig();
+
+   virtual int execute();
+
+protected:
+   /// Run the benchmark over one transport.
+   int run( indiBenchSummary & summ );
+
+   /// Make the temporary directory of driver symlinks.
+   int makeDrivers();
+
+   /// Start the drivers which talk to xindidriver.
+   int startDrivers();
+
+   /// Start the indiserver.
+   int startServer();
+
+   /// Stop the indiserver and the drivers, and remove the symlinks, FIFOs, and rings.
+   void cleanup();
+
+   /// Print the results.
+   void report( std::vector<double> & lat,
+                uint64_t received,
+                uint64_t blobs,
+                uint64_t blobBytes,
+                const std::map<std::string, std::vector<double>> & stats,
+                double elapsed,
+                indiBenchSummary & summ
+              );
+
+   /// Print the results of each transport next to the first.
+   void compare( const std::vector<indiBenchSummary> & summs );
+};
+
+inline
+void indiBench::setupConfig()
+{
+   config.add("drivers","D", "drivers" , argType::Required, "", "drivers", false,  "int", "Number of synthetic drivers.  Default 4.");
+   config.add("clients","C", "clients" , argType::Required, "", "clients", false,  "int", "Number of synthetic clients.  Default 2.");
+   config.add("props","P", "props" , argType::Required, "", "props", false,  "int", "Number properties per driver.  Default 4.");
+   config.add("elements","E", "elements" , argType::Required, "", "elements", false,  "int", "Elements per number property.  Default 4.");
+   config.add("rate","r", "rate" , argType::Required, "", "rate", false,  "real", "Updates per second of each number property.  Default 100.");
+   config.add("blobSize","b", "blobSize" , argType::Required, "", "blobSize", false,  "int", "Size of the BLOB property in bytes.  0, the default, disables BLOBs.");
+   config.add("blobRate","B", "blobRate" , argType::Required, "", "blobRate", false,  "real", "Updates per second of the BLOB property.  Default 0.");
+   config.add("warmup","w", "warmup" , argType::Required, "", "warmup", false,  "real", "Seconds to run before recording.  Default 2.");
+   config.add("duration","d", "duration" , argType::Required, "", "duration", false,  "real", "Seconds to record.  Default 10.");
+   config.add("port","p", "port" , argType::Required, "", "port", false,  "int", "Port for the indiserver.  Default 7700, so as not to collide with a running system.");
+   config.add("indiserver","", "indiserver" , argType::Required, "", "indiserver", false,  "string", "The indiserver executable.  Default is indiserver in the path.");
+   config.add("maxQueue","m", "maxQueue" , argType::Required, "", "maxQueue", false,  "int", "The indiserver -m option, max client queue in MB.  0, the default, uses the indiserver default.");
+   config.add("transport","T", "transport" , argType::Required, "", "transport", false,  "vector<string>", "The driver transport(s): pipe (driver on indiserver's pipes), fifo (MagAOXApp-style through xindidriver FIFOs), shm (through xindidriver shared memory rings), or all.  Each is run in turn.  Default pipe.");
+   config.add("fifoDir","", "fifoDir" , argType::Required, "", "fifoDir", false,  "string", "The directory of the xindidriver FIFOs, which must match the one xindidriver was compiled with.  Default " MAGAOX_path "/" MAGAOX_driverFIFORelPath ".");
+   config.add("xindidriver","", "xindidriver" , argType::Required, "", "xindidriver", false,  "string", "The xindidriver executable.  Default " MAGAOX_path "/bin/xindidriver.");
+}
+
+inline
+void indiBench::loadConfig()
+{
+   config(m_drivers, "drivers");
+   config(m_clients, "clients");
+   config(m_props, "props");
+   config(m_elements, "elements");
+   config(m_rate, "rate");
+   config(m_blobSize, "blobSize");
+   config(m_blobRate, "blobRate");
+   config(m_warmup, "warmup");
+   config(m_duration, "duration");
+   config(m_port, "port");
+   config(m_indiserver, "indiserver");
+   config(m_maxQueue, "maxQueue");
+   config(m_transports, "transport");
+   config(m_fifoDir, "fifoDir");
+   config(m_xindidriver, "xindidriver");
+}
+
+inline
+int indiBench::makeDrivers()
+{
+   char self[1024];
+   ssize_t ns = readlink("/proc/self/exe", self, sizeof(self)-1);
+   if(ns <= 0)
+   {
+      std::cerr << "indiBench: could not find own executable: " << strerror(errno) << "\n";
+      return -1;
+   }
+   self[ns] = '\0';
+
+   //For the xindidriver transports, indiserver starts xindidriver, named after the driver.
+   std::string target = self;
+   if(m_transport != "pipe")
+   {
+      if(access(m_xindidriver.c_str(), X_OK) != 0)
+      {
+         std::cerr << "indiBench: can not execute xindidriver at " << m_xindidriver << ", see --xindidriver\n";
+         return -1;
+      }
+      target = m_xindidriver;
+   }
+
+   char tmpl[] = "/tmp/indiBench.XXXXXX";
+   if(mkdtemp(tmpl) == nullptr)
+   {
+      std::cerr << "indiBench: could not make temporary directory: " << strerror(errno) << "\n";
+      return -1;
+   }
+   m_tmpDir = tmpl;
+
+   for(int n=0; n < m_drivers; ++n)
+   {
+      char name[64];
+      snprintf(name, sizeof(name), INDIBENCH_DRIVER_PREFIX "%02d", n);
+
+      std::string path = m_tmpDir + "/" + name;
+      if(symlink(target.c_str(), path.c_str()) < 0)
+      {
+         std::cerr << "indiBench: could not make driver symlink " << path << ": " << strerror(errno) << "\n";
+         return -1;
+      }
+
+      m_driverNames.push_back(name);
+   }
+
+   //The drivers inherit these through the indiserver.
+   setenv("INDIBENCH_PROPS", std::to_string(m_props).c_str(), 1);
+   setenv("INDIBENCH_ELEMENTS", std::to_string(m_elements).c_str(), 1);
+   setenv("INDIBENCH_RATE", std::to_string(m_rate).c_str(), 1);
+   setenv("INDIBENCH_BLOBSIZE", std::to_string(m_blobSize).c_str(), 1);
+   setenv("INDIBENCH_BLOBRATE", std::to_string(m_blobRate).c_str(), 1);
+   setenv("INDIBENCH_TRANSPORT", m_transport.c_str(), 1);
+   setenv("INDIBENCH_FIFODIR", m_fifoDir.c_str(), 1);
+
+   return 0;
+}
+
+inline
+int indiBench::startDrivers()
+{
+   if(m_transport == "pipe") return 0;
+
+   char self[1024];
+   ssize_t ns = readlink("/proc/self/exe", self, sizeof(self)-1);
+   if(ns <= 0)
+   {
+      std::cerr << "indiBench: could not find own executable: " << strerror(errno) << "\n";
+      return -1;
+   }
+   self[ns] = '\0';
+
+   for(size_t n=0; n < m_driverNames.size(); ++n)
+   {
+      pid_t pid = fork();
+
+      if(pid < 0)
+      {
+         std::cerr << "indiBench: fork failed: " << strerror(errno) << "\n";
+         return -1;
+      }
+
+      if(pid == 0)
+      {
+         //argv[0] is the driver name, which selects driver mode in main.
+         char * argv[] = {const_cast<char *>(m_driverNames[n].c_str()), nullptr};
+         execv(self, argv);
+
+         std::cerr << "indiBench: exec of " << self << " failed: " << strerror(errno) << "\n";
+         _exit(-1);
+      }
+
+      m_driverPids.push_back(pid);
+   }
+
+   return 0;
+}
+
+inline
+int indiBench::startServer()
+{
+   std::vector<std::string> args;
+   args.push_back(m_indiserver);
+   args.push_back("-p");
+   args.push_back(std::to_string(m_port));
+   if(m_maxQueue > 0)
+   {
+      args.push_back("-m");
+      args.push_back(std::to_string(m_maxQueue));
+   }
+   for(size_t n=0; n < m_driverNames.size(); ++n) args.push_back(m_tmpDir + "/" + m_driverNames[n]);
+
+   m_serverPid = fork();
+
+   if(m_serverPid < 0)
+   {
+      std::cerr << "indiBench: fork failed: " << strerror(errno) << "\n";
+      return -1;
+   }
+
+   if(m_serverPid == 0)
+   {
+      std::vector<char *> argv;
+      for(size_t n=0; n < args.size(); ++n) argv.push_back(const_cast<char *>(args[n].c_str()));
+      argv.push_back(nullptr);
+
+      execvp(argv[0], argv.data());
+
+      std::cerr << "indiBench: exec of " << args[0] << " failed: " << strerror(errno) << "\n";
+      _exit(-1);
+   }
+
+   return 0;
+}
+
+inline
+void indiBench::cleanup()
+{
+   if(m_serverPid > 0)
+   {
+      kill(m_serverPid, SIGTERM);
+      waitpid(m_serverPid, nullptr, 0);
+      m_serverPid = 0;
+   }
+
+   for(size_t n=0; n < m_driverPids.size(); ++n)
+   {
+      kill(m_driverPids[n], SIGTERM);
+      waitpid(m_driverPids[n], nullptr, 0);
+   }
+   m_driverPids.clear();
+
+   for(size_t n=0; n < m_driverNames.size(); ++n)
+   {
+      unlink((m_tmpDir + "/" + m_driverNames[n]).c_str());
+
+      if(m_transport != "pipe")
+      {
+         unlink((m_fifoDir + "/" + m_driverNames[n] + ".in").c_str());
+         unlink((m_fifoDir + "/" + m_driverNames[n] + ".out").c_str());
+         unlink((m_fifoDir + "/" + m_driverNames[n] + ".ctrl").c_str());
+         pcf::IndiShmRing::unlink("/" + m_driverNames[n] + ".in");
+         pcf::IndiShmRing::unlink("/" + m_driverNames[n] + ".out");
+      }
+   }
+   m_driverNames.clear();
+
+   if(m_tmpDir != "") rmdir(m_tmpDir.c_str());
+   m_tmpDir = "";
+}
+
+inline
+int indiBench::execute()
+{
+   if(m_drivers < 1 || m_clients < 1)
+   {
+      std::cerr << "indiBench: need at least one driver and one client.\n";
+      return -1;
+   }
+
+   std::vector<std::string> transports;
+   for(size_t n=0; n < m_transports.size(); ++n)
+   {
+      if(m_transports[n] == "all")
+      {
+         transports.insert(transports.end(), {"pipe", "fifo", "shm"});
+      }
+      else if(m_transports[n] == "pipe" || m_transports[n] == "fifo" || m_transports[n] == "shm")
+      {
+         transports.push_back(m_transports[n]);
+      }
+      else
+      {
+         std::cerr << "indiBench: unknown transport " << m_transports[n] << ".  Use pipe, fifo, shm, or all.\n";
+         return -1;
+      }
+   }
+
+   std::vector<indiBenchSummary> summs;
+   for(size_t n=0; n < transports.size(); ++n)
+   {
+      if(n > 0) printf("\n");
+
+      m_transport = transports[n];
+
+      indiBenchSummary summ;
+      if(run(summ) < 0) return -1;
+      summs.push_back(summ);
+   }
+
+   if(summs.size() > 1) compare(summs);
+
+   return 0;
+}
+
+inline
+int indiBench::run( indiBenchSummary & summ )
+{
+   //The drivers come first for xindidriver, so the rings exist when it starts.
+   if(makeDrivers() < 0 || startDrivers() < 0 || startServer() < 0)
+   {
+      cleanup();
+      return -1;
+   }
+
+   //Give the server time to start and listen.
+   sleep(1);
+
+   std::vector<indiBenchClient *> clients;
+   for(int n=0; n < m_clients; ++n)
+   {
+      indiBenchClient * c = new indiBenchClient("indiBench" + std::to_string(n), "127.0.0.1", m_port);
+      c->activate();
+      c->subscribe(m_driverNames);
+      clients.push_back(c);
+   }
+
+   //xindidriver waits a few seconds before it connects, so wait until every client hears from every driver.
+   double t0 = indiBenchTime();
+   for(size_t n=0; n < clients.size(); ++n)
+   {
+      while((int) clients[n]->driverStats().size() < m_drivers && indiBenchTime() - t0 < 30) usleep(100000);
+   }
+
+   if(indiBenchTime() - t0 >= 30)
+   {
+      std::cerr << "indiBench: not all drivers are reporting over " << m_transport << ", continuing anyway\n";
+   }
+
+   std::cerr << "indiBench: " << m_drivers << " drivers, " << m_clients << " clients over " << m_transport << ", warming up for " << m_warmup << " s\n";
+   usleep((useconds_t) (m_warmup*1e6));
+
+   for(size_t n=0; n < clients.size(); ++n) clients[n]->record(true);
+
+   t0 = indiBenchTime();
+   usleep((useconds_t) (m_duration*1e6));
+   for(size_t n=0; n < clients.size(); ++n) clients[n]->record(false);
+   double elapsed = indiBenchTime() - t0;
+
+   std::vector<double> lat;
+   uint64_t received = 0;
+   uint64_t blobs = 0;
+   uint64_t blobBytes = 0;
+   std::map<std::string, std::vector<double>> stats;
+
+   for(size_t n=0; n < clients.size(); ++n)
+   {
+      clients[n]->results(lat, received, blobs, blobBytes);
+      std::map<std::string, std::vector<double>> cs = clients[n]->driverStats();
+      stats.insert(cs.begin(), cs.end());
+   }
+
+   report(lat, received, blobs, blobBytes, stats, elapsed, summ);
+
+   for(size_t n=0; n < clients.size(); ++n)
+   {
+      clients[n]->quitProcess();
+      clients[n]->deactivate();
+      delete clients[n];
+   }
+
+   cleanup();
+
+   return 0;
+}
+
+inline
+void indiBench::report( std::vector<double> & lat,
+                        uint64_t received,
+                        uint64_t blobs,
+                        uint64_t blobBytes,
+                        const std::map<std::string, std::vector<double>> & stats,
+                        double elapsed,
+                        indiBenchSummary & summ
+                      )
+{
+   double expected = m_drivers * (m_rate*m_props + (m_blobSize > 0 ? m_blobRate : 0)) * m_clients;
+
+   summ.m_transport = m_transport;
+   summ.m_rate = received/elapsed;
+   summ.m_expected = expected;
+
+   printf("transport:         %s\n", m_transport.c_str());
+   printf("drivers:           %d\n", m_drivers);
+   printf("clients:           %d\n", m_clients);
+   printf("properties:        %d x %d elements at %g Hz", m_props, m_elements, m_rate);
+   if(m_blobSize > 0) printf(", BLOB %d bytes at %g Hz", m_blobSize, m_blobRate);
+   printf("\n");
+   printf("elapsed:           %0.3f s\n", elapsed);
+   printf("received:          %lu msgs\n", (unsigned long) received);
+   printf("rate:              %0.1f msgs/s (expected %0.1f)\n", received/elapsed, expected);
+   if(m_blobSize > 0)
+   {
+      printf("BLOB rate:         %0.1f msgs/s, %0.3f MB/s\n", blobs/elapsed, blobBytes/elapsed/1048576.0);
+   }
+
+   if(lat.size() > 0)
+   {
+      std::sort(lat.begin(), lat.end());
+
+      double mean = 0;
+      for(size_t n=0; n < lat.size(); ++n) mean += lat[n];
+      mean /= lat.size();
+
+      auto pct = [&lat](double p) { return 1e3*lat[ std::min(lat.size()-1, (size_t) (p*lat.size())) ]; };
+
+      printf("latency (ms):      mean %0.3f  p50 %0.3f  p90 %0.3f  p99 %0.3f  p99.9 %0.3f  max %0.3f\n",
+                                 1e3*mean, pct(0.5), pct(0.9), pct(0.99), pct(0.999), 1e3*lat.back());
+
+      summ.m_mean = 1e3*mean;
+      summ.m_p50 = pct(0.5);
+      summ.m_p99 = pct(0.99);
+      summ.m_max = 1e3*lat.back();
+   }
+   else
+   {
+      printf("latency (ms):      no messages received\n");
+   }
+
+   //Driver output queue depths, i.e. bytes in the pipe to the server.
+   double qmax = 0;
+   double qsum = 0;
+   for(auto it = stats.begin(); it != stats.end(); ++it)
+   {
+      qsum += it->second[1];
+      if(it->second[2] > qmax) qmax = it->second[2];
+   }
+   if(m_transport == "shm")
+   {
+      printf("driver queue (B):  not measured on shared memory  (%zu of %d drivers reporting)\n", stats.size(), m_drivers);
+   }
+   else
+   {
+      printf("driver queue (B):  mean %0.0f  max %0.0f  (%zu of %d drivers reporting)\n",
+                                  stats.size() > 0 ? qsum/stats.size() : 0.0, qmax, stats.size(), m_drivers);
+   }
+}
+
+inline
+void indiBench::compare( const std::vector<indiBenchSummary> & summs )
+{
+   const indiBenchSummary & base = summs[0];
+
+   printf("\n");
+   printf("transport   rate (msgs/s)   mean (ms)   p50 (ms)   p99 (ms)   max (ms)   p50 vs %s\n", base.m_transport.c_str());
+   for(size_t n=0; n < summs.size(); ++n)
+   {
+      const indiBenchSummary & s = summs[n];
+      printf("%-9s   %13.1f   %9.3f   %8.3f   %8.3f   %8.3f   ", s.m_transport.c_str(), s.m_rate, s.m_mean, s.m_p50, s.m_p99, s.m_max);
+      if(base.m_p50 > 0) printf("%0.2fx\n", s.m_p50/base.m_p50);
+      else printf("-\n");
+   }
+   printf("(expected rate %0.1f msgs/s)\n", base.m_expected);
+}
+
+#endif //indiBench_hpp
@@ -0,0 +1,17 @@
+/** \file predCtrlBench.cpp
+  * \brief A benchmark of the hoPredCtrl predictive controller.
+  *
+  * \ingroup predCtrlBench_files
+  */
+
+#include "predCtrlBench.hpp"
+
+
+
+int main(int argc, char **argv)
+{
+   predCtrlBench pcb;
+
+   return pcb.main(argc, argv);
+
+}
@@ -0,0 +1,210 @@
+/** \file predCtrlBench.hpp
+  * \brief A benchmark of the hoPredCtrl predictive controller.
+  *
+  * \ingroup predCtrlBench_files
+  */
+
+#ifndef predCtrlBench_hpp
+#define predCtrlBench_hpp
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <time.h>
+
+#include <mx/app/application.hpp>
+
+#include "../../apps/hoPredCtrl/predictive_controller.hpp"
+
+/** \defgroup predCtrlBench predCtrlBench: Predictive Controller Benchmark
+  * \brief Measure the per-step cost of the hoPredCtrl predictive controller, with whichever backend it was built with.
+  *
+  * <a href="../handbook/utils/predCtrlBench.html">Utility Documentation</a>
+  *
+  * \ingroup utils
+  *
+  */
+
+/** \defgroup predCtrlBench_files predCtrlBench Files
+  * \ingroup predCtrlBench
+  */
+
+/// Get the monotonic clock as seconds.
+/**
+  * \ingroup predCtrlBench
+  */
+inline double predCtrlBenchTime()
+{
+   timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((double) ts.tv_sec) + ((double) ts.tv_nsec)/1e9;
+}
+
+/// The predictive controller benchmark application.
+/**
+  * \ingroup predCtrlBench
+  */
+class predCtrlBench : public mx::app::application
+{
+protected:
+
+   std::vector<int> m_modes {500, 1000, 2000};
+   int m_measurements {8400};
+   int m_numHist {10};
+   int m_numFut {2};
+   int m_steps {2000};
+
+   double m_sink {0}; ///< Keeps the results live.
+
+public:
+   virtual void setupConfig();
+
+   virtual void loadConfig();
+
+   virtual int execute();
+
+protected:
+
+   /// Benchmark one mode count.
+   void bench( int nModes );
+
+   /// Print the latency statistics.
+   void report( const std::string & name,
+                std::vector<double> & lat
+              );
+};
+
+inline
+void predCtrlBench::setupConfig()
+{
+   config.add("modes","m", "modes" , argType::Required, "", "modes", false,  "vector<int>", "The numbers of modes to benchmark.  Default 500,1000,2000.");
+   config.add("measurements","M", "measurements" , argType::Required, "", "measurements", false,  "int", "The length of the WFS measurement vector.  Default 8400.");
+   config.add("Nhist","", "Nhist" , argType::Required, "", "Nhist", false,  "int", "The history length.  Default 10.");
+   config.add("Nfut","", "Nfut" , argType::Required, "", "Nfut", false,  "int", "The prediction horizon.  Default 2.");
+   config.add("steps","N", "steps" , argType::Required, "", "steps", false,  "int", "Number of loop steps to time for each mode count.  Default 2000.");
+}
+
+inline
+void predCtrlBench::loadConfig()
+{
+   config(m_modes, "modes");
+   config(m_measurements, "measurements");
+   config(m_numHist, "Nhist");
+   config(m_numFut, "Nfut");
+   config(m_steps, "steps");
+}
+
+inline
+int predCtrlBench::execute()
+{
+   if(m_steps < 1 || m_measurements < 1 || m_numHist < 1 || m_numFut < 1)
+   {
+      std::cerr << "predCtrlBench: steps, measurements, Nhist, and Nfut must be positive\n";
+      return -1;
+   }
+
+#ifdef HAVE_CUDA
+   printf("Backend: CUDA\n\n");
+#else
+   printf("Backend: CPU\n\n");
+#endif
+
+   for(size_t n = 0; n < m_modes.size(); ++n)
+   {
+      if(m_modes[n] < 1)
+      {
+         std::cerr << "predCtrlBench: modes must be positive\n";
+         return -1;
+      }
+
+      bench(m_modes[n]);
+   }
+
+   //So the compiler can't discard the work.
+   if(m_sink == 0) std::cerr << "\n";
+
+   return 0;
+}
+
+inline
+void predCtrlBench::bench( int nModes )
+{
+   std::vector<float> im(nModes*m_measurements);
+   srand48(nModes);
+   for(size_t n = 0; n < im.size(); ++n) im[n] = (drand48() - 0.5)/m_measurements;
+
+   //A few different measurements to cycle through
+   int nMeas = 16;
+   std::vector<std::vector<float>> wfs(nMeas, std::vector<float>(m_measurements));
+   for(int n = 0; n < nMeas; ++n)
+   {
+      for(int k = 0; k < m_measurements; ++k) wfs[n][k] = drand48() - 0.5;
+   }
+
+   DDSPC::PredictiveController pc(m_numHist, m_numFut, nModes, m_measurements, 0.999, 1.0, 100);
+   pc.set_interaction_matrix(im.data());
+   pc.set_new_regularization(1.0);
+   pc.create_exploration_buffer(0.01, m_steps/2);
+
+   std::vector<double> latAdd(m_steps), latPred(m_steps), latCtrl(m_steps), latCmd(m_steps), latTot(m_steps);
+
+   //Warm up the caches
+   for(int n = 0; n < 100; ++n)
+   {
+      pc.add_measurement(wfs[n % nMeas].data());
+      pc.update_predictor();
+      pc.update_controller();
+      m_sink += pc.get_command(0.1)[0];
+   }
+
+   for(int n = 0; n < m_steps; ++n)
+   {
+      double t0 = predCtrlBenchTime();
+      pc.add_measurement(wfs[n % nMeas].data());
+      double t1 = predCtrlBenchTime();
+      pc.update_predictor();
+      double t2 = predCtrlBenchTime();
+      pc.update_controller();
+      double t3 = predCtrlBenchTime();
+      m_sink += pc.get_command(0.1)[0];
+      double t4 = predCtrlBenchTime();
+
+      latAdd[n] = t1 - t0;
+      latPred[n] = t2 - t1;
+      latCtrl[n] = t3 - t2;
+      latCmd[n] = t4 - t3;
+      latTot[n] = t4 - t0;
+   }
+
+   printf("%d modes, %d measurements, Nhist %d, Nfut %d, %d steps\n", nModes, m_measurements, m_numHist, m_numFut, m_steps);
+   report("add_measurement", latAdd);
+   report("update_predictor", latPred);
+   report("update_controller", latCtrl);
+   report("get_command", latCmd);
+   report("step", latTot);
+   printf("\n");
+}
+
+inline
+void predCtrlBench::report( const std::string & name,
+                            std::vector<double> & lat
+                          )
+{
+   std::sort(lat.begin(), lat.end());
+
+   double mean = 0;
+   for(size_t n=0; n < lat.size(); ++n) mean += lat[n];
+   mean /= lat.size();
+
+   auto pct = [&lat](double p) { return 1e6*lat[ std::min(lat.size()-1, (size_t) (p*lat.size())) ]; };
+
+   printf("   %-17s latency (us):  mean %0.3f  p50 %0.3f  p99 %0.3f  max %0.3f\n", name.c_str(),
+                                 1e6*mean, pct(0.5), pct(0.99), 1e6*lat.back());
+}
+
+#endif //predCtrlBench_hpp
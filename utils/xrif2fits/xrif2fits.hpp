@@ -7,6 +7,18 @@
 #ifndef xrif2fits_hpp
 #define xrif2fits_hpp
 
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
 #include <ImageStruct.h>
 #include <ImageStreamIO.h>
 
@@ -28,6 +40,8 @@ using namespace mx::sys::tsop;
 
 #include "../../libMagAOX/libMagAOX.hpp"
 
+#include "xrif2fitsTable.hpp"
+
 
 
                       
@@ -44,7 +58,7 @@ using namespace mx::sys::tsop;
   * \ingroup xrif2fits
   */
 
-bool g_timeToDie = false;
+std::atomic<bool> g_timeToDie {false};
 
 void sigTermHandler( int signum,
                      siginfo_t *siginf,
@@ -61,8 +75,59 @@ void sigTermHandler( int signum,
    g_timeToDie = true;
 }
 
-/// A utility to stream MagaO-X images from xrif compressed archives to an ImageStreamIO stream.
-/**
+/// An archive in the xrif2fits pipeline, with its own xrif handles.
+/** The slots are used in turn, so archive n is in slot n % (number of slots), and the number of slots bounds the
+  * number of decoded archives in memory.
+  *
+  * \ingroup xrif2fits
+  */
+struct xrif2fitsSlot
+{
+   /// The states of a slot.
+   enum states { available, ///< Waiting for archive m_fileNo to be decoded into it.
+                 decoding,  ///< Archive m_fileNo is being read and decoded.
+                 decoded,   ///< Archive m_fileNo is decoded, and waiting for its meta data.
+                 writing,   ///< The frames of archive m_fileNo are being written.
+                 error      ///< Reading or decoding archive m_fileNo failed, see m_error.
+               };
+
+   xrif_t m_xrif {nullptr};        ///< The image data handle.
+   xrif_t m_xrif_timing {nullptr}; ///< The timing data handle.
+
+   size_t m_fileNo {0};     ///< The archive in this slot, or the next one to be.
+   int m_state {available}; ///< The state of the slot.  Protected by xrif2fits::m_mutex.
+
+   std::string m_details;  ///< The compression details of the archive, printed in order by the main thread.
+   std::string m_error;    ///< The error message, if decoding failed.
+
+   std::vector<std::string> m_outNames;          ///< The output file names, one per frame or one per cube.
+   std::vector<mx::fits::fitsHeader> m_headers;  ///< The header of each frame, if not writing cubes.
+   int m_perCube {0};                            ///< The number of frames in each cube, if writing cubes.
+   xrif2fitsTable m_table;                       ///< The meta data of each frame, if writing cubes with tables.
+
+   std::atomic<int> m_writesLeft {0}; ///< The number of writes of this archive not yet done.
+
+   ~xrif2fitsSlot()
+   {
+      if(m_xrif) xrif_delete(m_xrif);
+      if(m_xrif_timing) xrif_delete(m_xrif_timing);
+   }
+};
+
+/// A utility to convert MagaO-X images from xrif compressed archives to FITS files.
+/** The archives are converted by a pipeline.  A pool of decoding threads read and decode archives into slots, each
+  * with its own xrif handles.  The main thread takes the decoded archives in order, looks up the meta data of each
+  * frame in the logs, and writes the meta data file.  A pool of writing threads then writes the FITS files.  So
+  * reading and decoding, meta data, and writing overlap, while the number of slots bounds the memory used, and the
+  * output is the same as converting one archive at a time.
+  *
+  * The meta data stays on one thread because the log maps load files as they are searched.
+  *
+  * By default each frame is written to its own file, with its meta data in the header.  In cube mode each archive, or
+  * each block of cubeFrames frames, is written as a cube.  With cubeTable the cube is followed by a binary table with
+  * the meta data of each of its frames (see xrif2fitsTable), which keeps the meta data of the per-frame files in a
+  * small fraction of the files and writes.
+  *
   * \todo finish md doc for xrif2fits
   *
   * \ingroup xrif2fits
@@ -78,6 +143,16 @@ protected:
 
    std::vector<std::string> m_files; ///< List of files to use.  If dir is not empty, it will be pre-pended to each name.
 
+   std::string m_streamName; ///< If set, only archives of this stream are used.  Selects archives from the catalog in dir.
+
+   uint64_t m_firstFrame {0}; ///< Only archives with frame numbers of at least this are used.  Selects archives from the catalog in dir.
+
+   uint64_t m_lastFrame {std::numeric_limits<uint64_t>::max()}; ///< Only archives with frame numbers of at most this are used.  Selects archives from the catalog in dir.
+
+   std::string m_startTime; ///< Only archives with frames acquired at or after this UT time are used.  Selects archives from the catalog in dir.
+
+   std::string m_endTime; ///< Only archives with frames acquired at or before this UT time are used.  Selects archives from the catalog in dir.
+
    std::vector<std::string> m_logDir;
 
    std::vector<std::string> m_telDir;
@@ -90,44 +165,101 @@ protected:
    
    bool m_cubeMode {false};
 
+   bool m_cubeTable {false}; ///< If true, each cube is followed by a binary table of the meta data of its frames.  Implies m_cubeMode.
+
+   int m_cubeFrames {0}; ///< The maximum number of frames in each cube.  If 0, the default, each archive is one cube.
+
+   int m_threads {1}; ///< The number of threads reading and decoding archives.
+
+   int m_writeThreads {1}; ///< The number of threads writing FITS files.
+
+   int m_maxArchives {0}; ///< The maximum number of decoded archives in memory.  If 0, the default, this is threads+writeThreads+1.
+
 protected:
    ///@}
 
+   std::vector<std::unique_ptr<xrif2fitsSlot>> m_slots; ///< The pipeline slots.
 
-   xrif_t m_xrif {nullptr};
-   xrif_t m_xrif_timing {nullptr};
+   std::mutex m_mutex; ///< Protects the slot states and the write queue.
 
+   std::condition_variable m_cond; ///< Signaled on each change of a slot state or the write queue.
 
-public:
+   std::atomic<size_t> m_nextDecode {0}; ///< The next archive to be claimed by a decoding thread.
+
+   std::deque<std::pair<xrif2fitsSlot *, int>> m_writeQueue; ///< Files waiting to be written, by slot and index in its m_outNames.
+
+   bool m_writesDone {false}; ///< Set when no more writes will be queued.  Protected by m_mutex.
 
-   ~xrif2fits();
+   std::atomic<bool> m_abort {false}; ///< Set on an error, to stop all threads.
+
+   std::atomic<bool> m_writeError {false}; ///< Set by a writing thread when a FITS file can not be written.
+
+public:
 
    virtual void setupConfig();
 
    virtual void loadConfig();
 
    virtual int execute();
-};
 
-inline
-xrif2fits::~xrif2fits()
-{
-   if(m_xrif)
-   {
-      xrif_delete(m_xrif);
-   }
-   
-   if(m_xrif_timing)
-   {
-      xrif_delete(m_xrif_timing);
-   }
-}
+protected:
+
+   /// Read and decode an archive into a slot.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with the message in the slot's m_error
+     */
+   int decodeArchive( xrif2fitsSlot & slot,       ///< [in/out] the slot to decode into
+                      const std::string & fileName ///< [in] the archive
+                    );
+
+   /// Read and decode an archive of sub-chunks into a slot.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with the message in the slot's m_error
+     */
+   int decodeSubChunks( xrif2fitsSlot & slot,               ///< [in/out] the slot to decode into
+                        MagAOX::sys::xrifArchive & archive ///< [in] the open archive
+                      );
+
+   /// Wait, with the lock held, for a condition, the abort flag, or a signal.
+   /**
+     * \returns true if the condition was met
+     * \returns false if stopped
+     */
+   template<class predT>
+   bool waitFor( std::unique_lock<std::mutex> & lock, ///< [in] a lock on m_mutex
+                 predT pred                          ///< [in] the condition
+               );
+
+   /// Release a slot for the archive which uses it next.  Must be called with m_mutex locked.
+   void releaseSlot( xrif2fitsSlot & slot /**< [in/out] the slot */);
+
+   /// A decoding thread, which claims archives in order and decodes them.
+   void decodeThreadExec();
+
+   /// A writing thread, which writes queued frames.
+   void writeThreadExec();
+
+   /// Select the archives in dir with its catalog, by stream, frame numbers, and acquisition times.
+   /** Archives missing from the catalog are scanned.  Archives which overlap the selection are converted whole.
+     *
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int selectArchives();
+};
 
 inline
 void xrif2fits::setupConfig()
 {
    config.add("dir","d", "dir" , argType::Required, "", "dir", false,  "string", "The directory to search for files.  Can be empty if full path given in files.");
    config.add("files","f", "files" , argType::Required, "", "files", false,  "vector<string>", "List of files to use.  If dir is not empty, it will be pre-pended to each name.");
+   config.add("streamName","", "streamName" , argType::Required, "", "streamName", false,  "string", "If set, only archives of this stream in dir are used, selected with the catalog.");
+   config.add("firstFrame","", "firstFrame" , argType::Required, "", "firstFrame", false,  "int", "Only archives in dir with frame numbers of at least this are used, selected with the catalog.");
+   config.add("lastFrame","", "lastFrame" , argType::Required, "", "lastFrame", false,  "int", "Only archives in dir with frame numbers of at most this are used, selected with the catalog.");
+   config.add("startTime","", "startTime" , argType::Required, "", "startTime", false,  "string", "Only archives in dir with frames acquired at or after this UT time are used, selected with the catalog.  Format is YYYY-MM-DDTHH:MM:SS.SSS or YYYYMMDDHHMMSS.");
+   config.add("endTime","", "endTime" , argType::Required, "", "endTime", false,  "string", "Only archives in dir with frames acquired at or before this UT time are used, selected with the catalog.  Format is YYYY-MM-DDTHH:MM:SS.SSS or YYYYMMDDHHMMSS.");
    config.add("logdir","l", "logdir" , argType::Required, "", "logdir", false,  "vector<string>", "Directory(ies) for log files.");
    config.add("teldir","t", "teldir" , argType::Required, "", "teldir", false,  "vector<string>", "Directory(ies) for telemetry files.");
 
@@ -137,6 +269,12 @@ void xrif2fits::setupConfig()
    
    config.add("noMeta","", "noMeta" , argType::True, "", "noMeta", false,  "bool", "If true, the meta data file is not written (FITS headers will still be).  Default is false.");
    config.add("cubeMode","C", "cubeMode" , argType::True, "", "cubeMode", false,  "bool", "If true, the archive is written as a FITS cube with minimal header.  Default is false.");
+   config.add("cubeTable","T", "cubeTable" , argType::True, "", "cubeTable", false,  "bool", "If true, the archive is written as a FITS cube followed by a binary table extension (FRAMEMETA) with the meta data of each frame.  Implies cubeMode.  Default is false.");
+   config.add("cubeFrames","N", "cubeFrames" , argType::Required, "", "cubeFrames", false,  "int", "The maximum number of frames in each cube.  If 0 each archive is one cube.  Default is 0.");
+
+   config.add("threads","j", "threads" , argType::Required, "", "threads", false,  "int", "The number of threads reading and decoding archives.  Default is 1.");
+   config.add("writeThreads","w", "writeThreads" , argType::Required, "", "writeThreads", false,  "int", "The number of threads writing FITS files.  More than 1 requires a thread-safe cfitsio.  Default is 1.");
+   config.add("maxArchives","", "maxArchives" , argType::Required, "", "maxArchives", false,  "int", "The maximum number of decoded archives in memory.  Default is threads+writeThreads+1.");
 }
 
 inline
@@ -144,12 +282,375 @@ void xrif2fits::loadConfig()
 {
    config(m_dir, "dir");
    config(m_files, "files");
+   config(m_streamName, "streamName");
+   config(m_firstFrame, "firstFrame");
+   config(m_lastFrame, "lastFrame");
+   config(m_startTime, "startTime");
+   config(m_endTime, "endTime");
    config(m_outDir, "outDir");
    config(m_logDir, "logdir");
    config(m_telDir, "teldir");
    config(m_metaOnly, "metaOnly");
    config(m_noMeta, "noMeta");
    config(m_cubeMode, "cubeMode");
+   config(m_cubeTable, "cubeTable");
+   config(m_cubeFrames, "cubeFrames");
+
+   if(m_cubeTable) m_cubeMode = true;
+   config(m_threads, "threads");
+   config(m_writeThreads, "writeThreads");
+   config(m_maxArchives, "maxArchives");
+}
+
+inline
+int xrif2fits::decodeArchive( xrif2fitsSlot & slot,
+                              const std::string & fileName
+                            )
+{
+   char header[XRIF_HEADER_SIZE];
+   xrif_error_t rv;
+
+   xrif_t xrif = slot.m_xrif;
+   xrif_t xrif_timing = slot.m_xrif_timing;
+
+   //Archives of sub-chunks are decoded a sub-chunk at a time
+   {
+      MagAOX::sys::xrifArchive archive;
+      if(archive.open(slot.m_error, fileName) < 0) return -1;
+
+      if(archive.subChunkLength() > 0) return decodeSubChunks(slot, archive);
+   }
+
+   std::ostringstream details;
+
+   FILE * fp_xrif = fopen(fileName.c_str(), "rb");
+   if(fp_xrif == nullptr)
+   {
+      slot.m_error = "Error opening " + fileName + "\n (" + invokedName + "): " + strerror(errno);
+      return -1;
+   }
+
+   size_t nr = fread(header, 1, XRIF_HEADER_SIZE, fp_xrif);
+   if(nr != XRIF_HEADER_SIZE)
+   {
+      slot.m_error = "Error reading header of " + fileName;
+      fclose(fp_xrif);
+      return -1;
+   }
+
+   uint32_t header_size;
+   xrif_read_header(xrif, &header_size , header);
+
+   details << "xrif compression details:\n";
+   details << "  difference method:  " << xrif_difference_method_string(xrif->difference_method) << '\n';
+   details << "  reorder method:     " << xrif_reorder_method_string(xrif->reorder_method) << '\n';
+   details << "  compression method: " << xrif_compress_method_string( xrif->compress_method) << '\n';
+   if(xrif->compress_method == XRIF_COMPRESS_LZ4)
+   {
+      details << "    LZ4 acceleration: " << xrif->lz4_acceleration << '\n';
+   }
+   details << "  dimensions:         " << xrif->width << " x " << xrif->height << " x " << xrif->depth << " x " << xrif->frames << "\n";
+   details << "  raw size:           " << xrif->width*xrif->height*xrif->depth*xrif->frames*xrif->data_size << " bytes\n";
+   details << "  encoded size:       " << xrif->compressed_size << " bytes\n";
+   details << "  ratio:              " << ((double)xrif->compressed_size) / (xrif->width*xrif->height*xrif->depth*xrif->frames*xrif->data_size) << '\n';
+
+   rv = xrif_allocate_raw(xrif); 
+   if( rv != XRIF_NOERROR)
+   {
+      slot.m_error = "Error allocating raw buffer for " + fileName + "\n\t code: " + std::to_string(rv);
+      fclose(fp_xrif);
+      return -1;
+   }
+   
+   rv = xrif_allocate_reordered(xrif); 
+   if(rv != XRIF_NOERROR)
+   {
+      slot.m_error = "Error allocating reordered buffer for " + fileName + "\n\t code: " + std::to_string(rv);
+      fclose(fp_xrif);
+      return -1;
+   }
+
+   nr = fread(xrif->raw_buffer, 1, xrif->compressed_size, fp_xrif);
+   
+   if(nr != xrif->compressed_size)
+   {
+      slot.m_error = "Error reading data from " + fileName;
+      fclose(fp_xrif);
+      return -1;
+   }
+
+   //Now get timing data
+   nr = fread(header, 1, XRIF_HEADER_SIZE, fp_xrif);
+   if(nr != XRIF_HEADER_SIZE)
+   {
+      slot.m_error = "Error reading timing header of " + fileName;
+      fclose(fp_xrif);
+      return -1;
+   }
+   
+   xrif_read_header(xrif_timing, &header_size , header);
+   
+   details << "xrif timing data compression details:\n";
+   details << "  difference method:  " << xrif_difference_method_string(xrif_timing->difference_method) << '\n';
+   details << "  reorder method:     " << xrif_reorder_method_string(xrif_timing->reorder_method) << '\n';
+   details << "  compression method: " << xrif_compress_method_string( xrif_timing->compress_method) << '\n';
+   if(xrif_timing->compress_method == XRIF_COMPRESS_LZ4)
+   {
+      details << "    LZ4 acceleration: " << xrif_timing->lz4_acceleration << '\n';
+   }
+   details << "  dimensions:         " << xrif_timing->width << " x " << xrif_timing->height << " x " << xrif_timing->depth << " x " << xrif_timing->frames << "\n";
+   details << "  raw size:           " << xrif_timing->width*xrif_timing->height*xrif_timing->depth*xrif_timing->frames*xrif_timing->data_size << " bytes\n";
+   details << "  encoded size:       " << xrif_timing->compressed_size << " bytes\n";
+   details << "  ratio:              " << ((double)xrif_timing->compressed_size) / (xrif_timing->width*xrif_timing->height*xrif_timing->depth*xrif_timing->frames*xrif_timing->data_size) << '\n';
+   
+   slot.m_details = details.str();
+
+   rv = xrif_allocate_raw(xrif_timing);
+   if(rv != XRIF_NOERROR)
+   {
+      slot.m_error = "Error allocating raw buffer for timing data from " + fileName + "\n\t code: " + std::to_string(rv);
+      fclose(fp_xrif);
+      return -1;
+   }
+   
+   rv = xrif_allocate_reordered(xrif_timing);
+   if(rv != XRIF_NOERROR)
+   {
+      slot.m_error = "Error allocating reordered buffer for  timing data from " + fileName + "\n\t code: " + std::to_string(rv);
+      fclose(fp_xrif);
+      return -1;
+   }
+   
+   nr = fread(xrif_timing->raw_buffer, 1, xrif_timing->compressed_size, fp_xrif);
+ 
+   if(nr != xrif_timing->compressed_size)
+   {
+      slot.m_error = "Error reading timing data from " + fileName;
+      fclose(fp_xrif);
+      return -1;
+   }
+   
+   fclose(fp_xrif);
+
+   if(g_timeToDie == true || m_abort) return 0; //check after the long read.
+
+   if(!m_metaOnly)
+   {
+      rv = xrif_decode(xrif);
+      if(rv != XRIF_NOERROR)
+      {
+         slot.m_error = "Error decoding image data from " + fileName + "\n\t code: " + std::to_string(rv);
+         return -1;
+      }
+   }
+   
+   rv = xrif_decode(xrif_timing); 
+   if(rv != XRIF_NOERROR)
+   {
+      slot.m_error = "Error decoding timing data from " + fileName + "\n\t code: " + std::to_string(rv);
+      return -1;
+   }
+
+   return 0;
+}
+
+inline
+int xrif2fits::decodeSubChunks( xrif2fitsSlot & slot,
+                                MagAOX::sys::xrifArchive & archive
+                              )
+{
+   xrif_t xrif = slot.m_xrif;
+   xrif_t xrif_timing = slot.m_xrif_timing;
+
+   uint64_t frames = archive.frames();
+   size_t rawSize = frames*archive.width()*archive.height()*xrif_typesize(archive.typeCode());
+
+   std::ostringstream details;
+   details << "xrif archive of " << archive.blocks().size() << " sub-chunks of up to " << archive.subChunkLength() << " frames:\n";
+   details << "  dimensions:         " << archive.width() << " x " << archive.height() << " x 1 x " << frames << "\n";
+   details << "  raw size:           " << rawSize << " bytes\n";
+   details << "  encoded size:       " << archive.compressedSize() << " bytes\n";
+   details << "  ratio:              " << ((double) archive.compressedSize()) / rawSize << '\n';
+
+   slot.m_details = details.str();
+
+   //Size the handles for the whole archive, to hold the frames as if decoded from one block
+   xrif_error_t rv = xrif_set_size(xrif, archive.width(), archive.height(), 1, frames, archive.typeCode());
+   if(rv == XRIF_NOERROR) rv = xrif_allocate_raw(xrif);
+   if(rv != XRIF_NOERROR)
+   {
+      slot.m_error = "Error allocating raw buffer for " + archive.path() + "\n\t code: " + std::to_string(rv);
+      return -1;
+   }
+
+   rv = xrif_set_size(xrif_timing, 5, 1, 1, frames, XRIF_TYPECODE_UINT64);
+   if(rv == XRIF_NOERROR) rv = xrif_allocate_raw(xrif_timing);
+   if(rv != XRIF_NOERROR)
+   {
+      slot.m_error = "Error allocating raw buffer for timing data from " + archive.path() + "\n\t code: " + std::to_string(rv);
+      return -1;
+   }
+
+   if(archive.read(slot.m_error, m_metaOnly ? nullptr : xrif->raw_buffer, reinterpret_cast<uint64_t *>(xrif_timing->raw_buffer), 0, frames) < 0)
+   {
+      return -1;
+   }
+
+   return 0;
+}
+
+template<class predT>
+bool xrif2fits::waitFor( std::unique_lock<std::mutex> & lock,
+                         predT pred
+                       )
+{
+   //The signal handler can't notify, so wake up to check for it.
+   while(!pred())
+   {
+      if(g_timeToDie == true || m_abort) return false;
+      m_cond.wait_for(lock, std::chrono::milliseconds(100));
+   }
+
+   return true;
+}
+
+inline
+int xrif2fits::selectArchives()
+{
+   timespec start = {0,0};
+   timespec end = {std::numeric_limits<time_t>::max(), 0};
+
+   if(m_startTime != "" && MagAOX::sys::xrifCatalog::parseTime(start, m_startTime) < 0)
+   {
+      std::cerr << " (" << invokedName << "): invalid startTime: " << m_startTime << "\n";
+      return -1;
+   }
+
+   if(m_endTime != "" && MagAOX::sys::xrifCatalog::parseTime(end, m_endTime) < 0)
+   {
+      std::cerr << " (" << invokedName << "): invalid endTime: " << m_endTime << "\n";
+      return -1;
+   }
+
+   //Only the archives missing from the catalog are opened.
+   MagAOX::sys::xrifCatalog catalog;
+   std::vector<std::string> errMsgs;
+   catalog.rebuild(errMsgs, m_dir, true);
+
+   for(size_t n=0; n < errMsgs.size(); ++n)
+   {
+      std::cerr << " (" << invokedName << "): " << errMsgs[n] << "\n";
+   }
+
+   //Save the archives just scanned, so the next run doesn't scan them again.  Failure only costs that scan.
+   if(catalog.added() > 0 && catalog.save() < 0)
+   {
+      std::cerr << " (" << invokedName << "): error writing " << MagAOX::sys::xrifCatalog::catalogPath(catalog.dir());
+      std::cerr << ": " << strerror(errno) << "\n";
+   }
+
+   std::vector<size_t> idx = catalog.select(m_streamName, m_firstFrame, m_lastFrame, start, end);
+
+   m_files.clear();
+   for(size_t n=0; n < idx.size(); ++n)
+   {
+      m_files.push_back(catalog.path(idx[n]));
+   }
+
+   return 0;
+}
+
+inline
+void xrif2fits::releaseSlot( xrif2fitsSlot & slot )
+{
+   slot.m_fileNo += m_slots.size();
+   slot.m_state = xrif2fitsSlot::available;
+   m_cond.notify_all();
+}
+
+inline
+void xrif2fits::decodeThreadExec()
+{
+   while(g_timeToDie == false && !m_abort)
+   {
+      size_t n = m_nextDecode++;
+      if(n >= m_files.size()) return;
+
+      xrif2fitsSlot & slot = *m_slots[n % m_slots.size()];
+
+      {
+         std::unique_lock<std::mutex> lock(m_mutex);
+         if(!waitFor(lock, [&]{ return slot.m_state == xrif2fitsSlot::available && slot.m_fileNo == n; })) return;
+         slot.m_state = xrif2fitsSlot::decoding;
+      }
+
+      int rv = decodeArchive(slot, m_files[n]);
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      slot.m_state = (rv < 0) ? xrif2fitsSlot::error : xrif2fitsSlot::decoded;
+      m_cond.notify_all();
+   }
+}
+
+inline
+void xrif2fits::writeThreadExec()
+{
+   while(true)
+   {
+      std::pair<xrif2fitsSlot *, int> job;
+
+      {
+         std::unique_lock<std::mutex> lock(m_mutex);
+         if(!waitFor(lock, [&]{ return m_writeQueue.size() > 0 || m_writesDone; })) return;
+         if(m_writeQueue.size() == 0) return; //done
+
+         job = m_writeQueue.front();
+         m_writeQueue.pop_front();
+      }
+
+      xrif2fitsSlot & slot = *job.first;
+      int q = job.second;
+
+      int frames = slot.m_xrif->frames;
+      unsigned short * raw = (unsigned short*) slot.m_xrif->raw_buffer;
+
+      mx::fits::fitsFile<unsigned short> ff;
+
+      int rv;
+      std::string errMsg;
+      if(m_cubeMode)
+      {
+         int first = q*slot.m_perCube;
+         int count = std::min(slot.m_perCube, frames - first);
+
+         mx::improc::eigenCube<unsigned short> tmpc( raw + first*slot.m_xrif->width*slot.m_xrif->height, slot.m_xrif->width, slot.m_xrif->height, count);
+         rv = ff.write(slot.m_outNames[q], tmpc);
+
+         if(rv >= 0 && m_cubeTable)
+         {
+            rv = slot.m_table.write(errMsg, slot.m_outNames[q], first, count);
+         }
+      }
+      else
+      {
+         mx::improc::eigenCube<unsigned short> tmpc( raw, slot.m_xrif->width, slot.m_xrif->height, frames);
+         rv = ff.write(slot.m_outNames[q], tmpc.image(q), slot.m_headers[q]);
+      }
+
+      if(rv < 0)
+      {
+         std::cerr << " (" << invokedName << "): Error writing " << slot.m_outNames[q] << "\n";
+         if(errMsg != "") std::cerr << " (" << invokedName << "): " << errMsg << "\n";
+         m_writeError = true;
+         m_abort = true;
+      }
+
+      if(--slot.m_writesLeft == 0)
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         releaseSlot(slot);
+      }
+   }
 }
 
 inline
@@ -193,7 +694,17 @@ int xrif2fits::execute()
          m_dir = "./";
       }
 
-      m_files =  mx::ioutils::getFileNames( m_dir, "", "", ".xrif");
+      bool selecting = (m_streamName != "" || m_firstFrame != 0 || m_lastFrame != std::numeric_limits<uint64_t>::max() ||
+                                                                           m_startTime != "" || m_endTime != "");
+
+      if(selecting)
+      {
+         if(selectArchives() < 0) return -1;
+      }
+      else
+      {
+         m_files =  mx::ioutils::getFileNames( m_dir, "", "", ".xrif");
+      }
    }
    else
    {
@@ -226,26 +737,34 @@ int xrif2fits::execute()
       mkdir(m_outDir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
    }
    
-   xrif_error_t rv;
-   rv = xrif_new(&m_xrif);
+   if(m_threads < 1) m_threads = 1;
+   if(m_writeThreads < 1) m_writeThreads = 1;
+   if(m_maxArchives < 1) m_maxArchives = m_threads + m_writeThreads + 1;
 
-   if(rv < 0)
+   //Each slot has its own handles, so the decoding threads don't share them.
+   xrif_error_t rv;
+   m_slots.resize(m_maxArchives);
+   for(size_t k=0; k < m_slots.size(); ++k)
    {
-      std::cerr << " (" << invokedName << "): Error allocating xrif.\n";
-      return -1;
-   }
+      m_slots[k].reset(new xrif2fitsSlot);
+      m_slots[k]->m_fileNo = k;
 
-   rv = xrif_new(&m_xrif_timing);
+      rv = xrif_new(&m_slots[k]->m_xrif);
 
-   if(rv < 0)
-   {
-      std::cerr << " (" << invokedName << "): Error allocating xrif_timing.\n";
-      return -1;
-   }
-   
-   char header[XRIF_HEADER_SIZE];
+      if(rv < 0)
+      {
+         std::cerr << " (" << invokedName << "): Error allocating xrif.\n";
+         return -1;
+      }
 
-   
+      rv = xrif_new(&m_slots[k]->m_xrif_timing);
+
+      if(rv < 0)
+      {
+         std::cerr << " (" << invokedName << "): Error allocating xrif_timing.\n";
+         return -1;
+      }
+   }
       
    std::vector<logMeta> logMetas;
    logMetas.push_back(logMetaSpec({"tcsi", telem_telcat::eventCode, "catObj"}));
@@ -299,11 +818,33 @@ int xrif2fits::execute()
       metaOut << "\n";
    }
       
-   //Now de-compress and load the frames
-   //Only decompressing the number of files needed, and only copying the number of frames needed
+   //Start the pipeline
+   std::vector<std::thread> decodeThreads;
+   std::vector<std::thread> writeThreads;
+
+   for(int k=0; k < m_threads; ++k)
+   {
+      decodeThreads.push_back(std::thread(&xrif2fits::decodeThreadExec, this));
+   }
+
+   for(int k=0; k < m_writeThreads; ++k)
+   {
+      writeThreads.push_back(std::thread(&xrif2fits::writeThreadExec, this));
+   }
+
+   int result = 0;
+
+   //Now get the meta data of each archive in order, while the threads decode and write the others.
    for(size_t n=0; n < m_files.size(); ++n)
    {
-      if(g_timeToDie == true) break; //check before going on
+      if(g_timeToDie == true || m_abort) break; //check before going on
+
+      xrif2fitsSlot & slot = *m_slots[n % m_slots.size()];
+
+      {
+         std::unique_lock<std::mutex> lock(m_mutex);
+         if(!waitFor(lock, [&]{ return slot.m_fileNo == n && (slot.m_state == xrif2fitsSlot::decoded || slot.m_state == xrif2fitsSlot::error); })) break;
+      }
 
       logFileName lfn(m_files[n]);
       
@@ -316,157 +857,68 @@ int xrif2fits::execute()
       std::cout << "* xrif2fits: decoding for " << lfn.appName() << " (" + m_files[n] << ")\n";
       std::cout << "******************************************************\n";
       
-      FILE * fp_xrif = fopen(m_files[n].c_str(), "rb");
-      if(fp_xrif == nullptr)
-      {
-         std::cerr << " (" << invokedName << "): Error opening " << m_files[n] << "\n";
-         std::cerr << " (" << invokedName << "): " << strerror(errno) << "\n";
-         return -1;
-      }
+      std::cout << slot.m_details;
 
-      size_t nr = fread(header, 1, XRIF_HEADER_SIZE, fp_xrif);
-      if(nr != XRIF_HEADER_SIZE)
+      if(slot.m_state == xrif2fitsSlot::error)
       {
-         std::cerr << " (" << invokedName << "): Error reading header of " << m_files[n] << "\n";
-         fclose(fp_xrif);
-         return -1;
+         std::cerr << " (" << invokedName << "): " << slot.m_error << "\n";
+         m_abort = true;
+         result = -1;
+         break;
       }
 
-      uint32_t header_size;
-      xrif_read_header(m_xrif, &header_size , header);
+      if(g_timeToDie == true) break; //check after the decompress.
 
-      std::cout << "xrif compression details:\n";
-      std::cout << "  difference method:  " << xrif_difference_method_string(m_xrif->difference_method) << '\n';
-      std::cout << "  reorder method:     " << xrif_reorder_method_string(m_xrif->reorder_method) << '\n';
-      std::cout << "  compression method: " << xrif_compress_method_string( m_xrif->compress_method) << '\n';
-      if(m_xrif->compress_method == XRIF_COMPRESS_LZ4)
-      {
-         std::cout << "    LZ4 acceleration: " << m_xrif->lz4_acceleration << '\n';
-      }
-      std::cout << "  dimensions:         " << m_xrif->width << " x " << m_xrif->height << " x " << m_xrif->depth << " x " << m_xrif->frames << "\n";
-      std::cout << "  raw size:           " << m_xrif->width*m_xrif->height*m_xrif->depth*m_xrif->frames*m_xrif->data_size << " bytes\n";
-      std::cout << "  encoded size:       " << m_xrif->compressed_size << " bytes\n";
-      std::cout << "  ratio:              " << ((double)m_xrif->compressed_size) / (m_xrif->width*m_xrif->height*m_xrif->depth*m_xrif->frames*m_xrif->data_size) << '\n';
+      int frames = slot.m_xrif->frames;
 
-      rv = xrif_allocate_raw(m_xrif); 
-      if( rv != XRIF_NOERROR)
-      {
-         std::cerr << " (" << invokedName << "): Error allocating raw buffer for " << m_files[n] << "\n";
-         std::cerr << "\t code: " << rv << "\n";
-         return -1;
-      }
-      
-      rv = xrif_allocate_reordered(m_xrif); 
-      if(rv != XRIF_NOERROR)
-      {
-         std::cerr << " (" << invokedName << "): Error allocating reordered buffer for " << m_files[n] << "\n";
-         std::cerr << "\t code: " << rv << "\n";
-         return -1;
-      }
+      slot.m_headers.resize(frames);
 
-      nr = fread(m_xrif->raw_buffer, 1, m_xrif->compressed_size, fp_xrif);
-      
-      if(nr != m_xrif->compressed_size)
-      {
-         std::cerr << " (" << invokedName << "): Error reading data from " << m_files[n] << "\n";
-         return -1;
-      }
-
-      
-      //Now get timing data
-      nr = fread(header, 1, XRIF_HEADER_SIZE, fp_xrif);
-      if(nr != XRIF_HEADER_SIZE)
-      {
-         std::cerr << " (" << invokedName << "): Error reading timing header of " << m_files[n] << "\n";
-         fclose(fp_xrif);
-         return -1;
-      }
-      
-      xrif_read_header(m_xrif_timing, &header_size , header);
-      
-      std::cout << "xrif timing data compression details:\n";
-      std::cout << "  difference method:  " << xrif_difference_method_string(m_xrif_timing->difference_method) << '\n';
-      std::cout << "  reorder method:     " << xrif_reorder_method_string(m_xrif_timing->reorder_method) << '\n';
-      std::cout << "  compression method: " << xrif_compress_method_string( m_xrif_timing->compress_method) << '\n';
-      if(m_xrif_timing->compress_method == XRIF_COMPRESS_LZ4)
-      {
-         std::cout << "    LZ4 acceleration: " << m_xrif_timing->lz4_acceleration << '\n';
-      }
-      std::cout << "  dimensions:         " << m_xrif_timing->width << " x " << m_xrif_timing->height << " x " << m_xrif_timing->depth << " x " << m_xrif_timing->frames << "\n";
-      std::cout << "  raw size:           " << m_xrif_timing->width*m_xrif_timing->height*m_xrif_timing->depth*m_xrif_timing->frames*m_xrif_timing->data_size << " bytes\n";
-      std::cout << "  encoded size:       " << m_xrif_timing->compressed_size << " bytes\n";
-      std::cout << "  ratio:              " << ((double)m_xrif_timing->compressed_size) / (m_xrif_timing->width*m_xrif_timing->height*m_xrif_timing->depth*m_xrif_timing->frames*m_xrif_timing->data_size) << '\n';
-      
-      rv = xrif_allocate_raw(m_xrif_timing);
-      if(rv != XRIF_NOERROR)
-      {
-         std::cerr << " (" << invokedName << "): Error allocating raw buffer for timing data from " << m_files[n] << "\n";
-         std::cerr << "\t code: " << rv << "\n";
-         return -1;
-      }
-      
-      rv = xrif_allocate_reordered(m_xrif_timing);
-      if(rv != XRIF_NOERROR)
-      {
-         std::cerr << " (" << invokedName << "): Error allocating reordered buffer for  timing data from " << m_files[n] << "\n";
-         std::cerr << "\t code: " << rv << "\n";
-         return -1;
-      }
-      
-      nr = fread(m_xrif_timing->raw_buffer, 1, m_xrif_timing->compressed_size, fp_xrif);
-    
-      if(nr != m_xrif_timing->compressed_size)
+      if(m_cubeMode)
       {
-         std::cerr << " (" << invokedName << "): Error reading timing data from " << m_files[n] << "\n";
-         return -1;
-      }
-      
-      fclose(fp_xrif);
+         slot.m_perCube = (m_cubeFrames > 0 && m_cubeFrames < frames) ? m_cubeFrames : frames;
 
-      if(g_timeToDie == true) break; //check after the long read.
+         size_t nCubes = (frames > 0) ? (frames + slot.m_perCube - 1) / slot.m_perCube : 0;
+         slot.m_outNames.resize(nCubes);
 
-      if(!m_metaOnly)
-      {
-         rv = xrif_decode(m_xrif);
-         if(rv != XRIF_NOERROR)
+         if(nCubes == 1)
          {
-            std::cerr << " (" << invokedName << "): Error decoding image data from " << m_files[n] << "\n";
-            std::cerr << "\t code: " << rv << "\n";
-            return -1;
+            slot.m_outNames[0] = m_outDir + mx::ioutils::pathStem(m_files[n]) + ".fits";
+         }
+         else
+         {
+            for(size_t k=0; k < nCubes; ++k)
+            {
+               char str[32];
+               snprintf(str, sizeof(str), "_%04zu", k);
+               slot.m_outNames[k] = m_outDir + mx::ioutils::pathStem(m_files[n]) + str + ".fits";
+            }
          }
       }
-      
-      rv = xrif_decode(m_xrif_timing); 
-      if(rv != XRIF_NOERROR)
+      else
       {
-         std::cerr << " (" << invokedName << "): Error decoding timing data from " << m_files[n] << "\n";
-         std::cerr << "\t code: " << rv << "\n";
-         return -1;
+         slot.m_outNames.resize(frames);
       }
-               
-      if(g_timeToDie == true) break; //check after the decompress.
-
-      mx::improc::eigenCube<unsigned short> tmpc( (unsigned short*) m_xrif->raw_buffer, m_xrif->width, m_xrif->height, m_xrif->frames);
 
-      mx::fits::fitsFile<unsigned short> ff;
-      mx::fits::fitsHeader fh;
-      
-      if(m_cubeMode)
+      if(m_cubeTable)
       {
-         std::string outfname = m_outDir + mx::ioutils::pathStem(m_files[n]) + ".fits";
-         ff.write(outfname, tmpc);
+         slot.m_table.resize(frames, logMetas.size());
+         for(size_t u=0;u<logMetas.size();++u)
+         {
+            slot.m_table.m_keywords[u] = logMetas[u].keyword();
+         }
       }
-      else
-      {
 
-      for( int q=0; q < tmpc.planes(); ++q)
+      //Plain cubes have no meta data
+      if(!m_cubeMode || m_cubeTable)
+      {
+      for( int q=0; q < frames; ++q)
       {
          uint64_t cnt0;
          timespec atime; //This is the acquisition time of the exposure
          timespec wtime;
          timespec stime = {0,0}; //This is the start time of the exposure, calculated as atime-exptime.
       
-         uint64_t * curr_timing = (uint64_t*) m_xrif_timing->raw_buffer + 5*q;
+         uint64_t * curr_timing = (uint64_t*) slot.m_xrif_timing->raw_buffer + 5*q;
          
          cnt0 = curr_timing[0];
          atime.tv_sec = curr_timing[1];
@@ -500,20 +952,34 @@ int xrif2fits::execute()
 
          //timespecX midexp = mx::meanTimespec( atime, stime);
          
-         std::string timestamp;
-         mx::sys::timeStamp(timestamp, atime);
-         std::string outfname = m_outDir + lfn.appName() + "_" + timestamp + ".fits";
-
-         fh.clear();
-         
          std::string dateobs = mx::sys::ISO8601DateTimeStr(atime, 1);
          
-         fh.append("DATE-OBS", dateobs, "Date of obs. YYYY-mm-ddTHH:MM:SS");
-         fh.append("FRAMENO", cnt0);
-         fh.append("ACQSEC", atime.tv_sec);
-         fh.append("ACQNSEC", atime.tv_nsec);
-         fh.append("WRTSEC", wtime.tv_sec);
-         fh.append("WRTNSEC", wtime.tv_nsec);
+         mx::fits::fitsHeader & fh = slot.m_headers[q];
+         fh.clear();
+
+         if(!m_cubeMode)
+         {
+            std::string timestamp;
+            mx::sys::timeStamp(timestamp, atime);
+            slot.m_outNames[q] = m_outDir + lfn.appName() + "_" + timestamp + ".fits";
+
+            fh.append("DATE-OBS", dateobs, "Date of obs. YYYY-mm-ddTHH:MM:SS");
+            fh.append("FRAMENO", cnt0);
+            fh.append("ACQSEC", atime.tv_sec);
+            fh.append("ACQNSEC", atime.tv_nsec);
+            fh.append("WRTSEC", wtime.tv_sec);
+            fh.append("WRTNSEC", wtime.tv_nsec);
+         }
+
+         if(m_cubeTable)
+         {
+            slot.m_table.m_dateObs[q] = dateobs;
+            slot.m_table.m_cnt0[q] = cnt0;
+            slot.m_table.m_acqSec[q] = atime.tv_sec;
+            slot.m_table.m_acqNSec[q] = atime.tv_nsec;
+            slot.m_table.m_wrtSec[q] = wtime.tv_sec;
+            slot.m_table.m_wrtNSec[q] = wtime.tv_nsec;
+         }
 
          if(!m_noMeta)
          {
@@ -523,52 +989,68 @@ int xrif2fits::execute()
          if(exptime > -1)
          {
             //First output exposure time
-            fh.append(exptimeMeta.card(tels,stime,atime));
+            if(!m_cubeMode) fh.append(exptimeMeta.card(tels,stime,atime));
             if(!m_noMeta) metaOut << exptimeMeta.value(tels, stime, atime);
+            if(m_cubeTable) slot.m_table.m_exptime[q] = exptime;
 
             //Then output each value in turn
             for(size_t u=0;u<logMetas.size();++u)
             {
-               fh.append(logMetas[u].card(tels, stime, atime));
-               if(!m_noMeta) metaOut << " " << logMetas[u].value(tels, stime, atime) ;
+               if(!m_cubeMode) fh.append(logMetas[u].card(tels, stime, atime));
+
+               if(!m_noMeta || m_cubeTable)
+               {
+                  std::string value = logMetas[u].value(tels, stime, atime);
+                  if(!m_noMeta) metaOut << " " << value;
+                  if(m_cubeTable) slot.m_table.m_values[u][q] = value;
+               }
             }
          }
          
 
          if(!m_noMeta) metaOut << "\n";
+      }
+      }
 
+      //Hand the frames to the writing threads, which release the slot when done
+      std::lock_guard<std::mutex> lock(m_mutex);
 
-         if(!m_metaOnly)
+      if(m_metaOnly || slot.m_outNames.size() == 0)
+      {
+         releaseSlot(slot);
+      }
+      else
+      {
+         slot.m_state = xrif2fitsSlot::writing;
+         slot.m_writesLeft = slot.m_outNames.size();
+         for(size_t q=0; q < slot.m_outNames.size(); ++q)
          {
-            mx::improc::eigenImage<unsigned short> im = tmpc.image(q);
-            ff.write(outfname, tmpc.image(q), fh);
+            m_writeQueue.push_back({&slot, static_cast<int>(q)});
          }
-
       }
-      
-      //Below is for cubes
-      /*
-      outname = m_files[n];
-      ext = outname.find(".xrif");
-      outname.replace( ext, 5, ".time");
-      
-      std::ofstream fout;
-      fout.open(outname);
-      fout << "#cnt0   atime-sec  atime-nsec wtime-sec  wtime-nsec\n";
-      for(int i=0; i< tmpc.planes(); ++i)
-      {
-         uint64_t * curr_timing = (uint64_t*) m_xrif_timing->raw_buffer + 5*i;
-         
-         fout << curr_timing[0] << " " << curr_timing[1] << " " << curr_timing[2] << "  " << curr_timing[3] << " " << curr_timing[4] << "\n";
-      }*/
+      m_cond.notify_all();
    }
 
+   //Let the writing threads finish the queue, then stop everything.
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_writesDone = true;
+      m_cond.notify_all();
    }
+
+   for(size_t k=0; k < writeThreads.size(); ++k) writeThreads[k].join();
+
+   m_abort = true;
+   for(size_t k=0; k < decodeThreads.size(); ++k) decodeThreads[k].join();
+
    if(!m_noMeta) metaOut.close();
    
+   if(m_writeError) result = -1;
+
+   if(result < 0) return result;
+
    std::cerr << " (" << invokedName << "): exited normally.\n";
 
-   
    return 0;
 }
 
@@ -0,0 +1,161 @@
+/** \file xrif2fitsTable.hpp
+  * \brief The per-frame meta data binary table written with xrif2fits cubes.
+  *
+  * \ingroup xrif2fits_files
+  */
+
+#ifndef xrif2fitsTable_hpp
+#define xrif2fitsTable_hpp
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <fitsio.h>
+
+/// The meta data of each frame of an archive, written as a binary table extension after a cube.
+/** The table has one row per frame of the cube, with the columns DATE-OBS, FRAMENO, ACQSEC, ACQNSEC, WRTSEC, WRTNSEC,
+  * and EXPTIME, followed by a string column for each log meta data keyword.  These are the values written to the
+  * per-frame FITS headers and the meta data file.  EXPTIME is NaN, and the keyword values empty, for frames without
+  * an exposure time in the telemetry.
+  *
+  * \ingroup xrif2fits
+  */
+struct xrif2fitsTable
+{
+   std::vector<std::string> m_keywords; ///< The log meta data keywords, one column each.
+
+   std::vector<std::string> m_dateObs; ///< The DATE-OBS of each frame.
+   std::vector<int64_t> m_cnt0;        ///< The frame number of each frame.
+   std::vector<int64_t> m_acqSec;      ///< The acquisition time of each frame, seconds.
+   std::vector<int64_t> m_acqNSec;     ///< The acquisition time of each frame, nanoseconds.
+   std::vector<int64_t> m_wrtSec;      ///< The write time of each frame, seconds.
+   std::vector<int64_t> m_wrtNSec;     ///< The write time of each frame, nanoseconds.
+   std::vector<double> m_exptime;      ///< The exposure time of each frame, NaN if unknown.
+
+   std::vector<std::vector<std::string>> m_values; ///< The value of each keyword, by keyword then frame.
+
+   /// Size the table, clearing the values.
+   void resize( size_t frames,  ///< [in] the number of frames
+                size_t keywords ///< [in] the number of log meta data keywords
+              )
+   {
+      m_keywords.resize(keywords);
+
+      m_dateObs.assign(frames, "");
+      m_cnt0.assign(frames, 0);
+      m_acqSec.assign(frames, 0);
+      m_acqNSec.assign(frames, 0);
+      m_wrtSec.assign(frames, 0);
+      m_wrtNSec.assign(frames, 0);
+      m_exptime.assign(frames, std::nan(""));
+
+      m_values.resize(keywords);
+      for(size_t u=0; u < keywords; ++u) m_values[u].assign(frames, "");
+   }
+
+   /// Append the rows of a range of frames to a FITS file as a binary table extension named FRAMEMETA.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with the cfitsio message in errMsg
+     */
+   int write( std::string & errMsg,          ///< [out] the error message, if any
+              const std::string & fileName, ///< [in] the FITS file, which must exist
+              size_t first,                 ///< [in] the first frame
+              size_t count                  ///< [in] the number of frames
+            ) const
+   {
+      size_t ncols = 7 + m_keywords.size();
+
+      std::vector<std::string> ttype = {"DATE-OBS", "FRAMENO", "ACQSEC", "ACQNSEC", "WRTSEC", "WRTNSEC", "EXPTIME"};
+      std::vector<std::string> tform = {strForm(m_dateObs, first, count), "1K", "1K", "1K", "1K", "1K", "1D"};
+      std::vector<std::string> tunit = {"", "", "s", "ns", "s", "ns", "s"};
+
+      for(size_t u=0; u < m_keywords.size(); ++u)
+      {
+         ttype.push_back(m_keywords[u]);
+         tform.push_back(strForm(m_values[u], first, count));
+         tunit.push_back("");
+      }
+
+      std::vector<char *> ttypep(ncols), tformp(ncols), tunitp(ncols);
+      for(size_t c=0; c < ncols; ++c)
+      {
+         ttypep[c] = const_cast<char *>(ttype[c].c_str());
+         tformp[c] = const_cast<char *>(tform[c].c_str());
+         tunitp[c] = const_cast<char *>(tunit[c].c_str());
+      }
+
+      int status = 0;
+      fitsfile * fptr = nullptr;
+
+      fits_open_file(&fptr, fileName.c_str(), READWRITE, &status);
+
+      fits_create_tbl(fptr, BINARY_TBL, count, ncols, ttypep.data(), tformp.data(), tunitp.data(), "FRAMEMETA", &status);
+
+      strColumn(fptr, 1, m_dateObs, first, count, &status);
+      fits_write_col(fptr, TLONGLONG, 2, 1, 1, count, const_cast<int64_t *>(m_cnt0.data() + first), &status);
+      fits_write_col(fptr, TLONGLONG, 3, 1, 1, count, const_cast<int64_t *>(m_acqSec.data() + first), &status);
+      fits_write_col(fptr, TLONGLONG, 4, 1, 1, count, const_cast<int64_t *>(m_acqNSec.data() + first), &status);
+      fits_write_col(fptr, TLONGLONG, 5, 1, 1, count, const_cast<int64_t *>(m_wrtSec.data() + first), &status);
+      fits_write_col(fptr, TLONGLONG, 6, 1, 1, count, const_cast<int64_t *>(m_wrtNSec.data() + first), &status);
+      fits_write_col(fptr, TDOUBLE, 7, 1, 1, count, const_cast<double *>(m_exptime.data() + first), &status);
+
+      for(size_t u=0; u < m_keywords.size(); ++u)
+      {
+         strColumn(fptr, 8+u, m_values[u], first, count, &status);
+      }
+
+      if(fptr)
+      {
+         int cstatus = 0;
+         fits_close_file(fptr, &cstatus);
+         if(status == 0) status = cstatus;
+      }
+
+      if(status != 0)
+      {
+         char err[FLEN_STATUS];
+         fits_get_errstatus(status, err);
+         errMsg = err;
+         return -1;
+      }
+
+      return 0;
+   }
+
+protected:
+
+   /// Get the TFORM of a string column, wide enough for its longest value.
+   static std::string strForm( const std::vector<std::string> & col,
+                               size_t first,
+                               size_t count
+                             )
+   {
+      size_t w = 1;
+      for(size_t n=first; n < first+count; ++n)
+      {
+         if(col[n].size() > w) w = col[n].size();
+      }
+
+      return std::to_string(w) + "A";
+   }
+
+   /// Write a string column.
+   static void strColumn( fitsfile * fptr,
+                          int colnum,
+                          const std::vector<std::string> & col,
+                          size_t first,
+                          size_t count,
+                          int * status
+                        )
+   {
+      std::vector<char *> strs(count);
+      for(size_t n=0; n < count; ++n) strs[n] = const_cast<char *>(col[first+n].c_str());
+
+      fits_write_col(fptr, TSTRING, colnum, 1, 1, count, strs.data(), status);
+   }
+};
+
+#endif //xrif2fitsTable_hpp
@@ -0,0 +1,17 @@
+/** \file xrif2h5.cpp
+  * \brief The xrif2h5 main program.
+  *
+  * \ingroup xrif2h5_files
+  */
+
+#include "xrif2h5.hpp"
+
+
+
+int main(int argc, char **argv)
+{
+   xrif2h5 xs;
+
+   return xs.main(argc, argv);
+
+}
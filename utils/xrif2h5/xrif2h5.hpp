@@ -0,0 +1,560 @@
+/** \file xrif2h5.hpp
+  * \brief The xrif2h5 class declaration and definition.
+  *
+  * \ingroup xrif2h5_files
+  */
+
+#ifndef xrif2h5_hpp
+#define xrif2h5_hpp
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <mx/app/application.hpp>
+#include <mx/ioutils/fileUtils.hpp>
+
+#include <mx/sys/timeUtils.hpp>
+using namespace mx::sys::tscomp;
+using namespace mx::sys::tsop;
+
+#include "../../libMagAOX/libMagAOX.hpp"
+
+#include "xrif2h5Writer.hpp"
+
+/** \defgroup xrif2h5 xrif2h5: xrif-archive to HDF5 converter
+  * \brief Read images from xrif archives and write them to chunked, compressed HDF5 datasets
+  *
+  * <a href="../handbook/utils/xrif2h5.html">Utility Documentation</a>
+  *
+  * \ingroup utils
+  *
+  */
+
+/** \defgroup xrif2h5_files xrif2h5 Files
+  * \ingroup xrif2h5
+  */
+
+std::atomic<bool> g_timeToDie {false};
+
+void sigTermHandler( int signum,
+                     siginfo_t *siginf,
+                     void *ucont
+                    )
+{
+   //Suppress those warnings . . .
+   static_cast<void>(signum);
+   static_cast<void>(siginf);
+   static_cast<void>(ucont);
+
+   std::cerr << "\n"; //clear out the ^C char
+
+   g_timeToDie = true;
+}
+
+/// A utility to convert MagAO-X images from xrif compressed archives to an HDF5 file.
+/** All of the selected archives are written to one file, as frames x height x width, with parallel datasets of the
+  * timing and the log meta data of each frame (see xrif2h5Writer).  The archives must all have the same size and type.
+  *
+  * The archives are read one xrif block at a time, a sub-chunk of an archive of sub-chunks or else the whole archive,
+  * and each block is appended to the datasets as a hyperslab before the next is read.  So memory is bounded by one
+  * block regardless of the number of archives.  The image chunks are by default the largest divisor of the largest
+  * xrif block of any archive under maxChunkMB, and a range of frames can be read from the file without decompressing
+  * the rest.
+  *
+  * The chunks line up with the xrif blocks only as long as each archive is a whole number of chunks.  streamWriter
+  * starts a save with a partial archive, and an archive of sub-chunks may end with a partial block, so any archive
+  * which is not a whole number of chunks shifts the chunks of every later archive off its blocks.  Such archives are
+  * noted when the file is written.  Every frame is still written, only the chunk boundaries move.
+  *
+  * The meta data are the same as those of xrif2fits: the exposure time from the camera telemetry, and the values of
+  * the same log keywords, looked up at the start and end of each exposure.
+  *
+  * \ingroup xrif2h5
+  */
+class xrif2h5 : public mx::app::application
+{
+protected:
+   /** \name Configurable Parameters
+     * @{
+     */
+
+   std::string m_dir; ///< The directory to search for files.  Can be empty if full path given in files.  If files is empty, all archives in dir will be used.
+
+   std::vector<std::string> m_files; ///< List of files to use.  If dir is not empty, it will be pre-pended to each name.
+
+   std::string m_streamName; ///< If set, only archives of this stream are used.  Selects archives from the catalog in dir.
+
+   uint64_t m_firstFrame {0}; ///< Only archives with frame numbers of at least this are used.  Selects archives from the catalog in dir.
+
+   uint64_t m_lastFrame {std::numeric_limits<uint64_t>::max()}; ///< Only archives with frame numbers of at most this are used.  Selects archives from the catalog in dir.
+
+   std::string m_startTime; ///< Only archives with frames acquired at or after this UT time are used.  Selects archives from the catalog in dir.
+
+   std::string m_endTime; ///< Only archives with frames acquired at or before this UT time are used.  Selects archives from the catalog in dir.
+
+   std::vector<std::string> m_telDir; ///< Directory(ies) for telemetry files.
+
+   std::string m_outFile; ///< The HDF5 file to write.  If empty, the name of the first archive with extension .h5, in the current directory.
+
+   bool m_noMeta {false}; ///< If true, the /meta datasets are not written, and the logs are not searched.
+
+   uint64_t m_chunkFrames {0}; ///< The number of frames in each image chunk.  If 0, the default, the chunks divide the largest xrif block.
+
+   double m_maxChunkMB {16}; ///< The maximum size of an image chunk sized from the xrif blocks, in MB.
+
+   int m_deflate {1}; ///< The deflate level, 0 to 9.  If 0 the datasets are not compressed.
+
+   ///@}
+
+   std::vector<logMeta> m_logMetas; ///< The log keywords of each frame.
+
+   logMap m_tels; ///< The telemetry logs.
+
+public:
+
+   virtual void setupConfig();
+
+   virtual void loadConfig();
+
+   virtual int execute();
+
+protected:
+
+   /// Select the archives in dir with its catalog, by stream, frame numbers, and acquisition times.
+   /** Archives missing from the catalog are scanned.  Archives which overlap the selection are converted whole.
+     *
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int selectArchives();
+
+   /// Get the meta data of a frame from the logs.
+   /** The return value, rather than a NaN test on exptime, says whether it was found, since this is built with -ffast-math.
+     *
+     * \returns true if the exposure time was found
+     * \returns false otherwise, in which case exptime is NaN
+     */
+   bool frameMeta( double & exptime,                   ///< [out] the exposure time, or NaN if not known
+                   std::vector<std::vector<std::string>> & values, ///< [out] the keyword values, set for frame q
+                   size_t q,                           ///< [in] the index of the frame in values
+                   const std::string & appName,        ///< [in] the camera
+                   const timespec & atime              ///< [in] the acquisition time of the frame
+                 );
+
+   /// Append the frames of an archive to the file, one block at a time.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int appendArchive( xrif2h5Writer & writer,   ///< [in/out] the open writer
+                      const std::string & fileName ///< [in] the archive
+                    );
+};
+
+inline
+void xrif2h5::setupConfig()
+{
+   config.add("dir","d", "dir" , argType::Required, "", "dir", false,  "string", "The directory to search for files.  Can be empty if full path given in files.");
+   config.add("files","f", "files" , argType::Required, "", "files", false,  "vector<string>", "List of files to use.  If dir is not empty, it will be pre-pended to each name.");
+   config.add("streamName","", "streamName" , argType::Required, "", "streamName", false,  "string", "If set, only archives of this stream in dir are used, selected with the catalog.");
+   config.add("firstFrame","", "firstFrame" , argType::Required, "", "firstFrame", false,  "int", "Only archives in dir with frame numbers of at least this are used, selected with the catalog.");
+   config.add("lastFrame","", "lastFrame" , argType::Required, "", "lastFrame", false,  "int", "Only archives in dir with frame numbers of at most this are used, selected with the catalog.");
+   config.add("startTime","", "startTime" , argType::Required, "", "startTime", false,  "string", "Only archives in dir with frames acquired at or after this UT time are used, selected with the catalog.  Format is YYYY-MM-DDTHH:MM:SS.SSS or YYYYMMDDHHMMSS.");
+   config.add("endTime","", "endTime" , argType::Required, "", "endTime", false,  "string", "Only archives in dir with frames acquired at or before this UT time are used, selected with the catalog.  Format is YYYY-MM-DDTHH:MM:SS.SSS or YYYYMMDDHHMMSS.");
+   config.add("teldir","t", "teldir" , argType::Required, "", "teldir", false,  "vector<string>", "Directory(ies) for telemetry files.");
+
+   config.add("outFile","o", "outFile" , argType::Required, "", "outFile", false,  "string", "The HDF5 file to write, replacing any existing file.  Default is the name of the first archive with extension .h5.");
+
+   config.add("noMeta","", "noMeta" , argType::True, "", "noMeta", false,  "bool", "If true, the meta data datasets are not written.  Default is false.");
+
+   config.add("chunkFrames","N", "chunkFrames" , argType::Required, "", "chunkFrames", false,  "int", "The number of frames in each image chunk.  If 0 the chunks divide the largest xrif block of any archive.  Default is 0.");
+   config.add("maxChunkMB","", "maxChunkMB" , argType::Required, "", "maxChunkMB", false,  "real", "The maximum size of an image chunk sized from the xrif blocks, in MB.  Default is 16.");
+   config.add("deflate","z", "deflate" , argType::Required, "", "deflate", false,  "int", "The deflate level, 0 to 9, applied after shuffling.  If 0 the datasets are not compressed.  Default is 1.");
+}
+
+inline
+void xrif2h5::loadConfig()
+{
+   config(m_dir, "dir");
+   config(m_files, "files");
+   config(m_streamName, "streamName");
+   config(m_firstFrame, "firstFrame");
+   config(m_lastFrame, "lastFrame");
+   config(m_startTime, "startTime");
+   config(m_endTime, "endTime");
+   config(m_telDir, "teldir");
+   config(m_outFile, "outFile");
+   config(m_noMeta, "noMeta");
+   config(m_chunkFrames, "chunkFrames");
+   config(m_maxChunkMB, "maxChunkMB");
+   config(m_deflate, "deflate");
+}
+
+inline
+int xrif2h5::selectArchives()
+{
+   timespec start = {0,0};
+   timespec end = {std::numeric_limits<time_t>::max(), 0};
+
+   if(m_startTime != "" && MagAOX::sys::xrifCatalog::parseTime(start, m_startTime) < 0)
+   {
+      std::cerr << " (" << invokedName << "): invalid startTime: " << m_startTime << "\n";
+      return -1;
+   }
+
+   if(m_endTime != "" && MagAOX::sys::xrifCatalog::parseTime(end, m_endTime) < 0)
+   {
+      std::cerr << " (" << invokedName << "): invalid endTime: " << m_endTime << "\n";
+      return -1;
+   }
+
+   //Only the archives missing from the catalog are opened.
+   MagAOX::sys::xrifCatalog catalog;
+   std::vector<std::string> errMsgs;
+   catalog.rebuild(errMsgs, m_dir, true);
+
+   for(size_t n=0; n < errMsgs.size(); ++n)
+   {
+      std::cerr << " (" << invokedName << "): " << errMsgs[n] << "\n";
+   }
+
+   //Save the archives just scanned, so the next run doesn't scan them again.  Failure only costs that scan.
+   if(catalog.added() > 0 && catalog.save() < 0)
+   {
+      std::cerr << " (" << invokedName << "): error writing " << MagAOX::sys::xrifCatalog::catalogPath(catalog.dir());
+      std::cerr << ": " << strerror(errno) << "\n";
+   }
+
+   std::vector<size_t> idx = catalog.select(m_streamName, m_firstFrame, m_lastFrame, start, end);
+
+   m_files.clear();
+   for(size_t n=0; n < idx.size(); ++n)
+   {
+      m_files.push_back(catalog.path(idx[n]));
+   }
+
+   return 0;
+}
+
+inline
+bool xrif2h5::frameMeta( double & exptime,
+                         std::vector<std::vector<std::string>> & values,
+                         size_t q,
+                         const std::string & appName,
+                         const timespec & atime
+                       )
+{
+   exptime = std::numeric_limits<double>::quiet_NaN();
+
+   for(size_t u=0; u < values.size(); ++u) values[u][q] = "";
+
+   //We have to bootstrap the exposure time
+   char * prior = nullptr;
+   m_tels.getPriorLog(prior, appName, eventCodes::TELEM_STDCAM, atime);
+   if(!prior) return false;
+
+   exptime = telem_stdcam::exptime(logHeader::messageBuffer(prior));
+
+   timespec stime = atime-exptime; //This is the start time of the exposure.
+
+   for(size_t u=0; u < m_logMetas.size(); ++u)
+   {
+      values[u][q] = m_logMetas[u].value(m_tels, stime, atime);
+   }
+
+   return true;
+}
+
+inline
+int xrif2h5::appendArchive( xrif2h5Writer & writer,
+                            const std::string & fileName
+                          )
+{
+   std::string errMsg;
+
+   MagAOX::sys::xrifArchive archive;
+   if(archive.open(errMsg, fileName) < 0)
+   {
+      std::cerr << " (" << invokedName << "): " << errMsg << "\n";
+      return -1;
+   }
+
+   logFileName lfn(fileName);
+
+   if(!m_noMeta) m_tels.loadFiles(lfn.appName(), lfn.timestamp());
+
+   std::cout << "* xrif2h5: " << fileName << ": " << archive.frames() << " frames in " << archive.blocks().size() << " blocks\n";
+
+   size_t frameSize = static_cast<size_t>(archive.width())*archive.height()*xrif_typesize(archive.typeCode());
+
+   std::vector<char> images;
+   std::vector<uint64_t> timing;
+   std::vector<double> exptime;
+   std::vector<std::vector<std::string>> values(m_noMeta ? 0 : m_logMetas.size());
+
+   size_t noExptime = 0;
+
+   uint64_t first = 0;
+   for(size_t b=0; b < archive.blocks().size(); ++b)
+   {
+      if(g_timeToDie == true) return 0;
+
+      uint64_t count = archive.blocks()[b].m_frames;
+
+      images.resize(count*frameSize);
+      timing.resize(5*count);
+
+      if(archive.read(errMsg, images.data(), timing.data(), first, count) < 0)
+      {
+         std::cerr << " (" << invokedName << "): " << errMsg << "\n";
+         return -1;
+      }
+
+      if(!m_noMeta)
+      {
+         exptime.resize(count);
+         for(size_t u=0; u < values.size(); ++u) values[u].resize(count);
+
+         for(uint64_t q=0; q < count; ++q)
+         {
+            timespec atime = {static_cast<time_t>(timing[5*q+1]), static_cast<long>(timing[5*q+2])};
+
+            if(!frameMeta(exptime[q], values, q, lfn.appName(), atime)) ++noExptime;
+         }
+      }
+
+      if(writer.append(errMsg, images.data(), timing.data(), count, exptime, values) < 0)
+      {
+         std::cerr << " (" << invokedName << "): error writing " << m_outFile << ": " << errMsg << "\n";
+         return -1;
+      }
+
+      first += count;
+   }
+
+   if(noExptime > 0)
+   {
+      std::cerr << " (" << invokedName << "): no exposure time found for " << noExptime << " frames of " << fileName << "\n";
+   }
+
+   return 0;
+}
+
+inline
+int xrif2h5::execute()
+{
+   //Install signal handling
+   struct sigaction act;
+   sigset_t set;
+
+   act.sa_sigaction = sigTermHandler;
+   act.sa_flags = SA_SIGINFO;
+   sigemptyset(&set);
+   act.sa_mask = set;
+
+   errno = 0;
+   if( sigaction(SIGTERM, &act, 0) < 0 )
+   {
+      std::cerr << " (" << invokedName << "): error setting SIGTERM handler: " << strerror(errno) << "\n";
+      return -1;
+   }
+
+   errno = 0;
+   if( sigaction(SIGQUIT, &act, 0) < 0 )
+   {
+      std::cerr << " (" << invokedName << "): error setting SIGQUIT handler: " << strerror(errno) << "\n";
+      return -1;
+   }
+
+   errno = 0;
+   if( sigaction(SIGINT, &act, 0) < 0 )
+   {
+      std::cerr << " (" << invokedName << "): error setting SIGINT handler: " << strerror(errno) << "\n";
+      return -1;
+   }
+
+   //Figure out which files to use
+   if(m_files.size() == 0)
+   {
+      if(m_dir == "")
+      {
+         m_dir = "./";
+      }
+
+      bool selecting = (m_streamName != "" || m_firstFrame != 0 || m_lastFrame != std::numeric_limits<uint64_t>::max() ||
+                                                                           m_startTime != "" || m_endTime != "");
+
+      if(selecting)
+      {
+         if(selectArchives() < 0) return -1;
+      }
+      else
+      {
+         m_files =  mx::ioutils::getFileNames( m_dir, "", "", ".xrif");
+      }
+   }
+   else
+   {
+      if(m_dir != "")
+      {
+         if(m_dir[m_dir.size()-1] != '/') m_dir += '/';
+      }
+
+      for(size_t n=0; n<m_files.size(); ++n)
+      {
+         m_files[n] = m_dir + m_files[n];
+      }
+   }
+
+   if(m_files.size() == 0)
+   {
+      std::cerr << " (" << invokedName << "): No files found.\n";
+      return -1;
+   }
+
+   if(m_outFile == "") m_outFile = mx::ioutils::pathStem(m_files[0]) + ".h5";
+
+   //The first archive sets the size and type of the datasets, which the others must match.
+   std::string errMsg;
+   uint32_t width = 0, height = 0;
+   int typeCode = 0;
+
+   //The largest xrif block of any archive sets the default chunking, since the first archive of a save may be partial.
+   uint64_t blockFrames = 0;
+   std::vector<uint64_t> archiveFrames(m_files.size());
+
+   for(size_t n=0; n < m_files.size(); ++n)
+   {
+      MagAOX::sys::xrifArchive archive;
+      if(archive.open(errMsg, m_files[n]) < 0)
+      {
+         std::cerr << " (" << invokedName << "): " << errMsg << "\n";
+         return -1;
+      }
+
+      if(archive.depth() != 1)
+      {
+         std::cerr << " (" << invokedName << "): " << m_files[n] << " has depth " << archive.depth() << ", only depth 1 is supported\n";
+         return -1;
+      }
+
+      if(n == 0)
+      {
+         width = archive.width();
+         height = archive.height();
+         typeCode = archive.typeCode();
+      }
+      else if(archive.width() != width || archive.height() != height || archive.typeCode() != typeCode)
+      {
+         std::cerr << " (" << invokedName << "): " << m_files[n] << " does not match the size and type of " << m_files[0] << "\n";
+         return -1;
+      }
+
+      archiveFrames[n] = archive.frames();
+
+      uint64_t archiveBlock = (archive.subChunkLength() > 0 && archive.subChunkLength() < archive.frames()) ? archive.subChunkLength() : archive.frames();
+      if(archiveBlock > blockFrames) blockFrames = archiveBlock;
+   }
+
+   uint64_t chunkFrames = m_chunkFrames;
+   if(chunkFrames == 0)
+   {
+      size_t frameSize = static_cast<size_t>(width)*height*xrif_typesize(typeCode);
+
+      chunkFrames = xrif2h5Writer::chunkFrames(blockFrames, frameSize, m_maxChunkMB*1048576);
+   }
+
+   //An archive which is not a whole number of chunks shifts the chunks of every archive after it off the xrif blocks.
+   size_t misaligned = 0;
+   for(size_t n=0; n + 1 < m_files.size(); ++n)
+   {
+      if(archiveFrames[n] % chunkFrames != 0) ++misaligned;
+   }
+
+   if(misaligned > 0)
+   {
+      std::cerr << " (" << invokedName << "): note: " << misaligned << " archives are not a whole number of " << chunkFrames << " frame chunks, ";
+      std::cerr << "so the chunks after them do not line up with the xrif blocks.\n";
+   }
+
+   std::vector<std::string> keywords;
+
+   if(!m_noMeta)
+   {
+      m_logMetas.push_back(logMetaSpec({"tcsi", telem_telcat::eventCode, "catObj"}));
+      m_logMetas.push_back(logMetaSpec({"tcsi", telem_teldata::eventCode, "pa"}));
+
+      m_logMetas.push_back(logMetaSpec({"fwpupil", telem_stage::eventCode, "presetName"}));
+      m_logMetas.push_back(logMetaSpec({"fwpupil", telem_stage::eventCode, "preset"}));
+
+      m_logMetas.push_back(logMetaSpec({"fwpfpm", telem_stage::eventCode, "presetName"}));
+      m_logMetas.push_back(logMetaSpec({"fwfpm", telem_stage::eventCode, "preset"}));
+
+      m_logMetas.push_back(logMetaSpec({"fwlyot", telem_stage::eventCode, "presetName"}));
+      m_logMetas.push_back(logMetaSpec({"fwlyot", telem_stage::eventCode, "preset"}));
+
+      m_logMetas.push_back(logMetaSpec({"stagescibs", telem_stage::eventCode, "presetName"}));
+      m_logMetas.push_back(logMetaSpec({"stagescibs", telem_stage::eventCode, "preset"}));
+
+      m_logMetas.push_back(logMetaSpec({"fwsci1", telem_stage::eventCode, "presetName"}));
+      m_logMetas.push_back(logMetaSpec({"fwsci1", telem_stage::eventCode, "preset"}));
+
+      m_logMetas.push_back(logMetaSpec({"fwsci2", telem_stage::eventCode, "presetName"}));
+      m_logMetas.push_back(logMetaSpec({"fwsci2", telem_stage::eventCode, "preset"}));
+
+      for(size_t u=0; u < m_logMetas.size(); ++u)
+      {
+         keywords.push_back(m_logMetas[u].keyword());
+      }
+
+      std::cerr << "loading telemetry file names . . .\n";
+      for(size_t n=0; n < m_telDir.size(); ++n)
+      {
+         m_tels.loadAppToFileMap( m_telDir[n], ".bintel");
+      }
+   }
+
+   xrif2h5Writer writer;
+   if(writer.create(errMsg, m_outFile, width, height, typeCode, chunkFrames, m_deflate, !m_noMeta, keywords) < 0)
+   {
+      std::cerr << " (" << invokedName << "): " << errMsg << "\n";
+      return -1;
+   }
+
+   std::cout << "* xrif2h5: writing " << m_files.size() << " archives to " << m_outFile << " in chunks of " << chunkFrames << " frames\n";
+
+   int result = 0;
+   for(size_t n=0; n < m_files.size(); ++n)
+   {
+      if(g_timeToDie == true) break;
+
+      if(appendArchive(writer, m_files[n]) < 0)
+      {
+         result = -1;
+         break;
+      }
+   }
+
+   //The frames written so far are kept on a signal or an error.
+   uint64_t frames = writer.frames();
+   if(writer.close() < 0)
+   {
+      std::cerr << " (" << invokedName << "): error closing " << m_outFile << "\n";
+      return -1;
+   }
+
+   std::cout << "* xrif2h5: wrote " << frames << " frames to " << m_outFile << "\n";
+
+   if(result < 0) return result;
+
+   std::cerr << " (" << invokedName << "): exited normally.\n";
+
+   return 0;
+}
+
+#endif //xrif2h5_hpp
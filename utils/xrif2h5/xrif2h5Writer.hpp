@@ -0,0 +1,453 @@
+/** \file xrif2h5Writer.hpp
+  * \brief Appending frames and their meta data to chunked HDF5 datasets.
+  *
+  * \ingroup xrif2h5_files
+  */
+
+#ifndef xrif2h5Writer_hpp
+#define xrif2h5Writer_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <xrif/xrif.h>
+
+#include "../../libMagAOX/utils/H5Utils.hpp"
+
+/// Appends frames, their timing, and their meta data to the datasets of an HDF5 file.
+/** The file has the datasets:
+  * - /images, frames x height x width, in the native type of the archives
+  * - /timing/FRAMENO, ACQSEC, ACQNSEC, WRTSEC, and WRTNSEC, as in the archives
+  * - /meta/EXPTIME, the exposure time in seconds or NaN if not known, and a string dataset for each log keyword
+  *
+  * All are extendible in the frame dimension, and row n of each belongs to frame n.  The images are chunked by a
+  * whole number of frames, compressed with shuffle and deflate, so reading a range of frames decompresses only the
+  * chunks holding them.  The 1-D datasets are chunked by a multiple of the image chunk.
+  *
+  * Each append extends the datasets and writes the new rows as a hyperslab, so only the frames being appended are
+  * in memory.
+  *
+  * \ingroup xrif2h5
+  */
+class xrif2h5Writer
+{
+public:
+
+   /// Get the name of a timing dataset, in the order of the archive timing values.
+   static const char * timingName( int k /**< [in] the index of the timing value, 0 to 4 */)
+   {
+      static const char * names[5] = {"FRAMENO", "ACQSEC", "ACQNSEC", "WRTSEC", "WRTNSEC"};
+      return names[k];
+   }
+
+protected:
+
+   MagAOX::utils::H5Handle_F m_file;    ///< The file.
+   MagAOX::utils::H5Handle_D m_images;  ///< The images.
+   MagAOX::utils::H5Handle_D m_timing[5]; ///< The timing datasets.
+   MagAOX::utils::H5Handle_D m_exptime; ///< The exposure times, if writing meta data.
+
+   std::vector<std::unique_ptr<MagAOX::utils::H5Handle_D>> m_values; ///< The log keyword datasets, if writing meta data.
+
+   MagAOX::utils::H5Handle_T m_stringType; ///< The variable length string type.
+
+   hid_t m_imageType {-1};  ///< The native HDF5 type of the pixels.
+   uint32_t m_width {0};    ///< The width of the images.
+   uint32_t m_height {0};   ///< The height of the images.
+   bool m_meta {false};     ///< Whether the meta data is written.
+
+   uint64_t m_frames {0};   ///< The number of frames written.
+
+public:
+
+   /// Get the native HDF5 type of an xrif type code.
+   /**
+     * \returns the HDF5 type
+     * \returns -1 if the type is not supported
+     */
+   static hid_t nativeType( int typeCode /**< [in] the xrif type code */)
+   {
+      switch(typeCode)
+      {
+         case XRIF_TYPECODE_UINT8:
+            return H5T_NATIVE_UINT8;
+         case XRIF_TYPECODE_INT8:
+            return H5T_NATIVE_INT8;
+         case XRIF_TYPECODE_UINT16:
+            return H5T_NATIVE_UINT16;
+         case XRIF_TYPECODE_INT16:
+            return H5T_NATIVE_INT16;
+         case XRIF_TYPECODE_UINT32:
+            return H5T_NATIVE_UINT32;
+         case XRIF_TYPECODE_INT32:
+            return H5T_NATIVE_INT32;
+         case XRIF_TYPECODE_UINT64:
+            return H5T_NATIVE_UINT64;
+         case XRIF_TYPECODE_INT64:
+            return H5T_NATIVE_INT64;
+         case XRIF_TYPECODE_FLOAT:
+            return H5T_NATIVE_FLOAT;
+         case XRIF_TYPECODE_DOUBLE:
+            return H5T_NATIVE_DOUBLE;
+         default:
+            return -1;
+      }
+   }
+
+   /// Get the number of frames in an image chunk sized from the xrif blocks.
+   /** This is the largest divisor of the block length whose chunk fits in maxBytes, so a block of this length fills a
+     * whole number of chunks.  The chunks line up with the blocks only while every block starts on a chunk boundary.
+     *
+     * \returns the number of frames in a chunk, at least 1
+     */
+   static uint64_t chunkFrames( uint64_t blockFrames, ///< [in] the number of frames in an xrif block
+                                size_t frameSize,     ///< [in] the size of an image in bytes
+                                size_t maxBytes       ///< [in] the maximum size of a chunk in bytes
+                              )
+   {
+      if(blockFrames == 0 || frameSize == 0) return 1;
+
+      uint64_t maxFrames = maxBytes / frameSize;
+      if(maxFrames < 1) return 1;
+
+      for(uint64_t d = std::min(blockFrames, maxFrames); d > 1; --d)
+      {
+         if(blockFrames % d == 0) return d;
+      }
+
+      return 1;
+   }
+
+   /// Get the dataset name of a log keyword, with any '/' replaced since it separates groups.
+   static std::string datasetName( const std::string & keyword /**< [in] the keyword */)
+   {
+      std::string name = keyword;
+      std::replace(name.begin(), name.end(), '/', '_');
+
+      if(name == "" || name == ".") name = "_" + name;
+
+      return name;
+   }
+
+   /// Create the file and its datasets, replacing any existing file.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with the message in errMsg
+     */
+   int create( std::string & errMsg,                     ///< [out] the error message, if any
+               const std::string & path,                 ///< [in] the path of the file
+               uint32_t width,                           ///< [in] the width of the images
+               uint32_t height,                          ///< [in] the height of the images
+               int typeCode,                             ///< [in] the xrif type code of the images
+               uint64_t chunkFrames,                     ///< [in] the number of frames in an image chunk
+               int deflate,                              ///< [in] the deflate level, 0 for no compression
+               bool meta,                                ///< [in] whether the meta data is written
+               const std::vector<std::string> & keywords ///< [in] the log keywords, if writing meta data
+             )
+   {
+      m_imageType = nativeType(typeCode);
+      if(m_imageType < 0)
+      {
+         errMsg = "unsupported xrif type code " + std::to_string(typeCode);
+         return -1;
+      }
+
+      if(width == 0 || height == 0 || chunkFrames == 0)
+      {
+         errMsg = "invalid image or chunk size";
+         return -1;
+      }
+
+      m_width = width;
+      m_height = height;
+      m_meta = meta;
+      m_frames = 0;
+
+      m_file = H5Fcreate(path.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+      if(m_file < 0)
+      {
+         errMsg = "error creating " + path;
+         return -1;
+      }
+
+      if(createDataset(errMsg, m_images, m_file, "images", m_imageType, 3, chunkFrames, deflate) < 0) return -1;
+
+      //The 1-D chunks are a multiple of the image chunks, but not tiny.
+      uint64_t tableChunk = chunkFrames * ((1024 + chunkFrames - 1)/chunkFrames);
+
+      MagAOX::utils::H5Handle_G timing;
+      timing = H5Gcreate2(m_file, "timing", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+      if(timing < 0)
+      {
+         errMsg = "error creating the timing group";
+         return -1;
+      }
+
+      for(int k = 0; k < 5; ++k)
+      {
+         if(createDataset(errMsg, m_timing[k], timing, timingName(k), H5T_NATIVE_UINT64, 1, tableChunk, deflate) < 0)
+         {
+            return -1;
+         }
+      }
+
+      m_values.clear();
+
+      if(!m_meta) return 0;
+
+      m_stringType = H5Tcopy(H5T_C_S1);
+      if(m_stringType < 0 || H5Tset_size(m_stringType, H5T_VARIABLE) < 0)
+      {
+         errMsg = "error creating the string type";
+         return -1;
+      }
+
+      MagAOX::utils::H5Handle_G metaGroup;
+      metaGroup = H5Gcreate2(m_file, "meta", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+      if(metaGroup < 0)
+      {
+         errMsg = "error creating the meta group";
+         return -1;
+      }
+
+      if(createDataset(errMsg, m_exptime, metaGroup, "EXPTIME", H5T_NATIVE_DOUBLE, 1, tableChunk, deflate) < 0)
+      {
+         return -1;
+      }
+
+      for(size_t u = 0; u < keywords.size(); ++u)
+      {
+         std::string name = datasetName(keywords[u]);
+
+         //Keywords may repeat, e.g. a preset name of two devices
+         if(H5Lexists(metaGroup, name.c_str(), H5P_DEFAULT) > 0)
+         {
+            int n = 2;
+            while(H5Lexists(metaGroup, (name + "_" + std::to_string(n)).c_str(), H5P_DEFAULT) > 0) ++n;
+            name += "_" + std::to_string(n);
+         }
+
+         m_values.emplace_back(new MagAOX::utils::H5Handle_D);
+
+         //The strings are on the heap, so compressing the dataset would not compress them.
+         if(createDataset(errMsg, *m_values.back(), metaGroup, name, m_stringType, 1, tableChunk, 0) < 0) return -1;
+      }
+
+      return 0;
+   }
+
+   /// Append frames, their timing, and their meta data.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with the message in errMsg
+     */
+   int append( std::string & errMsg,                                  ///< [out] the error message, if any
+               const char * images,                                   ///< [in] count images
+               const uint64_t * timing,                               ///< [in] the 5 timing values of each frame
+               uint64_t count,                                        ///< [in] the number of frames
+               const std::vector<double> & exptime,                   ///< [in] the exposure time of each frame, if writing meta data
+               const std::vector<std::vector<std::string>> & values   ///< [in] the value of each keyword for each frame, if writing meta data
+             )
+   {
+      if(m_file <= 0)
+      {
+         errMsg = "file not open";
+         return -1;
+      }
+
+      if(count == 0) return 0;
+
+      hsize_t mdims[3] = {count, m_height, m_width};
+      MagAOX::utils::H5Handle_S mspace;
+      mspace = H5Screate_simple(3, mdims, nullptr);
+      if(writeRows(errMsg, m_images, mspace, m_imageType, count, images) < 0) return -1;
+
+      //Each timing dataset is a column of the timing values, selected in memory without copying.
+      hsize_t tdims[2] = {count, 5};
+      for(int k = 0; k < 5; ++k)
+      {
+         MagAOX::utils::H5Handle_S tspace;
+         tspace = H5Screate_simple(2, tdims, nullptr);
+
+         hsize_t start[2] = {0, static_cast<hsize_t>(k)};
+         hsize_t cnt[2] = {count, 1};
+         H5Sselect_hyperslab(tspace, H5S_SELECT_SET, start, nullptr, cnt, nullptr);
+
+         if(writeRows(errMsg, m_timing[k], tspace, H5T_NATIVE_UINT64, count, timing) < 0) return -1;
+      }
+
+      if(m_meta)
+      {
+         if(exptime.size() < count || values.size() < m_values.size())
+         {
+            errMsg = "missing meta data";
+            return -1;
+         }
+
+         hsize_t dims[1] = {count};
+         MagAOX::utils::H5Handle_S vspace;
+         vspace = H5Screate_simple(1, dims, nullptr);
+
+         if(writeRows(errMsg, m_exptime, vspace, H5T_NATIVE_DOUBLE, count, exptime.data()) < 0) return -1;
+
+         std::vector<const char *> strs(count);
+         for(size_t u = 0; u < m_values.size(); ++u)
+         {
+            if(values[u].size() < count)
+            {
+               errMsg = "missing meta data";
+               return -1;
+            }
+
+            for(uint64_t q = 0; q < count; ++q) strs[q] = values[u][q].c_str();
+
+            if(writeRows(errMsg, *m_values[u], vspace, m_stringType, count, strs.data()) < 0) return -1;
+         }
+      }
+
+      m_frames += count;
+
+      return 0;
+   }
+
+   /// Get the number of frames written.
+   uint64_t frames() const
+   {
+      return m_frames;
+   }
+
+   /// Flush and close the file.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error
+     */
+   int close()
+   {
+      int rv = 0;
+
+      m_values.clear();
+      m_exptime.close();
+      for(int k = 0; k < 5; ++k) m_timing[k].close();
+      m_images.close();
+      m_stringType.close();
+
+      if(m_file > 0)
+      {
+         if(H5Fflush(m_file, H5F_SCOPE_LOCAL) < 0) rv = -1;
+         if(m_file.close() < 0) rv = -1;
+      }
+
+      return rv;
+   }
+
+   ~xrif2h5Writer()
+   {
+      close();
+   }
+
+protected:
+
+   /// Create an empty dataset, extendible in the frame dimension.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with the message in errMsg
+     */
+   int createDataset( std::string & errMsg,              ///< [out] the error message, if any
+                      MagAOX::utils::H5Handle_D & dset, ///< [out] the dataset
+                      hid_t loc,                         ///< [in] the file or group
+                      const std::string & name,          ///< [in] the name of the dataset
+                      hid_t type,                        ///< [in] the type of the dataset
+                      int rank,                          ///< [in] 3 for images, 1 for a value per frame
+                      uint64_t chunkFrames,              ///< [in] the number of frames in a chunk
+                      int deflate                        ///< [in] the deflate level, 0 for no compression
+                    )
+   {
+      hsize_t dims[3] = {0, m_height, m_width};
+      hsize_t maxDims[3] = {H5S_UNLIMITED, m_height, m_width};
+      hsize_t chunk[3] = {chunkFrames, m_height, m_width};
+
+      MagAOX::utils::H5Handle_S space;
+      space = H5Screate_simple(rank, dims, maxDims);
+
+      MagAOX::utils::H5Handle_P dcpl;
+      dcpl = H5Pcreate(H5P_DATASET_CREATE);
+
+      if(space < 0 || dcpl < 0 || H5Pset_chunk(dcpl, rank, chunk) < 0)
+      {
+         errMsg = "error setting up " + name;
+         return -1;
+      }
+
+      if(deflate > 0)
+      {
+         if(H5Pset_shuffle(dcpl) < 0 || H5Pset_deflate(dcpl, std::min(deflate, 9)) < 0)
+         {
+            errMsg = "error setting the compression of " + name;
+            return -1;
+         }
+      }
+
+      //A NaN fill value marks exposure times never written, e.g. if stopped mid-append.
+      if(type == H5T_NATIVE_DOUBLE && rank == 1)
+      {
+         double fill = std::numeric_limits<double>::quiet_NaN();
+         H5Pset_fill_value(dcpl, H5T_NATIVE_DOUBLE, &fill);
+      }
+
+      dset = H5Dcreate2(loc, name.c_str(), type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+      if(dset < 0)
+      {
+         errMsg = "error creating " + name;
+         return -1;
+      }
+
+      return 0;
+   }
+
+   /// Extend a dataset by count rows and write them.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with the message in errMsg
+     */
+   int writeRows( std::string & errMsg,              ///< [out] the error message, if any
+                  MagAOX::utils::H5Handle_D & dset, ///< [in] the dataset
+                  hid_t mspace,                      ///< [in] the memory dataspace, with count rows selected
+                  hid_t memType,                     ///< [in] the type in memory
+                  uint64_t count,                    ///< [in] the number of rows
+                  const void * buf                   ///< [in] the rows
+                )
+   {
+      //Only the first dimension is used for 1-D datasets
+      hsize_t dims[3] = {m_frames + count, m_height, m_width};
+      if(H5Dset_extent(dset, dims) < 0)
+      {
+         errMsg = "error extending a dataset";
+         return -1;
+      }
+
+      MagAOX::utils::H5Handle_S fspace;
+      fspace = H5Dget_space(dset);
+
+      hsize_t start[3] = {m_frames, 0, 0};
+      hsize_t cnt[3] = {count, m_height, m_width};
+      if(fspace < 0 || H5Sselect_hyperslab(fspace, H5S_SELECT_SET, start, nullptr, cnt, nullptr) < 0)
+      {
+         errMsg = "error selecting rows of a dataset";
+         return -1;
+      }
+
+      if(H5Dwrite(dset, memType, mspace, fspace, H5P_DEFAULT, buf) < 0)
+      {
+         errMsg = "error writing a dataset";
+         return -1;
+      }
+
+      return 0;
+   }
+};
+
+#endif //xrif2h5Writer_hpp
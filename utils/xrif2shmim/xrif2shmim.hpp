@@ -7,6 +7,17 @@
 #ifndef xrif2shmim_hpp
 #define xrif2shmim_hpp
 
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <time.h>
+
 #include <ImageStruct.h>
 #include <ImageStreamIO.h>
 
@@ -20,16 +31,6 @@
 
 #include "../../libMagAOX/libMagAOX.hpp"
 
-/// Sleep for a specified period in microseconds.
-/** \todo add timeutils to libMagAOX
-  */
-inline
-void microsleep( unsigned usec /**< [in] the number of microseconds to sleep. */)
-{
-   std::this_thread::sleep_for(std::chrono::microseconds(usec));
-}
-
-
 /** \defgroup xrif2shmim xrif2shmim: xrif-archive Streamer
   * \brief Stream images from an xrif archive to shared memory.
   *
@@ -43,7 +44,7 @@ void microsleep( unsigned usec /**< [in] the number of microseconds to sleep. */
   * \ingroup xrif2shmim
   */
 
-bool g_timeToDie = false;
+std::atomic<bool> g_timeToDie {false};
 
 void sigTermHandler( int signum,
                      siginfo_t *siginf,
@@ -60,8 +61,41 @@ void sigTermHandler( int signum,
    g_timeToDie = true;
 }
 
-/// A utility to stream MagaO-X images from xrif compressed archives to an ImageStreamIO stream.
+/// A decoded archive in the xrif2shmim streaming ring.
 /**
+  * \ingroup xrif2shmim
+  */
+struct xrif2shmimChunk
+{
+   /// The states of a chunk.
+   enum states { empty,    ///< Waiting to be decoded into.
+                 decoding, ///< An archive is being read and decoded.
+                 ready,    ///< The archive is decoded, and waiting to be played.
+                 error     ///< Reading or decoding failed, see m_error.
+               };
+
+   MagAOX::sys::xrifArchive m_archive; ///< The archive reader, with its own decoding buffers.
+
+   std::vector<char> m_image;      ///< The decoded image data of all the frames.
+   std::vector<uint64_t> m_timing; ///< The decoded timing data, 5 values per frame.
+
+   size_t m_fileNo {0};   ///< The archive in this chunk.
+   bool m_rebase {false}; ///< True if this chunk starts a new pass through the archives.
+   int m_state {empty};   ///< The state of the chunk.  Protected by xrif2shmim::m_ringMutex.
+   std::string m_error;   ///< The error message, if decoding failed.
+};
+
+/// A utility to stream MagaO-X images from xrif compressed archives to an ImageStreamIO stream.
+/** By default numFrames frames are loaded into memory, and streamed in a loop at fps.
+  *
+  * In streaming mode the archives are played from disk in order, in a loop unless once is set, so memory does not
+  * grow with the number of frames.  A decoding thread reads ahead into a ring of ringLength decoded archives, while
+  * the main thread plays them.  Frames are paced at fps, or with realtime at the cadence of their original
+  * acquisition times divided by speed, and with preserveTime the stream's atime is the original acquisition time.
+  *
+  * In both modes each frame is written at an absolute deadline on CLOCK_MONOTONIC, so timing errors do not
+  * accumulate.  Late frames are written immediately, and counted.
+  *
   * \todo finish md doc for xrif2shmim
   *
   * \ingroup xrif2shmim
@@ -81,16 +115,37 @@ protected:
 
    bool m_earliest {false}; ///< If true, then the earliest numFrames in the archive are used.  By default (if not set) the latest numFrames are used.
 
+   std::string m_streamName; ///< If set, only archives of this stream are used.  Selects archives from the catalog in dir.
+
+   uint64_t m_firstFrame {0}; ///< Only archives with frame numbers of at least this are used.  Selects archives from the catalog in dir.
+
+   uint64_t m_lastFrame {std::numeric_limits<uint64_t>::max()}; ///< Only archives with frame numbers of at most this are used.  Selects archives from the catalog in dir.
+
+   std::string m_startTime; ///< Only archives with frames acquired at or after this UT time are used.  Selects archives from the catalog in dir.
+
+   std::string m_endTime; ///< Only archives with frames acquired at or before this UT time are used.  Selects archives from the catalog in dir.
+
    std::string m_shmimName {"xrif2shmim"}; ///< The name of the shared memory buffer to stream to.  Default is "xrif2shmim".
 
    uint32_t m_circBuffLength {1}; ///< The length of the shared memory circular buffer. Default is 1.
 
    double m_fps {10}; ///< The rate, in frames per second, at which to stream images.  Default is 10 fps.
 
-   ///@}
+   bool m_stream {false}; ///< If true, stream the archives from disk instead of loading them into memory.
 
+   int m_ringLength {3}; ///< The number of decoded archives held in streaming mode.  Default is 3.
 
-   xrif_t m_xrif {nullptr};
+   bool m_once {false}; ///< If true, stop after playing the archives once in streaming mode.
+
+   bool m_realtime {false}; ///< If true, pace frames at the cadence of their original acquisition times.  Implies stream.
+
+   double m_speed {1}; ///< The multiple of the original cadence at which to play in realtime mode.  Default is 1.
+
+   double m_maxGap {0}; ///< The longest interval between frames in realtime mode, in seconds.  Longer gaps, such as between observations, are shortened to this.  If 0, the default, gaps are kept.
+
+   bool m_preserveTime {false}; ///< If true, the stream's atime is the original acquisition time of each frame.  Implies stream.
+
+   ///@}
 
    /** \name Image Data
      * @{
@@ -108,27 +163,92 @@ protected:
 
    IMAGE m_imageStream; ///< The ImageStreamIO shared memory buffer.
 
+   uint64_t m_nextCnt1 {0}; ///< The next slice of the circular buffer to write.
 
    ///@}
 
-public:
+   /** \name Streaming
+     * @{
+     */
+
+   std::vector<std::unique_ptr<xrif2shmimChunk>> m_ring; ///< The ring of decoded archives.
+
+   std::mutex m_ringMutex; ///< Protects the chunk states and m_decodeDone.
+
+   std::condition_variable m_ringCond; ///< Signaled on each change of a chunk state.
+
+   bool m_decodeDone {false}; ///< Set by the decoding thread when it has no more archives.
+
+   std::atomic<bool> m_stopDecode {false}; ///< Set to stop the decoding thread.
+
+   ///@}
 
-   ~xrif2shmim();
+   /** \name Pacing Statistics
+     * @{
+     */
+
+   uint64_t m_played {0}; ///< The number of frames written.
+   uint64_t m_late {0}; ///< The number of frames written more than 1 ms after their deadline.
+   double m_maxLate {0}; ///< The latest a frame was written, in seconds.
+   uint64_t m_underruns {0}; ///< The number of times the player waited for the decoding thread.
+
+   ///@}
+
+public:
 
    virtual void setupConfig();
 
    virtual void loadConfig();
 
    virtual int execute();
+
+protected:
+
+   /// Select the archives in dir with its catalog, by stream, frame numbers, and acquisition times.
+   /** Archives missing from the catalog are scanned.  With numFrames, and not streaming, only the archives holding the
+     * latest (or earliest) numFrames frames are selected, so the rest are never opened.
+     *
+     * 
+eturns 0 on success
+     * 
+eturns -1 on error
+     */
+   int selectArchives();
+
+   /// Create the shared memory stream.
+   void createStream();
+
+   /// Write a frame to the stream and post it.
+   void publish( const char * src,       ///< [in] the frame data
+                 const timespec * atime  ///< [in] the acquisition time, or nullptr to use the write time
+               );
+
+   /// Wait for a deadline on CLOCK_MONOTONIC, and update the pacing statistics.
+   void waitUntil( int64_t deadline /**< [in] the deadline, in ns */);
+
+   /// Read and decode an archive, image and timing data, into a chunk.
+   /**
+     * \returns 0 on success
+     * \returns -1 on error, with the message in the chunk's m_error
+     */
+   int decodeChunk( xrif2shmimChunk & chunk,    ///< [in/out] the chunk
+                    const std::string & fileName ///< [in] the archive
+                  );
+
+   /// The decoding thread of streaming mode.
+   void decodeThreadExec();
+
+   /// Play the archives from disk.
+   int executeStream();
 };
 
+/// Get the current CLOCK_MONOTONIC time in ns.
 inline
-xrif2shmim::~xrif2shmim()
+int64_t monotonicNs()
 {
-   if(m_xrif)
-   {
-      xrif_delete(m_xrif);
-   }
+   timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return static_cast<int64_t>(ts.tv_sec)*1000000000 + ts.tv_nsec;
 }
 
 inline
@@ -138,10 +258,23 @@ void xrif2shmim::setupConfig()
    config.add("files","f", "files" , argType::Required, "", "files", false,  "vector<string>", "List of files to use.  If dir is not empty, it will be pre-pended to each name.");
    config.add("numFrames","N", "numFrames" , argType::Required, "", "numFrames", false,  "int", "The number of frames to store in memory.  This defines how many different images will be streamed.  If 0 (the default), all frames found using dir and files are loaded and stored.");
    config.add("earliest","e", "earliest" , argType::True, "", "earliest", false,  "bool", "If set or true, then the earliest numFrames in the archive are used.  By default (if not set) the latest numFrames are used.");
+   config.add("streamName","", "streamName" , argType::Required, "", "streamName", false,  "string", "If set, only archives of this stream in dir are used, selected with the catalog.");
+   config.add("firstFrame","", "firstFrame" , argType::Required, "", "firstFrame", false,  "int", "Only archives in dir with frame numbers of at least this are used, selected with the catalog.");
+   config.add("lastFrame","", "lastFrame" , argType::Required, "", "lastFrame", false,  "int", "Only archives in dir with frame numbers of at most this are used, selected with the catalog.");
+   config.add("startTime","", "startTime" , argType::Required, "", "startTime", false,  "string", "Only archives in dir with frames acquired at or after this UT time are used, selected with the catalog.  Format is YYYY-MM-DDTHH:MM:SS.SSS or YYYYMMDDHHMMSS.");
+   config.add("endTime","", "endTime" , argType::Required, "", "endTime", false,  "string", "Only archives in dir with frames acquired at or before this UT time are used, selected with the catalog.  Format is YYYY-MM-DDTHH:MM:SS.SSS or YYYYMMDDHHMMSS.");
    config.add("shmimName","n", "shmimName" , argType::Required, "", "shmimName", false,  "string", "The name of the shared memory buffer to stream to.  Default is \"xrif2shmim\"");
    config.add("circBuffLength","L", "circBuffLength" , argType::Required, "", "circBuffLength", false,  "int", "The length of the shared memory circular buffer. Default is 1.");
 
    config.add("fps","F", "fps" , argType::Required, "", "fps", false,  "float", "The rate, in frames per second, at which to stream images. Default is 10 fps.");
+
+   config.add("stream","s", "stream" , argType::True, "", "stream", false,  "bool", "If set or true, stream the archives from disk with a decode-ahead thread, instead of loading numFrames into memory.  numFrames and earliest are ignored.");
+   config.add("ringLength","", "ringLength" , argType::Required, "", "ringLength", false,  "int", "The number of decoded archives held in streaming mode.  Default is 3.");
+   config.add("once","", "once" , argType::True, "", "once", false,  "bool", "If set or true, stop after playing the archives once in streaming mode.  By default they are played in a loop.");
+   config.add("realtime","R", "realtime" , argType::True, "", "realtime", false,  "bool", "If set or true, play frames at the cadence of their original acquisition times, instead of at fps.  Implies stream.");
+   config.add("speed","", "speed" , argType::Required, "", "speed", false,  "float", "The multiple of the original cadence at which to play in realtime mode.  Default is 1.");
+   config.add("maxGap","", "maxGap" , argType::Required, "", "maxGap", false,  "float", "The longest interval between frames in realtime mode, in seconds.  Longer gaps are shortened to this.  If 0, the default, gaps are kept.");
+   config.add("preserveTime","P", "preserveTime" , argType::True, "", "preserveTime", false,  "bool", "If set or true, the stream's atime is the original acquisition time of each frame.  Implies stream.");
 }
 
 inline
@@ -151,9 +284,23 @@ void xrif2shmim::loadConfig()
    config(m_files, "files");
    config(m_numFrames, "numFrames");
    config(m_earliest, "earliest");
+   config(m_streamName, "streamName");
+   config(m_firstFrame, "firstFrame");
+   config(m_lastFrame, "lastFrame");
+   config(m_startTime, "startTime");
+   config(m_endTime, "endTime");
    config(m_shmimName, "shmimName");
    config(m_circBuffLength, "circBuffLength");
    config(m_fps, "fps");
+   config(m_stream, "stream");
+   config(m_ringLength, "ringLength");
+   config(m_once, "once");
+   config(m_realtime, "realtime");
+   config(m_speed, "speed");
+   config(m_maxGap, "maxGap");
+   config(m_preserveTime, "preserveTime");
+
+   if(m_realtime || m_preserveTime) m_stream = true;
 }
 
 inline
@@ -197,7 +344,17 @@ int xrif2shmim::execute()
          m_dir = "./";
       }
 
-      m_files =  mx::ioutils::getFileNames( m_dir, "", "", ".xrif");
+      bool selecting = (m_streamName != "" || m_firstFrame != 0 || m_lastFrame != std::numeric_limits<uint64_t>::max() ||
+                                                                           m_startTime != "" || m_endTime != "");
+
+      if(selecting || (m_numFrames > 0 && !m_stream))
+      {
+         if(selectArchives() < 0) return -1;
+      }
+      else
+      {
+         m_files =  mx::ioutils::getFileNames( m_dir, "", "", ".xrif");
+      }
    }
    else
    {
@@ -218,16 +375,14 @@ int xrif2shmim::execute()
       return -1;
    }
 
-
-   xrif_error_t rv;
-   rv = xrif_new(&m_xrif);
-
-   if(rv < 0)
+   if(m_stream)
    {
-      std::cerr << " (" << invokedName << "): Error allocating xrif.\n";
-      return -1;
+      return executeStream();
    }
 
+   MagAOX::sys::xrifArchive archive;
+   std::string errMsg;
+
    long st = 0;
    long ed = m_files.size();
    int stp = 1;
@@ -239,50 +394,42 @@ int xrif2shmim::execute()
       stp = -1;
    }
 
-   char header[XRIF_HEADER_SIZE];
-
    size_t nframes = 0;
 
    //First get number of frames.
    for(long n=st; n != ed; n += stp)
    {
-      FILE * fp_xrif = fopen(m_files[n].c_str(), "rb");
-      size_t nr = fread(header, 1, XRIF_HEADER_SIZE, fp_xrif);
-      fclose(fp_xrif);
-      if(nr != XRIF_HEADER_SIZE)
+      if(archive.open(errMsg, m_files[n]) < 0)
       {
-         std::cerr << " (" << invokedName << "): Error reading header of " << m_files[n] << "\n";
+         std::cerr << " (" << invokedName << "): " << errMsg << "\n";
          return -1;
       }
 
-      uint32_t header_size;
-      xrif_read_header(m_xrif, &header_size , header);
-
       if(n==st)
       {
-         m_width = m_xrif->width;
-         m_height = m_xrif->height;
-         m_dataType = m_xrif->type_code;
+         m_width = archive.width();
+         m_height = archive.height();
+         m_dataType = archive.typeCode();
       }
       else
       {
-         if(m_xrif->width != m_width)
+         if(archive.width() != m_width)
          {
             std::cerr << " (" << invokedName << "): width mis-match in " << m_files[n] << "\n";
             return -1;
          }
-         if(m_xrif->height != m_height)
+         if(archive.height() != m_height)
          {
             std::cerr << " (" << invokedName << "): height mis-match in " << m_files[n] << "\n";
             return -1;
          }
-         if(m_xrif->type_code != m_dataType)
+         if(archive.typeCode() != m_dataType)
          {
             std::cerr << " (" << invokedName << "): data type mismatch in " << m_files[n] << "\n";
          }
       }
 
-      if(m_xrif->depth != 1)
+      if(archive.depth() != 1)
       {
          std::cerr << " (" << invokedName << "): Cubes detected in " << m_files[n] << "\n";
          return -1;
@@ -296,7 +443,7 @@ int xrif2shmim::execute()
       }
       */
 
-      nframes += m_xrif->frames;
+      nframes += archive.frames();
 
       if(nframes >= m_numFrames && m_numFrames > 0)
       {
@@ -323,71 +470,54 @@ int xrif2shmim::execute()
 
    m_frames.resize(m_width, m_height, m_numFrames);
 
-   //Determine the order in which frames are copied
-   int findex = 0;
-   int fed = m_frames.planes();
-   if(stp == -1)
-   {
-      findex = m_frames.planes()-1;
-      fed = -1;
-   }
+   //The frames are stored in time order, and the files are read from the end when keeping the latest frames.
+   long findex = 0;
+   if(stp == -1) findex = m_frames.planes();
 
    //Now de-compress and load the frames
-   //Only decompressing the number of files needed, and only copying the number of frames needed
+   //Only reading the frames needed, so for archives of sub-chunks only the sub-chunks holding them are decoded.
+   size_t frameSize = m_width*m_height*m_typeSize;
+   std::vector<char> tmp;
+
    for(long n=st; n != ed; n += stp)
    {
       if(g_timeToDie == true) break; //check before going on
 
-      FILE * fp_xrif = fopen(m_files[n].c_str(), "rb");
-      size_t nr = fread(header, 1, XRIF_HEADER_SIZE, fp_xrif);
-      if(nr != XRIF_HEADER_SIZE)
+      if(archive.open(errMsg, m_files[n]) < 0)
       {
-         std::cerr << " (" << invokedName << "): Error reading header of " << m_files[n] << "\n";
-         fclose(fp_xrif);
+         std::cerr << " (" << invokedName << "): " << errMsg << "\n";
          return -1;
       }
 
-      uint32_t header_size;
-      xrif_read_header(m_xrif, &header_size , header);
+      uint64_t count = archive.frames();
+      uint64_t first = 0;
 
-      xrif_allocate_raw(m_xrif);
-      xrif_allocate_reordered(m_xrif);
+      if(stp == 1)
+      {
+         if(count > static_cast<uint64_t>(m_frames.planes() - findex)) count = m_frames.planes() - findex;
+      }
+      else
+      {
+         if(count > static_cast<uint64_t>(findex)) count = findex;
+         first = archive.frames() - count;
+         findex -= count;
+      }
 
-      nr = fread(m_xrif->raw_buffer, 1, m_xrif->compressed_size, fp_xrif);
-      fclose(fp_xrif);
+      if(count == 0) continue;
 
-      if(g_timeToDie == true) break; //check after the long read.
+      tmp.resize(count*frameSize);
 
-      if(nr != m_xrif->compressed_size)
+      if(archive.read(errMsg, tmp.data(), nullptr, first, count) < 0)
       {
-         std::cerr << " (" << invokedName << "): Error reading data from " << m_files[n] << "\n";
+         std::cerr << " (" << invokedName << "): " << errMsg << "\n";
          return -1;
       }
 
-      xrif_decode(m_xrif);
-
       if(g_timeToDie == true) break; //check after the decompress.
 
-      mx::improc::eigenCube<short> tmpc( (short*) m_xrif->raw_buffer, m_xrif->width, m_xrif->height, m_xrif->frames);
-
-      //Determine the order in which frames in tmpc are read
-      long pst = 0;
-      long ped = tmpc.planes();
-      if(stp == -1)
-      {
-         pst = tmpc.planes()-1;
-         ped = -1;
-      }
+      memcpy(reinterpret_cast<char *>(m_frames.data()) + findex*frameSize, tmp.data(), count*frameSize);
 
-      for( int p = pst; p != ped; p += stp)
-      {
-         m_frames.image(findex) = tmpc.image(p);
-         findex += stp;
-         if(findex == fed)
-         {
-            break;
-         }
-      }
+      if(stp == 1) findex += count;
    }
 
    if(g_timeToDie != false)
@@ -396,12 +526,99 @@ int xrif2shmim::execute()
       return -1;
    }
 
-   //De-allocate xrif
-   xrif_delete(m_xrif);
-   m_xrif = nullptr; //This is so destructor doesn't choke
+   archive.close();
 
    //Now create share memory stream.
+   createStream();
+
+   //Begin streaming
+   findex = 0;
+   int64_t period = 1e9/m_fps;
+   int64_t deadline = monotonicNs();
+   while(g_timeToDie == false)
+   {
+      publish((char *) m_frames.image(findex).data(), nullptr);
+
+      ++findex;
+      if(findex >= m_frames.planes()) findex = 0;
+
+      deadline += period;
+      waitUntil(deadline);
+   }
+
+   ImageStreamIO_destroyIm( &m_imageStream );
+
+   std::cerr << " (" << invokedName << "): exited normally.\n";
+
+   return 0;
+}
+
+inline
+int xrif2shmim::selectArchives()
+{
+   timespec start = {0,0};
+   timespec end = {std::numeric_limits<time_t>::max(), 0};
+
+   if(m_startTime != "" && MagAOX::sys::xrifCatalog::parseTime(start, m_startTime) < 0)
+   {
+      std::cerr << " (" << invokedName << "): invalid startTime: " << m_startTime << "\n";
+      return -1;
+   }
+
+   if(m_endTime != "" && MagAOX::sys::xrifCatalog::parseTime(end, m_endTime) < 0)
+   {
+      std::cerr << " (" << invokedName << "): invalid endTime: " << m_endTime << "\n";
+      return -1;
+   }
+
+   //Only the archives missing from the catalog are opened.
+   MagAOX::sys::xrifCatalog catalog;
+   std::vector<std::string> errMsgs;
+   catalog.rebuild(errMsgs, m_dir, true);
+
+   for(size_t n=0; n < errMsgs.size(); ++n)
+   {
+      std::cerr << " (" << invokedName << "): " << errMsgs[n] << "\n";
+   }
+
+   //Save the archives just scanned, so the next run doesn't scan them again.  Failure only costs that scan.
+   if(catalog.added() > 0 && catalog.save() < 0)
+   {
+      std::cerr << " (" << invokedName << "): error writing " << MagAOX::sys::xrifCatalog::catalogPath(catalog.dir());
+      std::cerr << ": " << strerror(errno) << "\n";
+   }
+
+   std::vector<size_t> idx = catalog.select(m_streamName, m_firstFrame, m_lastFrame, start, end);
+
+   //Keep only the archives needed for numFrames
+   if(m_numFrames > 0 && !m_stream)
+   {
+      size_t nframes = 0;
+      size_t nkeep = 0;
+
+      while(nkeep < idx.size() && nframes < m_numFrames)
+      {
+         if(m_earliest) nframes += catalog.entries()[idx[nkeep]].m_frames;
+         else nframes += catalog.entries()[idx[idx.size()-1-nkeep]].m_frames;
+         ++nkeep;
+      }
+
+      if(m_earliest) idx.erase(idx.begin() + nkeep, idx.end());
+      else idx.erase(idx.begin(), idx.end() - nkeep);
+   }
+
+   m_files.clear();
+   for(size_t n=0; n < idx.size(); ++n)
+   {
+      m_files.push_back(catalog.path(idx[n]));
+   }
+
+   return 0;
+}
 
+inline
+void xrif2shmim::createStream()
+{
    uint32_t imsize[3];
    imsize[0] = m_width;
    imsize[1] = m_height;
@@ -413,62 +630,281 @@ int xrif2shmim::execute()
 
    m_imageStream.md->cnt1 = m_circBuffLength;
 
-   //Begin streaming
-   uint64_t next_cnt1 = 0;
-   char * next_dest = (char *) m_imageStream.array.raw;
-   timespec * next_wtimearr = &m_imageStream.writetimearray[0];
-   timespec * next_atimearr = &m_imageStream.atimearray[0];
-   uint64_t * next_cntarr = &m_imageStream.cntarray[0];
+   m_nextCnt1 = 0;
+}
 
-   findex = 0;
-   double lastSend = mx::sys::get_curr_time();
-   double delta = 0;
-   while(g_timeToDie == false)
+inline
+void xrif2shmim::publish( const char * src,
+                          const timespec * atime
+                        )
+{
+   char * next_dest = (char *) m_imageStream.array.raw + m_nextCnt1*m_width*m_height*m_typeSize;
+
+   m_imageStream.md->write=1;
+
+   memcpy(next_dest, src, m_width*m_height*m_typeSize);
+
+   //Set the time of last write
+   clock_gettime(CLOCK_REALTIME, &m_imageStream.md->writetime);
+   if(atime) m_imageStream.md->atime = *atime;
+   else m_imageStream.md->atime = m_imageStream.md->writetime;
+
+   //Update cnt1
+   m_imageStream.md->cnt1 = m_nextCnt1;
+
+   //Update cnt0
+   m_imageStream.md->cnt0++;
+
+   m_imageStream.writetimearray[m_nextCnt1] = m_imageStream.md->writetime;
+   m_imageStream.atimearray[m_nextCnt1] = m_imageStream.md->atime;
+   m_imageStream.cntarray[m_nextCnt1] = m_imageStream.md->cnt0;
+
+   //And post
+   m_imageStream.md->write=0;
+   ImageStreamIO_sempost(&m_imageStream,-1);
+
+   //Now we increment outside the time-critical part.
+   ++m_nextCnt1;
+   if(m_nextCnt1 >= m_circBuffLength) m_nextCnt1 = 0;
+
+   ++m_played;
+}
+
+inline
+void xrif2shmim::waitUntil( int64_t deadline )
+{
+   double late = (monotonicNs() - deadline)/1e9;
+
+   if(late > 0)
    {
-      m_imageStream.md->write=1;
+      //Already late, so write now, and the following deadlines catch up.
+      if(late > 1e-3) ++m_late;
+      if(late > m_maxLate) m_maxLate = late;
+      return;
+   }
 
-      memcpy(next_dest, m_frames.image(findex).data(), m_width*m_height*m_typeSize); //This is about 10 usec faster -- but we have to descramble.
+   timespec ts;
+   ts.tv_sec = deadline / 1000000000;
+   ts.tv_nsec = deadline % 1000000000;
 
-      //Set the time of last write
-      clock_gettime(CLOCK_REALTIME, &m_imageStream.md->writetime);
-      m_imageStream.md->atime = m_imageStream.md->writetime;
+   while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR && g_timeToDie == false);
+}
 
-      //Update cnt1
-      m_imageStream.md->cnt1 = next_cnt1;
+inline
+int xrif2shmim::decodeChunk( xrif2shmimChunk & chunk,
+                             const std::string & fileName
+                           )
+{
+   if(chunk.m_archive.open(chunk.m_error, fileName) < 0) return -1;
 
-      //Update cnt0
-      m_imageStream.md->cnt0++;
+   chunk.m_image.resize(chunk.m_archive.frames()*chunk.m_archive.width()*chunk.m_archive.height()*chunk.m_archive.depth()*
+                                                                                      xrif_typesize(chunk.m_archive.typeCode()));
+   chunk.m_timing.resize(5*chunk.m_archive.frames());
 
-      *next_wtimearr = m_imageStream.md->writetime;
-      *next_atimearr = m_imageStream.md->atime;
-      *next_cntarr = m_imageStream.md->cnt0;
+   if(chunk.m_archive.read(chunk.m_error, chunk.m_image.data(), chunk.m_timing.data(), 0, chunk.m_archive.frames()) < 0)
+   {
+      return -1;
+   }
 
-      //And post
-      m_imageStream.md->write=0;
-      ImageStreamIO_sempost(&m_imageStream,-1);
+   return 0;
+}
 
-      //Now we increment pointers outside the time-critical part of the loop.
-      next_cnt1 = m_imageStream.md->cnt1+1;
-      if(next_cnt1 >= m_circBuffLength) next_cnt1 = 0;
+inline
+void xrif2shmim::decodeThreadExec()
+{
+   size_t chunkNo = 0;
+   size_t n = 0;
 
-      next_dest = (char *) m_imageStream.array.raw + next_cnt1*m_width*m_height*m_typeSize;
-      next_wtimearr = &m_imageStream.writetimearray[next_cnt1];
-      next_atimearr = &m_imageStream.atimearray[next_cnt1];
-      next_cntarr = &m_imageStream.cntarray[next_cnt1];
+   while(g_timeToDie == false && !m_stopDecode)
+   {
+      if(n == m_files.size())
+      {
+         if(m_once) break;
+         n = 0;
+      }
 
-      ++findex;
-      if(findex >= m_frames.planes()) findex = 0;
+      xrif2shmimChunk & chunk = *m_ring[chunkNo % m_ring.size()];
 
+      {
+         std::unique_lock<std::mutex> lock(m_ringMutex);
+         while(chunk.m_state != xrif2shmimChunk::empty)
+         {
+            //The signal handler can't notify, so wake up to check for it.
+            if(g_timeToDie == true || m_stopDecode) return;
+            m_ringCond.wait_for(lock, std::chrono::milliseconds(100));
+         }
+         chunk.m_state = xrif2shmimChunk::decoding;
+      }
 
-      double ct = mx::sys::get_curr_time();
-      delta += 0.1 * (ct-lastSend - 1.0/m_fps);
-      lastSend = ct;
+      int rv = decodeChunk(chunk, m_files[n]);
 
+      chunk.m_fileNo = n;
+      chunk.m_rebase = (n == 0 && chunkNo > 0);
 
-      if(1./m_fps - delta > 0) microsleep( (1./m_fps - delta)*1e6 ); //Argument is unsigned, since we can't unsleep, so don't pass a big number by axe.
+      {
+         std::lock_guard<std::mutex> lock(m_ringMutex);
+         chunk.m_state = (rv < 0) ? xrif2shmimChunk::error : xrif2shmimChunk::ready;
+         m_ringCond.notify_all();
+      }
+
+      if(rv < 0) return;
+
+      ++n;
+      ++chunkNo;
    }
 
-   ImageStreamIO_destroyIm( &m_imageStream );
+   std::lock_guard<std::mutex> lock(m_ringMutex);
+   m_decodeDone = true;
+   m_ringCond.notify_all();
+}
+
+inline
+int xrif2shmim::executeStream()
+{
+   if(m_ringLength < 2) m_ringLength = 2;
+   if(m_speed <= 0) m_speed = 1;
+
+   //Each chunk has its own archive reader and buffers, so the decoding thread fills one while another is played.
+   m_ring.resize(m_ringLength);
+   for(size_t k=0; k < m_ring.size(); ++k)
+   {
+      m_ring[k].reset(new xrif2shmimChunk);
+   }
+
+   std::cerr << " (" << invokedName << "): Streaming " << m_files.size() << " file";
+   if(m_files.size() > 1) std::cerr << "s";
+   std::cerr << "\n";
+
+   std::thread decodeThread(&xrif2shmim::decodeThreadExec, this);
+
+   int result = 0;
+   bool created = false;
+
+   int64_t period = 1e9/m_fps;
+   int64_t deadline = 0;
+   int64_t lastInterval = period;
+   timespec lastAtime = {0,0};
+
+   for(size_t chunkNo = 0; g_timeToDie == false; ++chunkNo)
+   {
+      xrif2shmimChunk & chunk = *m_ring[chunkNo % m_ring.size()];
+
+      int state;
+      bool underrun = false;
+      {
+         std::unique_lock<std::mutex> lock(m_ringMutex);
+
+         if(created && chunk.m_state != xrif2shmimChunk::ready && chunk.m_state != xrif2shmimChunk::error && !m_decodeDone)
+         {
+            ++m_underruns;
+            underrun = true;
+         }
+
+         while(chunk.m_state != xrif2shmimChunk::ready && chunk.m_state != xrif2shmimChunk::error && !(m_decodeDone && chunk.m_state == xrif2shmimChunk::empty) && g_timeToDie == false)
+         {
+            m_ringCond.wait_for(lock, std::chrono::milliseconds(100));
+         }
+
+         state = chunk.m_state;
+      }
+
+      if(g_timeToDie == true) break;
+
+      if(state == xrif2shmimChunk::error)
+      {
+         std::cerr << " (" << invokedName << "): " << chunk.m_error << "\n";
+         result = -1;
+         break;
+      }
+
+      if(state == xrif2shmimChunk::empty) break; //All played
+
+      //Don't burst the frames that were held up by the decoding thread.
+      if(underrun)
+      {
+         int64_t now = monotonicNs();
+         if(now > deadline) deadline = now;
+      }
+
+      MagAOX::sys::xrifArchive & archive = chunk.m_archive;
+
+      if(!created)
+      {
+         m_width = archive.width();
+         m_height = archive.height();
+         m_dataType = archive.typeCode();
+         m_typeSize = xrif_typesize(m_dataType);
+
+         createStream();
+         created = true;
+
+         deadline = monotonicNs();
+      }
+      else if(archive.width() != m_width || archive.height() != m_height || archive.typeCode() != m_dataType)
+      {
+         std::cerr << " (" << invokedName << "): size or data type mis-match in " << m_files[chunk.m_fileNo] << "\n";
+         result = -1;
+         break;
+      }
+
+      if(archive.depth() != 1)
+      {
+         std::cerr << " (" << invokedName << "): Cubes detected in " << m_files[chunk.m_fileNo] << "\n";
+         result = -1;
+         break;
+      }
+
+      size_t frameSize = m_width*m_height*m_typeSize;
+
+      for(uint64_t p = 0; p < archive.frames() && g_timeToDie == false; ++p)
+      {
+         uint64_t * curr_timing = chunk.m_timing.data() + 5*p;
+
+         timespec atime;
+         atime.tv_sec = curr_timing[1];
+         atime.tv_nsec = curr_timing[2];
+
+         //The first frame goes out now, the rest at their deadlines.
+         if(m_played > 0)
+         {
+            int64_t interval = period;
+
+            if(m_realtime)
+            {
+               interval = (atime.tv_sec - lastAtime.tv_sec)*1000000000 + (atime.tv_nsec - lastAtime.tv_nsec);
+
+               //Going around the loop again there is no real interval
+               if(interval < 0 || (p == 0 && chunk.m_rebase)) interval = lastInterval;
+
+               if(m_maxGap > 0 && interval > m_maxGap*1e9) interval = m_maxGap*1e9;
+
+               lastInterval = interval;
+               interval /= m_speed;
+            }
+
+            deadline += interval;
+            waitUntil(deadline);
+         }
+
+         publish(chunk.m_image.data() + p*frameSize, m_preserveTime ? &atime : nullptr);
+
+         lastAtime = atime;
+      }
+
+      std::lock_guard<std::mutex> lock(m_ringMutex);
+      chunk.m_state = xrif2shmimChunk::empty;
+      m_ringCond.notify_all();
+   }
+
+   m_stopDecode = true;
+   decodeThread.join();
+
+   if(created) ImageStreamIO_destroyIm( &m_imageStream );
+
+   std::cerr << " (" << invokedName << "): played " << m_played << " frames, " << m_late << " late (max " << m_maxLate*1e3 << " ms), ";
+   std::cerr << m_underruns << " decode underruns\n";
+
+   if(result < 0) return result;
 
    std::cerr << " (" << invokedName << "): exited normally.\n";
 
@@ -0,0 +1,17 @@
+/** \file xrifCatalogBuild.cpp
+  * \brief The xrifCatalogBuild main program.
+  *
+  * \ingroup xrifCatalogBuild_files
+  */
+
+#include "xrifCatalogBuild.hpp"
+
+
+
+int main(int argc, char **argv)
+{
+   xrifCatalogBuild xcb;
+
+   return xcb.main(argc, argv);
+
+}
@@ -0,0 +1,132 @@
+/** \file xrifCatalogBuild.hpp
+  * \brief The xrifCatalogBuild class declaration and definition.
+  *
+  * \ingroup xrifCatalogBuild_files
+  */
+
+#ifndef xrifCatalogBuild_hpp
+#define xrifCatalogBuild_hpp
+
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <mx/app/application.hpp>
+
+#include "../../libMagAOX/libMagAOX.hpp"
+
+/** \defgroup xrifCatalogBuild xrifCatalogBuild: xrif-archive catalog builder
+  * \brief Rebuild the catalog of the xrif archives in a raw image directory.
+  *
+  * <a href="../handbook/utils/xrifCatalogBuild.html">Utility Documentation</a>
+  *
+  * \ingroup utils
+  *
+  */
+
+/** \defgroup xrifCatalogBuild_files xrifCatalogBuild Files
+  * \ingroup xrifCatalogBuild
+  */
+
+/// A utility to rebuild the catalog of the xrif archives in a directory.
+/** The streamWriter adds each archive to the catalog as it is written.  This rebuilds the catalog of a directory from
+  * the archives themselves, for directories written before the catalog existed, or after archives are moved.  See
+  * MagAOX::sys::xrifCatalog.
+  *
+  * \ingroup xrifCatalogBuild
+  */
+class xrifCatalogBuild : public mx::app::application
+{
+protected:
+   /** \name Configurable Parameters
+     * @{
+     */
+
+   std::string m_dir {"./"}; ///< The directory of archives.  Default is the current directory.
+
+   bool m_update {false}; ///< If true, only archives missing from the existing catalog are scanned.
+
+   bool m_list {false}; ///< If true, the catalog is printed.
+
+   bool m_dryRun {false}; ///< If true, the catalog file is not written.
+
+   ///@}
+
+public:
+
+   virtual void setupConfig();
+
+   virtual void loadConfig();
+
+   virtual int execute();
+};
+
+inline
+void xrifCatalogBuild::setupConfig()
+{
+   config.add("dir","d", "dir" , argType::Required, "", "dir", false,  "string", "The directory of archives.  Default is the current directory.");
+   config.add("update","u", "update" , argType::True, "", "update", false,  "bool", "If set or true, only the archives missing from the existing catalog are scanned.  By default all archives are scanned.");
+   config.add("list","l", "list" , argType::True, "", "list", false,  "bool", "If set or true, print the catalog.");
+   config.add("dryRun","n", "dryRun" , argType::True, "", "dryRun", false,  "bool", "If set or true, do not write the catalog file.");
+}
+
+inline
+void xrifCatalogBuild::loadConfig()
+{
+   config(m_dir, "dir");
+   config(m_update, "update");
+   config(m_list, "list");
+   config(m_dryRun, "dryRun");
+}
+
+inline
+int xrifCatalogBuild::execute()
+{
+   if(m_dir == "") m_dir = "./";
+
+   MagAOX::sys::xrifCatalog catalog;
+   std::vector<std::string> errMsgs;
+
+   int nerr = catalog.rebuild(errMsgs, m_dir, m_update);
+
+   for(size_t n=0; n < errMsgs.size(); ++n)
+   {
+      std::cerr << " (" << invokedName << "): " << errMsgs[n] << "\n";
+   }
+
+   if(m_list)
+   {
+      const std::vector<MagAOX::sys::xrifCatalogEntry> & entries = catalog.entries();
+
+      for(size_t n=0; n < entries.size(); ++n)
+      {
+         const MagAOX::sys::xrifCatalogEntry & e = entries[n];
+
+         std::cout << e.m_file << "  " << e.m_width << "x" << e.m_height << "  frames: " << e.m_frames;
+         std::cout << " (" << e.m_cnt0First << "-" << e.m_cnt0Last << ")  dropped: " << e.dropped();
+         std::cout << "  ratio: " << std::fixed << std::setprecision(3) << e.ratio() << "\n";
+         std::cout.unsetf(std::ios_base::floatfield);
+      }
+   }
+
+   if(!m_dryRun)
+   {
+      if(catalog.save() < 0)
+      {
+         std::cerr << " (" << invokedName << "): error writing " << MagAOX::sys::xrifCatalog::catalogPath(catalog.dir());
+         std::cerr << ": " << strerror(errno) << "\n";
+         return -1;
+      }
+   }
+
+   std::cerr << " (" << invokedName << "): " << catalog.entries().size() << " archives in catalog of " << catalog.dir();
+   if(nerr > 0) std::cerr << ", " << nerr << " could not be read";
+   std::cerr << "\n";
+
+   return (nerr > 0) ? -1 : 0;
+}
+
+#endif //xrifCatalogBuild_hpp